@@ -0,0 +1,180 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "adc_input.h"
+
+#include <string.h>
+
+/*
+ * Oversampling of the throttle and brake inputs. The ADC samples the inputs
+ * in every PWM cycle anyway, so instead of using only the sample that
+ * happens to be there when the app runs, every sample goes through a CIC
+ * decimator. That averages out the noise and the switching ripple, and gives
+ * a value with more than 12 bits of resolution at the rate of the app. The
+ * decimator only needs additions per sample, so it can run in the PWM
+ * interrupt.
+ *
+ * A signal that stays outside of the configured range for some time is
+ * taken as an open or shorted input.
+ */
+
+/**
+ * Initialize a channel.
+ *
+ * @param ch
+ * The channel.
+ *
+ * @param decimation
+ * The number of samples per output, 1 to ADC_INPUT_DECIMATION_MAX. Fault
+ * detection is disabled.
+ */
+void adc_input_init(adc_input_ch *ch, int decimation) {
+	memset(ch, 0, sizeof(adc_input_ch));
+
+	if (decimation < 1) {
+		decimation = 1;
+	} else if (decimation > ADC_INPUT_DECIMATION_MAX) {
+		decimation = ADC_INPUT_DECIMATION_MAX;
+	}
+
+	ch->decimation = decimation;
+	ch->fault_low = 1.0;
+	ch->fault_high = 0.0;
+}
+
+/**
+ * Set the range outside of which the input is faulty.
+ *
+ * @param low
+ * Outputs below this are a low fault, in ADC counts.
+ *
+ * @param high
+ * Outputs above this are a high fault, in ADC counts. Set below low to
+ * disable fault detection.
+ *
+ * @param outputs
+ * The number of outputs in a row that must be out of range for a fault to
+ * be set, and back in range for it to be cleared.
+ */
+void adc_input_set_fault_limits(adc_input_ch *ch, float low, float high, int outputs) {
+	ch->fault_low = low;
+	ch->fault_high = high;
+	ch->fault_outputs = outputs > 1 ? outputs : 1;
+
+	if (low > high) {
+		ch->fault = ADC_INPUT_FAULT_NONE;
+		ch->fault_pending = ADC_INPUT_FAULT_NONE;
+		ch->fault_outputs_now = 0;
+	}
+}
+
+static void update_fault(adc_input_ch *ch) {
+	if (ch->fault_low > ch->fault_high) {
+		return;
+	}
+
+	adc_input_fault now = ADC_INPUT_FAULT_NONE;
+	if (ch->value < ch->fault_low) {
+		now = ADC_INPUT_FAULT_LOW;
+	} else if (ch->value > ch->fault_high) {
+		now = ADC_INPUT_FAULT_HIGH;
+	}
+
+	if (now == ch->fault) {
+		ch->fault_outputs_now = 0;
+		return;
+	}
+
+	if (now != ch->fault_pending) {
+		ch->fault_pending = now;
+		ch->fault_outputs_now = 0;
+	}
+
+	ch->fault_outputs_now++;
+
+	if (ch->fault_outputs_now >= ch->fault_outputs) {
+		ch->fault = now;
+		ch->fault_outputs_now = 0;
+		if (now != ADC_INPUT_FAULT_NONE) {
+			ch->fault_cnt++;
+		}
+	}
+}
+
+/**
+ * Add a sample.
+ *
+ * @return
+ * true when a new output was made. It is then in ch->value.
+ */
+bool adc_input_add(adc_input_ch *ch, uint16_t sample) {
+	// The integrators wrap around, which the combs undo as long as the
+	// output fits in 32 bits.
+	uint32_t acc = sample;
+	for (int i = 0;i < ADC_INPUT_CIC_ORDER;i++) {
+		ch->integ[i] += acc;
+		acc = ch->integ[i];
+	}
+
+	if (++ch->sample_cnt < ch->decimation) {
+		return false;
+	}
+
+	ch->sample_cnt = 0;
+
+	for (int i = 0;i < ADC_INPUT_CIC_ORDER;i++) {
+		uint32_t in = acc;
+		acc = in - ch->comb[i];
+		ch->comb[i] = in;
+	}
+
+	// The combs need one output to get their delay filled
+	if (!ch->primed) {
+		ch->primed = true;
+		return false;
+	}
+
+	float gain = 1.0;
+	for (int i = 0;i < ADC_INPUT_CIC_ORDER;i++) {
+		gain *= (float)ch->decimation;
+	}
+
+	ch->value = (float)acc / gain;
+	ch->output_cnt++;
+	update_fault(ch);
+
+	return true;
+}
+
+/**
+ * Set the output directly, e.g. from a single sample when the samples are not
+ * coming. The fault detection runs as for a decimated output.
+ */
+void adc_input_set(adc_input_ch *ch, float value) {
+	ch->value = value;
+	update_fault(ch);
+}
+
+const char *adc_input_fault_to_string(adc_input_fault fault) {
+	switch (fault) {
+	case ADC_INPUT_FAULT_LOW: return "Low (open or shorted to ground)";
+	case ADC_INPUT_FAULT_HIGH: return "High (shorted to supply)";
+	default: return "None";
+	}
+}
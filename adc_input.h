@@ -0,0 +1,66 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef ADC_INPUT_H_
+#define ADC_INPUT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// With 12 bit samples the CIC registers grow by 2 * log2(decimation) bits
+// and must fit in 32 bits.
+#define ADC_INPUT_CIC_ORDER			2
+#define ADC_INPUT_DECIMATION_MAX	1024
+
+typedef enum {
+	ADC_INPUT_FAULT_NONE = 0,
+	ADC_INPUT_FAULT_LOW, // Open, or shorted to ground
+	ADC_INPUT_FAULT_HIGH // Shorted to the supply
+} adc_input_fault;
+
+typedef struct {
+	// CIC decimator
+	int decimation;
+	int sample_cnt;
+	uint32_t integ[ADC_INPUT_CIC_ORDER];
+	uint32_t comb[ADC_INPUT_CIC_ORDER];
+	bool primed;
+
+	// Last output, in ADC counts with fractional bits
+	float value;
+	uint32_t output_cnt;
+
+	// Fault detection in ADC counts. Disabled when low > high.
+	float fault_low;
+	float fault_high;
+	int fault_outputs; // Outputs out of range before there is a fault
+	int fault_outputs_now;
+	adc_input_fault fault_pending;
+	adc_input_fault fault;
+	uint32_t fault_cnt;
+} adc_input_ch;
+
+// Functions
+void adc_input_init(adc_input_ch *ch, int decimation);
+bool adc_input_add(adc_input_ch *ch, uint16_t sample);
+void adc_input_set(adc_input_ch *ch, float value);
+void adc_input_set_fault_limits(adc_input_ch *ch, float low, float high, int outputs);
+const char *adc_input_fault_to_string(adc_input_fault fault);
+
+#endif /* ADC_INPUT_H_ */
@@ -82,6 +82,10 @@ void app_set_configuration(app_configuration *conf) {
 	// Configure balance app before starting it.
 	app_balance_configure(&appconf.app_balance_conf, &appconf.imu_conf);
 
+	if (app_stops_i2c()) {
+		hw_stop_i2c();
+	}
+
 	switch (appconf.app_to_use) {
 	case APP_PPM:
 		app_ppm_start();
@@ -92,18 +96,15 @@ void app_set_configuration(app_configuration *conf) {
 		break;
 
 	case APP_UART:
-		hw_stop_i2c();
 		app_uartcomm_start(UART_PORT_COMM_HEADER);
 		break;
 
 	case APP_PPM_UART:
-		hw_stop_i2c();
 		app_ppm_start();
 		app_uartcomm_start(UART_PORT_COMM_HEADER);
 		break;
 
 	case APP_ADC_UART:
-		hw_stop_i2c();
 		app_adc_start(false);
 		app_uartcomm_start(UART_PORT_COMM_HEADER);
 		break;
@@ -115,7 +116,6 @@ void app_set_configuration(app_configuration *conf) {
 	case APP_BALANCE:
 		app_balance_start();
 		if(appconf.imu_conf.type == IMU_TYPE_INTERNAL){
-			hw_stop_i2c();
 			app_uartcomm_start(UART_PORT_COMM_HEADER);
 		}
 		break;
@@ -138,7 +138,6 @@ void app_set_configuration(app_configuration *conf) {
 
 	case APP_CUSTOM:
 #ifdef APP_CUSTOM_TO_USE
-		hw_stop_i2c();
 		app_custom_start();
 #endif
 		break;
@@ -216,6 +215,33 @@ unsigned app_calc_crc(app_configuration* conf) {
 	return crc_new;
 }
 
+/**
+ * Check if the current app stops the I2C peripheral, e.g. to use its pins for
+ * the UART. Drivers that want to keep using the I2C port then have to
+ * bit-bang it.
+ */
+bool app_stops_i2c(void) {
+	switch (appconf.app_to_use) {
+	case APP_UART:
+	case APP_PPM_UART:
+	case APP_ADC_UART:
+		return true;
+
+	case APP_BALANCE:
+		return appconf.imu_conf.type == IMU_TYPE_INTERNAL;
+
+	case APP_CUSTOM:
+#ifdef APP_CUSTOM_TO_USE
+		return true;
+#else
+		return false;
+#endif
+
+	default:
+		return false;
+	}
+}
+
 /**
  * Report whether the current app is "running"
  */
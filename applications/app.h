@@ -29,6 +29,7 @@ void app_disable_output(int time_ms);
 bool app_is_output_disabled(void);
 unsigned app_calc_crc(app_configuration* conf);
 bool app_is_running(void);
+bool app_stops_i2c(void);
 
 // Standard apps
 void app_ppm_start(void);
@@ -55,6 +56,7 @@ void app_uartcomm_start(UART_PORT port_number);
 void app_uartcomm_stop(UART_PORT port_number);
 void app_uartcomm_configure(uint32_t baudrate, bool permanent_enabled, UART_PORT port_number);
 void app_uartcomm_send_packet(unsigned char *data, unsigned int len,  UART_PORT port_number);
+void app_uartcomm_write(unsigned char *data, unsigned int len, UART_PORT port_number);
 
 void app_nunchuk_start(void);
 void app_nunchuk_stop(void);
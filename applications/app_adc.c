@@ -26,7 +26,11 @@
 #include "timeout.h"
 #include "utils.h"
 #include "comm_can.h"
+#include "torque_vectoring.h"
 #include "hw.h"
+#include "adc_input.h"
+#include "terminal.h"
+#include "commands.h"
 #include <math.h>
 
 // Settings
@@ -35,10 +39,13 @@
 #define FILTER_SAMPLES					5
 #define RPM_FILTER_SAMPLES				8
 #define TC_DIFF_MAX_PASS				60  // TODO: move to app_conf
+#define FAULT_TIME						0.05 // Time the input has to be out of range for a fault
+#define VOLTS_TO_COUNTS(v)				((v) / ADC_COUNTS_TO_VOLTS(1.0))
 
 // Threads
 static THD_FUNCTION(adc_thread, arg);
 static THD_WORKING_AREA(adc_thread_wa, 1024);
+static thread_t *adc_tp = 0;
 
 // Private variables
 static volatile adc_config config;
@@ -50,6 +57,14 @@ static volatile float read_voltage2 = 0.0;
 static volatile bool use_rx_tx_as_buttons = false;
 static volatile bool stop_now = true;
 static volatile bool is_running = false;
+static adc_input_ch m_input[2];
+static volatile float m_input_rate = 0.0;
+static volatile bool m_oversampled = false;
+
+// Private functions
+static void adc_sample(void);
+static void update_input(systime_t sleep_time);
+static void terminal_input(int argc, const char **argv);
 
 void app_adc_configure(adc_config *conf) {
 	config = *conf;
@@ -90,6 +105,7 @@ static THD_FUNCTION(adc_thread, arg) {
 	(void)arg;
 
 	chRegSetThreadName("APP_ADC");
+	adc_tp = chThdGetSelfX();
 
 	// Set servo pin as an input with pullup
 	if (use_rx_tx_as_buttons) {
@@ -99,7 +115,19 @@ static THD_FUNCTION(adc_thread, arg) {
 		palSetPadMode(HW_ICU_GPIO, HW_ICU_PIN, PAL_MODE_INPUT_PULLUP);
 	}
 
+	adc_input_init(&m_input[0], 1);
+	adc_input_init(&m_input[1], 1);
+	m_input_rate = 0.0;
+	mc_interface_set_adc_sample_callback(adc_sample);
+
+	terminal_register_command_callback(
+			"adc_input",
+			"Print the oversampling and the fault state of the ADC app inputs",
+			0,
+			terminal_input);
+
 	is_running = true;
+	systime_t loop_time = chVTGetSystemTimeX();
 
 	for(;;) {
 		// Sleep for a time according to the specified rate
@@ -109,9 +137,23 @@ static THD_FUNCTION(adc_thread, arg) {
 		if (sleep_time == 0) {
 			sleep_time = 1;
 		}
-		chThdSleep(sleep_time);
+
+		update_input(sleep_time);
+
+		// The inputs are oversampled in every PWM cycle and decimated to the
+		// update rate, and a new value comes with an event. Read the ADC
+		// here if that stops, e.g. when the motor timer is not running.
+		bool oversampled = chEvtWaitAnyTimeout((eventmask_t)1, sleep_time * 2) != 0 &&
+				m_input[0].output_cnt > 0;
+		m_oversampled = oversampled;
+
+		// The wait is not always sleep_time long, so use the time that has passed
+		systime_t time_now = chVTGetSystemTimeX();
+		float elapsed_ms = (1000.0 * (float)(time_now - loop_time)) / (float)CH_CFG_ST_FREQUENCY;
+		loop_time = time_now;
 
 		if (stop_now) {
+			mc_interface_set_adc_sample_callback(0);
 			is_running = false;
 			return;
 		}
@@ -121,8 +163,19 @@ static THD_FUNCTION(adc_thread, arg) {
 			ms_without_power = 0;
 		}
 
+		// Without oversampling the pins are read directly, and the readings
+		// go through the same fault detection.
+		if (!oversampled) {
+			chSysLock();
+			adc_input_set(&m_input[0], ADC_Value[ADC_IND_EXT]);
+#ifdef ADC_IND_EXT2
+			adc_input_set(&m_input[1], ADC_Value[ADC_IND_EXT2]);
+#endif
+			chSysUnlock();
+		}
+
 		// Read the external ADC pin voltage
-		float pwr = ADC_VOLTS(ADC_IND_EXT);
+		float pwr = oversampled ? ADC_COUNTS_TO_VOLTS(m_input[0].value) : ADC_VOLTS(ADC_IND_EXT);
 		read_voltage = pwr;
 
 		// Optionally apply a filter
@@ -168,7 +221,7 @@ static THD_FUNCTION(adc_thread, arg) {
 
 		// Read the external ADC pin and convert the value to a voltage.
 #ifdef ADC_IND_EXT2
-		float brake = ADC_VOLTS(ADC_IND_EXT2);
+		float brake = oversampled ? ADC_COUNTS_TO_VOLTS(m_input[1].value) : ADC_VOLTS(ADC_IND_EXT2);
 #else
 		float brake = 0.0;
 #endif
@@ -234,6 +287,28 @@ static THD_FUNCTION(adc_thread, arg) {
 			continue;
 		}
 
+		// Release the motor while an input is open or shorted. With safe start the
+		// throttle has to be released after that.
+		if (m_input[0].fault != ADC_INPUT_FAULT_NONE ||
+				m_input[1].fault != ADC_INPUT_FAULT_NONE) {
+			ms_without_power = 0;
+			brake = 0.0;
+
+			switch (config.ctrl_type) {
+			case ADC_CTRL_TYPE_CURRENT_REV_CENTER:
+			case ADC_CTRL_TYPE_CURRENT_REV_BUTTON_BRAKE_CENTER:
+			case ADC_CTRL_TYPE_CURRENT_NOREV_BRAKE_CENTER:
+			case ADC_CTRL_TYPE_DUTY_REV_CENTER:
+			case ADC_CTRL_TYPE_PID_REV_CENTER:
+				pwr = 0.5;
+				break;
+
+			default:
+				pwr = 0.0;
+				break;
+			}
+		}
+
 		switch (config.ctrl_type) {
 		case ADC_CTRL_TYPE_CURRENT_REV_CENTER:
 		case ADC_CTRL_TYPE_CURRENT_REV_BUTTON_BRAKE_CENTER:
@@ -298,7 +373,7 @@ static THD_FUNCTION(adc_thread, arg) {
 			current_rel = pwr;
 
 			if (fabsf(pwr) < 0.001) {
-				ms_without_power += (1000.0 * (float)sleep_time) / (float)CH_CFG_ST_FREQUENCY;
+				ms_without_power += elapsed_ms;
 			}
 			break;
 
@@ -320,7 +395,7 @@ static THD_FUNCTION(adc_thread, arg) {
 			}
 
 			if (pwr < 0.001) {
-				ms_without_power += (1000.0 * (float)sleep_time) / (float)CH_CFG_ST_FREQUENCY;
+				ms_without_power += elapsed_ms;
 			}
 
 			if ((config.ctrl_type == ADC_CTRL_TYPE_CURRENT_REV_BUTTON_BRAKE_ADC ||
@@ -333,7 +408,7 @@ static THD_FUNCTION(adc_thread, arg) {
 		case ADC_CTRL_TYPE_DUTY_REV_CENTER:
 		case ADC_CTRL_TYPE_DUTY_REV_BUTTON:
 			if (fabsf(pwr) < 0.001) {
-				ms_without_power += (1000.0 * (float)sleep_time) / (float)CH_CFG_ST_FREQUENCY;
+				ms_without_power += elapsed_ms;
 			}
 
 			if (!(ms_without_power < MIN_MS_WITHOUT_POWER && config.safe_start)) {
@@ -364,7 +439,7 @@ static THD_FUNCTION(adc_thread, arg) {
 			}
 
 			if (fabsf(pwr) < 0.001) {
-				ms_without_power += (1000.0 * (float)sleep_time) / (float)CH_CFG_ST_FREQUENCY;
+				ms_without_power += elapsed_ms;
 			}
 			break;
 
@@ -487,8 +562,11 @@ static THD_FUNCTION(adc_thread, arg) {
 					rpm_lowest = -rpm_lowest;
 				}
 
-				// Traction control
-				if (config.multi_esc) {
+				// Let the coordinator distribute the current over all ESCs
+				if (config.multi_esc && torque_vectoring_is_enabled()) {
+					current_out = torque_vectoring_apply(current_rel, is_reverse);
+				} else if (config.multi_esc) {
+					// Traction control
 					for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
 						can_status_msg *msg = comm_can_get_status_msg_index(i);
 
@@ -530,3 +608,87 @@ static THD_FUNCTION(adc_thread, arg) {
 		}
 	}
 }
+
+static void adc_sample(void) {
+	if (!adc_tp) {
+		return;
+	}
+
+	bool new_value = adc_input_add(&m_input[0], ADC_Value[ADC_IND_EXT]);
+#ifdef ADC_IND_EXT2
+	adc_input_add(&m_input[1], ADC_Value[ADC_IND_EXT2]);
+#endif
+
+	if (new_value) {
+		chSysLockFromISR();
+		chEvtSignalI(adc_tp, (eventmask_t) 1);
+		chSysUnlockFromISR();
+	}
+}
+
+static void set_fault_limits(adc_input_ch *in, bool enabled, float v1, float v2, float v3, int outputs) {
+	float low = fminf(v1, fminf(v2, v3));
+	float high = fmaxf(v1, fmaxf(v2, v3));
+	float margin = fmaxf((high - low) * APP_ADC_FAULT_MARGIN, 0.1);
+
+	if (!enabled || APP_ADC_FAULT_MARGIN <= 0.0) {
+		low = 1.0;
+		high = 0.0;
+		margin = 0.0;
+	}
+
+	chSysLock();
+	adc_input_set_fault_limits(in, VOLTS_TO_COUNTS(low - margin), VOLTS_TO_COUNTS(high + margin), outputs);
+	chSysUnlock();
+}
+
+/*
+ * Decimate to the update rate at the current sampling frequency, and check
+ * the inputs against the configured voltages.
+ */
+static void update_input(systime_t sleep_time) {
+	float f_samp = mc_interface_get_sampling_frequency_now();
+	float rate_target = (float)CH_CFG_ST_FREQUENCY / (float)sleep_time;
+	int decimation = (int)(f_samp / rate_target + 0.5);
+	utils_truncate_number_int(&decimation, 1, ADC_INPUT_DECIMATION_MAX);
+
+	if (decimation != m_input[0].decimation) {
+		chSysLock();
+		adc_input_init(&m_input[0], decimation);
+		adc_input_init(&m_input[1], decimation);
+		chSysUnlock();
+	}
+
+	m_input_rate = f_samp / (float)decimation;
+
+	// Without oversampling the pins are read once every wait timeout, which is two sleep times
+	float fault_rate = m_oversampled ? m_input_rate : rate_target / 2.0;
+	int outputs = (int)(FAULT_TIME * fault_rate);
+
+	bool uses_brake = config.ctrl_type == ADC_CTRL_TYPE_CURRENT_NOREV_BRAKE_ADC ||
+			config.ctrl_type == ADC_CTRL_TYPE_CURRENT_REV_BUTTON_BRAKE_ADC;
+
+	set_fault_limits(&m_input[0], config.ctrl_type != ADC_CTRL_TYPE_NONE,
+			config.voltage_start, config.voltage_end, config.voltage_center, outputs);
+	set_fault_limits(&m_input[1], uses_brake,
+			config.voltage2_start, config.voltage2_end, config.voltage2_start, outputs);
+}
+
+static void terminal_input(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	commands_printf("Output rate : %.1f Hz", (double)m_input_rate);
+	commands_printf("Decimation  : %d samples", m_input[0].decimation);
+
+	for (int i = 0;i < 2;i++) {
+		adc_input_ch *in = &m_input[i];
+		commands_printf("ADC%d        : %.4f V, Fault: %s, Fault count: %u",
+				i + 1,
+				(double)ADC_COUNTS_TO_VOLTS(in->value),
+				adc_input_fault_to_string(in->fault),
+				(unsigned int)in->fault_cnt);
+	}
+
+	commands_printf(" ");
+}
@@ -27,6 +27,8 @@
 #include "timeout.h"
 #include "utils.h"
 #include "comm_can.h"
+#include "torque_vectoring.h"
+#include "timer.h"
 #include <math.h>
 
 // Settings
@@ -103,6 +105,8 @@ static THD_FUNCTION(ppm_thread, arg) {
 	is_running = true;
 
 	for(;;) {
+		// Woken up by every new pulse or frame, the timeout keeps the ramping
+		// and the timeout going without input.
 		chEvtWaitAnyTimeout((eventmask_t)1, MS2ST(2));
 
 		if (stop_now) {
@@ -175,7 +179,7 @@ static THD_FUNCTION(ppm_thread, arg) {
 		servo_val = utils_throttle_curve(servo_val, config.throttle_exp, config.throttle_exp_brake, config.throttle_exp_mode);
 
 		// Apply ramping
-		static systime_t last_time = 0;
+		static uint32_t last_time = 0;
 		static float servo_val_ramp = 0.0;
 		float ramp_time = fabsf(servo_val) > fabsf(servo_val_ramp) ? config.ramp_time_pos : config.ramp_time_neg;
 
@@ -184,8 +188,8 @@ static THD_FUNCTION(ppm_thread, arg) {
 //			ramp_time = fminf(config.ramp_time_pos, config.ramp_time_neg);
 //		}
 
-		const float dt = (float)ST2MS(chVTTimeElapsedSinceX(last_time)) / 1000.0;
-		last_time = chVTGetSystemTimeX();
+		const float dt = timer_seconds_elapsed_since(last_time);
+		last_time = timer_time_now();
 
 		if (ramp_time > 0.01) {
 			const float ramp_step = dt / ramp_time;
@@ -464,8 +468,12 @@ static THD_FUNCTION(ppm_thread, arg) {
 					servo_val = -servo_val;
 				}
 
-				// Send acceleration command to all ESCs seen recently on the CAN bus
-				if (config.multi_esc) {
+				// Let the coordinator distribute the current over all ESCs
+				if (config.multi_esc && torque_vectoring_is_enabled()) {
+					float current_rel = torque_vectoring_apply(servo_val, is_reverse);
+					current_out = servo_val > 0.0 ? current * current_rel / servo_val : 0.0;
+				} else if (config.multi_esc) {
+					// Send acceleration command to all ESCs seen recently on the CAN bus
 					if (config.tc) {
 						if(mc_interface_get_fault() != FAULT_CODE_NONE) {
 							autoTCdisengaged = true;
@@ -190,6 +190,22 @@ void app_uartcomm_send_packet(unsigned char *data, unsigned int len, UART_PORT p
 	chMtxUnlock(&send_mutex[port_number]);
 }
 
+// Raw bytes without packet framing. Nothing is written if the port is not running.
+void app_uartcomm_write(unsigned char *data, unsigned int len, UART_PORT port_number) {
+	if (port_number >= UART_NUMBER) {
+		return;
+	}
+
+	if (!send_mutex_init_done[port_number]) {
+		chMtxObjectInit(&send_mutex[port_number]);
+		send_mutex_init_done[port_number] = true;
+	}
+
+	chMtxLock(&send_mutex[port_number]);
+	write_packet(data, len, port_number);
+	chMtxUnlock(&send_mutex[port_number]);
+}
+
 void app_uartcomm_configure(uint32_t baudrate, bool enabled, UART_PORT port_number) {
 	if (port_number >= UART_NUMBER) {
 		return;
@@ -32,6 +32,11 @@
 #define DO_RESET_SEQ 0
 #endif
 
+/* Words packed into the data lane before being written as one block */
+#ifndef ADIV5_WRITE_BLOCK_WORDS
+#define ADIV5_WRITE_BLOCK_WORDS 32
+#endif
+
 /* All this should probably be defined in a dedicated ADIV5 header, so that they
  * are consistently named and accessible when needed in the codebase.
  */
@@ -232,7 +237,19 @@ void adiv5_ap_unref(ADIv5_AP_t *ap)
 
 void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
 {
+	if (addr == ADIV5_DP_SELECT) {
+		if (dp->select_valid && (dp->select == value))
+			return;
+		/* Another AP or bank, the cached CSW is not for it */
+		dp->csw_valid = false;
+	}
+
 	dp->low_access(dp, ADIV5_LOW_WRITE, addr, value);
+
+	if (addr == ADIV5_DP_SELECT) {
+		dp->select = value;
+		dp->select_valid = true;
+	}
 }
 
 static uint32_t adiv5_mem_read32(ADIv5_AP_t *ap, uint32_t addr)
@@ -543,7 +560,8 @@ void
 adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 					  size_t len, enum align align)
 {
-	uint32_t odest = dest;
+	uint32_t block[ADIV5_WRITE_BLOCK_WORDS];
+	size_t n = 0;
 
 	len >>= align;
 	ap_mem_access_setup(ap, dest, align);
@@ -564,11 +582,17 @@ adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 		}
 		src = (uint8_t *)src + (1 << align);
 		dest += (1 << align);
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, tmp);
+		block[n++] = tmp;
+
+		/* TAR only auto-increments within 1 kB, so the block has to
+		 * be sent before crossing into the next one */
+		bool wrap = (dest & 0x3ff) == 0;
+		if ((n == ADIV5_WRITE_BLOCK_WORDS) || wrap || (len == 0)) {
+			adiv5_dp_low_write_block(ap->dp, ADIV5_AP_DRW, block, n);
+			n = 0;
+		}
 
-		/* Check for 10 bit address overflow */
-		if ((dest ^ odest) & 0xfffffc00) {
-			odest = dest;
+		if (wrap && len) {
 			adiv5_dp_low_access(ap->dp,
 					ADIV5_LOW_WRITE, ADIV5_AP_TAR, dest);
 		}
@@ -584,9 +608,21 @@ adiv5_mem_write(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len)
 
 void adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 {
-	adiv5_dp_write(ap->dp, ADIV5_DP_SELECT,
+	ADIv5_DP_t *dp = ap->dp;
+
+	adiv5_dp_write(dp, ADIV5_DP_SELECT,
 			((uint32_t)ap->apsel << 24)|(addr & 0xF0));
-	adiv5_dp_write(ap->dp, addr, value);
+
+	if (addr == ADIV5_AP_CSW) {
+		if (dp->csw_valid && (dp->csw == value))
+			return;
+		adiv5_dp_write(dp, addr, value);
+		dp->csw = value;
+		dp->csw_valid = true;
+		return;
+	}
+
+	adiv5_dp_write(dp, addr, value);
 }
 
 uint32_t adiv5_ap_read(ADIv5_AP_t *ap, uint16_t addr)
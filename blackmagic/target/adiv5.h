@@ -130,6 +130,17 @@ typedef struct ADIv5_DP_s {
 	uint32_t (*low_access)(struct ADIv5_DP_s *dp, uint8_t RnW,
                                uint16_t addr, uint32_t value);
 	void (*abort)(struct ADIv5_DP_s *dp, uint32_t abort);
+	/* Optional, writes n values to the same register back to back */
+	void (*low_write_block)(struct ADIv5_DP_s *dp, uint16_t addr,
+	                        const uint32_t *values, size_t n);
+
+	/* Last values written to SELECT and to the CSW of the selected AP,
+	 * so that writes that change nothing can be skipped. Invalidated
+	 * when errors are cleared. */
+	bool select_valid;
+	bool csw_valid;
+	uint32_t select;
+	uint32_t csw;
 
 	union {
 		jtag_dev_t *dev;
@@ -153,6 +164,18 @@ static inline uint32_t adiv5_dp_low_access(struct ADIv5_DP_s *dp, uint8_t RnW,
 	return dp->low_access(dp, RnW, addr, value);
 }
 
+static inline void adiv5_dp_low_write_block(struct ADIv5_DP_s *dp, uint16_t addr,
+                                            const uint32_t *values, size_t n)
+{
+	if (dp->low_write_block) {
+		dp->low_write_block(dp, addr, values, n);
+		return;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		dp->low_access(dp, ADIV5_LOW_WRITE, addr, values[i]);
+}
+
 static inline void adiv5_dp_abort(struct ADIv5_DP_s *dp, uint32_t abort)
 {
 	return dp->abort(dp, abort);
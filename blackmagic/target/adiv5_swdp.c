@@ -40,6 +40,9 @@ static uint32_t adiv5_swdp_error(ADIv5_DP_t *dp);
 static uint32_t adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 				      uint16_t addr, uint32_t value);
 
+static void adiv5_swdp_low_write_block(ADIv5_DP_t *dp, uint16_t addr,
+				       const uint32_t *values, size_t n);
+
 static void adiv5_swdp_abort(ADIv5_DP_t *dp, uint32_t abort);
 
 int adiv5_swdp_scan(void)
@@ -78,6 +81,7 @@ int adiv5_swdp_scan(void)
 	dp->error = adiv5_swdp_error;
 	dp->low_access = adiv5_swdp_low_access;
 	dp->abort = adiv5_swdp_abort;
+	dp->low_write_block = adiv5_swdp_low_write_block;
 
 	adiv5_swdp_error(dp);
 	adiv5_dp_init(dp);
@@ -113,23 +117,29 @@ static uint32_t adiv5_swdp_error(ADIv5_DP_t *dp)
 	if(err & ADIV5_DP_CTRLSTAT_WDATAERR)
 		clr |= ADIV5_DP_ABORT_WDERRCLR;
 
-	adiv5_dp_write(dp, ADIV5_DP_ABORT, clr);
+	/* Nothing to clear in the common case, which saves a transaction
+	 * for each check */
+	if (clr)
+		adiv5_dp_write(dp, ADIV5_DP_ABORT, clr);
+
+	/* Whatever was written when the error occurred may not have taken
+	 * effect */
+	if (err || dp->fault) {
+		dp->select_valid = false;
+		dp->csw_valid = false;
+	}
+
 	dp->fault = 0;
 
 	return err;
 }
 
-static uint32_t adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
-				      uint16_t addr, uint32_t value)
+static uint32_t adiv5_swdp_request(uint8_t RnW, uint16_t addr)
 {
 	bool APnDP = addr & ADIV5_APnDP;
-	addr &= 0xff;
 	uint32_t request = 0x81;
-	uint32_t response = 0;
-	uint32_t ack;
-	platform_timeout timeout;
 
-	if(APnDP && dp->fault) return 0;
+	addr &= 0xff;
 
 	if(APnDP) request ^= 0x22;
 	if(RnW)   request ^= 0x24;
@@ -139,14 +149,46 @@ static uint32_t adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 	if((addr == 4) || (addr == 8))
 		request ^= 0x20;
 
-	platform_timeout_set(&timeout, 2000);
-	do {
+	return request;
+}
+
+/* Sends the request until it is not answered with WAIT. The timeout is
+ * only started on the first WAIT, as most requests are accepted at once. */
+static uint32_t adiv5_swdp_send_request(uint32_t request)
+{
+	uint32_t ack;
+	platform_timeout timeout;
+	bool timeout_set = false;
+
+	for (;;) {
 		swdptap_seq_out(request, 8);
 		ack = swdptap_seq_in(3);
-	} while (ack == SWDP_ACK_WAIT && !platform_timeout_is_expired(&timeout));
 
-	if (ack == SWDP_ACK_WAIT)
-		raise_exception(EXCEPTION_TIMEOUT, "SWDP ACK timeout");
+		if (ack != SWDP_ACK_WAIT)
+			break;
+
+		if (!timeout_set) {
+			platform_timeout_set(&timeout, 2000);
+			timeout_set = true;
+		} else if (platform_timeout_is_expired(&timeout)) {
+			raise_exception(EXCEPTION_TIMEOUT, "SWDP ACK timeout");
+			break;
+		}
+	}
+
+	return ack;
+}
+
+static uint32_t adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
+				      uint16_t addr, uint32_t value)
+{
+	bool APnDP = addr & ADIV5_APnDP;
+	uint32_t response = 0;
+	uint32_t ack;
+
+	if(APnDP && dp->fault) return 0;
+
+	ack = adiv5_swdp_send_request(adiv5_swdp_request(RnW, addr));
 
 	if(ack == SWDP_ACK_FAULT) {
 		dp->fault = 1;
@@ -177,6 +219,36 @@ static uint32_t adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 	return response;
 }
 
+/* Writes the values back to back, e.g. to DRW with auto-increment. The
+ * idle cycles are only sent after the last write, as the requests in
+ * between clock the previous one through. A FAULT ends the block and is
+ * left for the caller to find with the next sticky error check, like for
+ * single accesses. */
+static void adiv5_swdp_low_write_block(ADIv5_DP_t *dp, uint16_t addr,
+				       const uint32_t *values, size_t n)
+{
+	bool APnDP = addr & ADIV5_APnDP;
+	uint32_t request = adiv5_swdp_request(ADIV5_LOW_WRITE, addr);
+
+	if(APnDP && dp->fault) return;
+
+	for (size_t i = 0; i < n; i++) {
+		uint32_t ack = adiv5_swdp_send_request(request);
+
+		if(ack == SWDP_ACK_FAULT) {
+			dp->fault = 1;
+			break;
+		}
+
+		if(ack != SWDP_ACK_OK)
+			raise_exception(EXCEPTION_ERROR, "SWDP invalid ACK");
+
+		swdptap_seq_out_parity(values[i], 32);
+	}
+
+	swdptap_seq_out(0, 2);
+}
+
 static void adiv5_swdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, abort);
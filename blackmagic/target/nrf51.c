@@ -83,6 +83,10 @@ const struct command_s nrf51_read_cmd_list[] = {
 #define NRF51_PAGE_SIZE 1024
 #define NRF52_PAGE_SIZE 4096
 
+/* Data written per run of the flash stub. Fewer runs save the stub
+ * upload and the halt and resume around each of them. */
+#define NRF51_WRITE_BUF_SIZE 4096
+
 #define SRAM_BASE          0x20000000
 #define STUB_BUFFER_BASE   ALIGN(SRAM_BASE + sizeof(nrf51_flash_write_stub), 4)
 
@@ -99,6 +103,7 @@ static void nrf51_add_flash(target *t,
 	f->blocksize = erasesize;
 	f->erase = nrf51_flash_erase;
 	f->write = nrf51_flash_write;
+	f->buf_size = MIN(length, NRF51_WRITE_BUF_SIZE);
 	f->erased = 0xff;
 	target_add_flash(t, f);
 }
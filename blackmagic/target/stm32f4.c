@@ -95,6 +95,10 @@ static int stm32f4_flash_write(struct target_flash *f,
 #define SR_ERROR_MASK	0xF2
 #define SR_EOP		0x01
 
+/* Data written per programming sequence. Each one costs a few register
+ * accesses and a status poll. */
+#define STM32F4_WRITE_BUF_SIZE	4096
+
 #define F4_FLASHSIZE	0x1FFF7A22
 #define F7_FLASHSIZE	0x1FF0F442
 #define F72X_FLASHSIZE	0x1FF07A22
@@ -142,7 +146,7 @@ static void stm32f4_add_flash(target *t,
 	f->blocksize = blocksize;
 	f->erase = stm32f4_flash_erase;
 	f->write = stm32f4_flash_write;
-	f->buf_size = 1024;
+	f->buf_size = STM32F4_WRITE_BUF_SIZE;
 	f->erased = 0xff;
 	sf->base_sector = base_sector;
 	sf->bank_split = split;
@@ -434,17 +438,23 @@ static int stm32f4_flash_write(struct target_flash *f,
 	enum align psize = ((struct stm32f4_flash *)f)->psize;
 	target_mem_write32(t, FLASH_CR,
 					   (psize * FLASH_CR_PSIZE16) | FLASH_CR_PG);
-	cortexm_mem_write_sized(t, dest, src, len, psize);
+	if (cortexm_mem_write_sized(t, dest, src, len, psize)) {
+		DEBUG("stm32f4 flash write: comm error\n");
+		return -1;
+	}
 	/* Read FLASH_SR to poll for BSY bit */
-	/* Wait for completion or an error */
-	do {
+	/* Wait for completion or an error. The last word is usually done
+	 * by the time SR is read, so only sleep while it is not. */
+	for (;;) {
 		sr = target_mem_read32(t, FLASH_SR);
 		if(target_check_error(t)) {
 			DEBUG("stm32f4 flash write: comm error\n");
 			return -1;
 		}
+		if (!(sr & FLASH_SR_BSY))
+			break;
 		platform_delay(1); // Don't block thread.
-	} while (sr & FLASH_SR_BSY);
+	}
 
 	if (sr & SR_ERROR_MASK) {
 		DEBUG("stm32f4 flash write error 0x%" PRIx32 "\n", sr);
@@ -0,0 +1,251 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "bus_async.h"
+
+#include <string.h>
+
+/*
+ * Queue of I2C and SPI transfers. A transfer is submitted from any thread and
+ * finished with a callback from the thread that runs the bus, so that the
+ * caller does not have to wait for the bus. How the transfer is made is up
+ * to the backend, which can be bit-banging, a peripheral with DMA or a mock
+ * for the unit tests. This file does not depend on the RTOS, that is done in
+ * bus_thread.c.
+ */
+
+static void lock(bus_async *b) {
+	if (b->lock) {
+		b->lock();
+	}
+}
+
+static void unlock(bus_async *b) {
+	if (b->unlock) {
+		b->unlock();
+	}
+}
+
+/**
+ * Initialize a bus.
+ *
+ * @param b
+ * The bus.
+ *
+ * @param backend
+ * The backend to make the transfers with.
+ *
+ * @param ctx
+ * Given to the backend, e.g. the bit-banging state.
+ */
+void bus_async_init(bus_async *b, const bus_backend *backend, void *ctx) {
+	memset(b, 0, sizeof(bus_async));
+	b->backend = backend;
+	b->ctx = ctx;
+	b->retries = 1;
+}
+
+/**
+ * Queue a transfer. The transfer and its buffers must be valid until the
+ * callback, or until it has been cancelled.
+ *
+ * @param b
+ * The bus.
+ *
+ * @param x
+ * The transfer.
+ *
+ * @return
+ * false if the transfer is in a queue already.
+ */
+bool bus_async_submit(bus_async *b, bus_xfer *x) {
+	lock(b);
+
+	if (x->status == BUS_XFER_QUEUED || x->status == BUS_XFER_ACTIVE) {
+		unlock(b);
+		return false;
+	}
+
+	x->status = BUS_XFER_QUEUED;
+	x->next = 0;
+
+	if (b->tail) {
+		b->tail->next = x;
+	} else {
+		b->head = x;
+	}
+	b->tail = x;
+
+	unlock(b);
+
+	if (b->wake) {
+		b->wake(b);
+	}
+
+	return true;
+}
+
+/**
+ * Remove a transfer from the queue.
+ *
+ * @param b
+ * The bus.
+ *
+ * @param x
+ * The transfer.
+ *
+ * @return
+ * true if it was removed. false if it was not queued, or if it has been
+ * started already, in which case the callback will come.
+ */
+bool bus_async_cancel(bus_async *b, bus_xfer *x) {
+	bool res = false;
+
+	lock(b);
+
+	if (x->status == BUS_XFER_QUEUED) {
+		bus_xfer *prev = 0;
+		bus_xfer *now = b->head;
+
+		while (now) {
+			if (now == x) {
+				if (prev) {
+					prev->next = x->next;
+				} else {
+					b->head = x->next;
+				}
+
+				if (b->tail == x) {
+					b->tail = prev;
+				}
+
+				x->next = 0;
+				x->status = BUS_XFER_IDLE;
+				res = true;
+				break;
+			}
+
+			prev = now;
+			now = now->next;
+		}
+	}
+
+	unlock(b);
+
+	return res;
+}
+
+/**
+ * Fail all queued transfers without running them. The callbacks are called
+ * with ok set to false from the calling thread, so that anyone waiting for
+ * them is woken up.
+ *
+ * @param b
+ * The bus.
+ *
+ * @return
+ * The number of transfers that were failed.
+ */
+int bus_async_flush(bus_async *b) {
+	lock(b);
+	bus_xfer *x = b->head;
+	b->head = 0;
+	b->tail = 0;
+	unlock(b);
+
+	int cnt = 0;
+
+	while (x) {
+		bus_xfer *next = x->next;
+		x->next = 0;
+		x->status = BUS_XFER_FAILED;
+		cnt++;
+
+		if (x->done_cb) {
+			x->done_cb(x, false);
+		}
+
+		x = next;
+	}
+
+	return cnt;
+}
+
+bool bus_async_pending(bus_async *b) {
+	return b->head != 0;
+}
+
+/**
+ * Run queued transfers. Called from the thread that runs the bus.
+ *
+ * @param b
+ * The bus.
+ *
+ * @param max
+ * Run at most this many transfers, 0 runs until the queue is empty.
+ *
+ * @return
+ * The number of transfers that were run.
+ */
+int bus_async_process(bus_async *b, int max) {
+	int cnt = 0;
+
+	while (max <= 0 || cnt < max) {
+		lock(b);
+		bus_xfer *x = b->head;
+		if (x) {
+			b->head = x->next;
+			if (!b->head) {
+				b->tail = 0;
+			}
+			x->next = 0;
+			x->status = BUS_XFER_ACTIVE;
+		}
+		unlock(b);
+
+		if (!x) {
+			break;
+		}
+
+		bool ok = b->backend->transfer(b->ctx, x);
+
+		for (int i = 0;!ok && i < b->retries;i++) {
+			if (b->backend->recover) {
+				b->backend->recover(b->ctx);
+			}
+
+			b->retry_cnt++;
+			ok = b->backend->transfer(b->ctx, x);
+		}
+
+		b->xfer_cnt++;
+		if (!ok) {
+			b->fail_cnt++;
+		}
+
+		x->status = ok ? BUS_XFER_DONE : BUS_XFER_FAILED;
+		cnt++;
+
+		if (x->done_cb) {
+			x->done_cb(x, ok);
+		}
+	}
+
+	return cnt;
+}
@@ -0,0 +1,95 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef BUS_ASYNC_H_
+#define BUS_ASYNC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+	BUS_XFER_IDLE = 0,
+	BUS_XFER_QUEUED,
+	BUS_XFER_ACTIVE,
+	BUS_XFER_DONE,
+	BUS_XFER_FAILED
+} bus_xfer_status;
+
+typedef struct bus_xfer bus_xfer;
+
+/*
+ * A transfer writes txbytes and then reads rxbytes. On I2C that is a write
+ * followed by a repeated start and a read, and on SPI chip select is held
+ * over both.
+ */
+struct bus_xfer {
+	uint16_t addr;
+	const uint8_t *txbuf;
+	size_t txbytes;
+	uint8_t *rxbuf;
+	size_t rxbytes;
+	// Called from the thread that runs the bus when the transfer is done. The
+	// transfer can be submitted again from here.
+	void (*done_cb)(bus_xfer *x, bool ok);
+	void *arg;
+	volatile bus_xfer_status status;
+	bus_xfer *next;
+};
+
+typedef struct {
+	const char *name;
+	// Run a transfer to the end
+	bool (*transfer)(void *ctx, bus_xfer *x);
+	// Get the bus working again after an error, can be NULL
+	void (*recover)(void *ctx);
+} bus_backend;
+
+typedef struct bus_async bus_async;
+
+struct bus_async {
+	const bus_backend *backend;
+	void *ctx;
+	bus_xfer *head;
+	bus_xfer *tail;
+	int retries;
+
+	// Set by the platform. The lock protects the queue and wake is called
+	// when a transfer has been queued.
+	void (*lock)(void);
+	void (*unlock)(void);
+	void (*wake)(bus_async *b);
+
+	uint32_t xfer_cnt;
+	uint32_t fail_cnt;
+	uint32_t retry_cnt;
+
+	// List of buses run by the same thread
+	bus_async *next_bus;
+};
+
+// Functions
+void bus_async_init(bus_async *b, const bus_backend *backend, void *ctx);
+bool bus_async_submit(bus_async *b, bus_xfer *x);
+bool bus_async_cancel(bus_async *b, bus_xfer *x);
+int bus_async_flush(bus_async *b);
+bool bus_async_pending(bus_async *b);
+int bus_async_process(bus_async *b, int max);
+
+#endif /* BUS_ASYNC_H_ */
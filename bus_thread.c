@@ -0,0 +1,346 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "bus_thread.h"
+#include "terminal.h"
+#include "commands.h"
+
+/*
+ * Runs the transfers of all buses from one thread, and has the backends for
+ * bit-banging and for the I2C and SPI peripherals. The peripheral drivers
+ * use DMA and sleep while waiting, so with them a transfer costs almost no
+ * CPU time. The bit-banging backends still keep the CPU busy, but in this
+ * thread instead of in the thread that wanted the transfer.
+ */
+
+// Private variables
+static THD_WORKING_AREA(bus_thread_wa, 512);
+static thread_t *m_thd = 0;
+static binary_semaphore_t m_wake_sem;
+static mutex_t m_bus_mtx;
+static bus_async *m_buses = 0;
+
+// Private functions
+static THD_FUNCTION(bus_thread, arg);
+static void bus_lock(void);
+static void bus_unlock(void);
+static void bus_wake(bus_async *b);
+static bool bus_is_added(bus_async *b);
+static void sync_done(bus_xfer *x, bool ok);
+static void terminal_stats(int argc, const char **argv);
+
+static bool i2c_bb_transfer(void *ctx, bus_xfer *x);
+static void i2c_bb_recover(void *ctx);
+static bool i2c_hw_transfer(void *ctx, bus_xfer *x);
+static void i2c_hw_recover(void *ctx);
+static bool spi_bb_transfer(void *ctx, bus_xfer *x);
+static bool spi_hw_transfer(void *ctx, bus_xfer *x);
+
+const bus_backend bus_backend_i2c_bb = {"I2C bit-bang", i2c_bb_transfer, i2c_bb_recover};
+const bus_backend bus_backend_i2c_hw = {"I2C DMA", i2c_hw_transfer, i2c_hw_recover};
+const bus_backend bus_backend_spi_bb = {"SPI bit-bang", spi_bb_transfer, 0};
+const bus_backend bus_backend_spi_hw = {"SPI DMA", spi_hw_transfer, 0};
+
+/**
+ * Run a bus from the bus thread. The thread is started the first time.
+ *
+ * @param b
+ * The bus, initialized with bus_async_init.
+ */
+void bus_thread_add(bus_async *b) {
+	if (!m_thd) {
+		chBSemObjectInit(&m_wake_sem, true);
+		chMtxObjectInit(&m_bus_mtx);
+		m_thd = chThdCreateStatic(bus_thread_wa, sizeof(bus_thread_wa), NORMALPRIO, bus_thread, NULL);
+
+		terminal_register_command_callback(
+				"bus_stats",
+				"Print the transfer counts of the I2C and SPI buses",
+				0,
+				terminal_stats);
+	}
+
+	b->lock = bus_lock;
+	b->unlock = bus_unlock;
+	b->wake = bus_wake;
+
+	chMtxLock(&m_bus_mtx);
+	if (bus_is_added(b)) {
+		chMtxUnlock(&m_bus_mtx);
+		return;
+	}
+	b->next_bus = m_buses;
+	m_buses = b;
+	chMtxUnlock(&m_bus_mtx);
+
+	bus_wake(b);
+}
+
+/**
+ * Stop running a bus. Transfers that are left in its queue are not run, they
+ * fail with their callbacks called from here. When this returns the bus
+ * thread is done with the bus.
+ *
+ * @param b
+ * The bus.
+ */
+void bus_thread_remove(bus_async *b) {
+	if (!m_thd) {
+		return;
+	}
+
+	chMtxLock(&m_bus_mtx);
+	bus_async **now = &m_buses;
+	while (*now) {
+		if (*now == b) {
+			*now = b->next_bus;
+			b->next_bus = 0;
+			break;
+		}
+		now = &(*now)->next_bus;
+	}
+
+	// While holding the mutex, so that bus_thread_transfer can't queue
+	// anything that would never run.
+	bus_async_flush(b);
+	chMtxUnlock(&m_bus_mtx);
+}
+
+/**
+ * Make a transfer and wait for it to finish. The waiting thread sleeps, so
+ * with a DMA backend this costs almost no CPU time.
+ *
+ * @param b
+ * The bus.
+ *
+ * @param x
+ * The transfer. The callback and its argument are overwritten.
+ *
+ * @return
+ * true if the transfer was successful. false if it failed, or if the bus is
+ * not run by the bus thread.
+ */
+bool bus_thread_transfer(bus_async *b, bus_xfer *x) {
+	// Called from a callback, where waiting would never end
+	if (chThdGetSelfX() == m_thd) {
+		x->status = BUS_XFER_ACTIVE;
+		bool ok = b->backend->transfer(b->ctx, x);
+		x->status = ok ? BUS_XFER_DONE : BUS_XFER_FAILED;
+		return ok;
+	}
+
+	binary_semaphore_t sem;
+	chBSemObjectInit(&sem, true);
+	x->done_cb = sync_done;
+	x->arg = &sem;
+
+	if (!m_thd) {
+		return false;
+	}
+
+	chMtxLock(&m_bus_mtx);
+	bool ok = bus_is_added(b) && bus_async_submit(b, x);
+	chMtxUnlock(&m_bus_mtx);
+
+	if (!ok) {
+		return false;
+	}
+
+	// The backends have timeouts, and bus_thread_remove fails what is left
+	// in the queue, so this does not wait forever
+	chBSemWait(&sem);
+
+	return x->status == BUS_XFER_DONE;
+}
+
+static THD_FUNCTION(bus_thread, arg) {
+	(void)arg;
+
+	chRegSetThreadName("Bus");
+
+	for(;;) {
+		chBSemWait(&m_wake_sem);
+
+		// Take turns between the buses, so that one of them can't hold up
+		// the others with a long queue.
+		bool pending = true;
+		while (pending) {
+			pending = false;
+
+			chMtxLock(&m_bus_mtx);
+			for (bus_async *b = m_buses;b;b = b->next_bus) {
+				bus_async_process(b, 1);
+				if (bus_async_pending(b)) {
+					pending = true;
+				}
+			}
+			chMtxUnlock(&m_bus_mtx);
+		}
+	}
+}
+
+static void bus_lock(void) {
+	chSysLock();
+}
+
+static void bus_unlock(void) {
+	chSysUnlock();
+}
+
+static void bus_wake(bus_async *b) {
+	(void)b;
+	chBSemSignal(&m_wake_sem);
+}
+
+// Call with m_bus_mtx locked
+static bool bus_is_added(bus_async *b) {
+	for (bus_async *now = m_buses;now;now = now->next_bus) {
+		if (now == b) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void sync_done(bus_xfer *x, bool ok) {
+	(void)ok;
+	chBSemSignal((binary_semaphore_t*)x->arg);
+}
+
+static void terminal_stats(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	chMtxLock(&m_bus_mtx);
+	for (bus_async *b = m_buses;b;b = b->next_bus) {
+		commands_printf("%-14s Transfers: %u, Failed: %u, Retries: %u",
+				b->backend->name,
+				(unsigned int)b->xfer_cnt,
+				(unsigned int)b->fail_cnt,
+				(unsigned int)b->retry_cnt);
+	}
+	chMtxUnlock(&m_bus_mtx);
+	commands_printf(" ");
+}
+
+static bool i2c_bb_transfer(void *ctx, bus_xfer *x) {
+	i2c_bb_state *s = (i2c_bb_state*)ctx;
+	s->has_error = false;
+	return i2c_bb_tx_rx(s, x->addr, (uint8_t*)x->txbuf, x->txbytes, x->rxbuf, x->rxbytes);
+}
+
+static void i2c_bb_recover(void *ctx) {
+	i2c_bb_restore_bus((i2c_bb_state*)ctx);
+}
+
+static bool i2c_hw_transfer(void *ctx, bus_xfer *x) {
+	bus_i2c_hw *h = (bus_i2c_hw*)ctx;
+	uint8_t tmp[2];
+	uint8_t *rxbuf = x->rxbuf;
+	size_t rxbytes = x->rxbytes;
+
+	// The DMA driver can't receive a single byte, so read one more
+	if (rxbytes == 1) {
+		rxbuf = tmp;
+		rxbytes = 2;
+	}
+
+	msg_t res = MSG_RESET;
+
+	i2cAcquireBus(h->dev);
+	if (h->dev->state == I2C_READY) {
+		if (x->txbytes > 0) {
+			res = i2cMasterTransmitTimeout(h->dev, x->addr, x->txbuf, x->txbytes,
+					rxbuf, rxbytes, MS2ST(BUS_THREAD_I2C_TIMEOUT_MS));
+		} else if (rxbytes > 0) {
+			res = i2cMasterReceiveTimeout(h->dev, x->addr,
+					rxbuf, rxbytes, MS2ST(BUS_THREAD_I2C_TIMEOUT_MS));
+		}
+	}
+	i2cReleaseBus(h->dev);
+
+	if (res == MSG_OK && rxbuf == tmp) {
+		x->rxbuf[0] = tmp[0];
+	}
+
+	return res == MSG_OK;
+}
+
+static void i2c_hw_recover(void *ctx) {
+	bus_i2c_hw *h = (bus_i2c_hw*)ctx;
+
+	if (h->restore) {
+		h->restore();
+		return;
+	}
+
+	// After a timeout the driver is locked until it is restarted. Leave it
+	// alone if someone else has stopped it.
+	i2cAcquireBus(h->dev);
+	if (h->dev->state != I2C_STOP) {
+		i2cStop(h->dev);
+		i2cStart(h->dev, h->cfg);
+	}
+	i2cReleaseBus(h->dev);
+}
+
+static bool spi_bb_transfer(void *ctx, bus_xfer *x) {
+	spi_bb_state *s = (spi_bb_state*)ctx;
+
+	chMtxLock(&s->mutex);
+	spi_bb_begin(s);
+
+	if (x->txbytes > 0) {
+		spi_bb_transfer_8(s, 0, x->txbuf, x->txbytes);
+	}
+
+	if (x->rxbytes > 0) {
+		spi_bb_delay();
+		spi_bb_transfer_8(s, x->rxbuf, 0, x->rxbytes);
+	}
+
+	spi_bb_end(s);
+	chMtxUnlock(&s->mutex);
+
+	return true;
+}
+
+static bool spi_hw_transfer(void *ctx, bus_xfer *x) {
+	bus_spi_hw *h = (bus_spi_hw*)ctx;
+
+	spiAcquireBus(h->dev);
+
+	// Another device can use the same peripheral with another config
+	spiStart(h->dev, &h->cfg);
+	spiSelect(h->dev);
+
+	if (x->txbytes > 0) {
+		spiSend(h->dev, x->txbytes, x->txbuf);
+	}
+
+	if (x->rxbytes > 0) {
+		spiReceive(h->dev, x->rxbytes, x->rxbuf);
+	}
+
+	spiUnselect(h->dev);
+	spiReleaseBus(h->dev);
+
+	return true;
+}
@@ -0,0 +1,58 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef BUS_THREAD_H_
+#define BUS_THREAD_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "bus_async.h"
+#include "i2c_bb.h"
+#include "spi_bb.h"
+
+// Settings
+#define BUS_THREAD_I2C_TIMEOUT_MS		5
+
+// Hardware I2C. The pins must be set up, e.g. with hw_start_i2c.
+typedef struct {
+	I2CDriver *dev;
+	const I2CConfig *cfg;
+	// Unlocks the bus and restarts the driver after an error, e.g.
+	// hw_try_restore_i2c. When NULL the driver is restarted with cfg.
+	void (*restore)(void);
+} bus_i2c_hw;
+
+// Hardware SPI. Chip select is in the config, and the pins must be set up.
+typedef struct {
+	SPIDriver *dev;
+	SPIConfig cfg;
+} bus_spi_hw;
+
+// Backends
+extern const bus_backend bus_backend_i2c_bb;
+extern const bus_backend bus_backend_i2c_hw;
+extern const bus_backend bus_backend_spi_bb;
+extern const bus_backend bus_backend_spi_hw;
+
+// Functions
+void bus_thread_add(bus_async *b);
+void bus_thread_remove(bus_async *b);
+bool bus_thread_transfer(bus_async *b, bus_xfer *x);
+
+#endif /* BUS_THREAD_H_ */
@@ -27,6 +27,7 @@
 #include "buffer.h"
 #include "mc_interface.h"
 #include "timeout.h"
+#include "setpoint_stream.h"
 #include "commands.h"
 #include "app.h"
 #include "crc.h"
@@ -429,6 +430,31 @@ void comm_can_set_current(uint8_t controller_id, float current) {
 			((uint32_t)CAN_PACKET_SET_CURRENT << 8), buffer, send_index, true);
 }
 
+/**
+ * Send a streaming setpoint frame.
+ *
+ * @param controller_id
+ * The ID of the VESC to send the setpoint to.
+ *
+ * @param seq
+ * Sequence number, increment by one for each frame.
+ *
+ * @param mode
+ * SETPOINT_STREAM_MODE, optionally or:ed with SETPOINT_STREAM_FLAG_DIRECT.
+ *
+ * @param value
+ * The setpoint.
+ */
+void comm_can_set_stream(uint8_t controller_id, uint8_t seq, uint8_t mode, float value) {
+	int32_t send_index = 0;
+	uint8_t buffer[6];
+	buffer[send_index++] = seq;
+	buffer[send_index++] = mode;
+	buffer_append_float32_auto(buffer, value, &send_index);
+	comm_can_transmit_eid_replace(controller_id |
+			((uint32_t)CAN_PACKET_SET_STREAM << 8), buffer, send_index, true);
+}
+
 void comm_can_set_current_off_delay(uint8_t controller_id, float current, float off_delay) {
 	int32_t send_index = 0;
 	uint8_t buffer[6];
@@ -1378,6 +1404,10 @@ static void decode_msg(uint32_t eid, uint8_t *data8, int len, bool is_replaced)
 			timeout_reset();
 			break;
 
+		case CAN_PACKET_SET_STREAM:
+			setpoint_stream_process_packet(data8, len);
+			break;
+
 		case CAN_PACKET_SET_CURRENT_BRAKE:
 			ind = 0;
 			mc_interface_set_brake_current(buffer_get_float32(data8, 1e3, &ind));
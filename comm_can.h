@@ -37,6 +37,7 @@ void comm_can_set_eid_rx_callback(bool (*p_func)(uint32_t id, uint8_t *data, uin
 void comm_can_send_buffer(uint8_t controller_id, uint8_t *data, unsigned int len, uint8_t send);
 void comm_can_set_duty(uint8_t controller_id, float duty);
 void comm_can_set_current(uint8_t controller_id, float current);
+void comm_can_set_stream(uint8_t controller_id, uint8_t seq, uint8_t mode, float value);
 void comm_can_set_current_off_delay(uint8_t controller_id, float current, float off_delay);
 void comm_can_set_current_brake(uint8_t controller_id, float current);
 void comm_can_set_rpm(uint8_t controller_id, float rpm);
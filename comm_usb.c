@@ -23,16 +23,34 @@
 #include "packet.h"
 #include "comm_usb_serial.h"
 #include "commands.h"
+#include "datatypes.h"
+#include "packet_queue.h"
+#include <string.h>
 
-// Private variables
+// Settings
 #define SERIAL_RX_BUFFER_SIZE		2048
+#define SERIAL_TX_CONTROL_SIZE		2048
+#define SERIAL_TX_BULK_SIZE			4096
+#define SERIAL_TX_WRITE_SIZE		(PACKET_BUFFER_LEN * 2)
+#define SERIAL_TX_CONTROL_WAIT_MS	100
+
+// Private variables
 static uint8_t serial_rx_buffer[SERIAL_RX_BUFFER_SIZE];
-static int serial_rx_read_pos = 0;
-static int serial_rx_write_pos = 0;
+static volatile int serial_rx_read_pos = 0;
+static volatile int serial_rx_write_pos = 0;
 static THD_WORKING_AREA(serial_read_thread_wa, 256);
 static THD_WORKING_AREA(serial_process_thread_wa, 4096);
+static THD_WORKING_AREA(serial_write_thread_wa, 512);
+static uint8_t serial_tx_control_buffer[SERIAL_TX_CONTROL_SIZE];
+static uint8_t serial_tx_bulk_buffer[SERIAL_TX_BULK_SIZE];
+static uint8_t serial_tx_write_buffer[SERIAL_TX_WRITE_SIZE];
+static packet_queue tx_queue[USB_TX_PRIO_NUM];
+static usb_tx_prio_t tx_prio;
 static mutex_t send_mutex;
+static mutex_t tx_mutex;
 static thread_t *process_tp;
+static thread_t *read_tp;
+static thread_t *write_tp;
 static volatile unsigned int write_timeout_cnt = 0;
 static volatile bool was_timeout = false;
 static PACKET_STATE_t packet_state;
@@ -40,32 +58,59 @@ static PACKET_STATE_t packet_state;
 // Private functions
 static void process_packet(unsigned char *data, unsigned int len);
 static void send_packet_raw(unsigned char *buffer, unsigned int len);
+static void wait_for_control_space(unsigned int len);
 
+/*
+ * The read thread reads straight into the free part of the ring buffer, as
+ * many bytes as the USB queue has, and the process thread decodes the
+ * received data span by span. The read position is only moved after a span
+ * is decoded, so packets are decoded in place. When the ring buffer is full
+ * the read thread waits for the process thread, which leaves the data in the
+ * USB queue and makes the host wait until there is space.
+ */
 static THD_FUNCTION(serial_read_thread, arg) {
 	(void)arg;
 
 	chRegSetThreadName("USB read");
 
-	uint8_t buffer[2];
-	int had_data = 0;
+	read_tp = chThdGetSelfX();
 
 	for(;;) {
-		int len = chSequentialStreamRead(&SDU1, (uint8_t*) buffer, 1);
+		int read_pos = serial_rx_read_pos;
+		int write_pos = serial_rx_write_pos;
 
-		for (int i = 0;i < len;i++) {
-			serial_rx_buffer[serial_rx_write_pos++] = buffer[i];
+		// One slot is left free to tell a full buffer from an empty one
+		int len;
+		if (write_pos >= read_pos) {
+			len = SERIAL_RX_BUFFER_SIZE - write_pos - (read_pos == 0 ? 1 : 0);
+		} else {
+			len = read_pos - write_pos - 1;
+		}
 
-			if (serial_rx_write_pos == SERIAL_RX_BUFFER_SIZE) {
-				serial_rx_write_pos = 0;
-			}
+		if (len <= 0) {
+			chEvtWaitAnyTimeout((eventmask_t) 1, MS2ST(10));
+			continue;
+		}
 
-			had_data = 1;
+		uint8_t *ptr = serial_rx_buffer + write_pos;
+		size_t rx = chnReadTimeout(&SDU1, ptr, 1, TIME_INFINITE);
+
+		if (rx == 0) {
+			continue;
+		}
+
+		// Whatever else has arrived
+		if (len > 1) {
+			rx += chnReadTimeout(&SDU1, ptr + 1, len - 1, TIME_IMMEDIATE);
 		}
 
-		if (had_data) {
-			chEvtSignal(process_tp, (eventmask_t) 1);
-			had_data = 0;
+		write_pos += rx;
+		if (write_pos == SERIAL_RX_BUFFER_SIZE) {
+			write_pos = 0;
 		}
+
+		serial_rx_write_pos = write_pos;
+		chEvtSignal(process_tp, (eventmask_t) 1);
 	}
 }
 
@@ -79,12 +124,17 @@ static THD_FUNCTION(serial_process_thread, arg) {
 	for(;;) {
 		chEvtWaitAny((eventmask_t) 1);
 
-		while (serial_rx_read_pos != serial_rx_write_pos) {
-			packet_process_byte(serial_rx_buffer[serial_rx_read_pos++], &packet_state);
+		int read_pos = serial_rx_read_pos;
+		int write_pos;
 
-			if (serial_rx_read_pos == SERIAL_RX_BUFFER_SIZE) {
-				serial_rx_read_pos = 0;
-			}
+		while (read_pos != (write_pos = serial_rx_write_pos)) {
+			int end = write_pos > read_pos ? write_pos : SERIAL_RX_BUFFER_SIZE;
+
+			packet_process_data(serial_rx_buffer + read_pos, end - read_pos, &packet_state);
+
+			read_pos = end == SERIAL_RX_BUFFER_SIZE ? 0 : end;
+			serial_rx_read_pos = read_pos;
+			chEvtSignal(read_tp, (eventmask_t) 1);
 		}
 	}
 }
@@ -93,24 +143,109 @@ static void process_packet(unsigned char *data, unsigned int len) {
 	commands_process_packet(data, len, comm_usb_send_packet);
 }
 
-static void send_packet_raw(unsigned char *buffer, unsigned int len) {
-	/*
-	 * Only write to USB if the cable has been connected at least once. If a timeout occurs
-	 * make sure that this call does not stall on the next call, as the timeout probably occured
-	 * because noone is listening on the USB.
-	 */
-	if (comm_usb_serial_configured_cnt() > 0) {
-		unsigned int written = 0;
-		if (was_timeout) {
-			written = SDU1.vmt->writet(&SDU1, buffer, len, TIME_IMMEDIATE);
-		} else {
-			written = SDU1.vmt->writet(&SDU1, buffer, len, MS2ST(100));
+/*
+ * Writes the queued packets to USB. Control packets are taken before bulk
+ * packets every time, so a full bulk queue only delays a reply by the write
+ * that is in progress. A slow host only blocks this thread.
+ */
+static THD_FUNCTION(serial_write_thread, arg) {
+	(void)arg;
+
+	chRegSetThreadName("USB write");
+
+	write_tp = chThdGetSelfX();
+
+	for(;;) {
+		chEvtWaitAny((eventmask_t) 1);
+
+		for(;;) {
+			chMtxLock(&tx_mutex);
+			unsigned int len = packet_queue_pop(&tx_queue[USB_TX_PRIO_CONTROL],
+					serial_tx_write_buffer, SERIAL_TX_WRITE_SIZE);
+			len += packet_queue_pop(&tx_queue[USB_TX_PRIO_BULK],
+					serial_tx_write_buffer + len, SERIAL_TX_WRITE_SIZE - len);
+			chMtxUnlock(&tx_mutex);
+
+			if (len == 0) {
+				break;
+			}
+
+			/*
+			 * If a timeout occurs make sure that the next write does not stall, as the timeout
+			 * probably occured because noone is listening on the USB.
+			 */
+			unsigned int written = 0;
+			if (was_timeout) {
+				written = SDU1.vmt->writet(&SDU1, serial_tx_write_buffer, len, TIME_IMMEDIATE);
+			} else {
+				written = SDU1.vmt->writet(&SDU1, serial_tx_write_buffer, len, MS2ST(100));
+			}
+
+			was_timeout = written != len;
+			if (was_timeout) {
+				write_timeout_cnt++;
+			}
 		}
+	}
+}
+
+static void send_packet_raw(unsigned char *buffer, unsigned int len) {
+	// Only write to USB if the cable has been connected at least once.
+	if (comm_usb_serial_configured_cnt() == 0) {
+		return;
+	}
 
-		was_timeout = written != len;
-		if (was_timeout) {
-			write_timeout_cnt++;
+	// Packets that do not fit are dropped and counted by the queue
+	chMtxLock(&tx_mutex);
+	packet_queue_push(&tx_queue[tx_prio], buffer, len);
+	chMtxUnlock(&tx_mutex);
+
+	chEvtSignal(write_tp, (eventmask_t) 1);
+}
+
+/*
+ * Control packets wait for the write thread for a while when their queue is
+ * full, unless noone is reading. This is done before send_mutex is taken, so
+ * that other senders are not held up while waiting.
+ */
+static void wait_for_control_space(unsigned int len) {
+	if (comm_usb_serial_configured_cnt() == 0) {
+		return;
+	}
+
+	packet_queue *q = &tx_queue[USB_TX_PRIO_CONTROL];
+	systime_t start = chVTGetSystemTimeX();
+
+	for (;;) {
+		chMtxLock(&tx_mutex);
+		bool fits = packet_queue_fits(q, len);
+		chMtxUnlock(&tx_mutex);
+
+		if (fits || was_timeout ||
+				chVTTimeElapsedSinceX(start) >= MS2ST(SERIAL_TX_CONTROL_WAIT_MS)) {
+			break;
 		}
+
+		chEvtSignal(write_tp, (eventmask_t) 1);
+		chThdSleepMilliseconds(1);
+	}
+}
+
+/*
+ * COMM_PRINT carries the replies to terminal commands, so it is a control
+ * packet even though it can be long.
+ */
+static usb_tx_prio_t packet_prio(uint8_t packet_id) {
+	switch (packet_id) {
+	case COMM_SAMPLE_PRINT:
+	case COMM_ROTOR_POSITION:
+	case COMM_EXPERIMENT_SAMPLE:
+	case COMM_GPD_OUTPUT_SAMPLE:
+	case COMM_PLOT_DATA:
+		return USB_TX_PRIO_BULK;
+
+	default:
+		return USB_TX_PRIO_CONTROL;
 	}
 }
 
@@ -119,14 +254,31 @@ void comm_usb_init(void) {
 	packet_init(send_packet_raw, process_packet, &packet_state);
 
 	chMtxObjectInit(&send_mutex);
+	chMtxObjectInit(&tx_mutex);
+
+	packet_queue_init(&tx_queue[USB_TX_PRIO_CONTROL], serial_tx_control_buffer, SERIAL_TX_CONTROL_SIZE);
+	packet_queue_init(&tx_queue[USB_TX_PRIO_BULK], serial_tx_bulk_buffer, SERIAL_TX_BULK_SIZE);
 
 	// Threads
 	chThdCreateStatic(serial_read_thread_wa, sizeof(serial_read_thread_wa), NORMALPRIO, serial_read_thread, NULL);
 	chThdCreateStatic(serial_process_thread_wa, sizeof(serial_process_thread_wa), NORMALPRIO, serial_process_thread, NULL);
+	chThdCreateStatic(serial_write_thread_wa, sizeof(serial_write_thread_wa), NORMALPRIO + 1, serial_write_thread, NULL);
 }
 
 void comm_usb_send_packet(unsigned char *data, unsigned int len) {
+	if (len == 0) {
+		return;
+	}
+
+	usb_tx_prio_t prio = packet_prio(data[0]);
+
+	// Start, length, CRC and stop bytes are added by the packet framing
+	if (prio == USB_TX_PRIO_CONTROL) {
+		wait_for_control_space(len + (len <= 255 ? 5 : (len <= 65535 ? 6 : 7)));
+	}
+
 	chMtxLock(&send_mutex);
+	tx_prio = prio;
 	packet_send_packet(data, len, &packet_state);
 	chMtxUnlock(&send_mutex);
 }
@@ -134,3 +286,15 @@ void comm_usb_send_packet(unsigned char *data, unsigned int len) {
 unsigned int comm_usb_get_write_timeout_cnt(void) {
 	return write_timeout_cnt;
 }
+
+void comm_usb_get_tx_stats(usb_tx_prio_t prio, usb_tx_queue_stats_t *stats) {
+	packet_queue *q = &tx_queue[prio];
+
+	chMtxLock(&tx_mutex);
+	stats->size = q->size;
+	stats->used = q->used;
+	stats->peak = q->peak;
+	stats->sent = q->sent;
+	stats->dropped = q->dropped;
+	chMtxUnlock(&tx_mutex);
+}
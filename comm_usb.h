@@ -22,9 +22,25 @@
 
 #include "conf_general.h"
 
+// Types
+typedef enum {
+	USB_TX_PRIO_CONTROL = 0,
+	USB_TX_PRIO_BULK,
+	USB_TX_PRIO_NUM
+} usb_tx_prio_t;
+
+typedef struct {
+	unsigned int size;
+	unsigned int used;
+	unsigned int peak;
+	unsigned int sent;
+	unsigned int dropped;
+} usb_tx_queue_stats_t;
+
 // Functions
 void comm_usb_init(void);
 void comm_usb_send_packet(unsigned char *data, unsigned int len);
 unsigned int comm_usb_get_write_timeout_cnt(void);
+void comm_usb_get_tx_stats(usb_tx_prio_t prio, usb_tx_queue_stats_t *stats);
 
 #endif /* COMM_USB_H_ */
@@ -31,6 +31,7 @@
 #include "mc_interface.h"
 #include "app.h"
 #include "timeout.h"
+#include "setpoint_stream.h"
 #include "servo_dec.h"
 #include "comm_can.h"
 #include "flash_helper.h"
@@ -51,6 +52,9 @@
 #include "qmlui.h"
 #include "crc.h"
 #include "buzzer.h"
+#ifdef USE_LISPBM
+#include "lispif.h"
+#endif
 
 #include <math.h>
 #include <string.h>
@@ -186,6 +190,12 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 	data++;
 	len--;
 
+	// Streaming setpoints skip everything else to keep the latency low
+	if (packet_id == COMM_SET_STREAM) {
+		setpoint_stream_process_packet(data, len);
+		return;
+	}
+
 	// The NRF51 ESB implementation is treated like it has its own
 	// independent communication interface.
 	if (packet_id == COMM_EXT_NRF_PRESENT ||
@@ -480,6 +490,28 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 		timeout_reset();
 	} break;
 
+	case COMM_SET_POS_TRAJ: {
+		int32_t ind = 0;
+		mc_interface_set_pid_pos_traj((float)buffer_get_int32(data, &ind) / 1000000.0);
+		timeout_reset();
+	} break;
+
+	case COMM_PUSH_POS_WAYPOINT: {
+		int32_t ind = 0;
+		float pos = buffer_get_float32_auto(data, &ind);
+		float vel = buffer_get_float32_auto(data, &ind);
+		bool queued = mc_interface_push_pid_pos_waypoint(pos, vel);
+		timeout_reset();
+
+		// The reply tells if the waypoint was queued, so that the sender can
+		// wait and send it again when the queue is full.
+		ind = 0;
+		uint8_t send_buffer[8];
+		send_buffer[ind++] = COMM_PUSH_POS_WAYPOINT;
+		send_buffer[ind++] = queued;
+		reply_func(send_buffer, ind);
+	} break;
+
 	case COMM_SET_HANDBRAKE: {
 		int32_t ind = 0;
 		mc_interface_set_handbrake(buffer_get_float32(data, 1e3, &ind));
@@ -1582,6 +1614,7 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 	case COMM_BM_MEM_READ:
 	case COMM_GET_IMU_CALIBRATION:
 	case COMM_BM_MEM_WRITE:
+	case COMM_LISP_HEAP_SNAPSHOT:
 		if (!is_blocking) {
 			memcpy(blocking_thread_cmd_buffer, data - 1, len + 1);
 			blocking_thread_cmd_len = len + 1;
@@ -2315,6 +2348,34 @@ static THD_FUNCTION(blocking_thread, arg) {
 			}
 		} break;
 
+		case COMM_LISP_HEAP_SNAPSHOT: {
+			int32_t ind = 0;
+			uint32_t offset = buffer_get_uint32(data, &ind);
+			uint32_t read_len = buffer_get_uint16(data, &ind);
+			bool gc = len > 6 ? data[ind++] : false;
+
+			if (read_len > (sizeof(send_buffer) - 10)) {
+				read_len = sizeof(send_buffer) - 10;
+			}
+
+			uint32_t total = 0;
+#ifdef USE_LISPBM
+			read_len = lispif_heap_snapshot(offset, send_buffer + 9, read_len, gc, &total);
+#else
+			(void)gc;
+			read_len = 0;
+#endif
+
+			// A total of 0 means that there is no snapshot to read
+			ind = 0;
+			send_buffer[ind++] = packet_id;
+			buffer_append_uint32(send_buffer, total, &ind);
+			buffer_append_uint32(send_buffer, offset, &ind);
+			if (send_func_blocking) {
+				send_func_blocking(send_buffer, ind + read_len);
+			}
+		} break;
+
 		default:
 			break;
 		}
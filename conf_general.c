@@ -49,6 +49,8 @@
 #define EEPROM_BASE_CUSTOM		4000
 #define EEPROM_BASE_MCCONF_2	5000
 #define EEPROM_BASE_BACKUP		6000
+#define EEPROM_BASE_DTC			7000
+#define EEPROM_BASE_DTC_2		7100
 
 // Global variables
 uint16_t VirtAddVarTab[NB_OF_VAR];
@@ -84,6 +86,11 @@ void conf_general_init(void) {
 		VirtAddVarTab[ind++] = EEPROM_BASE_BACKUP + i;
 	}
 
+	for (unsigned int i = 0;i < EEPROM_VARS_DTC;i++) {
+		VirtAddVarTab[ind++] = EEPROM_BASE_DTC + i;
+		VirtAddVarTab[ind++] = EEPROM_BASE_DTC_2 + i;
+	}
+
 	FLASH_Unlock();
 	FLASH_ClearFlag(FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |
 			FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
@@ -162,6 +169,106 @@ bool conf_general_store_backup_data(void) {
 	return is_ok;
 }
 
+/**
+ * Read the dead time compensation table of a motor from emulated EEPROM. It is
+ * stored with a version and a CRC, and is only read when both match.
+ *
+ * @param data
+ * Where to store the table.
+ *
+ * @param len
+ * Size of the table in bytes. Must be even.
+ *
+ * @param version
+ * Version of the table layout.
+ *
+ * @return
+ * true if a valid table was read.
+ */
+bool conf_general_read_dtc(void *data, unsigned int len, uint16_t version, bool is_motor_2) {
+	unsigned int base = is_motor_2 ? EEPROM_BASE_DTC_2 : EEPROM_BASE_DTC;
+	uint8_t buffer[(EEPROM_VARS_DTC - 2) * 2];
+	uint16_t var_version, var_crc, var;
+
+	if ((len % 2) != 0 || len > sizeof(buffer)) {
+		return false;
+	}
+
+	if (EE_ReadVariable(base, &var_version) != 0 || var_version != version ||
+			EE_ReadVariable(base + 1, &var_crc) != 0) {
+		return false;
+	}
+
+	for (unsigned int i = 0;i < (len / 2);i++) {
+		if (EE_ReadVariable(base + 2 + i, &var) != 0) {
+			return false;
+		}
+
+		buffer[2 * i] = (var >> 8) & 0xFF;
+		buffer[2 * i + 1] = var & 0xFF;
+	}
+
+	if (crc16(buffer, len) != var_crc) {
+		return false;
+	}
+
+	memcpy(data, buffer, len);
+	return true;
+}
+
+/**
+ * Store the dead time compensation table of a motor to emulated EEPROM. The
+ * motor should not be running, as this can take a while on a page swap.
+ *
+ * @param data
+ * The table.
+ *
+ * @param len
+ * Size of the table in bytes. Must be even.
+ *
+ * @param version
+ * Version of the table layout, so that a table with another layout is not
+ * read after a firmware update.
+ *
+ * @return
+ * true for success.
+ */
+bool conf_general_store_dtc(const void *data, unsigned int len, uint16_t version, bool is_motor_2) {
+	unsigned int base = is_motor_2 ? EEPROM_BASE_DTC_2 : EEPROM_BASE_DTC;
+	const uint8_t *data_addr = (const uint8_t*)data;
+
+	if ((len % 2) != 0 || len > ((EEPROM_VARS_DTC - 2) * 2)) {
+		return false;
+	}
+
+	timeout_configure_IWDT_slowest();
+
+	bool is_ok = true;
+
+	FLASH_Unlock();
+	FLASH_ClearFlag(FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |
+			FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+
+	if (EE_WriteVariable(base, version) != FLASH_COMPLETE ||
+			EE_WriteVariable(base + 1, crc16((uint8_t*)data_addr, len)) != FLASH_COMPLETE) {
+		is_ok = false;
+	}
+
+	for (unsigned int i = 0;i < (len / 2) && is_ok;i++) {
+		uint16_t var = (data_addr[2 * i] << 8) & 0xFF00;
+		var |= data_addr[2 * i + 1] & 0xFF;
+
+		if (EE_WriteVariable(base + 2 + i, var) != FLASH_COMPLETE) {
+			is_ok = false;
+		}
+	}
+	FLASH_Lock();
+
+	timeout_configure_IWDT();
+
+	return is_ok;
+}
+
 /**
  * Read hw-specific variable from emulated EEPROM.
  *
@@ -341,6 +341,142 @@
 #define FOC_CONTROL_LOOP_FREQ_DIVIDER	1
 #endif
 
+/*
+ *	Rates in Hz of the tasks run by the FOC scheduler. The scheduler is woken from the
+ *	control loop interrupt, so each rate is converted to an integer divider of the
+ *	control loop rate. Setting the position or speed rate to 0 makes that loop follow
+ *	sp_pid_loop_rate from the motor configuration. The dividers can also be overridden
+ *	at runtime with the foc_sched_div terminal command.
+ */
+#ifndef FOC_SCHED_RATE_POS
+#define FOC_SCHED_RATE_POS				0
+#endif
+#ifndef FOC_SCHED_RATE_SPEED
+#define FOC_SCHED_RATE_SPEED			0
+#endif
+#ifndef FOC_SCHED_RATE_FW
+#define FOC_SCHED_RATE_FW				1000
+#endif
+#ifndef FOC_SCHED_RATE_TIMER
+#define FOC_SCHED_RATE_TIMER			1000
+#endif
+#ifndef FOC_SCHED_RATE_STATS
+#define FOC_SCHED_RATE_STATS			1000
+#endif
+#ifndef FOC_SCHED_RATE_TEMP
+#define FOC_SCHED_RATE_TEMP				1000
+#endif
+
+/*
+ *	Default limits in degrees/s, degrees/s^2 and degrees/s^3 and feedforward gains in
+ *	A/(degrees/s) and A/(degrees/s^2) of the position trajectory generator. These can be
+ *	changed at runtime with the foc_traj_limits and foc_traj_ff terminal commands.
+ */
+#ifndef FOC_TRAJ_VEL_MAX
+#define FOC_TRAJ_VEL_MAX				3600.0
+#endif
+#ifndef FOC_TRAJ_ACC_MAX
+#define FOC_TRAJ_ACC_MAX				36000.0
+#endif
+#ifndef FOC_TRAJ_JERK_MAX
+#define FOC_TRAJ_JERK_MAX				1.8e6
+#endif
+#ifndef FOC_TRAJ_KV
+#define FOC_TRAJ_KV						0.0
+#endif
+#ifndef FOC_TRAJ_KA
+#define FOC_TRAJ_KA						0.0
+#endif
+
+/*
+ *	Default modulation. FOC_SVM_MODE is a foc_svm_mode, where the discontinuous modes
+ *	reduce the switching losses, and FOC_SVM_OVERMOD allows the voltage to go above
+ *	the linear region up to six-step. Can be changed at runtime with the foc_svm
+ *	terminal command. Without HW_HAS_PHASE_SHUNTS only centered and DPWM min are
+ *	used and overmodulation is off, as low-side shunts need the low-side on in
+ *	every cycle.
+ */
+#ifndef FOC_SVM_MODE
+#define FOC_SVM_MODE					FOC_SVM_MODE_CENTERED
+#endif
+#ifndef FOC_SVM_OVERMOD
+#define FOC_SVM_OVERMOD					false
+#endif
+
+/*
+ *	Use the hall sensor model in foc_hall.c, which learns the angles of the hall sensor
+ *	edges and their delay while running. Can be changed at runtime with the
+ *	foc_hall_model terminal command.
+ */
+#ifndef FOC_HALL_MODEL
+#define FOC_HALL_MODEL					false
+#endif
+
+/*
+ *	Decode the servo input of the PPM app from a serial receiver on the UART instead of
+ *	from the servo pulses. 0: off, 1: SBUS, 2: CRSF. The channel is counted from 0. Can be
+ *	changed at runtime with the servodec_serial terminal command.
+ */
+#ifndef SERVO_DEC_SERIAL
+#define SERVO_DEC_SERIAL				0
+#endif
+#ifndef SERVO_DEC_SERIAL_CH
+#define SERVO_DEC_SERIAL_CH				2
+#endif
+
+/*
+ *	When the median filter of the servo input is used, changes of the pulse length smaller
+ *	than this are held so that the output does not move with the timer resolution. In ms,
+ *	0 to disable.
+ */
+#ifndef SERVO_DEC_JITTER_BAND
+#define SERVO_DEC_JITTER_BAND			0.0
+#endif
+
+/*
+ *	The ADC app takes its inputs as open or shorted when they stay outside of the configured
+ *	voltage range by more than this fraction of the range, and releases the motor. 0 to
+ *	disable. Off by default, as voltage_start is often set above the rest voltage of the
+ *	throttle to get a deadband, which would look like a fault at rest. E.g. 0.2 for
+ *	throttles that stay inside the range.
+ */
+#ifndef APP_ADC_FAULT_MARGIN
+#define APP_ADC_FAULT_MARGIN			0.0
+#endif
+
+/*
+ *	Streaming setpoint watchdog timeout in milliseconds. The motor is released when no
+ *	stream frame has been received for this long. Can be changed at runtime with the
+ *	stream_timeout terminal command.
+ */
+#ifndef SETPOINT_STREAM_TIMEOUT_MS
+#define SETPOINT_STREAM_TIMEOUT_MS		50
+#endif
+
+/*
+ *	Torque vectoring coordinator for multiple ESCs in current mode. Slip is relative to
+ *	the slowest wheel, and TV_RPM_MIN is the ERPM used as reference at low speed. Load
+ *	is moved away from a node TV_TEMP_MARGIN degrees before its temperature limits.
+ */
+#ifndef TV_ENABLE
+#define TV_ENABLE						0
+#endif
+#ifndef TV_SLIP_START
+#define TV_SLIP_START					0.05
+#endif
+#ifndef TV_SLIP_END
+#define TV_SLIP_END						0.25
+#endif
+#ifndef TV_SLIP_RECOVERY
+#define TV_SLIP_RECOVERY				2.0
+#endif
+#ifndef TV_RPM_MIN
+#define TV_RPM_MIN						1000.0
+#endif
+#ifndef TV_TEMP_MARGIN
+#define TV_TEMP_MARGIN					15.0
+#endif
+
 // Global configuration variables
 extern bool conf_general_permanent_nrf_found;
 extern volatile backup_data g_backup;
@@ -352,6 +488,8 @@ bool conf_general_read_eeprom_var_hw(eeprom_var *v, int address);
 bool conf_general_read_eeprom_var_custom(eeprom_var *v, int address);
 bool conf_general_store_eeprom_var_hw(eeprom_var *v, int address);
 bool conf_general_store_eeprom_var_custom(eeprom_var *v, int address);
+bool conf_general_read_dtc(void *data, unsigned int len, uint16_t version, bool is_motor_2);
+bool conf_general_store_dtc(const void *data, unsigned int len, uint16_t version, bool is_motor_2);
 void conf_general_read_app_configuration(app_configuration *conf);
 bool conf_general_store_app_configuration(app_configuration *conf);
 void conf_general_read_mc_configuration(mc_configuration *conf, bool is_motor_2);
@@ -1064,6 +1064,10 @@ typedef enum {
 	COMM_GET_EXT_HUM_TMP,
 	COMM_GET_STATS,
 	COMM_RESET_STATS,
+	COMM_SET_POS_TRAJ,
+	COMM_PUSH_POS_WAYPOINT,
+	COMM_SET_STREAM,
+	COMM_LISP_HEAP_SNAPSHOT,
 } COMM_PACKET_ID;
 
 // CAN commands
@@ -1126,9 +1130,24 @@ typedef enum {
 	CAN_PACKET_UPDATE_PID_POS_OFFSET,
 	CAN_PACKET_POLL_ROTOR_POS,
 	CAN_PACKET_BMS_BOOT,
+	CAN_PACKET_SET_STREAM,
 	CAN_PACKET_MAKE_ENUM_32_BITS = 0xFFFFFFFF,
 } CAN_PACKET_ID;
 
+// Streaming setpoint modes
+typedef enum {
+	SETPOINT_STREAM_MODE_OFF = 0,
+	SETPOINT_STREAM_MODE_CURRENT,
+	SETPOINT_STREAM_MODE_CURRENT_BRAKE,
+	SETPOINT_STREAM_MODE_DUTY,
+	SETPOINT_STREAM_MODE_RPM,
+	SETPOINT_STREAM_MODE_POS,
+	SETPOINT_STREAM_MODE_POS_TRAJ
+} SETPOINT_STREAM_MODE;
+
+// Set in the mode byte to apply the setpoint directly instead of interpolating
+#define SETPOINT_STREAM_FLAG_DIRECT		0x80
+
 // Logged fault data
 typedef struct {
 	uint8_t motor;
@@ -1241,7 +1260,9 @@ typedef enum {
 	MOTE_PACKET_FILL_RX_BUFFER_LONG,
 	MOTE_PACKET_PROCESS_RX_BUFFER,
 	MOTE_PACKET_PROCESS_SHORT_BUFFER,
-	MOTE_PACKET_PAIRING_INFO
+	MOTE_PACKET_PAIRING_INFO,
+	MOTE_PACKET_WINDOW_DATA,
+	MOTE_PACKET_WINDOW_ACK
 } MOTE_PACKET;
 
 typedef struct {
@@ -1298,6 +1319,7 @@ typedef union {
 
 #define EEPROM_VARS_HW			64
 #define EEPROM_VARS_CUSTOM		64
+#define EEPROM_VARS_DTC			72 // Per motor, for the dead time compensation table
 
 typedef struct {
 	float ah_tot;
@@ -0,0 +1,221 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "foc_dtc.h"
+
+#include <math.h>
+#include <string.h>
+
+#define TWO_BY_SQRT3			(1.15470053838)
+#define SQRT3_BY_2				(0.86602540378)
+
+/*
+ * Dead time and inverter nonlinearity compensation. During the dead time
+ * the phase voltage is decided by the direction of the current, so every
+ * phase loses some of its duty cycle in the direction of its current. At
+ * high current that is dead time * f_sw, but when the current ripple
+ * crosses zero the loss goes down to zero with the current, and the
+ * switching times and voltage drops of the transistors add to it. This is
+ * why a fixed sign based compensation is wrong at low current.
+ *
+ * The loss of each phase is stored as a table over the current magnitude,
+ * which is measured by holding a current between every pair of phases and
+ * looking at how much voltage the current controller needs.
+ */
+
+/**
+ * Clear the table. foc_dtc_mod_comp must not be used until it has been
+ * calibrated.
+ */
+void foc_dtc_reset(foc_dtc_table *t) {
+	memset(t, 0, sizeof(foc_dtc_table));
+}
+
+/**
+ * Current of a point in the table. The points are closer together at low
+ * current, where the loss changes most.
+ *
+ * @param i_max
+ * The largest current.
+ *
+ * @param n
+ * Point 0 - FOC_DTC_POINTS - 1.
+ *
+ * @return
+ * The current.
+ */
+float foc_dtc_point(float i_max, int n) {
+	const float rel = (float)n / (float)(FOC_DTC_POINTS - 1);
+	return i_max * rel * rel;
+}
+
+/**
+ * Calculate the table from a voltage sweep.
+ *
+ * @param t
+ * The table to update.
+ *
+ * @param i_max
+ * The largest phase current of the sweep. The points are at foc_dtc_point.
+ *
+ * @param v_bus
+ * Input voltage during the sweep.
+ *
+ * @param f_sw
+ * Switching frequency during the sweep.
+ *
+ * @param v_meas
+ * Voltage magnitude that the current controller needed at every point, with
+ * the current going in to phase k and out of phase k + 1. That is the current
+ * vector at -30 + k * 120 degrees with magnitude 2 / sqrt(3) times the phase
+ * current. Index 0 is not used. The current should be high enough at the last
+ * points for the loss to be saturated, as the resistance is taken from their
+ * slope.
+ *
+ * @return
+ * true if the sweep made sense, otherwise the table is left unchanged.
+ */
+bool foc_dtc_calibrate(foc_dtc_table *t, float i_max, float v_bus, float f_sw,
+		float v_meas[3][FOC_DTC_POINTS]) {
+	const int last = FOC_DTC_POINTS - 1;
+
+	if (i_max <= 0.0 || v_bus <= 0.0 || f_sw <= 0.0) {
+		return false;
+	}
+
+	const float vec_last = foc_dtc_point(i_max, last) * TWO_BY_SQRT3;
+	const float vec_prev = foc_dtc_point(i_max, last - 1) * TWO_BY_SQRT3;
+
+	float res = 0.0;
+	for (int k = 0;k < 3;k++) {
+		res += (v_meas[k][last] - v_meas[k][last - 1]) / (vec_last - vec_prev);
+	}
+	res /= 3.0;
+
+	if (!(res > 0.0)) {
+		return false;
+	}
+
+	// With the current between phase k and k + 1 and none in the third phase,
+	// the loss along the current in the normalization of mod_alpha is
+	//   m = sqrt(3) / 2 * (e_k(i) + e_k+1(i))
+	// so the sum of the loss of every pair of phases is known at every point,
+	// from which the loss of each phase follows.
+	float tab[3][FOC_DTC_POINTS];
+
+	for (int n = 0;n <= last;n++) {
+		float sum[3];
+
+		for (int k = 0;k < 3;k++) {
+			if (n == 0) {
+				sum[k] = 0.0;
+			} else {
+				const float vec = foc_dtc_point(i_max, n) * TWO_BY_SQRT3;
+				const float m = 1.5 * (v_meas[k][n] - res * vec) / v_bus;
+				sum[k] = TWO_BY_SQRT3 * m;
+			}
+		}
+
+		for (int k = 0;k < 3;k++) {
+			float e = 0.5 * (sum[k] + sum[(k + 2) % 3] - sum[(k + 1) % 3]);
+
+			// Noise can make the points close to zero slightly negative
+			if (e < 0.0) {
+				e = 0.0;
+			}
+
+			if (!isfinite(e)) {
+				return false;
+			}
+
+			tab[k][n] = e;
+		}
+	}
+
+	memcpy(t->tab, tab, sizeof(tab));
+	t->i_max = i_max;
+	t->i_max_inv = 1.0 / i_max;
+	t->f_sw = f_sw;
+	t->res = res;
+	t->valid = true;
+
+	return true;
+}
+
+/**
+ * Get the duty cycle that a phase loses at a current.
+ *
+ * @param t
+ * The table.
+ *
+ * @param phase
+ * Phase 0 - 2.
+ *
+ * @param current
+ * The phase current. The loss has the same sign.
+ *
+ * @return
+ * The lost duty cycle at the calibration switching frequency.
+ */
+float foc_dtc_phase(const foc_dtc_table *t, int phase, float current) {
+	const float *tab = t->tab[phase];
+	const float rel = fabsf(current) * t->i_max_inv;
+	float e;
+
+	if (rel >= 1.0) {
+		e = tab[FOC_DTC_POINTS - 1];
+	} else {
+		const float pos = sqrtf(rel) * (float)(FOC_DTC_POINTS - 1);
+		const int ind = (int)pos;
+		e = tab[ind] + (tab[ind + 1] - tab[ind]) * (pos - (float)ind);
+	}
+
+	return current < 0.0 ? -e : e;
+}
+
+/**
+ * Calculate how much the modulation is reduced by the inverter.
+ *
+ * @param t
+ * The table.
+ *
+ * @param f_sw
+ * The switching frequency now.
+ *
+ * @param ia
+ * Phase currents, preferably filtered.
+ *
+ * @param mod_alpha
+ * The loss in mod_alpha, to be subtracted from the commanded modulation.
+ *
+ * @param mod_beta
+ * The loss in mod_beta.
+ */
+void foc_dtc_mod_comp(const foc_dtc_table *t, float f_sw, float ia, float ib, float ic,
+		float *mod_alpha, float *mod_beta) {
+	const float scale = f_sw / t->f_sw;
+	const float ea = foc_dtc_phase(t, 0, ia);
+	const float eb = foc_dtc_phase(t, 1, ib);
+	const float ec = foc_dtc_phase(t, 2, ic);
+
+	// mod_alpha = 1/2 * (2 * ea - eb - ec)
+	// mod_beta  = sqrt(3)/2 * (eb - ec)
+	*mod_alpha = 0.5 * (2.0 * ea - eb - ec) * scale;
+	*mod_beta = SQRT3_BY_2 * (eb - ec) * scale;
+}
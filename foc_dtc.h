@@ -0,0 +1,51 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef FOC_DTC_H_
+#define FOC_DTC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Points in the table of each phase, from 0 to i_max
+#define FOC_DTC_POINTS				9
+// Layout version of the stored table, change it when foc_dtc_table changes
+#define FOC_DTC_VERSION				1
+
+typedef struct {
+	// Duty cycle lost on each phase at the currents of foc_dtc_point
+	float tab[3][FOC_DTC_POINTS];
+	float i_max;
+	float i_max_inv;
+	// Switching frequency of the calibration, the loss scales with it
+	float f_sw;
+	float res;
+	bool valid;
+} foc_dtc_table;
+
+// Functions
+void foc_dtc_reset(foc_dtc_table *t);
+float foc_dtc_point(float i_max, int n);
+bool foc_dtc_calibrate(foc_dtc_table *t, float i_max, float v_bus, float f_sw,
+		float v_meas[3][FOC_DTC_POINTS]);
+float foc_dtc_phase(const foc_dtc_table *t, int phase, float current);
+void foc_dtc_mod_comp(const foc_dtc_table *t, float f_sw, float ia, float ib, float ic,
+		float *mod_alpha, float *mod_beta);
+
+#endif /* FOC_DTC_H_ */
@@ -0,0 +1,491 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "foc_hall.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Hall sensor model. The hall table from the detection has the center of
+ * every state, and the edges are assumed to be in the middle between them.
+ * As the sensors are not placed perfectly, the real edges can be several
+ * degrees away from that, which shows up as torque ripple at six times the
+ * electrical frequency when interpolating with a constant speed.
+ *
+ * The edges are passed at a known angle, so the time between three passes
+ * of the same edge gives the speed and acceleration over two revolutions.
+ * From them, the angles of the other edges can be calculated from when they
+ * were passed. The differences to the table are low pass filtered into an
+ * offset for every edge and direction. Their mean is kept at zero, as it
+ * can't be told apart from an error in the table. When the observer is
+ * used, which is at higher speed, the time from passing an edge until it is
+ * seen is learned from the observer angle at the edges.
+ *
+ * Between the edges the angle is extrapolated with the speed and the
+ * acceleration from the last sectors, but never past the next edge. At low
+ * speed two sectors are used, and at high speed enough of them to make the
+ * error from sampling the edges small.
+ */
+
+#define TABLE_TO_RAD			(2.0 * M_PI / 200.0)
+#define LEARN_GAIN				0.02
+#define DELAY_GAIN				0.01
+#define DELAY_MAX				1e-3
+#define DELAY_SPEED_MIN			50.0
+#define DEV_MAX					(M_PI / 6.0)
+#define FIT_SECTORS_MAX			6
+#define FIT_SAMPLES				100.0
+
+// Private functions
+static void build_maps(foc_hall_state *h, const uint8_t *table);
+static void resync(foc_hall_state *h, int hall);
+static void edge_seen(foc_hall_state *h, int edge, int dir, int state_new, float dt,
+		float ref_angle, bool ref_valid);
+static void calibrate(foc_hall_state *h);
+static float state_center(const foc_hall_state *h, int state, int dir);
+static float edge_span(const foc_hall_state *h, int from, int to, int dir);
+
+static inline float norm_angle(float a) {
+	a = fmodf(a, 2.0 * M_PI);
+	if (a < 0.0) {
+		a += 2.0 * M_PI;
+	}
+	return a;
+}
+
+// The angle from b to a when going forwards, 0 to 2 * pi
+static inline float progress(float a, float b) {
+	return norm_angle(a - b);
+}
+
+// The shortest angle from b to a, -pi to pi
+static inline float angle_diff(float a, float b) {
+	float d = progress(a, b);
+	if (d > M_PI) {
+		d -= 2.0 * M_PI;
+	}
+	return d;
+}
+
+/**
+ * Forget everything, including what has been learned.
+ */
+void foc_hall_reset(foc_hall_state *h) {
+	memset(h, 0, sizeof(foc_hall_state));
+	h->state = -1;
+}
+
+/**
+ * Run the model. Call this every control loop iteration.
+ *
+ * @param h
+ * The model state.
+ *
+ * @param table
+ * The hall table, with the angle of every state in 0 - 200 and 255 for
+ * invalid states. When it changes the learned offsets are cleared.
+ *
+ * @param hall
+ * The hall state now.
+ *
+ * @param dt
+ * Time since the last call. The edges are assumed to be in the middle of it.
+ *
+ * @param ref_angle
+ * Angle from another source, such as the observer.
+ *
+ * @param ref_valid
+ * ref_angle can be used to learn the delay of the sensors. It should be
+ * accurate to about one degree.
+ *
+ * @param interp_speed
+ * Below this speed in rad/s the center of the state is used, as in correct_hall.
+ *
+ * @return
+ * true if the table and the hall state are valid. The angle and the speed
+ * are in h->angle and h->speed_now.
+ */
+bool foc_hall_update(foc_hall_state *h, const uint8_t *table, int hall, float dt,
+		float ref_angle, bool ref_valid, float interp_speed) {
+	if (memcmp(h->table, table, sizeof(h->table)) != 0) {
+		build_maps(h, table);
+		memset(h->offset, 0, sizeof(h->offset));
+		memset(h->cal_cnt, 0, sizeof(h->cal_cnt));
+		h->state = -1;
+	}
+
+	if (!h->table_ok || hall < 0 || hall > 7 || h->next[hall] < 0) {
+		h->state = -1;
+		return false;
+	}
+
+	h->t_edge += dt;
+
+	if (h->state < 0) {
+		resync(h, hall);
+		return true;
+	}
+
+	if (hall != h->state) {
+		if (hall == h->next[h->state]) {
+			edge_seen(h, hall, 1, hall, dt, ref_angle, ref_valid);
+		} else if (h->next[hall] == h->state) {
+			edge_seen(h, h->state, -1, hall, dt, ref_angle, ref_valid);
+		} else {
+			// A state was skipped
+			resync(h, hall);
+			return true;
+		}
+
+		h->state = hall;
+	}
+
+	if (h->edges == 0) {
+		h->angle = state_center(h, hall, 1);
+		h->speed_now = 0.0;
+		return true;
+	}
+
+	float t = h->t_edge + h->delay;
+	if (t < 0.0) {
+		t = 0.0;
+	}
+
+	float prog, speed_now;
+	if (h->accel < 0.0 && (h->speed + h->accel * t) < 0.0) {
+		// Decelerating to a stop before the next edge
+		const float t_stop = -h->speed / h->accel;
+		prog = h->pos + h->speed * t_stop + 0.5 * h->accel * t_stop * t_stop;
+		speed_now = 0.0;
+	} else {
+		prog = h->pos + h->speed * t + 0.5 * h->accel * t * t;
+		speed_now = h->speed + h->accel * t;
+	}
+
+	// The next edge has not been seen yet, so the speed can't be higher than
+	// what it would take to reach it.
+	if (t > 0.0 && speed_now > (h->span / t)) {
+		speed_now = h->span / t;
+	}
+
+	if (prog < 0.0) {
+		prog = 0.0;
+	} else if (prog > h->span) {
+		prog = h->span;
+	}
+
+	if (speed_now < interp_speed) {
+		h->angle = state_center(h, hall, h->dir);
+	} else {
+		h->angle = norm_angle(h->ang_edge + (float)h->dir * prog);
+	}
+
+	h->speed_now = (float)h->dir * speed_now;
+
+	return true;
+}
+
+/**
+ * Get the learned angle of an edge.
+ *
+ * @param h
+ * The model state.
+ *
+ * @param state
+ * The state above the edge.
+ *
+ * @param dir
+ * Direction that the edge is passed in, 1 or -1.
+ *
+ * @return
+ * The angle in radians. Until the direction has been learned, the edges from
+ * the other direction are used.
+ */
+float foc_hall_edge_angle(const foc_hall_state *h, int state, int dir) {
+	int ind = dir > 0 ? 0 : 1;
+	if (h->cal_cnt[ind] == 0) {
+		ind = 1 - ind;
+	}
+	return norm_angle(h->nominal[state] + h->offset[ind][state]);
+}
+
+/*
+ * Find the neighbours and the nominal edges from the table. It must have six
+ * valid states at different angles.
+ */
+static void build_maps(foc_hall_state *h, const uint8_t *table) {
+	memcpy(h->table, table, sizeof(h->table));
+	h->table_ok = false;
+
+	int valid = 0;
+	for (int s = 0;s < 8;s++) {
+		h->next[s] = -1;
+		if (table[s] <= 200) {
+			valid++;
+		}
+	}
+
+	if (valid != 6) {
+		return;
+	}
+
+	int8_t next[8];
+	for (int s = 0;s < 8;s++) {
+		next[s] = -1;
+		if (table[s] > 200) {
+			continue;
+		}
+
+		int dist_min = 201;
+		for (int o = 0;o < 8;o++) {
+			if (o == s || table[o] > 200) {
+				continue;
+			}
+
+			int dist = ((int)table[o] - (int)table[s] + 200) % 200;
+			if (dist == 0) {
+				return;
+			}
+
+			if (dist < dist_min) {
+				dist_min = dist;
+				next[s] = o;
+			}
+		}
+	}
+
+	for (int s = 0;s < 8;s++) {
+		if (next[s] < 0) {
+			continue;
+		}
+
+		const int n = next[s];
+		const float ang = (float)table[s] * TABLE_TO_RAD;
+		h->nominal[n] = norm_angle(ang + 0.5 * progress((float)table[n] * TABLE_TO_RAD, ang));
+	}
+
+	memcpy(h->next, next, sizeof(h->next));
+	h->table_ok = true;
+}
+
+static void resync(foc_hall_state *h, int hall) {
+	h->state = hall;
+	h->dir = 0;
+	h->edges = 0;
+	h->t_edge = 0.0;
+	h->pos = 0.0;
+	h->speed = 0.0;
+	h->accel = 0.0;
+	h->angle = state_center(h, hall, 1);
+	h->speed_now = 0.0;
+}
+
+static void edge_seen(foc_hall_state *h, int edge, int dir, int state_new, float dt,
+		float ref_angle, bool ref_valid) {
+	// The edge happened somewhere since the previous sample
+	const float t_ago = 0.5 * dt;
+	const float interval = h->t_edge - t_ago;
+	h->t_edge = t_ago;
+
+	if (dir != h->dir) {
+		h->dir = dir;
+		h->edges = 0;
+		h->pos = 0.0;
+		h->speed = 0.0;
+		h->accel = 0.0;
+	}
+
+	memmove(&h->hist_edge[1], &h->hist_edge[0], (FOC_HALL_HIST - 1) * sizeof(h->hist_edge[0]));
+	memmove(&h->hist_dt[1], &h->hist_dt[0], (FOC_HALL_HIST - 1) * sizeof(h->hist_dt[0]));
+	h->hist_edge[0] = edge;
+	h->hist_dt[0] = interval;
+	if (h->edges < FOC_HALL_HIST) {
+		h->edges++;
+	}
+
+	h->ang_edge = foc_hall_edge_angle(h, edge, dir);
+	h->span = edge_span(h, edge, dir > 0 ? h->next[state_new] : state_new, dir);
+
+	if (h->edges >= 2) {
+		// The edges are only seen every sample, so at high speed more sectors
+		// are needed for the speed and the acceleration.
+		int n = 1;
+		float t_sum = h->hist_dt[0];
+		while (n < (h->edges - 1) && n < FIT_SECTORS_MAX && (n < 2 || t_sum < (FIT_SAMPLES * dt))) {
+			t_sum += h->hist_dt[n];
+			n++;
+		}
+
+		if (n == 1) {
+			h->pos = 0.0;
+			h->speed = edge_span(h, h->hist_edge[1], h->hist_edge[0], dir) / t_sum;
+			h->accel = 0.0;
+		} else {
+			// Least squares fit of ang = pos + speed * t + accel / 2 * t^2, with t
+			// in units of t_sum and going back in time from the last edge. The
+			// position is where the last edge actually was, which is only known
+			// to within a sample.
+			float s1 = 0.0, s2 = 0.0, s3 = 0.0, s4 = 0.0;
+			float y0 = 0.0, y1 = 0.0, y2 = 0.0;
+			float t = 0.0, ang = 0.0;
+			const float t_sum_inv = 1.0 / t_sum;
+
+			for (int j = 1;j <= n;j++) {
+				t -= h->hist_dt[j - 1] * t_sum_inv;
+				ang -= edge_span(h, h->hist_edge[j], h->hist_edge[j - 1], dir);
+				const float tt = t * t;
+				s1 += t;
+				s2 += tt;
+				s3 += tt * t;
+				s4 += tt * tt;
+				y0 += ang;
+				y1 += t * ang;
+				y2 += tt * ang;
+			}
+
+			const float s0 = (float)(n + 1);
+			const float m00 = s2 * s4 - s3 * s3;
+			const float m01 = s1 * s4 - s2 * s3;
+			const float m02 = s1 * s3 - s2 * s2;
+			const float det = s0 * m00 - s1 * m01 + s2 * m02;
+			const float det_inv = 1.0 / det;
+
+			h->pos = (y0 * m00 - s1 * (y1 * s4 - y2 * s3) + s2 * (y1 * s3 - y2 * s2)) * det_inv;
+			const float c1 = (s0 * (y1 * s4 - y2 * s3) - y0 * m01 + s2 * (s1 * y2 - s2 * y1)) * det_inv;
+			const float c2 = (s0 * (s2 * y2 - s3 * y1) - s1 * (s1 * y2 - s2 * y1) + y0 * m02) * det_inv;
+			float speed = c1 * t_sum_inv;
+			float accel = 2.0 * c2 * t_sum_inv * t_sum_inv;
+
+			// At most doubling or halving the speed over the last sector
+			const float w0 = edge_span(h, h->hist_edge[1], h->hist_edge[0], dir) / h->hist_dt[0];
+			const float acc_max = w0 / h->hist_dt[0];
+			if (accel > acc_max) {
+				accel = acc_max;
+			} else if (accel < -acc_max) {
+				accel = -acc_max;
+			}
+
+			if (speed < 0.5 * w0) {
+				speed = 0.5 * w0;
+			}
+
+			h->speed = speed;
+			h->accel = accel;
+		}
+	}
+
+	if (ref_valid && h->edges >= 3 && h->speed > DELAY_SPEED_MIN) {
+		const float delay = (float)dir * angle_diff(ref_angle, h->ang_edge) / h->speed - t_ago;
+		if (fabsf(delay) < DELAY_MAX) {
+			h->delay += DELAY_GAIN * (delay - h->delay);
+			h->delay_cnt++;
+		}
+	}
+
+	if (h->edges == FOC_HALL_HIST) {
+		calibrate(h);
+	}
+}
+
+/*
+ * Learn the edges from the last two revolutions. The angle is fitted as a
+ * second order polynomial of time through the three passes of the first edge,
+ * and the other edges are averaged over both revolutions.
+ */
+static void calibrate(foc_hall_state *h) {
+	const uint8_t *e = h->hist_edge;
+	const int last = FOC_HALL_HIST - 1;
+	const int rev = last / 2;
+
+	if (e[0] != e[rev] || e[rev] != e[last]) {
+		return;
+	}
+
+	float t[FOC_HALL_HIST];
+	t[last] = 0.0;
+	for (int j = last - 1;j >= 0;j--) {
+		t[j] = t[j + 1] + h->hist_dt[j];
+	}
+
+	const float a = t[rev];
+	const float b = t[0];
+
+	// Skip when the speed changed too much between the revolutions
+	const float rev_ratio = (b - a) / a;
+	if (rev_ratio < 0.7 || rev_ratio > 1.4) {
+		return;
+	}
+
+	const float ka = 2.0 * M_PI / (a * (a - b));
+	const float kb = 4.0 * M_PI / (b * (b - a));
+	const float ang_ref = h->nominal[e[last]];
+
+	float dev[6];
+	float mean = 0.0;
+	for (int i = 0;i < rev;i++) {
+		const float t1 = t[last - i];
+		const float t2 = t[rev - i];
+		const float p1 = ka * t1 * (t1 - b) + kb * t1 * (t1 - a);
+		const float p2 = ka * t2 * (t2 - b) + kb * t2 * (t2 - a);
+		const float p = 0.5 * (p1 + p2 - 2.0 * M_PI);
+
+		const float ang = h->nominal[e[last - i]];
+		const float nom = h->dir > 0 ? progress(ang, ang_ref) : progress(ang_ref, ang);
+
+		dev[i] = p - nom;
+		mean += dev[i];
+	}
+	mean /= (float)rev;
+
+	for (int i = 0;i < rev;i++) {
+		dev[i] -= mean;
+		if (fabsf(dev[i]) > DEV_MAX) {
+			return;
+		}
+	}
+
+	const int ind = h->dir > 0 ? 0 : 1;
+	float *offset = h->offset[ind];
+
+	// Start from the other direction, which only differs by the hysteresis
+	if (h->cal_cnt[ind] == 0) {
+		memcpy(offset, h->offset[1 - ind], sizeof(h->offset[0]));
+	}
+
+	for (int i = 0;i < rev;i++) {
+		const int s = e[last - i];
+		offset[s] += LEARN_GAIN * ((float)h->dir * dev[i] - offset[s]);
+	}
+
+	h->cal_cnt[ind]++;
+}
+
+static float state_center(const foc_hall_state *h, int state, int dir) {
+	const float lower = foc_hall_edge_angle(h, state, dir);
+	const float upper = foc_hall_edge_angle(h, h->next[state], dir);
+	return norm_angle(lower + 0.5 * progress(upper, lower));
+}
+
+// Angle between two edges along dir
+static float edge_span(const foc_hall_state *h, int from, int to, int dir) {
+	const float a_from = foc_hall_edge_angle(h, from, dir);
+	const float a_to = foc_hall_edge_angle(h, to, dir);
+	return dir > 0 ? progress(a_to, a_from) : progress(a_from, a_to);
+}
@@ -0,0 +1,67 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef FOC_HALL_H_
+#define FOC_HALL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Edges kept, which is two electrical revolutions
+#define FOC_HALL_HIST				13
+
+typedef struct {
+	// Learned deviation of the edges from the table, per direction. Indexed
+	// with the state above the edge.
+	float offset[2][8];
+	uint32_t cal_cnt[2];
+	// Time from when an edge is passed until it is seen
+	float delay;
+	uint32_t delay_cnt;
+
+	// Table that the maps below were made from
+	uint8_t table[8];
+	bool table_ok;
+	int8_t next[8];
+	float nominal[8];
+
+	int state;
+	int dir;
+	int edges;
+	uint8_t hist_edge[FOC_HALL_HIST];
+	float hist_dt[FOC_HALL_HIST];
+	float t_edge;
+	float ang_edge;
+	float span;
+	float pos;
+	float speed;
+	float accel;
+
+	// Output
+	float angle;
+	float speed_now;
+} foc_hall_state;
+
+// Functions
+void foc_hall_reset(foc_hall_state *h);
+bool foc_hall_update(foc_hall_state *h, const uint8_t *table, int hall, float dt,
+		float ref_angle, bool ref_valid, float interp_speed);
+float foc_hall_edge_angle(const foc_hall_state *h, int state, int dir);
+
+#endif /* FOC_HALL_H_ */
@@ -0,0 +1,327 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "foc_svm.h"
+
+#include <math.h>
+
+/*
+ * Space vector modulation by zero sequence injection. The phase voltages
+ * of the reference are computed directly and the same offset is added to
+ * all of them, chosen from their maximum and minimum. The centered offset
+ * gives the same timings as the classic sector based SVM, and the other
+ * offsets clamp one phase to a rail (discontinuous PWM), which removes a
+ * third of the switching.
+ *
+ * Beyond the linear region the modulation follows the two mode method of
+ * Bolognani and Zigliotto: in mode I the reference is amplified and clamped
+ * to the hexagon, and in mode II it stays on the hexagon with the middle
+ * phase held at the nearest vertex for part of every sector, until six-step
+ * is reached. The gain and the hold that give the requested fundamental
+ * are precomputed in foc_svm_init.
+ */
+
+#define HOLD_SIX_STEP			0.4999
+#define FUND_STEPS				24
+#define TAB_SCALE				((float)(FOC_SVM_OVERMOD_TAB_LEN - 1) / (FOC_SVM_MOD_SIX_STEP - FOC_SVM_MOD_LINEAR))
+
+// Private variables
+static float m_gain_tab[FOC_SVM_OVERMOD_TAB_LEN];
+static float m_hold_tab[FOC_SVM_OVERMOD_TAB_LEN];
+static float m_fund_cos[FUND_STEPS];
+static float m_fund_sin[FUND_STEPS];
+static bool m_init_done = false;
+
+// Sector as in the classic SVM from which phase is above the next one
+static const uint8_t m_sector_tab[8] = {1, 6, 2, 1, 4, 5, 3, 1};
+
+// Private functions
+static inline int duty_overmod(float alpha, float beta, foc_svm_mode mode, bool overmod, float *duty);
+static inline int duty_from_ref(float alpha, float beta, foc_svm_mode mode, float gain, float hold, float *duty);
+static float fundamental(float mod, float gain, float hold);
+
+/**
+ * Build the overmodulation table. Only does something the first time.
+ */
+void foc_svm_init(void) {
+	if (m_init_done) {
+		return;
+	}
+
+	// All sectors look the same, so it is enough to integrate over one
+	for (int i = 0;i < FUND_STEPS;i++) {
+		float ang = ((float)i + 0.5) / (float)FUND_STEPS * (M_PI / 3.0);
+		m_fund_cos[i] = cosf(ang);
+		m_fund_sin[i] = sinf(ang);
+	}
+
+	const float hex_fund = fundamental(FOC_SVM_MOD_LINEAR, 100.0, 0.0);
+
+	for (int i = 0;i < FOC_SVM_OVERMOD_TAB_LEN;i++) {
+		float mod = FOC_SVM_MOD_LINEAR + (FOC_SVM_MOD_SIX_STEP - FOC_SVM_MOD_LINEAR) *
+				(float)i / (float)(FOC_SVM_OVERMOD_TAB_LEN - 1);
+
+		// The fundamental grows with the gain and the hold, so both can
+		// be found with bisection.
+		if (mod <= hex_fund) {
+			float lo = 1.0, hi = 100.0;
+			for (int j = 0;j < 24;j++) {
+				float mid = 0.5 * (lo + hi);
+				if (fundamental(mod, mid, 0.0) < mod) {
+					lo = mid;
+				} else {
+					hi = mid;
+				}
+			}
+			m_gain_tab[i] = 0.5 * (lo + hi);
+			m_hold_tab[i] = 0.0;
+		} else {
+			float lo = 0.0, hi = 0.5;
+			for (int j = 0;j < 20;j++) {
+				float mid = 0.5 * (lo + hi);
+				if (fundamental(mod, 100.0, mid) < mod) {
+					lo = mid;
+				} else {
+					hi = mid;
+				}
+			}
+			m_gain_tab[i] = 100.0;
+			m_hold_tab[i] = 0.5 * (lo + hi);
+		}
+	}
+
+	// The last entry is six-step, where the hold only has to reach HOLD_SIX_STEP
+	m_hold_tab[FOC_SVM_OVERMOD_TAB_LEN - 1] = 0.5;
+
+	m_init_done = true;
+}
+
+static inline int duty_overmod(float alpha, float beta, foc_svm_mode mode, bool overmod, float *duty) {
+	float gain = 1.0;
+	float hold = 0.0;
+
+	if (overmod && m_init_done) {
+		float mag_sq = alpha * alpha + beta * beta;
+
+		if (mag_sq > (FOC_SVM_MOD_LINEAR * FOC_SVM_MOD_LINEAR)) {
+			float mag = sqrtf(mag_sq);
+			float pos = (mag - FOC_SVM_MOD_LINEAR) * TAB_SCALE;
+
+			if (pos >= (float)(FOC_SVM_OVERMOD_TAB_LEN - 1)) {
+				gain = m_gain_tab[FOC_SVM_OVERMOD_TAB_LEN - 1];
+				hold = m_hold_tab[FOC_SVM_OVERMOD_TAB_LEN - 1];
+			} else {
+				int ind = (int)pos;
+				float frac = pos - (float)ind;
+				gain = m_gain_tab[ind] + (m_gain_tab[ind + 1] - m_gain_tab[ind]) * frac;
+				hold = m_hold_tab[ind] + (m_hold_tab[ind + 1] - m_hold_tab[ind]) * frac;
+			}
+		}
+	}
+
+	return duty_from_ref(alpha, beta, mode, gain, hold, duty);
+}
+
+/**
+ * Calculate duty cycles from a normalized voltage.
+ *
+ * @param alpha
+ * Normalized alpha voltage, 1 corresponds to 2/3 * v_bus.
+ *
+ * @param beta
+ * Normalized beta voltage.
+ *
+ * @param mode
+ * Zero sequence to use. In the overmodulation region all modes are the same.
+ *
+ * @param overmod
+ * Make the fundamental follow the magnitude up to FOC_SVM_MOD_SIX_STEP. Without
+ * this, magnitudes above FOC_SVM_MOD_LINEAR are clamped to the hexagon.
+ *
+ * @param duty
+ * Duty cycles of the three phases between 0 and 1. Inside of the hexagon they
+ * can be outside of that range by rounding errors.
+ */
+void foc_svm_duty(float alpha, float beta, foc_svm_mode mode, bool overmod, float *duty) {
+	duty_overmod(alpha, beta, mode, overmod, duty);
+}
+
+/**
+ * Space vector modulation. Replaces the sector based svm that was used in
+ * mcpwm_foc.c, with the same arguments and the same timings for
+ * FOC_SVM_MODE_CENTERED.
+ *
+ * @param alpha
+ * Normalized alpha voltage, 1 corresponds to 2/3 * v_bus.
+ *
+ * @param beta
+ * Normalized beta voltage.
+ *
+ * @param top
+ * The peak value of the PWM counter.
+ *
+ * @param mode
+ * Zero sequence to use.
+ *
+ * @param overmod
+ * Use overmodulation above FOC_SVM_MOD_LINEAR.
+ *
+ * @param tA
+ * PWM duty cycle phase A (0 = off all of the time, top = on all of the time)
+ *
+ * @param tB
+ * PWM duty cycle phase B
+ *
+ * @param tC
+ * PWM duty cycle phase C
+ *
+ * @param sector
+ * Sector of the voltage, 1 - 6.
+ */
+void foc_svm(float alpha, float beta, uint32_t top, foc_svm_mode mode, bool overmod,
+		uint32_t *tA, uint32_t *tB, uint32_t *tC, uint32_t *sector) {
+	float duty[3];
+	int sector_ind = duty_overmod(alpha, beta, mode, overmod, duty);
+
+	// Round, so that a clamped phase ends up exactly at 0 or top
+	const float top_f = (float)top;
+	*tA = (uint32_t)(duty[0] * top_f + 0.5);
+	*tB = (uint32_t)(duty[1] * top_f + 0.5);
+	*tC = (uint32_t)(duty[2] * top_f + 0.5);
+	*sector = m_sector_tab[sector_ind];
+}
+
+const char *foc_svm_mode_name(foc_svm_mode mode) {
+	switch (mode) {
+	case FOC_SVM_MODE_CENTERED: return "Centered";
+	case FOC_SVM_MODE_DPWM_MIN: return "DPWM min";
+	case FOC_SVM_MODE_DPWM_MAX: return "DPWM max";
+	case FOC_SVM_MODE_DPWM1: return "DPWM1";
+	default: return "Unknown";
+	}
+}
+
+/*
+ * Returns the index in m_sector_tab. Uses comparisons instead of fminf and
+ * fmaxf, as they are library calls without -ffast-math.
+ */
+static inline int duty_from_ref(float alpha, float beta, foc_svm_mode mode, float gain, float hold, float *duty) {
+	// Phase voltages in units of v_bus
+	const float k = (2.0 / 3.0) * gain;
+	const float ka = k * alpha;
+	const float kb = k * FOC_SVM_MOD_LINEAR * beta;
+	float ua = ka;
+	float ub = -0.5 * ka + kb;
+	float uc = -0.5 * ka - kb;
+
+	const int ind = (ua > ub) | (ub > uc) << 1 | (uc > ua) << 2;
+
+	float max = ua > ub ? ua : ub;
+	max = uc > max ? uc : max;
+	float min = ua < ub ? ua : ub;
+	min = uc < min ? uc : min;
+	const float span = max - min;
+
+	// Outside of the hexagon. Scale down, keeping the angle.
+	const bool on_hex = span > 1.0;
+	if (on_hex) {
+		const float scale = 1.0 / span;
+		ua *= scale;
+		ub *= scale;
+		uc *= scale;
+		max *= scale;
+		min *= scale;
+	}
+
+	float offset;
+	switch (mode) {
+	case FOC_SVM_MODE_DPWM_MIN:
+		offset = -min;
+		break;
+
+	case FOC_SVM_MODE_DPWM_MAX:
+		offset = 1.0 - max;
+		break;
+
+	case FOC_SVM_MODE_DPWM1:
+		offset = (max + min) > 0.0 ? 1.0 - max : -min;
+		break;
+
+	default:
+		offset = 0.5 - 0.5 * (max + min);
+		break;
+	}
+
+	duty[0] = ua + offset;
+	duty[1] = ub + offset;
+	duty[2] = uc + offset;
+
+	// Inside of the hexagon the duty cycles are between 0 and 1, apart from
+	// rounding errors that the conversion to timer counts takes care of.
+	if (!on_hex) {
+		return ind;
+	}
+
+	// On the hexagon one phase is high and one low. Hold the middle one
+	// at the closest of them near the vertices.
+	for (int i = 0;i < 3;i++) {
+		float d = duty[i];
+
+		if (hold >= HOLD_SIX_STEP) {
+			d = d >= 0.5 ? 1.0 : 0.0;
+		} else if (hold > 0.0) {
+			d = (d - hold) / (1.0 - 2.0 * hold);
+		}
+
+		if (d < 0.0) {
+			d = 0.0;
+		} else if (d > 1.0) {
+			d = 1.0;
+		}
+
+		duty[i] = d;
+	}
+
+	return ind;
+}
+
+/*
+ * The fundamental of the output voltage over a period, when the reference
+ * with magnitude mod is amplified with gain and the middle phase is held
+ * with hold on the hexagon.
+ */
+static float fundamental(float mod, float gain, float hold) {
+	float sum = 0.0;
+
+	for (int i = 0;i < FUND_STEPS;i++) {
+		const float c = m_fund_cos[i];
+		const float s = m_fund_sin[i];
+
+		float duty[3];
+		duty_from_ref(mod * c, mod * s, FOC_SVM_MODE_CENTERED, gain, hold, duty);
+
+		// alpha and beta of the output, in the same normalization
+		float alpha = 0.5 * (2.0 * duty[0] - duty[1] - duty[2]);
+		float beta = FOC_SVM_MOD_LINEAR * (duty[1] - duty[2]);
+
+		sum += alpha * c + beta * s;
+	}
+
+	return sum / (float)FUND_STEPS;
+}
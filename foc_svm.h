@@ -0,0 +1,54 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef FOC_SVM_H_
+#define FOC_SVM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Largest modulation in the linear region and with six-step, in the
+// normalization of mod_alpha and mod_beta (1 = 2/3 * v_bus)
+#define FOC_SVM_MOD_LINEAR			(0.86602540378)
+#define FOC_SVM_MOD_SIX_STEP		(0.95492965855)
+
+// Entries in the overmodulation table
+#define FOC_SVM_OVERMOD_TAB_LEN		32
+
+typedef enum {
+	// Continuous, with the zero vectors split equally. Same as the classic SVM.
+	FOC_SVM_MODE_CENTERED = 0,
+	// The lowest phase is kept low, so no phase switches for 120 degrees
+	FOC_SVM_MODE_DPWM_MIN,
+	// The highest phase is kept high
+	FOC_SVM_MODE_DPWM_MAX,
+	// The phase with the largest voltage is kept at its rail for 60 degrees
+	// around its peak, where it has most current with a high power factor.
+	FOC_SVM_MODE_DPWM1,
+	FOC_SVM_MODE_NUM
+} foc_svm_mode;
+
+// Functions
+void foc_svm_init(void);
+void foc_svm(float alpha, float beta, uint32_t top, foc_svm_mode mode, bool overmod,
+		uint32_t *tA, uint32_t *tB, uint32_t *tC, uint32_t *sector);
+void foc_svm_duty(float alpha, float beta, foc_svm_mode mode, bool overmod, float *duty);
+const char *foc_svm_mode_name(foc_svm_mode mode);
+
+#endif /* FOC_SVM_H_ */
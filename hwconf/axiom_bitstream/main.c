@@ -0,0 +1,389 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+	*/
+
+/*
+ * Picks the chunk size for the compressed Axiom FPGA bitstream and
+ * generates hw_axiom_fpga_bitstream.c with it.
+ *
+ * Usage: axiom_bitstream [options] bitstream.bin|hw_axiom_fpga_bitstream.c
+ *
+ * -s hz     SPI clock during loading (default 10.5 MHz)
+ * -d MB/s   Decompression rate on the target, as printed by axiom_fpga_bench
+ * -b hz     Software SPI clock, for comparison with the old loader
+ * -p us     Overhead per chunk, for starting the DMA and reading the header
+ * -r bytes  Largest RAM to spend on the two chunk buffers
+ * -k size   Use this chunk size for the output instead of the best one
+ * -o file   Write the compressed bitstream as a C file
+ *
+ * Each chunk is a two byte big endian compressed length followed by the
+ * LZO1X data. The load time is modeled from the size of each chunk and
+ * from how long it takes to decompress on the host, scaled to the rate
+ * on the target. With double buffering the SPI transfer of one chunk
+ * overlaps the decompression of the next, so only the first
+ * decompression and the last transfer are not hidden. Small chunks cost
+ * more overhead and compress worse, large chunks make the parts that are
+ * not hidden longer and cost RAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "minilzo.h"
+
+#define CHUNK_MIN			256
+#define CHUNK_MAX			16384
+#define CHUNK_STEP			256
+#define DUMMY_BYTES			7
+#define HOST_REPS			50
+
+typedef struct {
+	int chunk;
+	int chunks;
+	int compressed;
+	double t_seq;
+	double t_pipe;
+	double t_sw;
+} result_t;
+
+static double spi_hz = 10.5e6;
+static double sw_spi_hz = 2.0e6;
+static double dec_rate = 20.0e6;
+static double chunk_overhead = 5e-6;
+static int ram_max = 16384;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint8_t *read_file(const char *path, long *size) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return NULL;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	uint8_t *data = malloc(len > 0 ? (size_t)len + 1 : 1);
+	if (!data || fread(data, 1, (size_t)len, f) != (size_t)len) {
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+
+	data[len] = 0;
+	fclose(f);
+	*size = len;
+	return data;
+}
+
+// Parses the array of a C file with a compressed bitstream
+static uint8_t *parse_c_array(const char *text, long *size) {
+	const char *p = strchr(text, '{');
+	if (!p) {
+		return NULL;
+	}
+
+	uint8_t *data = malloc(strlen(p));
+	long len = 0;
+
+	while (*p && *p != '}') {
+		if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+			char *end;
+			data[len++] = (uint8_t)strtoul(p, &end, 16);
+			p = end;
+		} else {
+			p++;
+		}
+	}
+
+	*size = len;
+	return data;
+}
+
+// Reverses the chunked compression, for starting from an existing C file
+static uint8_t *decompress_chunks(const uint8_t *in, long in_len, long *size) {
+	uint8_t *out = malloc(CHUNK_MAX * 64 + 65536);
+	long out_len = 0;
+	long index = 0;
+	long out_max = CHUNK_MAX * 64;
+
+	while (index + 2 <= in_len) {
+		lzo_uint comp = ((lzo_uint)in[index] << 8) | in[index + 1];
+		index += 2;
+
+		if (comp == 0 || index + (long)comp > in_len) {
+			break;
+		}
+
+		if (out_len + 65536 > out_max) {
+			out_max *= 2;
+			out = realloc(out, out_max + 65536);
+		}
+
+		lzo_uint len = 65536;
+		if (lzo1x_decompress_safe(in + index, comp, out + out_len, &len, NULL) != LZO_E_OK) {
+			free(out);
+			return NULL;
+		}
+
+		out_len += len;
+		index += comp;
+	}
+
+	*size = out_len;
+	return out;
+}
+
+// Compresses in chunks and models the load time. Returns the compressed
+// data if out is set.
+static result_t evaluate(const uint8_t *bin, long bin_len, int chunk, uint8_t **out) {
+	static lzo_align_t __LZO_MMODEL wrkmem[(LZO1X_1_MEM_COMPRESS + sizeof(lzo_align_t) - 1) / sizeof(lzo_align_t)];
+	static uint8_t tmp[CHUNK_MAX];
+
+	result_t r;
+	memset(&r, 0, sizeof(r));
+	r.chunk = chunk;
+	r.chunks = (int)(bin_len / chunk + 1);
+
+	uint8_t *comp = malloc((size_t)bin_len + (size_t)bin_len / 16 + 64 + 3 * (size_t)r.chunks + 16);
+	long comp_len = 0;
+
+	// Host decompression time of all chunks, for scaling each one below
+	double *t_host = malloc(sizeof(double) * (size_t)r.chunks);
+	double t_host_total = 0.0;
+
+	// The last chunk is the remainder, which can be empty. The loader
+	// always expects it, so it is kept as an empty chunk in that case.
+	for (int i = 0; i < r.chunks; i++) {
+		long start = (long)i * chunk;
+		long len = i == (r.chunks - 1) ? bin_len % chunk : chunk;
+
+		lzo_uint clen = 0;
+		lzo1x_1_compress(bin + start, (lzo_uint)len, comp + comp_len + 2, &clen, wrkmem);
+		comp[comp_len] = (uint8_t)(clen >> 8);
+		comp[comp_len + 1] = (uint8_t)clen;
+
+		double t0 = now();
+		for (int n = 0; n < HOST_REPS; n++) {
+			lzo_uint dlen = (lzo_uint)len;
+			lzo1x_decompress_safe(comp + comp_len + 2, clen, tmp, &dlen, NULL);
+		}
+		t_host[i] = (now() - t0) / HOST_REPS;
+		t_host_total += t_host[i];
+
+		comp_len += 2 + (long)clen;
+	}
+
+	r.compressed = (int)comp_len;
+
+	double host_rate = (double)bin_len / t_host_total;
+	double scale = host_rate / dec_rate;
+	double cpu = 0.0;
+	double spi_free = 0.0;
+
+	for (int i = 0; i < r.chunks; i++) {
+		long len = i == (r.chunks - 1) ? bin_len % chunk : chunk;
+		double t_dec = t_host[i] * scale;
+		double t_spi = (double)len * 8.0 / spi_hz;
+
+		r.t_seq += t_dec + chunk_overhead + t_spi;
+		r.t_sw += t_dec + (double)len * 8.0 / sw_spi_hz;
+
+		// Decompress into the free buffer, wait for the other one to be sent
+		// and start sending this one
+		cpu += t_dec;
+		if (spi_free > cpu) {
+			cpu = spi_free;
+		}
+		cpu += chunk_overhead;
+		spi_free = cpu + t_spi;
+	}
+
+	double t_dummy = DUMMY_BYTES * 8.0 / spi_hz;
+	r.t_seq += t_dummy;
+	r.t_pipe = spi_free + chunk_overhead + t_dummy;
+	r.t_sw += DUMMY_BYTES * 8.0 / sw_spi_hz;
+
+	free(t_host);
+
+	if (out) {
+		*out = comp;
+	} else {
+		free(comp);
+	}
+
+	return r;
+}
+
+static bool write_c_file(const char *path, const uint8_t *comp, int comp_len, int chunk, long bin_len) {
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		return false;
+	}
+
+	fprintf(f, "// Generated by hwconf/axiom_bitstream\n");
+	fprintf(f, "#define BITSTREAM_CHUNK_SIZE\t\t%d\n", chunk);
+	fprintf(f, "#define BITSTREAM_SIZE\t\t\t\t%ld\n\n", bin_len);
+	fprintf(f, "const unsigned char FPGA_bitstream[%d] =\n{\n", comp_len);
+
+	for (int i = 0; i < comp_len; i++) {
+		if ((i % 8) == 0) {
+			fprintf(f, "    ");
+		}
+		fprintf(f, "0x%02x", comp[i]);
+		if (i < (comp_len - 1)) {
+			fprintf(f, (i % 8) == 7 ? ",\n" : ", ");
+		}
+	}
+
+	fprintf(f, "\n};\n");
+	fclose(f);
+	return true;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: axiom_bitstream [-s spi_hz] [-d dec_MB/s] [-b sw_spi_hz] [-p chunk_us]\n"
+			"                       [-r ram_bytes] [-k chunk] [-o out.c] bitstream.bin|bitstream.c\n");
+}
+
+int main(int argc, char **argv) {
+	const char *in = NULL;
+	const char *out_path = NULL;
+	int chunk_forced = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			spi_hz = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			dec_rate = atof(argv[++i]) * 1e6;
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			sw_spi_hz = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			chunk_overhead = atof(argv[++i]) * 1e-6;
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			ram_max = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+			chunk_forced = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			out_path = argv[++i];
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			in = argv[i];
+		}
+	}
+
+	if (!in || spi_hz <= 0.0 || dec_rate <= 0.0 || sw_spi_hz <= 0.0 ||
+			chunk_forced < 0 || chunk_forced > CHUNK_MAX) {
+		usage();
+		return 1;
+	}
+
+	if (lzo_init() != LZO_E_OK) {
+		fprintf(stderr, "Could not initialize LZO\n");
+		return 1;
+	}
+
+	long file_len = 0;
+	uint8_t *file = read_file(in, &file_len);
+	if (!file) {
+		fprintf(stderr, "Could not read %s\n", in);
+		return 1;
+	}
+
+	// A C file is an already compressed bitstream
+	uint8_t *bin = file;
+	long bin_len = file_len;
+	size_t in_len = strlen(in);
+	if (in_len > 2 && strcmp(in + in_len - 2, ".c") == 0) {
+		long comp_len = 0;
+		uint8_t *comp = parse_c_array((const char*)file, &comp_len);
+		bin = comp ? decompress_chunks(comp, comp_len, &bin_len) : NULL;
+		free(comp);
+		free(file);
+
+		if (!bin) {
+			fprintf(stderr, "Could not decompress the bitstream in %s\n", in);
+			return 1;
+		}
+	}
+
+	printf("Bitstream: %ld bytes, SPI %.2f MHz, decompression %.1f MB/s, %.1f us per chunk\n\n",
+			bin_len, spi_hz / 1e6, dec_rate / 1e6, chunk_overhead * 1e6);
+	printf("  chunk  chunks  compressed    RAM   software  sequential  pipelined\n");
+
+	result_t best;
+	memset(&best, 0, sizeof(best));
+
+	for (int chunk = CHUNK_MIN; chunk <= CHUNK_MAX; chunk += CHUNK_STEP) {
+		result_t r = evaluate(bin, bin_len, chunk, NULL);
+		bool fits = 2 * chunk <= ram_max;
+
+		if (fits && (best.chunk == 0 || r.t_pipe < best.t_pipe)) {
+			best = r;
+		}
+
+		printf("  %5d  %6d  %10d  %5d  %6.2f ms  %7.2f ms  %6.2f ms%s\n",
+				r.chunk, r.chunks, r.compressed, 2 * chunk,
+				r.t_sw * 1e3, r.t_seq * 1e3, r.t_pipe * 1e3, fits ? "" : "  (RAM)");
+	}
+
+	if (best.chunk == 0) {
+		fprintf(stderr, "No chunk size fits in %d bytes of RAM\n", ram_max);
+		free(bin);
+		return 1;
+	}
+
+	printf("\nBest chunk size: %d, %.2f ms pipelined, %.2f ms with the software SPI\n",
+			best.chunk, best.t_pipe * 1e3, best.t_sw * 1e3);
+
+	if (out_path) {
+		int chunk = chunk_forced ? chunk_forced : best.chunk;
+		uint8_t *comp = NULL;
+		result_t r = evaluate(bin, bin_len, chunk, &comp);
+
+		// Check that the loader gets the bitstream back
+		long check_len = 0;
+		uint8_t *check = decompress_chunks(comp, r.compressed, &check_len);
+		bool ok = check && check_len == bin_len && memcmp(check, bin, (size_t)bin_len) == 0;
+		free(check);
+
+		if (!ok || !write_c_file(out_path, comp, r.compressed, chunk, bin_len)) {
+			fprintf(stderr, "Could not write %s\n", out_path);
+			free(comp);
+			free(bin);
+			return 1;
+		}
+
+		printf("Wrote %s with chunk size %d, %d bytes\n", out_path, chunk, r.compressed);
+		free(comp);
+	}
+
+	free(bin);
+	return 0;
+}
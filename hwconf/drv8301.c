@@ -21,6 +21,7 @@
 #ifdef HW_HAS_DRV8301
 
 #include "drv8301.h"
+#include "drv_regs.h"
 #include "ch.h"
 #include "hal.h"
 #include "stm32f4xx_conf.h"
@@ -31,7 +32,15 @@
 #include <stdio.h>
 #include "mc_interface.h"
 
+#ifdef DRV8301_CS_GPIO2
+#define DRV_CNT		2
+#else
+#define DRV_CNT		1
+#endif
+
 // Private functions
+static bool read_regs(int first, int cnt, uint16_t *values, drv_status_change *change);
+static drv_shadow *shadow_now(void);
 static uint16_t spi_exchange(uint16_t x);
 static void spi_transfer(uint16_t *in_buf, const uint16_t *out_buf, int length);
 static void spi_begin(void);
@@ -41,14 +50,35 @@ static void terminal_read_reg(int argc, const char **argv);
 static void terminal_write_reg(int argc, const char **argv);
 static void terminal_set_oc_adj(int argc, const char **argv);
 static void terminal_print_faults(int argc, const char **argv);
+static void terminal_dump_regs(int argc, const char **argv);
 
 // Private variables
 static char m_fault_print_buffer[120];
 static mutex_t m_spi_mutex;
+static drv_shadow m_shadow[DRV_CNT];
+
+static const drv_regs_def m_regs_def = {
+		"DRV8301",
+		4, // Registers
+		true, // Delayed response
+		true, // Checked response
+		{0x7FF, 0x080}, // Status masks
+		{0, 4}, // Status shifts
+		{
+				{"FETLC_OC", "FETHC_OC", "FETLB_OC", "FETHB_OC", "FETLA_OC", "FETHA_OC",
+						"OTW", "OTSD", "PVDD_UV", "GVDD_UV", "FAULT"},
+				{0, 0, 0, 0, 0, 0, 0, "GVDD_OV", 0, 0, 0}
+		},
+		0, (1 << 10) // FAULT
+};
 
 void drv8301_init(void) {
 	chMtxObjectInit(&m_spi_mutex);
 
+	for (int i = 0;i < DRV_CNT;i++) {
+		drv_shadow_init(&m_shadow[i]);
+	}
+
 	// DRV8301 SPI
 	palSetPadMode(DRV8301_MISO_GPIO, DRV8301_MISO_PIN, PAL_MODE_INPUT);
 	palSetPadMode(DRV8301_SCK_GPIO, DRV8301_SCK_PIN, PAL_MODE_OUTPUT_PUSHPULL | PAL_STM32_OSPEED_HIGHEST);
@@ -90,6 +120,14 @@ void drv8301_init(void) {
 			"Print all current DRV8301 faults.",
 			0,
 			terminal_print_faults);
+
+	terminal_register_command_callback(
+			"drv8301_dump_regs",
+			"Read all DRV8301 registers and print them, and the last status change.",
+			0,
+			terminal_dump_regs);
+
+	drv_regs_start_status_thread(&m_regs_def, DRV_CNT, read_regs);
 }
 
 /**
@@ -165,9 +203,9 @@ void drv8301_set_current_amp_gain(int gain) {
  *
  */
 int drv8301_read_faults(void) {
-	int r0 = drv8301_read_reg(0);
-	int r1 = drv8301_read_reg(1);
-	return (r0 & 0x3FF) | ((r1 & 0x80) << 4);
+	uint16_t status[DRV_REGS_STATUS];
+	read_regs(0, DRV_REGS_STATUS, status, 0);
+	return drv_regs_faults(&m_regs_def, status);
 }
 
 /**
@@ -239,38 +277,69 @@ char* drv8301_faults_to_string(int faults) {
 }
 
 unsigned int drv8301_read_reg(int reg) {
-	uint16_t out = 0;
-	out |= (1 << 15);
-	out |= (reg & 0x0F) << 11;
-	out |= 0x807F;
+	uint16_t res;
+	read_regs(reg, 1, &res, 0);
+	return res;
+}
+
+void drv8301_write_reg(int reg, int data) {
+	uint16_t out = drv_regs_write_cmd(reg, data);
+
+	chMtxLock(&m_spi_mutex);
+	spi_begin();
+	spi_exchange(out);
+	spi_end();
+	drv_shadow_set(shadow_now(), reg, data & DRV_REGS_DATA_MASK);
+	chMtxUnlock(&m_spi_mutex);
+}
+
+/**
+ * Read several registers with the read commands back to back.
+ *
+ * @param change
+ * Set to how the status registers changed, can be NULL.
+ *
+ * @return
+ * true if the response was valid.
+ */
+static bool read_regs(int first, int cnt, uint16_t *values, drv_status_change *change) {
+	uint16_t tx[DRV_REGS_MAX + 1];
+	uint16_t rx[DRV_REGS_MAX + 1];
+	int frames = drv_regs_batch_cmd(&m_regs_def, first, cnt, tx);
 
 	chMtxLock(&m_spi_mutex);
 
-	if (reg != 0) {
+	for (int i = 0;i < frames;i++) {
 		spi_begin();
-		spi_exchange(out);
+		rx[i] = spi_exchange(tx[i]);
 		spi_end();
 	}
 
-	spi_begin();
-	uint16_t res = spi_exchange(0xFFFF);
-	spi_end();
+	bool ok = drv_regs_batch_parse(&m_regs_def, first, cnt, rx, values);
+	drv_shadow *s = shadow_now();
+	drv_status_change res = DRV_STATUS_SAME;
+
+	if (ok) {
+		res = drv_shadow_update(&m_regs_def, s, first, cnt, values);
+	} else {
+		s->error_cnt++;
+	}
 
 	chMtxUnlock(&m_spi_mutex);
 
-	return res;
-}
+	if (change) {
+		*change = res;
+	}
 
-void drv8301_write_reg(int reg, int data) {
-	uint16_t out = 0;
-	out |= (reg & 0x0F) << 11;
-	out |= data & 0x7FF;
+	return ok;
+}
 
-	chMtxLock(&m_spi_mutex);
-	spi_begin();
-	spi_exchange(out);
-	spi_end();
-	chMtxUnlock(&m_spi_mutex);
+static drv_shadow *shadow_now(void) {
+#if DRV_CNT == 2
+	return &m_shadow[mc_interface_motor_now() == 2 ? 1 : 0];
+#else
+	return &m_shadow[0];
+#endif
 }
 
 // Software SPI
@@ -419,6 +488,46 @@ static void terminal_print_faults(int argc, const char **argv) {
 	(void)argc;
 	(void)argv;
 	commands_printf(drv8301_faults_to_string(drv8301_read_faults()));
+
+	drv_shadow *s = shadow_now();
+	if (s->change_cnt > 0) {
+		char buf[120];
+		drv_regs_diff_to_string(&m_regs_def, s->change_old, s->change_new, buf, sizeof(buf));
+		commands_printf("Last change: %s", buf);
+	}
+}
+
+static void terminal_dump_regs(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	uint16_t regs[DRV_REGS_MAX];
+	if (!read_regs(0, m_regs_def.reg_cnt, regs, 0)) {
+		commands_printf("Invalid response.\n");
+		return;
+	}
+
+	for (int i = 0;i < m_regs_def.reg_cnt;i++) {
+		char bl[9];
+		char bh[9];
+
+		utils_byte_to_binary((regs[i] >> 8) & 0xFF, bh);
+		utils_byte_to_binary(regs[i] & 0xFF, bl);
+
+		commands_printf("Reg 0x%02x: %s %s (0x%04x)", i, bh, bl, regs[i]);
+	}
+
+	drv_shadow *s = shadow_now();
+	commands_printf("Status reads: %u, Errors: %u, Changes: %u",
+			(unsigned int)s->update_cnt, (unsigned int)s->error_cnt, (unsigned int)s->change_cnt);
+
+	if (s->change_cnt > 0) {
+		char buf[120];
+		drv_regs_diff_to_string(&m_regs_def, s->change_old, s->change_new, buf, sizeof(buf));
+		commands_printf("Last change: %s", buf);
+	}
+
+	commands_printf(" ");
 }
 
 #endif
@@ -21,6 +21,7 @@
 #ifdef HW_HAS_DRV8320S
 
 #include "drv8320s.h"
+#include "drv_regs.h"
 #include "ch.h"
 #include "hal.h"
 #include "stm32f4xx_conf.h"
@@ -29,8 +30,17 @@
 #include "commands.h"
 #include <string.h>
 #include <stdio.h>
+#include "mc_interface.h"
+
+#ifdef DRV8320S_CS_GPIO2
+#define DRV_CNT		2
+#else
+#define DRV_CNT		1
+#endif
 
 // Private functions
+static bool read_regs(int first, int cnt, uint16_t *values, drv_status_change *change);
+static drv_shadow *shadow_now(void);
 static uint16_t spi_exchange(uint16_t x);
 static void spi_transfer(uint16_t *in_buf, const uint16_t *out_buf, int length);
 static void spi_begin(void);
@@ -40,14 +50,36 @@ static void terminal_read_reg(int argc, const char **argv);
 static void terminal_write_reg(int argc, const char **argv);
 static void terminal_set_oc_adj(int argc, const char **argv);
 static void terminal_print_faults(int argc, const char **argv);
+static void terminal_dump_regs(int argc, const char **argv);
 
 // Private variables
 static char m_fault_print_buffer[120];
 static mutex_t m_spi_mutex;
+static drv_shadow m_shadow[DRV_CNT];
+
+static const drv_regs_def m_regs_def = {
+		"DRV8320S",
+		6, // Registers
+		false, // Delayed response
+		false, // Checked response
+		{0x7FF, 0x7FF}, // Status masks
+		{0, 16}, // Status shifts
+		{
+				{"VDS_LC", "VDS_HC", "VDS_LB", "VDS_HB", "VDS_LA", "VDS_HA",
+						"OTSD", "UVLO", "GDF", "VDS_OCP", "FAULT"},
+				{"VGS_LC", "VGS_HC", "VGS_LB", "VGS_HB", "VGS_LA", "VGS_HA",
+						"CPUV", "OTW", 0, 0, 0}
+		},
+		0, (1 << 10) // FAULT
+};
 
 void drv8320s_init(void) {
 	chMtxObjectInit(&m_spi_mutex);
 
+	for (int i = 0;i < DRV_CNT;i++) {
+		drv_shadow_init(&m_shadow[i]);
+	}
+
 	// DRV8320S SPI
 	palSetPadMode(DRV8320S_MISO_GPIO, DRV8320S_MISO_PIN, PAL_MODE_INPUT_PULLUP);
 	palSetPadMode(DRV8320S_SCK_GPIO, DRV8320S_SCK_PIN, PAL_MODE_OUTPUT_PUSHPULL | PAL_STM32_OSPEED_HIGHEST);
@@ -84,6 +116,14 @@ void drv8320s_init(void) {
 			"Print all current DRV8320S faults.",
 			0,
 			terminal_print_faults);
+
+	terminal_register_command_callback(
+			"drv8320s_dump_regs",
+			"Read all DRV8320S registers and print them, and the last status change.",
+			0,
+			terminal_dump_regs);
+
+	drv_regs_start_status_thread(&m_regs_def, DRV_CNT, read_regs);
 }
 
 /**
@@ -143,9 +183,9 @@ void drv8320s_set_oc_mode(drv8301_oc_mode mode) {
  *
  */
 unsigned long drv8320s_read_faults(void) {
-	unsigned long r0 = drv8320s_read_reg(0);
-	int r1 = drv8320s_read_reg(1);
-	return r0 | (r1 << 16);
+	uint16_t status[DRV_REGS_STATUS];
+	read_regs(0, DRV_REGS_STATUS, status, 0);
+	return drv_regs_faults(&m_regs_def, status);
 }
 
 /**
@@ -256,38 +296,69 @@ char* drv8320s_faults_to_string(unsigned long faults) {
 }
 
 unsigned int drv8320s_read_reg(int reg) {
-	uint16_t out = 0;
-	out |= (1 << 15);
-	out |= (reg & 0x0F) << 11;
-	out |= 0x807F;
+	uint16_t res;
+	read_regs(reg, 1, &res, 0);
+	return res;
+}
+
+void drv8320s_write_reg(int reg, int data) {
+	uint16_t out = drv_regs_write_cmd(reg, data);
+
+	chMtxLock(&m_spi_mutex);
+	spi_begin();
+	spi_exchange(out);
+	spi_end();
+	drv_shadow_set(shadow_now(), reg, data & DRV_REGS_DATA_MASK);
+	chMtxUnlock(&m_spi_mutex);
+}
+
+/**
+ * Read several registers with the read commands back to back.
+ *
+ * @param change
+ * Set to how the status registers changed, can be NULL.
+ *
+ * @return
+ * true if the response was valid.
+ */
+static bool read_regs(int first, int cnt, uint16_t *values, drv_status_change *change) {
+	uint16_t tx[DRV_REGS_MAX + 1];
+	uint16_t rx[DRV_REGS_MAX + 1];
+	int frames = drv_regs_batch_cmd(&m_regs_def, first, cnt, tx);
 
 	chMtxLock(&m_spi_mutex);
 
-	if (reg != 0) {
+	for (int i = 0;i < frames;i++) {
 		spi_begin();
-		spi_exchange(out);
+		rx[i] = spi_exchange(tx[i]);
 		spi_end();
 	}
 
-	spi_begin();
-	uint16_t res = spi_exchange(out);
-	spi_end();
+	bool ok = drv_regs_batch_parse(&m_regs_def, first, cnt, rx, values);
+	drv_shadow *s = shadow_now();
+	drv_status_change res = DRV_STATUS_SAME;
+
+	if (ok) {
+		res = drv_shadow_update(&m_regs_def, s, first, cnt, values);
+	} else {
+		s->error_cnt++;
+	}
 
 	chMtxUnlock(&m_spi_mutex);
 
-	return res;
-}
+	if (change) {
+		*change = res;
+	}
 
-void drv8320s_write_reg(int reg, int data) {
-	uint16_t out = 0;
-	out |= (reg & 0x0F) << 11;
-	out |= data & 0x7FF;
+	return ok;
+}
 
-	chMtxLock(&m_spi_mutex);
-	spi_begin();
-	spi_exchange(out);
-	spi_end();
-	chMtxUnlock(&m_spi_mutex);
+static drv_shadow *shadow_now(void) {
+#if DRV_CNT == 2
+	return &m_shadow[mc_interface_motor_now() == 2 ? 1 : 0];
+#else
+	return &m_shadow[0];
+#endif
 }
 
 // Software SPI
@@ -420,6 +491,46 @@ static void terminal_print_faults(int argc, const char **argv) {
 	(void)argc;
 	(void)argv;
 	commands_printf(drv8320s_faults_to_string(drv8320s_read_faults()));
+
+	drv_shadow *s = shadow_now();
+	if (s->change_cnt > 0) {
+		char buf[120];
+		drv_regs_diff_to_string(&m_regs_def, s->change_old, s->change_new, buf, sizeof(buf));
+		commands_printf("Last change: %s", buf);
+	}
+}
+
+static void terminal_dump_regs(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	uint16_t regs[DRV_REGS_MAX];
+	if (!read_regs(0, m_regs_def.reg_cnt, regs, 0)) {
+		commands_printf("Invalid response.\n");
+		return;
+	}
+
+	for (int i = 0;i < m_regs_def.reg_cnt;i++) {
+		char bl[9];
+		char bh[9];
+
+		utils_byte_to_binary((regs[i] >> 8) & 0xFF, bh);
+		utils_byte_to_binary(regs[i] & 0xFF, bl);
+
+		commands_printf("Reg 0x%02x: %s %s (0x%04x)", i, bh, bl, regs[i]);
+	}
+
+	drv_shadow *s = shadow_now();
+	commands_printf("Status reads: %u, Errors: %u, Changes: %u",
+			(unsigned int)s->update_cnt, (unsigned int)s->error_cnt, (unsigned int)s->change_cnt);
+
+	if (s->change_cnt > 0) {
+		char buf[120];
+		drv_regs_diff_to_string(&m_regs_def, s->change_old, s->change_new, buf, sizeof(buf));
+		commands_printf("Last change: %s", buf);
+	}
+
+	commands_printf(" ");
 }
 
 #endif
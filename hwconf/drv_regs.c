@@ -0,0 +1,370 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "drv_regs.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#ifndef NO_STM32
+#include "conf_general.h"
+#include "ch.h"
+#include "mc_interface.h"
+
+#if defined(HW_HAS_DRV8301) || defined(HW_HAS_DRV8320S) || defined(HW_HAS_DRV8323S)
+#define DRV_STATUS_THREAD			(DRV_STATUS_RATE_HZ > 0)
+#endif
+#endif
+
+#ifndef DRV_STATUS_THREAD
+#define DRV_STATUS_THREAD			0
+#endif
+
+/*
+ * SPI frames and status decoding that are shared by the DRV8301, DRV8320S
+ * and DRV8323S. All of them use 16 bit frames with a read bit, a 4 bit
+ * address and 11 data bits. Several registers are read in one go by sending
+ * the read commands back to back, where the DRV8301 answers one frame late,
+ * so that it only needs one extra frame instead of one extra per register.
+ *
+ * The status registers are kept in a shadow copy, and changes are recorded
+ * so that the bits that changed can be printed when the driver reports a
+ * fault. They are also polled from a thread, which stops the motor on a
+ * latched fault that nFAULT missed.
+ */
+
+#if DRV_STATUS_THREAD
+// Private variables
+static THD_WORKING_AREA(status_thread_wa, 1024);
+static const drv_regs_def *m_status_def;
+static int m_status_drv_cnt;
+static drv_read_regs_func m_status_read_regs;
+
+// Threads
+static THD_FUNCTION(status_thread, arg);
+#endif
+
+uint16_t drv_regs_read_cmd(int reg) {
+	uint16_t out = 0;
+	out |= (1 << 15);
+	out |= (reg & 0x0F) << 11;
+	out |= 0x807F;
+	return out;
+}
+
+uint16_t drv_regs_write_cmd(int reg, int data) {
+	uint16_t out = 0;
+	out |= (reg & 0x0F) << 11;
+	out |= data & DRV_REGS_DATA_MASK;
+	return out;
+}
+
+/**
+ * Make the frames to read several registers.
+ *
+ * @param def
+ * The gate driver.
+ *
+ * @param first
+ * The first register to read.
+ *
+ * @param cnt
+ * The number of registers to read.
+ *
+ * @param tx
+ * The frames are stored here. Must have room for cnt + 1 frames.
+ *
+ * @return
+ * The number of frames.
+ */
+int drv_regs_batch_cmd(const drv_regs_def *def, int first, int cnt, uint16_t *tx) {
+	for (int i = 0;i < cnt;i++) {
+		tx[i] = drv_regs_read_cmd(first + i);
+	}
+
+	if (def->delayed_response) {
+		tx[cnt] = 0xFFFF;
+		return cnt + 1;
+	}
+
+	return cnt;
+}
+
+/**
+ * Get the register values from the frames that were received while sending
+ * the frames from drv_regs_batch_cmd.
+ *
+ * @param values
+ * The cnt register values are stored here, also when there is an error.
+ *
+ * @return
+ * false if a response had the frame error bit set or the wrong address, or
+ * if it was all ones as when MISO is not driven.
+ */
+bool drv_regs_batch_parse(const drv_regs_def *def, int first, int cnt, const uint16_t *rx, uint16_t *values) {
+	bool ok = true;
+	int ofs = def->delayed_response ? 1 : 0;
+
+	for (int i = 0;i < cnt;i++) {
+		uint16_t res = rx[i + ofs];
+		values[i] = res & DRV_REGS_DATA_MASK;
+
+		if (res == 0xFFFF) {
+			ok = false;
+		}
+
+		if (def->checked_response) {
+			if ((res & (1 << 15)) || ((res >> 11) & 0x0F) != ((first + i) & 0x0F)) {
+				ok = false;
+			}
+		}
+	}
+
+	return ok;
+}
+
+/**
+ * Make the fault word from the status registers, as given by the
+ * read_faults function of the driver.
+ */
+uint32_t drv_regs_faults(const drv_regs_def *def, const uint16_t *status) {
+	uint32_t res = 0;
+	for (int i = 0;i < DRV_REGS_STATUS;i++) {
+		res |= (uint32_t)(status[i] & def->status_mask[i]) << def->status_shift[i];
+	}
+	return res;
+}
+
+/**
+ * Print the status bits that differ, as +NAME for bits that were set and
+ * -NAME for bits that were cleared.
+ *
+ * @return
+ * The length of the string.
+ */
+int drv_regs_diff_to_string(const drv_regs_def *def, const uint16_t *old_status,
+		const uint16_t *new_status, char *buf, int len) {
+	int ind = 0;
+	buf[0] = '\0';
+
+	for (int i = 0;i < DRV_REGS_STATUS;i++) {
+		uint16_t diff = (old_status[i] ^ new_status[i]) & def->status_mask[i];
+
+		for (int bit = 0;bit < 11;bit++) {
+			if (!(diff & (1 << bit)) || ind >= len) {
+				continue;
+			}
+
+			char sign = (new_status[i] & (1 << bit)) ? '+' : '-';
+			const char *name = def->status_names[i][bit];
+
+			if (name) {
+				ind += snprintf(buf + ind, len - ind, "%s%c%s", ind ? " " : "", sign, name);
+			} else {
+				ind += snprintf(buf + ind, len - ind, "%s%cR%d.%d", ind ? " " : "", sign, i, bit);
+			}
+		}
+	}
+
+	if (ind == 0) {
+		ind = snprintf(buf, len, "No change");
+	}
+
+	return ind < len ? ind : len - 1;
+}
+
+void drv_shadow_init(drv_shadow *s) {
+	memset(s, 0, sizeof(drv_shadow));
+}
+
+/**
+ * Set a control register, e.g. after writing it. The status registers are
+ * only set by drv_shadow_update_status.
+ */
+void drv_shadow_set(drv_shadow *s, int reg, uint16_t val) {
+	if (reg >= DRV_REGS_STATUS && reg < DRV_REGS_MAX) {
+		s->regs[reg] = val;
+		s->valid |= 1 << reg;
+	}
+}
+
+/**
+ * Update the shadow copy after reading registers. The status registers are
+ * only compared when both of them were read.
+ *
+ * @return
+ * See drv_shadow_update_status.
+ */
+drv_status_change drv_shadow_update(const drv_regs_def *def, drv_shadow *s,
+		int first, int cnt, const uint16_t *values) {
+	drv_status_change res = DRV_STATUS_SAME;
+
+	if (first == 0 && cnt >= DRV_REGS_STATUS) {
+		res = drv_shadow_update_status(def, s, values);
+	}
+
+	for (int i = 0;i < cnt;i++) {
+		drv_shadow_set(s, first + i, values[i]);
+	}
+
+	return res;
+}
+
+/**
+ * Update the status registers.
+ *
+ * @param status
+ * The new status registers.
+ *
+ * @return
+ * DRV_STATUS_NEW_FAULT when the fault bit was set since the last update,
+ * DRV_STATUS_CHANGED when other bits changed. The first update only sets
+ * the baseline, so faults that were there at startup are only recorded.
+ */
+drv_status_change drv_shadow_update_status(const drv_regs_def *def, drv_shadow *s, const uint16_t *status) {
+	bool first = (s->valid & ((1 << DRV_REGS_STATUS) - 1)) != ((1 << DRV_REGS_STATUS) - 1);
+	bool changed = false;
+	uint16_t old[DRV_REGS_STATUS];
+
+	for (int i = 0;i < DRV_REGS_STATUS;i++) {
+		old[i] = first ? 0 : s->regs[i];
+		if ((old[i] ^ status[i]) & def->status_mask[i]) {
+			changed = true;
+		}
+	}
+
+	s->update_cnt++;
+
+	for (int i = 0;i < DRV_REGS_STATUS;i++) {
+		s->regs[i] = status[i];
+		s->valid |= 1 << i;
+	}
+
+	if (!changed) {
+		return DRV_STATUS_SAME;
+	}
+
+	s->change_cnt++;
+	memcpy(s->change_old, old, sizeof(old));
+	memcpy(s->change_new, status, sizeof(s->change_new));
+
+	uint16_t fault_old = old[def->fault_reg] & def->fault_bit;
+	uint16_t fault_new = status[def->fault_reg] & def->fault_bit;
+
+	if (!first && fault_new && !fault_old) {
+		return DRV_STATUS_NEW_FAULT;
+	}
+
+	return DRV_STATUS_CHANGED;
+}
+
+/**
+ * Decide if a status read from the polling thread should stop the motor. A
+ * new fault has to be seen by two valid reads in a row, so that one corrupted
+ * frame can't stop the motor.
+ *
+ * @param pending
+ * State of the motor, false at startup.
+ *
+ * @param read_ok
+ * The read was valid. Failed reads are skipped.
+ *
+ * @param change
+ * From drv_shadow_update_status.
+ *
+ * @param status
+ * The status registers that were read.
+ *
+ * @return
+ * true if the motor should be stopped.
+ */
+bool drv_regs_confirm_fault(const drv_regs_def *def, bool *pending, bool read_ok,
+		drv_status_change change, const uint16_t *status) {
+	if (!read_ok) {
+		return false;
+	}
+
+	if (*pending) {
+		*pending = false;
+		return (status[def->fault_reg] & def->fault_bit) != 0;
+	}
+
+	*pending = change == DRV_STATUS_NEW_FAULT;
+	return false;
+}
+
+/**
+ * Start polling the status registers at DRV_STATUS_RATE_HZ. Does nothing
+ * when the rate is 0.
+ *
+ * @param def
+ * The gate driver.
+ *
+ * @param drv_cnt
+ * Number of gate drivers, one per motor.
+ *
+ * @param read_regs
+ * Reads the registers of the gate driver of the selected motor.
+ */
+void drv_regs_start_status_thread(const drv_regs_def *def, int drv_cnt, drv_read_regs_func read_regs) {
+#if DRV_STATUS_THREAD
+	m_status_def = def;
+	m_status_drv_cnt = drv_cnt;
+	m_status_read_regs = read_regs;
+	chThdCreateStatic(status_thread_wa, sizeof(status_thread_wa), NORMALPRIO - 1, status_thread, NULL);
+#else
+	(void)def;
+	(void)drv_cnt;
+	(void)read_regs;
+#endif
+}
+
+#if DRV_STATUS_THREAD
+static THD_FUNCTION(status_thread, arg) {
+	(void)arg;
+
+	static char name[24];
+	snprintf(name, sizeof(name), "%s Status", m_status_def->name);
+	chRegSetThreadName(name);
+
+	bool pending[2] = {false, false};
+
+	// Let the motor control start first
+	chThdSleepMilliseconds(2000);
+
+	for(;;) {
+		for (int motor = 1;motor <= m_status_drv_cnt;motor++) {
+			mc_interface_select_motor_thread(motor);
+
+			uint16_t status[DRV_REGS_STATUS];
+			drv_status_change change = DRV_STATUS_SAME;
+			bool ok = m_status_read_regs(0, DRV_REGS_STATUS, status, &change);
+
+			// nFAULT should have caught this already, but a short pulse can be
+			// missed while the latched bit can't.
+			if (drv_regs_confirm_fault(m_status_def, &pending[motor - 1], ok, change, status) &&
+					mc_interface_get_fault() != FAULT_CODE_DRV) {
+				mc_interface_fault_stop(FAULT_CODE_DRV, motor == 2, false);
+			}
+		}
+
+		chThdSleepMilliseconds(1000 / DRV_STATUS_RATE_HZ);
+	}
+}
+#endif
@@ -0,0 +1,92 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HWCONF_DRV_REGS_H_
+#define HWCONF_DRV_REGS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Settings
+#ifndef DRV_STATUS_RATE_HZ
+#define DRV_STATUS_RATE_HZ			10 // Rate at which the status registers are read, 0 to disable
+#endif
+
+#define DRV_REGS_MAX				8
+#define DRV_REGS_STATUS				2
+#define DRV_REGS_DATA_MASK			0x7FF
+
+// Register layout of a gate driver
+typedef struct {
+	const char *name;
+	int reg_cnt;
+	// The response comes in the frame after the command, instead of in the
+	// same frame.
+	bool delayed_response;
+	// The response has a frame error bit and the address
+	bool checked_response;
+	// Status bits that are used, and where they go in the fault word
+	uint16_t status_mask[DRV_REGS_STATUS];
+	int status_shift[DRV_REGS_STATUS];
+	// Names of the status bits, NULL for unused bits
+	const char *status_names[DRV_REGS_STATUS][11];
+	// Status bit that follows nFAULT
+	int fault_reg;
+	uint16_t fault_bit;
+} drv_regs_def;
+
+typedef enum {
+	DRV_STATUS_SAME = 0,
+	DRV_STATUS_CHANGED,
+	DRV_STATUS_NEW_FAULT
+} drv_status_change;
+
+// Reads registers of the selected motor and updates its shadow copy
+typedef bool (*drv_read_regs_func)(int first, int cnt, uint16_t *values, drv_status_change *change);
+
+// Last known register values of one gate driver
+typedef struct {
+	uint16_t regs[DRV_REGS_MAX];
+	uint16_t valid;
+	uint32_t update_cnt;
+	uint32_t error_cnt;
+	uint32_t change_cnt;
+	// Status registers before and after the last change
+	uint16_t change_old[DRV_REGS_STATUS];
+	uint16_t change_new[DRV_REGS_STATUS];
+} drv_shadow;
+
+// Functions
+uint16_t drv_regs_read_cmd(int reg);
+uint16_t drv_regs_write_cmd(int reg, int data);
+int drv_regs_batch_cmd(const drv_regs_def *def, int first, int cnt, uint16_t *tx);
+bool drv_regs_batch_parse(const drv_regs_def *def, int first, int cnt, const uint16_t *rx, uint16_t *values);
+uint32_t drv_regs_faults(const drv_regs_def *def, const uint16_t *status);
+int drv_regs_diff_to_string(const drv_regs_def *def, const uint16_t *old_status,
+		const uint16_t *new_status, char *buf, int len);
+void drv_shadow_init(drv_shadow *s);
+void drv_shadow_set(drv_shadow *s, int reg, uint16_t val);
+drv_status_change drv_shadow_update(const drv_regs_def *def, drv_shadow *s,
+		int first, int cnt, const uint16_t *values);
+drv_status_change drv_shadow_update_status(const drv_regs_def *def, drv_shadow *s, const uint16_t *status);
+bool drv_regs_confirm_fault(const drv_regs_def *def, bool *pending, bool read_ok,
+		drv_status_change change, const uint16_t *status);
+void drv_regs_start_status_thread(const drv_regs_def *def, int drv_cnt, drv_read_regs_func read_regs);
+
+#endif /* HWCONF_DRV_REGS_H_ */
@@ -362,6 +362,11 @@
 #define ADC_VOLTS_INPUT_FACTOR	1.0
 #endif
 
+// Same scaling as ADC_VOLTS, for counts that are not in ADC_Value, e.g. oversampled ones
+#ifndef ADC_COUNTS_TO_VOLTS
+#define ADC_COUNTS_TO_VOLTS(c)	((float)(c) / 4095.0 * V_REG)
+#endif
+
 // NRF SW SPI (default to spi header pins)
 #ifndef NRF_PORT_CSN
 #define NRF_PORT_CSN			HW_SPI_PORT_NSS
@@ -92,6 +92,7 @@
 
 // Voltage on ADC channel
 #define ADC_VOLTS(ch)			((float)ADC_Value[ch] / 4095.0 * V_REG)
+#define ADC_COUNTS_TO_VOLTS(c)	((float)(c) / 4095.0 * V_REG)
 
 // NTC Termistors
 #define NTC_RES(adc_val)		((4095.0 * 10000.0) / adc_val - 10000.0)
@@ -32,6 +32,7 @@
 #include "stdio.h"
 #include <math.h>
 #include "minilzo.h"
+#include "timer.h"
 
 #include "hw_axiom_fpga_bitstream.c"    //this file ONLY contains the fpga binary blob
 
@@ -58,9 +59,24 @@
 #define EEPROM_ADDR_CURRENT_GAIN	0
 #define EEPROM_ADDR_INPUT_CURRENT_GAIN	1
 
+// Can be defined by the bitstream file, see hwconf/axiom_bitstream
+#ifndef BITSTREAM_CHUNK_SIZE
 #define BITSTREAM_CHUNK_SIZE		2000
+#endif
+#ifndef BITSTREAM_SIZE
 #define BITSTREAM_SIZE				104090		//ice40up5k
 //#define BITSTREAM_SIZE				71338		//ice40LP1K
+#endif
+
+// Hardware SPI for loading the bitstream. The ChibiOS driver is not used as
+// its TX stream (DMA1 stream 7) is taken by I2C2. Stream 5 channel 0 is also
+// SPI3_TX and is only shared with the DAC, which is not used on this hardware.
+#define BITSTREAM_SPI				SPI3
+#define BITSTREAM_SPI_AF			GPIO_AF_SPI3
+#define BITSTREAM_SPI_BR			SPI_CR1_BR_0		// 42 MHz / 4 = 10.5 MHz
+#define BITSTREAM_SPI_CLOCK			10.5e6
+#define BITSTREAM_DMA_STREAM		STM32_DMA_STREAM(STM32_DMA_STREAM_ID(1, 5))
+#define BITSTREAM_DMA_CHANNEL		0
 
 // Variables
 static volatile bool i2c_running = false;
@@ -70,6 +86,8 @@ static volatile float input_current_sensor_offset = 1.65;
 static volatile uint16_t input_current_sensor_offset_samples = 0;
 static volatile uint32_t input_current_sensor_offset_sum = 0;
 static volatile bool current_input_sensor_offset_start_measurement = false;
+static volatile float fpga_config_time = 0.0;
+static volatile bool fpga_config_dma = false;
 //extern unsigned char FPGA_bitstream[BITSTREAM_SIZE];
 
 // I2C configuration
@@ -88,6 +106,11 @@ static void spi_transfer(uint8_t *in_buf, const uint8_t *out_buf, int length);
 static void spi_begin(void);
 static void spi_end(void);
 static void spi_delay(void);
+static bool spi_dma_begin(void);
+static void spi_dma_start(const uint8_t *buf, int length);
+static void spi_dma_wait(void);
+static void spi_dma_end(void);
+static void terminal_cmd_fpga_bench(int argc, const char **argv);
 void hw_axiom_init_FPGA_CLK(void);
 void hw_axiom_setup_dac(void);
 void hw_axiom_configure_brownout(uint8_t);
@@ -223,6 +246,12 @@ void hw_init_gpio(void) {
 			"Read current sensor gain.",
 			0,
 			terminal_cmd_read_current_sensor_gain);
+
+	terminal_register_command_callback(
+			"axiom_fpga_bench",
+			"Measure the bitstream decompression rate and print the last FPGA load time.",
+			0,
+			terminal_cmd_fpga_bench);
     
     // Send bitstream over SPI to configure FPGA
 	hw_axiom_configure_FPGA();
@@ -495,15 +524,39 @@ void hw_axiom_init_FPGA_CLK(void) {
 	RCC_MCO2Config(RCC_MCO2Source_PLLI2SCLK, RCC_MCO2Div_4);
 }
 
+// Decompresses the next chunk of the bitstream and advances index past it
+static int bitstream_decompress_chunk(int chunk, uint32_t *index, uint8_t *out, lzo_uint *len) {
+	const int chunks = BITSTREAM_SIZE / BITSTREAM_CHUNK_SIZE + 1;
+
+	uint16_t compressed_chunk_size = (uint16_t)FPGA_bitstream[(*index)++] << 8;
+	compressed_chunk_size |= (uint8_t)FPGA_bitstream[(*index)++];
+
+	if (chunk == (chunks - 1)) {
+		*len = BITSTREAM_SIZE % BITSTREAM_CHUNK_SIZE;
+	} else {
+		*len = BITSTREAM_CHUNK_SIZE;
+	}
+
+	int r = lzo1x_decompress_safe(FPGA_bitstream + *index, compressed_chunk_size, out, len, NULL);
+	*index += compressed_chunk_size;
+
+	return r;
+}
+
 char hw_axiom_configure_FPGA(void) {
-	// use CCM SRAM for this 2kB decompressor buffer
-	__attribute__((section(".ram4"))) static uint8_t __LZO_MMODEL outputBuffer[BITSTREAM_CHUNK_SIZE] = {0};
+	// Two buffers so that one chunk can be sent while the next one is
+	// decompressed. They are in normal SRAM, as DMA can't reach the CCM.
+	static uint8_t __LZO_MMODEL outputBuffer[2][BITSTREAM_CHUNK_SIZE];
+	static const uint8_t dummy[7] = {0};
 
-    int r;
-    uint32_t index = 0;
-    const int16_t chunks = BITSTREAM_SIZE / BITSTREAM_CHUNK_SIZE + 1;
-    lzo_uint decompressed_len;
-    lzo_uint decompressed_bitstream_size = 0;
+	int r;
+	uint32_t index = 0;
+	const int chunks = BITSTREAM_SIZE / BITSTREAM_CHUNK_SIZE + 1;
+	lzo_uint decompressed_len;
+	lzo_uint decompressed_bitstream_size = 0;
+	int buf = 0;
+
+	systime_t start = chVTGetSystemTimeX();
 
 	r = lzo_init(); // Initialize decompressor
 
@@ -514,33 +567,42 @@ char hw_axiom_configure_FPGA(void) {
 	palSetPad(AXIOM_FPGA_RESET_PORT, AXIOM_FPGA_RESET_PIN);
 	chThdSleep(20);
 
-    for (int i = 0; i < chunks; i++) {
-        uint16_t compressed_chunk_size = (uint16_t)FPGA_bitstream[index++] << 8;
-    	compressed_chunk_size |= (uint8_t)FPGA_bitstream[index++];
-
-        if( i == (chunks - 1) ) {
-        	decompressed_len = BITSTREAM_SIZE % BITSTREAM_CHUNK_SIZE;
-        }
-        else {
-        	decompressed_len =  BITSTREAM_CHUNK_SIZE;
-        }
+	// Fall back to the software SPI if the DMA stream is taken
+	bool dma = spi_dma_begin();
 
-		r = lzo1x_decompress_safe(FPGA_bitstream + index,compressed_chunk_size, outputBuffer, &decompressed_len,NULL);
+	for (int i = 0; i < chunks; i++) {
+		r = bitstream_decompress_chunk(i, &index, outputBuffer[buf], &decompressed_len);
 		decompressed_bitstream_size += decompressed_len;
-		index += compressed_chunk_size;
 
 		if (r != LZO_E_OK) {
 			break;
 		}
 
-		spi_transfer(0, outputBuffer, decompressed_len);
-    }
+		if (dma) {
+			// The previous chunk is sent from the other buffer while this one is
+			// decompressed, so the wait here is only for what is left of it.
+			spi_dma_wait();
+			spi_dma_start(outputBuffer[buf], decompressed_len);
+			buf ^= 1;
+		} else {
+			spi_transfer(0, outputBuffer[buf], decompressed_len);
+		}
+	}
 
 	//include 49 extra spi clock cycles, dummy bytes
-	uint8_t dummy = 0;
-	spi_transfer(0, &dummy, 7);
+	if (dma) {
+		spi_dma_wait();
+		spi_dma_start(dummy, sizeof(dummy));
+		spi_dma_wait();
+		spi_dma_end();
+	} else {
+		spi_transfer(0, dummy, 7);
+	}
 	spi_end();
 
+	fpga_config_time = (float)(chVTGetSystemTimeX() - start) / (float)CH_CFG_ST_FREQUENCY;
+	fpga_config_dma = dma;
+
 	// CDONE LED should be set by now
 	if( (r != LZO_E_OK) || (decompressed_bitstream_size != BITSTREAM_SIZE) )
 		commands_printf("Error decompressing FPGA image.\n");
@@ -548,6 +610,64 @@ char hw_axiom_configure_FPGA(void) {
 	return 0;
 }
 
+static bool spi_dma_begin(void) {
+	if (dmaStreamAllocate(BITSTREAM_DMA_STREAM, 1, NULL, NULL)) {
+		return false;
+	}
+
+	// Mode 3, like the software SPI: SCK idles high and the FPGA samples on
+	// the rising edge. Set up before the pins are handed over, so that SCK
+	// does not glitch.
+	RCC_APB1PeriphClockCmd(RCC_APB1Periph_SPI3, ENABLE);
+	BITSTREAM_SPI->CR1 = 0;
+	BITSTREAM_SPI->CR2 = SPI_CR2_TXDMAEN;
+	BITSTREAM_SPI->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI |
+			SPI_CR1_CPOL | SPI_CR1_CPHA | BITSTREAM_SPI_BR;
+	BITSTREAM_SPI->CR1 |= SPI_CR1_SPE;
+
+	palSetPadMode(SPI_SW_SCK_GPIO, SPI_SW_SCK_PIN,
+			PAL_MODE_ALTERNATE(BITSTREAM_SPI_AF) | PAL_STM32_OSPEED_HIGHEST);
+	palSetPadMode(SPI_SW_MOSI_GPIO, SPI_SW_MOSI_PIN,
+			PAL_MODE_ALTERNATE(BITSTREAM_SPI_AF) | PAL_STM32_OSPEED_HIGHEST);
+
+	dmaStreamSetPeripheral(BITSTREAM_DMA_STREAM, &BITSTREAM_SPI->DR);
+
+	return true;
+}
+
+static void spi_dma_start(const uint8_t *buf, int length) {
+	dmaStreamSetMemory0(BITSTREAM_DMA_STREAM, buf);
+	dmaStreamSetTransactionSize(BITSTREAM_DMA_STREAM, length);
+	dmaStreamSetMode(BITSTREAM_DMA_STREAM,
+			STM32_DMA_CR_CHSEL(BITSTREAM_DMA_CHANNEL) | STM32_DMA_CR_DIR_M2P |
+			STM32_DMA_CR_MINC | STM32_DMA_CR_PL(1));
+	dmaStreamClearInterrupt(BITSTREAM_DMA_STREAM);
+	dmaStreamEnable(BITSTREAM_DMA_STREAM);
+}
+
+static void spi_dma_wait(void) {
+	while (BITSTREAM_DMA_STREAM->stream->CR & STM32_DMA_CR_EN) {
+		__NOP();
+	}
+}
+
+static void spi_dma_end(void) {
+	// The last byte is still being shifted out when the stream is done
+	while (!(BITSTREAM_SPI->SR & SPI_SR_TXE) || (BITSTREAM_SPI->SR & SPI_SR_BSY)) {
+		__NOP();
+	}
+
+	palSetPad(SPI_SW_SCK_GPIO, SPI_SW_SCK_PIN);
+	palSetPadMode(SPI_SW_SCK_GPIO, SPI_SW_SCK_PIN, PAL_MODE_OUTPUT_PUSHPULL | PAL_STM32_OSPEED_HIGHEST);
+	palSetPadMode(SPI_SW_MOSI_GPIO, SPI_SW_MOSI_PIN, PAL_MODE_OUTPUT_PUSHPULL | PAL_STM32_OSPEED_HIGHEST);
+
+	BITSTREAM_SPI->CR1 = 0;
+	BITSTREAM_SPI->CR2 = 0;
+	RCC_APB1PeriphClockCmd(RCC_APB1Periph_SPI3, DISABLE);
+
+	dmaStreamRelease(BITSTREAM_DMA_STREAM);
+}
+
 static void spi_begin(void) {
 	palClearPad(SPI_SW_FPGA_CS_GPIO, SPI_SW_FPGA_CS_PIN);
 }
@@ -659,6 +779,39 @@ static void terminal_cmd_read_current_sensor_gain(int argc, const char **argv) {
 	return;
 }
 
+static void terminal_cmd_fpga_bench(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	static uint8_t __LZO_MMODEL outputBuffer[BITSTREAM_CHUNK_SIZE];
+	const int chunks = BITSTREAM_SIZE / BITSTREAM_CHUNK_SIZE + 1;
+	const int reps = 5;
+	uint32_t bytes = 0;
+	bool ok = true;
+
+	uint32_t start = timer_time_now();
+	for (int n = 0; n < reps; n++) {
+		uint32_t index = 0;
+		for (int i = 0; i < chunks; i++) {
+			lzo_uint len;
+			ok &= bitstream_decompress_chunk(i, &index, outputBuffer, &len) == LZO_E_OK;
+			bytes += len;
+		}
+	}
+	float t = timer_seconds_elapsed_since(start);
+
+	commands_printf("Bitstream       : %d bytes in %d chunks of %d, %d compressed",
+			BITSTREAM_SIZE, chunks, BITSTREAM_CHUNK_SIZE, (int)sizeof(FPGA_bitstream));
+	commands_printf("Decompression   : %.2f MB/s%s", (double)((float)bytes / t / 1e6), ok ? "" : " (errors)");
+	if (fpga_config_dma) {
+		commands_printf("SPI             : DMA at %.2f MHz", (double)(BITSTREAM_SPI_CLOCK / 1e6));
+	} else {
+		commands_printf("SPI             : Software");
+	}
+	commands_printf("Last load time  : %.2f ms", (double)(fpga_config_time * 1e3));
+	commands_printf(" ");
+}
+
 float hw_axiom_read_current_sensor_gain() {
 	eeprom_var current_gain;
 
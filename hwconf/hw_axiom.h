@@ -178,6 +178,7 @@
 #endif
 // Voltage on ADC channel
 #define ADC_VOLTS(ch)					((float)ADC_Value[ch] / 4096.0 * V_REG)
+#define ADC_COUNTS_TO_VOLTS(c)	((float)(c) / 4096.0 * V_REG)
 
 // Sin/Cos Encoder signals
 #define ENCODER_SIN_VOLTS				ADC_VOLTS(ADC_IND_EXT)
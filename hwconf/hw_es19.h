@@ -137,6 +137,7 @@
 
 // Voltage on ADC channel
 #define ADC_VOLTS(ch)			((float)ADC_Value[ch] / 4096.0 * V_REG)
+#define ADC_COUNTS_TO_VOLTS(c)	((float)(c) / 4096.0 * V_REG)
 #define ADC_VOLTS_PH_FACTOR		((1.0 / 8.2) * (10.0 / 15.0)) // AMC1301 gain + diff amp gain
 #define ADC_VOLTS_INPUT_FACTOR	ADC_VOLTS_PH_FACTOR
 
@@ -3,6 +3,7 @@ HWSRC =	hwconf/hw.c \
 	hwconf/drv8305.c \
 	hwconf/drv8320s.c \
 	hwconf/drv8323s.c \
+	hwconf/drv_regs.c \
 	hwconf/luna/luna_display_serial.c \
 	hwconf/si8900.c
 
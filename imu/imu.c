@@ -29,6 +29,8 @@
 #include "lsm6ds3.h"
 #include "utils.h"
 #include "Fusion.h"
+#include "bus_thread.h"
+#include "app.h"
 
 #include <math.h>
 #include <string.h>
@@ -40,6 +42,13 @@ static float m_accel[3], m_gyro[3], m_mag[3];
 static stkalign_t m_thd_work_area[THD_WORKING_AREA_SIZE(2048) / sizeof(stkalign_t)];
 static i2c_bb_state m_i2c_bb;
 static spi_bb_state m_spi_bb;
+static bus_async m_bus;
+#ifdef HW_I2C_DEV
+static bus_i2c_hw m_i2c_hw;
+#endif
+#ifdef BMI160_SPI_DEV
+static bus_spi_hw m_spi_hw;
+#endif
 static ICM20948_STATE m_icm20948_state;
 static BMI_STATE m_bmi_state;
 static imu_config m_settings;
@@ -153,11 +162,34 @@ void imu_init_bmi160_i2c(stm32_gpio_t *sda_gpio, int sda_pin,
 		stm32_gpio_t *scl_gpio, int scl_pin) {
 	imu_stop();
 
-	m_i2c_bb.sda_gpio = sda_gpio;
-	m_i2c_bb.sda_pin = sda_pin;
-	m_i2c_bb.scl_gpio = scl_gpio;
-	m_i2c_bb.scl_pin = scl_pin;
-	i2c_bb_init(&m_i2c_bb);
+	bool use_hw = false;
+
+#ifdef HW_I2C_DEV
+	// On the I2C port the peripheral is used, so that the transfers run on
+	// DMA instead of bit-banging in this thread. Not when the app stops the
+	// peripheral, as the transfers would then fail.
+	if (!app_stops_i2c() &&
+			sda_gpio == HW_I2C_SDA_PORT && sda_pin == HW_I2C_SDA_PIN &&
+			scl_gpio == HW_I2C_SCL_PORT && scl_pin == HW_I2C_SCL_PIN) {
+		hw_start_i2c();
+		m_i2c_hw.dev = &HW_I2C_DEV;
+		m_i2c_hw.cfg = HW_I2C_DEV.config;
+		m_i2c_hw.restore = hw_try_restore_i2c;
+		bus_async_init(&m_bus, &bus_backend_i2c_hw, &m_i2c_hw);
+		use_hw = true;
+	}
+#endif
+
+	if (!use_hw) {
+		m_i2c_bb.sda_gpio = sda_gpio;
+		m_i2c_bb.sda_pin = sda_pin;
+		m_i2c_bb.scl_gpio = scl_gpio;
+		m_i2c_bb.scl_pin = scl_pin;
+		i2c_bb_init(&m_i2c_bb);
+		bus_async_init(&m_bus, &bus_backend_i2c_bb, &m_i2c_bb);
+	}
+
+	bus_thread_add(&m_bus);
 
 	m_bmi_state.sensor.id = BMI160_I2C_ADDR;
 	m_bmi_state.sensor.interface = BMI160_I2C_INTF;
@@ -173,6 +205,27 @@ void imu_init_bmi160_spi(stm32_gpio_t *nss_gpio, int nss_pin,
 		stm32_gpio_t *miso_gpio, int miso_pin) {
 	imu_stop();
 
+#ifdef BMI160_SPI_DEV
+	// The hwconf can give an SPI peripheral on these pins. Make sure that its
+	// DMA streams are not used by anything else.
+	palSetPadMode(sck_gpio, sck_pin, PAL_MODE_ALTERNATE(BMI160_SPI_GPIO_AF) |
+			PAL_STM32_OSPEED_HIGHEST);
+	palSetPadMode(mosi_gpio, mosi_pin, PAL_MODE_ALTERNATE(BMI160_SPI_GPIO_AF) |
+			PAL_STM32_OSPEED_HIGHEST);
+	palSetPadMode(miso_gpio, miso_pin, PAL_MODE_ALTERNATE(BMI160_SPI_GPIO_AF) |
+			PAL_STM32_OSPEED_HIGHEST);
+	palSetPadMode(nss_gpio, nss_pin, PAL_MODE_OUTPUT_PUSHPULL |
+			PAL_STM32_OSPEED_HIGHEST);
+	palSetPad(nss_gpio, nss_pin);
+
+	m_spi_hw.dev = &BMI160_SPI_DEV;
+	m_spi_hw.cfg.end_cb = NULL;
+	m_spi_hw.cfg.ssport = nss_gpio;
+	m_spi_hw.cfg.sspad = nss_pin;
+	// Mode 3, at most 5.25 MHz. The BMI160 can do 10 MHz.
+	m_spi_hw.cfg.cr1 = SPI_CR1_BR_1 | SPI_CR1_BR_0 | SPI_CR1_CPOL | SPI_CR1_CPHA;
+	bus_async_init(&m_bus, &bus_backend_spi_hw, &m_spi_hw);
+#else
 	m_spi_bb.nss_gpio = nss_gpio;
 	m_spi_bb.nss_pin = nss_pin;
 	m_spi_bb.sck_gpio = sck_gpio;
@@ -183,6 +236,10 @@ void imu_init_bmi160_spi(stm32_gpio_t *nss_gpio, int nss_pin,
 	m_spi_bb.miso_pin = miso_pin;
 
 	spi_bb_init(&m_spi_bb);
+	bus_async_init(&m_bus, &bus_backend_spi_bb, &m_spi_bb);
+#endif
+
+	bus_thread_add(&m_bus);
 
 	m_bmi_state.sensor.id = 0;
 	m_bmi_state.sensor.interface = BMI160_SPI_INTF;
@@ -209,6 +266,7 @@ void imu_stop(void) {
 	icm20948_stop(&m_icm20948_state);
 	bmi160_wrapper_stop(&m_bmi_state);
 	lsm6ds3_stop();
+	bus_thread_remove(&m_bus);
 }
 
 bool imu_startup_done(void) {
@@ -525,60 +583,53 @@ void rotate(float *input, float *rotation, float *output) {
 }
 
 static int8_t user_i2c_read(uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint16_t len) {
-	m_i2c_bb.has_error = 0;
-
 	uint8_t txbuf[1];
 	txbuf[0] = reg_addr;
-	return i2c_bb_tx_rx(&m_i2c_bb, dev_addr, txbuf, 1, data, len) ? BMI160_OK : BMI160_E_COM_FAIL;
+
+	bus_xfer x = {0};
+	x.addr = dev_addr;
+	x.txbuf = txbuf;
+	x.txbytes = 1;
+	x.rxbuf = data;
+	x.rxbytes = len;
+	return bus_thread_transfer(&m_bus, &x) ? BMI160_OK : BMI160_E_COM_FAIL;
 }
 
 static int8_t user_i2c_write(uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint16_t len) {
-	m_i2c_bb.has_error = 0;
-
 	uint8_t txbuf[len + 1];
 	txbuf[0] = reg_addr;
 	memcpy(txbuf + 1, data, len);
-	return i2c_bb_tx_rx(&m_i2c_bb, dev_addr, txbuf, len + 1, 0, 0) ? BMI160_OK : BMI160_E_COM_FAIL;
+
+	bus_xfer x = {0};
+	x.addr = dev_addr;
+	x.txbuf = txbuf;
+	x.txbytes = len + 1;
+	return bus_thread_transfer(&m_bus, &x) ? BMI160_OK : BMI160_E_COM_FAIL;
 }
 
 static int8_t user_spi_read(uint8_t dev_id, uint8_t reg_addr, uint8_t *data, uint16_t len) {
 	(void)dev_id;
-	
-	int8_t rslt = BMI160_OK; // Return 0 for Success, non-zero for failure 
-
-	reg_addr = (reg_addr | BMI160_SPI_RD_MASK);
-
-	chMtxLock(&m_spi_bb.mutex);
-	spi_bb_begin(&m_spi_bb);
-	spi_bb_exchange_8(&m_spi_bb, reg_addr);
-	spi_bb_delay();
-
-	for (int i = 0; i < len; i++) {
-		data[i] = spi_bb_exchange_8(&m_spi_bb, 0);
-	}
 
-	spi_bb_end(&m_spi_bb);
-	chMtxUnlock(&m_spi_bb.mutex);
-	return rslt;
+	uint8_t txbuf[1];
+	txbuf[0] = reg_addr | BMI160_SPI_RD_MASK;
+
+	bus_xfer x = {0};
+	x.txbuf = txbuf;
+	x.txbytes = 1;
+	x.rxbuf = data;
+	x.rxbytes = len;
+	return bus_thread_transfer(&m_bus, &x) ? BMI160_OK : BMI160_E_COM_FAIL;
 }
 
 static int8_t user_spi_write(uint8_t dev_id, uint8_t reg_addr, uint8_t *data, uint16_t len) {
 	(void)dev_id;
 
-	int8_t rslt = BMI160_OK; /* Return 0 for Success, non-zero for failure */
-	chMtxLock(&m_spi_bb.mutex);
-	spi_bb_begin(&m_spi_bb);
-	reg_addr = (reg_addr & BMI160_SPI_WR_MASK);
-	spi_bb_exchange_8(&m_spi_bb, reg_addr);
-	spi_bb_delay();
-
-	for (int i = 0; i < len; i++) {
-		spi_bb_exchange_8(&m_spi_bb, *data);
-		data++;
-	}
-
-	spi_bb_end(&m_spi_bb);
-	chMtxUnlock(&m_spi_bb.mutex);
+	uint8_t txbuf[len + 1];
+	txbuf[0] = reg_addr & BMI160_SPI_WR_MASK;
+	memcpy(txbuf + 1, data, len);
 
-	return rslt;
+	bus_xfer x = {0};
+	x.txbuf = txbuf;
+	x.txbytes = len + 1;
+	return bus_thread_transfer(&m_bus, &x) ? BMI160_OK : BMI160_E_COM_FAIL;
 }
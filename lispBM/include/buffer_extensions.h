@@ -0,0 +1,52 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BUFFER_EXTENSIONS_H_
+#define BUFFER_EXTENSIONS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lispbm_types.h"
+
+/*
+  Byte buffer extensions.
+
+  A buffer is any array, addressed as bytes, or a view into one made
+  with bufview. A view is the list (array offset . length), so it keeps
+  the array alive and shares its data without copying.
+
+  (bufcreate n)                         New zeroed buffer of n bytes
+  (buflen buf)                          Length in bytes
+  (bufview buf offset len)              View of len bytes at offset
+  (bufclear buf [byte])                 Fill with byte, default 0
+  (bufcpy dst dst-ind src src-ind len)  Copy bytes, may overlap
+  (bufset-T buf ind v0 [v1 ...] [end])  Write consecutive values at ind
+  (bufget-T buf ind [end])              Read one value at ind
+
+  T is one of i8, u8, i16, u16, i32, u32 and f32. Values are big endian
+  unless 'little-endian is given as the last argument. Only bufcreate,
+  bufview and the boxed i32, u32 and f32 results of bufget allocate on
+  the heap.
+*/
+
+extern bool buffer_extensions_init(void);
+
+/* The data and length of a buffer or view, for other extensions */
+extern bool buffer_get_data(VALUE buf, uint8_t **data, uint32_t *len);
+
+#endif
@@ -22,8 +22,12 @@
 #include <stdbool.h>
 #include "lispbm_types.h"
 
+/* Set in the size header when the trained dictionary is used */
+#define COMPRESSION_DICT_FLAG 0x80000000u
+
 typedef struct {
   uint32_t compressed_bits;
+  bool dict;
   uint32_t i;
   bool string_mode;
   char last_string_char;
@@ -39,12 +43,36 @@ extern void compression_init_state(decomp_state *s, char *src);
    for example.
  
    Compress returns an array that caller must free 
+
+   compression_compress uses the trained dictionary in compression_dict.h
+   and compression_compress_legacy the original code table. Both formats
+   can be decompressed.
 */ 
 extern char *compression_compress(char *string, uint32_t *res_size);
+extern char *compression_compress_legacy(char *string, uint32_t *res_size);
 extern int  compression_decompress_incremental(decomp_state *s, char *dest_buff, uint32_t dest_n);
 extern bool compression_decompress(char *dest, uint32_t dest_n, char *src);
 
 /* parse compressed code */
 extern VALUE compression_parse(char *bytes);
 
+/* 
+   Compressed code stored in flash is preceded by this magic word so
+   that it can be told apart from plain source.
+*/
+#define COMPRESSION_CODE_MAGIC 0x434D424Cu // "LBMC"
+
+/* Tokenizer stream over compressed code, for incremental parsing */
+#define DECOMP_BUFF_SIZE 32
+typedef struct {
+  decomp_state ds;
+  char decomp_buff[DECOMP_BUFF_SIZE];
+  int  decomp_bytes;
+  int  buff_pos;
+} tokenizer_compressed_state;
+
+extern void compression_create_char_stream(tokenizer_compressed_state *ts,
+                                           tokenizer_char_stream *str,
+                                           char *bytes);
+
 #endif
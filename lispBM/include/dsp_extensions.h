@@ -0,0 +1,58 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DSP_EXTENSIONS_H_
+#define DSP_EXTENSIONS_H_
+
+#include <stdbool.h>
+
+#include "lispbm_types.h"
+
+/*
+  Math and DSP extensions on float arrays. Each call processes a whole
+  array in C, so scripts don't have to loop over array-read and
+  array-write with a boxed float per element.
+
+  (farray n [v])                        New float array filled with v, default 0
+  (farray-from-list lst)                Float array from a list of numbers
+  (farray-to-list arr)                  List of the elements
+  (dsp-sum arr), (dsp-mean arr)
+  (dsp-min arr), (dsp-max arr)
+  (dsp-dot a b)                         Dot product, a and b of equal length
+  (dsp-scale arr k [offset])            arr = arr * k + offset, in place
+  (dsp-biquad coeffs state in [out])    Cascaded biquad filter
+  (dsp-fir taps state in [out])         FIR filter
+  (dsp-interp xs ys x)                  Interpolate one value in a table
+  (dsp-interp xs ys in out)             Interpolate every element of in
+  (pid-create kp ki kd [min max])       PID controller state
+  (pid-update pid setpoint value dt)    Run the controller, returns the output
+  (pid-reset pid)                       Clear the integrator and derivative
+
+  The biquad coefficients are b0 b1 b2 a1 a2 per stage, with a0 = 1, and
+  the state holds two floats per stage. The FIR state holds as many
+  floats as there are taps. Both filters keep their state between calls,
+  so a signal can be processed in blocks. When out is left out, in is
+  filtered in place. The interpolation table xs must be increasing, and
+  values outside of it are clamped to the ends.
+
+  Only the array constructors, farray-to-list and the float results
+  allocate on the heap.
+*/
+
+extern bool dsp_extensions_init(void);
+
+#endif
@@ -63,11 +63,17 @@ extern void eval_cps_step_eval(void);
 extern void eval_cps_continue_eval(void); 
 extern void eval_cps_kill_eval(void);
 extern uint32_t eval_cps_current_state(void);
+extern int eval_cps_gc(VALUE remember);
+extern VALUE eval_cps_send(CID cid, VALUE msg);
+extern CID eval_cps_current_cid(void);
 
 /* statistics interface */
 extern void eval_cps_running_iterator(ctx_fun f, void*, void*);
 extern void eval_cps_blocked_iterator(ctx_fun f, void*, void*);
 extern void eval_cps_done_iterator(ctx_fun f, void*, void*);
+/* The context in the middle of its quantum, if any. Only meaningful
+   while evaluation is paused. */
+extern void eval_cps_current_iterator(ctx_fun f, void*, void*);
 
 /*
   Callback routines for sleeping and timestamp generation.
@@ -78,6 +84,14 @@ extern void eval_cps_set_usleep_callback(void (*fptr)(uint32_t));
 extern void eval_cps_set_timestamp_us_callback(uint32_t (*fptr)(void));
 extern void eval_cps_set_ctx_done_callback(void (*fptr)(eval_context_t *));
 
+/*
+  Called by the evaluator between evaluation steps, where it is safe to
+  allocate on the heap and to send messages with eval_cps_send. Used to
+  deliver events from other threads.
+*/
+extern void eval_cps_set_event_callback(void (*fptr)(void));
+extern void eval_cps_set_idle_sleep_us(uint32_t us);
+
 /* Non concurrent interface: */
 extern int eval_cps_init_nc(unsigned int stack_size, bool grow_stack);
 extern void eval_cps_del_nc(void);
@@ -245,6 +245,8 @@ extern unsigned int heap_num_free(void);
 extern unsigned int heap_num_allocated(void);
 extern unsigned int heap_size(void);
 extern VALUE heap_allocate_cell(TYPE type);
+// Consecutive cells from the start of the free list, for heap images
+extern int heap_allocate_block(unsigned int num_cells, UINT *first);
 extern unsigned int heap_size_bytes(void);
 
 extern char *dec_str(VALUE);
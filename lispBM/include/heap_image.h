@@ -0,0 +1,73 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HEAP_IMAGE_H_
+#define HEAP_IMAGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lispbm_types.h"
+#include "heap.h"
+
+/*
+  Precompiled heap image.
+
+  An image is a parsed program stored as the cons cells it occupies
+  on the heap, so that it can be loaded with a copy and a single
+  relocation pass instead of being tokenized and parsed again.
+
+  Layout (32 bit little endian words):
+
+  [heap_image_header_t]
+  [cons_t      x num_cells]    Cells, indexed from 0 within the image
+  [uint32_t    x array_words]  Array headers followed by their data
+  [char        x symbol_bytes] Zero terminated symbol names, padded to 4
+
+  Inside the cells:
+   - Pointers (cons, boxed and array) hold the image cell index.
+   - Symbols with id >= MAX_SPECIAL_SYMBOLS hold MAX_SPECIAL_SYMBOLS + n,
+     where n is the position of the name in the symbol table. They are
+     looked up or added by name at load time, so the runtime symbol ids
+     of extensions registered before loading do not matter.
+   - Array cells hold the word offset of the array header in the
+     array section instead of the address.
+
+  The checksum is the sum of all words in the image, except for the
+  checksum field.
+*/
+
+#define HEAP_IMAGE_MAGIC      0x494D424Cu // "LBMI"
+#define HEAP_IMAGE_VERSION    1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_cells;
+  uint32_t array_words;
+  uint32_t num_symbols;
+  uint32_t symbol_bytes;
+  VALUE    root;
+  uint32_t checksum;
+} heap_image_header_t;
+
+extern unsigned int heap_image_size(const heap_image_header_t *hdr);
+extern uint32_t heap_image_checksum(const heap_image_header_t *hdr);
+extern bool heap_image_is_valid(const uint8_t *data, unsigned int max_size);
+extern VALUE heap_image_load(const uint8_t *data, unsigned int max_size);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HEAP_SNAPSHOT_H_
+#define HEAP_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lispbm_types.h"
+
+/*
+  Binary snapshot of the heap and the array memory, for inspecting
+  what a running program keeps alive from a host.
+
+  The snapshot is not stored anywhere. It is generated on the fly for
+  each window that is read, so it can be sent in small chunks without
+  a buffer of its own. The heap must not change between
+  heap_snapshot_begin and the last heap_snapshot_read, which means that
+  evaluation has to be paused.
+
+  Layout (little endian):
+
+  [heap_snapshot_header_t]
+  [cons_t      x heap_cells]    Raw cells, including gc bits
+  [uint32_t    x bitmap_words]  Status bitmap of the array memory
+  [heap_snapshot_array_t x num_arrays]
+  [heap_snapshot_root_t  x num_roots]
+  [symbol      x num_symbols]   uint32_t id, uint8_t len, name without zero
+
+  Roots are the global bindings, the environment list that holds them
+  and everything the contexts hold on to, in that order.
+  Symbol names are included for the keys of the global bindings only.
+*/
+
+#define HEAP_SNAPSHOT_MAGIC     0x5348424Cu // "LBHS"
+#define HEAP_SNAPSHOT_VERSION   1
+
+#define HEAP_SNAPSHOT_ROOT_GLOBAL   0   // id is the symbol of the binding
+#define HEAP_SNAPSHOT_ROOT_ENV      1   // The global environment list itself
+#define HEAP_SNAPSHOT_ROOT_CTX      2   // id is the context id
+#define HEAP_SNAPSHOT_ROOT_STACK    3   // id is the context id
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  uint32_t heap_cells;
+  VALUE    freelist;
+  uint32_t mem_words;
+  uint32_t mem_base;
+  uint32_t bitmap_words;
+  uint32_t num_arrays;
+  uint32_t num_roots;
+  uint32_t num_symbols;
+  uint32_t gc_num;
+} heap_snapshot_header_t;
+
+typedef struct {
+  uint32_t cell;
+  TYPE     elt_type;
+  uint32_t size;
+} heap_snapshot_array_t;
+
+typedef struct {
+  uint32_t kind;
+  uint32_t id;
+  VALUE    val;
+} heap_snapshot_root_t;
+
+/* Scans the heap and returns the total size of the snapshot in bytes */
+extern uint32_t heap_snapshot_begin(void);
+/* Copies up to len bytes from offset into buf. Returns the number
+   of bytes copied, which is 0 at the end. */
+extern uint32_t heap_snapshot_read(uint32_t offset, uint8_t *buf, uint32_t len);
+
+#endif
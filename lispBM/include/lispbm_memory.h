@@ -105,4 +105,9 @@ extern uint32_t memory_num_free(void);
 extern uint32_t *memory_allocate(uint32_t num_words);
 extern int memory_free(uint32_t *ptr);
 
+// The memory area and its status bitmap, for heap snapshots
+extern uint32_t *memory_data(void);
+extern uint32_t *memory_bitmap(void);
+extern uint32_t memory_bitmap_words(void);
+
 #endif
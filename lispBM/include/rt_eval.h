@@ -0,0 +1,97 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RT_EVAL_H_
+#define RT_EVAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lispbm_types.h"
+
+/*
+  Real-time evaluator for a small, non-allocating subset of lisp.
+
+  Code is compiled once from a lisp expression into a fixed pool of
+  nodes, and can then be run from another thread without touching the
+  lisp heap, the symbol table or the evaluator. Every value is a float,
+  and 0 is false.
+
+  (+ a b ...) (- a b ...) (- a) (* a b ...) (/ a b)
+  (< a b) (> a b) (<= a b) (>= a b) (= a b)
+  (and a b ...) (or a b ...) (not a)
+  (abs a) (min a b ...) (max a b ...)
+  (if c a [b])
+  (progn a b ...)
+  (setq var a)                          Variables keep their value between runs
+  (post id a)                           Post a message to the main evaluator
+  (native a ...)                        Any function added with rt_eval_add_native
+
+  Numbers, t and nil are constants and any other symbol is a variable.
+  The variable dt holds the time in seconds since the previous run.
+  There are no loops, recursion or lambdas, so a run evaluates each node
+  at most once and its time is bounded by the size of the program.
+*/
+
+#define RT_EVAL_MAX_NODES       256
+#define RT_EVAL_MAX_VARS        16
+#define RT_EVAL_MAX_NATIVES     32
+#define RT_EVAL_MAX_ARGS        4
+#define RT_EVAL_MAX_DEPTH       16
+
+typedef enum {
+  RT_EVAL_OK = 0,
+  RT_EVAL_ERR_FORM,
+  RT_EVAL_ERR_ARGS,
+  RT_EVAL_ERR_NODES,
+  RT_EVAL_ERR_VARS,
+  RT_EVAL_ERR_DEPTH
+} rt_eval_res;
+
+typedef float (*rt_native_fun)(const float *args);
+
+typedef struct {
+  uint8_t op;
+  uint8_t argn;
+  uint16_t first;   // First argument
+  uint16_t next;    // Next argument of the parent
+  uint16_t ind;     // Variable or native index
+  float value;
+} rt_node_t;
+
+typedef struct {
+  rt_node_t nodes[RT_EVAL_MAX_NODES];
+  unsigned int num_nodes;
+  uint16_t root;
+  UINT var_syms[RT_EVAL_MAX_VARS];
+  volatile float vars[RT_EVAL_MAX_VARS];
+  unsigned int num_vars;
+  UINT err_sym;     // The symbol that caused a compile error, if any
+} rt_program_t;
+
+extern bool rt_eval_add_native(const char *name, unsigned int argn, rt_native_fun fun);
+extern void rt_eval_set_post_callback(void (*fun)(int id, float value));
+
+extern rt_eval_res rt_eval_compile(rt_program_t *p, VALUE code);
+extern const char *rt_eval_error_str(rt_eval_res res);
+extern float rt_eval_run(rt_program_t *p, float dt);
+
+/* Variable access by symbol, for the main evaluator. Returns -1 if the
+   program has no such variable. */
+extern int rt_eval_var_index(rt_program_t *p, UINT sym);
+
+#endif
@@ -22,5 +22,8 @@
 
 extern VALUE tokpar_parse(char *str);
 extern VALUE tokpar_parse_program(tokenizer_char_stream str);
+/* Parse one top level expression. Returns false at the end of the stream,
+   otherwise res is the expression or an error symbol. */
+extern bool tokpar_parse_next(tokenizer_char_stream str, VALUE *res);
 
 #endif
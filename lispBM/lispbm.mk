@@ -3,6 +3,8 @@ LISPBM = lispBM
 LISPBMSRC = $(LISPBM)/src/env.c \
             $(LISPBM)/src/fundamental.c \
 	        $(LISPBM)/src/heap.c \
+            $(LISPBM)/src/heap_image.c \
+            $(LISPBM)/src/heap_snapshot.c \
             $(LISPBM)/src/lispbm_memory.c \
             $(LISPBM)/src/print.c \
             $(LISPBM)/src/qq_expand.c \
@@ -11,11 +13,16 @@ LISPBMSRC = $(LISPBM)/src/env.c \
             $(LISPBM)/src/tokpar.c \
             $(LISPBM)/src/compression.c \
             $(LISPBM)/src/extensions.c \
+            $(LISPBM)/src/buffer_extensions.c \
+            $(LISPBM)/src/dsp_extensions.c \
+            $(LISPBM)/src/rt_eval.c \
             $(LISPBM)/src/lispbm.c \
             $(LISPBM)/src/eval_cps.c \
             $(LISPBM)/platform/chibios/src/platform_mutex.c \
 			$(LISPBM)/lispif.c \
-			$(LISPBM)/lispif_vesc_extensions.c
+			$(LISPBM)/lispif_vesc_extensions.c \
+			$(LISPBM)/lispif_events.c \
+			$(LISPBM)/lispif_rt.c
 
 LISPBMINC = lispBM \
             lispBM/include \
@@ -31,6 +31,14 @@
 #include "lispbm_memory.h"
 #include "env.h"
 #include "lispbm.h"
+#include "heap_image.h"
+#include "heap_snapshot.h"
+#include "compression.h"
+#include "lispif_events.h"
+#include "lispif_rt.h"
+#include "mc_interface.h"
+#include "comm_can.h"
+#include "hw.h"
 
 /*
  * Observed issues:
@@ -38,9 +46,20 @@
  * * extern keyword should be removed for functions as is makes no difference
  */
 
+// Can be overridden in the hardware configuration, e.g. after looking at
+// heap snapshots of the scripts that run on the board
+#ifndef HEAP_SIZE
 #define HEAP_SIZE				1024
+#endif
+#ifndef LISP_MEM_SIZE
 #define LISP_MEM_SIZE			MEMORY_SIZE_4K
-#define LISP_MEM_BITMAP_SIZE	MEMORY_BITMAP_SIZE_4K
+#endif
+// One bitmap word for every 16 memory words, see MEMORY_SIZE_64BYTES_TIMES_X
+#ifndef LISP_MEM_BITMAP_SIZE
+#define LISP_MEM_BITMAP_SIZE	(LISP_MEM_SIZE / 16)
+#endif
+#define CODE_SIZE				(128 * 1024)
+#define SNAPSHOT_TIMEOUT_MS		2000
 
 __attribute__((section(".ram4"))) static cons_t heap[HEAP_SIZE] __attribute__ ((aligned (8)));
 __attribute__((section(".ram4"))) static uint32_t memory_array[LISP_MEM_SIZE];
@@ -50,13 +69,83 @@ static thread_t *eval_tp = 0;
 static THD_WORKING_AREA(eval_thread_wa, 2048);
 static bool lisp_thd_running = false;
 
+static THD_WORKING_AREA(load_thread_wa, 2048);
+static volatile bool load_running = false;
+static volatile bool load_abort = false;
+static tokenizer_compressed_state load_ts;
+static tokenizer_char_stream load_str;
+
+static THD_WORKING_AREA(events_thread_wa, 512);
+static binary_semaphore_t eval_wake_sem;
+
+static mutex_t snapshot_mtx;
+static volatile bool snapshot_active = false;
+static bool snapshot_was_paused = false;
+static uint32_t snapshot_size = 0;
+static volatile systime_t snapshot_last = 0;
+
+// Private functions
+static void snapshot_end(bool resume);
+
 static uint32_t timestamp_callback(void) {
 	systime_t t = chVTGetSystemTime();
 	return (uint32_t) ((1000000 / CH_CFG_ST_FREQUENCY) * t);
 }
 
+// Sleeps until the time is up or an event arrives
 static void sleep_callback(uint32_t us) {
-	chThdSleepMicroseconds(us);
+	systime_t t = US2ST(us);
+	chBSemWaitTimeout(&eval_wake_sem, t > 0 ? t : 1);
+}
+
+static void wake_eval(void) {
+	chBSemSignal(&eval_wake_sem);
+}
+
+static bool can_sid_callback(uint32_t id, uint8_t *data, uint8_t len) {
+	return lispif_events_can_frame(id, false, data, len);
+}
+
+static bool can_eid_callback(uint32_t id, uint8_t *data, uint8_t len) {
+	return lispif_events_can_frame(id, true, data, len);
+}
+
+static void can_subscribed(void) {
+	comm_can_set_sid_rx_callback(can_sid_callback);
+	comm_can_set_eid_rx_callback(can_eid_callback);
+}
+
+/*
+ * Polls the event sources that do not notify by themselves. This runs in
+ * C, so scripts waiting for these events do not use evaluator time.
+ */
+static THD_FUNCTION(events_thread, arg) {
+	(void)arg;
+	chRegSetThreadName("Lisp Events");
+
+	for (;;) {
+		lispif_events_tick(ST2MS(chVTGetSystemTimeX()));
+
+		if (lispif_events_wants(LISPIF_EVENT_FAULT)) {
+			lispif_events_fault(mc_interface_get_fault());
+		}
+
+		if (lispif_events_wants(LISPIF_EVENT_ADC)) {
+			lispif_events_adc(0, ADC_VOLTS(ADC_IND_EXT));
+			lispif_events_adc(1, ADC_VOLTS(ADC_IND_EXT2));
+		}
+
+		// Do not leave evaluation paused if the host stops reading a snapshot
+		if (snapshot_active && ST2MS(chVTTimeElapsedSinceX(snapshot_last)) > SNAPSHOT_TIMEOUT_MS) {
+			chMtxLock(&snapshot_mtx);
+			if (snapshot_active) {
+				snapshot_end(true);
+			}
+			chMtxUnlock(&snapshot_mtx);
+		}
+
+		chThdSleepMilliseconds(1);
+	}
 }
 
 static THD_FUNCTION(eval_thread, arg) {
@@ -66,6 +155,71 @@ static THD_FUNCTION(eval_thread, arg) {
 	eval_cps_run_eval();
 }
 
+static void pause_eval(void) {
+	eval_cps_pause_eval();
+	wake_eval();
+	while (eval_cps_current_state() != EVAL_CPS_STATE_PAUSED) {
+		chThdSleepMilliseconds(1);
+	}
+}
+
+/*
+ * Read-eval loop for compressed code. Top level forms are decompressed,
+ * parsed and evaluated one at a time, with a garbage collection before
+ * each one. That way the heap only has to hold the largest form and what
+ * the program keeps, instead of the whole program at once.
+ */
+static THD_FUNCTION(load_thread, arg) {
+	(void)arg;
+	chRegSetThreadName("Lisp Load");
+
+	int form_num = 0;
+
+	while (!load_abort) {
+		pause_eval();
+		eval_cps_gc(enc_sym(SYM_NIL));
+
+		VALUE form;
+		if (!tokpar_parse_next(load_str, &form)) {
+			eval_cps_continue_eval();
+			break;
+		}
+
+		form_num++;
+
+		// Running out of cells while parsing leaves no free cells behind
+		VALUE prg = form;
+		if (type_of(form) != VAL_TYPE_SYMBOL || !symrepr_is_error(dec_sym(form))) {
+			prg = heap_num_free() > 0 ? cons(form, enc_sym(SYM_NIL)) : enc_sym(SYM_MERROR);
+		}
+
+		CID cid = 0;
+		if (type_of(prg) == PTR_TYPE_CONS) {
+			cid = eval_cps_program(prg);
+		}
+
+		eval_cps_continue_eval();
+
+		if (cid == 0) {
+			commands_printf("Lisp load: form %d: %s", form_num,
+					type_of(prg) == VAL_TYPE_SYMBOL ? symrepr_lookup_name(dec_sym(prg)) : "no context");
+			break;
+		}
+
+		VALUE r = enc_sym(SYM_NIL);
+		while (!load_abort && !eval_cps_remove_done_ctx(cid, &r)) {
+			chThdSleepMilliseconds(1);
+		}
+
+		if (type_of(r) == VAL_TYPE_SYMBOL && symrepr_is_error(dec_sym(r))) {
+			commands_printf("Lisp load: form %d: %s", form_num, symrepr_lookup_name(dec_sym(r)));
+			break;
+		}
+	}
+
+	load_running = false;
+}
+
 static void terminal_start(int argc, const char **argv) {
 	(void)argc;
 	(void)argv;
@@ -74,19 +228,36 @@ static void terminal_start(int argc, const char **argv) {
 
 	if (!lisp_thd_running) {
 		lispbm_init(heap, HEAP_SIZE, memory_array, LISP_MEM_SIZE, bitmap_array, LISP_MEM_BITMAP_SIZE);
+		chBSemObjectInit(&eval_wake_sem, true);
+		lispif_events_init(wake_eval, can_subscribed);
+		lispif_rt_init();
 
 		eval_cps_set_timestamp_us_callback(timestamp_callback);
 		eval_cps_set_usleep_callback(sleep_callback);
+		eval_cps_set_idle_sleep_us(10000);
 		chThdCreateStatic(eval_thread_wa, sizeof(eval_thread_wa), NORMALPRIO, eval_thread, NULL);
+		chThdCreateStatic(events_thread_wa, sizeof(events_thread_wa), NORMALPRIO - 1, events_thread, NULL);
 
 		lisp_thd_running = true;
 	} else {
+		lispif_rt_init();
+
+		chMtxLock(&snapshot_mtx);
+		snapshot_end(false);
+		chMtxUnlock(&snapshot_mtx);
+
+		load_abort = true;
+		while (load_running) {
+			chThdSleepMilliseconds(1);
+		}
+
 		eval_cps_pause_eval();
 		while (eval_cps_current_state() != EVAL_CPS_STATE_PAUSED) {
 			chThdSleepMilliseconds(100);
 		}
 
 		lispbm_init(heap, HEAP_SIZE, memory_array, LISP_MEM_SIZE, bitmap_array, LISP_MEM_BITMAP_SIZE);
+		lispif_events_init(wake_eval, can_subscribed);
 
 		eval_cps_pause_eval();
 		while (eval_cps_current_state() != EVAL_CPS_STATE_PAUSED) {
@@ -96,7 +267,29 @@ static void terminal_start(int argc, const char **argv) {
 
 	lispif_load_vesc_extensions();
 
-	VALUE t = tokpar_parse(code);
+	// The code area holds either source, compressed source or a heap
+	// image made by lbm_image
+	if (*((uint32_t*)code) == COMPRESSION_CODE_MAGIC) {
+		compression_create_char_stream(&load_ts, &load_str, code + 4);
+		load_abort = false;
+		load_running = true;
+		chThdCreateStatic(load_thread_wa, sizeof(load_thread_wa), NORMALPRIO - 1, load_thread, NULL);
+		eval_cps_continue_eval();
+		commands_printf("Lisp started, loading compressed code");
+		return;
+	}
+
+	VALUE t;
+	if (heap_image_is_valid((uint8_t*)code, CODE_SIZE)) {
+		t = heap_image_load((uint8_t*)code, CODE_SIZE);
+
+		if (type_of(t) == VAL_TYPE_SYMBOL) {
+			commands_printf("Could not load heap image: %s", symrepr_lookup_name(dec_sym(t)));
+			return;
+		}
+	} else {
+		t = tokpar_parse(code);
+	}
 
 	eval_cps_program(t);
 	eval_cps_continue_eval();
@@ -108,6 +301,12 @@ static void terminal_stop(int argc, const char **argv) {
 	(void)argc;
 	(void)argv;
 
+	lispif_rt_stop();
+
+	chMtxLock(&snapshot_mtx);
+	snapshot_end(false);
+	chMtxUnlock(&snapshot_mtx);
+
 	eval_cps_pause_eval();
 	while (eval_cps_current_state() != EVAL_CPS_STATE_PAUSED) {
 		chThdSleepMilliseconds(100);
@@ -141,6 +340,14 @@ static void terminal_stats(int argc, const char **argv) {
 		return;
 	}
 
+	lispif_rt_stats rt_stats;
+	lispif_rt_get_stats(&rt_stats);
+	if (rt_stats.running || rt_stats.runs > 0) {
+		commands_printf("RT loop: %s, runs: %lu, overruns: %lu, max: %.1f us",
+				rt_stats.running ? "running" : "stopped", rt_stats.runs,
+				rt_stats.overruns, (double)rt_stats.max_us);
+	}
+
 	commands_printf("------------------------------------------------------------\r\n");
 	commands_printf("Used cons cells: %lu", HEAP_SIZE - heap_num_free());
 	commands_printf("Free cons cells: %lu", heap_num_free());
@@ -173,7 +380,61 @@ static void terminal_stats(int argc, const char **argv) {
 	commands_printf(" ");
 }
 
+static void snapshot_end(bool resume) {
+	if (snapshot_active && resume && !snapshot_was_paused) {
+		eval_cps_continue_eval();
+	}
+	snapshot_active = false;
+}
+
+/*
+ * Reads a chunk of a heap snapshot. Reading offset 0 pauses evaluation,
+ * optionally collects garbage and starts a new snapshot. Evaluation
+ * continues when the last chunk has been read, or after a timeout. The
+ * total size is 0 if there is no snapshot to read.
+ */
+uint32_t lispif_heap_snapshot(uint32_t offset, uint8_t *buf, uint32_t len, bool gc, uint32_t *total) {
+	*total = 0;
+
+	if (!lisp_thd_running || load_running) {
+		return 0;
+	}
+
+	chMtxLock(&snapshot_mtx);
+
+	if (offset == 0) {
+		if (!snapshot_active) {
+			snapshot_was_paused = eval_cps_current_state() == EVAL_CPS_STATE_PAUSED;
+			pause_eval();
+			snapshot_active = true;
+		}
+
+		if (gc) {
+			eval_cps_gc(enc_sym(SYM_NIL));
+		}
+
+		snapshot_size = heap_snapshot_begin();
+	}
+
+	uint32_t res = 0;
+	if (snapshot_active) {
+		res = heap_snapshot_read(offset, buf, len);
+		*total = snapshot_size;
+		snapshot_last = chVTGetSystemTimeX();
+
+		if ((offset + res) >= snapshot_size) {
+			snapshot_end(true);
+		}
+	}
+
+	chMtxUnlock(&snapshot_mtx);
+
+	return res;
+}
+
 void lispif_init(void) {
+	chMtxObjectInit(&snapshot_mtx);
+
 	terminal_register_command_callback(
 			"lisp_run",
 			"Run Lisp",
@@ -21,8 +21,12 @@
 #ifndef LISPBM_LISPIF_H_
 #define LISPBM_LISPIF_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+
 // Functions
 void lispif_init(void);
 void lispif_load_vesc_extensions(void);
+uint32_t lispif_heap_snapshot(uint32_t offset, uint8_t *buf, uint32_t len, bool gc, uint32_t *total);
 
 #endif /* LISPBM_LISPIF_H_ */
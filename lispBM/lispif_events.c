@@ -0,0 +1,520 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lispif_events.h"
+#include "eval_cps.h"
+#include "extensions.h"
+#include "symrepr.h"
+#include "heap.h"
+#include "platform_mutex.h"
+
+#include <string.h>
+
+#define SUBS_MAX			16
+#define QUEUE_LEN			32
+
+typedef struct {
+	bool active;
+	CID cid;
+	lispif_event_type type;
+	uint32_t id;
+	uint32_t mask;
+	float threshold;
+	float hysteresis;
+	int state;
+	uint32_t period_ms;
+	uint32_t next_ms;
+} event_sub;
+
+typedef struct {
+	CID cid;
+	lispif_event_type type;
+	uint32_t id;
+	float value;
+	bool above;
+	uint8_t len;
+	uint8_t data[8];
+} event_msg;
+
+// Private variables
+static mutex_t m_mutex;
+static bool m_mutex_init_done = false;
+static event_sub m_subs[SUBS_MAX];
+static event_msg m_queue[QUEUE_LEN];
+static volatile unsigned int m_head = 0;
+static volatile unsigned int m_tail = 0;
+static volatile uint32_t m_dropped = 0;
+static void (*m_wakeup)(void) = 0;
+static void (*m_can_subscribed)(void) = 0;
+
+static UINT m_sym_can_sid;
+static UINT m_sym_can_eid;
+static UINT m_sym_adc_above;
+static UINT m_sym_adc_below;
+static UINT m_sym_fault;
+static UINT m_sym_timer;
+static UINT m_sym_rt;
+
+// Private functions
+static void process_events(void);
+
+void lispif_events_init(void (*wakeup)(void), void (*can_subscribed)(void)) {
+	if (!m_mutex_init_done) {
+		mutex_init(&m_mutex);
+		m_mutex_init_done = true;
+	}
+
+	mutex_lock(&m_mutex);
+	memset(m_subs, 0, sizeof(m_subs));
+	m_head = 0;
+	m_tail = 0;
+	m_dropped = 0;
+	m_wakeup = wakeup;
+	m_can_subscribed = can_subscribed;
+	mutex_unlock(&m_mutex);
+
+	eval_cps_set_event_callback(process_events);
+}
+
+bool lispif_events_wants(lispif_event_type type) {
+	for (int i = 0;i < SUBS_MAX;i++) {
+		if (m_subs[i].active && m_subs[i].type == type) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void lispif_events_unsubscribe(CID cid) {
+	mutex_lock(&m_mutex);
+	for (int i = 0;i < SUBS_MAX;i++) {
+		if (m_subs[i].cid == cid) {
+			m_subs[i].active = false;
+		}
+	}
+	mutex_unlock(&m_mutex);
+}
+
+uint32_t lispif_events_dropped(void) {
+	return m_dropped;
+}
+
+// Must be called with the mutex locked. Returns the event to fill in.
+static event_msg *queue_event(event_sub *sub, uint32_t id) {
+	if (m_head - m_tail >= QUEUE_LEN) {
+		m_dropped++;
+		return 0;
+	}
+
+	event_msg *ev = &m_queue[m_head % QUEUE_LEN];
+	memset(ev, 0, sizeof(event_msg));
+	ev->cid = sub->cid;
+	ev->type = sub->type;
+	ev->id = id;
+	m_head++;
+
+	return ev;
+}
+
+static void wakeup(bool queued) {
+	if (queued && m_wakeup) {
+		m_wakeup();
+	}
+}
+
+bool lispif_events_can_frame(uint32_t id, bool eid, uint8_t *data, uint8_t len) {
+	lispif_event_type type = eid ? LISPIF_EVENT_CAN_EID : LISPIF_EVENT_CAN_SID;
+	bool queued = false;
+
+	mutex_lock(&m_mutex);
+	for (int i = 0;i < SUBS_MAX;i++) {
+		event_sub *s = &m_subs[i];
+		if (s->active && s->type == type && (id & s->mask) == (s->id & s->mask)) {
+			event_msg *ev = queue_event(s, id);
+			if (ev) {
+				ev->len = len > 8 ? 8 : len;
+				memcpy(ev->data, data, ev->len);
+				queued = true;
+			}
+		}
+	}
+	mutex_unlock(&m_mutex);
+
+	wakeup(queued);
+
+	// Other users of the frame still get it
+	return false;
+}
+
+void lispif_events_adc(int channel, float volts) {
+	bool queued = false;
+
+	mutex_lock(&m_mutex);
+	for (int i = 0;i < SUBS_MAX;i++) {
+		event_sub *s = &m_subs[i];
+		if (!s->active || s->type != LISPIF_EVENT_ADC || s->id != (uint32_t)channel) {
+			continue;
+		}
+
+		int state = s->state;
+		if (state < 0) {
+			s->state = volts > s->threshold;
+			continue;
+		} else if (state == 0 && volts > s->threshold) {
+			s->state = 1;
+		} else if (state == 1 && volts < (s->threshold - s->hysteresis)) {
+			s->state = 0;
+		} else {
+			continue;
+		}
+
+		event_msg *ev = queue_event(s, (uint32_t)channel);
+		if (ev) {
+			ev->value = volts;
+			ev->above = s->state == 1;
+			queued = true;
+		}
+	}
+	mutex_unlock(&m_mutex);
+
+	wakeup(queued);
+}
+
+void lispif_events_fault(int fault) {
+	bool queued = false;
+
+	mutex_lock(&m_mutex);
+	for (int i = 0;i < SUBS_MAX;i++) {
+		event_sub *s = &m_subs[i];
+		if (!s->active || s->type != LISPIF_EVENT_FAULT) {
+			continue;
+		}
+
+		if (s->state < 0) {
+			s->state = fault;
+		} else if (s->state != fault) {
+			s->state = fault;
+			queued |= queue_event(s, (uint32_t)fault) != 0;
+		}
+	}
+	mutex_unlock(&m_mutex);
+
+	wakeup(queued);
+}
+
+void lispif_events_tick(uint32_t now_ms) {
+	bool queued = false;
+
+	mutex_lock(&m_mutex);
+	for (int i = 0;i < SUBS_MAX;i++) {
+		event_sub *s = &m_subs[i];
+		if (!s->active || s->type != LISPIF_EVENT_TIMER) {
+			continue;
+		}
+
+		if (s->state < 0) {
+			s->state = 0;
+			s->next_ms = now_ms + s->period_ms;
+		} else if ((int32_t)(now_ms - s->next_ms) >= 0) {
+			queued |= queue_event(s, (uint32_t)i) != 0;
+			s->next_ms += s->period_ms;
+
+			// Do not try to catch up after a long stall
+			if ((int32_t)(now_ms - s->next_ms) >= 0) {
+				s->next_ms = now_ms + s->period_ms;
+			}
+		}
+	}
+	mutex_unlock(&m_mutex);
+
+	wakeup(queued);
+}
+
+void lispif_events_rt(int id, float value) {
+	bool queued = false;
+
+	mutex_lock(&m_mutex);
+	for (int i = 0;i < SUBS_MAX;i++) {
+		event_sub *s = &m_subs[i];
+		if (!s->active || s->type != LISPIF_EVENT_RT) {
+			continue;
+		}
+
+		event_msg *ev = queue_event(s, (uint32_t)id);
+		if (ev) {
+			ev->value = value;
+			queued = true;
+		}
+	}
+	mutex_unlock(&m_mutex);
+
+	wakeup(queued);
+}
+
+static VALUE make_msg(event_msg *ev) {
+	VALUE head;
+	VALUE args = enc_sym(SYM_NIL);
+	VALUE id = enc_i((INT)ev->id);
+
+	switch (ev->type) {
+	case LISPIF_EVENT_CAN_SID:
+	case LISPIF_EVENT_CAN_EID: {
+		head = enc_sym(ev->type == LISPIF_EVENT_CAN_SID ? m_sym_can_sid : m_sym_can_eid);
+
+		VALUE data;
+		if (!heap_allocate_array(&data, ev->len, VAL_TYPE_CHAR)) {
+			return enc_sym(SYM_MERROR);
+		}
+		memcpy((char*)car(data) + 8, ev->data, ev->len);
+
+		args = cons(data, args);
+		if (ev->type == LISPIF_EVENT_CAN_EID) {
+			// Extended ids do not fit in 28 bits
+			id = enc_U(ev->id);
+		}
+	} break;
+
+	case LISPIF_EVENT_ADC: {
+		head = enc_sym(ev->above ? m_sym_adc_above : m_sym_adc_below);
+		VALUE v = enc_F(ev->value);
+		if (type_of(v) == VAL_TYPE_SYMBOL) {
+			return v;
+		}
+		args = cons(v, args);
+	} break;
+
+	case LISPIF_EVENT_FAULT:
+		head = enc_sym(m_sym_fault);
+		break;
+
+	case LISPIF_EVENT_TIMER:
+		head = enc_sym(m_sym_timer);
+		break;
+
+	case LISPIF_EVENT_RT: {
+		head = enc_sym(m_sym_rt);
+		VALUE v = enc_F(ev->value);
+		if (type_of(v) == VAL_TYPE_SYMBOL) {
+			return v;
+		}
+		args = cons(v, args);
+	} break;
+
+	default:
+		return enc_sym(SYM_EERROR);
+	}
+
+	if (type_of(args) == VAL_TYPE_SYMBOL && args != enc_sym(SYM_NIL)) {
+		return args;
+	}
+	if (type_of(id) == VAL_TYPE_SYMBOL) {
+		return id;
+	}
+
+	args = cons(id, args);
+	if (type_of(args) == VAL_TYPE_SYMBOL) {
+		return args;
+	}
+
+	return cons(head, args);
+}
+
+/*
+ * Called by the evaluator between evaluation steps, so the heap can be
+ * used here. The queue is read without the mutex first, as this runs
+ * before every step.
+ */
+static void process_events(void) {
+	while (m_tail != m_head) {
+		event_msg ev;
+
+		mutex_lock(&m_mutex);
+		ev = m_queue[m_tail % QUEUE_LEN];
+		m_tail++;
+		mutex_unlock(&m_mutex);
+
+		VALUE msg = make_msg(&ev);
+		if (is_symbol_merror(msg)) {
+			eval_cps_gc(enc_sym(SYM_NIL));
+			msg = make_msg(&ev);
+		}
+
+		if (type_of(msg) == VAL_TYPE_SYMBOL) {
+			m_dropped++;
+			continue;
+		}
+
+		VALUE res = eval_cps_send(ev.cid, msg);
+		if (res == enc_sym(SYM_NIL)) {
+			// The context is gone
+			lispif_events_unsubscribe(ev.cid);
+		} else if (res != enc_sym(SYM_TRUE)) {
+			m_dropped++;
+		}
+	}
+}
+
+// Extensions
+
+static int subscribe(lispif_event_type type, uint32_t id, uint32_t mask,
+		float threshold, float hysteresis, uint32_t period_ms) {
+	CID cid = eval_cps_current_cid();
+	int res = -1;
+
+	mutex_lock(&m_mutex);
+	for (int i = 0;i < SUBS_MAX;i++) {
+		event_sub *s = &m_subs[i];
+		if (!s->active) {
+			s->cid = cid;
+			s->type = type;
+			s->id = id;
+			s->mask = mask;
+			s->threshold = threshold;
+			s->hysteresis = hysteresis;
+			s->state = -1;
+			s->period_ms = period_ms;
+			s->next_ms = 0;
+			s->active = true;
+			res = i;
+			break;
+		}
+	}
+	mutex_unlock(&m_mutex);
+
+	if (res >= 0 && (type == LISPIF_EVENT_CAN_SID || type == LISPIF_EVENT_CAN_EID) &&
+			m_can_subscribed) {
+		m_can_subscribed();
+	}
+
+	return res;
+}
+
+static bool is_number_all(VALUE *args, UINT argn) {
+	for (UINT i = 0;i < argn;i++) {
+		if (!is_number(args[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static VALUE sub_result(int id) {
+	return id >= 0 ? enc_i(id) : enc_sym(SYM_MERROR);
+}
+
+static VALUE ext_event_can(VALUE *args, UINT argn, bool eid) {
+	if (argn < 1 || argn > 2 || !is_number_all(args, argn)) {
+		return enc_sym(SYM_EERROR);
+	}
+
+	uint32_t mask = eid ? 0x1FFFFFFF : 0x7FF;
+	if (argn == 2) {
+		mask = dec_as_u(args[1]);
+	}
+
+	return sub_result(subscribe(eid ? LISPIF_EVENT_CAN_EID : LISPIF_EVENT_CAN_SID,
+			dec_as_u(args[0]), mask, 0.0, 0.0, 0));
+}
+
+static VALUE ext_event_can_sid(VALUE *args, UINT argn) {
+	return ext_event_can(args, argn, false);
+}
+
+static VALUE ext_event_can_eid(VALUE *args, UINT argn) {
+	return ext_event_can(args, argn, true);
+}
+
+static VALUE ext_event_adc(VALUE *args, UINT argn) {
+	if (argn < 2 || argn > 3 || !is_number_all(args, argn)) {
+		return enc_sym(SYM_EERROR);
+	}
+
+	float hyst = argn == 3 ? dec_as_f(args[2]) : 0.0;
+	return sub_result(subscribe(LISPIF_EVENT_ADC, dec_as_u(args[0]), 0,
+			dec_as_f(args[1]), hyst, 0));
+}
+
+static VALUE ext_event_fault(VALUE *args, UINT argn) {
+	(void)args;
+	if (argn != 0) {
+		return enc_sym(SYM_EERROR);
+	}
+	return sub_result(subscribe(LISPIF_EVENT_FAULT, 0, 0, 0.0, 0.0, 0));
+}
+
+static VALUE ext_event_timer(VALUE *args, UINT argn) {
+	if (argn != 1 || !is_number(args[0]) || dec_as_i(args[0]) <= 0) {
+		return enc_sym(SYM_EERROR);
+	}
+	return sub_result(subscribe(LISPIF_EVENT_TIMER, 0, 0, 0.0, 0.0, dec_as_u(args[0])));
+}
+
+static VALUE ext_event_rt(VALUE *args, UINT argn) {
+	(void)args;
+	if (argn != 0) {
+		return enc_sym(SYM_EERROR);
+	}
+	return sub_result(subscribe(LISPIF_EVENT_RT, 0, 0, 0.0, 0.0, 0));
+}
+
+static VALUE ext_event_unsubscribe(VALUE *args, UINT argn) {
+	if (argn == 0) {
+		lispif_events_unsubscribe(eval_cps_current_cid());
+		return enc_sym(SYM_TRUE);
+	}
+
+	if (argn != 1 || !is_number(args[0])) {
+		return enc_sym(SYM_EERROR);
+	}
+
+	INT id = dec_as_i(args[0]);
+	VALUE res = enc_sym(SYM_EERROR);
+
+	mutex_lock(&m_mutex);
+	if (id >= 0 && id < SUBS_MAX && m_subs[id].active &&
+			m_subs[id].cid == eval_cps_current_cid()) {
+		m_subs[id].active = false;
+		res = enc_sym(SYM_TRUE);
+	}
+	mutex_unlock(&m_mutex);
+
+	return res;
+}
+
+bool lispif_events_load_extensions(void) {
+	bool res = true;
+
+	res = res && symrepr_addsym("can-sid", &m_sym_can_sid);
+	res = res && symrepr_addsym("can-eid", &m_sym_can_eid);
+	res = res && symrepr_addsym("adc-above", &m_sym_adc_above);
+	res = res && symrepr_addsym("adc-below", &m_sym_adc_below);
+	res = res && symrepr_addsym("fault", &m_sym_fault);
+	res = res && symrepr_addsym("timer", &m_sym_timer);
+	res = res && symrepr_addsym("rt", &m_sym_rt);
+
+	res = res && extensions_add("event-can-sid", ext_event_can_sid);
+	res = res && extensions_add("event-can-eid", ext_event_can_eid);
+	res = res && extensions_add("event-adc", ext_event_adc);
+	res = res && extensions_add("event-fault", ext_event_fault);
+	res = res && extensions_add("event-timer", ext_event_timer);
+	res = res && extensions_add("event-rt", ext_event_rt);
+	res = res && extensions_add("event-unsubscribe", ext_event_unsubscribe);
+
+	return res;
+}
@@ -0,0 +1,71 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LISPBM_LISPIF_EVENTS_H_
+#define LISPBM_LISPIF_EVENTS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lispbm_types.h"
+
+/*
+ * Events delivered to the mailbox of the context that subscribed to them,
+ * so that scripts can block in recv instead of polling with yield.
+ *
+ * (event-can-sid id [mask])            -> (can-sid id data)
+ * (event-can-eid id [mask])            -> (can-eid id data)
+ * (event-adc ch threshold [hyst])      -> (adc-above ch volts), (adc-below ch volts)
+ * (event-fault)                        -> (fault code)
+ * (event-timer ms)                     -> (timer id)
+ * (event-rt)                           -> (rt id value)
+ * (event-unsubscribe [id])
+ *
+ * The subscribe functions return an id that can be unsubscribed. Data is
+ * a byte array that can be read with the buffer extensions. Frames match
+ * when (id & mask) equals the subscribed id & mask.
+ *
+ * Sources call the functions below from any thread. The events are queued
+ * and turned into messages by the evaluator between evaluation steps.
+ */
+
+typedef enum {
+	LISPIF_EVENT_CAN_SID = 0,
+	LISPIF_EVENT_CAN_EID,
+	LISPIF_EVENT_ADC,
+	LISPIF_EVENT_FAULT,
+	LISPIF_EVENT_TIMER,
+	LISPIF_EVENT_RT
+} lispif_event_type;
+
+// Functions
+void lispif_events_init(void (*wakeup)(void), void (*can_subscribed)(void));
+bool lispif_events_load_extensions(void);
+bool lispif_events_wants(lispif_event_type type);
+void lispif_events_unsubscribe(CID cid);
+uint32_t lispif_events_dropped(void);
+
+// Sources
+bool lispif_events_can_frame(uint32_t id, bool eid, uint8_t *data, uint8_t len);
+void lispif_events_adc(int channel, float volts);
+void lispif_events_fault(int fault);
+void lispif_events_tick(uint32_t now_ms);
+void lispif_events_rt(int id, float value);
+
+#endif /* LISPBM_LISPIF_EVENTS_H_ */
@@ -0,0 +1,336 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lispif_rt.h"
+#include "lispif_events.h"
+#include "rt_eval.h"
+#include "extensions.h"
+#include "symrepr.h"
+#include "heap.h"
+
+#include "ch.h"
+#include "commands.h"
+#include "mc_interface.h"
+#include "timeout.h"
+#include "servo_dec.h"
+#include "timer.h"
+#include "hw.h"
+
+#define RT_RATE_MAX				1000
+#define RT_BUDGET_DEFAULT_US	200.0
+#define RT_OVERRUN_LIMIT		3
+
+// Private variables
+static THD_WORKING_AREA(rt_thread_wa, 1024);
+static bool m_init_done = false;
+static rt_program_t m_prog;
+static volatile bool m_running = false;
+static volatile bool m_in_run = false;
+static volatile systime_t m_period = 0;
+static volatile float m_budget_us = RT_BUDGET_DEFAULT_US;
+static volatile lispif_rt_stats m_stats;
+
+// Private functions
+static void add_natives(void);
+
+static THD_FUNCTION(rt_thread, arg) {
+	(void)arg;
+	chRegSetThreadName("Lisp RT");
+
+	systime_t time = chVTGetSystemTimeX();
+	uint32_t last_run = timer_time_now();
+	int overruns_in_row = 0;
+
+	for (;;) {
+		if (!m_running) {
+			chThdSleepMilliseconds(5);
+			time = chVTGetSystemTimeX();
+			last_run = timer_time_now();
+			overruns_in_row = 0;
+			continue;
+		}
+
+		m_in_run = true;
+		if (m_running) {
+			uint32_t t_start = timer_time_now();
+			float dt = timer_seconds_elapsed_since(last_run);
+			last_run = t_start;
+
+			rt_eval_run(&m_prog, dt);
+
+			float us = timer_seconds_elapsed_since(t_start) * 1e6;
+			m_stats.runs++;
+			m_stats.last_us = us;
+			if (us > m_stats.max_us) {
+				m_stats.max_us = us;
+			}
+
+			if (us > m_budget_us) {
+				m_stats.overruns++;
+				overruns_in_row++;
+				if (overruns_in_row >= RT_OVERRUN_LIMIT) {
+					m_running = false;
+					m_stats.running = false;
+					mc_interface_release_motor();
+					lispif_events_rt(-1, us);
+				}
+			} else {
+				overruns_in_row = 0;
+			}
+		}
+		m_in_run = false;
+
+		// Sleeps until the next period, or not at all if it already started
+		systime_t prev = time;
+		time += m_period;
+		chThdSleepUntilWindowed(prev, time);
+		if ((systime_t)(chVTGetSystemTimeX() - prev) > m_period) {
+			time = chVTGetSystemTimeX();
+		}
+	}
+}
+
+// Starts the thread the first time. Later calls stop the loop and drop
+// the program, as its variables refer to symbols of the previous heap.
+void lispif_rt_init(void) {
+	if (m_init_done) {
+		lispif_rt_stop();
+		m_prog.num_nodes = 0;
+		m_prog.num_vars = 0;
+		return;
+	}
+
+	add_natives();
+	rt_eval_set_post_callback(lispif_events_rt);
+	chThdCreateStatic(rt_thread_wa, sizeof(rt_thread_wa), NORMALPRIO + 1, rt_thread, NULL);
+	m_init_done = true;
+}
+
+// Stops the loop and waits for a run in progress to finish
+void lispif_rt_stop(void) {
+	m_running = false;
+	m_stats.running = false;
+	while (m_in_run) {
+		chThdSleepMilliseconds(1);
+	}
+}
+
+void lispif_rt_get_stats(lispif_rt_stats *stats) {
+	*stats = *((lispif_rt_stats*)&m_stats);
+}
+
+// Natives that can be called from the real-time program
+
+static float rt_set_current(const float *args) {
+	mc_interface_set_current(args[0]);
+	return args[0];
+}
+
+static float rt_set_current_rel(const float *args) {
+	mc_interface_set_current_rel(args[0]);
+	return args[0];
+}
+
+static float rt_set_duty(const float *args) {
+	mc_interface_set_duty(args[0]);
+	return args[0];
+}
+
+static float rt_set_brake(const float *args) {
+	mc_interface_set_brake_current(args[0]);
+	return args[0];
+}
+
+static float rt_set_rpm(const float *args) {
+	mc_interface_set_pid_speed(args[0]);
+	return args[0];
+}
+
+static float rt_get_current(const float *args) {
+	(void)args;
+	return mc_interface_get_tot_current_filtered();
+}
+
+static float rt_get_duty(const float *args) {
+	(void)args;
+	return mc_interface_get_duty_cycle_now();
+}
+
+static float rt_get_rpm(const float *args) {
+	(void)args;
+	return mc_interface_get_rpm();
+}
+
+static float rt_get_vin(const float *args) {
+	(void)args;
+	return mc_interface_get_input_voltage_filtered();
+}
+
+static float rt_get_adc(const float *args) {
+	return args[0] >= 0.5 ? ADC_VOLTS(ADC_IND_EXT2) : ADC_VOLTS(ADC_IND_EXT);
+}
+
+static float rt_get_ppm(const float *args) {
+	(void)args;
+	return servodec_get_servo(0);
+}
+
+static float rt_timeout_reset(const float *args) {
+	(void)args;
+	timeout_reset();
+	return 1.0;
+}
+
+static void add_natives(void) {
+	rt_eval_add_native("set-current", 1, rt_set_current);
+	rt_eval_add_native("set-current-rel", 1, rt_set_current_rel);
+	rt_eval_add_native("set-duty", 1, rt_set_duty);
+	rt_eval_add_native("set-brake", 1, rt_set_brake);
+	rt_eval_add_native("set-rpm", 1, rt_set_rpm);
+	rt_eval_add_native("get-current", 0, rt_get_current);
+	rt_eval_add_native("get-duty", 0, rt_get_duty);
+	rt_eval_add_native("get-rpm", 0, rt_get_rpm);
+	rt_eval_add_native("get-vin", 0, rt_get_vin);
+	rt_eval_add_native("get-adc", 1, rt_get_adc);
+	rt_eval_add_native("get-ppm", 0, rt_get_ppm);
+	rt_eval_add_native("timeout-reset", 0, rt_timeout_reset);
+}
+
+// Extensions for the main evaluator
+
+static VALUE ext_rt_load(VALUE *args, UINT argn) {
+	if (argn != 1) {
+		return enc_sym(SYM_EERROR);
+	}
+
+	lispif_rt_stop();
+
+	rt_eval_res res = rt_eval_compile(&m_prog, args[0]);
+	if (res != RT_EVAL_OK) {
+		const char *name = symrepr_lookup_name(m_prog.err_sym);
+		commands_printf("RT: %s%s%s", rt_eval_error_str(res),
+				m_prog.err_sym != SYM_NIL && name ? " at " : "",
+				m_prog.err_sym != SYM_NIL && name ? name : "");
+		return enc_sym(SYM_EERROR);
+	}
+
+	return enc_sym(SYM_TRUE);
+}
+
+static VALUE ext_rt_start(VALUE *args, UINT argn) {
+	if (argn < 1 || argn > 2 || !is_number(args[0]) || (argn == 2 && !is_number(args[1]))) {
+		return enc_sym(SYM_EERROR);
+	}
+
+	float hz = dec_as_f(args[0]);
+	if (hz <= 0.0 || hz > RT_RATE_MAX || m_prog.num_nodes == 0) {
+		return enc_sym(SYM_EERROR);
+	}
+
+	lispif_rt_stop();
+
+	m_period = US2ST((int)(1.0e6 / hz));
+	if (m_period == 0) {
+		m_period = 1;
+	}
+	m_budget_us = argn == 2 ? dec_as_f(args[1]) : RT_BUDGET_DEFAULT_US;
+	m_stats.runs = 0;
+	m_stats.overruns = 0;
+	m_stats.max_us = 0.0;
+	m_stats.last_us = 0.0;
+	m_stats.running = true;
+	m_running = true;
+
+	return enc_sym(SYM_TRUE);
+}
+
+static VALUE ext_rt_stop(VALUE *args, UINT argn) {
+	(void)args; (void)argn;
+	lispif_rt_stop();
+	return enc_sym(SYM_TRUE);
+}
+
+static int var_index(VALUE var) {
+	if (type_of(var) != VAL_TYPE_SYMBOL) {
+		return -1;
+	}
+	return rt_eval_var_index(&m_prog, dec_sym(var));
+}
+
+static VALUE ext_rt_set(VALUE *args, UINT argn) {
+	if (argn != 2 || !is_number(args[1])) {
+		return enc_sym(SYM_EERROR);
+	}
+
+	int ind = var_index(args[0]);
+	if (ind < 0) {
+		return enc_sym(SYM_NIL);
+	}
+
+	m_prog.vars[ind] = dec_as_f(args[1]);
+	return enc_sym(SYM_TRUE);
+}
+
+static VALUE ext_rt_get(VALUE *args, UINT argn) {
+	if (argn != 1) {
+		return enc_sym(SYM_EERROR);
+	}
+
+	int ind = var_index(args[0]);
+	if (ind < 0) {
+		return enc_sym(SYM_NIL);
+	}
+
+	return enc_F(m_prog.vars[ind]);
+}
+
+static VALUE ext_rt_stats(VALUE *args, UINT argn) {
+	(void)args; (void)argn;
+
+	lispif_rt_stats stats;
+	lispif_rt_get_stats(&stats);
+
+	VALUE max_us = enc_F(stats.max_us);
+	if (type_of(max_us) == VAL_TYPE_SYMBOL) {
+		return max_us;
+	}
+
+	VALUE res = cons(max_us, enc_sym(SYM_NIL));
+	if (type_of(res) == VAL_TYPE_SYMBOL) {
+		return res;
+	}
+	res = cons(enc_i(stats.overruns), res);
+	if (type_of(res) == VAL_TYPE_SYMBOL) {
+		return res;
+	}
+	return cons(enc_i(stats.runs), res);
+}
+
+bool lispif_rt_load_extensions(void) {
+	bool res = true;
+
+	res = res && extensions_add("rt-load", ext_rt_load);
+	res = res && extensions_add("rt-start", ext_rt_start);
+	res = res && extensions_add("rt-stop", ext_rt_stop);
+	res = res && extensions_add("rt-set", ext_rt_set);
+	res = res && extensions_add("rt-get", ext_rt_get);
+	res = res && extensions_add("rt-stats", ext_rt_stats);
+
+	return res;
+}
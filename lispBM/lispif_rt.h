@@ -0,0 +1,57 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LISPBM_LISPIF_RT_H_
+#define LISPBM_LISPIF_RT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Real-time loop for control scripts. A program in the subset described
+ * in rt_eval.h runs at a fixed rate in its own thread, above the main
+ * evaluator, so it does not wait for the gc or other contexts.
+ *
+ * (rt-load code)                       Compile quoted code, stops the loop
+ * (rt-start hz [budget-us])            Run the program hz times per second
+ * (rt-stop)
+ * (rt-set var value), (rt-get var)     Program variables, var quoted
+ * (rt-stats)                           (runs overruns max-us)
+ *
+ * A run that takes longer than the budget is an overrun. After
+ * RT_OVERRUN_LIMIT overruns in a row the loop stops, the motor is
+ * released and (rt -1 us) is posted. (post id value) in the program
+ * sends (rt id value) to the contexts that called (event-rt).
+ */
+
+typedef struct {
+	uint32_t runs;
+	uint32_t overruns;
+	float max_us;
+	float last_us;
+	bool running;
+} lispif_rt_stats;
+
+// Functions
+void lispif_rt_init(void);
+void lispif_rt_stop(void);
+void lispif_rt_get_stats(lispif_rt_stats *stats);
+bool lispif_rt_load_extensions(void);
+
+#endif /* LISPBM_LISPIF_RT_H_ */
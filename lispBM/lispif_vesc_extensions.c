@@ -20,6 +20,10 @@
 
 #include "lispif.h"
 #include "extensions.h"
+#include "buffer_extensions.h"
+#include "dsp_extensions.h"
+#include "lispif_events.h"
+#include "lispif_rt.h"
 #include "print.h"
 
 #include "commands.h"
@@ -32,6 +36,7 @@
 #include "bms.h"
 #include "utils.h"
 #include "hw.h"
+#include "app.h"
 
 #include <math.h>
 
@@ -410,6 +415,55 @@ static VALUE ext_can_pos(VALUE *args, UINT argn) {
 	return enc_sym(SYM_TRUE);
 }
 
+// Raw CAN-frames and UART-bytes from buffers
+
+static VALUE ext_can_send(VALUE *args, UINT argn, bool eid) {
+	uint8_t *data;
+	uint32_t len;
+
+	if (argn != 2 || !is_number(args[0]) ||
+			!buffer_get_data(args[1], &data, &len) || len > 8) {
+		return enc_sym(SYM_EERROR);
+	}
+
+	if (eid) {
+		comm_can_transmit_eid(dec_as_u(args[0]), data, len);
+	} else {
+		comm_can_transmit_sid(dec_as_u(args[0]), data, len);
+	}
+
+	return enc_sym(SYM_TRUE);
+}
+
+static VALUE ext_can_send_sid(VALUE *args, UINT argn) {
+	return ext_can_send(args, argn, false);
+}
+
+static VALUE ext_can_send_eid(VALUE *args, UINT argn) {
+	return ext_can_send(args, argn, true);
+}
+
+static VALUE ext_uart_write(VALUE *args, UINT argn) {
+	uint8_t *data;
+	uint32_t len;
+	UART_PORT port = UART_PORT_COMM_HEADER;
+
+	if (argn < 1 || argn > 2 || !buffer_get_data(args[0], &data, &len)) {
+		return enc_sym(SYM_EERROR);
+	}
+
+	if (argn == 2) {
+		if (!is_number(args[1]) || dec_as_i(args[1]) < 0 ||
+				dec_as_i(args[1]) > UART_PORT_EXTRA_HEADER) {
+			return enc_sym(SYM_EERROR);
+		}
+		port = dec_as_i(args[1]);
+	}
+
+	app_uartcomm_write(data, len, port);
+	return enc_sym(SYM_TRUE);
+}
+
 // Math
 
 static VALUE ext_sin(VALUE *args, UINT argn) {
@@ -433,6 +487,11 @@ static VALUE ext_pow(VALUE *args, UINT argn) {
 }
 
 void lispif_load_vesc_extensions(void) {
+	buffer_extensions_init();
+	dsp_extensions_init();
+	lispif_events_load_extensions();
+	lispif_rt_load_extensions();
+
 	// Various commands
 	extensions_add("print", ext_print);
 	extensions_add("timeout-reset", ext_reset_timeout);
@@ -478,6 +537,11 @@ void lispif_load_vesc_extensions(void) {
 	extensions_add("canset-rpm", ext_can_rpm);
 	extensions_add("canset-pos", ext_can_pos);
 
+	// Raw CAN-frames and UART-bytes
+	extensions_add("can-send-sid", ext_can_send_sid);
+	extensions_add("can-send-eid", ext_can_send_eid);
+	extensions_add("uart-write", ext_uart_write);
+
 	// Math
 	extensions_add("sin", ext_sin);
 	extensions_add("cos", ext_cos);
@@ -0,0 +1,328 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "buffer_extensions.h"
+#include "extensions.h"
+#include "symrepr.h"
+#include "heap.h"
+
+typedef enum {
+  BUF_I8 = 0,
+  BUF_U8,
+  BUF_I16,
+  BUF_U16,
+  BUF_I32,
+  BUF_U32,
+  BUF_F32
+} buf_type_t;
+
+static const unsigned int type_size[] = {1, 1, 2, 2, 4, 4, 4};
+
+static UINT sym_little_endian;
+static UINT sym_big_endian;
+
+bool buffer_get_data(VALUE buf, uint8_t **data, uint32_t *len) {
+  uint32_t offset = 0;
+  uint32_t view_len = 0;
+  bool is_view = false;
+
+  if (type_of(buf) == PTR_TYPE_CONS) {
+    VALUE range = cdr(buf);
+    if (type_of(range) != PTR_TYPE_CONS ||
+        type_of(car(range)) != VAL_TYPE_U ||
+        type_of(cdr(range)) != VAL_TYPE_U) {
+      return false;
+    }
+    offset = dec_u(car(range));
+    view_len = dec_u(cdr(range));
+    is_view = true;
+    buf = car(buf);
+  }
+
+  if (type_of(buf) != PTR_TYPE_ARRAY) {
+    return false;
+  }
+
+  array_header_t *array = (array_header_t*)car(buf);
+  uint32_t size = array->size;
+  if (array->elt_type != VAL_TYPE_CHAR) {
+    size *= 4;
+  }
+
+  if (is_view) {
+    if (offset > size || view_len > size - offset) {
+      return false;
+    }
+    size = view_len;
+  }
+
+  *data = (uint8_t*)array + 8 + offset;
+  *len = size;
+  return true;
+}
+
+static bool get_index(VALUE v, uint32_t *ind) {
+  if (!is_number(v) || dec_as_i(v) < 0) {
+    return false;
+  }
+  *ind = (uint32_t)dec_as_i(v);
+  return true;
+}
+
+/* Removes a trailing endianness symbol from the arguments */
+static bool get_endianness(VALUE *args, UINT *argn, bool *little_endian) {
+  *little_endian = false;
+  if (*argn > 0 && type_of(args[*argn - 1]) == VAL_TYPE_SYMBOL) {
+    UINT s = dec_sym(args[*argn - 1]);
+    if (s == sym_little_endian) {
+      *little_endian = true;
+    } else if (s != sym_big_endian) {
+      return false;
+    }
+    (*argn)--;
+  }
+  return true;
+}
+
+static void put_bytes(uint8_t *p, uint32_t v, unsigned int n, bool little_endian) {
+  for (unsigned int i = 0; i < n; i ++) {
+    unsigned int shift = little_endian ? 8 * i : 8 * (n - 1 - i);
+    p[i] = (uint8_t)(v >> shift);
+  }
+}
+
+static uint32_t get_bytes(const uint8_t *p, unsigned int n, bool little_endian) {
+  uint32_t v = 0;
+  for (unsigned int i = 0; i < n; i ++) {
+    unsigned int shift = little_endian ? 8 * i : 8 * (n - 1 - i);
+    v |= (uint32_t)p[i] << shift;
+  }
+  return v;
+}
+
+static VALUE buf_set(VALUE *args, UINT argn, buf_type_t t) {
+  bool le;
+  uint8_t *data;
+  uint32_t len;
+  uint32_t ind;
+
+  if (!get_endianness(args, &argn, &le) ||
+      argn < 3 ||
+      !buffer_get_data(args[0], &data, &len) ||
+      !get_index(args[1], &ind)) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  unsigned int n = type_size[t];
+  UINT num_values = argn - 2;
+  if (ind > len || num_values * n > len - ind) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  for (UINT i = 0; i < num_values; i ++) {
+    if (!is_number(args[i + 2])) {
+      return enc_sym(SYM_EERROR);
+    }
+  }
+
+  for (UINT i = 0; i < num_values; i ++) {
+    VALUE v = args[i + 2];
+    uint32_t raw;
+
+    if (t == BUF_F32) {
+      FLOAT f = dec_as_f(v);
+      memcpy(&raw, &f, 4);
+    } else if (t == BUF_U32) {
+      raw = dec_as_u(v);
+    } else {
+      raw = (uint32_t)dec_as_i(v);
+    }
+
+    put_bytes(data + ind + i * n, raw, n, le);
+  }
+
+  return enc_sym(SYM_TRUE);
+}
+
+static VALUE buf_get(VALUE *args, UINT argn, buf_type_t t) {
+  bool le;
+  uint8_t *data;
+  uint32_t len;
+  uint32_t ind;
+
+  if (!get_endianness(args, &argn, &le) ||
+      argn != 2 ||
+      !buffer_get_data(args[0], &data, &len) ||
+      !get_index(args[1], &ind)) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  unsigned int n = type_size[t];
+  if (ind > len || n > len - ind) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  uint32_t raw = get_bytes(data + ind, n, le);
+
+  switch (t) {
+  case BUF_I8: return enc_i((int8_t)raw);
+  case BUF_U8: return enc_i((INT)raw);
+  case BUF_I16: return enc_i((int16_t)raw);
+  case BUF_U16: return enc_i((INT)raw);
+  case BUF_I32: return enc_I((INT)raw);
+  case BUF_U32: return enc_U(raw);
+  case BUF_F32: {
+    FLOAT f;
+    memcpy(&f, &raw, 4);
+    return enc_F(f);
+  }
+  default:
+    return enc_sym(SYM_EERROR);
+  }
+}
+
+static VALUE ext_bufcreate(VALUE *args, UINT argn) {
+  uint32_t len;
+  if (argn != 1 || !get_index(args[0], &len)) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  VALUE res;
+  if (!heap_allocate_array(&res, len, VAL_TYPE_CHAR)) {
+    return enc_sym(SYM_MERROR);
+  }
+
+  memset((char*)car(res) + 8, 0, len);
+  return res;
+}
+
+static VALUE ext_buflen(VALUE *args, UINT argn) {
+  uint8_t *data;
+  uint32_t len;
+  if (argn != 1 || !buffer_get_data(args[0], &data, &len)) {
+    return enc_sym(SYM_EERROR);
+  }
+  return enc_i((INT)len);
+}
+
+static VALUE ext_bufview(VALUE *args, UINT argn) {
+  uint8_t *data;
+  uint32_t len;
+  uint32_t offset;
+  uint32_t view_len;
+
+  if (argn != 3 ||
+      !buffer_get_data(args[0], &data, &len) ||
+      !get_index(args[1], &offset) ||
+      !get_index(args[2], &view_len) ||
+      offset > len || view_len > len - offset) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  // Views of views refer to the array directly
+  VALUE array = args[0];
+  if (type_of(array) == PTR_TYPE_CONS) {
+    offset += dec_u(car(cdr(array)));
+    array = car(array);
+  }
+
+  VALUE range = cons(enc_u(offset), enc_u(view_len));
+  if (type_of(range) == VAL_TYPE_SYMBOL) {
+    return range;
+  }
+  return cons(array, range);
+}
+
+static VALUE ext_bufclear(VALUE *args, UINT argn) {
+  uint8_t *data;
+  uint32_t len;
+
+  if (argn < 1 || argn > 2 ||
+      !buffer_get_data(args[0], &data, &len) ||
+      (argn == 2 && !is_number(args[1]))) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  memset(data, argn == 2 ? (uint8_t)dec_as_i(args[1]) : 0, len);
+  return enc_sym(SYM_TRUE);
+}
+
+static VALUE ext_bufcpy(VALUE *args, UINT argn) {
+  uint8_t *dst, *src;
+  uint32_t dst_len, src_len;
+  uint32_t dst_ind, src_ind, n;
+
+  if (argn != 5 ||
+      !buffer_get_data(args[0], &dst, &dst_len) ||
+      !get_index(args[1], &dst_ind) ||
+      !buffer_get_data(args[2], &src, &src_len) ||
+      !get_index(args[3], &src_ind) ||
+      !get_index(args[4], &n) ||
+      dst_ind > dst_len || n > dst_len - dst_ind ||
+      src_ind > src_len || n > src_len - src_ind) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  memmove(dst + dst_ind, src + src_ind, n);
+  return enc_sym(SYM_TRUE);
+}
+
+#define BUF_EXTENSIONS(name, t) \
+  static VALUE ext_bufset_##name(VALUE *args, UINT argn) {return buf_set(args, argn, t);} \
+  static VALUE ext_bufget_##name(VALUE *args, UINT argn) {return buf_get(args, argn, t);}
+
+BUF_EXTENSIONS(i8, BUF_I8)
+BUF_EXTENSIONS(u8, BUF_U8)
+BUF_EXTENSIONS(i16, BUF_I16)
+BUF_EXTENSIONS(u16, BUF_U16)
+BUF_EXTENSIONS(i32, BUF_I32)
+BUF_EXTENSIONS(u32, BUF_U32)
+BUF_EXTENSIONS(f32, BUF_F32)
+
+bool buffer_extensions_init(void) {
+  if (!symrepr_addsym("little-endian", &sym_little_endian) ||
+      !symrepr_addsym("big-endian", &sym_big_endian)) {
+    return false;
+  }
+
+  bool res = true;
+  res = res && extensions_add("bufcreate", ext_bufcreate);
+  res = res && extensions_add("buflen", ext_buflen);
+  res = res && extensions_add("bufview", ext_bufview);
+  res = res && extensions_add("bufclear", ext_bufclear);
+  res = res && extensions_add("bufcpy", ext_bufcpy);
+
+  res = res && extensions_add("bufset-i8", ext_bufset_i8);
+  res = res && extensions_add("bufset-u8", ext_bufset_u8);
+  res = res && extensions_add("bufset-i16", ext_bufset_i16);
+  res = res && extensions_add("bufset-u16", ext_bufset_u16);
+  res = res && extensions_add("bufset-i32", ext_bufset_i32);
+  res = res && extensions_add("bufset-u32", ext_bufset_u32);
+  res = res && extensions_add("bufset-f32", ext_bufset_f32);
+
+  res = res && extensions_add("bufget-i8", ext_bufget_i8);
+  res = res && extensions_add("bufget-u8", ext_bufget_u8);
+  res = res && extensions_add("bufget-i16", ext_bufget_i16);
+  res = res && extensions_add("bufget-u16", ext_bufget_u16);
+  res = res && extensions_add("bufget-i32", ext_bufget_i32);
+  res = res && extensions_add("bufget-u32", ext_bufget_u32);
+  res = res && extensions_add("bufget-f32", ext_bufget_f32);
+
+  return res;
+}
@@ -24,11 +24,16 @@
 #include "compression.h"
 #include "lispbm_types.h"
 #include "tokpar.h"
+#include "compression_dict.h"
 
 #define  KEY  0
 #define  CODE 1
 
-/* The codes are generated using python script in utils directory
+/* Original fixed code table. Still decoded, and used by
+   compression_compress_legacy, but code is compressed with the trained
+   dictionary in compression_dict.h by default.
+
+   The codes are generated using python script in utils directory
    - Depends on the Huffman library (pip3 install huffman)
    - exec(open('gen_codes.py').read())
    - print(make_c())
@@ -160,67 +165,6 @@ int match_longest_code(char *string, uint32_t start_bit, uint32_t total_bits) {
   return longest_match_ix;
 }
 
-int compressed_length(char *string) {
-  uint32_t i = 0;
-
-  uint32_t n = strlen(string);
-  int comp_len = 0; // in bits
-
-  bool string_mode = false;
-  bool gobbling_whitespace = false;
-
-  while (i < n) {
-    if (string_mode) {
-      if (string[i] == '\"'  &&
-          !(string[i-1] == '\\')) {
-        string_mode = false;
-        comp_len += 8;
-        i++;
-      } else {
-        comp_len += 8;
-        i++;
-      }
-
-    } else {
-
-      // Gobble up any comments
-      if (string[i] == ';' ) {
-        while (string[i] && string[i] != '\n') {
-          i++;
-        }
-        continue;
-      }
-
-      if ( string[i] == '\n' ||
-           string[i] == ' '  ||
-           string[i] == '\t' ||
-           string[i] == '\r') {
-        gobbling_whitespace = true;
-        i ++;
-        continue;
-      } else if (gobbling_whitespace) {
-        gobbling_whitespace = false;
-        i--;
-      }
-
-      if (string[i] == '\"') string_mode = true;
-
-      int ix;
-      if (isspace(string[i])) {
-        ix = match_longest_key(" ");
-      } else {
-        ix = match_longest_key(string + i);
-      }
-
-      if (ix == -1)return -1;
-      unsigned int code_len = strlen(codes[ix][1]);
-      comp_len += (int)code_len;
-      i += strlen(codes[ix][0]);
-    }
-  }
-  return comp_len;
-}
-
 void set_bit(char *c, int bit_pos, bool set) {
   char bval = 0;
   if (bit_pos <= 7) {
@@ -264,115 +208,178 @@ void emit_key(char *dest, char *key, int nk, uint32_t *char_pos) {
   }
 }
 
-char read_character(char *src, uint32_t *bit_pos) {
+int match_longest_dict_key(char *string) {
 
-  char c = 0;
+  int longest_match_ix = -1;
+  unsigned int longest_match_length = 0;
 
-  for (int i = 0; i < 8; i ++) {
-    uint32_t byte_ix = (*bit_pos)/8;
-    uint32_t bit_ix  = (*bit_pos)%8;
-    bool s = src[byte_ix] & (1 << bit_ix);
-    set_bit(&c, i, s);
-    *bit_pos = *bit_pos + 1;
+  for (int i = 0; i < DICT_NUM_KEYS; i ++) {
+    unsigned int s_len = dict_key_lengths[i];
+    if (s_len > longest_match_length &&
+        strncmp(dict_keys[i], string, s_len) == 0) {
+      longest_match_ix = i;
+      longest_match_length = s_len;
+    }
   }
-  return c;
+  return longest_match_ix;
 }
 
-char *compression_compress(char *string, uint32_t *res_size) {
-
-  int c_size_bits_i = compressed_length(string);
-  uint32_t c_size_bits = 0;
-  if ( c_size_bits_i >= 0 ) {
-    c_size_bits = (uint32_t)compressed_length(string);
+static void emit_dict_code(char *compressed, int ix, int *bit_pos) {
+  for (unsigned int i = 0; i < dict_code_lengths[ix]; i ++) {
+    int byte_ix = (*bit_pos) / 8;
+    int bit_ix  = (*bit_pos) % 8;
+    set_bit(&compressed[byte_ix], bit_ix, dict_codes[ix] & (1 << i));
+    *bit_pos = *bit_pos + 1;
   }
+}
 
-  uint32_t c_size_bytes = 4 + (c_size_bits/8);
-  if (c_size_bits % 8 > 0) {
-    c_size_bytes += 1;
+/* Emit the longest key at string, or only count its bits if compressed
+   is NULL. Returns the number of characters consumed or -1. */
+static int emit_longest_key(char *compressed, char *string, int *bit_pos, bool legacy) {
+  int ix;
+  if (legacy) {
+    ix = match_longest_key(string);
+    if (ix == -1) return -1;
+    if (compressed) {
+      emit_code(compressed, codes[ix][CODE], bit_pos);
+    } else {
+      *bit_pos += (int)strlen(codes[ix][CODE]);
+    }
+    return (int)strlen(codes[ix][KEY]);
   }
-  
-  uint32_t header_value = c_size_bits;
 
-  if (header_value == 0) return NULL;
-
-  char *compressed = malloc(c_size_bytes);
-  if (!compressed) return NULL;
-  memset(compressed, 0, c_size_bytes);
-  *res_size = c_size_bytes;
-  int bit_pos = 0;
+  ix = match_longest_dict_key(string);
+  if (ix == -1) return -1;
+  if (compressed) {
+    emit_dict_code(compressed, ix, bit_pos);
+  } else {
+    *bit_pos += dict_code_lengths[ix];
+  }
+  return dict_key_lengths[ix];
+}
 
-  compressed[0] = (char)header_value;
-  compressed[1] = (char)(header_value >> 8);
-  compressed[2] = (char)(header_value >> 16);
-  compressed[3] = (char)(header_value >> 24);
-  bit_pos = 32;
+/* One pass over the source that either counts the compressed size in
+   bits (compressed is NULL) or writes the compressed bits after the
+   header. Comments are removed and runs of whitespace become one space. */
+static int compress_pass(char *string, char *compressed, bool legacy) {
 
   bool string_mode = false;
-  bool gobbling_whitespace = false;
+  bool pending_space = false;
   uint32_t n = strlen(string);
   uint32_t i = 0;
+  int bit_pos = 32;
 
   while (i < n) {
     if (string_mode) {
-
       if (string[i] == '\"' &&
           !(string[i-1] == '\\')) {
-        emit_string_char_code(compressed, '\"', &bit_pos);
-        i ++;
         string_mode = false;
-        continue;
-      } else {
+      }
+      if (compressed) {
         emit_string_char_code(compressed, string[i], &bit_pos);
+      } else {
+        bit_pos += 8;
+      }
+      i++;
+      continue;
+    }
+
+    // Gobble up any comments
+    if (string[i] == ';' ) {
+      while (string[i] && string[i] != '\n') {
         i++;
       }
+      continue;
+    }
 
-    } else {
+    // gobble up whitespaces
+    if ( string[i] == '\n' ||
+         string[i] == ' '  ||
+         string[i] == '\t' ||
+         string[i] == '\r') {
+      pending_space = true;
+      i ++;
+      continue;
+    }
 
-      // Gobble up any comments
-      if (string[i] == ';' ) {
-        while (string[i] && string[i] != '\n') {
-          i++;
-        }
-        continue;
+    if (pending_space) {
+      pending_space = false;
+      if (emit_longest_key(compressed, " ", &bit_pos, legacy) < 0) {
+        return -1;
       }
+    }
 
-      // gobble up whitespaces
-      if ( string[i] == '\n' ||
-           string[i] == ' '  ||
-           string[i] == '\t' ||
-           string[i] == '\r') {
-        gobbling_whitespace = true;
-        *(string + i) = ' ';
-        i ++;
-        continue;
-      } else if (gobbling_whitespace) {
-        gobbling_whitespace = false;
-        i--;
-      }
+    /* Compress string-starting " character */
+    if (string[i] == '\"') {
+      string_mode = true;
+    }
 
-      /* Compress string-starting " character */
-      if (string[i] == '\"') {
-        string_mode = true;
-      }
-      int ix = match_longest_key(&string[i]);
+    int n_key = emit_longest_key(compressed, &string[i], &bit_pos, legacy);
+    if (n_key < 0) {
+      return -1;
+    }
+    i += (uint32_t)n_key;
+  }
 
-      if (ix == -1) {
-        free(compressed);
-        return NULL;
-      }
+  return bit_pos - 32;
+}
 
-      emit_code(compressed, codes[ix][CODE], &bit_pos);
+static char *compress(char *string, uint32_t *res_size, bool legacy) {
 
-      i += strlen(codes[ix][0]);
-    }
+  int c_size_bits_i = compress_pass(string, NULL, legacy);
+  if (c_size_bits_i <= 0) return NULL;
+
+  uint32_t c_size_bits = (uint32_t)c_size_bits_i;
+  uint32_t c_size_bytes = 4 + (c_size_bits/8);
+  if (c_size_bits % 8 > 0) {
+    c_size_bytes += 1;
+  }
+
+  uint32_t header_value = c_size_bits;
+  if (!legacy) {
+    header_value |= COMPRESSION_DICT_FLAG;
+  }
+
+  char *compressed = malloc(c_size_bytes);
+  if (!compressed) return NULL;
+  memset(compressed, 0, c_size_bytes);
+  *res_size = c_size_bytes;
+
+  compressed[0] = (char)header_value;
+  compressed[1] = (char)(header_value >> 8);
+  compressed[2] = (char)(header_value >> 16);
+  compressed[3] = (char)(header_value >> 24);
+
+  if (compress_pass(string, compressed, legacy) != c_size_bits_i) {
+    free(compressed);
+    return NULL;
   }
 
   return compressed;
 }
 
+char *compression_compress(char *string, uint32_t *res_size) {
+  return compress(string, res_size, false);
+}
+
+char *compression_compress_legacy(char *string, uint32_t *res_size) {
+  return compress(string, res_size, true);
+}
+
+/* Up to 17 bits starting at bit_pos, without reading past end_bit */
+static inline uint32_t read_bits(const char *src, uint32_t bit_pos, uint32_t end_bit) {
+  const uint8_t *p = (const uint8_t*)src + (bit_pos >> 3);
+  uint32_t avail = ((end_bit + 7) >> 3) - (bit_pos >> 3);
+  uint32_t w = p[0];
+  if (avail > 1) w |= (uint32_t)p[1] << 8;
+  if (avail > 2) w |= (uint32_t)p[2] << 16;
+  return w >> (bit_pos & 7);
+}
 
 void compression_init_state(decomp_state *s, char *src) {
   memcpy(&s->compressed_bits, src, 4);
+  s->dict = (s->compressed_bits & COMPRESSION_DICT_FLAG) != 0;
+  s->compressed_bits &= ~COMPRESSION_DICT_FLAG;
   s->i = 32;
   s->string_mode = false;
   s->last_string_char = 0;
@@ -381,12 +388,16 @@ void compression_init_state(decomp_state *s, char *src) {
 
 int compression_decompress_incremental(decomp_state *s, char *dest_buff, uint32_t dest_n) {
 
-  memset(dest_buff, 0, dest_n);
   uint32_t char_pos = 0;
+  uint32_t end_bit = s->compressed_bits + 32;
 
-  if (s->i < s->compressed_bits + 32) {
+  if (s->i < end_bit) {
      if (s->string_mode) {
-      char c = read_character(s->src, &s->i);
+      if (s->i + 8 > end_bit) {
+        return -1;
+      }
+      char c = (char)read_bits(s->src, s->i, end_bit);
+      s->i += 8;
       if (c == '\"') {
         if (s->last_string_char != '\\') {
           s->string_mode = false;
@@ -398,6 +409,28 @@ int compression_decompress_incremental(decomp_state *s, char *dest_buff, uint32_
       return 1;
     }
 
+    if (s->dict) {
+      uint32_t e = dict_decode[read_bits(s->src, s->i, end_bit) &
+                               ((1 << DICT_MAX_CODE_LENGTH) - 1)];
+      uint32_t code_len = e >> 8;
+      uint32_t ix = e & 0xFF;
+
+      if (code_len == 0 ||
+          s->i + code_len > end_bit ||
+          dict_key_lengths[ix] > dest_n) {
+        return -1;
+      }
+
+      if (ix == DICT_KEY_STRING) {
+        s->string_mode = true;
+        s->last_string_char = 0;
+      }
+
+      memcpy(dest_buff, dict_keys[ix], dict_key_lengths[ix]);
+      s->i += code_len;
+      return dict_key_lengths[ix];
+    }
+
     int ix = match_longest_code(s->src, s->i, (s->compressed_bits + 32));
     if (ix == -1) {
       return -1;
@@ -447,14 +480,6 @@ bool compression_decompress(char *dest, uint32_t dest_n, char *src) {
 
 /* Implementation of the parsing interface */
 
-#define DECOMP_BUFF_SIZE 32
-typedef struct {
-  decomp_state ds;
-  char decomp_buff[DECOMP_BUFF_SIZE];
-  int  decomp_bytes;
-  int  buff_pos;
-} tokenizer_compressed_state;
-
 bool more_compressed(tokenizer_char_stream str) {
   tokenizer_compressed_state *s = (tokenizer_compressed_state*)str.state;
   bool more =
@@ -487,6 +512,11 @@ char get_compressed(tokenizer_char_stream str) {
 char peek_compressed(tokenizer_char_stream str, unsigned int n) {
   tokenizer_compressed_state *s = (tokenizer_compressed_state*)str.state;
 
+  // Most peeks are within the characters that are already decompressed
+  if (s->buff_pos + (int)n < s->decomp_bytes) {
+    return s->decomp_buff[s->buff_pos + (int)n];
+  }
+
   tokenizer_compressed_state old;
 
   memcpy(&old, s, sizeof(tokenizer_compressed_state));
@@ -508,22 +538,28 @@ void drop_compressed(tokenizer_char_stream str, unsigned int n) {
 }
 
 
-VALUE compression_parse(char *bytes) {
+void compression_create_char_stream(tokenizer_compressed_state *ts,
+                                    tokenizer_char_stream *str,
+                                    char *bytes) {
+  ts->decomp_bytes = 0;
+  memset(ts->decomp_buff, 0, DECOMP_BUFF_SIZE);
+  ts->buff_pos = 0;
 
-  tokenizer_compressed_state ts;
+  compression_init_state(&ts->ds, bytes);
 
-  ts.decomp_bytes = 0;
-  memset(ts.decomp_buff, 0, 32);
-  ts.buff_pos = 0;
+  str->state = ts;
+  str->more = more_compressed;
+  str->get = get_compressed;
+  str->peek = peek_compressed;
+  str->drop = drop_compressed;
+}
 
-  compression_init_state(&ts.ds, bytes);
+VALUE compression_parse(char *bytes) {
 
+  tokenizer_compressed_state ts;
   tokenizer_char_stream str;
-  str.state = &ts;
-  str.more = more_compressed;
-  str.get = get_compressed;
-  str.peek = peek_compressed;
-  str.drop = drop_compressed;
+
+  compression_create_char_stream(&ts, &str, bytes);
 
   return tokpar_parse_program(str);
 }
@@ -0,0 +1,179 @@
+/*
+   Generated by lispBM/tools/lbm_dict from 8 files (4519 bytes).
+   Do not edit, train a new dictionary instead.
+*/
+
+#ifndef COMPRESSION_DICT_H_
+#define COMPRESSION_DICT_H_
+
+#define DICT_NUM_KEYS 112
+#define DICT_MAX_KEY_LENGTH 12
+#define DICT_MAX_CODE_LENGTH 10
+#define DICT_KEY_STRING 42
+
+static const char * const dict_keys[DICT_NUM_KEYS] = {
+  "a", "b", "c", "d", "e", "f",
+  "g", "h", "i", "j", "k", "l",
+  "m", "n", "o", "p", "q", "r",
+  "s", "t", "u", "v", "w", "x",
+  "y", "z", "0", "1", "2", "3",
+  "4", "5", "6", "7", "8", "9",
+  "_", ",", "`", " ", "'", "\\",
+  "\"", "#", ".", ">", "<", "=",
+  "/", "*", "-", "+", "?", "(",
+  ")", ",@", "(define", "define", "(lambda", "lambda",
+  "))", "))))", ")))", ")))))", "))))))", "nil",
+  "xs", "(if", "(car", "(cdr", "(progn", "(cons",
+  "(yield", "progn", "car", "cdr", "(f", "50",
+  "(iacc", "(let", "acc", "cons", "itcnt", "yield",
+  "(get-encoder", "if", "foldl", "get-encoder", "(set-servo", "iacc",
+  "(set-duty", "let", "set-servo", "(foldl", "(map", "rate",
+  "(-", "map", "set-duty", "(acc", "1000000", "iota",
+  "(+", "(=", "((", "(/", "(<", "(>",
+  "20000", "(*", "(n", "(x",
+};
+
+static const uint8_t dict_key_lengths[DICT_NUM_KEYS] = {
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 2, 7, 6, 7, 6, 2, 4, 3, 5,
+  6, 3, 2, 3, 4, 4, 6, 5, 6, 5, 3, 3, 2, 2, 5, 4,
+  3, 4, 5, 5, 12, 2, 5, 11, 10, 4, 9, 3, 9, 6, 4, 4,
+  2, 3, 8, 4, 7, 4, 2, 2, 2, 2, 2, 2, 5, 2, 2, 2,
+};
+
+/* Codes in the order they are written to the stream, LSB first */
+static const uint16_t dict_codes[DICT_NUM_KEYS] = {
+  0x001, 0x05B, 0x013, 0x053, 0x00A, 0x033, 0x073, 0x0CF, 0x021, 0x2CF,
+  0x1CF, 0x011, 0x031, 0x009, 0x029, 0x019, 0x3CF, 0x01A, 0x039, 0x006,
+  0x005, 0x025, 0x02F, 0x0DB, 0x03B, 0x22F, 0x002, 0x015, 0x0BB, 0x07B,
+  0x0FB, 0x12F, 0x32F, 0x0AF, 0x2AF, 0x1AF, 0x3AF, 0x06F, 0x26F, 0x000,
+  0x16F, 0x36F, 0x007, 0x0EF, 0x035, 0x2EF, 0x1EF, 0x3EF, 0x01F, 0x21F,
+  0x00D, 0x11F, 0x31F, 0x02D, 0x016, 0x09F, 0x00E, 0x29F, 0x01D, 0x19F,
+  0x01E, 0x087, 0x047, 0x39F, 0x0C7, 0x03D, 0x003, 0x00B, 0x04B, 0x02B,
+  0x027, 0x0A7, 0x067, 0x05F, 0x25F, 0x15F, 0x06B, 0x023, 0x35F, 0x0E7,
+  0x017, 0x0DF, 0x097, 0x2DF, 0x1DF, 0x3DF, 0x03F, 0x23F, 0x13F, 0x33F,
+  0x0BF, 0x2BF, 0x1BF, 0x3BF, 0x07F, 0x27F, 0x01B, 0x17F, 0x37F, 0x0FF,
+  0x2FF, 0x1FF, 0x057, 0x0D7, 0x037, 0x0B7, 0x077, 0x0F7, 0x3FF, 0x00F,
+  0x08F, 0x04F,
+};
+
+static const uint8_t dict_code_lengths[DICT_NUM_KEYS] = {
+  6, 8, 7, 7, 5, 7, 7, 10, 6, 10, 10, 6, 6, 6, 6, 6,
+  10, 5, 6, 5, 6, 6, 10, 8, 8, 10, 4, 6, 8, 8, 8, 10,
+  10, 10, 10, 10, 10, 10, 10, 2, 10, 10, 8, 10, 6, 10, 10, 10,
+  10, 10, 6, 10, 10, 6, 5, 10, 5, 10, 6, 10, 5, 8, 8, 10,
+  8, 6, 6, 7, 7, 7, 8, 8, 8, 10, 10, 10, 7, 6, 10, 8,
+  8, 10, 8, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+  7, 10, 10, 10, 10, 10, 8, 8, 8, 8, 8, 8, 10, 8, 8, 8,
+};
+
+/* Next DICT_MAX_CODE_LENGTH bits of the stream -> (code length << 8) | key */
+static const uint16_t dict_decode[1 << DICT_MAX_CODE_LENGTH] = {
+  0x227, 0x600, 0x41A, 0x642, 0x227, 0x614, 0x513, 0x82A, 0x227, 0x60D,
+  0x504, 0x743, 0x227, 0x632, 0x538, 0x86D, 0x227, 0x60B, 0x41A, 0x702,
+  0x227, 0x61B, 0x536, 0x850, 0x227, 0x60F, 0x511, 0x760, 0x227, 0x63A,
+  0x53C, 0xA30, 0x227, 0x608, 0x41A, 0x64D, 0x227, 0x615, 0x513, 0x846,
+  0x227, 0x60E, 0x504, 0x745, 0x227, 0x635, 0x538, 0xA16, 0x227, 0x60C,
+  0x41A, 0x705, 0x227, 0x62C, 0x536, 0x868, 0x227, 0x612, 0x511, 0x818,
+  0x227, 0x641, 0x53C, 0xA56, 0x227, 0x600, 0x41A, 0x642, 0x227, 0x614,
+  0x513, 0x83E, 0x227, 0x60D, 0x504, 0x744, 0x227, 0x632, 0x538, 0x86F,
+  0x227, 0x60B, 0x41A, 0x703, 0x227, 0x61B, 0x536, 0x866, 0x227, 0x60F,
+  0x511, 0x801, 0x227, 0x63A, 0x53C, 0xA49, 0x227, 0x608, 0x41A, 0x64D,
+  0x227, 0x615, 0x513, 0x848, 0x227, 0x60E, 0x504, 0x74C, 0x227, 0x635,
+  0x538, 0xA25, 0x227, 0x60C, 0x41A, 0x706, 0x227, 0x62C, 0x536, 0x86A,
+  0x227, 0x612, 0x511, 0x81D, 0x227, 0x641, 0x53C, 0xA5E, 0x227, 0x600,
+  0x41A, 0x642, 0x227, 0x614, 0x513, 0x83D, 0x227, 0x60D, 0x504, 0x743,
+  0x227, 0x632, 0x538, 0x86E, 0x227, 0x60B, 0x41A, 0x702, 0x227, 0x61B,
+  0x536, 0x852, 0x227, 0x60F, 0x511, 0x760, 0x227, 0x63A, 0x53C, 0xA37,
+  0x227, 0x608, 0x41A, 0x64D, 0x227, 0x615, 0x513, 0x847, 0x227, 0x60E,
+  0x504, 0x745, 0x227, 0x635, 0x538, 0xA21, 0x227, 0x60C, 0x41A, 0x705,
+  0x227, 0x62C, 0x536, 0x869, 0x227, 0x612, 0x511, 0x81C, 0x227, 0x641,
+  0x53C, 0xA5A, 0x227, 0x600, 0x41A, 0x642, 0x227, 0x614, 0x513, 0x840,
+  0x227, 0x60D, 0x504, 0x744, 0x227, 0x632, 0x538, 0xA07, 0x227, 0x60B,
+  0x41A, 0x703, 0x227, 0x61B, 0x536, 0x867, 0x227, 0x60F, 0x511, 0x817,
+  0x227, 0x63A, 0x53C, 0xA51, 0x227, 0x608, 0x41A, 0x64D, 0x227, 0x615,
+  0x513, 0x84F, 0x227, 0x60E, 0x504, 0x74C, 0x227, 0x635, 0x538, 0xA2B,
+  0x227, 0x60C, 0x41A, 0x706, 0x227, 0x62C, 0x536, 0x86B, 0x227, 0x612,
+  0x511, 0x81E, 0x227, 0x641, 0x53C, 0xA63, 0x227, 0x600, 0x41A, 0x642,
+  0x227, 0x614, 0x513, 0x82A, 0x227, 0x60D, 0x504, 0x743, 0x227, 0x632,
+  0x538, 0x86D, 0x227, 0x60B, 0x41A, 0x702, 0x227, 0x61B, 0x536, 0x850,
+  0x227, 0x60F, 0x511, 0x760, 0x227, 0x63A, 0x53C, 0xA33, 0x227, 0x608,
+  0x41A, 0x64D, 0x227, 0x615, 0x513, 0x846, 0x227, 0x60E, 0x504, 0x745,
+  0x227, 0x635, 0x538, 0xA1F, 0x227, 0x60C, 0x41A, 0x705, 0x227, 0x62C,
+  0x536, 0x868, 0x227, 0x612, 0x511, 0x818, 0x227, 0x641, 0x53C, 0xA58,
+  0x227, 0x600, 0x41A, 0x642, 0x227, 0x614, 0x513, 0x83E, 0x227, 0x60D,
+  0x504, 0x744, 0x227, 0x632, 0x538, 0x86F, 0x227, 0x60B, 0x41A, 0x703,
+  0x227, 0x61B, 0x536, 0x866, 0x227, 0x60F, 0x511, 0x801, 0x227, 0x63A,
+  0x53C, 0xA4B, 0x227, 0x608, 0x41A, 0x64D, 0x227, 0x615, 0x513, 0x848,
+  0x227, 0x60E, 0x504, 0x74C, 0x227, 0x635, 0x538, 0xA28, 0x227, 0x60C,
+  0x41A, 0x706, 0x227, 0x62C, 0x536, 0x86A, 0x227, 0x612, 0x511, 0x81D,
+  0x227, 0x641, 0x53C, 0xA61, 0x227, 0x600, 0x41A, 0x642, 0x227, 0x614,
+  0x513, 0x83D, 0x227, 0x60D, 0x504, 0x743, 0x227, 0x632, 0x538, 0x86E,
+  0x227, 0x60B, 0x41A, 0x702, 0x227, 0x61B, 0x536, 0x852, 0x227, 0x60F,
+  0x511, 0x760, 0x227, 0x63A, 0x53C, 0xA3B, 0x227, 0x608, 0x41A, 0x64D,
+  0x227, 0x615, 0x513, 0x847, 0x227, 0x60E, 0x504, 0x745, 0x227, 0x635,
+  0x538, 0xA23, 0x227, 0x60C, 0x41A, 0x705, 0x227, 0x62C, 0x536, 0x869,
+  0x227, 0x612, 0x511, 0x81C, 0x227, 0x641, 0x53C, 0xA5C, 0x227, 0x600,
+  0x41A, 0x642, 0x227, 0x614, 0x513, 0x840, 0x227, 0x60D, 0x504, 0x744,
+  0x227, 0x632, 0x538, 0xA0A, 0x227, 0x60B, 0x41A, 0x703, 0x227, 0x61B,
+  0x536, 0x867, 0x227, 0x60F, 0x511, 0x817, 0x227, 0x63A, 0x53C, 0xA54,
+  0x227, 0x608, 0x41A, 0x64D, 0x227, 0x615, 0x513, 0x84F, 0x227, 0x60E,
+  0x504, 0x74C, 0x227, 0x635, 0x538, 0xA2E, 0x227, 0x60C, 0x41A, 0x706,
+  0x227, 0x62C, 0x536, 0x86B, 0x227, 0x612, 0x511, 0x81E, 0x227, 0x641,
+  0x53C, 0xA65, 0x227, 0x600, 0x41A, 0x642, 0x227, 0x614, 0x513, 0x82A,
+  0x227, 0x60D, 0x504, 0x743, 0x227, 0x632, 0x538, 0x86D, 0x227, 0x60B,
+  0x41A, 0x702, 0x227, 0x61B, 0x536, 0x850, 0x227, 0x60F, 0x511, 0x760,
+  0x227, 0x63A, 0x53C, 0xA31, 0x227, 0x608, 0x41A, 0x64D, 0x227, 0x615,
+  0x513, 0x846, 0x227, 0x60E, 0x504, 0x745, 0x227, 0x635, 0x538, 0xA19,
+  0x227, 0x60C, 0x41A, 0x705, 0x227, 0x62C, 0x536, 0x868, 0x227, 0x612,
+  0x511, 0x818, 0x227, 0x641, 0x53C, 0xA57, 0x227, 0x600, 0x41A, 0x642,
+  0x227, 0x614, 0x513, 0x83E, 0x227, 0x60D, 0x504, 0x744, 0x227, 0x632,
+  0x538, 0x86F, 0x227, 0x60B, 0x41A, 0x703, 0x227, 0x61B, 0x536, 0x866,
+  0x227, 0x60F, 0x511, 0x801, 0x227, 0x63A, 0x53C, 0xA4A, 0x227, 0x608,
+  0x41A, 0x64D, 0x227, 0x615, 0x513, 0x848, 0x227, 0x60E, 0x504, 0x74C,
+  0x227, 0x635, 0x538, 0xA26, 0x227, 0x60C, 0x41A, 0x706, 0x227, 0x62C,
+  0x536, 0x86A, 0x227, 0x612, 0x511, 0x81D, 0x227, 0x641, 0x53C, 0xA5F,
+  0x227, 0x600, 0x41A, 0x642, 0x227, 0x614, 0x513, 0x83D, 0x227, 0x60D,
+  0x504, 0x743, 0x227, 0x632, 0x538, 0x86E, 0x227, 0x60B, 0x41A, 0x702,
+  0x227, 0x61B, 0x536, 0x852, 0x227, 0x60F, 0x511, 0x760, 0x227, 0x63A,
+  0x53C, 0xA39, 0x227, 0x608, 0x41A, 0x64D, 0x227, 0x615, 0x513, 0x847,
+  0x227, 0x60E, 0x504, 0x745, 0x227, 0x635, 0x538, 0xA22, 0x227, 0x60C,
+  0x41A, 0x705, 0x227, 0x62C, 0x536, 0x869, 0x227, 0x612, 0x511, 0x81C,
+  0x227, 0x641, 0x53C, 0xA5B, 0x227, 0x600, 0x41A, 0x642, 0x227, 0x614,
+  0x513, 0x840, 0x227, 0x60D, 0x504, 0x744, 0x227, 0x632, 0x538, 0xA09,
+  0x227, 0x60B, 0x41A, 0x703, 0x227, 0x61B, 0x536, 0x867, 0x227, 0x60F,
+  0x511, 0x817, 0x227, 0x63A, 0x53C, 0xA53, 0x227, 0x608, 0x41A, 0x64D,
+  0x227, 0x615, 0x513, 0x84F, 0x227, 0x60E, 0x504, 0x74C, 0x227, 0x635,
+  0x538, 0xA2D, 0x227, 0x60C, 0x41A, 0x706, 0x227, 0x62C, 0x536, 0x86B,
+  0x227, 0x612, 0x511, 0x81E, 0x227, 0x641, 0x53C, 0xA64, 0x227, 0x600,
+  0x41A, 0x642, 0x227, 0x614, 0x513, 0x82A, 0x227, 0x60D, 0x504, 0x743,
+  0x227, 0x632, 0x538, 0x86D, 0x227, 0x60B, 0x41A, 0x702, 0x227, 0x61B,
+  0x536, 0x850, 0x227, 0x60F, 0x511, 0x760, 0x227, 0x63A, 0x53C, 0xA34,
+  0x227, 0x608, 0x41A, 0x64D, 0x227, 0x615, 0x513, 0x846, 0x227, 0x60E,
+  0x504, 0x745, 0x227, 0x635, 0x538, 0xA20, 0x227, 0x60C, 0x41A, 0x705,
+  0x227, 0x62C, 0x536, 0x868, 0x227, 0x612, 0x511, 0x818, 0x227, 0x641,
+  0x53C, 0xA59, 0x227, 0x600, 0x41A, 0x642, 0x227, 0x614, 0x513, 0x83E,
+  0x227, 0x60D, 0x504, 0x744, 0x227, 0x632, 0x538, 0x86F, 0x227, 0x60B,
+  0x41A, 0x703, 0x227, 0x61B, 0x536, 0x866, 0x227, 0x60F, 0x511, 0x801,
+  0x227, 0x63A, 0x53C, 0xA4E, 0x227, 0x608, 0x41A, 0x64D, 0x227, 0x615,
+  0x513, 0x848, 0x227, 0x60E, 0x504, 0x74C, 0x227, 0x635, 0x538, 0xA29,
+  0x227, 0x60C, 0x41A, 0x706, 0x227, 0x62C, 0x536, 0x86A, 0x227, 0x612,
+  0x511, 0x81D, 0x227, 0x641, 0x53C, 0xA62, 0x227, 0x600, 0x41A, 0x642,
+  0x227, 0x614, 0x513, 0x83D, 0x227, 0x60D, 0x504, 0x743, 0x227, 0x632,
+  0x538, 0x86E, 0x227, 0x60B, 0x41A, 0x702, 0x227, 0x61B, 0x536, 0x852,
+  0x227, 0x60F, 0x511, 0x760, 0x227, 0x63A, 0x53C, 0xA3F, 0x227, 0x608,
+  0x41A, 0x64D, 0x227, 0x615, 0x513, 0x847, 0x227, 0x60E, 0x504, 0x745,
+  0x227, 0x635, 0x538, 0xA24, 0x227, 0x60C, 0x41A, 0x705, 0x227, 0x62C,
+  0x536, 0x869, 0x227, 0x612, 0x511, 0x81C, 0x227, 0x641, 0x53C, 0xA5D,
+  0x227, 0x600, 0x41A, 0x642, 0x227, 0x614, 0x513, 0x840, 0x227, 0x60D,
+  0x504, 0x744, 0x227, 0x632, 0x538, 0xA10, 0x227, 0x60B, 0x41A, 0x703,
+  0x227, 0x61B, 0x536, 0x867, 0x227, 0x60F, 0x511, 0x817, 0x227, 0x63A,
+  0x53C, 0xA55, 0x227, 0x608, 0x41A, 0x64D, 0x227, 0x615, 0x513, 0x84F,
+  0x227, 0x60E, 0x504, 0x74C, 0x227, 0x635, 0x538, 0xA2F, 0x227, 0x60C,
+  0x41A, 0x706, 0x227, 0x62C, 0x536, 0x86B, 0x227, 0x612, 0x511, 0x81E,
+  0x227, 0x641, 0x53C, 0xA6C,
+};
+
+#endif
@@ -0,0 +1,453 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <float.h>
+
+#include "dsp_extensions.h"
+#include "extensions.h"
+#include "symrepr.h"
+#include "heap.h"
+
+/* PID state, stored in a float array */
+typedef enum {
+  PID_KP = 0,
+  PID_KI,
+  PID_KD,
+  PID_MIN,
+  PID_MAX,
+  PID_INTEGRAL,
+  PID_PREV,
+  PID_STARTED,
+  PID_SIZE
+} pid_field_t;
+
+static bool get_farray(VALUE v, FLOAT **data, uint32_t *len) {
+  if (type_of(v) != PTR_TYPE_ARRAY) {
+    return false;
+  }
+
+  array_header_t *array = (array_header_t*)car(v);
+  if (array->elt_type != PTR_TYPE_BOXED_F) {
+    return false;
+  }
+
+  *data = (FLOAT*)((UINT*)array + 2);
+  *len = array->size;
+  return true;
+}
+
+static VALUE new_farray(uint32_t len, FLOAT **data) {
+  VALUE res;
+  if (!heap_allocate_array(&res, len, PTR_TYPE_BOXED_F)) {
+    return enc_sym(SYM_MERROR);
+  }
+  *data = (FLOAT*)((UINT*)car(res) + 2);
+  return res;
+}
+
+static bool all_numbers(VALUE *args, UINT argn) {
+  for (UINT i = 0; i < argn; i ++) {
+    if (!is_number(args[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static VALUE ext_farray(VALUE *args, UINT argn) {
+  if (argn < 1 || argn > 2 || !all_numbers(args, argn) || dec_as_i(args[0]) < 0) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  FLOAT *data;
+  uint32_t len = (uint32_t)dec_as_i(args[0]);
+  VALUE res = new_farray(len, &data);
+  if (type_of(res) == VAL_TYPE_SYMBOL) {
+    return res;
+  }
+
+  FLOAT v = argn == 2 ? dec_as_f(args[1]) : 0.0f;
+  for (uint32_t i = 0; i < len; i ++) {
+    data[i] = v;
+  }
+  return res;
+}
+
+static VALUE ext_farray_from_list(VALUE *args, UINT argn) {
+  if (argn != 1) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  uint32_t len = 0;
+  VALUE curr = args[0];
+  while (type_of(curr) == PTR_TYPE_CONS) {
+    if (!is_number(car(curr))) {
+      return enc_sym(SYM_EERROR);
+    }
+    len ++;
+    curr = cdr(curr);
+  }
+
+  FLOAT *data;
+  VALUE res = new_farray(len, &data);
+  if (type_of(res) == VAL_TYPE_SYMBOL) {
+    return res;
+  }
+
+  curr = args[0];
+  for (uint32_t i = 0; i < len; i ++) {
+    data[i] = dec_as_f(car(curr));
+    curr = cdr(curr);
+  }
+  return res;
+}
+
+static VALUE ext_farray_to_list(VALUE *args, UINT argn) {
+  FLOAT *data;
+  uint32_t len;
+  if (argn != 1 || !get_farray(args[0], &data, &len)) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  // The list is built from the end
+  VALUE res = enc_sym(SYM_NIL);
+  for (uint32_t i = len; i > 0; i --) {
+    VALUE f = enc_F(data[i - 1]);
+    if (type_of(f) == VAL_TYPE_SYMBOL) {
+      return f;
+    }
+    res = cons(f, res);
+    if (type_of(res) == VAL_TYPE_SYMBOL) {
+      return res;
+    }
+  }
+  return res;
+}
+
+static VALUE ext_dsp_sum(VALUE *args, UINT argn) {
+  FLOAT *data;
+  uint32_t len;
+  if (argn != 1 || !get_farray(args[0], &data, &len)) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  FLOAT sum = 0.0f;
+  for (uint32_t i = 0; i < len; i ++) {
+    sum += data[i];
+  }
+  return enc_F(sum);
+}
+
+static VALUE ext_dsp_mean(VALUE *args, UINT argn) {
+  FLOAT *data;
+  uint32_t len;
+  if (argn != 1 || !get_farray(args[0], &data, &len) || len == 0) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  FLOAT sum = 0.0f;
+  for (uint32_t i = 0; i < len; i ++) {
+    sum += data[i];
+  }
+  return enc_F(sum / (FLOAT)len);
+}
+
+static VALUE min_max(VALUE *args, UINT argn, bool max) {
+  FLOAT *data;
+  uint32_t len;
+  if (argn != 1 || !get_farray(args[0], &data, &len) || len == 0) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  FLOAT res = data[0];
+  for (uint32_t i = 1; i < len; i ++) {
+    if (max ? data[i] > res : data[i] < res) {
+      res = data[i];
+    }
+  }
+  return enc_F(res);
+}
+
+static VALUE ext_dsp_min(VALUE *args, UINT argn) {
+  return min_max(args, argn, false);
+}
+
+static VALUE ext_dsp_max(VALUE *args, UINT argn) {
+  return min_max(args, argn, true);
+}
+
+static VALUE ext_dsp_dot(VALUE *args, UINT argn) {
+  FLOAT *a, *b;
+  uint32_t len_a, len_b;
+  if (argn != 2 ||
+      !get_farray(args[0], &a, &len_a) ||
+      !get_farray(args[1], &b, &len_b) ||
+      len_a != len_b) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  FLOAT sum = 0.0f;
+  for (uint32_t i = 0; i < len_a; i ++) {
+    sum += a[i] * b[i];
+  }
+  return enc_F(sum);
+}
+
+static VALUE ext_dsp_scale(VALUE *args, UINT argn) {
+  FLOAT *data;
+  uint32_t len;
+  if (argn < 2 || argn > 3 ||
+      !get_farray(args[0], &data, &len) ||
+      !all_numbers(args + 1, argn - 1)) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  FLOAT k = dec_as_f(args[1]);
+  FLOAT offset = argn == 3 ? dec_as_f(args[2]) : 0.0f;
+  for (uint32_t i = 0; i < len; i ++) {
+    data[i] = data[i] * k + offset;
+  }
+  return enc_sym(SYM_TRUE);
+}
+
+/* The input and output of a filter, where out defaults to in */
+static bool get_in_out(VALUE *args, UINT argn, FLOAT **in, FLOAT **out, uint32_t *len) {
+  uint32_t out_len;
+  if (!get_farray(args[0], in, len)) {
+    return false;
+  }
+  if (argn == 1) {
+    *out = *in;
+    return true;
+  }
+  return get_farray(args[1], out, &out_len) && out_len == *len;
+}
+
+static VALUE ext_dsp_biquad(VALUE *args, UINT argn) {
+  FLOAT *coeffs, *state, *in, *out;
+  uint32_t coeffs_len, state_len, len;
+  if (argn < 3 || argn > 4 ||
+      !get_farray(args[0], &coeffs, &coeffs_len) ||
+      !get_farray(args[1], &state, &state_len) ||
+      !get_in_out(args + 2, argn - 2, &in, &out, &len) ||
+      coeffs_len == 0 || coeffs_len % 5 != 0 ||
+      state_len != (coeffs_len / 5) * 2) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  // Transposed direct form II, one stage at a time over the whole block
+  uint32_t stages = coeffs_len / 5;
+  for (uint32_t s = 0; s < stages; s ++) {
+    const FLOAT *c = coeffs + 5 * s;
+    FLOAT z1 = state[2 * s];
+    FLOAT z2 = state[2 * s + 1];
+    const FLOAT *src = s == 0 ? in : out;
+
+    for (uint32_t i = 0; i < len; i ++) {
+      FLOAT x = src[i];
+      FLOAT y = c[0] * x + z1;
+      z1 = c[1] * x - c[3] * y + z2;
+      z2 = c[2] * x - c[4] * y;
+      out[i] = y;
+    }
+
+    state[2 * s] = z1;
+    state[2 * s + 1] = z2;
+  }
+
+  return enc_sym(SYM_TRUE);
+}
+
+static VALUE ext_dsp_fir(VALUE *args, UINT argn) {
+  FLOAT *taps, *state, *in, *out;
+  uint32_t taps_len, state_len, len;
+  if (argn < 3 || argn > 4 ||
+      !get_farray(args[0], &taps, &taps_len) ||
+      !get_farray(args[1], &state, &state_len) ||
+      !get_in_out(args + 2, argn - 2, &in, &out, &len) ||
+      taps_len == 0 || state_len != taps_len) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  // The state is a delay line with the newest sample first
+  for (uint32_t i = 0; i < len; i ++) {
+    memmove(state + 1, state, (taps_len - 1) * sizeof(FLOAT));
+    state[0] = in[i];
+
+    FLOAT y = 0.0f;
+    for (uint32_t j = 0; j < taps_len; j ++) {
+      y += taps[j] * state[j];
+    }
+    out[i] = y;
+  }
+
+  return enc_sym(SYM_TRUE);
+}
+
+static FLOAT interpolate(const FLOAT *xs, const FLOAT *ys, uint32_t len, FLOAT x) {
+  if (x <= xs[0]) {
+    return ys[0];
+  }
+  if (x >= xs[len - 1]) {
+    return ys[len - 1];
+  }
+
+  // Binary search for the segment xs[lo] <= x < xs[lo + 1]
+  uint32_t lo = 0;
+  uint32_t hi = len - 1;
+  while (hi - lo > 1) {
+    uint32_t mid = (lo + hi) / 2;
+    if (xs[mid] <= x) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  FLOAT dx = xs[hi] - xs[lo];
+  if (dx <= 0.0f) {
+    return ys[lo];
+  }
+  return ys[lo] + (ys[hi] - ys[lo]) * (x - xs[lo]) / dx;
+}
+
+static VALUE ext_dsp_interp(VALUE *args, UINT argn) {
+  FLOAT *xs, *ys;
+  uint32_t xs_len, ys_len;
+  if (argn < 3 || argn > 4 ||
+      !get_farray(args[0], &xs, &xs_len) ||
+      !get_farray(args[1], &ys, &ys_len) ||
+      xs_len == 0 || xs_len != ys_len) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  if (argn == 3) {
+    if (!is_number(args[2])) {
+      return enc_sym(SYM_EERROR);
+    }
+    return enc_F(interpolate(xs, ys, xs_len, dec_as_f(args[2])));
+  }
+
+  FLOAT *in, *out;
+  uint32_t len;
+  if (!get_in_out(args + 2, 2, &in, &out, &len)) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  for (uint32_t i = 0; i < len; i ++) {
+    out[i] = interpolate(xs, ys, xs_len, in[i]);
+  }
+  return enc_sym(SYM_TRUE);
+}
+
+static VALUE ext_pid_create(VALUE *args, UINT argn) {
+  if ((argn != 3 && argn != 5) || !all_numbers(args, argn)) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  FLOAT *pid;
+  VALUE res = new_farray(PID_SIZE, &pid);
+  if (type_of(res) == VAL_TYPE_SYMBOL) {
+    return res;
+  }
+
+  pid[PID_KP] = dec_as_f(args[0]);
+  pid[PID_KI] = dec_as_f(args[1]);
+  pid[PID_KD] = dec_as_f(args[2]);
+  pid[PID_MIN] = argn == 5 ? dec_as_f(args[3]) : -FLT_MAX;
+  pid[PID_MAX] = argn == 5 ? dec_as_f(args[4]) : FLT_MAX;
+  pid[PID_INTEGRAL] = 0.0f;
+  pid[PID_PREV] = 0.0f;
+  pid[PID_STARTED] = 0.0f;
+  return res;
+}
+
+static FLOAT clamp(FLOAT v, FLOAT min, FLOAT max) {
+  return v < min ? min : (v > max ? max : v);
+}
+
+static VALUE ext_pid_update(VALUE *args, UINT argn) {
+  FLOAT *pid;
+  uint32_t len;
+  if (argn != 4 ||
+      !get_farray(args[0], &pid, &len) || len != PID_SIZE ||
+      !all_numbers(args + 1, 3)) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  FLOAT setpoint = dec_as_f(args[1]);
+  FLOAT value = dec_as_f(args[2]);
+  FLOAT dt = dec_as_f(args[3]);
+  FLOAT error = setpoint - value;
+
+  // The derivative is taken on the measured value, so that setpoint
+  // steps don't kick the output
+  FLOAT d_term = 0.0f;
+  if (pid[PID_STARTED] != 0.0f && dt > 0.0f) {
+    d_term = -pid[PID_KD] * (value - pid[PID_PREV]) / dt;
+  }
+  pid[PID_PREV] = value;
+  pid[PID_STARTED] = 1.0f;
+
+  FLOAT p_term = pid[PID_KP] * error;
+
+  // The integrator is limited to what the output can use, so that it
+  // doesn't wind up while the output is saturated
+  pid[PID_INTEGRAL] += pid[PID_KI] * error * dt;
+  pid[PID_INTEGRAL] = clamp(pid[PID_INTEGRAL],
+                            pid[PID_MIN] - p_term - d_term,
+                            pid[PID_MAX] - p_term - d_term);
+
+  return enc_F(clamp(p_term + pid[PID_INTEGRAL] + d_term, pid[PID_MIN], pid[PID_MAX]));
+}
+
+static VALUE ext_pid_reset(VALUE *args, UINT argn) {
+  FLOAT *pid;
+  uint32_t len;
+  if (argn != 1 || !get_farray(args[0], &pid, &len) || len != PID_SIZE) {
+    return enc_sym(SYM_EERROR);
+  }
+
+  pid[PID_INTEGRAL] = 0.0f;
+  pid[PID_PREV] = 0.0f;
+  pid[PID_STARTED] = 0.0f;
+  return enc_sym(SYM_TRUE);
+}
+
+bool dsp_extensions_init(void) {
+  bool res = true;
+  res = res && extensions_add("farray", ext_farray);
+  res = res && extensions_add("farray-from-list", ext_farray_from_list);
+  res = res && extensions_add("farray-to-list", ext_farray_to_list);
+
+  res = res && extensions_add("dsp-sum", ext_dsp_sum);
+  res = res && extensions_add("dsp-mean", ext_dsp_mean);
+  res = res && extensions_add("dsp-min", ext_dsp_min);
+  res = res && extensions_add("dsp-max", ext_dsp_max);
+  res = res && extensions_add("dsp-dot", ext_dsp_dot);
+  res = res && extensions_add("dsp-scale", ext_dsp_scale);
+  res = res && extensions_add("dsp-biquad", ext_dsp_biquad);
+  res = res && extensions_add("dsp-fir", ext_dsp_fir);
+  res = res && extensions_add("dsp-interp", ext_dsp_interp);
+
+  res = res && extensions_add("pid-create", ext_pid_create);
+  res = res && extensions_add("pid-update", ext_pid_update);
+  res = res && extensions_add("pid-reset", ext_pid_reset);
+
+  return res;
+}
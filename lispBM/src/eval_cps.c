@@ -148,6 +148,11 @@ static eval_context_t ctx_non_concurrent;
 static void (*usleep_callback)(uint32_t) = NULL;
 static uint32_t (*timestamp_us_callback)(void) = NULL;
 static void (*ctx_done_callback)(eval_context_t *) = NULL;
+static void (*event_callback)(void) = NULL;
+
+/* Sleep when no context is runnable. Platforms that wake the evaluator
+   up when there is something to do can make this longer. */
+static uint32_t idle_sleep_us = DEFAULT_SLEEP_US;
 
 void eval_cps_set_usleep_callback(void (*fptr)(uint32_t)) {
   usleep_callback = fptr;
@@ -161,6 +166,14 @@ void eval_cps_set_ctx_done_callback(void (*fptr)(eval_context_t *)) {
   ctx_done_callback = fptr;
 }
 
+void eval_cps_set_event_callback(void (*fptr)(void)) {
+  event_callback = fptr;
+}
+
+void eval_cps_set_idle_sleep_us(uint32_t us) {
+  idle_sleep_us = us;
+}
+
 
 static void queue_iterator(eval_context_queue_t *q, ctx_fun f, void *arg1, void *arg2) {
   mutex_lock(&qmutex);
@@ -186,6 +199,12 @@ void eval_cps_done_iterator(ctx_fun f, void *arg1, void *arg2){
   queue_iterator(&done, f, arg1, arg2);
 }
 
+void eval_cps_current_iterator(ctx_fun f, void *arg1, void *arg2){
+  if (ctx_running) {
+    f(ctx_running, arg1, arg2);
+  }
+}
+
 static void enqueue_ctx(eval_context_queue_t *q, eval_context_t *ctx) {
   mutex_lock(&qmutex);
   if (q->last == NULL) {
@@ -370,7 +389,7 @@ static eval_context_t *dequeue_ctx(uint32_t *us) {
   }
   /* ChibiOS does not like a sleep time of 0 */
   /* TODO: Make sure that does not happen. */
-  *us = DEFAULT_SLEEP_US;
+  *us = queue.first ? DEFAULT_SLEEP_US : idle_sleep_us;
   mutex_unlock(&qmutex);
   return NULL;
 }
@@ -475,7 +494,7 @@ static VALUE find_receiver_and_send(CID cid, VALUE msg) {
   }
 
   /* check the current context */
-  if (ctx_running->id == cid) {
+  if (ctx_running && ctx_running->id == cid) {
     VALUE new_mailbox = cons(msg, ctx_running->mailbox);
 
     if (type_of(new_mailbox) == VAL_TYPE_SYMBOL) {
@@ -832,13 +851,15 @@ static inline void eval_let(eval_context_t *ctx) {
     return;
   }
 
-  // Implements letrec by "preallocating" the key parts
+  // Implements letrec by "preallocating" the key parts. The env is
+  // kept in the context while it grows, so that the gc sees it.
   while (type_of(curr) == PTR_TYPE_CONS) {
     VALUE key = car(car(curr));
     VALUE val = NIL;
     VALUE binding;
     CONS_WITH_GC(binding, key, val, NIL);
-    CONS_WITH_GC(new_env, binding, new_env, new_env);
+    CONS_WITH_GC(new_env, binding, new_env, binding);
+    ctx->curr_env = new_env;
 
     curr = cdr(curr);
   }
@@ -992,10 +1013,12 @@ static inline void cont_progn_rest(eval_context_t *ctx) {
       error_ctx(rest);
     return;
   }
-  // allow for tail recursion
+  // allow for tail recursion. The previous expression may have been
+  // a closure application that left its own env in the context.
   if (type_of(cdr(rest)) == VAL_TYPE_SYMBOL &&
       cdr(rest) == NIL) {
     ctx->curr_exp = car(rest);
+    ctx->curr_env = env;
     return;
   }
   // Else create a continuation
@@ -1504,6 +1527,10 @@ void eval_cps_run_eval(void){
       break;
     }
 
+    if (event_callback) {
+      event_callback();
+    }
+
     if (heap_size() - heap_num_allocated() < PRELIMINARY_GC_MEASURE) {
       gc(NIL, NIL);
     }
@@ -1540,6 +1567,29 @@ VALUE evaluate_non_concurrent(void) {
   return ctx_non_concurrent.r;
 }
 
+/* Collect garbage from outside of the evaluator. Only safe
+   while evaluation is paused. */
+int eval_cps_gc(VALUE remember) {
+  return gc(remember, NIL);
+}
+
+/* Send a message to a context from the event callback, or while
+   evaluation is paused. Returns t, nil if there is no such context
+   or an error symbol. */
+VALUE eval_cps_send(CID cid, VALUE msg) {
+  VALUE res = find_receiver_and_send(cid, msg);
+  if (is_symbol_merror(res)) {
+    gc(msg, NIL);
+    res = find_receiver_and_send(cid, msg);
+  }
+  return res;
+}
+
+/* The context that is being evaluated, for extensions */
+CID eval_cps_current_cid(void) {
+  return ctx_running ? ctx_running->id : 0;
+}
+
 CID eval_cps_program(VALUE lisp) {
   return create_ctx(lisp, NIL, 256, false);
 }
@@ -256,6 +256,40 @@ VALUE heap_allocate_cell(TYPE ptr_type) {
   return res;
 }
 
+// Take num_cells consecutive cells from the head of the free list.
+// After heap_init the free list is in address order, so this succeeds
+// as long as nothing has been freed back into it out of order.
+int heap_allocate_block(unsigned int num_cells, UINT *first) {
+
+  VALUE curr = heap_state.freelist;
+
+  if (num_cells == 0 || !is_ptr(curr)) return 0;
+
+  UINT start = dec_ptr(curr);
+
+  if (start + num_cells > heap_state.heap_size) return 0;
+
+  for (unsigned int i = 0; i < num_cells; i ++) {
+    if (type_of(curr) != PTR_TYPE_CONS ||
+        dec_ptr(curr) != start + i) {
+      return 0;
+    }
+    curr = read_cdr(ref_cell(curr));
+  }
+
+  heap_state.freelist = curr;
+  heap_state.num_alloc += num_cells;
+
+  for (unsigned int i = 0; i < num_cells; i ++) {
+    cons_t *cell = &heap_state.heap[start + i];
+    set_car_(cell, NIL);
+    set_cdr_(cell, NIL);
+  }
+
+  *first = start;
+  return 1;
+}
+
 unsigned int heap_num_allocated(void) {
   return heap_state.num_alloc;
 }
@@ -0,0 +1,248 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "heap_image.h"
+#include "heap.h"
+#include "symrepr.h"
+#include "lispbm_memory.h"
+
+static const uint32_t *image_words(const heap_image_header_t *hdr) {
+  return (const uint32_t*)((const uint8_t*)hdr + sizeof(heap_image_header_t));
+}
+
+unsigned int heap_image_size(const heap_image_header_t *hdr) {
+  return (unsigned int)sizeof(heap_image_header_t) +
+    hdr->num_cells * sizeof(cons_t) +
+    hdr->array_words * 4 +
+    hdr->symbol_bytes;
+}
+
+uint32_t heap_image_checksum(const heap_image_header_t *hdr) {
+  const uint32_t *w = (const uint32_t*)hdr;
+  unsigned int n = heap_image_size(hdr) / 4;
+  uint32_t sum = 0;
+
+  for (unsigned int i = 0; i < n; i ++) {
+    sum += w[i];
+  }
+  // The checksum field itself is not included
+  return sum - hdr->checksum;
+}
+
+bool heap_image_is_valid(const uint8_t *data, unsigned int max_size) {
+  const heap_image_header_t *hdr = (const heap_image_header_t*)data;
+
+  if (max_size < sizeof(heap_image_header_t) ||
+      hdr->magic != HEAP_IMAGE_MAGIC ||
+      hdr->version != HEAP_IMAGE_VERSION ||
+      hdr->symbol_bytes % 4 != 0) {
+    return false;
+  }
+
+  // Bound each section on its own first so that the sum cannot wrap
+  if (hdr->num_cells > max_size / sizeof(cons_t) ||
+      hdr->array_words > max_size / 4 ||
+      hdr->symbol_bytes > max_size ||
+      heap_image_size(hdr) > max_size) {
+    return false;
+  }
+
+  return heap_image_checksum(hdr) == hdr->checksum;
+}
+
+static bool image_value(VALUE v, UINT base, unsigned int num_cells,
+                        const UINT *sym_map, unsigned int num_symbols,
+                        VALUE *res) {
+  if (is_ptr(v)) {
+    TYPE t = ptr_type(v);
+    UINT ix = dec_ptr(v);
+
+    if ((t != PTR_TYPE_CONS &&
+         t != PTR_TYPE_BOXED_I &&
+         t != PTR_TYPE_BOXED_U &&
+         t != PTR_TYPE_BOXED_F &&
+         t != PTR_TYPE_ARRAY) ||
+        ix >= num_cells) {
+      return false;
+    }
+
+    *res = set_ptr_type(enc_cons_ptr(base + ix), t);
+    return true;
+  }
+
+  if (val_type(v) == VAL_TYPE_SYMBOL && dec_sym(v) >= MAX_SPECIAL_SYMBOLS) {
+    UINT n = dec_sym(v) - MAX_SPECIAL_SYMBOLS;
+    if (n >= num_symbols) {
+      return false;
+    }
+    *res = enc_sym(sym_map[n]);
+    return true;
+  }
+
+  *res = v;
+  return true;
+}
+
+static bool is_raw_car(VALUE cdr) {
+  if (type_of(cdr) != VAL_TYPE_SYMBOL) {
+    return false;
+  }
+
+  UINT s = dec_sym(cdr);
+  return s == SYM_BOXED_I_TYPE ||
+    s == SYM_BOXED_U_TYPE ||
+    s == SYM_BOXED_F_TYPE ||
+    s == SYM_ARRAY_TYPE;
+}
+
+static void free_sym_map(UINT *sym_map) {
+  if (sym_map) {
+    memory_free(sym_map);
+  }
+}
+
+static bool load_array(cons_t *cell, const uint32_t *img_arrays,
+                       unsigned int array_words, VALUE *err) {
+  UINT offset = cell->car;
+
+  *err = enc_sym(SYM_RERROR);
+
+  if (offset > array_words || array_words - offset < 2) {
+    return false;
+  }
+
+  const array_header_t *arr = (const array_header_t*)(img_arrays + offset);
+  UINT words = arr->size;
+  if (arr->elt_type == VAL_TYPE_CHAR) {
+    words = (arr->size + 3) / 4;
+  }
+
+  if (words > array_words - offset - 2) {
+    return false;
+  }
+
+  uint32_t *mem = memory_allocate(2 + words);
+  if (mem == NULL) {
+    *err = enc_sym(SYM_MERROR);
+    return false;
+  }
+
+  memcpy(mem, arr, (2 + words) * 4);
+  cell->car = (UINT)mem;
+  return true;
+}
+
+/*
+ * Load an image into the heap. Cells are copied into a consecutive block
+ * from the free list, so this should be done right after lispbm_init. The
+ * result is the program (a list of expressions, as returned by
+ * tokpar_parse) or an error symbol.
+ */
+VALUE heap_image_load(const uint8_t *data, unsigned int max_size) {
+  if (!heap_image_is_valid(data, max_size)) {
+    return enc_sym(SYM_RERROR);
+  }
+
+  const heap_image_header_t *hdr = (const heap_image_header_t*)data;
+  const cons_t *img_cells = (const cons_t*)image_words(hdr);
+  const uint32_t *img_arrays = (const uint32_t*)(img_cells + hdr->num_cells);
+  const char *img_names = (const char*)(img_arrays + hdr->array_words);
+
+  UINT *sym_map = NULL;
+  if (hdr->num_symbols > 0) {
+    sym_map = memory_allocate(hdr->num_symbols);
+    if (sym_map == NULL) {
+      return enc_sym(SYM_MERROR);
+    }
+  }
+
+  // Symbols are copied to symbol memory as the image can be rewritten
+  // while the program runs.
+  const char *name = img_names;
+  const char *names_end = img_names + hdr->symbol_bytes;
+  for (unsigned int i = 0; i < hdr->num_symbols; i ++) {
+    size_t len = strnlen(name, (size_t)(names_end - name));
+
+    if (name + len >= names_end) {
+      free_sym_map(sym_map);
+      return enc_sym(SYM_RERROR);
+    }
+
+    if (!symrepr_lookup((char*)name, &sym_map[i]) &&
+        !symrepr_addsym((char*)name, &sym_map[i])) {
+      free_sym_map(sym_map);
+      return enc_sym(SYM_MERROR);
+    }
+
+    name += len + 1;
+  }
+
+  UINT base = 0;
+
+  if (hdr->num_cells > 0) {
+    if (!heap_allocate_block(hdr->num_cells, &base)) {
+      free_sym_map(sym_map);
+      return enc_sym(SYM_MERROR);
+    }
+
+    heap_state_t hs;
+    heap_get_state(&hs);
+    cons_t *cells = &hs.heap[base];
+    memcpy(cells, img_cells, hdr->num_cells * sizeof(cons_t));
+
+    for (unsigned int i = 0; i < hdr->num_cells; i ++) {
+      VALUE cdr = val_clr_gc_mark(cells[i].cdr);
+      VALUE err = enc_sym(SYM_RERROR);
+      bool ok = true;
+
+      if (!is_raw_car(cdr)) {
+        ok = image_value(cells[i].car, base, hdr->num_cells,
+                         sym_map, hdr->num_symbols, &cells[i].car) &&
+          image_value(cdr, base, hdr->num_cells,
+                      sym_map, hdr->num_symbols, &cells[i].cdr);
+      } else {
+        if (dec_sym(cdr) == SYM_ARRAY_TYPE) {
+          ok = load_array(&cells[i], img_arrays, hdr->array_words, &err);
+        }
+        cells[i].cdr = cdr;
+      }
+
+      if (!ok) {
+        // The cells are already allocated. Make them harmless so that
+        // the garbage collector does not follow or free anything that
+        // was not relocated, and let it reclaim them.
+        for (unsigned int j = i; j < hdr->num_cells; j ++) {
+          cells[j].car = enc_sym(SYM_NIL);
+          cells[j].cdr = enc_sym(SYM_NIL);
+        }
+        free_sym_map(sym_map);
+        return err;
+      }
+    }
+  }
+
+  VALUE res;
+  if (!image_value(hdr->root, base, hdr->num_cells,
+                   sym_map, hdr->num_symbols, &res)) {
+    res = enc_sym(SYM_RERROR);
+  }
+
+  free_sym_map(sym_map);
+  return res;
+}
@@ -0,0 +1,195 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "heap_snapshot.h"
+#include "heap.h"
+#include "symrepr.h"
+#include "env.h"
+#include "eval_cps.h"
+#include "lispbm_memory.h"
+
+#define CTX_REGISTERS 5
+
+typedef struct {
+  uint32_t pos;     // Position in the snapshot
+  uint32_t offset;  // Window to copy
+  uint32_t len;
+  uint8_t *buf;
+  uint32_t num_roots;
+} writer_t;
+
+static heap_snapshot_header_t header;
+
+/* Advances the position by n bytes and copies the part of them
+   that falls inside the window. */
+static void put(writer_t *w, const void *src, uint32_t n) {
+  uint32_t start = w->pos;
+  uint32_t end = w->pos + n;
+  w->pos = end;
+
+  if (!w->buf || end <= w->offset || start >= w->offset + w->len) {
+    return;
+  }
+
+  uint32_t from = start < w->offset ? w->offset - start : 0;
+  uint32_t to = end > w->offset + w->len ? w->offset + w->len - start : n;
+  memcpy(w->buf + (start + from - w->offset), (const uint8_t*)src + from, to - from);
+}
+
+static bool is_array_cell(cons_t *cell) {
+  return type_of(cell->cdr) == VAL_TYPE_SYMBOL &&
+    dec_sym(val_clr_gc_mark(cell->cdr)) == SYM_ARRAY_TYPE &&
+    cell->car != enc_sym(SYM_RECOVERED);
+}
+
+static void put_root(writer_t *w, uint32_t kind, uint32_t id, VALUE val) {
+  heap_snapshot_root_t r;
+  r.kind = kind;
+  r.id = id;
+  r.val = val;
+  put(w, &r, sizeof(r));
+  w->num_roots++;
+}
+
+static void put_ctx_roots(eval_context_t *ctx, void *arg1, void *arg2) {
+  (void)arg2;
+  writer_t *w = (writer_t*)arg1;
+
+  VALUE regs[CTX_REGISTERS] = {ctx->program, ctx->curr_exp, ctx->curr_env, ctx->mailbox, ctx->r};
+  for (int i = 0; i < CTX_REGISTERS; i ++) {
+    put_root(w, HEAP_SNAPSHOT_ROOT_CTX, ctx->id, regs[i]);
+  }
+
+  // Only the stack words that gc would follow
+  for (unsigned int i = 0; i < ctx->K.sp; i ++) {
+    VALUE v = ctx->K.data[i];
+    if (is_ptr(v) && dec_ptr(v) < header.heap_cells) {
+      put_root(w, HEAP_SNAPSHOT_ROOT_STACK, ctx->id, v);
+    }
+  }
+}
+
+static void put_roots(writer_t *w) {
+  VALUE env = *env_get_global_ptr();
+  while (type_of(env) == PTR_TYPE_CONS) {
+    VALUE binding = car(env);
+    put_root(w, HEAP_SNAPSHOT_ROOT_GLOBAL, dec_sym(car(binding)), cdr(binding));
+    env = cdr(env);
+  }
+  put_root(w, HEAP_SNAPSHOT_ROOT_ENV, 0, *env_get_global_ptr());
+
+  eval_cps_current_iterator(put_ctx_roots, w, NULL);
+  eval_cps_running_iterator(put_ctx_roots, w, NULL);
+  eval_cps_blocked_iterator(put_ctx_roots, w, NULL);
+  eval_cps_done_iterator(put_ctx_roots, w, NULL);
+}
+
+static uint32_t put_symbols(writer_t *w) {
+  uint32_t num = 0;
+  VALUE env = *env_get_global_ptr();
+
+  while (type_of(env) == PTR_TYPE_CONS) {
+    uint32_t id = dec_sym(car(car(env)));
+    const char *name = symrepr_lookup_name(id);
+    if (name) {
+      size_t name_len = strlen(name);
+      uint8_t len = name_len > 255 ? 255 : (uint8_t)name_len;
+      put(w, &id, 4);
+      put(w, &len, 1);
+      put(w, name, len);
+      num++;
+    }
+    env = cdr(env);
+  }
+
+  return num;
+}
+
+/* Writes the whole snapshot through w. Sections that are outside of
+   the window only advance the position, so a read costs one pass over
+   the cells and the roots regardless of where it is. */
+static void put_snapshot(writer_t *w) {
+  heap_state_t hs;
+  heap_get_state(&hs);
+
+  put(w, &header, sizeof(header));
+  put(w, hs.heap, header.heap_cells * sizeof(cons_t));
+  put(w, memory_bitmap(), header.bitmap_words * 4);
+
+  for (uint32_t i = 0; i < header.heap_cells; i ++) {
+    cons_t *cell = &hs.heap[i];
+    if (is_array_cell(cell)) {
+      array_header_t *arr = (array_header_t*)cell->car;
+      heap_snapshot_array_t a;
+      a.cell = i;
+      a.elt_type = arr->elt_type;
+      a.size = arr->size;
+      put(w, &a, sizeof(a));
+    }
+  }
+
+  put_roots(w);
+  put_symbols(w);
+}
+
+uint32_t heap_snapshot_begin(void) {
+  heap_state_t hs;
+  heap_get_state(&hs);
+
+  memset(&header, 0, sizeof(header));
+  header.magic = HEAP_SNAPSHOT_MAGIC;
+  header.version = HEAP_SNAPSHOT_VERSION;
+  header.heap_cells = hs.heap_size;
+  header.freelist = hs.freelist;
+  header.mem_words = memory_num_words();
+  header.mem_base = (uint32_t)memory_data();
+  header.bitmap_words = memory_bitmap_words();
+  header.gc_num = hs.gc_num;
+
+  for (uint32_t i = 0; i < header.heap_cells; i ++) {
+    if (is_array_cell(&hs.heap[i])) {
+      header.num_arrays++;
+    }
+  }
+
+  // A pass without a buffer counts the roots and symbols
+  writer_t w;
+  memset(&w, 0, sizeof(w));
+  put_roots(&w);
+  header.num_roots = w.num_roots;
+  header.num_symbols = put_symbols(&w);
+
+  memset(&w, 0, sizeof(w));
+  put_snapshot(&w);
+  return w.pos;
+}
+
+uint32_t heap_snapshot_read(uint32_t offset, uint8_t *buf, uint32_t len) {
+  writer_t w;
+  memset(&w, 0, sizeof(w));
+  w.offset = offset;
+  w.len = len;
+  w.buf = buf;
+  put_snapshot(&w);
+
+  if (offset >= w.pos) {
+    return 0;
+  }
+  return w.pos - offset < len ? w.pos - offset : len;
+}
@@ -99,6 +99,18 @@ uint32_t memory_num_words(void) {
   return memory_size;
 }
 
+uint32_t *memory_data(void) {
+  return memory;
+}
+
+uint32_t *memory_bitmap(void) {
+  return bitmap;
+}
+
+uint32_t memory_bitmap_words(void) {
+  return bitmap_size;
+}
+
 uint32_t memory_num_free(void) {
   if (memory == NULL || bitmap == NULL) {
     return 0;
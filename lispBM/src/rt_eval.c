@@ -0,0 +1,477 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "rt_eval.h"
+#include "symrepr.h"
+#include "heap.h"
+
+#define NO_NODE   0xFFFF
+#define VAR_DT    0
+
+typedef enum {
+  OP_CONST = 0,
+  OP_VAR,
+  OP_SETQ,
+  OP_PROGN,
+  OP_IF,
+  OP_ADD,
+  OP_SUB,
+  OP_NEG,
+  OP_MUL,
+  OP_DIV,
+  OP_LT,
+  OP_GT,
+  OP_LE,
+  OP_GE,
+  OP_EQ,
+  OP_AND,
+  OP_OR,
+  OP_NOT,
+  OP_ABS,
+  OP_MIN,
+  OP_MAX,
+  OP_POST,
+  OP_NATIVE
+} rt_op_t;
+
+typedef struct {
+  const char *name;
+  rt_op_t op;
+  uint8_t min_args;
+  uint8_t max_args;
+} builtin_t;
+
+/* Forms with variable arity are evaluated over their argument list,
+   so they don't nest deeper with more arguments. */
+static const builtin_t builtins[] = {
+  {"progn", OP_PROGN, 1, 255},
+  {"if",    OP_IF,    2, 3},
+  {"+",     OP_ADD,   1, 255},
+  {"-",     OP_SUB,   1, 255},
+  {"*",     OP_MUL,   1, 255},
+  {"/",     OP_DIV,   2, 2},
+  {"<",     OP_LT,    2, 2},
+  {">",     OP_GT,    2, 2},
+  {"<=",    OP_LE,    2, 2},
+  {">=",    OP_GE,    2, 2},
+  {"=",     OP_EQ,    2, 2},
+  {"and",   OP_AND,   1, 255},
+  {"or",    OP_OR,    1, 255},
+  {"not",   OP_NOT,   1, 1},
+  {"abs",   OP_ABS,   1, 1},
+  {"min",   OP_MIN,   1, 255},
+  {"max",   OP_MAX,   1, 255},
+  {"post",  OP_POST,  2, 2},
+};
+
+typedef struct {
+  const char *name;
+  unsigned int argn;
+  rt_native_fun fun;
+} native_t;
+
+static native_t natives[RT_EVAL_MAX_NATIVES];
+static unsigned int num_natives = 0;
+static void (*post_callback)(int id, float value) = 0;
+
+bool rt_eval_add_native(const char *name, unsigned int argn, rt_native_fun fun) {
+  if (argn > RT_EVAL_MAX_ARGS) {
+    return false;
+  }
+
+  for (unsigned int i = 0; i < num_natives; i ++) {
+    if (strcmp(natives[i].name, name) == 0) {
+      natives[i].argn = argn;
+      natives[i].fun = fun;
+      return true;
+    }
+  }
+
+  if (num_natives >= RT_EVAL_MAX_NATIVES) {
+    return false;
+  }
+
+  natives[num_natives].name = name;
+  natives[num_natives].argn = argn;
+  natives[num_natives].fun = fun;
+  num_natives ++;
+  return true;
+}
+
+void rt_eval_set_post_callback(void (*fun)(int id, float value)) {
+  post_callback = fun;
+}
+
+const char *rt_eval_error_str(rt_eval_res res) {
+  switch (res) {
+  case RT_EVAL_OK: return "ok";
+  case RT_EVAL_ERR_FORM: return "unsupported form";
+  case RT_EVAL_ERR_ARGS: return "wrong number of arguments";
+  case RT_EVAL_ERR_NODES: return "program too large";
+  case RT_EVAL_ERR_VARS: return "too many variables";
+  case RT_EVAL_ERR_DEPTH: return "nested too deep";
+  default: return "unknown error";
+  }
+}
+
+int rt_eval_var_index(rt_program_t *p, UINT sym) {
+  for (unsigned int i = 0; i < p->num_vars; i ++) {
+    if (p->var_syms[i] == sym) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+/* Compiler */
+
+static int new_node(rt_program_t *p, rt_op_t op) {
+  if (p->num_nodes >= RT_EVAL_MAX_NODES) {
+    return -RT_EVAL_ERR_NODES;
+  }
+
+  rt_node_t *n = &p->nodes[p->num_nodes];
+  memset(n, 0, sizeof(rt_node_t));
+  n->op = op;
+  n->first = NO_NODE;
+  n->next = NO_NODE;
+  return (int)p->num_nodes ++;
+}
+
+static int var_slot(rt_program_t *p, UINT sym) {
+  int ind = rt_eval_var_index(p, sym);
+  if (ind >= 0) {
+    return ind;
+  }
+  if (p->num_vars >= RT_EVAL_MAX_VARS) {
+    p->err_sym = sym;
+    return -RT_EVAL_ERR_VARS;
+  }
+  p->var_syms[p->num_vars] = sym;
+  p->vars[p->num_vars] = 0.0f;
+  return (int)p->num_vars ++;
+}
+
+/* Returns the index of the new node, or a negated error */
+static int compile_exp(rt_program_t *p, VALUE exp, unsigned int depth);
+
+static int compile_symbol(rt_program_t *p, UINT sym) {
+  if (sym == SYM_TRUE || sym == SYM_NIL) {
+    int n = new_node(p, OP_CONST);
+    if (n >= 0) {
+      p->nodes[n].value = sym == SYM_TRUE ? 1.0f : 0.0f;
+    }
+    return n;
+  }
+
+  int slot = var_slot(p, sym);
+  if (slot < 0) {
+    return slot;
+  }
+
+  int n = new_node(p, OP_VAR);
+  if (n >= 0) {
+    p->nodes[n].ind = (uint16_t)slot;
+  }
+  return n;
+}
+
+static int compile_args(rt_program_t *p, int n, VALUE args, unsigned int depth) {
+  uint16_t *link = &p->nodes[n].first;
+  unsigned int argn = 0;
+
+  while (type_of(args) == PTR_TYPE_CONS) {
+    int a = compile_exp(p, car(args), depth + 1);
+    if (a < 0) {
+      return a;
+    }
+    *link = (uint16_t)a;
+    link = &p->nodes[a].next;
+    argn ++;
+    if (argn > 255) {
+      return -RT_EVAL_ERR_ARGS;
+    }
+    args = cdr(args);
+  }
+
+  p->nodes[n].argn = (uint8_t)argn;
+  return n;
+}
+
+static int compile_form(rt_program_t *p, VALUE exp, unsigned int depth) {
+  VALUE head = car(exp);
+  VALUE args = cdr(exp);
+
+  if (type_of(head) != VAL_TYPE_SYMBOL) {
+    return -RT_EVAL_ERR_FORM;
+  }
+
+  UINT sym = dec_sym(head);
+  const char *name = symrepr_lookup_name(sym);
+  if (!name) {
+    p->err_sym = sym;
+    return -RT_EVAL_ERR_FORM;
+  }
+
+  unsigned int argn = 0;
+  for (VALUE a = args; type_of(a) == PTR_TYPE_CONS; a = cdr(a)) {
+    argn ++;
+  }
+
+  if (strcmp(name, "setq") == 0) {
+    if (argn != 2 || type_of(car(args)) != VAL_TYPE_SYMBOL) {
+      p->err_sym = sym;
+      return -RT_EVAL_ERR_ARGS;
+    }
+    UINT var = dec_sym(car(args));
+    if (var == SYM_TRUE || var == SYM_NIL) {
+      p->err_sym = var;
+      return -RT_EVAL_ERR_FORM;
+    }
+    int slot = var_slot(p, var);
+    if (slot < 0) {
+      return slot;
+    }
+    int n = new_node(p, OP_SETQ);
+    if (n < 0) {
+      return n;
+    }
+    p->nodes[n].ind = (uint16_t)slot;
+    return compile_args(p, n, cdr(args), depth);
+  }
+
+  for (unsigned int i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i ++) {
+    const builtin_t *b = &builtins[i];
+    if (strcmp(name, b->name) != 0) {
+      continue;
+    }
+    if (argn < b->min_args || argn > b->max_args) {
+      p->err_sym = sym;
+      return -RT_EVAL_ERR_ARGS;
+    }
+    rt_op_t op = b->op;
+    if (op == OP_SUB && argn == 1) {
+      op = OP_NEG;
+    }
+    int n = new_node(p, op);
+    if (n < 0) {
+      return n;
+    }
+    return compile_args(p, n, args, depth);
+  }
+
+  for (unsigned int i = 0; i < num_natives; i ++) {
+    if (strcmp(name, natives[i].name) != 0) {
+      continue;
+    }
+    if (argn != natives[i].argn) {
+      p->err_sym = sym;
+      return -RT_EVAL_ERR_ARGS;
+    }
+    int n = new_node(p, OP_NATIVE);
+    if (n < 0) {
+      return n;
+    }
+    p->nodes[n].ind = (uint16_t)i;
+    return compile_args(p, n, args, depth);
+  }
+
+  p->err_sym = sym;
+  return -RT_EVAL_ERR_FORM;
+}
+
+static int compile_exp(rt_program_t *p, VALUE exp, unsigned int depth) {
+  if (depth >= RT_EVAL_MAX_DEPTH) {
+    return -RT_EVAL_ERR_DEPTH;
+  }
+
+  switch (type_of(exp)) {
+  case VAL_TYPE_SYMBOL:
+    return compile_symbol(p, dec_sym(exp));
+  case VAL_TYPE_I:
+  case VAL_TYPE_U:
+  case PTR_TYPE_BOXED_I:
+  case PTR_TYPE_BOXED_U:
+  case PTR_TYPE_BOXED_F: {
+    int n = new_node(p, OP_CONST);
+    if (n >= 0) {
+      p->nodes[n].value = dec_as_f(exp);
+    }
+    return n;
+  }
+  case PTR_TYPE_CONS:
+    return compile_form(p, exp, depth);
+  default:
+    return -RT_EVAL_ERR_FORM;
+  }
+}
+
+rt_eval_res rt_eval_compile(rt_program_t *p, VALUE code) {
+  p->num_nodes = 0;
+  p->num_vars = 0;
+  p->err_sym = SYM_NIL;
+
+  UINT dt_sym;
+  if (!symrepr_lookup("dt", &dt_sym) &&
+      !symrepr_addsym("dt", &dt_sym)) {
+    return RT_EVAL_ERR_VARS;
+  }
+  var_slot(p, dt_sym);
+
+  int root = compile_exp(p, code, 0);
+  if (root < 0) {
+    p->num_nodes = 0;
+    return (rt_eval_res)(-root);
+  }
+
+  p->root = (uint16_t)root;
+  return RT_EVAL_OK;
+}
+
+/* Evaluator */
+
+static float eval_node(rt_program_t *p, uint16_t ind) {
+  const rt_node_t *n = &p->nodes[ind];
+  uint16_t a = n->first;
+  float res;
+
+  switch (n->op) {
+  case OP_CONST: return n->value;
+  case OP_VAR: return p->vars[n->ind];
+
+  case OP_SETQ:
+    res = eval_node(p, a);
+    p->vars[n->ind] = res;
+    return res;
+
+  case OP_PROGN:
+    res = 0.0f;
+    for (; a != NO_NODE; a = p->nodes[a].next) {
+      res = eval_node(p, a);
+    }
+    return res;
+
+  case OP_IF: {
+    uint16_t then = p->nodes[a].next;
+    if (eval_node(p, a) != 0.0f) {
+      return eval_node(p, then);
+    }
+    uint16_t other = p->nodes[then].next;
+    return other != NO_NODE ? eval_node(p, other) : 0.0f;
+  }
+
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_MIN:
+  case OP_MAX:
+    res = eval_node(p, a);
+    for (a = p->nodes[a].next; a != NO_NODE; a = p->nodes[a].next) {
+      float v = eval_node(p, a);
+      switch (n->op) {
+      case OP_ADD: res += v; break;
+      case OP_SUB: res -= v; break;
+      case OP_MUL: res *= v; break;
+      case OP_MIN: res = v < res ? v : res; break;
+      default: res = v > res ? v : res; break;
+      }
+    }
+    return res;
+
+  case OP_NEG: return -eval_node(p, a);
+
+  case OP_DIV: {
+    // Division by zero gives 0, so that outputs stay finite
+    float x = eval_node(p, a);
+    float y = eval_node(p, p->nodes[a].next);
+    return y != 0.0f ? x / y : 0.0f;
+  }
+
+  case OP_LT:
+  case OP_GT:
+  case OP_LE:
+  case OP_GE:
+  case OP_EQ: {
+    float x = eval_node(p, a);
+    float y = eval_node(p, p->nodes[a].next);
+    switch (n->op) {
+    case OP_LT: return x < y ? 1.0f : 0.0f;
+    case OP_GT: return x > y ? 1.0f : 0.0f;
+    case OP_LE: return x <= y ? 1.0f : 0.0f;
+    case OP_GE: return x >= y ? 1.0f : 0.0f;
+    default: return x == y ? 1.0f : 0.0f;
+    }
+  }
+
+  case OP_AND:
+    res = 1.0f;
+    for (; a != NO_NODE; a = p->nodes[a].next) {
+      res = eval_node(p, a);
+      if (res == 0.0f) {
+        break;
+      }
+    }
+    return res;
+
+  case OP_OR:
+    res = 0.0f;
+    for (; a != NO_NODE; a = p->nodes[a].next) {
+      res = eval_node(p, a);
+      if (res != 0.0f) {
+        break;
+      }
+    }
+    return res;
+
+  case OP_NOT: return eval_node(p, a) == 0.0f ? 1.0f : 0.0f;
+
+  case OP_ABS:
+    res = eval_node(p, a);
+    return res < 0.0f ? -res : res;
+
+  case OP_POST: {
+    float id = eval_node(p, a);
+    res = eval_node(p, p->nodes[a].next);
+    if (post_callback) {
+      post_callback((int)id, res);
+    }
+    return res;
+  }
+
+  case OP_NATIVE: {
+    float args[RT_EVAL_MAX_ARGS];
+    unsigned int i = 0;
+    for (; a != NO_NODE; a = p->nodes[a].next) {
+      args[i ++] = eval_node(p, a);
+    }
+    return natives[n->ind].fun(args);
+  }
+
+  default:
+    return 0.0f;
+  }
+}
+
+float rt_eval_run(rt_program_t *p, float dt) {
+  if (p->num_nodes == 0) {
+    return 0.0f;
+  }
+  p->vars[VAR_DT] = dt;
+  return eval_node(p, p->root);
+}
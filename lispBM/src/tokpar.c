@@ -510,6 +510,17 @@ VALUE tokpar_parse_program(tokenizer_char_stream str) {
   return cons(head, tail);
 }
 
+bool tokpar_parse_next(tokenizer_char_stream str, VALUE *res) {
+  token tok = next_token(str);
+
+  if (tok.type == TOKENIZER_END) {
+    return false;
+  }
+
+  *res = parse_sexp(tok, str);
+  return true;
+}
+
 VALUE parse_sexp(token tok, tokenizer_char_stream str) {
 
   VALUE v;
@@ -549,7 +560,9 @@ VALUE parse_sexp(token tok, tokenizer_char_stream str) {
     return v;
   }
   case TOKSTRING: {
-    heap_allocate_array(&v, tok.text_len+1, VAL_TYPE_CHAR);
+    if (!heap_allocate_array(&v, tok.text_len+1, VAL_TYPE_CHAR)) {
+      return enc_sym(SYM_MERROR);
+    }
     array_header_t *arr = (array_header_t*)car(v);
     char *data = (char *)arr + 8;
     memset(data, 0, (tok.text_len+1) * sizeof(char));
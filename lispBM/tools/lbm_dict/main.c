@@ -0,0 +1,463 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Trains the compression dictionary on a corpus of lisp scripts and
+ * writes it as compression_dict.h.
+ *
+ * Usage: lbm_dict [-o compression_dict.h] [-w words] file.lisp [file2.lisp ...]
+ *
+ * The dictionary has every character that the compressor accepts outside
+ * of strings, plus the words and word fragments that save the most bits
+ * on the corpus. Code lengths come from a Huffman code limited to
+ * DICT_MAX_CODE_LENGTH bits, so that compression.c can decode each key
+ * with a single lookup in a table of 2^DICT_MAX_CODE_LENGTH entries.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#define MAX_CODE_LENGTH		10
+#define MAX_KEY_LENGTH		12
+#define MAX_KEYS			200
+#define MAX_CANDIDATES		8192
+#define DEFAULT_WORDS		56
+
+// Characters with keys of their own, same as the original code table
+static const char *m_chars = "abcdefghijklmnopqrstuvwxyz0123456789_,` '\\\"#.><=/*-+?()";
+
+typedef struct {
+  char key[MAX_KEY_LENGTH + 1];
+  unsigned int len;
+  unsigned long count;
+  unsigned int code_len;
+  unsigned int code;
+} key_t_;
+
+typedef struct {
+  char word[MAX_KEY_LENGTH + 1];
+  unsigned long count;
+  int files;
+  int last_file;
+} cand_t;
+
+static key_t_ m_keys[MAX_KEYS];
+static int m_num_keys = 0;
+static cand_t m_cand[MAX_CANDIDATES];
+static int m_num_cand = 0;
+static int m_file = 0;
+
+/*
+ * Normalize like compression_compress: comments are removed, whitespace
+ * runs become one space and strings are kept as they are. String
+ * contents are marked in the mask.
+ */
+static char *normalize(const char *src, char **mask_out) {
+  size_t n = strlen(src);
+  char *res = malloc(n + 1);
+  char *mask = calloc(1, n + 1);
+  size_t j = 0;
+  bool string_mode = false;
+  bool space = false;
+
+  for (size_t i = 0; i < n; i++) {
+    char c = src[i];
+    if (string_mode) {
+      res[j] = c;
+      mask[j++] = 1;
+      if (c == '\"' && src[i - 1] != '\\') {
+        string_mode = false;
+      }
+      continue;
+    }
+
+    if (c == ';') {
+      while (src[i] && src[i] != '\n') {
+        i++;
+      }
+      i--;
+      continue;
+    }
+
+    if (c == '\n' || c == ' ' || c == '\t' || c == '\r') {
+      space = true;
+      continue;
+    }
+
+    if (space) {
+      res[j++] = ' ';
+      space = false;
+    }
+
+    res[j++] = c;
+    if (c == '\"') {
+      string_mode = true;
+    }
+  }
+
+  res[j] = 0;
+  *mask_out = mask;
+  return res;
+}
+
+static bool is_word_char(char c) {
+  return isalnum((unsigned char)c) || strchr("-_+*/=<>?", c);
+}
+
+static void add_candidate(const char *w, size_t len) {
+  if (len < 2 || len > MAX_KEY_LENGTH) {
+    return;
+  }
+
+  for (int i = 0; i < m_num_cand; i++) {
+    if (strlen(m_cand[i].word) == len && strncmp(m_cand[i].word, w, len) == 0) {
+      m_cand[i].count++;
+      if (m_cand[i].last_file != m_file) {
+        m_cand[i].files++;
+        m_cand[i].last_file = m_file;
+      }
+      return;
+    }
+  }
+
+  if (m_num_cand < MAX_CANDIDATES) {
+    memcpy(m_cand[m_num_cand].word, w, len);
+    m_cand[m_num_cand].word[len] = 0;
+    m_cand[m_num_cand].count = 1;
+    m_cand[m_num_cand].files = 1;
+    m_cand[m_num_cand].last_file = m_file;
+    m_num_cand++;
+  }
+}
+
+// Words, words with their opening parenthesis and runs of parentheses
+static void count_candidates(const char *s, const char *mask) {
+  size_t n = strlen(s);
+  for (size_t i = 0; i < n; i++) {
+    if (mask[i]) {
+      continue;
+    }
+
+    if (is_word_char(s[i]) && (i == 0 || !is_word_char(s[i - 1]))) {
+      size_t e = i;
+      while (e < n && !mask[e] && is_word_char(s[e])) {
+        e++;
+      }
+      add_candidate(s + i, e - i);
+      if (i > 0 && s[i - 1] == '(' && !mask[i - 1]) {
+        add_candidate(s + i - 1, e - i + 1);
+      }
+    }
+
+    if ((s[i] == ')' || s[i] == '(') && (i == 0 || s[i - 1] != s[i])) {
+      size_t e = i;
+      while (e < n && s[e] == s[i] && !mask[e]) {
+        e++;
+      }
+      for (size_t l = 2; l <= e - i && l <= 6; l++) {
+        add_candidate(s + i, l);
+      }
+    }
+  }
+}
+
+static int cmp_savings(const void *a, const void *b) {
+  const cand_t *ca = a, *cb = b;
+  unsigned long sa = ca->count * (strlen(ca->word) - 1);
+  unsigned long sb = cb->count * (strlen(cb->word) - 1);
+  return sa < sb ? 1 : (sa > sb ? -1 : strcmp(ca->word, cb->word));
+}
+
+static void add_key(const char *k) {
+  strcpy(m_keys[m_num_keys].key, k);
+  m_keys[m_num_keys].len = (unsigned int)strlen(k);
+  m_keys[m_num_keys].count = 1; // Every key must get a code
+  m_num_keys++;
+}
+
+// Longest match, the same way the compressor picks keys
+static void count_keys(const char *s, const char *mask) {
+  size_t n = strlen(s);
+  size_t i = 0;
+  while (i < n) {
+    if (mask[i]) {
+      i++;
+      continue;
+    }
+
+    int best = -1;
+    for (int k = 0; k < m_num_keys; k++) {
+      if (strncmp(s + i, m_keys[k].key, m_keys[k].len) == 0 &&
+          (best < 0 || m_keys[k].len > m_keys[best].len)) {
+        best = k;
+      }
+    }
+
+    if (best < 0) {
+      i++;
+      continue;
+    }
+
+    m_keys[best].count++;
+    i += m_keys[best].len;
+  }
+}
+
+static void huffman_lengths(void) {
+  int n = m_num_keys;
+  unsigned long w[2 * MAX_KEYS];
+  int parent[2 * MAX_KEYS];
+  bool used[2 * MAX_KEYS];
+
+  for (int i = 0; i < n; i++) {
+    w[i] = m_keys[i].count;
+    used[i] = false;
+  }
+
+  int nodes = n;
+  for (int step = 0; step < n - 1; step++) {
+    int a = -1, b = -1;
+    for (int i = 0; i < nodes; i++) {
+      if (used[i]) {
+        continue;
+      }
+      if (a < 0 || w[i] < w[a]) {
+        b = a;
+        a = i;
+      } else if (b < 0 || w[i] < w[b]) {
+        b = i;
+      }
+    }
+    used[a] = used[b] = true;
+    w[nodes] = w[a] + w[b];
+    used[nodes] = false;
+    parent[a] = parent[b] = nodes;
+    nodes++;
+  }
+  parent[nodes - 1] = -1;
+
+  for (int i = 0; i < n; i++) {
+    unsigned int len = 0;
+    for (int p = i; parent[p] >= 0; p = parent[p]) {
+      len++;
+    }
+    m_keys[i].code_len = len;
+  }
+
+  // Limit the length and repair the Kraft sum by making the longest
+  // codes that are still below the limit one bit longer.
+  unsigned long kraft = 0;
+  for (int i = 0; i < n; i++) {
+    if (m_keys[i].code_len > MAX_CODE_LENGTH) {
+      m_keys[i].code_len = MAX_CODE_LENGTH;
+    }
+    kraft += 1ul << (MAX_CODE_LENGTH - m_keys[i].code_len);
+  }
+
+  while (kraft > (1ul << MAX_CODE_LENGTH)) {
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+      if (m_keys[i].code_len < MAX_CODE_LENGTH &&
+          (best < 0 || m_keys[i].code_len > m_keys[best].code_len ||
+              (m_keys[i].code_len == m_keys[best].code_len &&
+                  m_keys[i].count < m_keys[best].count))) {
+        best = i;
+      }
+    }
+    kraft -= 1ul << (MAX_CODE_LENGTH - m_keys[best].code_len - 1);
+    m_keys[best].code_len++;
+  }
+}
+
+// Canonical codes, stored bit reversed as the stream is read LSB first
+static void canonical_codes(void) {
+  unsigned int code = 0;
+  for (unsigned int len = 1; len <= MAX_CODE_LENGTH; len++) {
+    for (int i = 0; i < m_num_keys; i++) {
+      if (m_keys[i].code_len != len) {
+        continue;
+      }
+      unsigned int rev = 0;
+      for (unsigned int b = 0; b < len; b++) {
+        if (code & (1u << b)) {
+          rev |= 1u << (len - 1 - b);
+        }
+      }
+      m_keys[i].code = rev;
+      code++;
+    }
+    code <<= 1;
+  }
+}
+
+static void print_key(FILE *f, const char *k) {
+  fputc('"', f);
+  for (const char *c = k; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', f);
+    }
+    fputc(*c, f);
+  }
+  fputc('"', f);
+}
+
+int main(int argc, char **argv) {
+  const char *out = "compression_dict.h";
+  int words = DEFAULT_WORDS;
+  char *texts[256];
+  char *masks[256];
+  int num_texts = 0;
+  unsigned long corpus_bytes = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      out = argv[++i];
+    } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      words = atoi(argv[++i]);
+    } else if (num_texts < 256) {
+      FILE *f = fopen(argv[i], "rb");
+      if (!f) {
+        fprintf(stderr, "Could not open %s\n", argv[i]);
+        return 1;
+      }
+      fseek(f, 0, SEEK_END);
+      long size = ftell(f);
+      fseek(f, 0, SEEK_SET);
+      char *src = malloc((size_t)size + 1);
+      size_t n = fread(src, 1, (size_t)size, f);
+      src[n] = 0;
+      fclose(f);
+      corpus_bytes += n;
+
+      for (char *c = src; *c; c++) {
+        *c = (char)tolower((unsigned char)*c);
+      }
+
+      texts[num_texts] = normalize(src, &masks[num_texts]);
+      num_texts++;
+      free(src);
+    }
+  }
+
+  if (num_texts == 0) {
+    fprintf(stderr, "Usage: %s [-o compression_dict.h] [-w words] file.lisp [file2.lisp ...]\n", argv[0]);
+    return 1;
+  }
+
+  for (const char *c = m_chars; *c; c++) {
+    char k[2] = {*c, 0};
+    add_key(k);
+  }
+  add_key(",@");
+
+  for (int i = 0; i < num_texts; i++) {
+    m_file = i;
+    count_candidates(texts[i], masks[i]);
+  }
+
+  qsort(m_cand, (size_t)m_num_cand, sizeof(cand_t), cmp_savings);
+  for (int i = 0; i < m_num_cand && words > 0 && m_num_keys < MAX_KEYS; i++) {
+    // Words from a single script would not help the others
+    if (m_cand[i].files > 1 || num_texts == 1) {
+      add_key(m_cand[i].word);
+      words--;
+    }
+  }
+
+  for (int i = 0; i < num_texts; i++) {
+    count_keys(texts[i], masks[i]);
+  }
+
+  huffman_lengths();
+  canonical_codes();
+
+  unsigned long bits = 0;
+  for (int i = 0; i < m_num_keys; i++) {
+    bits += (m_keys[i].count - 1) * m_keys[i].code_len;
+  }
+
+  FILE *f = fopen(out, "w");
+  if (!f) {
+    fprintf(stderr, "Could not write %s\n", out);
+    return 1;
+  }
+
+  fprintf(f, "/*\n   Generated by lispBM/tools/lbm_dict from %d files (%lu bytes).\n", num_texts, corpus_bytes);
+  fprintf(f, "   Do not edit, train a new dictionary instead.\n*/\n\n");
+  fprintf(f, "#ifndef COMPRESSION_DICT_H_\n#define COMPRESSION_DICT_H_\n\n");
+  fprintf(f, "#define DICT_NUM_KEYS %d\n", m_num_keys);
+  fprintf(f, "#define DICT_MAX_KEY_LENGTH %d\n", MAX_KEY_LENGTH);
+  fprintf(f, "#define DICT_MAX_CODE_LENGTH %d\n", MAX_CODE_LENGTH);
+
+  int quote = -1;
+  for (int i = 0; i < m_num_keys; i++) {
+    if (strcmp(m_keys[i].key, "\"") == 0) {
+      quote = i;
+    }
+  }
+  fprintf(f, "#define DICT_KEY_STRING %d\n\n", quote);
+
+  fprintf(f, "static const char * const dict_keys[DICT_NUM_KEYS] = {");
+  for (int i = 0; i < m_num_keys; i++) {
+    fprintf(f, i % 6 == 0 ? "\n  " : " ");
+    print_key(f, m_keys[i].key);
+    fprintf(f, ",");
+  }
+  fprintf(f, "\n};\n\n");
+
+  fprintf(f, "static const uint8_t dict_key_lengths[DICT_NUM_KEYS] = {");
+  for (int i = 0; i < m_num_keys; i++) {
+    fprintf(f, "%s%u,", i % 16 == 0 ? "\n  " : " ", m_keys[i].len);
+  }
+  fprintf(f, "\n};\n\n");
+
+  fprintf(f, "/* Codes in the order they are written to the stream, LSB first */\n");
+  fprintf(f, "static const uint16_t dict_codes[DICT_NUM_KEYS] = {");
+  for (int i = 0; i < m_num_keys; i++) {
+    fprintf(f, "%s0x%03X,", i % 10 == 0 ? "\n  " : " ", m_keys[i].code);
+  }
+  fprintf(f, "\n};\n\n");
+
+  fprintf(f, "static const uint8_t dict_code_lengths[DICT_NUM_KEYS] = {");
+  for (int i = 0; i < m_num_keys; i++) {
+    fprintf(f, "%s%u,", i % 16 == 0 ? "\n  " : " ", m_keys[i].code_len);
+  }
+  fprintf(f, "\n};\n\n");
+
+  fprintf(f, "/* Next DICT_MAX_CODE_LENGTH bits of the stream -> (code length << 8) | key */\n");
+  fprintf(f, "static const uint16_t dict_decode[1 << DICT_MAX_CODE_LENGTH] = {");
+  for (unsigned int idx = 0; idx < (1u << MAX_CODE_LENGTH); idx++) {
+    unsigned int entry = 0;
+    for (int i = 0; i < m_num_keys; i++) {
+      unsigned int mask = (1u << m_keys[i].code_len) - 1;
+      if ((idx & mask) == m_keys[i].code) {
+        entry = (m_keys[i].code_len << 8) | (unsigned int)i;
+        break;
+      }
+    }
+    fprintf(f, "%s0x%03X,", idx % 10 == 0 ? "\n  " : " ", entry);
+  }
+  fprintf(f, "\n};\n\n#endif\n");
+  fclose(f);
+
+  printf("Keys: %d, corpus %lu bytes -> %lu bytes of codes (strings excluded)\n",
+      m_num_keys, corpus_bytes, bits / 8);
+  return 0;
+}
@@ -0,0 +1,519 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heap_decode.h"
+#include "symrepr.h"
+
+/* Status bit patterns, same as in lispbm_memory.c */
+#define FREE_OR_USED  0
+#define END           1
+#define START         2
+#define START_END     3
+
+static unsigned int mem_status(const heap_decode_t *h, uint32_t i) {
+  return (h->bitmap[i >> 4] >> ((i & 0xF) << 1)) & 3;
+}
+
+static uint32_t mem_words(const heap_decode_t *h) {
+  uint32_t n = h->hdr.bitmap_words << 4;
+  return n < h->hdr.mem_words ? n : h->hdr.mem_words;
+}
+
+/* Length of the block starting at word i, or 0 if no block starts there */
+static uint32_t block_len(const heap_decode_t *h, uint32_t i) {
+  uint32_t n = mem_words(h);
+  if (i >= n) {
+    return 0;
+  }
+
+  unsigned int s = mem_status(h, i);
+  if (s == START_END) {
+    return 1;
+  }
+  if (s != START) {
+    return 0;
+  }
+
+  for (uint32_t j = i + 1; j < n; j ++) {
+    if (mem_status(h, j) == END) {
+      return j - i + 1;
+    }
+  }
+  return n - i;
+}
+
+/* Word index of the array header that an array cell points to */
+static uint32_t array_word(const heap_decode_t *h, uint32_t cell) {
+  return (h->cells[cell].car - h->hdr.mem_base) >> 2;
+}
+
+static cell_kind_t classify(const cons_t *c) {
+  VALUE cdr = val_clr_gc_mark(c->cdr);
+  if (type_of(cdr) != VAL_TYPE_SYMBOL) {
+    return CELL_CONS;
+  }
+
+  switch (dec_sym(cdr)) {
+  case SYM_ARRAY_TYPE:    return CELL_ARRAY;
+  case SYM_BOXED_I_TYPE:  return CELL_BOXED_I;
+  case SYM_BOXED_U_TYPE:  return CELL_BOXED_U;
+  case SYM_BOXED_F_TYPE:  return CELL_BOXED_F;
+  case SYM_REF_TYPE:      return CELL_REF;
+  case SYM_STREAM_TYPE:   return CELL_STREAM;
+  case SYM_BYTECODE_TYPE: return CELL_BYTECODE;
+  default:                return CELL_CONS;
+  }
+}
+
+/* Values that gc would follow to a cell */
+static bool heap_ref(const heap_decode_t *h, VALUE v, uint32_t *cell) {
+  if (!is_ptr(v)) {
+    return false;
+  }
+
+  TYPE t = ptr_type(v);
+  if (t != PTR_TYPE_CONS && t != PTR_TYPE_BOXED_I && t != PTR_TYPE_BOXED_U &&
+      t != PTR_TYPE_BOXED_F && t != PTR_TYPE_ARRAY && t != PTR_TYPE_REF &&
+      t != PTR_TYPE_STREAM) {
+    return false;
+  }
+
+  uint32_t ix = dec_ptr(v);
+  if (ix >= h->hdr.heap_cells || h->kind[ix] == CELL_FREE) {
+    return false;
+  }
+
+  *cell = ix;
+  return true;
+}
+
+static bool has_children(cell_kind_t kind) {
+  return kind == CELL_CONS || kind == CELL_REF ||
+    kind == CELL_STREAM || kind == CELL_BYTECODE;
+}
+
+/* Breadth first from all roots in order, so that paths are short and
+   each cell is attributed to the first root that reaches it. */
+static void find_reachable(heap_decode_t *h) {
+  uint32_t n = h->hdr.heap_cells;
+  uint32_t *queue = malloc(n * sizeof(uint32_t) + 4);
+  uint32_t head = 0;
+  uint32_t tail = 0;
+
+  for (uint32_t i = 0; i < n; i ++) {
+    h->parent[i] = -1;
+    h->root[i] = -1;
+    h->via_cdr[i] = 0;
+  }
+
+  for (uint32_t r = 0; r < h->hdr.num_roots; r ++) {
+    uint32_t c;
+    if (heap_ref(h, h->roots[r].val, &c) && h->root[c] < 0) {
+      h->root[c] = (int32_t)r;
+      queue[tail++] = c;
+    }
+
+    while (head < tail) {
+      uint32_t p = queue[head++];
+      if (!has_children(h->kind[p])) {
+        continue;
+      }
+
+      VALUE next[2] = {h->cells[p].car, val_clr_gc_mark(h->cells[p].cdr)};
+      for (int j = 0; j < 2; j ++) {
+        if (heap_ref(h, next[j], &c) && h->root[c] < 0) {
+          h->root[c] = (int32_t)r;
+          h->parent[c] = (int32_t)p;
+          h->via_cdr[c] = (uint8_t)j;
+          queue[tail++] = c;
+        }
+      }
+    }
+  }
+
+  free(queue);
+}
+
+bool heap_decode_load(heap_decode_t *h, const uint8_t *data, uint32_t size) {
+  memset(h, 0, sizeof(heap_decode_t));
+
+  if (size < sizeof(heap_snapshot_header_t)) {
+    return false;
+  }
+  memcpy(&h->hdr, data, sizeof(heap_snapshot_header_t));
+
+  if (h->hdr.magic != HEAP_SNAPSHOT_MAGIC || h->hdr.version != HEAP_SNAPSHOT_VERSION) {
+    return false;
+  }
+
+  uint64_t pos = sizeof(heap_snapshot_header_t);
+  uint64_t fixed = pos +
+    (uint64_t)h->hdr.heap_cells * sizeof(cons_t) +
+    (uint64_t)h->hdr.bitmap_words * 4 +
+    (uint64_t)h->hdr.num_arrays * sizeof(heap_snapshot_array_t) +
+    (uint64_t)h->hdr.num_roots * sizeof(heap_snapshot_root_t);
+  if (fixed > size) {
+    return false;
+  }
+
+  h->cells = (const cons_t*)(data + pos);
+  pos += h->hdr.heap_cells * sizeof(cons_t);
+  h->bitmap = (const uint32_t*)(data + pos);
+  pos += h->hdr.bitmap_words * 4;
+  h->arrays = (const heap_snapshot_array_t*)(data + pos);
+  pos += h->hdr.num_arrays * sizeof(heap_snapshot_array_t);
+  h->roots = (const heap_snapshot_root_t*)(data + pos);
+  pos += h->hdr.num_roots * sizeof(heap_snapshot_root_t);
+
+  h->sym_ids = calloc(h->hdr.num_symbols + 1, sizeof(uint32_t));
+  h->sym_names = calloc(h->hdr.num_symbols + 1, sizeof(char*));
+  for (uint32_t i = 0; i < h->hdr.num_symbols; i ++) {
+    if (pos + 5 > size) {
+      heap_decode_free(h);
+      return false;
+    }
+    memcpy(&h->sym_ids[i], data + pos, 4);
+    uint8_t len = data[pos + 4];
+    pos += 5;
+    if (pos + len > size) {
+      heap_decode_free(h);
+      return false;
+    }
+    h->sym_names[i] = calloc(len + 1, 1);
+    memcpy(h->sym_names[i], data + pos, len);
+    pos += len;
+  }
+
+  uint32_t n = h->hdr.heap_cells;
+  h->kind = malloc(n + 1);
+  h->parent = malloc(n * sizeof(int32_t) + 4);
+  h->via_cdr = malloc(n + 1);
+  h->root = malloc(n * sizeof(int32_t) + 4);
+
+  for (uint32_t i = 0; i < n; i ++) {
+    h->kind[i] = (uint8_t)classify(&h->cells[i]);
+  }
+
+  // The free list, with a guard against a corrupt snapshot
+  VALUE fl = h->hdr.freelist;
+  uint32_t steps = 0;
+  while (type_of(fl) == PTR_TYPE_CONS && dec_ptr(fl) < n && steps++ < n) {
+    uint32_t ix = dec_ptr(fl);
+    h->kind[ix] = CELL_FREE;
+    fl = h->cells[ix].cdr;
+  }
+
+  find_reachable(h);
+  return true;
+}
+
+void heap_decode_free(heap_decode_t *h) {
+  if (h->sym_names) {
+    for (uint32_t i = 0; i < h->hdr.num_symbols; i ++) {
+      free(h->sym_names[i]);
+    }
+  }
+  free(h->sym_names);
+  free(h->sym_ids);
+  free(h->kind);
+  free(h->parent);
+  free(h->via_cdr);
+  free(h->root);
+  memset(h, 0, sizeof(heap_decode_t));
+}
+
+void heap_decode_stats(const heap_decode_t *h, heap_decode_stats_t *s) {
+  memset(s, 0, sizeof(heap_decode_stats_t));
+
+  s->cells = h->hdr.heap_cells;
+  for (uint32_t i = 0; i < s->cells; i ++) {
+    cell_kind_t k = (cell_kind_t)h->kind[i];
+    s->kinds[k]++;
+    if (k == CELL_FREE) {
+      s->free++;
+    } else if (h->root[i] >= 0) {
+      s->reachable++;
+    } else {
+      s->kinds_unreachable[k]++;
+    }
+  }
+
+  // Blocks that hold array headers are arrays, the rest is mostly symbol names
+  uint32_t n = mem_words(h);
+  uint8_t *is_array = calloc(n + 1, 1);
+  for (uint32_t i = 0; i < h->hdr.num_arrays; i ++) {
+    uint32_t w = array_word(h, h->arrays[i].cell);
+    if (w < n) {
+      is_array[w] = 1;
+    }
+  }
+
+  s->mem_words = n;
+  uint32_t run = 0;
+  for (uint32_t i = 0; i <= n; i ++) {
+    uint32_t len = i < n ? block_len(h, i) : 0;
+
+    if (i < n && len == 0) {
+      run++;
+      continue;
+    }
+
+    if (run > 0) {
+      s->free_runs++;
+      s->mem_free += run;
+      if (run > s->free_run_max) {
+        s->free_run_max = run;
+      }
+      unsigned int bin = 0;
+      while (bin < 7 && (run >> (bin + 1)) > 0) {
+        bin++;
+      }
+      s->free_run_hist[bin]++;
+      run = 0;
+    }
+
+    if (i == n) {
+      break;
+    }
+
+    if (is_array[i]) {
+      s->array_blocks++;
+      s->mem_arrays += len;
+    } else {
+      s->other_blocks++;
+      s->mem_other += len;
+    }
+    i += len - 1;
+  }
+
+  free(is_array);
+}
+
+uint32_t heap_decode_retained(const heap_decode_t *h, VALUE v, uint32_t *array_words) {
+  uint32_t n = h->hdr.heap_cells;
+  uint8_t *seen = calloc(n + 1, 1);
+  uint32_t *stack = malloc(n * sizeof(uint32_t) + 4);
+  uint32_t sp = 0;
+  uint32_t cells = 0;
+  uint32_t words = 0;
+
+  uint32_t c;
+  if (heap_ref(h, v, &c)) {
+    seen[c] = 1;
+    stack[sp++] = c;
+  }
+
+  while (sp > 0) {
+    uint32_t p = stack[--sp];
+    cells++;
+
+    if (h->kind[p] == CELL_ARRAY) {
+      words += block_len(h, array_word(h, p));
+    }
+
+    if (!has_children(h->kind[p])) {
+      continue;
+    }
+
+    VALUE next[2] = {h->cells[p].car, val_clr_gc_mark(h->cells[p].cdr)};
+    for (int j = 0; j < 2; j ++) {
+      if (heap_ref(h, next[j], &c) && !seen[c]) {
+        seen[c] = 1;
+        stack[sp++] = c;
+      }
+    }
+  }
+
+  free(stack);
+  free(seen);
+
+  if (array_words) {
+    *array_words = words;
+  }
+  return cells;
+}
+
+const char *heap_decode_sym_name(const heap_decode_t *h, uint32_t id) {
+  for (uint32_t i = 0; i < h->hdr.num_symbols; i ++) {
+    if (h->sym_ids[i] == id) {
+      return h->sym_names[i];
+    }
+  }
+  return NULL;
+}
+
+const char *heap_decode_kind_name(cell_kind_t kind) {
+  switch (kind) {
+  case CELL_FREE:     return "free";
+  case CELL_CONS:     return "cons";
+  case CELL_BOXED_I:  return "boxed i32";
+  case CELL_BOXED_U:  return "boxed u32";
+  case CELL_BOXED_F:  return "boxed float";
+  case CELL_ARRAY:    return "array";
+  case CELL_REF:      return "ref";
+  case CELL_STREAM:   return "stream";
+  case CELL_BYTECODE: return "bytecode";
+  default:            return "unknown";
+  }
+}
+
+void heap_decode_root_name(const heap_decode_t *h, uint32_t root, char *buf, size_t len) {
+  const heap_snapshot_root_t *r = &h->roots[root];
+
+  switch (r->kind) {
+  case HEAP_SNAPSHOT_ROOT_GLOBAL: {
+    const char *name = heap_decode_sym_name(h, r->id);
+    if (name) {
+      snprintf(buf, len, "%s", name);
+    } else {
+      snprintf(buf, len, "sym %u", r->id);
+    }
+  } break;
+  case HEAP_SNAPSHOT_ROOT_ENV:
+    snprintf(buf, len, "global env");
+    break;
+  case HEAP_SNAPSHOT_ROOT_CTX:
+    snprintf(buf, len, "ctx %u", r->id);
+    break;
+  case HEAP_SNAPSHOT_ROOT_STACK:
+    snprintf(buf, len, "ctx %u stack", r->id);
+    break;
+  default:
+    snprintf(buf, len, "root %u", root);
+    break;
+  }
+}
+
+static size_t append(char *buf, size_t len, size_t pos, const char *step, uint32_t count) {
+  if (pos >= len) {
+    return pos;
+  }
+  int res = count > 1 ?
+    snprintf(buf + pos, len - pos, " %s x%u", step, count) :
+    snprintf(buf + pos, len - pos, " %s", step);
+  return res > 0 ? pos + (size_t)res : pos;
+}
+
+void heap_decode_path(const heap_decode_t *h, uint32_t cell, char *buf, size_t len) {
+  if (cell >= h->hdr.heap_cells || h->root[cell] < 0) {
+    snprintf(buf, len, "unreachable");
+    return;
+  }
+
+  // Steps from the root, collected backwards
+  uint32_t n = 0;
+  uint8_t *steps = malloc(h->hdr.heap_cells + 1);
+  int32_t c = (int32_t)cell;
+  while (h->parent[c] >= 0) {
+    steps[n++] = h->via_cdr[c];
+    c = h->parent[c];
+  }
+
+  heap_decode_root_name(h, (uint32_t)h->root[cell], buf, len);
+  size_t pos = strlen(buf);
+
+  // Repeated steps are counted, so long lists stay readable
+  while (n > 0) {
+    uint8_t step = steps[n - 1];
+    uint32_t count = 0;
+    while (n > 0 && steps[n - 1] == step) {
+      count++;
+      n--;
+    }
+    pos = append(buf, len, pos, step ? "cdr" : "car", count);
+  }
+
+  free(steps);
+}
+
+typedef struct {
+  uint8_t r, g, b;
+} rgb_t;
+
+static const rgb_t kind_colors[CELL_KINDS] = {
+  {40, 40, 40},     // free
+  {60, 110, 230},   // cons
+  {60, 200, 90},    // boxed i
+  {60, 200, 90},    // boxed u
+  {150, 230, 60},   // boxed f
+  {250, 160, 30},   // array
+  {190, 80, 220},   // ref
+  {190, 80, 220},   // stream
+  {230, 230, 230},  // bytecode
+};
+
+bool heap_decode_write_ppm(const heap_decode_t *h, const char *path) {
+  const uint32_t width = 64;
+  uint32_t n = h->hdr.heap_cells;
+  uint32_t words = mem_words(h);
+  uint32_t rows_cells = (n + width - 1) / width;
+  uint32_t rows_mem = (words + width - 1) / width;
+  uint32_t height = rows_cells + 1 + rows_mem;
+
+  rgb_t *pix = calloc(width * height, sizeof(rgb_t));
+  if (!pix) {
+    return false;
+  }
+
+  // Unreachable cells in red, as they are what the next gc recovers
+  for (uint32_t i = 0; i < n; i ++) {
+    cell_kind_t k = (cell_kind_t)h->kind[i];
+    rgb_t col = kind_colors[k];
+    if (k != CELL_FREE && h->root[i] < 0) {
+      col.r = 220; col.g = 40; col.b = 40;
+    }
+    pix[i] = col;
+  }
+
+  rgb_t *mem = pix + (rows_cells + 1) * width;
+  for (uint32_t i = 0; i < words; i ++) {
+    mem[i] = kind_colors[CELL_FREE];
+  }
+
+  for (uint32_t i = 0; i < words; i ++) {
+    uint32_t len = block_len(h, i);
+    for (uint32_t j = 0; j < len; j ++) {
+      mem[i + j].r = 60; mem[i + j].g = 190; mem[i + j].b = 200;
+    }
+    if (len > 0) {
+      i += len - 1;
+    }
+  }
+
+  for (uint32_t i = 0; i < h->hdr.num_arrays; i ++) {
+    uint32_t w = array_word(h, h->arrays[i].cell);
+    uint32_t len = block_len(h, w);
+    for (uint32_t j = 0; j < len; j ++) {
+      mem[w + j] = kind_colors[CELL_ARRAY];
+    }
+  }
+
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    free(pix);
+    return false;
+  }
+  fprintf(f, "P6\n%u %u\n255\n", width, height);
+  fwrite(pix, sizeof(rgb_t), width * height, f);
+  fclose(f);
+  free(pix);
+  return true;
+}
@@ -0,0 +1,92 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HEAP_DECODE_H_
+#define HEAP_DECODE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "heap.h"
+#include "heap_snapshot.h"
+
+/* What a cell is used for, as far as the snapshot tells */
+typedef enum {
+  CELL_FREE = 0,
+  CELL_CONS,
+  CELL_BOXED_I,
+  CELL_BOXED_U,
+  CELL_BOXED_F,
+  CELL_ARRAY,
+  CELL_REF,
+  CELL_STREAM,
+  CELL_BYTECODE,
+  CELL_KINDS
+} cell_kind_t;
+
+typedef struct {
+  heap_snapshot_header_t hdr;
+  const cons_t *cells;
+  const uint32_t *bitmap;
+  const heap_snapshot_array_t *arrays;
+  const heap_snapshot_root_t *roots;
+  uint32_t *sym_ids;
+  char **sym_names;
+
+  uint8_t *kind;        // cell_kind_t per cell
+  int32_t *parent;      // Cell this one was first reached from, -1 if from a root
+  uint8_t *via_cdr;     // Reached through the cdr of the parent
+  int32_t *root;        // First root that reaches the cell, -1 if unreachable
+} heap_decode_t;
+
+typedef struct {
+  uint32_t cells;
+  uint32_t free;
+  uint32_t reachable;
+  uint32_t kinds[CELL_KINDS];
+  uint32_t kinds_unreachable[CELL_KINDS];
+
+  uint32_t mem_words;
+  uint32_t mem_free;
+  uint32_t mem_arrays;      // Words in array blocks, headers included
+  uint32_t mem_other;       // Words in other blocks, mostly symbol names
+  uint32_t array_blocks;
+  uint32_t other_blocks;
+  uint32_t free_runs;
+  uint32_t free_run_max;
+  uint32_t free_run_hist[8];  // Free runs of 1, 2-3, 4-7, ..., 128+ words
+} heap_decode_stats_t;
+
+extern bool heap_decode_load(heap_decode_t *h, const uint8_t *data, uint32_t size);
+extern void heap_decode_free(heap_decode_t *h);
+extern void heap_decode_stats(const heap_decode_t *h, heap_decode_stats_t *s);
+
+/* Cells and array words reachable from v, shared structure included */
+extern uint32_t heap_decode_retained(const heap_decode_t *h, VALUE v, uint32_t *array_words);
+
+extern const char *heap_decode_sym_name(const heap_decode_t *h, uint32_t id);
+extern const char *heap_decode_kind_name(cell_kind_t kind);
+extern void heap_decode_root_name(const heap_decode_t *h, uint32_t root, char *buf, size_t len);
+
+/* Describes how the cell is reached, e.g. "my-list cdr x12 car" */
+extern void heap_decode_path(const heap_decode_t *h, uint32_t cell, char *buf, size_t len);
+
+/* One pixel per cell, then one per word of array memory */
+extern bool heap_decode_write_ppm(const heap_decode_t *h, const char *path);
+
+#endif
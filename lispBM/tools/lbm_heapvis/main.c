@@ -0,0 +1,239 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Decodes heap snapshots read with COMM_LISP_HEAP_SNAPSHOT and prints
+ * what is filling the heap and the array memory, to help with choosing
+ * HEAP_SIZE and LISP_MEM_SIZE for a board.
+ *
+ * Usage: lbm_heapvis [-n top] [-p image.ppm] snapshot.bin
+ *
+ * The image has one pixel per cell, colored by type with unreachable
+ * cells in red, followed by one pixel per word of array memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heap_decode.h"
+
+typedef struct {
+  uint32_t root;
+  uint32_t cells;
+  uint32_t words;
+} retention_t;
+
+static uint8_t *read_file(const char *path, uint32_t *size) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return NULL;
+  }
+
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  uint8_t *data = malloc(len > 0 ? (size_t)len : 1);
+  if (!data || fread(data, 1, (size_t)len, f) != (size_t)len) {
+    free(data);
+    fclose(f);
+    return NULL;
+  }
+
+  fclose(f);
+  *size = (uint32_t)len;
+  return data;
+}
+
+static double percent(uint32_t part, uint32_t total) {
+  return total > 0 ? 100.0 * (double)part / (double)total : 0.0;
+}
+
+static int cmp_retention(const void *a, const void *b) {
+  const retention_t *ra = a;
+  const retention_t *rb = b;
+  uint32_t sa = ra->cells * 2 + ra->words;
+  uint32_t sb = rb->cells * 2 + rb->words;
+  return sa < sb ? 1 : (sa > sb ? -1 : 0);
+}
+
+static void print_heap(const heap_decode_t *h, const heap_decode_stats_t *s) {
+  uint32_t used = s->cells - s->free;
+
+  printf("Heap: %u cells, %u bytes, gc runs: %u\n",
+         s->cells, s->cells * 8, h->hdr.gc_num);
+  printf("  used        %6u  %5.1f %%\n", used, percent(used, s->cells));
+  printf("  reachable   %6u  %5.1f %%\n", s->reachable, percent(s->reachable, s->cells));
+  printf("  garbage     %6u  %5.1f %%\n", used - s->reachable, percent(used - s->reachable, s->cells));
+  printf("  free        %6u  %5.1f %%\n", s->free, percent(s->free, s->cells));
+
+  printf("\nCell types:           cells   garbage\n");
+  for (int k = CELL_CONS; k < CELL_KINDS; k ++) {
+    if (s->kinds[k] > 0) {
+      printf("  %-16s   %6u    %6u\n", heap_decode_kind_name((cell_kind_t)k),
+             s->kinds[k], s->kinds_unreachable[k]);
+    }
+  }
+}
+
+static void print_memory(const heap_decode_stats_t *s) {
+  printf("\nArray and symbol memory: %u words, %u bytes\n", s->mem_words, s->mem_words * 4);
+  printf("  arrays      %6u words in %u blocks\n", s->mem_arrays, s->array_blocks);
+  printf("  other       %6u words in %u blocks\n", s->mem_other, s->other_blocks);
+  printf("  free        %6u words in %u runs, largest %u\n",
+         s->mem_free, s->free_runs, s->free_run_max);
+
+  // The share of free memory that is not in the largest run is what
+  // fragmentation costs for the next large allocation
+  if (s->mem_free > 0) {
+    printf("  fragmentation %.1f %%\n", percent(s->mem_free - s->free_run_max, s->mem_free));
+  }
+
+  printf("  free runs:");
+  for (int i = 0; i < 8; i ++) {
+    if (s->free_run_hist[i] > 0) {
+      if (i == 7) {
+        printf(" %u+: %u", 1u << i, s->free_run_hist[i]);
+      } else {
+        printf(" %u-%u: %u", 1u << i, (2u << i) - 1, s->free_run_hist[i]);
+      }
+    }
+  }
+  printf("\n");
+}
+
+static void print_retention(const heap_decode_t *h, int top) {
+  retention_t *r = calloc(h->hdr.num_roots + 1, sizeof(retention_t));
+  uint32_t n = 0;
+
+  for (uint32_t i = 0; i < h->hdr.num_roots; i ++) {
+    if (h->roots[i].kind == HEAP_SNAPSHOT_ROOT_GLOBAL) {
+      r[n].root = i;
+      r[n].cells = heap_decode_retained(h, h->roots[i].val, &r[n].words);
+      n++;
+    }
+  }
+  qsort(r, n, sizeof(retention_t), cmp_retention);
+
+  printf("\nRetained by global bindings, shared structure counted for each:\n");
+  printf("  %-24s  cells  array words\n", "binding");
+  for (uint32_t i = 0; i < n && (int)i < top; i ++) {
+    if (r[i].cells == 0) {
+      break;
+    }
+    char name[64];
+    heap_decode_root_name(h, r[i].root, name, sizeof(name));
+    printf("  %-24s %6u  %6u\n", name, r[i].cells, r[i].words);
+  }
+
+  // Cells that only contexts reach, attributed to the first root found
+  uint32_t ctx_cells = 0;
+  for (uint32_t i = 0; i < h->hdr.heap_cells; i ++) {
+    if (h->root[i] >= 0 && (h->roots[h->root[i]].kind == HEAP_SNAPSHOT_ROOT_CTX ||
+                            h->roots[h->root[i]].kind == HEAP_SNAPSHOT_ROOT_STACK)) {
+      ctx_cells++;
+    }
+  }
+  printf("  %-24s %6u\n", "(contexts only)", ctx_cells);
+
+  free(r);
+}
+
+static void print_arrays(const heap_decode_t *h, int top) {
+  uint32_t n = h->hdr.num_arrays;
+  if (n == 0) {
+    return;
+  }
+
+  heap_snapshot_array_t *a = malloc(n * sizeof(heap_snapshot_array_t));
+  memcpy(a, h->arrays, n * sizeof(heap_snapshot_array_t));
+
+  // Largest first, by a simple selection as there are few arrays
+  printf("\nLargest arrays:\n");
+  for (int i = 0; i < top && (uint32_t)i < n; i ++) {
+    uint32_t best = (uint32_t)i;
+    for (uint32_t j = (uint32_t)i + 1; j < n; j ++) {
+      if (a[j].size > a[best].size) {
+        best = j;
+      }
+    }
+    heap_snapshot_array_t tmp = a[i];
+    a[i] = a[best];
+    a[best] = tmp;
+
+    char path[256];
+    heap_decode_path(h, a[i].cell, path, sizeof(path));
+    const char *type =
+      a[i].elt_type == VAL_TYPE_CHAR ? "byte" :
+      a[i].elt_type == PTR_TYPE_BOXED_F ? "float" : "word";
+    printf("  %6u %-5s  %s\n", a[i].size, type, path);
+  }
+
+  free(a);
+}
+
+int main(int argc, char **argv) {
+  const char *ppm = NULL;
+  const char *in = NULL;
+  int top = 10;
+
+  for (int i = 1; i < argc; i ++) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      ppm = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      top = atoi(argv[++i]);
+    } else {
+      in = argv[i];
+    }
+  }
+
+  if (!in) {
+    fprintf(stderr, "Usage: lbm_heapvis [-n top] [-p image.ppm] snapshot.bin\n");
+    return 1;
+  }
+
+  uint32_t size = 0;
+  uint8_t *data = read_file(in, &size);
+  if (!data) {
+    fprintf(stderr, "Could not read %s\n", in);
+    return 1;
+  }
+
+  heap_decode_t h;
+  if (!heap_decode_load(&h, data, size)) {
+    fprintf(stderr, "%s is not a valid heap snapshot\n", in);
+    free(data);
+    return 1;
+  }
+
+  heap_decode_stats_t s;
+  heap_decode_stats(&h, &s);
+
+  print_heap(&h, &s);
+  print_memory(&s);
+  print_retention(&h, top);
+  print_arrays(&h, top);
+
+  if (ppm && !heap_decode_write_ppm(&h, ppm)) {
+    fprintf(stderr, "Could not write %s\n", ppm);
+  }
+
+  heap_decode_free(&h);
+  free(data);
+  return 0;
+}
@@ -0,0 +1,231 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "image_writer.h"
+#include "heap_image.h"
+#include "heap.h"
+#include "symrepr.h"
+#include "lispbm_memory.h"
+
+#define UNMAPPED 0xFFFFFFFFu
+
+#define WRITER_MEM_SIZE    MEMORY_SIZE_1M
+#define WRITER_BITMAP_SIZE MEMORY_BITMAP_SIZE_1M
+
+typedef struct {
+  cons_t *heap;
+  UINT *cell_map;       // heap index -> image index
+  UINT *cell_src;       // image index -> heap index
+  unsigned int num_cells;
+
+  UINT *syms;           // runtime ids of the symbols in the image
+  unsigned int num_symbols;
+
+  uint32_t *arrays;
+  unsigned int array_words;
+  unsigned int array_cap;
+} writer_state;
+
+static uint32_t *m_mem = NULL;
+static cons_t *m_heap = NULL;
+static unsigned int m_heap_cells = 0;
+
+int image_writer_init(unsigned int heap_cells) {
+  if (!m_mem) {
+    void *mem = mmap(NULL,
+                     (WRITER_MEM_SIZE + WRITER_BITMAP_SIZE) * 4,
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+
+    if (mem == MAP_FAILED) {
+      return 0;
+    }
+    m_mem = mem;
+  }
+
+  free(m_heap);
+  m_heap = aligned_alloc(8, heap_cells * sizeof(cons_t));
+  m_heap_cells = heap_cells;
+
+  if (!m_heap ||
+      !memory_init(m_mem, WRITER_MEM_SIZE, m_mem + WRITER_MEM_SIZE, WRITER_BITMAP_SIZE) ||
+      !symrepr_init() ||
+      !heap_init(m_heap, heap_cells)) {
+    return 0;
+  }
+
+  return 1;
+}
+
+static UINT image_sym(writer_state *s, UINT id) {
+  for (unsigned int i = 0; i < s->num_symbols; i ++) {
+    if (s->syms[i] == id) {
+      return MAX_SPECIAL_SYMBOLS + i;
+    }
+  }
+
+  s->syms[s->num_symbols] = id;
+  return MAX_SPECIAL_SYMBOLS + s->num_symbols++;
+}
+
+static VALUE image_value(writer_state *s, VALUE v) {
+  if (is_ptr(v)) {
+    UINT ix = dec_ptr(v);
+
+    if (s->cell_map[ix] == UNMAPPED) {
+      s->cell_map[ix] = s->num_cells;
+      s->cell_src[s->num_cells++] = ix;
+    }
+
+    return set_ptr_type(enc_cons_ptr(s->cell_map[ix]), ptr_type(v));
+  }
+
+  if (val_type(v) == VAL_TYPE_SYMBOL && dec_sym(v) >= MAX_SPECIAL_SYMBOLS) {
+    return enc_sym(image_sym(s, dec_sym(v)));
+  }
+
+  return v;
+}
+
+static int image_array(writer_state *s, const array_header_t *arr, UINT *offset) {
+  unsigned int words = arr->size;
+  if (arr->elt_type == VAL_TYPE_CHAR) {
+    words = (arr->size + 3) / 4;
+  }
+
+  if (s->array_words + 2 + words > s->array_cap) {
+    unsigned int cap = 2 * (s->array_cap + 2 + words);
+    uint32_t *a = realloc(s->arrays, cap * 4);
+    if (!a) {
+      return 0;
+    }
+    s->arrays = a;
+    s->array_cap = cap;
+  }
+
+  *offset = s->array_words;
+  memcpy(s->arrays + s->array_words, arr, (2 + words) * 4);
+  s->array_words += 2 + words;
+  return 1;
+}
+
+int image_writer_write(VALUE prg, uint8_t **image, unsigned int *size) {
+  writer_state s;
+  memset(&s, 0, sizeof(s));
+
+  int res = 0;
+  uint8_t *buf = NULL;
+  cons_t *cells = NULL;
+
+  s.heap = m_heap;
+  s.cell_map = malloc(m_heap_cells * sizeof(UINT));
+  s.cell_src = malloc(m_heap_cells * sizeof(UINT));
+  s.syms = malloc((2 * m_heap_cells + 1) * sizeof(UINT));
+  cells = malloc(m_heap_cells * sizeof(cons_t));
+
+  if (!s.cell_map || !s.cell_src || !s.syms || !cells) {
+    goto done;
+  }
+
+  for (unsigned int i = 0; i < m_heap_cells; i ++) {
+    s.cell_map[i] = UNMAPPED;
+  }
+
+  // Breadth first over the reachable cells, numbering them in the order
+  // they are found.
+  VALUE root = image_value(&s, prg);
+
+  for (unsigned int i = 0; i < s.num_cells; i ++) {
+    cons_t *src = &s.heap[s.cell_src[i]];
+    VALUE cdr = val_clr_gc_mark(src->cdr);
+
+    if (type_of(cdr) == VAL_TYPE_SYMBOL && dec_sym(cdr) == SYM_ARRAY_TYPE) {
+      if (!image_array(&s, (array_header_t*)src->car, &cells[i].car)) {
+        goto done;
+      }
+      cells[i].cdr = cdr;
+    } else if (type_of(cdr) == VAL_TYPE_SYMBOL &&
+               (dec_sym(cdr) == SYM_BOXED_I_TYPE ||
+                dec_sym(cdr) == SYM_BOXED_U_TYPE ||
+                dec_sym(cdr) == SYM_BOXED_F_TYPE)) {
+      cells[i].car = src->car;
+      cells[i].cdr = cdr;
+    } else {
+      cells[i].car = image_value(&s, src->car);
+      cells[i].cdr = image_value(&s, cdr);
+    }
+  }
+
+  unsigned int symbol_bytes = 0;
+  for (unsigned int i = 0; i < s.num_symbols; i ++) {
+    symbol_bytes += strlen(symrepr_lookup_name(s.syms[i])) + 1;
+  }
+  symbol_bytes = (symbol_bytes + 3) & ~3u;
+
+  heap_image_header_t hdr;
+  hdr.magic = HEAP_IMAGE_MAGIC;
+  hdr.version = HEAP_IMAGE_VERSION;
+  hdr.num_cells = s.num_cells;
+  hdr.array_words = s.array_words;
+  hdr.num_symbols = s.num_symbols;
+  hdr.symbol_bytes = symbol_bytes;
+  hdr.root = root;
+  hdr.checksum = 0;
+
+  unsigned int len = heap_image_size(&hdr);
+  buf = calloc(1, len);
+  if (!buf) {
+    goto done;
+  }
+
+  uint8_t *p = buf + sizeof(hdr);
+  memcpy(p, cells, s.num_cells * sizeof(cons_t));
+  p += s.num_cells * sizeof(cons_t);
+  if (s.array_words > 0) {
+    memcpy(p, s.arrays, s.array_words * 4);
+  }
+  p += s.array_words * 4;
+  for (unsigned int i = 0; i < s.num_symbols; i ++) {
+    const char *name = symrepr_lookup_name(s.syms[i]);
+    strcpy((char*)p, name);
+    p += strlen(name) + 1;
+  }
+
+  memcpy(buf, &hdr, sizeof(hdr));
+  ((heap_image_header_t*)buf)->checksum =
+    heap_image_checksum((heap_image_header_t*)buf);
+
+  *image = buf;
+  *size = len;
+  buf = NULL;
+  res = 1;
+
+  done:
+  free(buf);
+  free(cells);
+  free(s.cell_map);
+  free(s.cell_src);
+  free(s.syms);
+  free(s.arrays);
+  return res;
+}
@@ -0,0 +1,33 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_WRITER_H_
+#define IMAGE_WRITER_H_
+
+#include <stdint.h>
+
+#include "lispbm_types.h"
+
+// Host side runtime for the reader. The memory area has to be below 4 GB
+// as arrays and symbol names are stored as 32 bit addresses in the heap.
+extern int image_writer_init(unsigned int heap_cells);
+
+// Serialize everything reachable from prg into a heap image. The result
+// is allocated with malloc. Returns 0 on failure.
+extern int image_writer_write(VALUE prg, uint8_t **image, unsigned int *size);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+    Copyright 2022 Benjamin Vedder      benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Serializes lisp programs into heap images that lispif can load
+ * from the code area in flash without parsing them on the target.
+ *
+ * Usage: lbm_image [-o out.bin] [-c cells] [-z] file.lisp [file2.lisp ...]
+ *
+ * All files are read as one program in the order they are given, so
+ * the prelude is added by passing it first.
+ *
+ * With -z the source is compressed instead. lispif then decompresses,
+ * parses and evaluates it one top level form at a time, which needs less
+ * heap than an image for programs that do not keep everything they run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_writer.h"
+#include "heap_image.h"
+#include "heap.h"
+#include "tokpar.h"
+#include "compression.h"
+
+#define WRITER_HEAP_CELLS 65536
+
+static int write_file(const char *path, const uint8_t *data, unsigned int size) {
+  FILE *f = fopen(path, "wb");
+  if (!f || fwrite(data, 1, size, f) != size) {
+    fprintf(stderr, "Could not write %s\n", path);
+    if (f) {
+      fclose(f);
+    }
+    return 0;
+  }
+  fclose(f);
+  return 1;
+}
+
+static int write_compressed(const char *path, char *src) {
+  uint32_t size;
+  char *compressed = compression_compress(src, &size);
+  if (!compressed) {
+    fprintf(stderr, "Could not compress program\n");
+    return 1;
+  }
+
+  uint8_t *buf = malloc(size + 4);
+  uint32_t magic = COMPRESSION_CODE_MAGIC;
+  memcpy(buf, &magic, 4);
+  memcpy(buf + 4, compressed, size);
+  free(compressed);
+
+  printf("Size:    %u bytes\n", size + 4);
+
+  int res = write_file(path, buf, size + 4);
+  free(buf);
+  return res ? 0 : 1;
+}
+
+static char *append_file(char *buf, size_t *len, const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Could not open %s\n", path);
+    return NULL;
+  }
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  char *res = realloc(buf, *len + (size_t)size + 2);
+  if (!res) {
+    fclose(f);
+    return NULL;
+  }
+
+  size_t n = fread(res + *len, 1, (size_t)size, f);
+  fclose(f);
+
+  *len += n;
+  res[(*len)++] = '\n';
+  res[*len] = 0;
+  return res;
+}
+
+int main(int argc, char **argv) {
+  const char *out = "image.bin";
+  unsigned int max_cells = 1024;
+  int compress = 0;
+  char *src = NULL;
+  size_t src_len = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      out = argv[++i];
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      max_cells = (unsigned int)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "-z") == 0) {
+      compress = 1;
+    } else {
+      src = append_file(src, &src_len, argv[i]);
+      if (!src) {
+        return 1;
+      }
+    }
+  }
+
+  if (!src) {
+    fprintf(stderr, "Usage: %s [-o out.bin] [-c cells] [-z] file.lisp [file2.lisp ...]\n", argv[0]);
+    return 1;
+  }
+
+  if (compress) {
+    return write_compressed(out, src);
+  }
+
+  if (!image_writer_init(WRITER_HEAP_CELLS)) {
+    fprintf(stderr, "Could not initialize the runtime\n");
+    return 1;
+  }
+
+  VALUE prg = tokpar_parse(src);
+  if (type_of(prg) == VAL_TYPE_SYMBOL &&
+      (dec_sym(prg) == SYM_RERROR || dec_sym(prg) == SYM_MERROR)) {
+    fprintf(stderr, "Parse error\n");
+    return 1;
+  }
+
+  uint8_t *image;
+  unsigned int size;
+  if (!image_writer_write(prg, &image, &size)) {
+    fprintf(stderr, "Could not serialize program\n");
+    return 1;
+  }
+
+  heap_image_header_t *hdr = (heap_image_header_t*)image;
+  printf("Cells:   %u\n", hdr->num_cells);
+  printf("Arrays:  %u words\n", hdr->array_words);
+  printf("Symbols: %u (%u bytes)\n", hdr->num_symbols, hdr->symbol_bytes);
+  printf("Size:    %u bytes\n", size);
+
+  if (hdr->num_cells > max_cells) {
+    fprintf(stderr, "The program needs %u cells, but the heap only has %u\n",
+            hdr->num_cells, max_cells);
+    return 1;
+  }
+
+  if (!write_file(out, image, size)) {
+    return 1;
+  }
+
+  free(image);
+  free(src);
+  return 0;
+}
@@ -54,6 +54,8 @@
 #include "shutdown.h"
 #include "mempools.h"
 #include "events.h"
+#include "setpoint_stream.h"
+#include "torque_vectoring.h"
 #include "main.h"
 
 #ifdef USE_LISPBM
@@ -249,8 +251,10 @@ int main(void) {
 
 	ledpwm_init();
 	mc_interface_init();
+	setpoint_stream_init();
 
 	commands_init();
+	torque_vectoring_init();
 
 #if COMM_USE_USB
 	comm_usb_init();
@@ -39,6 +39,7 @@
 #include "crc.h"
 #include "bms.h"
 #include "events.h"
+#include "setpoint_stream.h"
 
 #include <math.h>
 #include <stdlib.h>
@@ -130,6 +131,7 @@ static volatile motor_if_state_t *motor_now(void);
 
 // Function pointers
 static void(*pwn_done_func)(void) = 0;
+static void(*adc_sample_func)(void) = 0;
 
 // Threads
 static THD_WORKING_AREA(timer_thread_wa, 1024);
@@ -515,6 +517,21 @@ void mc_interface_set_pwm_callback(void (*p_func)(void)) {
 	pwn_done_func = p_func;
 }
 
+/**
+ * Set a function that should be called after each PWM cycle of the first
+ * motor, when new ADC samples are available. This is for inputs that are
+ * oversampled in sync with the PWM, and is separate from the PWM callback so
+ * that a custom app can use that at the same time.
+ *
+ * Note: this function is called from an interrupt.
+ *
+ * @param p_func
+ * The function to be called. 0 will not call any function.
+ */
+void mc_interface_set_adc_sample_callback(void (*p_func)(void)) {
+	adc_sample_func = p_func;
+}
+
 /**
  * Lock the control by disabling all control commands.
  */
@@ -710,6 +727,93 @@ void mc_interface_set_pid_pos(float pos) {
 	events_add("set_pid_pos", pos);
 }
 
+/**
+ * Convert a position from the user frame to the frame used by the position
+ * controller, with offset, direction and encoder inversion applied.
+ */
+static float pos_to_controller(float pos) {
+	pos += motor_now()->m_conf.p_pid_offset;
+	pos *= DIR_MULT;
+
+	if (encoder_is_configured()) {
+		if (motor_now()->m_conf.foc_encoder_inverted) {
+			pos *= -1.0;
+		}
+	}
+
+	utils_norm_angle(&pos);
+	return pos;
+}
+
+/**
+ * Move to a position using a jerk-limited trajectory with feedforward. This
+ * requires FOC, with other motor types the position is set directly.
+ *
+ * @param pos
+ * The goal position in degrees.
+ */
+void mc_interface_set_pid_pos_traj(float pos) {
+	SHUTDOWN_RESET();
+
+	if (mc_interface_try_input()) {
+		return;
+	}
+
+	motor_now()->m_position_set = pos;
+	pos = pos_to_controller(pos);
+
+	switch (motor_now()->m_conf.motor_type) {
+	case MOTOR_TYPE_BLDC:
+	case MOTOR_TYPE_DC:
+		mcpwm_set_pid_pos(pos);
+		break;
+
+	case MOTOR_TYPE_FOC:
+		mcpwm_foc_set_pid_pos_traj(pos);
+		break;
+
+	default:
+		break;
+	}
+
+	events_add("set_pid_pos_traj", pos);
+}
+
+/**
+ * Queue a waypoint for streaming a position path. Only supported with FOC.
+ *
+ * @param pos
+ * The waypoint position in degrees.
+ *
+ * @param vel
+ * The velocity when passing the waypoint in degrees/s. Use 0 for the last waypoint.
+ *
+ * @return
+ * true if the waypoint was queued, false if the queue was full or the
+ * motor type does not support it.
+ */
+bool mc_interface_push_pid_pos_waypoint(float pos, float vel) {
+	SHUTDOWN_RESET();
+
+	if (mc_interface_try_input()) {
+		return false;
+	}
+
+	if (motor_now()->m_conf.motor_type != MOTOR_TYPE_FOC) {
+		return false;
+	}
+
+	motor_now()->m_position_set = pos;
+	pos = pos_to_controller(pos);
+
+	vel *= DIR_MULT;
+	if (encoder_is_configured() && motor_now()->m_conf.foc_encoder_inverted) {
+		vel *= -1.0;
+	}
+
+	return mcpwm_foc_push_pid_pos_waypoint(pos, vel);
+}
+
 void mc_interface_set_current(float current) {
 	if (fabsf(current) > 0.001) {
 		SHUTDOWN_RESET();
@@ -1820,6 +1924,10 @@ void mc_interface_mc_timer_isr(bool is_second_motor) {
 		pwn_done_func();
 	}
 
+	if (adc_sample_func && !is_second_motor) {
+		adc_sample_func();
+	}
+
 	motor->m_motor_current_sum += current_filtered;
 	motor->m_input_current_sum += current_in_filtered;
 	motor->m_motor_current_iterations++;
@@ -2551,6 +2659,8 @@ static void run_timer_tasks(volatile motor_if_state_t *motor) {
 #ifdef HW_HAS_WHEEL_SPEED_SENSOR
 	hw_update_speed_sensor();
 #endif
+
+	setpoint_stream_run();
 }
 
 static THD_FUNCTION(timer_thread, arg) {
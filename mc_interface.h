@@ -33,6 +33,7 @@ void mc_interface_set_configuration(mc_configuration *configuration);
 unsigned mc_interface_calc_crc(mc_configuration* conf, bool is_motor_2);
 bool mc_interface_dccal_done(void);
 void mc_interface_set_pwm_callback(void (*p_func)(void));
+void mc_interface_set_adc_sample_callback(void (*p_func)(void));
 void mc_interface_lock(void);
 void mc_interface_unlock(void);
 void mc_interface_lock_override_once(void);
@@ -43,6 +44,8 @@ void mc_interface_set_duty(float dutyCycle);
 void mc_interface_set_duty_noramp(float dutyCycle);
 void mc_interface_set_pid_speed(float rpm);
 void mc_interface_set_pid_pos(float pos);
+void mc_interface_set_pid_pos_traj(float pos);
+bool mc_interface_push_pid_pos_waypoint(float pos, float vel);
 void mc_interface_set_current(float current);
 void mc_interface_set_brake_current(float current);
 void mc_interface_set_current_rel(float val);
@@ -40,6 +40,11 @@
 #include <stdio.h>
 #include "virtual_motor.h"
 #include "digital_filter.h"
+#include "trajectory.h"
+#include "foc_svm.h"
+#include "foc_dtc.h"
+#include "foc_hall.h"
+#include "conf_general.h"
 
 // Private types
 typedef struct {
@@ -191,8 +196,64 @@ typedef struct {
 	// Resistance observer
 	float m_r_est;
 	float m_r_est_state;
+
+	// Position trajectory
+	traj_state m_traj;
+	bool m_traj_en;
+	float m_traj_wp_last;
+	float m_traj_kv;
+	float m_traj_ka;
+
+	// Modulation
+	foc_svm_mode m_svm_mode;
+	bool m_svm_overmod;
+
+	// Dead time compensation, stored in emulated EEPROM and measured during
+	// detection when missing or stale
+	foc_dtc_table m_dtc;
+
+	// Hall sensor model with learned edges
+	foc_hall_state m_hall_model;
+	bool m_hall_model_en;
 } motor_all_state_t;
 
+typedef enum {
+	FOC_TASK_POS = 0,
+	FOC_TASK_SPEED,
+	FOC_TASK_FW,
+	FOC_TASK_TIMER,
+	FOC_TASK_STATS,
+	FOC_TASK_TEMP,
+	FOC_TASK_NUM
+} foc_task_t;
+
+typedef struct {
+	const char *name;
+	void(*func)(volatile motor_all_state_t *motor, float dt);
+	int div;
+	int div_override;
+	int cnt;
+	uint32_t time_last;
+	float exec_time;
+	float exec_time_max;
+	uint32_t runs;
+	uint32_t overruns;
+} foc_sched_task_t;
+
+typedef struct {
+	foc_sched_task_t tasks[FOC_TASK_NUM];
+	float f_base;
+	float f_zv;
+	bool sample_v0_v7;
+	PID_RATE pid_rate;
+	bool update_div;
+	int base_div;
+	int isr_cnt;
+	bool busy;
+	uint32_t missed_ticks;
+	thread_t *tp;
+} foc_sched_t;
+
 static float smooth_erpm;
 static float bq_z1, bq_z2;
 static float bq_a0, bq_a1, bq_a2, bq_b1, bq_b2;
@@ -224,6 +285,7 @@ static volatile motor_all_state_t m_motor_1;
 static volatile motor_all_state_t m_motor_2;
 #endif
 static volatile int m_isr_motor = 0;
+static volatile foc_sched_t m_sched;
 
 // Private functions
 void observer_update(float v_alpha, float v_beta, float i_alpha, float i_beta,
@@ -234,6 +296,9 @@ static void control_current(volatile motor_all_state_t *motor, float dt);
 static void update_valpha_vbeta(volatile motor_all_state_t *motor, float mod_alpha, float mod_beta);
 static void svm(float alpha, float beta, uint32_t PWMFullDutyCycle,
 				uint32_t* tAout, uint32_t* tBout, uint32_t* tCout, uint32_t *svm_sector);
+static void svm_limit_to_hw(foc_svm_mode *mode, bool *overmod);
+static void dtc_load(volatile motor_all_state_t *motor);
+static void dtc_store(volatile motor_all_state_t *motor);
 static void run_pid_control_pos(float dt, volatile motor_all_state_t *motor);
 static void run_pid_control_speed(float dt, volatile motor_all_state_t *motor);
 static void stop_pwm_hw(volatile motor_all_state_t *motor);
@@ -242,23 +307,31 @@ static float correct_encoder(float obs_angle, float enc_angle, float speed, floa
 static float correct_hall(float angle, float dt, volatile motor_all_state_t *motor);
 static void terminal_tmp(int argc, const char **argv);
 static void terminal_plot_hfi(int argc, const char **argv);
+static void terminal_sched(int argc, const char **argv);
+static void terminal_traj_limits(int argc, const char **argv);
+static void terminal_traj_ff(int argc, const char **argv);
+static void terminal_sched_div(int argc, const char **argv);
+static void terminal_svm(int argc, const char **argv);
+static void terminal_dtc(int argc, const char **argv);
+static void terminal_hall_model(int argc, const char **argv);
 static void run_fw(volatile motor_all_state_t *motor, float dt);
 static void timer_update(volatile motor_all_state_t *motor, float dt);
+static void update_samples(volatile motor_all_state_t *motor, float dt);
+static void run_resistance_observer(volatile motor_all_state_t *motor, float dt);
 static void input_current_offset_measurement( void );
 static void hfi_update(volatile motor_all_state_t *motor);
+static void sched_init(void);
+static void sched_update_dividers(void);
+static void sched_isr_tick(void);
 
 // Threads
-static THD_WORKING_AREA(timer_thread_wa, 1024);
-static THD_FUNCTION(timer_thread, arg);
-static volatile bool timer_thd_stop;
-
 static THD_WORKING_AREA(hfi_thread_wa, 1024);
 static THD_FUNCTION(hfi_thread, arg);
 static volatile bool hfi_thd_stop;
 
-static THD_WORKING_AREA(pid_thread_wa, 512);
-static THD_FUNCTION(pid_thread, arg);
-static volatile bool pid_thd_stop;
+static THD_WORKING_AREA(sched_thread_wa, 1024);
+static THD_FUNCTION(sched_thread, arg);
+static volatile bool sched_thd_stop;
 
 // Macros
 #ifdef HW_HAS_3_SHUNTS
@@ -517,6 +590,9 @@ static void timer_reinit(int f_zv) {
 }
 
 void mcpwm_foc_init(volatile mc_configuration *conf_m1, volatile mc_configuration *conf_m2) {
+	// Takes a few milliseconds the first time, so do it before locking
+	foc_svm_init();
+
 	utils_sys_lock_cnt();
 
 #ifndef HW_HAS_DUAL_MOTORS
@@ -534,6 +610,15 @@ void mcpwm_foc_init(volatile mc_configuration *conf_m1, volatile mc_configuratio
 	m_motor_1.m_control_mode = CONTROL_MODE_NONE;
 	m_motor_1.m_hall_dt_diff_last = 1.0;
 	update_hfi_samples(m_motor_1.m_conf->foc_hfi_samples, &m_motor_1);
+	traj_set_limits((traj_state*)&m_motor_1.m_traj, FOC_TRAJ_VEL_MAX, FOC_TRAJ_ACC_MAX, FOC_TRAJ_JERK_MAX);
+	m_motor_1.m_traj_kv = FOC_TRAJ_KV;
+	m_motor_1.m_traj_ka = FOC_TRAJ_KA;
+	m_motor_1.m_svm_mode = FOC_SVM_MODE;
+	m_motor_1.m_svm_overmod = FOC_SVM_OVERMOD;
+	svm_limit_to_hw((foc_svm_mode*)&m_motor_1.m_svm_mode, (bool*)&m_motor_1.m_svm_overmod);
+	foc_hall_reset((foc_hall_state*)&m_motor_1.m_hall_model);
+	m_motor_1.m_hall_model_en = FOC_HALL_MODEL;
+	dtc_load(&m_motor_1);
 
 #ifdef HW_HAS_DUAL_MOTORS
 	memset((void*)&m_motor_2, 0, sizeof(motor_all_state_t));
@@ -542,6 +627,15 @@ void mcpwm_foc_init(volatile mc_configuration *conf_m1, volatile mc_configuratio
 	m_motor_2.m_control_mode = CONTROL_MODE_NONE;
 	m_motor_2.m_hall_dt_diff_last = 1.0;
 	update_hfi_samples(m_motor_2.m_conf->foc_hfi_samples, &m_motor_2);
+	traj_set_limits((traj_state*)&m_motor_2.m_traj, FOC_TRAJ_VEL_MAX, FOC_TRAJ_ACC_MAX, FOC_TRAJ_JERK_MAX);
+	m_motor_2.m_traj_kv = FOC_TRAJ_KV;
+	m_motor_2.m_traj_ka = FOC_TRAJ_KA;
+	m_motor_2.m_svm_mode = FOC_SVM_MODE;
+	m_motor_2.m_svm_overmod = FOC_SVM_OVERMOD;
+	svm_limit_to_hw((foc_svm_mode*)&m_motor_2.m_svm_mode, (bool*)&m_motor_2.m_svm_overmod);
+	foc_hall_reset((foc_hall_state*)&m_motor_2.m_hall_model);
+	m_motor_2.m_hall_model_en = FOC_HALL_MODEL;
+	dtc_load(&m_motor_2);
 #endif
 
 	float foc_freq = conf_m1->foc_f_zv;
@@ -703,14 +797,12 @@ void mcpwm_foc_init(volatile mc_configuration *conf_m1, volatile mc_configuratio
 	}
 
 	// Start threads
-	timer_thd_stop = false;
-	chThdCreateStatic(timer_thread_wa, sizeof(timer_thread_wa), NORMALPRIO, timer_thread, NULL);
-
 	hfi_thd_stop = false;
 	chThdCreateStatic(hfi_thread_wa, sizeof(hfi_thread_wa), NORMALPRIO, hfi_thread, NULL);
 
-	pid_thd_stop = false;
-	chThdCreateStatic(pid_thread_wa, sizeof(pid_thread_wa), NORMALPRIO, pid_thread, NULL);
+	sched_init();
+	sched_thd_stop = false;
+	chThdCreateStatic(sched_thread_wa, sizeof(sched_thread_wa), NORMALPRIO, sched_thread, NULL);
 
 	// Check if the system has resumed from IWDG reset
 	if (timeout_had_IWDG_reset()) {
@@ -729,6 +821,48 @@ void mcpwm_foc_init(volatile mc_configuration *conf_m1, volatile mc_configuratio
 			"[en]",
 			terminal_plot_hfi);
 
+	terminal_register_command_callback(
+			"foc_traj_limits",
+			"Set the position trajectory limits in degrees/s, degrees/s^2 and degrees/s^3",
+			"[vel] [acc] [jerk]",
+			terminal_traj_limits);
+
+	terminal_register_command_callback(
+			"foc_traj_ff",
+			"Set the position trajectory feedforward in A/(degrees/s) and A/(degrees/s^2)",
+			"[kv] [ka]",
+			terminal_traj_ff);
+
+	terminal_register_command_callback(
+			"foc_sched",
+			"Print rate, execution time and overruns of the FOC scheduler tasks",
+			0,
+			terminal_sched);
+
+	terminal_register_command_callback(
+			"foc_sched_div",
+			"Override the control loop divider of a FOC scheduler task. 0: automatic",
+			"[task] [div]",
+			terminal_sched_div);
+
+	terminal_register_command_callback(
+			"foc_svm",
+			"Set the modulation. 0: Centered, 1: DPWM min, 2: DPWM max, 3: DPWM1. overmod 1 goes up to six-step",
+			"[mode] [overmod]",
+			terminal_svm);
+
+	terminal_register_command_callback(
+			"foc_dtc",
+			"Print the dead time compensation table. With a current, measure it up to that current. 0 clears it. The table is stored",
+			"[current]",
+			terminal_dtc);
+
+	terminal_register_command_callback(
+			"foc_hall_model",
+			"Print the learned hall sensor edges. 1 enables the model, which restarts the learning, and 0 disables it",
+			"[enable]",
+			terminal_hall_model);
+
 	m_init_done = true;
 }
 
@@ -743,18 +877,13 @@ void mcpwm_foc_deinit(void) {
 
 	m_init_done = false;
 
-	timer_thd_stop = true;
-	while (timer_thd_stop) {
-		chThdSleepMilliseconds(1);
-	}
-
 	hfi_thd_stop = true;
 	while (hfi_thd_stop) {
 		chThdSleepMilliseconds(1);
 	}
 
-	pid_thd_stop = true;
-	while (pid_thd_stop) {
+	sched_thd_stop = true;
+	while (sched_thd_stop) {
 		chThdSleepMilliseconds(1);
 	}
 
@@ -913,6 +1042,7 @@ void mcpwm_foc_set_pid_speed(float rpm) {
  * The desired position of the motor in degrees.
  */
 void mcpwm_foc_set_pid_pos(float pos) {
+	motor_now()->m_traj_en = false;
 	motor_now()->m_control_mode = CONTROL_MODE_POS;
 	motor_now()->m_pos_pid_set = pos;
 
@@ -921,6 +1051,152 @@ void mcpwm_foc_set_pid_pos(float pos) {
 	}
 }
 
+/*
+ * Start a trajectory from the current position control setpoint, or from the
+ * current position if position control is not running.
+ */
+static void pos_traj_start(volatile motor_all_state_t *motor) {
+	if (!motor->m_traj_en || motor->m_control_mode != CONTROL_MODE_POS ||
+			motor->m_state != MC_STATE_RUNNING) {
+		float start = motor->m_control_mode == CONTROL_MODE_POS ?
+				motor->m_pos_pid_set : motor->m_pos_pid_now;
+		traj_init((traj_state*)&motor->m_traj, start);
+		motor->m_traj_wp_last = start;
+		motor->m_traj_en = true;
+	}
+
+	motor->m_control_mode = CONTROL_MODE_POS;
+
+	if (motor->m_state != MC_STATE_RUNNING) {
+		motor->m_state = MC_STATE_RUNNING;
+	}
+}
+
+/**
+ * Use PID position control with a jerk-limited trajectory towards the goal
+ * position. The velocity and acceleration of the trajectory are fed forward
+ * to the current controller.
+ *
+ * @param pos
+ * The desired position of the motor in degrees.
+ */
+void mcpwm_foc_set_pid_pos_traj(float pos) {
+	volatile motor_all_state_t *motor = motor_now();
+	traj_state *t = (traj_state*)&motor->m_traj;
+
+	utils_sys_lock_cnt();
+	pos_traj_start(motor);
+	float target = t->pos + utils_angle_difference(pos, t->pos);
+	traj_set_target(t, target);
+	motor->m_traj_wp_last = target;
+	utils_sys_unlock_cnt();
+}
+
+/**
+ * Queue a waypoint for the position trajectory. This can be used to stream
+ * a path, where each waypoint is passed with the given velocity. The last
+ * waypoint should have zero velocity.
+ *
+ * @param pos
+ * Waypoint position in degrees.
+ *
+ * @param vel
+ * Velocity at the waypoint in degrees/s.
+ *
+ * @return
+ * false if the waypoint queue is full.
+ */
+bool mcpwm_foc_push_pid_pos_waypoint(float pos, float vel) {
+	volatile motor_all_state_t *motor = motor_now();
+	traj_state *t = (traj_state*)&motor->m_traj;
+
+	utils_sys_lock_cnt();
+	pos_traj_start(motor);
+	float wp = motor->m_traj_wp_last + utils_angle_difference(pos, motor->m_traj_wp_last);
+	bool res = traj_push_waypoint(t, wp, vel);
+	if (res) {
+		motor->m_traj_wp_last = wp;
+	}
+	utils_sys_unlock_cnt();
+
+	return res;
+}
+
+/**
+ * Set the limits of the position trajectory.
+ *
+ * @param vel
+ * Maximum velocity in degrees/s.
+ *
+ * @param acc
+ * Maximum acceleration in degrees/s^2.
+ *
+ * @param jerk
+ * Maximum jerk in degrees/s^3. 0 gives a trapezoidal velocity profile.
+ */
+void mcpwm_foc_set_pos_traj_limits(float vel, float acc, float jerk) {
+	utils_sys_lock_cnt();
+	traj_set_limits((traj_state*)&motor_now()->m_traj, vel, acc, jerk);
+	utils_sys_unlock_cnt();
+}
+
+/**
+ * Set the feedforward gains from the trajectory to the q-axis current.
+ *
+ * @param kv
+ * Current per velocity in A/(degrees/s).
+ *
+ * @param ka
+ * Current per acceleration in A/(degrees/s^2).
+ */
+void mcpwm_foc_set_pos_traj_ff(float kv, float ka) {
+	motor_now()->m_traj_kv = kv;
+	motor_now()->m_traj_ka = ka;
+}
+
+/**
+ * Set the modulation.
+ *
+ * @param mode
+ * Zero sequence to use. The discontinuous modes switch each phase for 2/3 of
+ * the electrical period, which reduces the switching losses by about 1/3.
+ *
+ * @param overmod
+ * Allow the voltage to go above the linear region, up to six-step.
+ *
+ * @return
+ * True if the modulation was set as requested. Without phase shunts the
+ * modes that clamp a phase high and overmodulation are not allowed, and
+ * DPWM min without overmodulation is used instead.
+ */
+bool mcpwm_foc_set_svm(foc_svm_mode mode, bool overmod) {
+	foc_svm_mode mode_hw = mode;
+	bool overmod_hw = overmod;
+	svm_limit_to_hw(&mode_hw, &overmod_hw);
+
+	motor_now()->m_svm_mode = mode_hw;
+	motor_now()->m_svm_overmod = overmod_hw;
+
+	return mode_hw == mode && overmod_hw == overmod;
+}
+
+/**
+ * Use the hall sensor model, which learns where the edges of the hall
+ * sensors are instead of assuming that they are 60 degrees apart.
+ *
+ * @param enable
+ * Enable the model. The learning starts over when it is enabled.
+ */
+void mcpwm_foc_set_hall_model(bool enable) {
+	volatile motor_all_state_t *motor = motor_now();
+
+	if (enable && !motor->m_hall_model_en) {
+		foc_hall_reset((foc_hall_state*)&motor->m_hall_model);
+	}
+
+	motor->m_hall_model_en = enable;
+}
+
 /**
  * Use current control and specify a goal current to use. The sign determines
  * the direction of the torque. Absolute values less than
@@ -2068,6 +2344,16 @@ bool mcpwm_foc_measure_res_ind(float *res, float *ind, float *ld_lq_diff) {
 	motor->m_conf->foc_motor_r = *res;
 	*ind = mcpwm_foc_measure_inductance_current(i_last, 200, 0, ld_lq_diff);
 
+	// Measure the dead time table when there is none, or when it was measured on
+	// a motor with a different resistance.
+	if (!motor->m_dtc.valid || fabsf(motor->m_dtc.res - *res) > (0.3 * *res)) {
+		// The sweep holds many currents, so it needs a current controller that settles
+		// quickly. Use a bandwidth of 1000 rad/s with what was just measured.
+		motor->m_conf->foc_current_kp = *ind * 1e-6 * 1000.0;
+		motor->m_conf->foc_current_ki = *res * 1000.0;
+		mcpwm_foc_measure_dead_time(i_last, 100);
+	}
+
 	motor->m_conf->foc_f_zv = f_zv_old;
 	motor->m_conf->foc_current_kp = kp_old;
 	motor->m_conf->foc_current_ki = ki_old;
@@ -2076,6 +2362,115 @@ bool mcpwm_foc_measure_res_ind(float *res, float *ind, float *ld_lq_diff) {
 	return true;
 }
 
+/**
+ * Measure the dead time and inverter nonlinearity compensation table. A current
+ * is held between every pair of phases and swept from low to high, and the
+ * voltage the current controller needs beyond the resistive drop is the loss.
+ *
+ * @param current
+ * The largest current of the sweep. Should be well above the current ripple,
+ * as the resistance is taken from the last points.
+ *
+ * @param samples
+ * The number of samples to average over at every point.
+ *
+ * @return
+ * true if the table was updated and stored. Otherwise the previous table, or
+ * the foc_dt_us compensation, is used.
+ *
+ * This uses the current controller gains from the configuration, so the motor
+ * should be detected first. The detection runs it when the stored table is
+ * missing or was measured on another motor.
+ */
+bool mcpwm_foc_measure_dead_time(float current, int samples) {
+	mc_interface_lock();
+
+	volatile motor_all_state_t *motor = motor_now();
+
+	motor->m_phase_override = true;
+	motor->m_phase_now_override = 0.0;
+	motor->m_id_set = 0.0;
+	motor->m_iq_set = 0.0;
+	motor->m_control_mode = CONTROL_MODE_CURRENT;
+	motor->m_state = MC_STATE_RUNNING;
+
+	// Disable timeout
+	systime_t tout = timeout_get_timeout_msec();
+	float tout_c = timeout_get_brake_current();
+	KILL_SW_MODE tout_ksw = timeout_get_kill_sw_mode();
+	timeout_reset();
+	timeout_configure(60000, 0.0, KILL_SW_MODE_DISABLED);
+
+	float v_meas[3][FOC_DTC_POINTS];
+	bool ok = true;
+
+	for (int k = 0;k < 3 && ok;k++) {
+		// The current is on the q axis, so this makes it go in to phase k and out
+		// of phase k + 1, at -30 + k * 120 degrees.
+		float phase = (float)(k - 1) * (2.0 * M_PI / 3.0);
+		utils_norm_angle_rad(&phase);
+		motor->m_phase_now_override = phase;
+
+		for (int n = 1;n < FOC_DTC_POINTS && ok;n++) {
+			const float i_goal = foc_dtc_point(current, n);
+
+			while (fabsf(motor->m_iq_set - i_goal) > 0.001) {
+				utils_step_towards((float*)&motor->m_iq_set, i_goal, current / 500.0);
+				chThdSleepMilliseconds(1);
+			}
+
+			chThdSleepMilliseconds(50);
+
+			motor->m_samples.avg_current_tot = 0.0;
+			motor->m_samples.avg_voltage_tot = 0.0;
+			motor->m_samples.sample_num = 0;
+
+			int cnt = 0;
+			while (motor->m_samples.sample_num < samples) {
+				chThdSleepMilliseconds(1);
+				cnt++;
+
+				if (cnt > 10000 || mc_interface_get_fault() != FAULT_CODE_NONE) {
+					ok = false;
+					break;
+				}
+			}
+
+			if (ok) {
+				v_meas[k][n] = motor->m_samples.avg_voltage_tot / (float)motor->m_samples.sample_num;
+			}
+		}
+
+		while (fabsf(motor->m_iq_set) > 0.001) {
+			utils_step_towards((float*)&motor->m_iq_set, 0.0, current / 500.0);
+			chThdSleepMilliseconds(1);
+		}
+	}
+
+	motor->m_id_set = 0.0;
+	motor->m_iq_set = 0.0;
+	motor->m_phase_override = false;
+	motor->m_control_mode = CONTROL_MODE_NONE;
+	motor->m_state = MC_STATE_OFF;
+	stop_pwm_hw(motor);
+
+	if (ok) {
+		// The phase current is sqrt(3) / 2 of the current vector
+		ok = foc_dtc_calibrate((foc_dtc_table*)&motor->m_dtc, current * SQRT3_BY_2, motor->m_motor_state.v_bus,
+				motor->m_conf->foc_f_zv, v_meas);
+	}
+
+	if (ok) {
+		dtc_store(motor);
+	}
+
+	// Enable timeout
+	timeout_configure(tout, tout_c, tout_ksw);
+	mc_interface_unlock();
+
+	return ok;
+}
+
 /**
  * Run the motor in open loop and figure out at which angles the hall sensors are.
  *
@@ -3162,6 +3557,14 @@ void mcpwm_foc_adc_int_handler(void *p, uint32_t flags) {
 	mc_interface_mc_timer_isr(false);
 #endif
 
+#ifdef HW_HAS_DUAL_MOTORS
+	if (!is_second_motor) {
+		sched_isr_tick();
+	}
+#else
+	sched_isr_tick();
+#endif
+
 	m_isr_motor = 0;
 	m_last_adc_isr_duration = timer_seconds_elapsed_since(t_start);
 }
@@ -3211,8 +3614,6 @@ static void run_fw(volatile motor_all_state_t *motor, float dt) {
 }
 
 static void timer_update(volatile motor_all_state_t *motor, float dt) {
-	run_fw(motor, dt);
-
 	// Check if it is time to stop the modulation. Notice that modulation is kept on as long as there is
 	// field weakening current.
 	utils_sys_lock_cnt();
@@ -3387,18 +3788,6 @@ static void timer_update(volatile motor_all_state_t *motor, float dt) {
 		motor->m_phase_observer_override = false;
 	}
 
-	// Samples
-	if (motor->m_state == MC_STATE_RUNNING) {
-		const volatile float vd_tmp = motor->m_motor_state.vd;
-		const volatile float vq_tmp = motor->m_motor_state.vq;
-		const volatile float id_tmp = motor->m_motor_state.id;
-		const volatile float iq_tmp = motor->m_motor_state.iq;
-
-		motor->m_samples.avg_current_tot += sqrtf(SQ(id_tmp) + SQ(iq_tmp));
-		motor->m_samples.avg_voltage_tot += sqrtf(SQ(vd_tmp) + SQ(vq_tmp));
-		motor->m_samples.sample_num++;
-	}
-
 	// Observer gain scaling, based on bus voltage and duty cycle
 	float gamma_tmp = utils_map(fabsf(motor->m_motor_state.duty_now),
 								0.0, 40.0 / motor->m_motor_state.v_bus,
@@ -3409,23 +3798,38 @@ static void timer_update(volatile motor_all_state_t *motor, float dt) {
 
 	// 4.0 scaling is kind of arbitrary, but it should make configs from old VESC Tools more likely to work.
 	motor->m_gamma_now = gamma_tmp * 4.0;
+}
 
-	// Run resistance observer
-	// See "An adaptive flux observer for the permanent magnet synchronous motor"
-	// https://doi.org/10.1002/acs.2587
-	{
-		float res_est_gain = 0.00002;
-		float i_abs_sq = SQ(motor->m_motor_state.i_abs);
-		motor->m_r_est = motor->m_r_est_state - 0.5 * res_est_gain * motor->m_conf->foc_motor_l * i_abs_sq;
-		float res_dot = -res_est_gain * (motor->m_r_est * i_abs_sq + motor->m_speed_est_fast *
-				(motor->m_motor_state.i_beta * motor->m_observer_x1 - motor->m_motor_state.i_alpha * motor->m_observer_x2) -
-				(motor->m_motor_state.i_alpha * motor->m_motor_state.v_alpha + motor->m_motor_state.i_beta * motor->m_motor_state.v_beta));
-		motor->m_r_est_state += res_dot * dt;
+static void update_samples(volatile motor_all_state_t *motor, float dt) {
+	(void)dt;
 
-		utils_truncate_number((float*)&motor->m_r_est_state, motor->m_conf->foc_motor_r * 0.25, motor->m_conf->foc_motor_r * 3.0);
+	if (motor->m_state == MC_STATE_RUNNING) {
+		const volatile float vd_tmp = motor->m_motor_state.vd;
+		const volatile float vq_tmp = motor->m_motor_state.vq;
+		const volatile float id_tmp = motor->m_motor_state.id;
+		const volatile float iq_tmp = motor->m_motor_state.iq;
+
+		motor->m_samples.avg_current_tot += sqrtf(SQ(id_tmp) + SQ(iq_tmp));
+		motor->m_samples.avg_voltage_tot += sqrtf(SQ(vd_tmp) + SQ(vq_tmp));
+		motor->m_samples.sample_num++;
 	}
 }
 
+// The resistance estimate is what the motor temperature estimation is based on.
+// See "An adaptive flux observer for the permanent magnet synchronous motor"
+// https://doi.org/10.1002/acs.2587
+static void run_resistance_observer(volatile motor_all_state_t *motor, float dt) {
+	float res_est_gain = 0.00002;
+	float i_abs_sq = SQ(motor->m_motor_state.i_abs);
+	motor->m_r_est = motor->m_r_est_state - 0.5 * res_est_gain * motor->m_conf->foc_motor_l * i_abs_sq;
+	float res_dot = -res_est_gain * (motor->m_r_est * i_abs_sq + motor->m_speed_est_fast *
+			(motor->m_motor_state.i_beta * motor->m_observer_x1 - motor->m_motor_state.i_alpha * motor->m_observer_x2) -
+			(motor->m_motor_state.i_alpha * motor->m_motor_state.v_alpha + motor->m_motor_state.i_beta * motor->m_motor_state.v_beta));
+	motor->m_r_est_state += res_dot * dt;
+
+	utils_truncate_number((float*)&motor->m_r_est_state, motor->m_conf->foc_motor_r * 0.25, motor->m_conf->foc_motor_r * 3.0);
+}
+
 static void terminal_tmp(int argc, const char **argv) {
 	(void)argc;
 	(void)argv;
@@ -3486,30 +3890,6 @@ static void input_current_offset_measurement(void) {
 #endif
 }
 
-static THD_FUNCTION(timer_thread, arg) {
-	(void)arg;
-
-	chRegSetThreadName("foc timer");
-
-	for(;;) {
-		const float dt = 0.001;
-
-		if (timer_thd_stop) {
-			timer_thd_stop = false;
-			return;
-		}
-
-		timer_update(&m_motor_1, dt);
-#ifdef HW_HAS_DUAL_MOTORS
-		timer_update(&m_motor_2, dt);
-#endif
-
-		input_current_offset_measurement();
-
-		chThdSleepMilliseconds(1);
-	}
-}
-
 static void hfi_update(volatile motor_all_state_t *motor) {
 	float rpm_abs = fabsf(RADPS2RPM_f(motor->m_speed_est_fast));
 
@@ -3654,40 +4034,210 @@ static THD_FUNCTION(hfi_thread, arg) {
 	}
 }
 
-static THD_FUNCTION(pid_thread, arg) {
+static float pid_rate_to_hz(PID_RATE rate) {
+	switch (rate) {
+	case PID_RATE_25_HZ: return 25.0;
+	case PID_RATE_50_HZ: return 50.0;
+	case PID_RATE_100_HZ: return 100.0;
+	case PID_RATE_250_HZ: return 250.0;
+	case PID_RATE_500_HZ: return 500.0;
+	case PID_RATE_1000_HZ: return 1000.0;
+	case PID_RATE_2500_HZ: return 2500.0;
+	case PID_RATE_5000_HZ: return 5000.0;
+	case PID_RATE_10000_HZ: return 10000.0;
+	}
+
+	return 1000.0;
+}
+
+static void sched_task_pos(volatile motor_all_state_t *motor, float dt) {
+	run_pid_control_pos(dt, motor);
+}
+
+static void sched_task_speed(volatile motor_all_state_t *motor, float dt) {
+	run_pid_control_speed(dt, motor);
+}
+
+static void sched_task_timer(volatile motor_all_state_t *motor, float dt) {
+	timer_update(motor, dt);
+
+	if (motor == &m_motor_1) {
+		input_current_offset_measurement();
+	}
+}
+
+static void sched_init(void) {
+	memset((void*)&m_sched, 0, sizeof(m_sched));
+
+	m_sched.tasks[FOC_TASK_POS].name = "pos";
+	m_sched.tasks[FOC_TASK_POS].func = sched_task_pos;
+	m_sched.tasks[FOC_TASK_SPEED].name = "speed";
+	m_sched.tasks[FOC_TASK_SPEED].func = sched_task_speed;
+	m_sched.tasks[FOC_TASK_FW].name = "fw";
+	m_sched.tasks[FOC_TASK_FW].func = run_fw;
+	m_sched.tasks[FOC_TASK_TIMER].name = "timer";
+	m_sched.tasks[FOC_TASK_TIMER].func = sched_task_timer;
+	m_sched.tasks[FOC_TASK_STATS].name = "stats";
+	m_sched.tasks[FOC_TASK_STATS].func = update_samples;
+	m_sched.tasks[FOC_TASK_TEMP].name = "temp";
+	m_sched.tasks[FOC_TASK_TEMP].func = run_resistance_observer;
+
+	for (int i = 0;i < FOC_TASK_NUM;i++) {
+		m_sched.tasks[i].time_last = timer_time_now();
+	}
+
+	sched_update_dividers();
+}
+
+/**
+ * Convert the task rates to dividers of the control loop rate. The scheduler
+ * thread is woken up every base_div control loop iterations, which is the
+ * smallest divider among the tasks.
+ */
+static void sched_update_dividers(void) {
+	volatile mc_configuration *conf = m_motor_1.m_conf;
+
+	m_sched.f_zv = conf->foc_f_zv;
+	m_sched.sample_v0_v7 = conf->foc_sample_v0_v7;
+	m_sched.pid_rate = conf->sp_pid_loop_rate;
+
+	float f_base = conf->foc_f_zv / 2.0;
+#if defined(HW_HAS_PHASE_SHUNTS) && !defined(HW_HAS_DUAL_MOTORS)
+	if (conf->foc_sample_v0_v7) {
+		f_base = conf->foc_f_zv;
+	}
+#endif
+	f_base /= (float)FOC_CONTROL_LOOP_FREQ_DIVIDER;
+
+	const float rate_pid = pid_rate_to_hz(conf->sp_pid_loop_rate);
+	const float rates[FOC_TASK_NUM] = {
+			FOC_SCHED_RATE_POS > 0 ? FOC_SCHED_RATE_POS : rate_pid,
+			FOC_SCHED_RATE_SPEED > 0 ? FOC_SCHED_RATE_SPEED : rate_pid,
+			FOC_SCHED_RATE_FW,
+			FOC_SCHED_RATE_TIMER,
+			FOC_SCHED_RATE_STATS,
+			FOC_SCHED_RATE_TEMP
+	};
+
+	int base_div = 0;
+	for (int i = 0;i < FOC_TASK_NUM;i++) {
+		volatile foc_sched_task_t *task = &m_sched.tasks[i];
+
+		int div = task->div_override;
+		if (div <= 0) {
+			div = (int)roundf(f_base / rates[i]);
+		}
+
+		if (div < 1) {
+			div = 1;
+		}
+
+		task->div = div;
+		task->cnt = 0;
+
+		if (base_div == 0 || div < base_div) {
+			base_div = div;
+		}
+	}
+
+	m_sched.f_base = f_base;
+	m_sched.base_div = base_div;
+	m_sched.update_div = false;
+}
+
+/**
+ * Called from the control loop interrupt. Wakes up the scheduler thread
+ * every base_div iterations and counts the wakeups that happen while the
+ * thread is still busy with the previous one.
+ */
+static void sched_isr_tick(void) {
+	if (++m_sched.isr_cnt < m_sched.base_div) {
+		return;
+	}
+
+	m_sched.isr_cnt = 0;
+
+	if (m_sched.tp) {
+		if (m_sched.busy) {
+			m_sched.missed_ticks++;
+		}
+
+		chSysLockFromISR();
+		chEvtSignalI(m_sched.tp, (eventmask_t) 1);
+		chSysUnlockFromISR();
+	}
+}
+
+static THD_FUNCTION(sched_thread, arg) {
 	(void)arg;
 
-	chRegSetThreadName("foc pid");
+	chRegSetThreadName("foc sched");
 
-	uint32_t last_time = timer_time_now();
+	m_sched.tp = chThdGetSelfX();
 
 	for(;;) {
-		if (pid_thd_stop) {
-			pid_thd_stop = false;
+		// If the control loop interrupt does not run, e.g. while the timers are
+		// re-initialized, the timeout makes sure that all tasks still get to run.
+		eventmask_t evt = chEvtWaitAnyTimeout((eventmask_t) 1, MS2ST(5));
+
+		if (sched_thd_stop) {
+			chSysLock();
+			m_sched.tp = 0;
+			chSysUnlock();
+			sched_thd_stop = false;
 			return;
 		}
 
-		switch (m_motor_1.m_conf->sp_pid_loop_rate) {
-		case PID_RATE_25_HZ: chThdSleepMicroseconds(1000000 / 25); break;
-		case PID_RATE_50_HZ: chThdSleepMicroseconds(1000000 / 50); break;
-		case PID_RATE_100_HZ: chThdSleepMicroseconds(1000000 / 100); break;
-		case PID_RATE_250_HZ: chThdSleepMicroseconds(1000000 / 250); break;
-		case PID_RATE_500_HZ: chThdSleepMicroseconds(1000000 / 500); break;
-		case PID_RATE_1000_HZ: chThdSleepMicroseconds(1000000 / 1000); break;
-		case PID_RATE_2500_HZ: chThdSleepMicroseconds(1000000 / 2500); break;
-		case PID_RATE_5000_HZ: chThdSleepMicroseconds(1000000 / 5000); break;
-		case PID_RATE_10000_HZ: chThdSleepMicroseconds(1000000 / 10000); break;
+		m_sched.busy = true;
+
+		if (m_sched.update_div ||
+				m_sched.f_zv != m_motor_1.m_conf->foc_f_zv ||
+				m_sched.sample_v0_v7 != m_motor_1.m_conf->foc_sample_v0_v7 ||
+				m_sched.pid_rate != m_motor_1.m_conf->sp_pid_loop_rate) {
+			sched_update_dividers();
 		}
 
-		float dt = timer_seconds_elapsed_since(last_time);
-		last_time = timer_time_now();
+		for (int i = 0;i < FOC_TASK_NUM;i++) {
+			volatile foc_sched_task_t *task = &m_sched.tasks[i];
+
+			if (evt) {
+				task->cnt += m_sched.base_div;
+				if (task->cnt < task->div) {
+					continue;
+				}
+
+				task->cnt -= task->div;
+
+				// More than one period behind, drop the lost iterations.
+				if (task->cnt >= task->div) {
+					task->cnt = 0;
+					task->overruns++;
+				}
+			}
+
+			uint32_t t_start = timer_time_now();
+			float dt = timer_seconds_elapsed_since(task->time_last);
+			task->time_last = t_start;
 
-		run_pid_control_pos(dt, &m_motor_1);
-		run_pid_control_speed(dt, &m_motor_1);
+			task->func(&m_motor_1, dt);
 #ifdef HW_HAS_DUAL_MOTORS
-		run_pid_control_pos(dt, &m_motor_2);
-		run_pid_control_speed(dt, &m_motor_2);
+			task->func(&m_motor_2, dt);
 #endif
+
+			float t_exec = timer_seconds_elapsed_since(t_start);
+			UTILS_LP_FAST(task->exec_time, t_exec, 0.01);
+			if (t_exec > task->exec_time_max) {
+				task->exec_time_max = t_exec;
+			}
+
+			if (t_exec > ((float)task->div / m_sched.f_base)) {
+				task->overruns++;
+			}
+
+			task->runs++;
+		}
+
+		m_sched.busy = false;
 	}
 }
 
@@ -3922,7 +4472,11 @@ static void control_current(volatile motor_all_state_t *motor, float dt) {
 
 	// Calculate the max length of the voltage space vector without overmodulation.
 	// Is simply 1/sqrt(3) * v_bus. See https://microchipdeveloper.com/mct5001:start. Adds margin with max_duty.
+	// With overmodulation the fundamental can go up to that of six-step, which is 2/pi * v_bus.
 	float max_v_mag = ONE_BY_SQRT3 * max_duty * state_m->v_bus;
+	if (motor->m_svm_overmod) {
+		max_v_mag = (2.0 / M_PI) * max_duty * state_m->v_bus;
+	}
 
 	// Saturation and anti-windup. Notice that the d-axis has priority as it controls field
 	// weakening and the efficiency.
@@ -3962,6 +4516,9 @@ static void control_current(volatile motor_all_state_t *motor, float dt) {
 	float mod_alpha = c * state_m->mod_d - s * state_m->mod_q;
 	float mod_beta  = c * state_m->mod_q + s * state_m->mod_d;
 
+	// Sampling in both zero vectors needs both of them, which the discontinuous modes remove
+	foc_svm_mode svm_mode = conf_now->foc_sample_v0_v7 ? FOC_SVM_MODE_CENTERED : motor->m_svm_mode;
+
 	update_valpha_vbeta(motor, mod_alpha, mod_beta);
     
     // Dead time compensated values for vd and vq. Note that these are not used to control the switching times. 
@@ -4022,11 +4579,19 @@ static void control_current(volatile motor_all_state_t *motor, float dt) {
 			// Delay adding the HFI voltage when not sampling in both 0 vectors, as it will cancel
 			// itself with the opposite pulse from the previous HFI sample. This makes more sense
 			// when drawing the SVM waveform.
-			svm(mod_alpha_tmp, mod_beta_tmp, TIM1->ARR,
-				(uint32_t*)&motor->m_duty1_next,
-				(uint32_t*)&motor->m_duty2_next,
-				(uint32_t*)&motor->m_duty3_next,
-				(uint32_t*)&state_m->svm_sector);
+			if (svm_mode == FOC_SVM_MODE_CENTERED) {
+				svm(mod_alpha_tmp, mod_beta_tmp, TIM1->ARR,
+					(uint32_t*)&motor->m_duty1_next,
+					(uint32_t*)&motor->m_duty2_next,
+					(uint32_t*)&motor->m_duty3_next,
+					(uint32_t*)&state_m->svm_sector);
+			} else {
+				foc_svm(mod_alpha_tmp, mod_beta_tmp, TIM1->ARR, svm_mode, false,
+					(uint32_t*)&motor->m_duty1_next,
+					(uint32_t*)&motor->m_duty2_next,
+					(uint32_t*)&motor->m_duty3_next,
+					(uint32_t*)&state_m->svm_sector);
+			}
 			motor->m_duty_next_set = true;
 		}
 	} else {
@@ -4043,7 +4608,13 @@ static void control_current(volatile motor_all_state_t *motor, float dt) {
     
     // Calculate the duty cycles for all the phases. This also injects a zero modulation signal to
 	// be able to fully utilize the bus voltage. See https://microchipdeveloper.com/mct5001:start
-	svm(mod_alpha, mod_beta, top, &duty1, &duty2, &duty3, (uint32_t*)&state_m->svm_sector);
+	// The sector based svm is about twice as fast, so it is kept for the default modulation.
+	if (svm_mode == FOC_SVM_MODE_CENTERED && !motor->m_svm_overmod) {
+		svm(mod_alpha, mod_beta, top, &duty1, &duty2, &duty3, (uint32_t*)&state_m->svm_sector);
+	} else {
+		foc_svm(mod_alpha, mod_beta, top, svm_mode, motor->m_svm_overmod,
+				&duty1, &duty2, &duty3, (uint32_t*)&state_m->svm_sector);
+	}
 
 	if (motor == &m_motor_1) {
 		TIMER_UPDATE_DUTY_M1(duty1, duty2, duty3);
@@ -4122,9 +4693,16 @@ static void update_valpha_vbeta(volatile motor_all_state_t *motor, float mod_alp
 	const float mod_alpha_filter_sgn = (1.0 / 3.0) * (2.0 * SIGN(ia_filter) - SIGN(ib_filter) - SIGN(ic_filter));
 	const float mod_beta_filter_sgn = ONE_BY_SQRT3 * (SIGN(ib_filter) - SIGN(ic_filter));
 
-	const float mod_comp_fact = conf_now->foc_dt_us * 1e-6 * conf_now->foc_f_zv;
-	const float mod_alpha_comp = mod_alpha_filter_sgn * mod_comp_fact;
-	const float mod_beta_comp = mod_beta_filter_sgn * mod_comp_fact;
+	float mod_alpha_comp, mod_beta_comp;
+	if (motor->m_dtc.valid) {
+		// Measured loss of every phase, which also is right at low current
+		foc_dtc_mod_comp((foc_dtc_table*)&motor->m_dtc, conf_now->foc_f_zv, ia_filter, ib_filter, ic_filter,
+				&mod_alpha_comp, &mod_beta_comp);
+	} else {
+		const float mod_comp_fact = conf_now->foc_dt_us * 1e-6 * conf_now->foc_f_zv;
+		mod_alpha_comp = mod_alpha_filter_sgn * mod_comp_fact;
+		mod_beta_comp = mod_beta_filter_sgn * mod_comp_fact;
+	}
 
 	mod_alpha -= mod_alpha_comp;
 	mod_beta -= mod_beta_comp;
@@ -4357,9 +4935,76 @@ static void svm(float alpha, float beta, uint32_t PWMFullDutyCycle,
 	*svm_sector = sector;
 }
 
+/**
+ * Low-side shunts can only be sampled while all low-side switches are on. The
+ * modes that keep a phase high and overmodulation, where the largest phase is
+ * held high near six-step, remove that window and the bootstrap refresh, so
+ * they are only allowed with phase shunts. DPWM min keeps the lowest phase low
+ * and has a longer V0 than centered, so it is used instead. In the linear
+ * region the window is kept by max_duty.
+ */
+static void svm_limit_to_hw(foc_svm_mode *mode, bool *overmod) {
+#ifdef HW_HAS_PHASE_SHUNTS
+	(void)mode;
+	(void)overmod;
+#else
+	if (*mode == FOC_SVM_MODE_DPWM_MAX || *mode == FOC_SVM_MODE_DPWM1) {
+		*mode = FOC_SVM_MODE_DPWM_MIN;
+	}
+
+	*overmod = false;
+#endif
+}
+
+static bool dtc_is_motor_2(volatile motor_all_state_t *motor) {
+#ifdef HW_HAS_DUAL_MOTORS
+	return motor == &m_motor_2;
+#else
+	(void)motor;
+	return false;
+#endif
+}
+
+static void dtc_load(volatile motor_all_state_t *motor) {
+	if (!conf_general_read_dtc((void*)&motor->m_dtc, sizeof(foc_dtc_table),
+			FOC_DTC_VERSION, dtc_is_motor_2(motor))) {
+		foc_dtc_reset((foc_dtc_table*)&motor->m_dtc);
+	}
+}
+
+/*
+ * Writing the emulated EEPROM stalls the flash, and with it the control
+ * interrupts, so this must only be called with the motor stopped.
+ */
+static void dtc_store(volatile motor_all_state_t *motor) {
+	utils_sys_lock_cnt();
+	conf_general_store_dtc((void*)&motor->m_dtc, sizeof(foc_dtc_table),
+			FOC_DTC_VERSION, dtc_is_motor_2(motor));
+	utils_sys_unlock_cnt();
+}
+
 static void run_pid_control_pos(float dt, volatile motor_all_state_t *motor) {
 	volatile mc_configuration *conf_now = motor->m_conf;
 
+	float iq_ff = 0.0;
+	if (motor->m_traj_en && motor->m_control_mode == CONTROL_MODE_POS) {
+		traj_state *t = (traj_state*)&motor->m_traj;
+
+		utils_sys_lock_cnt();
+		traj_update(t, dt);
+
+		// Keep the trajectory positions close to the angle range
+		if (t->pos >= 360.0 || t->pos < 0.0) {
+			float ofs = -floorf(t->pos / 360.0) * 360.0;
+			traj_offset(t, ofs);
+			motor->m_traj_wp_last += ofs;
+		}
+
+		motor->m_pos_pid_set = t->pos;
+		iq_ff = motor->m_traj_kv * t->vel + motor->m_traj_ka * t->acc;
+		utils_sys_unlock_cnt();
+	}
+
 	float angle_now = motor->m_pos_pid_now;
 	float angle_set = motor->m_pos_pid_set;
 
@@ -4369,6 +5014,7 @@ static void run_pid_control_pos(float dt, volatile motor_all_state_t *motor) {
 
 	// PID is off. Return.
 	if (motor->m_control_mode != CONTROL_MODE_POS) {
+		motor->m_traj_en = false;
 		motor->m_pos_i_term = 0;
 		motor->m_pos_prev_error = 0;
 		motor->m_pos_prev_proc = angle_now;
@@ -4452,15 +5098,20 @@ static void run_pid_control_pos(float dt, volatile motor_all_state_t *motor) {
 	float output = p_term + motor->m_pos_i_term + d_term + d_term_proc;
 	utils_truncate_number(&output, -1.0, 1.0);
 
+	// Trajectory feedforward
+	const float i_max = conf_now->l_current_max * conf_now->l_current_max_scale;
+	output += iq_ff * error_sign / i_max;
+	utils_truncate_number(&output, -1.0, 1.0);
+
 	if (encoder_is_configured()) {
 		if (encoder_index_found()) {
-			motor->m_iq_set = output * conf_now->l_current_max * conf_now->l_current_max_scale;;
+			motor->m_iq_set = output * i_max;
 		} else {
 			// Rotate the motor with 40 % power until the encoder index is found.
-			motor->m_iq_set = 0.4 * conf_now->l_current_max * conf_now->l_current_max_scale;;
+			motor->m_iq_set = 0.4 * i_max;
 		}
 	} else {
-		motor->m_iq_set = output * conf_now->l_current_max * conf_now->l_current_max_scale;;
+		motor->m_iq_set = output * i_max;
 	}
 }
 
@@ -4677,7 +5328,17 @@ static float correct_hall(float angle, float dt, volatile motor_all_state_t *mot
 	volatile mc_configuration *conf_now = motor->m_conf;
 	motor->m_hall_dt_diff_now += dt;
 
-	float rad_per_sec = (M_PI / 3.0) / motor->m_hall_dt_diff_last;
+	int hall = utils_read_hall(motor != &m_motor_1, conf_now->m_hall_extra_samples);
+
+	// The observer is good enough for learning the hall delay when it is used
+	bool model_ok = false;
+	if (motor->m_hall_model_en) {
+		model_ok = foc_hall_update((foc_hall_state*)&motor->m_hall_model,
+				(const uint8_t*)conf_now->foc_hall_table, hall, dt, angle, !motor->m_using_hall,
+				RPM2RADPS_f(conf_now->foc_hall_interp_erpm));
+	}
+
+	float rad_per_sec = model_ok ? motor->m_hall_model.speed_now : (M_PI / 3.0) / motor->m_hall_dt_diff_last;
 	float rpm_abs_fast = fabsf(RADPS2RPM_f(motor->m_speed_est_fast));
 	float rpm_abs_hall = fabsf(RADPS2RPM_f(rad_per_sec));
 
@@ -4693,8 +5354,7 @@ static float correct_hall(float angle, float dt, volatile motor_all_state_t *mot
 		}
 	}
 
-	int ang_hall_int = conf_now->foc_hall_table[utils_read_hall(
-			motor != &m_motor_1, conf_now->m_hall_extra_samples)];
+	int ang_hall_int = conf_now->foc_hall_table[hall];
 
 	// Only override the observer if the hall sensor value is valid.
 	if (ang_hall_int < 201) {
@@ -4755,6 +5415,11 @@ static float correct_hall(float angle, float dt, volatile motor_all_state_t *mot
 			}
 		}
 
+		// The interpolation above still runs, so that it can take over at any time
+		if (model_ok) {
+			motor->m_ang_hall = motor->m_hall_model.angle;
+		}
+
 		// Limit hall sensor rate of change. This will reduce current spikes in the current controllers when the angle estimation
 		// changes fast.
 		float angle_step = (fmaxf(rpm_abs_hall, conf_now->foc_hall_interp_erpm) / 60.0) * 2.0 * M_PI * dt * 1.5;
@@ -4818,3 +5483,194 @@ static void terminal_plot_hfi(int argc, const char **argv) {
 		commands_printf("This command requires one argument.\n");
 	}
 }
+
+static void terminal_sched(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	commands_printf("Control loop: %.1f Hz, wakeup divider: %d, missed wakeups: %u",
+			(double)m_sched.f_base, m_sched.base_div, (unsigned int)m_sched.missed_ticks);
+
+	for (int i = 0;i < FOC_TASK_NUM;i++) {
+		volatile foc_sched_task_t *task = &m_sched.tasks[i];
+		commands_printf("%-6s div: %4d (%7.1f Hz)%s exec: %6.2f us (max %6.2f us) runs: %u overruns: %u",
+				task->name, task->div, (double)(m_sched.f_base / (float)task->div),
+				task->div_override > 0 ? "*" : " ",
+				(double)(task->exec_time * 1e6), (double)(task->exec_time_max * 1e6),
+				(unsigned int)task->runs, (unsigned int)task->overruns);
+		task->exec_time_max = 0.0;
+	}
+
+	commands_printf(" ");
+}
+
+static void terminal_sched_div(int argc, const char **argv) {
+	if (argc == 3) {
+		int task = -1;
+		for (int i = 0;i < FOC_TASK_NUM;i++) {
+			if (strcmp(argv[1], m_sched.tasks[i].name) == 0) {
+				task = i;
+				break;
+			}
+		}
+
+		int div = -1;
+		sscanf(argv[2], "%d", &div);
+
+		if (task >= 0 && div >= 0) {
+			m_sched.tasks[task].div_override = div;
+			m_sched.update_div = true;
+			commands_printf("Divider for %s set to %d\n", m_sched.tasks[task].name, div);
+		} else {
+			commands_printf("Invalid argument. Tasks: pos, speed, fw, timer, stats, temp. div >= 0.\n");
+		}
+	} else {
+		commands_printf("This command requires two arguments.\n");
+	}
+}
+
+static void terminal_traj_limits(int argc, const char **argv) {
+	if (argc == 4) {
+		float vel = -1.0;
+		float acc = -1.0;
+		float jerk = -1.0;
+		sscanf(argv[1], "%f", &vel);
+		sscanf(argv[2], "%f", &acc);
+		sscanf(argv[3], "%f", &jerk);
+
+		if (vel > 0.0 && acc > 0.0 && jerk >= 0.0) {
+			mcpwm_foc_set_pos_traj_limits(vel, acc, jerk);
+			commands_printf("Trajectory limits set\n");
+		} else {
+			commands_printf("Invalid argument. vel and acc must be > 0, jerk >= 0.\n");
+		}
+	} else {
+		commands_printf("This command requires three arguments.\n");
+	}
+}
+
+static void terminal_traj_ff(int argc, const char **argv) {
+	if (argc == 3) {
+		float kv = 0.0;
+		float ka = 0.0;
+		sscanf(argv[1], "%f", &kv);
+		sscanf(argv[2], "%f", &ka);
+
+		mcpwm_foc_set_pos_traj_ff(kv, ka);
+		commands_printf("Trajectory feedforward set\n");
+	} else {
+		commands_printf("This command requires two arguments.\n");
+	}
+}
+
+static void terminal_svm(int argc, const char **argv) {
+	if (argc == 3) {
+		int mode = -1;
+		int overmod = -1;
+		sscanf(argv[1], "%d", &mode);
+		sscanf(argv[2], "%d", &overmod);
+
+		if (mode >= 0 && mode < FOC_SVM_MODE_NUM && (overmod == 0 || overmod == 1)) {
+			if (!mcpwm_foc_set_svm((foc_svm_mode)mode, overmod)) {
+				commands_printf("This hardware has low-side shunts, which need the low-side on\n"
+						"in every PWM cycle. Only centered and DPWM min without\n"
+						"overmodulation can be used.");
+			}
+
+			commands_printf("Modulation set to %s%s\n", foc_svm_mode_name(motor_now()->m_svm_mode),
+					motor_now()->m_svm_overmod ? " with overmodulation" : "");
+		} else {
+			commands_printf("Invalid argument. mode: 0 - %d, overmod: 0 or 1.\n", FOC_SVM_MODE_NUM - 1);
+		}
+	} else {
+		commands_printf("Modulation: %s%s\n", foc_svm_mode_name(motor_now()->m_svm_mode),
+				motor_now()->m_svm_overmod ? " with overmodulation" : "");
+	}
+}
+
+static void terminal_dtc(int argc, const char **argv) {
+	volatile motor_all_state_t *motor = motor_now();
+
+	if (argc == 2) {
+		float current = -1.0;
+		sscanf(argv[1], "%f", &current);
+
+		if (current == 0.0) {
+			foc_dtc_reset((foc_dtc_table*)&motor->m_dtc);
+			mc_interface_lock();
+			dtc_store(motor);
+			mc_interface_unlock();
+			commands_printf("Dead time compensation table cleared, using foc_dt_us\n");
+			return;
+		} else if (current > 0.0 && current <= motor->m_conf->l_current_max) {
+			if (!mcpwm_foc_measure_dead_time(current, 100)) {
+				commands_printf("Measurement failed\n");
+				return;
+			}
+		} else {
+			commands_printf("Invalid argument. 0 < current <= l_current_max, or 0 to clear.\n");
+			return;
+		}
+	}
+
+	if (!motor->m_dtc.valid) {
+		commands_printf("No dead time compensation table, using foc_dt_us\n");
+		return;
+	}
+
+	commands_printf("Measured at %.1f kHz, R: %.2f mOhm\n",
+			(double)(motor->m_dtc.f_sw * 1e-3), (double)(motor->m_dtc.res * 1e3));
+	commands_printf("    I (A)   A (%%)   B (%%)   C (%%)");
+	for (int n = 0;n < FOC_DTC_POINTS;n++) {
+		commands_printf("  %6.2f  %6.3f  %6.3f  %6.3f",
+				(double)foc_dtc_point(motor->m_dtc.i_max, n),
+				(double)(motor->m_dtc.tab[0][n] * 100.0),
+				(double)(motor->m_dtc.tab[1][n] * 100.0),
+				(double)(motor->m_dtc.tab[2][n] * 100.0));
+	}
+	commands_printf(" ");
+}
+
+static void terminal_hall_model(int argc, const char **argv) {
+	volatile motor_all_state_t *motor = motor_now();
+
+	if (argc == 2) {
+		int enable = -1;
+		sscanf(argv[1], "%d", &enable);
+
+		if (enable == 0 || enable == 1) {
+			mcpwm_foc_set_hall_model(enable);
+		} else {
+			commands_printf("Invalid argument. enable: 0 or 1.\n");
+			return;
+		}
+	}
+
+	if (!motor->m_hall_model_en) {
+		commands_printf("Hall sensor model disabled\n");
+		return;
+	}
+
+	const foc_hall_state *h = (const foc_hall_state*)&motor->m_hall_model;
+
+	if (!h->table_ok) {
+		commands_printf("Hall sensor model enabled, but the hall table is not valid\n");
+		return;
+	}
+
+	commands_printf("Learned in %u + %u revolutions, delay %.1f us (%u updates)",
+			(unsigned int)h->cal_cnt[0] / 6, (unsigned int)h->cal_cnt[1] / 6,
+			(double)(h->delay * 1e6), (unsigned int)h->delay_cnt);
+	commands_printf("  State   Table   Fwd (deg)   Rev (deg)");
+	for (int s = 0;s < 8;s++) {
+		if (h->next[s] < 0) {
+			continue;
+		}
+
+		commands_printf("  %d       %5.1f   %5.1f       %5.1f", s,
+				(double)RAD2DEG_f(h->nominal[s]),
+				(double)RAD2DEG_f(foc_hall_edge_angle(h, s, 1)),
+				(double)RAD2DEG_f(foc_hall_edge_angle(h, s, -1)));
+	}
+	commands_printf(" ");
+}
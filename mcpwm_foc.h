@@ -22,6 +22,7 @@
 
 #include "conf_general.h"
 #include "datatypes.h"
+#include "foc_svm.h"
 #include <stdbool.h>
 
 // Functions
@@ -37,6 +38,12 @@ void mcpwm_foc_set_duty(float dutyCycle);
 void mcpwm_foc_set_duty_noramp(float dutyCycle);
 void mcpwm_foc_set_pid_speed(float rpm);
 void mcpwm_foc_set_pid_pos(float pos);
+void mcpwm_foc_set_pid_pos_traj(float pos);
+bool mcpwm_foc_push_pid_pos_waypoint(float pos, float vel);
+void mcpwm_foc_set_pos_traj_limits(float vel, float acc, float jerk);
+void mcpwm_foc_set_pos_traj_ff(float kv, float ka);
+bool mcpwm_foc_set_svm(foc_svm_mode mode, bool overmod);
+void mcpwm_foc_set_hall_model(bool enable);
 void mcpwm_foc_set_current(float current);
 void mcpwm_foc_set_brake_current(float current);
 void mcpwm_foc_set_handbrake(float current);
@@ -78,6 +85,7 @@ float mcpwm_foc_measure_resistance(float current, int samples, bool stop_after);
 float mcpwm_foc_measure_inductance(float duty, int samples, float *curr, float *ld_lq_diff);
 float mcpwm_foc_measure_inductance_current(float curr_goal, int samples, float *curr, float *ld_lq_diff);
 bool mcpwm_foc_measure_res_ind(float *res, float *ind, float *ld_lq_diff);
+bool mcpwm_foc_measure_dead_time(float current, int samples);
 bool mcpwm_foc_hall_detect(float current, uint8_t *hall_table);
 int mcpwm_foc_dc_cal(bool cal_undriven);
 void mcpwm_foc_print_state(void);
@@ -1,6 +1,7 @@
 NRFSRC =	nrf/spi_sw.c \
 			nrf/rf.c \
 			nrf/rfhelp.c \
-			nrf/nrf_driver.c
+			nrf/nrf_driver.c \
+			nrf/rf_transport.c
 
 NRFINC = nrf
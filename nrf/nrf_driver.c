@@ -21,6 +21,7 @@
 #include "nrf_driver.h"
 #include "rf.h"
 #include "rfhelp.h"
+#include "rf_transport.h"
 #include "conf_general.h"
 #include "app.h"
 #include "buffer.h"
@@ -56,6 +57,13 @@ static volatile bool rx_stop = true;
 static volatile bool ext_nrf = false;
 static volatile int driver_paused = 0;
 
+// Windowed transport for long messages, used when the other side has
+// sent with it.
+static RF_TRANSPORT_STATE_t transport;
+static mutex_t transport_mutex;
+static bool transport_init_done = false;
+static volatile bool peer_windowed = false;
+
 // This is a hack to prevent race conditions when updating the appconf
 // from the nrf thread
 static volatile bool from_nrf = false;
@@ -64,6 +72,8 @@ static volatile bool from_nrf = false;
 static THD_FUNCTION(rx_thread, arg);
 static THD_FUNCTION(tx_thread, arg);
 static int rf_tx_wrapper(char *data, int len);
+static int transport_send(unsigned char *data, unsigned int len);
+static void transport_init(void);
 
 bool nrf_driver_init(void) {
 	if (from_nrf) {
@@ -85,6 +95,8 @@ bool nrf_driver_init(void) {
 	pairing_time_end = 0;
 	pairing_active = false;
 
+	transport_init();
+
 	rx_stop = false;
 	tx_stop = false;
 	chThdCreateStatic(rx_thread_wa, sizeof(rx_thread_wa), NORMALPRIO - 1, rx_thread, NULL);
@@ -96,6 +108,10 @@ bool nrf_driver_init(void) {
 }
 
 void nrf_driver_init_ext_nrf(void) {
+	if (!ext_nrf) {
+		transport_init();
+	}
+
 	ext_nrf = true;
 
 	if (!tx_running) {
@@ -181,6 +197,23 @@ static int rf_tx_wrapper(char *data, int len) {
 	return res;
 }
 
+static int transport_send(unsigned char *data, unsigned int len) {
+	nosend_cnt = 0;
+	return rf_tx_wrapper((char*)data, len);
+}
+
+static void transport_init(void) {
+	if (!transport_init_done) {
+		chMtxObjectInit(&transport_mutex);
+		transport_init_done = true;
+	}
+
+	chMtxLock(&transport_mutex);
+	rf_transport_init(transport_send, MOTE_PACKET_WINDOW_DATA, MOTE_PACKET_WINDOW_ACK, &transport);
+	chMtxUnlock(&transport_mutex);
+	peer_windowed = false;
+}
+
 static THD_FUNCTION(tx_thread, arg) {
 	(void)arg;
 
@@ -225,6 +258,12 @@ static THD_FUNCTION(tx_thread, arg) {
 			nosend_cnt = 0;
 		}
 
+		if (driver_paused == 0) {
+			chMtxLock(&transport_mutex);
+			rf_transport_timer(1, &transport);
+			chMtxUnlock(&transport_mutex);
+		}
+
 		if (driver_paused > 0) {
 			driver_paused--;
 		}
@@ -320,6 +359,10 @@ void nrf_driver_send_buffer(unsigned char *data, unsigned int len) {
 		ind += len;
 		rf_tx_wrapper((char*)send_buffer, ind);
 		nosend_cnt = 0;
+	} else if (peer_windowed) {
+		chMtxLock(&transport_mutex);
+		rf_transport_send(data, len, &transport);
+		chMtxUnlock(&transport_mutex);
 	} else {
 		unsigned int end_a = 0;
 		unsigned int len2 = len - (MAX_PL_LEN - 5);
@@ -427,6 +470,7 @@ void nrf_driver_process_packet(unsigned char *buf, unsigned char len) {
 	break;
 
 	case MOTE_PACKET_PROCESS_RX_BUFFER: {
+		peer_windowed = false;
 		ind = 1;
 		int rxbuf_len = (unsigned int)buf[ind++] << 8;
 		rxbuf_len |= (unsigned int)buf[ind++];
@@ -463,6 +507,25 @@ void nrf_driver_process_packet(unsigned char *buf, unsigned char len) {
 		from_nrf = false;
 		break;
 
+	case MOTE_PACKET_WINDOW_DATA:
+	case MOTE_PACKET_WINDOW_ACK: {
+		if (!transport_init_done) {
+			break;
+		}
+
+		peer_windowed = true;
+
+		chMtxLock(&transport_mutex);
+		int rxbuf_len = rf_transport_process_packet(buf, len, &transport);
+		chMtxUnlock(&transport_mutex);
+
+		if (rxbuf_len > 0) {
+			from_nrf = true;
+			commands_process_packet(transport.rx_msg.data, rxbuf_len, nrf_driver_send_buffer);
+			from_nrf = false;
+		}
+	} break;
+
 	case MOTE_PACKET_PAIRING_INFO: {
 		ind = 1;
 
@@ -0,0 +1,385 @@
+/*
+	Copyright 2016 - 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+/*
+ * Windowed transport for messages that do not fit in one radio packet.
+ *
+ * The message and its CRC are split into chunks of RF_TRANSPORT_CHUNK_LEN
+ * bytes. Each chunk has a one byte header:
+ *
+ * bit 7:    Message sequence bit, toggled for every new message
+ * bit 6:    Ack request
+ * bit 5:    Last chunk of the message, which gives the message length
+ * bit 4..0: Chunk index
+ *
+ * All chunks are sent once back to back, RF_TRANSPORT_WINDOW per call to
+ * rf_transport_timer, with an ack request on the last one. The receiver
+ * answers an ack request or a complete message with the sequence bit, a
+ * complete flag, the index of the chunk that asked and a bitmap of the
+ * received chunks. The sender then sends the chunks that are missing, up to
+ * RF_TRANSPORT_WINDOW at a time with an ack request on the last one, and
+ * waits for the ack again. If there is no ack within RF_TRANSPORT_ACK_TIMEOUT
+ * the missing chunks are sent again. The next message starts when the
+ * previous one is acked as complete.
+ *
+ * This is independent of the radio and the RTOS, the caller provides the
+ * time and locking.
+ */
+
+#include <string.h>
+#include "rf_transport.h"
+#include "crc.h"
+
+#if ((RF_TRANSPORT_MAX_LEN + 2 + RF_TRANSPORT_CHUNK_LEN - 1) / RF_TRANSPORT_CHUNK_LEN) > RF_TRANSPORT_MAX_CHUNKS
+#error "RF_TRANSPORT_MAX_LEN needs more chunks than the ack bitmap has"
+#endif
+
+#define HDR_SEQ					(1 << 7)
+#define HDR_ACK_REQ				(1 << 6)
+#define HDR_LAST				(1 << 5)
+#define HDR_INDEX_MASK			0x1F
+#define ACK_COMPLETE			(1 << 6)
+
+// Private functions
+static void start_message(RF_TRANSPORT_STATE_t *state);
+static void next_message(RF_TRANSPORT_STATE_t *state);
+static void send_window(RF_TRANSPORT_STATE_t *state);
+static void send_ack(RF_TRANSPORT_STATE_t *state, int seq, int index, bool complete);
+static void rx_reset(RF_TRANSPORT_STATE_t *state);
+
+static uint32_t chunk_mask(int chunks) {
+	return chunks >= 32 ? 0xFFFFFFFF : ((uint32_t)1 << chunks) - 1;
+}
+
+void rf_transport_init(int(*s_func)(unsigned char *data, unsigned int len),
+		uint8_t data_id, uint8_t ack_id, RF_TRANSPORT_STATE_t *state) {
+	memset(state, 0, sizeof(RF_TRANSPORT_STATE_t));
+	state->send_func = s_func;
+	state->data_id = data_id;
+	state->ack_id = ack_id;
+	rx_reset(state);
+}
+
+/**
+ * Queue a message for sending. The message is sent from rf_transport_timer.
+ *
+ * @param data
+ * The message.
+ *
+ * @param len
+ * The length of the message, at most RF_TRANSPORT_MAX_LEN.
+ *
+ * @param state
+ * The transport state.
+ *
+ * @return
+ * true if the message was queued, false if it was too long or the queue
+ * was full.
+ */
+bool rf_transport_send(unsigned char *data, unsigned int len, RF_TRANSPORT_STATE_t *state) {
+	if (len == 0 || len > RF_TRANSPORT_MAX_LEN ||
+			state->tx_queue_num >= RF_TRANSPORT_TX_QUEUE) {
+		state->stats.msgs_dropped++;
+		return false;
+	}
+
+	RF_TRANSPORT_MSG_t *msg = &state->tx_queue[state->tx_queue_num++];
+	memcpy(msg->data, data, len);
+	unsigned short crc = crc16(data, len);
+	msg->data[len] = (uint8_t)(crc >> 8);
+	msg->data[len + 1] = (uint8_t)(crc & 0xFF);
+	msg->len = len + 2;
+
+	if (state->tx_queue_num == 1) {
+		start_message(state);
+	}
+
+	return true;
+}
+
+bool rf_transport_busy(RF_TRANSPORT_STATE_t *state) {
+	return state->tx_queue_num > 0;
+}
+
+/**
+ * Process a data or ack packet from the radio.
+ *
+ * @param buf
+ * The packet, starting with data_id or ack_id.
+ *
+ * @param len
+ * The length of the packet.
+ *
+ * @param state
+ * The transport state.
+ *
+ * @return
+ * The length of the message in state->rx_msg.data if this packet completed
+ * one, 0 otherwise. The message stays there until the next message starts.
+ */
+int rf_transport_process_packet(unsigned char *buf, unsigned int len, RF_TRANSPORT_STATE_t *state) {
+	if (len >= 6 && buf[0] == state->ack_id) {
+		int seq = (buf[1] & HDR_SEQ) ? 1 : 0;
+		uint32_t bitmap = (uint32_t)buf[2] | (uint32_t)buf[3] << 8 |
+				(uint32_t)buf[4] << 16 | (uint32_t)buf[5] << 24;
+
+		int index = buf[1] & HDR_INDEX_MASK;
+
+		if (state->tx_queue_num == 0 || seq != state->tx_seq) {
+			return 0;
+		}
+
+		if (buf[1] & ACK_COMPLETE) {
+			state->stats.msgs_sent++;
+			next_message(state);
+			return 0;
+		}
+
+		// The receiver clears its bitmap if the CRC did not match, so
+		// the bitmap replaces what was acked before.
+		bitmap &= chunk_mask(state->tx_chunks);
+		if (bitmap & ~state->tx_acked) {
+			state->tx_rounds = 0;
+		}
+
+		state->tx_acked = bitmap;
+
+		// Acks for earlier windows arrive while later chunks are on the way
+		if (index == state->tx_req_index) {
+			state->tx_wait_ack = false;
+		}
+
+		return 0;
+	}
+
+	if (len < 2 || buf[0] != state->data_id) {
+		return 0;
+	}
+
+	int seq = (buf[1] & HDR_SEQ) ? 1 : 0;
+	bool ack_req = buf[1] & HDR_ACK_REQ;
+	bool last = buf[1] & HDR_LAST;
+	int index = buf[1] & HDR_INDEX_MASK;
+	unsigned int data_len = len - 2;
+	unsigned int offset = index * RF_TRANSPORT_CHUNK_LEN;
+
+	if (seq != state->rx_seq) {
+		rx_reset(state);
+		state->rx_seq = seq;
+	}
+
+	state->rx_timer = RF_TRANSPORT_RX_TIMEOUT;
+
+	if (state->rx_complete) {
+		// The ack got lost, so the sender is still trying
+		if (ack_req || last) {
+			send_ack(state, seq, index, true);
+		}
+		return 0;
+	}
+
+	// All chunks but the last one are full
+	bool valid = data_len > 0 && data_len <= RF_TRANSPORT_CHUNK_LEN &&
+			(offset + data_len) <= sizeof(state->rx_msg.data) &&
+			(last || data_len == RF_TRANSPORT_CHUNK_LEN) &&
+			(state->rx_chunks < 0 || index < state->rx_chunks);
+
+	if (valid) {
+		memcpy(state->rx_msg.data + offset, buf + 2, data_len);
+		state->rx_received |= (uint32_t)1 << index;
+
+		if (last) {
+			state->rx_chunks = index + 1;
+			state->rx_msg.len = offset + data_len;
+		}
+	}
+
+	if (state->rx_chunks > 0 && state->rx_received == chunk_mask(state->rx_chunks)) {
+		unsigned int msg_len = state->rx_msg.len;
+		unsigned short crc = 0;
+
+		if (msg_len > 2) {
+			crc = (unsigned short)state->rx_msg.data[msg_len - 2] << 8 |
+					(unsigned short)state->rx_msg.data[msg_len - 1];
+		}
+
+		if (msg_len > 2 && crc16(state->rx_msg.data, msg_len - 2) == crc) {
+			state->rx_complete = true;
+			state->stats.msgs_received++;
+			send_ack(state, seq, index, true);
+			return msg_len - 2;
+		}
+
+		// Start over, the sender will resend everything
+		state->stats.crc_errors++;
+		state->rx_received = 0;
+		state->rx_chunks = -1;
+		send_ack(state, seq, index, false);
+		return 0;
+	}
+
+	if (ack_req || last) {
+		send_ack(state, seq, index, false);
+	}
+
+	return 0;
+}
+
+/**
+ * Run the transport. Call this regularly, e.g. every millisecond.
+ *
+ * @param ms
+ * The time since the last call in milliseconds.
+ *
+ * @param state
+ * The transport state.
+ */
+void rf_transport_timer(int ms, RF_TRANSPORT_STATE_t *state) {
+	if (state->tx_queue_num > 0) {
+		if (!state->tx_wait_ack) {
+			send_window(state);
+		} else {
+			state->tx_timer -= ms;
+
+			if (state->tx_timer <= 0) {
+				state->tx_rounds++;
+
+				if (state->tx_rounds >= RF_TRANSPORT_MAX_ROUNDS) {
+					state->stats.msgs_failed++;
+					next_message(state);
+				} else {
+					send_window(state);
+				}
+			}
+		}
+	}
+
+	if (state->rx_timer > 0) {
+		state->rx_timer -= ms;
+
+		if (state->rx_timer <= 0) {
+			rx_reset(state);
+		}
+	}
+}
+
+static void start_message(RF_TRANSPORT_STATE_t *state) {
+	RF_TRANSPORT_MSG_t *msg = &state->tx_queue[0];
+
+	state->tx_chunks = (msg->len + RF_TRANSPORT_CHUNK_LEN - 1) / RF_TRANSPORT_CHUNK_LEN;
+	state->tx_sent = 0;
+	state->tx_acked = 0;
+	state->tx_seq ^= 1;
+	state->tx_timer = 0;
+	state->tx_rounds = 0;
+	state->tx_wait_ack = false;
+}
+
+static void next_message(RF_TRANSPORT_STATE_t *state) {
+	state->tx_queue_num--;
+
+	for (int i = 0;i < state->tx_queue_num;i++) {
+		state->tx_queue[i] = state->tx_queue[i + 1];
+	}
+
+	if (state->tx_queue_num > 0) {
+		start_message(state);
+	}
+}
+
+/*
+ * Sends the next chunks that have not been sent yet, or when all have been
+ * sent once the first chunks that have not been acked. The last chunk of
+ * the message and the last chunk of every resent window ask for an ack.
+ */
+static void send_window(RF_TRANSPORT_STATE_t *state) {
+	RF_TRANSPORT_MSG_t *msg = &state->tx_queue[0];
+	uint32_t all = chunk_mask(state->tx_chunks);
+	bool first_pass = (state->tx_sent & all) != all;
+	uint32_t pending = first_pass ? ~state->tx_sent & all : ~state->tx_acked & all;
+	uint8_t buffer[RF_TRANSPORT_RADIO_PL_LEN];
+	int sent = 0;
+
+	for (int i = 0;i < state->tx_chunks && sent < RF_TRANSPORT_WINDOW;i++) {
+		if (!(pending & ((uint32_t)1 << i))) {
+			continue;
+		}
+
+		pending &= ~((uint32_t)1 << i);
+		sent++;
+
+		bool last = i == (state->tx_chunks - 1);
+		unsigned int offset = i * RF_TRANSPORT_CHUNK_LEN;
+		unsigned int len = last ? msg->len - offset : RF_TRANSPORT_CHUNK_LEN;
+
+		buffer[0] = state->data_id;
+		buffer[1] = i | (state->tx_seq ? HDR_SEQ : 0) | (last ? HDR_LAST : 0);
+
+		if (pending == 0 || (!first_pass && sent == RF_TRANSPORT_WINDOW)) {
+			buffer[1] |= HDR_ACK_REQ;
+			state->tx_req_index = i;
+		}
+
+		memcpy(buffer + 2, msg->data + offset, len);
+
+		if (state->tx_sent & ((uint32_t)1 << i)) {
+			state->stats.chunks_resent++;
+		}
+
+		state->tx_sent |= (uint32_t)1 << i;
+		state->stats.chunks_sent++;
+
+		if (state->send_func) {
+			state->send_func(buffer, len + 2);
+		}
+	}
+
+	// Keep going until everything has been sent once
+	if ((state->tx_sent & all) == all) {
+		state->tx_wait_ack = true;
+		state->tx_timer = RF_TRANSPORT_ACK_TIMEOUT;
+	}
+}
+
+static void send_ack(RF_TRANSPORT_STATE_t *state, int seq, int index, bool complete) {
+	uint8_t buffer[6];
+	uint32_t bitmap = state->rx_received;
+
+	buffer[0] = state->ack_id;
+	buffer[1] = index | (seq ? HDR_SEQ : 0) | (complete ? ACK_COMPLETE : 0);
+	buffer[2] = bitmap & 0xFF;
+	buffer[3] = (bitmap >> 8) & 0xFF;
+	buffer[4] = (bitmap >> 16) & 0xFF;
+	buffer[5] = (bitmap >> 24) & 0xFF;
+
+	state->stats.acks_sent++;
+
+	if (state->send_func) {
+		state->send_func(buffer, sizeof(buffer));
+	}
+}
+
+static void rx_reset(RF_TRANSPORT_STATE_t *state) {
+	state->rx_received = 0;
+	state->rx_chunks = -1;
+	state->rx_seq = -1;
+	state->rx_timer = 0;
+	state->rx_complete = false;
+	state->rx_msg.len = 0;
+}
@@ -0,0 +1,93 @@
+/*
+	Copyright 2016 - 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef NRF_RF_TRANSPORT_H_
+#define NRF_RF_TRANSPORT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Settings
+#ifndef RF_TRANSPORT_MAX_LEN
+#define RF_TRANSPORT_MAX_LEN		512
+#endif
+
+#define RF_TRANSPORT_RADIO_PL_LEN	25
+#define RF_TRANSPORT_CHUNK_LEN		(RF_TRANSPORT_RADIO_PL_LEN - 2)
+#define RF_TRANSPORT_MAX_CHUNKS		32
+#define RF_TRANSPORT_WINDOW			8
+#define RF_TRANSPORT_TX_QUEUE		2
+#define RF_TRANSPORT_ACK_TIMEOUT	15 // Resend the missing chunks if there is no ack within this time (ms)
+#define RF_TRANSPORT_MAX_ROUNDS		12 // Give up after this many timeouts without progress
+#define RF_TRANSPORT_RX_TIMEOUT		100 // Forget a message after this time without chunks (ms)
+
+// Types
+typedef struct {
+	uint8_t data[RF_TRANSPORT_MAX_LEN + 2];
+	unsigned int len;
+} RF_TRANSPORT_MSG_t;
+
+typedef struct {
+	unsigned int msgs_sent;
+	unsigned int msgs_failed;
+	unsigned int msgs_dropped;
+	unsigned int msgs_received;
+	unsigned int chunks_sent;
+	unsigned int chunks_resent;
+	unsigned int acks_sent;
+	unsigned int crc_errors;
+} RF_TRANSPORT_STATS_t;
+
+typedef struct {
+	int(*send_func)(unsigned char *data, unsigned int len);
+	uint8_t data_id;
+	uint8_t ack_id;
+
+	// Sending
+	RF_TRANSPORT_MSG_t tx_queue[RF_TRANSPORT_TX_QUEUE];
+	int tx_queue_num;
+	int tx_chunks;
+	uint32_t tx_sent;
+	uint32_t tx_acked;
+	uint8_t tx_seq;
+	int tx_timer;
+	int tx_rounds;
+	int tx_req_index;
+	bool tx_wait_ack;
+
+	// Receiving
+	RF_TRANSPORT_MSG_t rx_msg;
+	uint32_t rx_received;
+	int rx_chunks;
+	int rx_seq;
+	int rx_timer;
+	bool rx_complete;
+
+	RF_TRANSPORT_STATS_t stats;
+} RF_TRANSPORT_STATE_t;
+
+// Functions
+void rf_transport_init(int(*s_func)(unsigned char *data, unsigned int len),
+		uint8_t data_id, uint8_t ack_id, RF_TRANSPORT_STATE_t *state);
+bool rf_transport_send(unsigned char *data, unsigned int len, RF_TRANSPORT_STATE_t *state);
+bool rf_transport_busy(RF_TRANSPORT_STATE_t *state);
+int rf_transport_process_packet(unsigned char *buf, unsigned int len, RF_TRANSPORT_STATE_t *state);
+void rf_transport_timer(int ms, RF_TRANSPORT_STATE_t *state);
+
+#endif /* NRF_RF_TRANSPORT_H_ */
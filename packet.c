@@ -24,6 +24,7 @@
 // Private functions
 static int try_decode_packet(unsigned char *buffer, unsigned int in_len,
 		void(*process_func)(unsigned char *data, unsigned int len), int *bytes_left);
+static void decode_rx_buffer(PACKET_STATE_t *state, unsigned int data_len);
 
 void packet_init(void (*s_func)(unsigned char *data, unsigned int len),
 		void (*p_func)(unsigned char *data, unsigned int len), PACKET_STATE_t *state) {
@@ -103,6 +104,88 @@ void packet_process_byte(uint8_t rx_data, PACKET_STATE_t *state) {
 		return;
 	}
 
+	decode_rx_buffer(state, data_len);
+}
+
+/**
+ * Process a block of received data. This gives the same packets as calling
+ * packet_process_byte for every byte, but packets that are completely within
+ * data are decoded in place without copying them to the receive buffer first.
+ *
+ * @param data
+ * The received data. Decoded packets point into it, so it must not be
+ * modified before this function returns.
+ *
+ * @param len
+ * The length of the data.
+ *
+ * @param state
+ * The packet state.
+ */
+void packet_process_data(unsigned char *data, unsigned int len, PACKET_STATE_t *state) {
+	while (len > 0) {
+		unsigned int data_len = state->rx_write_ptr - state->rx_read_ptr;
+
+		if (data_len == 0) {
+			int res = try_decode_packet(data, len, state->process_func, &state->bytes_left);
+
+			if (res > 0) {
+				data += res;
+				len -= res;
+			} else if (res == -1) {
+				data++;
+				len--;
+			} else {
+				// The rest is the beginning of a packet, which is shorter
+				// than the receive buffer.
+				memcpy(state->rx_buffer, data, len);
+				state->rx_read_ptr = 0;
+				state->rx_write_ptr = len;
+				break;
+			}
+
+			continue;
+		}
+
+		// Only append what the packet in the buffer needs, so that
+		// decoding can go back to the data as soon as it is empty.
+		unsigned int add = state->bytes_left > 1 ? (unsigned int)state->bytes_left : 1;
+		if (add > len) {
+			add = len;
+		}
+
+		// Out of space (should not happen)
+		if ((data_len + add) > PACKET_BUFFER_LEN) {
+			packet_process_byte(*data++, state);
+			len--;
+			continue;
+		}
+
+		if ((state->rx_write_ptr + add) > PACKET_BUFFER_LEN) {
+			memmove(state->rx_buffer,
+					state->rx_buffer + state->rx_read_ptr,
+					data_len);
+
+			state->rx_read_ptr = 0;
+			state->rx_write_ptr = data_len;
+		}
+
+		memcpy(state->rx_buffer + state->rx_write_ptr, data, add);
+		state->rx_write_ptr += add;
+		data_len += add;
+		data += add;
+		len -= add;
+
+		if (state->bytes_left > (int)add) {
+			state->bytes_left -= add;
+			continue;
+		}
+
+		decode_rx_buffer(state, data_len);
+	}
+}
+
+static void decode_rx_buffer(PACKET_STATE_t *state, unsigned int data_len) {
 	// Try decoding the packet at various offsets until it succeeds, or
 	// until we run out of data.
 	for (;;) {
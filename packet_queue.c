@@ -0,0 +1,114 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "packet_queue.h"
+
+#include <string.h>
+
+/*
+ * Queue of whole packets in a ring buffer. Packets are stored with their
+ * length in two bytes first, and can wrap around the end of the buffer. A
+ * packet that does not fit is not stored at all and counted as dropped, and
+ * pop only returns whole packets. There is no locking here, that is up to
+ * the user.
+ */
+
+static void copy_in(packet_queue *q, const uint8_t *data, unsigned int len) {
+	unsigned int first = q->size - q->write;
+	if (first > len) {
+		first = len;
+	}
+
+	memcpy(q->buffer + q->write, data, first);
+	memcpy(q->buffer, data + first, len - first);
+
+	q->write += len;
+	if (q->write >= q->size) {
+		q->write -= q->size;
+	}
+}
+
+static void copy_out(packet_queue *q, uint8_t *data, unsigned int len) {
+	unsigned int first = q->size - q->read;
+	if (first > len) {
+		first = len;
+	}
+
+	memcpy(data, q->buffer + q->read, first);
+	memcpy(data + first, q->buffer, len - first);
+
+	q->read += len;
+	if (q->read >= q->size) {
+		q->read -= q->size;
+	}
+}
+
+void packet_queue_init(packet_queue *q, uint8_t *buffer, unsigned int size) {
+	memset(q, 0, sizeof(packet_queue));
+	q->buffer = buffer;
+	q->size = size;
+}
+
+bool packet_queue_fits(packet_queue *q, unsigned int len) {
+	return (len + PACKET_QUEUE_OVERHEAD) <= (q->size - q->used) && len <= 0xFFFF;
+}
+
+bool packet_queue_push(packet_queue *q, const uint8_t *data, unsigned int len) {
+	if (!packet_queue_fits(q, len)) {
+		q->dropped++;
+		return false;
+	}
+
+	uint8_t len_bytes[PACKET_QUEUE_OVERHEAD] = {len >> 8, len & 0xFF};
+	copy_in(q, len_bytes, PACKET_QUEUE_OVERHEAD);
+	copy_in(q, data, len);
+
+	q->used += len + PACKET_QUEUE_OVERHEAD;
+	if (q->used > q->peak) {
+		q->peak = q->used;
+	}
+
+	return true;
+}
+
+/*
+ * Pops as many whole packets as fit in max bytes.
+ */
+unsigned int packet_queue_pop(packet_queue *q, uint8_t *out, unsigned int max) {
+	unsigned int res = 0;
+
+	while (q->used > 0) {
+		uint8_t len_bytes[PACKET_QUEUE_OVERHEAD];
+		unsigned int read = q->read;
+		copy_out(q, len_bytes, PACKET_QUEUE_OVERHEAD);
+		unsigned int len = (unsigned int)len_bytes[0] << 8 | (unsigned int)len_bytes[1];
+
+		if ((res + len) > max) {
+			q->read = read;
+			break;
+		}
+
+		copy_out(q, out + res, len);
+		q->used -= len + PACKET_QUEUE_OVERHEAD;
+		q->sent++;
+		res += len;
+	}
+
+	return res;
+}
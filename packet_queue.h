@@ -0,0 +1,46 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef PACKET_QUEUE_H_
+#define PACKET_QUEUE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+	uint8_t *buffer;
+	unsigned int size;
+	unsigned int read;
+	unsigned int write;
+	unsigned int used;
+	unsigned int peak;
+	unsigned int sent;
+	unsigned int dropped;
+} packet_queue;
+
+// Bytes that a packet takes in the queue besides its data
+#define PACKET_QUEUE_OVERHEAD		2
+
+// Functions
+void packet_queue_init(packet_queue *q, uint8_t *buffer, unsigned int size);
+bool packet_queue_fits(packet_queue *q, unsigned int len);
+bool packet_queue_push(packet_queue *q, const uint8_t *data, unsigned int len);
+unsigned int packet_queue_pop(packet_queue *q, uint8_t *out, unsigned int max);
+
+#endif /* PACKET_QUEUE_H_ */
@@ -0,0 +1,219 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "rc_serial.h"
+
+#include <string.h>
+
+/*
+ * Decoding of the SBUS and CRSF serial receiver protocols. Both of them send
+ * 16 channels of 11 bits packed LSB first, and a channel frame arrives
+ * every few milliseconds without the jitter and the 1-2 ms of pulse length
+ * that servo pulses have.
+ *
+ * SBUS: 100000 baud 8E2, inverted. 25 byte frames that start with 0x0F,
+ * followed by 22 bytes of channels, a flag byte and an end byte.
+ *
+ * CRSF: 420000 baud 8N1. Frames are address, length, type, payload and a
+ * CRC8 with polynomial 0xD5 over the type and the payload. The length
+ * counts the type, the payload and the CRC.
+ */
+
+// SBUS
+#define SBUS_FRAME_LEN				25
+#define SBUS_HEADER					0x0F
+#define SBUS_FLAG_FRAME_LOST		(1 << 2)
+#define SBUS_FLAG_FAILSAFE			(1 << 3)
+
+// CRSF
+#define CRSF_ADDR_FC				0xC8
+#define CRSF_ADDR_RX				0xEC
+#define CRSF_ADDR_TX				0xEE
+#define CRSF_LEN_MIN				2
+#define CRSF_LEN_MAX				62
+#define CRSF_TYPE_LINK_STATS		0x14
+#define CRSF_TYPE_RC_CHANNELS		0x16
+#define CRSF_RC_PAYLOAD_LEN			22
+
+// Private functions
+static void unpack_channels(rc_serial_state *s, const uint8_t *data);
+static bool sbus_byte(rc_serial_state *s, uint8_t b);
+static bool crsf_byte(rc_serial_state *s, uint8_t b);
+
+void rc_serial_init(rc_serial_state *s, rc_serial_proto proto) {
+	memset(s, 0, sizeof(rc_serial_state));
+	s->proto = proto;
+	s->link_quality = -1;
+
+	for (int i = 0;i < RC_SERIAL_CHANNELS;i++) {
+		s->ch[i] = 992;
+	}
+}
+
+/**
+ * Call when the line has been idle for longer than between the bytes of a
+ * frame. A partial frame is dropped, so that the next byte is taken as the
+ * start of a frame.
+ */
+void rc_serial_gap(rc_serial_state *s) {
+	s->ind = 0;
+}
+
+/**
+ * Process a received byte.
+ *
+ * @return
+ * true when the byte completed a frame with channels. The channels and the
+ * flags are then updated.
+ */
+bool rc_serial_process_byte(rc_serial_state *s, uint8_t b) {
+	switch (s->proto) {
+	case RC_SERIAL_SBUS: return sbus_byte(s, b);
+	case RC_SERIAL_CRSF: return crsf_byte(s, b);
+	default: return false;
+	}
+}
+
+/**
+ * Convert a channel value to the length of the servo pulse that the
+ * receiver would output for it. SBUS and CRSF use the same scale, where 172
+ * is 988 us, 992 is 1500 us and 1811 is 2012 us.
+ */
+float rc_serial_ch_to_ms(uint16_t value) {
+	return 1.5 + ((float)value - 992.0) * 0.000625;
+}
+
+uint8_t rc_serial_crc8(const uint8_t *data, int len) {
+	uint8_t crc = 0;
+
+	for (int i = 0;i < len;i++) {
+		crc ^= data[i];
+		for (int j = 0;j < 8;j++) {
+			if (crc & 0x80) {
+				crc = (crc << 1) ^ 0xD5;
+			} else {
+				crc <<= 1;
+			}
+		}
+	}
+
+	return crc;
+}
+
+const char *rc_serial_proto_name(rc_serial_proto proto) {
+	switch (proto) {
+	case RC_SERIAL_SBUS: return "SBUS";
+	case RC_SERIAL_CRSF: return "CRSF";
+	default: return "None";
+	}
+}
+
+static void unpack_channels(rc_serial_state *s, const uint8_t *data) {
+	uint32_t bits = 0;
+	int bit_cnt = 0;
+	int ind = 0;
+
+	for (int i = 0;i < RC_SERIAL_CHANNELS;i++) {
+		while (bit_cnt < 11) {
+			bits |= (uint32_t)data[ind++] << bit_cnt;
+			bit_cnt += 8;
+		}
+
+		s->ch[i] = bits & 0x7FF;
+		bits >>= 11;
+		bit_cnt -= 11;
+	}
+}
+
+static bool sbus_byte(rc_serial_state *s, uint8_t b) {
+	if (s->ind == 0 && b != SBUS_HEADER) {
+		return false;
+	}
+
+	s->buf[s->ind++] = b;
+
+	if (s->ind < SBUS_FRAME_LEN) {
+		return false;
+	}
+
+	s->ind = 0;
+
+	// The end byte is 0 for SBUS, and has 0x04 in the low nibble for SBUS2
+	if (b != 0x00 && (b & 0x0F) != 0x04) {
+		s->error_cnt++;
+		return false;
+	}
+
+	uint8_t flags = s->buf[23];
+	unpack_channels(s, s->buf + 1);
+	s->failsafe = flags & SBUS_FLAG_FAILSAFE;
+	s->frame_lost = flags & SBUS_FLAG_FRAME_LOST;
+	s->frame_cnt++;
+
+	if (s->frame_lost) {
+		s->lost_cnt++;
+	}
+
+	return true;
+}
+
+static bool crsf_byte(rc_serial_state *s, uint8_t b) {
+	if (s->ind == 0) {
+		if (b != CRSF_ADDR_FC && b != CRSF_ADDR_RX && b != CRSF_ADDR_TX) {
+			return false;
+		}
+	} else if (s->ind == 1) {
+		if (b < CRSF_LEN_MIN || b > CRSF_LEN_MAX) {
+			s->ind = 0;
+			s->error_cnt++;
+			return false;
+		}
+	}
+
+	s->buf[s->ind++] = b;
+
+	if (s->ind < 2 || s->ind < s->buf[1] + 2) {
+		return false;
+	}
+
+	s->ind = 0;
+
+	int len = s->buf[1];
+	uint8_t type = s->buf[2];
+	const uint8_t *payload = s->buf + 3;
+
+	if (rc_serial_crc8(s->buf + 2, len - 1) != s->buf[len + 1]) {
+		s->error_cnt++;
+		return false;
+	}
+
+	if (type == CRSF_TYPE_LINK_STATS && len >= 5) {
+		s->link_quality = payload[2];
+	} else if (type == CRSF_TYPE_RC_CHANNELS && len == CRSF_RC_PAYLOAD_LEN + 2) {
+		unpack_channels(s, payload);
+
+		// The receiver stops sending channels when the link is lost
+		s->failsafe = false;
+		s->frame_lost = false;
+		s->frame_cnt++;
+		return true;
+	}
+
+	return false;
+}
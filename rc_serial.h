@@ -0,0 +1,61 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef RC_SERIAL_H_
+#define RC_SERIAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RC_SERIAL_CHANNELS				16
+#define RC_SERIAL_BUF_LEN				64
+
+typedef enum {
+	RC_SERIAL_NONE = 0,
+	RC_SERIAL_SBUS,
+	RC_SERIAL_CRSF
+} rc_serial_proto;
+
+typedef struct {
+	rc_serial_proto proto;
+	uint8_t buf[RC_SERIAL_BUF_LEN];
+	int ind;
+
+	// Last channel frame
+	uint16_t ch[RC_SERIAL_CHANNELS];
+	bool failsafe;
+	bool frame_lost;
+
+	// Uplink link quality in percent from CRSF, -1 if unknown
+	int link_quality;
+
+	uint32_t frame_cnt;
+	uint32_t error_cnt;
+	uint32_t lost_cnt;
+} rc_serial_state;
+
+// Functions
+void rc_serial_init(rc_serial_state *s, rc_serial_proto proto);
+void rc_serial_gap(rc_serial_state *s);
+bool rc_serial_process_byte(rc_serial_state *s, uint8_t b);
+float rc_serial_ch_to_ms(uint16_t value);
+uint8_t rc_serial_crc8(const uint8_t *data, int len);
+const char *rc_serial_proto_name(rc_serial_proto proto);
+
+#endif /* RC_SERIAL_H_ */
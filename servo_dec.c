@@ -23,12 +23,22 @@
 #include "hal.h"
 #include "hw.h"
 #include "utils.h"
+#include "timer.h"
+#include "servo_filter.h"
+#include "rc_serial.h"
+#include "app.h"
+#include "terminal.h"
+#include "commands.h"
+#include <string.h>
+#include <stdio.h>
 
 /*
  * Settings
  */
 #define SERVO_NUM				1
 #define TIMER_FREQ				1000000
+#define MEDIAN_LEN				3
+#define SERIAL_GAP_MS			1
 
 // Private variables
 static volatile systime_t last_update_time;
@@ -38,13 +48,36 @@ static volatile float pulse_end = 2.0;
 static volatile float last_len_received[SERVO_NUM];
 static volatile bool use_median_filter = false;
 static volatile bool is_running = false;
+static servo_filter m_filter;
+
+// Serial receiver
+static volatile rc_serial_proto m_serial_proto = SERVO_DEC_SERIAL;
+static volatile int m_serial_ch = SERVO_DEC_SERIAL_CH;
+static volatile rc_serial_proto m_source = RC_SERIAL_NONE;
+static rc_serial_state m_serial;
+static volatile bool serial_stop_now = true;
+static volatile bool serial_is_running = false;
+
+// Threads
+#ifdef HW_UART_DEV
+static THD_WORKING_AREA(serial_thread_wa, 512);
+static THD_FUNCTION(serial_thread, arg);
+#endif
 
 // Function pointers
 static void(*done_func)(void) = 0;
 
-static void icuwidthcb(ICUDriver *icup) {
-	last_len_received[0] = ((float)icuGetWidthX(icup) / ((float)TIMER_FREQ / 1000.0));
-	float len = last_len_received[0] - pulse_start;
+// Private functions
+static void update_pulse(float len_ms, uint32_t time);
+static void filter_init(void);
+static void start_source(void);
+static void stop_source(void);
+static void terminal_stats(int argc, const char **argv);
+static void terminal_serial(int argc, const char **argv);
+
+static void update_pulse(float len_ms, uint32_t time) {
+	last_len_received[0] = len_ms;
+	float len = len_ms - pulse_start;
 	const float len_set = (pulse_end - pulse_start);
 
 	if (len > len_set) {
@@ -63,29 +96,33 @@ static void icuwidthcb(ICUDriver *icup) {
 		}
 	}
 
-	if (len >= 0.0) {
-		if (use_median_filter) {
-			float c = (len * 2.0 - len_set) / len_set;
-			static float c1 = 0.5;
-			static float c2 = 0.5;
-			float med = utils_middle_of_3(c, c1, c2);
-
-			c2 = c1;
-			c1 = c;
+	if (len < 0.0) {
+		m_filter.pulse_cnt++;
+		m_filter.reject_cnt++;
+		return;
+	}
 
-			servo_pos[0] = med;
-		} else {
-			servo_pos[0] = (len * 2.0 - len_set) / len_set;
-		}
+	if (!servo_filter_add(&m_filter, len, time, &len)) {
+		return;
+	}
 
-		last_update_time = chVTGetSystemTime();
+	servo_pos[0] = (len * 2.0 - len_set) / len_set;
+	last_update_time = chVTGetSystemTimeX();
 
-		if (done_func) {
-			done_func();
-		}
+	if (done_func) {
+		done_func();
 	}
 }
 
+static void icuwidthcb(ICUDriver *icup) {
+	// The counter is reset on the rising edge, so it has the time since the
+	// pulse started. Going back by that removes the interrupt latency from
+	// the timestamp.
+	uint32_t since_edge = icup->tim->CNT;
+	uint32_t time = timer_time_now() - (uint32_t)((float)since_edge * ((float)TIMER_HZ / (float)TIMER_FREQ));
+	update_pulse((float)icuGetWidthX(icup) / ((float)TIMER_FREQ / 1000.0), time);
+}
+
 static void icuperiodcb(ICUDriver *icup) {
 	(void)icup;
 }
@@ -105,14 +142,10 @@ static ICUConfig icucfg = {
  *
  * @param d_func
  * A function that should be called every time the servo signals have been
- * decoded. Can be NULL.
+ * decoded. Can be NULL. It is called from an interrupt, or from the serial
+ * receiver thread with the same rules as in an interrupt.
  */
 void servodec_init(void (*d_func)(void)) {
-	icuStart(&HW_ICU_DEV, &icucfg);
-	palSetPadMode(HW_ICU_GPIO, HW_ICU_PIN, PAL_MODE_ALTERNATE(HW_ICU_GPIO_AF));
-	icuStartCapture(&HW_ICU_DEV);
-	icuEnableNotifications(&HW_ICU_DEV);
-
 	for (int i = 0;i < SERVO_NUM;i++) {
 		servo_pos[i] = 0.0;
 		last_len_received[i] = 0.0;
@@ -121,7 +154,21 @@ void servodec_init(void (*d_func)(void)) {
 	// Set our function pointer
 	done_func = d_func;
 
+	filter_init();
+	start_source();
 	is_running = true;
+
+	terminal_register_command_callback(
+			"servodec_stats",
+			"Print the pulse rate, pulse width jitter and rejected pulses of the servo input",
+			0,
+			terminal_stats);
+
+	terminal_register_command_callback(
+			"servodec_serial",
+			"Decode the servo input from a serial receiver on the UART",
+			"[none/sbus/crsf] [channel]",
+			terminal_serial);
 }
 
 /**
@@ -129,8 +176,7 @@ void servodec_init(void (*d_func)(void)) {
  */
 void servodec_stop(void) {
 	if (is_running) {
-		icuStop(&HW_ICU_DEV);
-		palSetPadMode(HW_ICU_GPIO, HW_ICU_PIN, PAL_MODE_INPUT);
+		stop_source();
 		pulse_start = 1.0;
 		pulse_end = 2.0;
 		use_median_filter = false;
@@ -148,11 +194,19 @@ void servodec_stop(void) {
  *
  * @param end
  * he amount of milliseconds the pulse ends at (default is 2.0)
+ *
+ * @param median_filter
+ * Use a median over the last pulses, and drop pulses that come too soon
+ * after the previous one.
  */
 void servodec_set_pulse_options(float start, float end, bool median_filter) {
 	pulse_start = start;
 	pulse_end = end;
-	use_median_filter = median_filter;
+
+	if (median_filter != use_median_filter) {
+		use_median_filter = median_filter;
+		filter_init();
+	}
 }
 
 /**
@@ -199,3 +253,197 @@ float servodec_get_last_pulse_len(int servo_num) {
 		return 0.0;
 	}
 }
+
+/**
+ * Get the time between the servo pulses or serial frames.
+ *
+ * @return
+ * The average time between pulses in milliseconds, 0.0 if unknown.
+ */
+float servodec_get_pulse_period(void) {
+	return m_filter.period * 1000.0;
+}
+
+static void filter_init(void) {
+	chSysLock();
+	servo_filter_init(&m_filter, TIMER_HZ, use_median_filter ? MEDIAN_LEN : 1);
+
+	if (use_median_filter) {
+		m_filter.jitter_band = SERVO_DEC_JITTER_BAND;
+	}
+
+	// Serial frames come without glitches
+	if (m_source != RC_SERIAL_NONE) {
+		m_filter.glitch_period = 0.0;
+	}
+	chSysUnlock();
+}
+
+static void start_source(void) {
+	m_source = RC_SERIAL_NONE;
+
+#ifdef HW_UART_DEV
+	// The UART can't be used when an app uses it
+	app_use use = app_get_configuration()->app_to_use;
+	bool uart_free = use != APP_UART && use != APP_PPM_UART && use != APP_ADC_UART;
+
+	if (m_serial_proto != RC_SERIAL_NONE && uart_free) {
+		static SerialConfig cfg;
+		memset(&cfg, 0, sizeof(cfg));
+
+		if (m_serial_proto == RC_SERIAL_SBUS) {
+			// 8E2. The USART can't invert its input, so SBUS needs an
+			// inverter or a receiver with uninverted SBUS.
+			cfg.speed = 100000;
+			cfg.cr1 = USART_CR1_PCE | USART_CR1_M;
+			cfg.cr2 = USART_CR2_STOP2_BITS;
+		} else {
+			cfg.speed = 420000;
+		}
+
+		rc_serial_init(&m_serial, m_serial_proto);
+		sdStart(&HW_UART_DEV, &cfg);
+		palSetPadMode(HW_UART_RX_PORT, HW_UART_RX_PIN, PAL_MODE_ALTERNATE(HW_UART_GPIO_AF) |
+				PAL_STM32_OSPEED_HIGHEST | PAL_STM32_PUDR_PULLUP);
+
+		m_source = m_serial_proto;
+		m_filter.glitch_period = 0.0;
+		serial_stop_now = false;
+		serial_is_running = true;
+		chThdCreateStatic(serial_thread_wa, sizeof(serial_thread_wa), NORMALPRIO + 1, serial_thread, NULL);
+		return;
+	}
+#endif
+
+	icuStart(&HW_ICU_DEV, &icucfg);
+	palSetPadMode(HW_ICU_GPIO, HW_ICU_PIN, PAL_MODE_ALTERNATE(HW_ICU_GPIO_AF));
+	icuStartCapture(&HW_ICU_DEV);
+	icuEnableNotifications(&HW_ICU_DEV);
+}
+
+static void stop_source(void) {
+#ifdef HW_UART_DEV
+	if (m_source != RC_SERIAL_NONE) {
+		serial_stop_now = true;
+		while (serial_is_running) {
+			chThdSleepMilliseconds(1);
+		}
+
+		sdStop(&HW_UART_DEV);
+		palSetPadMode(HW_UART_RX_PORT, HW_UART_RX_PIN, PAL_MODE_INPUT_PULLUP);
+		m_source = RC_SERIAL_NONE;
+		return;
+	}
+#endif
+
+	icuStop(&HW_ICU_DEV);
+	palSetPadMode(HW_ICU_GPIO, HW_ICU_PIN, PAL_MODE_INPUT);
+}
+
+#ifdef HW_UART_DEV
+static THD_FUNCTION(serial_thread, arg) {
+	(void)arg;
+
+	chRegSetThreadName("Servo Serial");
+
+	for(;;) {
+		if (serial_stop_now) {
+			serial_is_running = false;
+			return;
+		}
+
+		msg_t res = chnGetTimeout(&HW_UART_DEV, MS2ST(SERIAL_GAP_MS));
+
+		if (res < MSG_OK) {
+			rc_serial_gap(&m_serial);
+			continue;
+		}
+
+		if (!rc_serial_process_byte(&m_serial, (uint8_t)res)) {
+			continue;
+		}
+
+		// Let the timeout release the motor when the receiver has lost the link
+		if (m_serial.failsafe || m_serial_ch >= RC_SERIAL_CHANNELS) {
+			continue;
+		}
+
+		update_pulse(rc_serial_ch_to_ms(m_serial.ch[m_serial_ch]), timer_time_now());
+
+		// Switch to the thread that was signaled right away
+		chSysLock();
+		chSchRescheduleS();
+		chSysUnlock();
+	}
+}
+#endif
+
+static void terminal_stats(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	float period = m_filter.period;
+
+	commands_printf("Source       : %s", m_source == RC_SERIAL_NONE ? "Servo pulses" : rc_serial_proto_name(m_source));
+	commands_printf("Pulse period : %.2f ms (%.1f Hz)", (double)(period * 1000.0), (double)(period > 0.0 ? 1.0 / period : 0.0));
+	commands_printf("Width jitter : %.1f us", (double)(m_filter.jitter * 1000.0));
+	commands_printf("Pulses       : %u", (unsigned int)m_filter.pulse_cnt);
+	commands_printf("Rejected     : %u", (unsigned int)m_filter.reject_cnt);
+	commands_printf("Outliers     : %u", (unsigned int)m_filter.outlier_cnt);
+	commands_printf("Last update  : %u ms ago", (unsigned int)servodec_get_time_since_update());
+
+	if (m_source != RC_SERIAL_NONE) {
+		commands_printf("Frames       : %u", (unsigned int)m_serial.frame_cnt);
+		commands_printf("Errors       : %u", (unsigned int)m_serial.error_cnt);
+		commands_printf("Lost frames  : %u", (unsigned int)m_serial.lost_cnt);
+		commands_printf("Failsafe     : %s", m_serial.failsafe ? "Yes" : "No");
+		if (m_serial.link_quality >= 0) {
+			commands_printf("Link quality : %d %%", m_serial.link_quality);
+		}
+	}
+
+	commands_printf(" ");
+}
+
+static void terminal_serial(int argc, const char **argv) {
+	if (argc >= 2) {
+		rc_serial_proto proto;
+
+		if (strcmp(argv[1], "none") == 0) {
+			proto = RC_SERIAL_NONE;
+		} else if (strcmp(argv[1], "sbus") == 0) {
+			proto = RC_SERIAL_SBUS;
+		} else if (strcmp(argv[1], "crsf") == 0) {
+			proto = RC_SERIAL_CRSF;
+		} else {
+			commands_printf("Invalid protocol\n");
+			return;
+		}
+
+		if (argc >= 3) {
+			int channel = -1;
+			sscanf(argv[2], "%d", &channel);
+			if (channel < 0 || channel >= RC_SERIAL_CHANNELS) {
+				commands_printf("Invalid channel\n");
+				return;
+			}
+			m_serial_ch = channel;
+		}
+
+		m_serial_proto = proto;
+
+		if (is_running) {
+			stop_source();
+			filter_init();
+			start_source();
+		}
+	}
+
+	commands_printf("Serial receiver: %s, channel %d", rc_serial_proto_name(m_serial_proto), m_serial_ch);
+
+	if (is_running && m_source != m_serial_proto) {
+		commands_printf("The UART is used by the app, decoding servo pulses");
+	}
+
+	commands_printf(" ");
+}
@@ -0,0 +1,193 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "servo_filter.h"
+
+#include <string.h>
+#include <math.h>
+
+/*
+ * Filter for servo pulses that are measured with input capture. Every pulse
+ * comes with the timestamp of its edge, so that extra edges from noise can
+ * be told apart from real pulses by their period, and so that the frame rate
+ * and pulse width jitter of the receiver can be shown. The pulse lengths go through a
+ * median over the last few pulses, which removes single bad pulses, and
+ * changes that are smaller than the jitter band are held so that the output
+ * does not move with the timer resolution.
+ *
+ * The glitch check is relative to the measured period, so it works for
+ * receivers with any frame rate. It is off until the period is known, and
+ * when most of the pulses look like glitches the frame rate has changed and
+ * the period is measured again.
+ */
+
+// Settings
+#define OUTLIER_MS				0.05 // Pulses this far from the median are counted as outliers
+#define STATS_FILTER			0.1
+#define GLITCH_MAX				3 // More glitches than this close together means that the frame rate changed
+
+/**
+ * Initialize the filter.
+ *
+ * @param f
+ * The filter.
+ *
+ * @param tick_freq
+ * The frequency of the timestamps that are given to servo_filter_add.
+ *
+ * @param median_len
+ * The number of pulses in the median. 1 disables the median and the glitch
+ * check. The jitter band is off by default, set jitter_band to use it.
+ */
+void servo_filter_init(servo_filter *f, float tick_freq, int median_len) {
+	memset(f, 0, sizeof(servo_filter));
+
+	if (median_len < 1) {
+		median_len = 1;
+	} else if (median_len > SERVO_FILTER_MEDIAN_MAX) {
+		median_len = SERVO_FILTER_MEDIAN_MAX;
+	}
+
+	f->tick_freq = tick_freq;
+	f->median_len = median_len;
+	f->period_max = 0.1;
+
+	if (median_len > 1) {
+		f->glitch_period = 0.5;
+	}
+}
+
+/**
+ * Forget the pulse history, e.g. after the signal was lost. The statistics
+ * are kept.
+ */
+void servo_filter_reset(servo_filter *f) {
+	f->hist_cnt = 0;
+	f->hist_ind = 0;
+	f->out_valid = false;
+	f->has_time = false;
+	f->glitch_cnt = 0;
+}
+
+static float median(const float *values, int len) {
+	float sorted[SERVO_FILTER_MEDIAN_MAX];
+	memcpy(sorted, values, sizeof(float) * len);
+
+	for (int i = 1;i < len;i++) {
+		float v = sorted[i];
+		int j = i - 1;
+		while (j >= 0 && sorted[j] > v) {
+			sorted[j + 1] = sorted[j];
+			j--;
+		}
+		sorted[j + 1] = v;
+	}
+
+	if (len % 2) {
+		return sorted[len / 2];
+	} else {
+		return (sorted[len / 2 - 1] + sorted[len / 2]) / 2.0;
+	}
+}
+
+/**
+ * Add a pulse.
+ *
+ * @param f
+ * The filter.
+ *
+ * @param len
+ * The pulse length in milliseconds.
+ *
+ * @param time
+ * The timestamp of the pulse in ticks of tick_freq. It may wrap around.
+ *
+ * @param out
+ * The filtered pulse length is stored here when the pulse is accepted.
+ *
+ * @return
+ * false if the pulse came too soon after the previous one and was dropped.
+ */
+bool servo_filter_add(servo_filter *f, float len, uint32_t time, float *out) {
+	f->pulse_cnt++;
+
+	if (f->has_time) {
+		float period = (float)(time - f->last_time) / f->tick_freq;
+		bool rate_changed = false;
+
+		if (period < (f->period * f->glitch_period)) {
+			if (f->glitch_cnt < GLITCH_MAX) {
+				// An extra edge from noise. Keep the time of the last good pulse
+				// so that the next real pulse gets the right period.
+				f->glitch_cnt++;
+				f->reject_cnt++;
+				return false;
+			}
+
+			// The receiver is sending faster now
+			f->period = 0.0;
+			rate_changed = true;
+		}
+
+		// The pulses in between the glitches are on time when the rate has
+		// changed as well, so the glitch count only goes down slowly.
+		if (f->glitch_cnt > 0) {
+			f->glitch_cnt--;
+		}
+
+		if (rate_changed) {
+			// The rejected pulses are in this period, so the new one is
+			// measured from this pulse.
+		} else if (period < f->period_max) {
+			if (f->period > 0.0) {
+				f->period += (period - f->period) * STATS_FILTER;
+			} else {
+				f->period = period;
+			}
+		} else {
+			// The signal was gone, so the old pulses should not be used
+			servo_filter_reset(f);
+		}
+	}
+
+	f->last_time = time;
+	f->has_time = true;
+
+	f->hist[f->hist_ind] = len;
+	f->hist_ind = (f->hist_ind + 1) % f->median_len;
+	if (f->hist_cnt < f->median_len) {
+		f->hist_cnt++;
+	}
+
+	float med = median(f->hist, f->hist_cnt);
+	float dev = fabsf(len - med);
+
+	f->jitter += (dev - f->jitter) * STATS_FILTER;
+	if (dev > OUTLIER_MS) {
+		f->outlier_cnt++;
+	}
+
+	if (!f->out_valid || fabsf(med - f->out) >= f->jitter_band) {
+		f->out = med;
+		f->out_valid = true;
+	}
+
+	*out = f->out;
+	return true;
+}
@@ -0,0 +1,59 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef SERVO_FILTER_H_
+#define SERVO_FILTER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SERVO_FILTER_MEDIAN_MAX			5
+
+typedef struct {
+	// Settings
+	float tick_freq; // Frequency of the timestamps
+	int median_len; // Pulses in the median, 1 to disable it
+	float jitter_band; // Changes smaller than this are held, in ms. 0 to disable.
+	float glitch_period; // Pulses closer than this fraction of the measured period are glitches. 0 to disable.
+	float period_max; // Longer pulse periods are dropouts, in seconds
+
+	// State
+	float hist[SERVO_FILTER_MEDIAN_MAX];
+	int hist_cnt;
+	int hist_ind;
+	float out;
+	bool out_valid;
+	uint32_t last_time;
+	bool has_time;
+	int glitch_cnt;
+
+	// Statistics
+	float period;
+	float jitter;
+	uint32_t pulse_cnt;
+	uint32_t reject_cnt;
+	uint32_t outlier_cnt;
+} servo_filter;
+
+// Functions
+void servo_filter_init(servo_filter *f, float tick_freq, int median_len);
+void servo_filter_reset(servo_filter *f);
+bool servo_filter_add(servo_filter *f, float len, uint32_t time, float *out);
+
+#endif /* SERVO_FILTER_H_ */
@@ -0,0 +1,341 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+/*
+ * Streaming setpoints for external controllers that close an outer loop at a
+ * high rate. All interfaces use the same compact frame:
+ *
+ * uint8   seq      Sequence number, incremented by one for each frame
+ * uint8   mode     SETPOINT_STREAM_MODE, optionally or:ed with SETPOINT_STREAM_FLAG_DIRECT
+ * float32 value    Setpoint in A, duty cycle, ERPM or degrees (buffer_append_float32_auto)
+ * [uint8 mode, float32 value]  Setpoint for the second motor on dual motor hardware
+ *
+ * On UART and USB the frame follows COMM_SET_STREAM and on CAN it is the payload
+ * of CAN_PACKET_SET_STREAM. A frame with one setpoint applies to the selected
+ * motor, a frame with two setpoints applies to motor 1 and motor 2.
+ *
+ * Frames with a duplicated or older sequence number are dropped. Unless the
+ * direct flag is set, the setpoint is ramped from the previous value over the
+ * measured frame interval in the mc_interface timer thread, which smooths out
+ * jitter in the frame timing at the cost of one frame interval of latency. The
+ * stream has its own watchdog that releases the motor when no frame has been
+ * received for the stream timeout.
+ *
+ * In SETPOINT_STREAM_MODE_POS_TRAJ the value is the goal of the jerk-limited
+ * position trajectory. The trajectory already gives a smooth path, so these
+ * setpoints are always applied directly.
+ */
+
+#include "setpoint_stream.h"
+#include "mc_interface.h"
+#include "timeout.h"
+#include "timer.h"
+#include "buffer.h"
+#include "utils.h"
+#include "terminal.h"
+#include "commands.h"
+#include "conf_general.h"
+#include "hw.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#ifdef HW_HAS_DUAL_MOTORS
+#define STREAM_MOTORS			2
+#else
+#define STREAM_MOTORS			1
+#endif
+
+// Size of one setpoint in a frame
+#define STREAM_SETPOINT_LEN		5
+
+typedef struct {
+	bool active;
+	bool direct;
+	SETPOINT_STREAM_MODE mode;
+	uint8_t seq_last;
+	float value_start;
+	float value_end;
+	float value_now;
+	float interval;
+	uint32_t frame_time;
+	uint32_t frames;
+	uint32_t lost;
+	uint32_t dropped;
+	uint32_t timeouts;
+} stream_state_t;
+
+// Private variables
+static volatile stream_state_t m_stream[STREAM_MOTORS];
+static volatile float m_timeout;
+
+// Private functions
+static void handle_setpoint(int motor, uint8_t seq, uint8_t mode, float value);
+static void apply_setpoint(SETPOINT_STREAM_MODE mode, float value);
+static void terminal_status(int argc, const char **argv);
+static void terminal_timeout(int argc, const char **argv);
+
+void setpoint_stream_init(void) {
+	for (int i = 0;i < STREAM_MOTORS;i++) {
+		m_stream[i].active = false;
+		m_stream[i].interval = 1e-3;
+	}
+
+	m_timeout = (float)SETPOINT_STREAM_TIMEOUT_MS / 1000.0;
+
+	terminal_register_command_callback(
+			"stream_status",
+			"Print statistics of the streaming setpoint interface",
+			0,
+			terminal_status);
+
+	terminal_register_command_callback(
+			"stream_timeout",
+			"Set the streaming setpoint watchdog timeout",
+			"[ms]",
+			terminal_timeout);
+}
+
+/**
+ * Process a streaming setpoint frame. This is called from the communication
+ * threads and does as little as possible.
+ *
+ * @param data
+ * The frame, starting at the sequence number.
+ *
+ * @param len
+ * The length of the frame.
+ */
+void setpoint_stream_process_packet(unsigned char *data, unsigned int len) {
+	if (len < (1 + STREAM_SETPOINT_LEN)) {
+		return;
+	}
+
+	uint8_t seq = data[0];
+	int32_t ind = 1;
+
+	if (len < (1 + 2 * STREAM_SETPOINT_LEN)) {
+		uint8_t mode = data[ind++];
+		handle_setpoint(mc_interface_get_motor_thread(), seq, mode, buffer_get_float32_auto(data, &ind));
+	} else {
+		for (int motor = 1;motor <= STREAM_MOTORS;motor++) {
+			uint8_t mode = data[ind++];
+			handle_setpoint(motor, seq, mode, buffer_get_float32_auto(data, &ind));
+		}
+	}
+}
+
+/**
+ * Interpolate and apply the streamed setpoint of the selected motor and run
+ * the stream watchdog. Called from the mc_interface timer thread.
+ */
+void setpoint_stream_run(void) {
+	volatile stream_state_t *s = &m_stream[mc_interface_get_motor_thread() - 1];
+
+	if (!s->active) {
+		return;
+	}
+
+	utils_sys_lock_cnt();
+
+	float age = timer_seconds_elapsed_since(s->frame_time);
+	if (age > m_timeout) {
+		s->active = false;
+		s->timeouts++;
+		utils_sys_unlock_cnt();
+		mc_interface_release_motor();
+		return;
+	}
+
+	if (s->direct) {
+		utils_sys_unlock_cnt();
+		return;
+	}
+
+	float ratio = age / s->interval;
+	utils_truncate_number(&ratio, 0.0, 1.0);
+
+	float value;
+	if (s->mode == SETPOINT_STREAM_MODE_POS) {
+		value = s->value_start + utils_angle_difference(s->value_end, s->value_start) * ratio;
+		utils_norm_angle(&value);
+	} else {
+		value = s->value_start + (s->value_end - s->value_start) * ratio;
+	}
+
+	s->value_now = value;
+	SETPOINT_STREAM_MODE mode = s->mode;
+
+	utils_sys_unlock_cnt();
+
+	apply_setpoint(mode, value);
+}
+
+/**
+ * Check if a setpoint stream is controlling the selected motor.
+ *
+ * @return
+ * true if a stream is active, false otherwise.
+ */
+bool setpoint_stream_is_active(void) {
+	return m_stream[mc_interface_get_motor_thread() - 1].active;
+}
+
+/**
+ * Set the stream watchdog timeout.
+ *
+ * @param timeout_ms
+ * Time without frames after which the motor is released, in milliseconds.
+ */
+void setpoint_stream_set_timeout(float timeout_ms) {
+	m_timeout = timeout_ms / 1000.0;
+}
+
+static void handle_setpoint(int motor, uint8_t seq, uint8_t mode, float value) {
+	if (motor < 1 || motor > STREAM_MOTORS) {
+		return;
+	}
+
+	volatile stream_state_t *s = &m_stream[motor - 1];
+	bool direct = mode & SETPOINT_STREAM_FLAG_DIRECT;
+	mode &= ~SETPOINT_STREAM_FLAG_DIRECT;
+
+	if (mode == SETPOINT_STREAM_MODE_POS_TRAJ) {
+		direct = true;
+	}
+
+	if (mode > SETPOINT_STREAM_MODE_POS_TRAJ ||
+			UTILS_IS_NAN(value) || UTILS_IS_INF(value)) {
+		s->dropped++;
+		return;
+	}
+
+	utils_sys_lock_cnt();
+
+	if (s->active) {
+		uint8_t diff = seq - s->seq_last;
+
+		// Duplicated or reordered frame
+		if (diff == 0 || diff >= 128) {
+			s->dropped++;
+			utils_sys_unlock_cnt();
+			return;
+		}
+
+		s->lost += diff - 1;
+
+		float dt = timer_seconds_elapsed_since(s->frame_time) / (float)diff;
+		utils_truncate_number(&dt, 1e-4, m_timeout);
+		UTILS_LP_FAST(s->interval, dt, 0.1);
+	}
+
+	if (s->active && !direct && s->mode == (SETPOINT_STREAM_MODE)mode) {
+		s->value_start = s->value_now;
+	} else {
+		s->value_start = value;
+		s->value_now = value;
+	}
+
+	s->value_end = value;
+	s->mode = mode;
+	s->direct = direct;
+	s->seq_last = seq;
+	s->frame_time = timer_time_now();
+	s->frames++;
+	s->active = mode != SETPOINT_STREAM_MODE_OFF;
+
+	utils_sys_unlock_cnt();
+
+	timeout_reset();
+
+	if (direct || mode == SETPOINT_STREAM_MODE_OFF) {
+		int motor_last = mc_interface_get_motor_thread();
+		mc_interface_select_motor_thread(motor);
+		apply_setpoint(mode, value);
+		mc_interface_select_motor_thread(motor_last);
+	}
+}
+
+static void apply_setpoint(SETPOINT_STREAM_MODE mode, float value) {
+	switch (mode) {
+	case SETPOINT_STREAM_MODE_CURRENT:
+		mc_interface_set_current(value);
+		break;
+
+	case SETPOINT_STREAM_MODE_CURRENT_BRAKE:
+		mc_interface_set_brake_current(value);
+		break;
+
+	case SETPOINT_STREAM_MODE_DUTY:
+		mc_interface_set_duty(value);
+		break;
+
+	case SETPOINT_STREAM_MODE_RPM:
+		mc_interface_set_pid_speed(value);
+		break;
+
+	case SETPOINT_STREAM_MODE_POS:
+		mc_interface_set_pid_pos(value);
+		break;
+
+	case SETPOINT_STREAM_MODE_POS_TRAJ:
+		mc_interface_set_pid_pos_traj(value);
+		break;
+
+	default:
+		mc_interface_release_motor();
+		break;
+	}
+}
+
+static void terminal_status(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	for (int i = 0;i < STREAM_MOTORS;i++) {
+		volatile stream_state_t *s = &m_stream[i];
+		commands_printf("Motor %d", i + 1);
+		commands_printf("Active    : %d", s->active);
+		commands_printf("Mode      : %d%s", s->mode, s->direct ? " (direct)" : "");
+		commands_printf("Setpoint  : %.3f", (double)s->value_now);
+		commands_printf("Interval  : %.3f ms", (double)(s->interval * 1000.0));
+		commands_printf("Frames    : %u", s->frames);
+		commands_printf("Lost      : %u", s->lost);
+		commands_printf("Dropped   : %u", s->dropped);
+		commands_printf("Timeouts  : %u\n", s->timeouts);
+	}
+
+	commands_printf("Timeout: %.1f ms\n", (double)(m_timeout * 1000.0));
+}
+
+static void terminal_timeout(int argc, const char **argv) {
+	if (argc == 2) {
+		float ms = -1.0;
+		sscanf(argv[1], "%f", &ms);
+
+		if (ms > 0.0) {
+			setpoint_stream_set_timeout(ms);
+			commands_printf("Stream timeout set to %.1f ms\n", (double)ms);
+		} else {
+			commands_printf("Invalid argument. The timeout must be > 0.\n");
+		}
+	} else {
+		commands_printf("This command requires one argument.\n");
+	}
+}
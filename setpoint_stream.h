@@ -0,0 +1,34 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef SETPOINT_STREAM_H_
+#define SETPOINT_STREAM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "datatypes.h"
+
+// Functions
+void setpoint_stream_init(void);
+void setpoint_stream_process_packet(unsigned char *data, unsigned int len);
+void setpoint_stream_run(void);
+bool setpoint_stream_is_active(void);
+void setpoint_stream_set_timeout(float timeout_ms);
+
+#endif /* SETPOINT_STREAM_H_ */
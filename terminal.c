@@ -579,6 +579,14 @@ void terminal_process_string(char *str) {
 #ifdef COMM_USE_USB
 		commands_printf("USB config events: %d", comm_usb_serial_configured_cnt());
 		commands_printf("USB write timeouts: %u", comm_usb_get_write_timeout_cnt());
+
+		const char *usb_tx_names[USB_TX_PRIO_NUM] = {"control", "bulk"};
+		for (int i = 0;i < USB_TX_PRIO_NUM;i++) {
+			usb_tx_queue_stats_t st;
+			comm_usb_get_tx_stats((usb_tx_prio_t)i, &st);
+			commands_printf("USB TX %s: %u/%u bytes, peak %u, sent %u, dropped %u",
+					usb_tx_names[i], st.used, st.size, st.peak, st.sent, st.dropped);
+		}
 #else
 		commands_printf("USB not enabled on hardware.");
 #endif
@@ -1122,6 +1130,40 @@ void terminal_process_string(char *str) {
 				commands_printf("Invalid arguments\n");
 			}
 		}
+	} else if (strcmp(argv[0], "pos_traj") == 0) {
+		if (argc == 2) {
+			float pos = -1.0;
+			sscanf(argv[1], "%f", &pos);
+
+			if (pos >= 0.0 && pos < 360.0) {
+				timeout_reset();
+				mc_interface_set_pid_pos_traj(pos);
+			} else {
+				commands_printf("Invalid argument. The position must be 0 - 360.\n");
+			}
+		} else {
+			commands_printf("This command requires one argument.\n");
+		}
+	} else if (strcmp(argv[0], "pos_waypoint") == 0) {
+		if (argc == 3) {
+			float pos = -1.0;
+			float vel = 0.0;
+			sscanf(argv[1], "%f", &pos);
+			sscanf(argv[2], "%f", &vel);
+
+			if (pos >= 0.0 && pos < 360.0) {
+				timeout_reset();
+				if (mc_interface_push_pid_pos_waypoint(pos, vel)) {
+					commands_printf("OK\n");
+				} else {
+					commands_printf("The waypoint queue is full, or the motor is not running FOC.\n");
+				}
+			} else {
+				commands_printf("Invalid argument. The position must be 0 - 360.\n");
+			}
+		} else {
+			commands_printf("This command requires two arguments.\n");
+		}
 	}
 
 	// The help command
@@ -1270,6 +1312,12 @@ void terminal_process_string(char *str) {
 		commands_printf("update_pid_pos_offset [angle_now] [store]");
 		commands_printf("  Update position PID offset.");
 
+		commands_printf("pos_traj [deg]");
+		commands_printf("  Move to a position along a jerk-limited trajectory.");
+
+		commands_printf("pos_waypoint [deg] [deg/s]");
+		commands_printf("  Queue a trajectory waypoint, passed with the given velocity.");
+
 		for (int i = 0;i < callback_write;i++) {
 			if (callbacks[i].cbf == 0) {
 				continue;
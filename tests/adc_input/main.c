@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "adc_input.h"
+#include "../test_util.h"
+
+/*
+ * Oversampling of the ADC app inputs with the CIC decimator, and detection
+ * of open and shorted inputs.
+ */
+
+static float noise(float amp) {
+	return amp * (2.0 * (float)rand() / (float)RAND_MAX - 1.0);
+}
+
+static uint16_t quantize(float counts) {
+	float v = roundf(counts);
+	if (v < 0.0) {
+		v = 0.0;
+	} else if (v > 4095.0) {
+		v = 4095.0;
+	}
+	return (uint16_t)v;
+}
+
+// Run samples through the channel and return the number of outputs
+static int run(adc_input_ch *ch, float counts, float noise_amp, int samples) {
+	int outputs = 0;
+	for (int i = 0;i < samples;i++) {
+		if (adc_input_add(ch, quantize(counts + noise(noise_amp)))) {
+			outputs++;
+		}
+	}
+	return outputs;
+}
+
+static void test_decimation(void) {
+	adc_input_ch ch;
+
+	adc_input_init(&ch, 32);
+	int outputs = run(&ch, 1000.0, 0.0, 32 * 10);
+	check("One output per 32 samples after priming", outputs == 9);
+	check("DC gain", fabsf(ch.value - 1000.0) < 1e-3);
+
+	adc_input_init(&ch, 1);
+	adc_input_add(&ch, 17);
+	adc_input_add(&ch, 23);
+	check("No decimation passes samples", ch.value == 23.0);
+
+	adc_input_init(&ch, 5000);
+	check("Decimation limited", ch.decimation == ADC_INPUT_DECIMATION_MAX);
+
+	// The largest decimation must not overflow the registers
+	run(&ch, 4095.0, 0.0, ADC_INPUT_DECIMATION_MAX * 5);
+	check("Full scale at the largest decimation", fabsf(ch.value - 4095.0) < 1e-2);
+
+	// A value between two codes is resolved with noise on the input
+	srand(3);
+	adc_input_init(&ch, 256);
+	run(&ch, 1234.3, 2.0, 256 * 20);
+	printf("    1234.3 resolved as %.3f\n", (double)ch.value);
+	check("Resolution beyond 12 bits", fabsf(ch.value - 1234.3) < 0.1);
+
+	// Noise reduction compared to single samples
+	srand(7);
+	adc_input_init(&ch, 64);
+	run(&ch, 2000.0, 0.0, 64 * 2);
+	float max_err = 0.0;
+	for (int i = 0;i < 100;i++) {
+		run(&ch, 2000.0, 40.0, 64);
+		max_err = fmaxf(max_err, fabsf(ch.value - 2000.0));
+	}
+	printf("    Largest error %.2f counts with +-40 counts of noise\n", (double)max_err);
+	check("Noise reduced", max_err < 10.0);
+
+	// A step settles within two outputs
+	adc_input_init(&ch, 16);
+	run(&ch, 500.0, 0.0, 16 * 4);
+	run(&ch, 3000.0, 0.0, 16 * 2);
+	check("Step settles in two outputs", fabsf(ch.value - 3000.0) < 1e-3);
+
+	// Switching ripple at the sample rate is removed
+	adc_input_init(&ch, 20);
+	for (int i = 0;i < 20 * 10;i++) {
+		adc_input_add(&ch, (i % 2) ? 1100 : 900);
+	}
+	check("Ripple removed", fabsf(ch.value - 1000.0) < 1e-3);
+}
+
+static void test_faults(void) {
+	adc_input_ch ch;
+
+	adc_input_init(&ch, 10);
+	run(&ch, 0.0, 0.0, 10 * 10);
+	check("No fault detection by default", ch.fault == ADC_INPUT_FAULT_NONE);
+
+	adc_input_set_fault_limits(&ch, 300.0, 3500.0, 5);
+	run(&ch, 1000.0, 20.0, 10 * 10);
+	check("In range", ch.fault == ADC_INPUT_FAULT_NONE);
+
+	// Open input, pulled to ground
+	run(&ch, 0.0, 0.0, 10 * 4);
+	check("Short dropout ignored", ch.fault == ADC_INPUT_FAULT_NONE);
+	run(&ch, 0.0, 0.0, 10 * 4);
+	check("Open input detected", ch.fault == ADC_INPUT_FAULT_LOW && ch.fault_cnt == 1);
+
+	run(&ch, 1000.0, 0.0, 10 * 3);
+	check("Fault held until back for long enough", ch.fault == ADC_INPUT_FAULT_LOW);
+	run(&ch, 1000.0, 0.0, 10 * 5);
+	check("Fault cleared", ch.fault == ADC_INPUT_FAULT_NONE);
+
+	run(&ch, 4095.0, 0.0, 10 * 7);
+	check("Short to supply detected", ch.fault == ADC_INPUT_FAULT_HIGH && ch.fault_cnt == 2);
+
+	adc_input_set_fault_limits(&ch, 1.0, 0.0, 5);
+	check("Disabling clears the fault", ch.fault == ADC_INPUT_FAULT_NONE);
+
+	// Direct readings when the samples stop
+	adc_input_set_fault_limits(&ch, 300.0, 3500.0, 3);
+	uint32_t outputs = ch.output_cnt;
+	adc_input_set(&ch, 0.0);
+	adc_input_set(&ch, 0.0);
+	check("Direct reading dropout ignored", ch.fault == ADC_INPUT_FAULT_NONE);
+	adc_input_set(&ch, 0.0);
+	check("Direct reading open input detected", ch.fault == ADC_INPUT_FAULT_LOW &&
+			ch.value == 0.0 && ch.output_cnt == outputs);
+}
+
+int main(void) {
+	printf("Decimation:\n");
+	test_decimation();
+
+	printf("\nFaults:\n");
+	test_faults();
+
+	return test_result();
+}
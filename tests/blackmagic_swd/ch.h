@@ -0,0 +1,8 @@
+#ifndef CH_H_
+#define CH_H_
+
+// Host build of the blackmagic SWD code, see main.c
+
+#include <stdint.h>
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef COMMANDS_H_
+#define COMMANDS_H_
+
+// Host build of the blackmagic SWD code, see main.c
+
+void commands_printf(const char* format, ...);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef HAL_H_
+#define HAL_H_
+
+// Host build of the blackmagic SWD code. The pins are connected to the
+// simulated target in main.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+	int unused;
+} stm32_gpio_t;
+
+extern stm32_gpio_t sim_gpioa;
+
+#define GPIOA						(&sim_gpioa)
+
+#define PAL_LOW						0
+#define PAL_HIGH					1
+#define PAL_MODE_INPUT				0
+#define PAL_MODE_OUTPUT_PUSHPULL	1
+#define PAL_STM32_OSPEED_HIGHEST	0
+
+void sim_pin_write(int pin, int val);
+int sim_pin_read(int pin);
+void sim_pin_mode(int pin, int mode);
+
+#define palSetPad(port, pin)			sim_pin_write(pin, 1)
+#define palClearPad(port, pin)			sim_pin_write(pin, 0)
+#define palWritePad(port, pin, val)		sim_pin_write(pin, val)
+#define palReadPad(port, pin)			sim_pin_read(pin)
+#define palSetPadMode(port, pin, mode)	sim_pin_mode(pin, mode)
+
+#endif
@@ -0,0 +1,592 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "../test_util.h"
+
+/*
+ * The blackmagic SW-DP and MEM-AP code against a target that is simulated
+ * at the level of the SWCLK and SWDIO pins. The target follows the SWD
+ * protocol, including line resets, turnarounds, posted AP reads, the 1 kB
+ * TAR auto-increment limit, WAIT while busy and FAULT with sticky errors.
+ *
+ * Throughput is given in SWCLK cycles, which is what the bit-banged
+ * interface spends its time on.
+ */
+
+#define SIM_MEM_BASE		0x20000000
+#define SIM_MEM_SIZE		0x10000
+#define SIM_IDCODE			0x2BA01477
+#define SIM_AP_IDR			0x24770011
+#define SIM_AP_BASE			(SIM_MEM_BASE + 0xF000)
+#define SWCLK_HZ			2e6
+
+#define SIM_ACK_OK			1
+#define SIM_ACK_WAIT		2
+#define SIM_ACK_FAULT		4
+
+typedef enum {
+	ST_LOCKOUT = 0,
+	ST_IDLE,
+	ST_REQ,
+	ST_TRN_ACK,
+	ST_ACK,
+	ST_RDATA,
+	ST_TRN_WDATA,
+	ST_WDATA,
+	ST_TRN_IDLE
+} sim_state_t;
+
+typedef struct {
+	// Pins
+	int clk;
+	int host_val;
+	bool host_drive;
+	int target_val;
+	bool target_drive;
+
+	// Protocol
+	sim_state_t state;
+	uint32_t shift;
+	int bits;
+	int ones;
+	uint8_t req;
+	int ack;
+	uint32_t rdata;
+
+	// Registers
+	uint32_t ctrlstat;
+	uint32_t select;
+	uint32_t rdbuff;
+	uint32_t csw;
+	uint32_t tar;
+	uint8_t mem[SIM_MEM_SIZE];
+
+	// Fault injection
+	int wait_every;		// Every nth DRW access is answered with WAIT once
+	int fault_at;		// The nth DRW write is answered with FAULT
+	int drw_count;
+	bool waited;
+
+	// Counters
+	uint64_t clocks;
+	uint32_t transactions;
+	uint32_t waits;
+	uint32_t drw_writes;
+} sim_t;
+
+static sim_t sim;
+static ADIv5_AP_t *m_ap = NULL;
+
+stm32_gpio_t sim_gpioa;
+stm32_gpio_t *platform_swdio_port = SWDIO_PORT_DEFAULT;
+int platform_swdio_pin = SWDIO_PIN_DEFAULT;
+stm32_gpio_t *platform_swclk_port = SWCLK_PORT_DEFAULT;
+int platform_swclk_pin = SWCLK_PIN_DEFAULT;
+target *target_list = NULL;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Things the adiv5 code refers to that are not part of the test
+
+void commands_printf(const char* format, ...) {
+	(void)format;
+}
+
+uint32_t platform_time_ms(void) {
+	return (uint32_t)(now() * 1e3);
+}
+
+void platform_delay(uint32_t ms) {
+	(void)ms;
+}
+
+void target_list_free(void) {
+}
+
+void nrf51_mdm_probe(ADIv5_AP_t *ap) {
+	(void)ap;
+}
+
+// The ROM table of the simulated AP is empty, so the probe is forced on
+// it, which is where the test gets its AP
+bool cortexm_probe(ADIv5_AP_t *ap, bool forced) {
+	(void)forced;
+	if (!m_ap && ap->apsel == 0) {
+		m_ap = ap;
+		adiv5_ap_ref(ap);
+	}
+	return true;
+}
+
+// Simulated target
+
+static bool parity32(uint32_t v) {
+	return __builtin_parity(v);
+}
+
+static uint32_t sim_mem_read(uint32_t addr) {
+	uint32_t ofs = (addr - SIM_MEM_BASE) & (SIM_MEM_SIZE - 4);
+	uint32_t v;
+	memcpy(&v, sim.mem + ofs, 4);
+	return v;
+}
+
+static void sim_mem_write(uint32_t addr, uint32_t val) {
+	int size = 1 << (sim.csw & 7);
+	uint32_t ofs = (addr - SIM_MEM_BASE) & (SIM_MEM_SIZE - 1);
+
+	// Take the byte lanes of the access
+	for (int i = 0; i < size; i++) {
+		int lane = (addr + i) & 3;
+		sim.mem[(ofs + i) & (SIM_MEM_SIZE - 1)] = (uint8_t)(val >> (lane * 8));
+	}
+}
+
+static void sim_tar_increment(void) {
+	if (((sim.csw >> 4) & 3) == 1) {
+		uint32_t inc = 1 << (sim.csw & 7);
+		sim.tar = (sim.tar & ~0x3FFu) | ((sim.tar + inc) & 0x3FF);
+	}
+}
+
+static uint32_t sim_ap_access(bool read, int a, uint32_t val) {
+	int apsel = sim.select >> 24;
+	int reg = (sim.select & 0xF0) | a;
+
+	if (apsel != 0) {
+		return 0;
+	}
+
+	switch (reg) {
+	case 0x00:
+		if (read) {
+			return sim.csw;
+		}
+		sim.csw = val;
+		break;
+
+	case 0x04:
+		if (read) {
+			return sim.tar;
+		}
+		sim.tar = val;
+		break;
+
+	case 0x0C: {
+		uint32_t ret = 0;
+		if (read) {
+			ret = sim_mem_read(sim.tar);
+		} else {
+			sim_mem_write(sim.tar, val);
+			sim.drw_writes++;
+		}
+		sim_tar_increment();
+		return ret;
+	}
+
+	case 0xF4: return 0;
+	case 0xF8: return SIM_AP_BASE;
+	case 0xFC: return SIM_AP_IDR;
+	default: break;
+	}
+
+	return 0;
+}
+
+// Decides the ACK of a request and does reads, writes are done when the
+// data has arrived
+static int sim_request(void) {
+	bool ap = (sim.req >> 1) & 1;
+	bool read = (sim.req >> 2) & 1;
+	int a = ((sim.req >> 3) & 3) << 2;
+
+	sim.transactions++;
+
+	if (ap) {
+		if (sim.ctrlstat & ADIV5_DP_CTRLSTAT_STICKYERR) {
+			return SIM_ACK_FAULT;
+		}
+
+		bool drw = (sim.select & 0xF0) == 0 && a == 0xC && (sim.select >> 24) == 0;
+		if (drw) {
+			sim.drw_count++;
+
+			if (sim.fault_at && sim.drw_count == sim.fault_at) {
+				sim.ctrlstat |= ADIV5_DP_CTRLSTAT_STICKYERR;
+				return SIM_ACK_FAULT;
+			}
+
+			if (sim.wait_every && (sim.drw_count % sim.wait_every) == 0 && !sim.waited) {
+				sim.waited = true;
+				sim.drw_count--;
+				sim.waits++;
+				return SIM_ACK_WAIT;
+			}
+			sim.waited = false;
+		}
+
+		if (read) {
+			// Posted, the data is from the previous AP read
+			sim.rdata = sim.rdbuff;
+			sim.rdbuff = sim_ap_access(true, a, 0);
+		}
+	} else if (read) {
+		switch (a) {
+		case 0x0: sim.rdata = SIM_IDCODE; break;
+		case 0x4: sim.rdata = sim.ctrlstat; break;
+		case 0xC: sim.rdata = sim.rdbuff; break;
+		default: sim.rdata = 0; break;
+		}
+	}
+
+	return SIM_ACK_OK;
+}
+
+static void sim_write(void) {
+	bool ap = (sim.req >> 1) & 1;
+	int a = ((sim.req >> 3) & 3) << 2;
+	uint32_t val = sim.shift;
+
+	if (ap) {
+		sim_ap_access(false, a, val);
+		return;
+	}
+
+	switch (a) {
+	case 0x0:
+		if (val & ADIV5_DP_ABORT_STKERRCLR) {
+			sim.ctrlstat &= ~ADIV5_DP_CTRLSTAT_STICKYERR;
+		}
+		break;
+
+	case 0x4: {
+		// Power up requests are acknowledged at once
+		uint32_t req = val & (ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ);
+		sim.ctrlstat = (sim.ctrlstat & ADIV5_DP_CTRLSTAT_STICKYERR) | req | (req << 1);
+	} break;
+
+	case 0x8:
+		sim.select = val;
+		break;
+
+	default:
+		break;
+	}
+}
+
+// The target samples SWDIO on the rising edge of SWCLK and changes its
+// output after it
+static void sim_rising_edge(void) {
+	int bit = sim.host_drive ? sim.host_val : (sim.target_drive ? sim.target_val : 1);
+
+	sim.clocks++;
+
+	if (sim.host_drive && bit) {
+		if (++sim.ones >= 50) {
+			sim.state = ST_LOCKOUT;
+			sim.target_drive = false;
+			return;
+		}
+	} else {
+		sim.ones = 0;
+	}
+
+	switch (sim.state) {
+	case ST_LOCKOUT:
+		// Idle cycles after a line reset
+		if (!bit && sim.host_drive) {
+			sim.state = ST_IDLE;
+		}
+		break;
+
+	case ST_IDLE:
+		if (bit && sim.host_drive) {
+			sim.req = 1;
+			sim.bits = 1;
+			sim.state = ST_REQ;
+		}
+		break;
+
+	case ST_REQ:
+		sim.req |= bit << sim.bits;
+		if (++sim.bits == 8) {
+			bool parity = parity32((sim.req >> 1) & 0xF);
+			bool ok = ((sim.req >> 5) & 1) == parity &&
+					((sim.req >> 6) & 1) == 0 && ((sim.req >> 7) & 1) == 1;
+			sim.state = ok ? ST_TRN_ACK : ST_LOCKOUT;
+		}
+		break;
+
+	case ST_TRN_ACK:
+		sim.ack = sim_request();
+		sim.bits = 0;
+		sim.target_drive = true;
+		sim.target_val = sim.ack & 1;
+		sim.state = ST_ACK;
+		break;
+
+	case ST_ACK:
+		if (++sim.bits < 3) {
+			sim.target_val = (sim.ack >> sim.bits) & 1;
+			break;
+		}
+
+		sim.bits = 0;
+		if (sim.ack != SIM_ACK_OK) {
+			sim.target_drive = false;
+			sim.state = ST_TRN_IDLE;
+		} else if ((sim.req >> 2) & 1) {
+			sim.target_val = sim.rdata & 1;
+			sim.state = ST_RDATA;
+		} else {
+			sim.target_drive = false;
+			sim.state = ST_TRN_WDATA;
+		}
+		break;
+
+	case ST_RDATA:
+		if (++sim.bits < 32) {
+			sim.target_val = (sim.rdata >> sim.bits) & 1;
+		} else if (sim.bits == 32) {
+			sim.target_val = parity32(sim.rdata);
+		} else {
+			sim.target_drive = false;
+			sim.state = ST_TRN_IDLE;
+		}
+		break;
+
+	case ST_TRN_WDATA:
+		sim.shift = 0;
+		sim.bits = 0;
+		sim.state = ST_WDATA;
+		break;
+
+	case ST_WDATA:
+		if (sim.bits < 32) {
+			sim.shift |= (uint32_t)bit << sim.bits;
+			sim.bits++;
+		} else {
+			if (bit == parity32(sim.shift)) {
+				sim_write();
+			} else {
+				sim.ctrlstat |= ADIV5_DP_CTRLSTAT_WDATAERR;
+			}
+			sim.state = ST_IDLE;
+		}
+		break;
+
+	case ST_TRN_IDLE:
+		sim.state = ST_IDLE;
+		break;
+	}
+}
+
+void sim_pin_write(int pin, int val) {
+	if (pin == SWCLK_PIN_DEFAULT) {
+		if (val && !sim.clk) {
+			sim_rising_edge();
+		}
+		sim.clk = val;
+	} else if (pin == SWDIO_PIN_DEFAULT) {
+		sim.host_val = val ? 1 : 0;
+	}
+}
+
+int sim_pin_read(int pin) {
+	if (pin == SWDIO_PIN_DEFAULT) {
+		return sim.target_drive ? sim.target_val : 1;
+	}
+	return 0;
+}
+
+void sim_pin_mode(int pin, int mode) {
+	if (pin == SWDIO_PIN_DEFAULT) {
+		sim.host_drive = mode == PAL_MODE_OUTPUT_PUSHPULL;
+	}
+}
+
+// Tests
+
+static void fill(uint8_t *buf, int len, uint32_t seed) {
+	for (int i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t)(seed >> 16);
+	}
+}
+
+static bool mem_equals(uint32_t addr, const uint8_t *buf, int len) {
+	return memcmp(sim.mem + (addr - SIM_MEM_BASE), buf, len) == 0;
+}
+
+static void reset_counters(void) {
+	sim.clocks = 0;
+	sim.transactions = 0;
+	sim.waits = 0;
+	sim.drw_writes = 0;
+	sim.drw_count = 0;
+}
+
+static void test_connect(void) {
+	memset(&sim, 0, sizeof(sim));
+	sim.state = ST_LOCKOUT;
+
+	adiv5_swdp_scan();
+	check("DP found and AP 0 probed", m_ap != NULL && m_ap->idr == SIM_AP_IDR);
+	if (m_ap) {
+		check("DP IDCODE read", m_ap->dp->idcode == SIM_IDCODE);
+		check("debug powered up", (sim.ctrlstat & ADIV5_DP_CTRLSTAT_CDBGPWRUPACK) != 0);
+	}
+}
+
+static void test_write_read(void) {
+	static uint8_t data[3000];
+	static uint8_t back[3000];
+	fill(data, sizeof(data), 1);
+
+	// Crosses two 1 kB boundaries, where TAR has to be written again
+	uint32_t addr = SIM_MEM_BASE + 0x300;
+	adiv5_mem_write(m_ap, addr, data, sizeof(data));
+	check("word write across 1 kB boundaries", mem_equals(addr, data, sizeof(data)));
+
+	adiv5_mem_read(m_ap, back, addr, sizeof(back));
+	check("read back", memcmp(back, data, sizeof(data)) == 0);
+
+	// Halfword and byte lanes
+	adiv5_mem_write(m_ap, SIM_MEM_BASE + 0x2002, data, 14);
+	check("halfword writes", mem_equals(SIM_MEM_BASE + 0x2002, data, 14));
+	adiv5_mem_write(m_ap, SIM_MEM_BASE + 0x2101, data + 100, 7);
+	check("byte writes", mem_equals(SIM_MEM_BASE + 0x2101, data + 100, 7));
+
+	// A block that ends exactly at a 1 kB boundary and one that starts there
+	adiv5_mem_write(m_ap, SIM_MEM_BASE + 0x3F00, data, 0x100);
+	adiv5_mem_write(m_ap, SIM_MEM_BASE + 0x4000, data + 0x100, 0x80);
+	check("blocks ending and starting at a boundary",
+			mem_equals(SIM_MEM_BASE + 0x3F00, data, 0x180));
+	check("no errors", adiv5_dp_error(m_ap->dp) == 0);
+}
+
+static void test_wait_fault(void) {
+	static uint8_t data[1024];
+	fill(data, sizeof(data), 2);
+
+	// The flash controller stalls the bus while programming
+	sim.wait_every = 3;
+	reset_counters();
+	adiv5_mem_write(m_ap, SIM_MEM_BASE + 0x5000, data, sizeof(data));
+	sim.wait_every = 0;
+	check("WAIT retried within a block", mem_equals(SIM_MEM_BASE + 0x5000, data, sizeof(data)));
+	check("all WAITs seen", sim.waits >= 80);
+
+	// FAULT in the middle of a block ends it and is found by the next
+	// sticky error check
+	memset(sim.mem + 0x6000, 0, sizeof(data));
+	reset_counters();
+	sim.fault_at = 100;
+	adiv5_mem_write(m_ap, SIM_MEM_BASE + 0x6000, data, sizeof(data));
+	sim.fault_at = 0;
+	check("words before the fault written", mem_equals(SIM_MEM_BASE + 0x6000, data, 99 * 4));
+	check("nothing written after the fault", sim.mem[0x6000 + 99 * 4 + 8] == 0);
+	check("no AP accesses after the fault", sim.drw_count == 100);
+
+	uint32_t err = adiv5_dp_error(m_ap->dp);
+	check("sticky error reported", (err & ADIV5_DP_CTRLSTAT_STICKYERR) != 0);
+	check("sticky error cleared", (sim.ctrlstat & ADIV5_DP_CTRLSTAT_STICKYERR) == 0);
+
+	adiv5_mem_write(m_ap, SIM_MEM_BASE + 0x6000, data, sizeof(data));
+	check("write after the error", mem_equals(SIM_MEM_BASE + 0x6000, data, sizeof(data)));
+	check("no errors", adiv5_dp_error(m_ap->dp) == 0);
+}
+
+static uint64_t write_clocks(uint32_t addr, const uint8_t *data, int len, bool block) {
+	ADIv5_DP_t *dp = m_ap->dp;
+	void (*old)(ADIv5_DP_t *, uint16_t, const uint32_t *, size_t) = dp->low_write_block;
+
+	if (!block) {
+		dp->low_write_block = NULL;
+	}
+
+	reset_counters();
+	adiv5_mem_write(m_ap, addr, data, len);
+	dp->low_write_block = old;
+
+	return sim.clocks;
+}
+
+static void test_throughput(void) {
+	static uint8_t data[16384];
+	fill(data, sizeof(data), 3);
+	ADIv5_DP_t *dp = m_ap->dp;
+
+	uint64_t single = write_clocks(SIM_MEM_BASE, data, sizeof(data), false);
+	check("single accesses write correctly", mem_equals(SIM_MEM_BASE, data, sizeof(data)));
+
+	memset(sim.mem, 0, sizeof(data));
+	double t0 = now();
+	uint64_t block = write_clocks(SIM_MEM_BASE, data, sizeof(data), true);
+	double t = now() - t0;
+	check("block write correct", mem_equals(SIM_MEM_BASE, data, sizeof(data)));
+	check("block write uses fewer clocks", block < single);
+
+	printf("    16 kB: %.1f clocks/word single, %.1f clocks/word block, %.1f %% saved\n",
+			(double)single / 4096.0, (double)block / 4096.0,
+			100.0 * (double)(single - block) / (double)single);
+	printf("    at %.0f MHz SWCLK: %.1f kB/s single, %.1f kB/s block (host sim %.1f ms)\n",
+			SWCLK_HZ / 1e6, 16.0 * SWCLK_HZ / (double)single,
+			16.0 * SWCLK_HZ / (double)block, t * 1e3);
+
+	// Register accesses such as polling a status register, where the
+	// cached SELECT and CSW save most of the transactions
+	uint32_t val = 0x12345678;
+	reset_counters();
+	for (int i = 0; i < 100; i++) {
+		adiv5_mem_write(m_ap, SIM_MEM_BASE + 0x100, &val, 4);
+	}
+	uint32_t cached = sim.transactions;
+
+	reset_counters();
+	for (int i = 0; i < 100; i++) {
+		dp->select_valid = false;
+		adiv5_mem_write(m_ap, SIM_MEM_BASE + 0x100, &val, 4);
+	}
+	uint32_t uncached = sim.transactions;
+
+	check("register write correct", sim_mem_read(SIM_MEM_BASE + 0x100) == val);
+	check("cached SELECT and CSW skip writes", cached * 2 <= uncached);
+	printf("    word writes: %.1f transactions cached, %.1f uncached\n",
+			(double)cached / 100.0, (double)uncached / 100.0);
+
+	// Error checks without errors only read CTRL/STAT
+	reset_counters();
+	adiv5_dp_error(dp);
+	check("sticky error check is one transaction", sim.transactions == 1);
+	check("caches kept without errors", dp->select_valid && dp->csw_valid);
+}
+
+int main(void) {
+	printf("Connecting:\n");
+	test_connect();
+	if (!m_ap) {
+		printf("\nFAILED\n");
+		return 1;
+	}
+
+	printf("\nMemory access:\n");
+	test_write_read();
+	test_wait_fault();
+
+	printf("\nThroughput:\n");
+	test_throughput();
+
+	return test_result();
+}
@@ -0,0 +1,416 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bus_async.h"
+#include "../test_util.h"
+
+/*
+ * The transfer queue with mock backends: an I2C device with a register
+ * pointer that auto-increments, where errors can be injected to test the
+ * retries, and an SPI loopback. The last test runs the bus from a worker
+ * thread like bus_thread.c does, with several threads that wait for their
+ * transfers at the same time.
+ */
+
+#define DEV_ADDR			0x68
+#define THREADS				4
+#define THREAD_XFERS		2000
+
+typedef struct {
+	uint8_t regs[256];
+	uint8_t ptr;
+	int fail_next;
+	int recover_cnt;
+	int xfer_cnt;
+} i2c_dev;
+
+static bool i2c_dev_transfer(void *ctx, bus_xfer *x) {
+	i2c_dev *d = (i2c_dev*)ctx;
+	d->xfer_cnt++;
+
+	if (d->fail_next > 0) {
+		d->fail_next--;
+		return false;
+	}
+
+	// NAK
+	if (x->addr != DEV_ADDR) {
+		return false;
+	}
+
+	if (x->txbytes > 0) {
+		d->ptr = x->txbuf[0];
+		for (size_t i = 1;i < x->txbytes;i++) {
+			d->regs[d->ptr++] = x->txbuf[i];
+		}
+	}
+
+	for (size_t i = 0;i < x->rxbytes;i++) {
+		x->rxbuf[i] = d->regs[d->ptr++];
+	}
+
+	return true;
+}
+
+static void i2c_dev_recover(void *ctx) {
+	i2c_dev *d = (i2c_dev*)ctx;
+	d->recover_cnt++;
+}
+
+static bool spi_loop_transfer(void *ctx, bus_xfer *x) {
+	(void)ctx;
+
+	// MISO is tied to MOSI, and MOSI is high when only reading
+	for (size_t i = 0;i < x->rxbytes;i++) {
+		x->rxbuf[i] = 0xFF;
+	}
+
+	if (x->txbytes > 0 && x->rxbytes > 0) {
+		x->rxbuf[0] = x->txbuf[x->txbytes - 1];
+	}
+
+	return true;
+}
+
+static const bus_backend m_i2c_backend = {"I2C mock", i2c_dev_transfer, i2c_dev_recover};
+static const bus_backend m_spi_backend = {"SPI mock", spi_loop_transfer, 0};
+
+static int m_order[8];
+static int m_order_cnt = 0;
+
+static void order_cb(bus_xfer *x, bool ok) {
+	(void)ok;
+	m_order[m_order_cnt++] = *(int*)x->arg;
+}
+
+static void test_transfers(void) {
+	i2c_dev d;
+	memset(&d, 0, sizeof(d));
+	bus_async b;
+	bus_async_init(&b, &m_i2c_backend, &d);
+
+	const uint8_t wr[4] = {0x40, 0x11, 0x22, 0x33};
+	bus_xfer x = {0};
+	x.addr = DEV_ADDR;
+	x.txbuf = wr;
+	x.txbytes = 4;
+	check("Write submitted", bus_async_submit(&b, &x));
+	check("Write queued", x.status == BUS_XFER_QUEUED && bus_async_pending(&b));
+	check("Write run", bus_async_process(&b, 0) == 1);
+	check("Write done", x.status == BUS_XFER_DONE && !bus_async_pending(&b));
+	check("Registers written", d.regs[0x40] == 0x11 && d.regs[0x41] == 0x22 && d.regs[0x42] == 0x33);
+
+	const uint8_t reg = 0x41;
+	uint8_t rd[2] = {0};
+	memset(&x, 0, sizeof(x));
+	x.addr = DEV_ADDR;
+	x.txbuf = &reg;
+	x.txbytes = 1;
+	x.rxbuf = rd;
+	x.rxbytes = 2;
+	bus_async_submit(&b, &x);
+	bus_async_process(&b, 0);
+	check("Registers read back", x.status == BUS_XFER_DONE && rd[0] == 0x22 && rd[1] == 0x33);
+
+	x.addr = DEV_ADDR + 1;
+	bus_async_submit(&b, &x);
+	bus_async_process(&b, 0);
+	check("Wrong address fails", x.status == BUS_XFER_FAILED && b.fail_cnt == 1);
+	check("Wrong address retried once", b.retry_cnt == 1 && d.recover_cnt == 1);
+
+	bus_async s;
+	bus_async_init(&s, &m_spi_backend, 0);
+	const uint8_t tx[2] = {0x80, 0x5A};
+	uint8_t rx[3] = {0};
+	bus_xfer y = {0};
+	y.txbuf = tx;
+	y.txbytes = 2;
+	y.rxbuf = rx;
+	y.rxbytes = 3;
+	bus_async_submit(&s, &y);
+	bus_async_process(&s, 0);
+	check("SPI loopback", y.status == BUS_XFER_DONE && rx[0] == 0x5A && rx[1] == 0xFF && rx[2] == 0xFF);
+}
+
+static void test_queue(void) {
+	i2c_dev d;
+	memset(&d, 0, sizeof(d));
+	bus_async b;
+	bus_async_init(&b, &m_i2c_backend, &d);
+
+	const uint8_t reg = 0;
+	int ids[5] = {0, 1, 2, 3, 4};
+	bus_xfer x[5];
+	memset(x, 0, sizeof(x));
+	for (int i = 0;i < 5;i++) {
+		x[i].addr = DEV_ADDR;
+		x[i].txbuf = &reg;
+		x[i].txbytes = 1;
+		x[i].done_cb = order_cb;
+		x[i].arg = &ids[i];
+	}
+
+	m_order_cnt = 0;
+	for (int i = 0;i < 5;i++) {
+		bus_async_submit(&b, &x[i]);
+	}
+
+	check("Queued transfer can't be submitted again", !bus_async_submit(&b, &x[2]));
+	check("Cancel in the middle", bus_async_cancel(&b, &x[2]) && x[2].status == BUS_XFER_IDLE);
+	check("Cancel at the end", bus_async_cancel(&b, &x[4]));
+	check("Cancel twice fails", !bus_async_cancel(&b, &x[4]));
+
+	// The end of the queue must be right after cancelling the last one
+	bus_async_submit(&b, &x[4]);
+
+	check("Process at most two", bus_async_process(&b, 2) == 2);
+	check("Done transfer can't be cancelled", !bus_async_cancel(&b, &x[0]));
+	bus_async_process(&b, 0);
+
+	bool order_ok = m_order_cnt == 4 && m_order[0] == 0 && m_order[1] == 1 &&
+			m_order[2] == 3 && m_order[3] == 4;
+	check("Callbacks in submit order", order_ok);
+	check("Queue empty", !bus_async_pending(&b) && b.head == 0 && b.tail == 0);
+	check("Cancelled transfer not run", x[2].status == BUS_XFER_IDLE && d.xfer_cnt == 4);
+
+	// Flushing fails the queued transfers through their callbacks
+	m_order_cnt = 0;
+	for (int i = 0;i < 3;i++) {
+		bus_async_submit(&b, &x[i]);
+	}
+
+	check("Flush fails all queued", bus_async_flush(&b) == 3 && m_order_cnt == 3);
+	check("Flushed transfers not run", d.xfer_cnt == 4 && x[1].status == BUS_XFER_FAILED);
+	check("Queue empty after flush", !bus_async_pending(&b) && b.head == 0 && b.tail == 0);
+	check("Flushed transfer can be submitted again", bus_async_submit(&b, &x[0]));
+	bus_async_process(&b, 0);
+}
+
+static int m_resubmit_left = 0;
+static bus_async *m_resubmit_bus = 0;
+
+static void resubmit_cb(bus_xfer *x, bool ok) {
+	(void)ok;
+	if (m_resubmit_left > 0) {
+		m_resubmit_left--;
+		bus_async_submit(m_resubmit_bus, x);
+	}
+}
+
+static void test_retry(void) {
+	i2c_dev d;
+	memset(&d, 0, sizeof(d));
+	bus_async b;
+	bus_async_init(&b, &m_i2c_backend, &d);
+
+	const uint8_t reg = 0;
+	uint8_t rd[1];
+	bus_xfer x = {0};
+	x.addr = DEV_ADDR;
+	x.txbuf = &reg;
+	x.txbytes = 1;
+	x.rxbuf = rd;
+	x.rxbytes = 1;
+
+	d.fail_next = 1;
+	bus_async_submit(&b, &x);
+	bus_async_process(&b, 0);
+	check("One error recovered", x.status == BUS_XFER_DONE && d.recover_cnt == 1 && b.retry_cnt == 1);
+
+	d.fail_next = 2;
+	bus_async_submit(&b, &x);
+	bus_async_process(&b, 0);
+	check("Two errors fail with one retry", x.status == BUS_XFER_FAILED && b.fail_cnt == 1);
+
+	b.retries = 3;
+	d.fail_next = 3;
+	bus_async_submit(&b, &x);
+	bus_async_process(&b, 0);
+	check("Three errors recovered with three retries", x.status == BUS_XFER_DONE && d.recover_cnt == 5);
+	check("Counters", b.xfer_cnt == 3 && b.fail_cnt == 1 && b.retry_cnt == 5);
+
+	m_resubmit_bus = &b;
+	m_resubmit_left = 9;
+	x.done_cb = resubmit_cb;
+	bus_async_submit(&b, &x);
+	check("Resubmit from the callback", bus_async_process(&b, 0) == 10 && m_resubmit_left == 0);
+}
+
+/*
+ * Threaded test
+ */
+
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t m_wake_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_wake_cond = PTHREAD_COND_INITIALIZER;
+static bool m_wake = false;
+static volatile bool m_stop = false;
+
+typedef struct {
+	bool done;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+} waiter;
+
+typedef struct {
+	bus_async *b;
+	int id;
+	int errors;
+} producer;
+
+static void lock(void) {
+	pthread_mutex_lock(&m_lock);
+}
+
+static void unlock(void) {
+	pthread_mutex_unlock(&m_lock);
+}
+
+static void wake(bus_async *b) {
+	(void)b;
+	pthread_mutex_lock(&m_wake_mtx);
+	m_wake = true;
+	pthread_cond_signal(&m_wake_cond);
+	pthread_mutex_unlock(&m_wake_mtx);
+}
+
+static void *worker(void *arg) {
+	bus_async *b = (bus_async*)arg;
+
+	for (;;) {
+		pthread_mutex_lock(&m_wake_mtx);
+		while (!m_wake && !m_stop) {
+			pthread_cond_wait(&m_wake_cond, &m_wake_mtx);
+		}
+		m_wake = false;
+		pthread_mutex_unlock(&m_wake_mtx);
+
+		bus_async_process(b, 0);
+
+		if (m_stop && !bus_async_pending(b)) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static void sync_cb(bus_xfer *x, bool ok) {
+	(void)ok;
+	waiter *w = (waiter*)x->arg;
+	pthread_mutex_lock(&w->mtx);
+	w->done = true;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mtx);
+}
+
+static bool sync_transfer(bus_async *b, bus_xfer *x) {
+	waiter w;
+	w.done = false;
+	pthread_mutex_init(&w.mtx, 0);
+	pthread_cond_init(&w.cond, 0);
+	x->done_cb = sync_cb;
+	x->arg = &w;
+
+	bool res = bus_async_submit(b, x);
+
+	if (res) {
+		pthread_mutex_lock(&w.mtx);
+		while (!w.done) {
+			pthread_cond_wait(&w.cond, &w.mtx);
+		}
+		pthread_mutex_unlock(&w.mtx);
+		res = x->status == BUS_XFER_DONE;
+	}
+
+	pthread_mutex_destroy(&w.mtx);
+	pthread_cond_destroy(&w.cond);
+	return res;
+}
+
+static void *producer_thd(void *arg) {
+	producer *p = (producer*)arg;
+
+	// Every thread has its own registers, so a mixed up transfer shows up
+	// as a wrong value.
+	for (int i = 0;i < THREAD_XFERS;i++) {
+		uint8_t wr[3] = {(uint8_t)(p->id * 2), (uint8_t)i, (uint8_t)p->id};
+		bus_xfer x = {0};
+		x.addr = DEV_ADDR;
+		x.txbuf = wr;
+		x.txbytes = 3;
+		if (!sync_transfer(p->b, &x)) {
+			p->errors++;
+		}
+
+		uint8_t rd[2] = {0};
+		memset(&x, 0, sizeof(x));
+		x.addr = DEV_ADDR;
+		x.txbuf = wr;
+		x.txbytes = 1;
+		x.rxbuf = rd;
+		x.rxbytes = 2;
+		if (!sync_transfer(p->b, &x) || rd[0] != (uint8_t)i || rd[1] != (uint8_t)p->id) {
+			p->errors++;
+		}
+	}
+
+	return 0;
+}
+
+static void test_threads(void) {
+	i2c_dev d;
+	memset(&d, 0, sizeof(d));
+	bus_async b;
+	bus_async_init(&b, &m_i2c_backend, &d);
+	b.lock = lock;
+	b.unlock = unlock;
+	b.wake = wake;
+
+	pthread_t wt;
+	pthread_create(&wt, 0, worker, &b);
+
+	pthread_t pt[THREADS];
+	producer p[THREADS];
+	for (int i = 0;i < THREADS;i++) {
+		p[i].b = &b;
+		p[i].id = i + 1;
+		p[i].errors = 0;
+		pthread_create(&pt[i], 0, producer_thd, &p[i]);
+	}
+
+	int errors = 0;
+	for (int i = 0;i < THREADS;i++) {
+		pthread_join(pt[i], 0);
+		errors += p[i].errors;
+	}
+
+	m_stop = true;
+	wake(&b);
+	pthread_join(wt, 0);
+
+	check("All transfers from all threads correct", errors == 0);
+	check("All transfers run once", b.xfer_cnt == THREADS * THREAD_XFERS * 2 &&
+			d.xfer_cnt == THREADS * THREAD_XFERS * 2);
+	check("Queue empty", !bus_async_pending(&b));
+}
+
+int main(void) {
+	printf("Transfers:\n");
+	test_transfers();
+
+	printf("\nQueue:\n");
+	test_queue();
+
+	printf("\nRetries:\n");
+	test_retry();
+
+	printf("\nThreads:\n");
+	test_threads();
+
+	return test_result();
+}
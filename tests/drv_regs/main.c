@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "drv_regs.h"
+#include "../test_util.h"
+
+/*
+ * Batched register reads and status decoding of the DRV gate drivers,
+ * against simulated drivers. The DRV8301 answers one frame late with the
+ * address and a frame error bit in the response, and the DRV832x answer in
+ * the same frame.
+ */
+
+static const drv_regs_def m_def_8301 = {
+		"DRV8301",
+		4, // Registers
+		true, // Delayed response
+		true, // Checked response
+		{0x7FF, 0x080}, // Status masks
+		{0, 4}, // Status shifts
+		{
+				{"FETLC_OC", "FETHC_OC", "FETLB_OC", "FETHB_OC", "FETLA_OC", "FETHA_OC",
+						"OTW", "OTSD", "PVDD_UV", "GVDD_UV", "FAULT"},
+				{0, 0, 0, 0, 0, 0, 0, "GVDD_OV", 0, 0, 0}
+		},
+		0, (1 << 10) // FAULT
+};
+
+static const drv_regs_def m_def_8320s = {
+		"DRV8320S",
+		6, // Registers
+		false, // Delayed response
+		false, // Checked response
+		{0x7FF, 0x7FF}, // Status masks
+		{0, 16}, // Status shifts
+		{
+				{"VDS_LC", "VDS_HC", "VDS_LB", "VDS_HB", "VDS_LA", "VDS_HA",
+						"OTSD", "UVLO", "GDF", "VDS_OCP", "FAULT"},
+				{"VGS_LC", "VGS_HC", "VGS_LB", "VGS_HB", "VGS_LA", "VGS_HA",
+						"CPUV", "OTW", 0, 0, 0}
+		},
+		0, (1 << 10) // FAULT
+};
+
+static const drv_regs_def m_def_8323s = {
+		"DRV8323S",
+		7, // Registers
+		false, // Delayed response
+		false, // Checked response
+		{0x7FF, 0x7FF}, // Status masks
+		{0, 16}, // Status shifts
+		{
+				{"VDS_LC", "VDS_HC", "VDS_LB", "VDS_HB", "VDS_LA", "VDS_HA",
+						"OTSD", "UVLO", "GDF", "VDS_OCP", "FAULT"},
+				{"VGS_LC", "VGS_HC", "VGS_LB", "VGS_HB", "VGS_LA", "VGS_HA",
+						"CPUV", "OTW", "SC_OC", "SB_OC", "SA_OC"}
+		},
+		0, (1 << 10) // FAULT
+};
+
+typedef struct {
+	const drv_regs_def *def;
+	uint16_t regs[16];
+	uint16_t last_cmd;
+	bool frame_error;
+	int frames;
+} sim_drv;
+
+static uint16_t sim_response(sim_drv *d, uint16_t cmd) {
+	int reg = (cmd >> 11) & 0x0F;
+	uint16_t res = d->regs[reg] & DRV_REGS_DATA_MASK;
+	if (d->def->checked_response) {
+		res |= reg << 11;
+		if (d->frame_error) {
+			res |= 1 << 15;
+		}
+	}
+	return res;
+}
+
+static uint16_t sim_exchange(sim_drv *d, uint16_t cmd) {
+	uint16_t res;
+	d->frames++;
+
+	if (d->def->delayed_response) {
+		res = sim_response(d, d->last_cmd);
+	} else {
+		res = sim_response(d, cmd);
+	}
+
+	if (!(cmd & (1 << 15))) {
+		d->regs[(cmd >> 11) & 0x0F] = cmd & DRV_REGS_DATA_MASK;
+	}
+
+	d->last_cmd = cmd;
+	return res;
+}
+
+static bool sim_read(sim_drv *d, int first, int cnt, uint16_t *values) {
+	uint16_t tx[DRV_REGS_MAX + 1];
+	uint16_t rx[DRV_REGS_MAX + 1];
+	int frames = drv_regs_batch_cmd(d->def, first, cnt, tx);
+
+	for (int i = 0;i < frames;i++) {
+		rx[i] = sim_exchange(d, tx[i]);
+	}
+
+	return drv_regs_batch_parse(d->def, first, cnt, rx, values);
+}
+
+static void sim_init(sim_drv *d, const drv_regs_def *def) {
+	memset(d, 0, sizeof(sim_drv));
+	d->def = def;
+	d->last_cmd = 0xFFFF;
+	for (int i = 0;i < def->reg_cnt;i++) {
+		d->regs[i] = (uint16_t)(0x100 + i * 0x23);
+	}
+}
+
+static void test_batch(const drv_regs_def *def, int frames_old) {
+	sim_drv d;
+	sim_init(&d, def);
+
+	uint16_t values[DRV_REGS_MAX];
+	bool ok = sim_read(&d, 0, def->reg_cnt, values);
+	bool match = true;
+	for (int i = 0;i < def->reg_cnt;i++) {
+		if (values[i] != d.regs[i]) {
+			match = false;
+		}
+	}
+
+	char name[80];
+	snprintf(name, sizeof(name), "%s all registers in one batch", def->name);
+	check(name, ok && match);
+
+	d.frames = 0;
+	sim_read(&d, 0, DRV_REGS_STATUS, values);
+	snprintf(name, sizeof(name), "%s status in %d frames instead of %d", def->name, d.frames, frames_old);
+	check(name, d.frames < frames_old);
+
+	sim_read(&d, 3, 1, values);
+	snprintf(name, sizeof(name), "%s single register", def->name);
+	check(name, values[0] == d.regs[3]);
+
+	sim_exchange(&d, drv_regs_write_cmd(3, 0x5A5));
+	sim_read(&d, 3, 1, values);
+	snprintf(name, sizeof(name), "%s write and read back", def->name);
+	check(name, values[0] == 0x5A5);
+}
+
+static void test_checked(void) {
+	sim_drv d;
+	sim_init(&d, &m_def_8301);
+
+	uint16_t values[DRV_REGS_MAX];
+	d.frame_error = true;
+	check("Frame error detected", !sim_read(&d, 0, 2, values));
+	d.frame_error = false;
+	check("Valid after frame error", sim_read(&d, 0, 2, values));
+
+	// Response to another address, as when a frame is lost
+	uint16_t rx[3] = {0, (1 << 11) | 0x12, (0 << 11) | 0x34};
+	check("Wrong address detected", !drv_regs_batch_parse(&m_def_8301, 0, 2, rx, values));
+
+	// The DRV832x have nothing to check apart from MISO not being driven
+	rx[1] = 0xF8FF;
+	check("Unchecked response accepted", drv_regs_batch_parse(&m_def_8323s, 0, 2, rx, values));
+	check("Data bits only", values[1] == 0x0FF);
+	rx[1] = 0xFFFF;
+	check("All ones rejected", !drv_regs_batch_parse(&m_def_8323s, 0, 2, rx, values));
+}
+
+static void test_faults(void) {
+	bool ok_8301 = true;
+	bool ok_832x = true;
+
+	srand(5);
+	for (int i = 0;i < 1000;i++) {
+		uint16_t status[2] = {(uint16_t)(rand() & 0x7FF), (uint16_t)(rand() & 0x7FF)};
+
+		// As the drivers made the fault word before, apart from the DRV8301
+		// FAULT bit that was left out.
+		uint32_t f_8301 = (status[0] & 0x7FF) | ((status[1] & 0x80) << 4);
+		uint32_t f_832x = status[0] | (status[1] << 16);
+
+		if (drv_regs_faults(&m_def_8301, status) != f_8301) {
+			ok_8301 = false;
+		}
+
+		if (drv_regs_faults(&m_def_8323s, status) != f_832x) {
+			ok_832x = false;
+		}
+	}
+
+	check("DRV8301 fault word", ok_8301);
+	check("DRV832x fault word", ok_832x);
+}
+
+static void test_diff(void) {
+	char buf[120];
+	uint16_t old[2] = {0x000, 0x080};
+	uint16_t now[2] = {(1 << 5) | (1 << 10), 0x000};
+
+	drv_regs_diff_to_string(&m_def_8323s, old, now, buf, sizeof(buf));
+	printf("    %s\n", buf);
+	check("Set and cleared bits", strcmp(buf, "+VDS_HA +FAULT -OTW") == 0);
+
+	old[1] = 0;
+	now[1] = 1 << 9;
+	drv_regs_diff_to_string(&m_def_8320s, old, now, buf, sizeof(buf));
+	printf("    %s\n", buf);
+	check("Unnamed bit", strstr(buf, "+R1.9") != 0);
+
+	// The device ID of the DRV8301 is not a status bit
+	uint16_t id_old[2] = {0, 0x001};
+	uint16_t id_now[2] = {0, 0x002};
+	drv_regs_diff_to_string(&m_def_8301, id_old, id_now, buf, sizeof(buf));
+	check("Masked bits ignored", strcmp(buf, "No change") == 0);
+
+	uint16_t all_old[2] = {0, 0};
+	uint16_t all_now[2] = {0x7FF, 0x7FF};
+	char small[20];
+	int len = drv_regs_diff_to_string(&m_def_8323s, all_old, all_now, small, sizeof(small));
+	check("Truncated to the buffer", len == (int)strlen(small) && len < (int)sizeof(small));
+}
+
+static void test_shadow(void) {
+	drv_shadow s;
+	drv_shadow_init(&s);
+
+	uint16_t status[2] = {1 << 7, 0};
+	check("Startup fault only recorded", drv_shadow_update_status(&m_def_8323s, &s, status) == DRV_STATUS_CHANGED);
+	check("Same status", drv_shadow_update_status(&m_def_8323s, &s, status) == DRV_STATUS_SAME);
+
+	status[1] = 1 << 7;
+	check("Warning is a change", drv_shadow_update_status(&m_def_8323s, &s, status) == DRV_STATUS_CHANGED);
+
+	status[0] |= (1 << 10) | (1 << 0);
+	check("New fault", drv_shadow_update_status(&m_def_8323s, &s, status) == DRV_STATUS_NEW_FAULT);
+	check("Change recorded", s.change_old[0] == (1 << 7) && s.change_new[0] == ((1 << 10) | (1 << 7) | 1));
+
+	status[1] = 0;
+	check("Latched fault not raised again", drv_shadow_update_status(&m_def_8323s, &s, status) == DRV_STATUS_CHANGED);
+
+	status[0] = 0;
+	drv_shadow_update_status(&m_def_8323s, &s, status);
+	status[0] = 1 << 10;
+	check("Fault after reset raised", drv_shadow_update_status(&m_def_8323s, &s, status) == DRV_STATUS_NEW_FAULT);
+	check("Counters", s.update_cnt == 7 && s.change_cnt == 6);
+
+	uint16_t values[2] = {0x123, 0x456};
+	drv_shadow_update(&m_def_8323s, &s, 2, 2, values);
+	check("Control registers set", s.regs[2] == 0x123 && s.regs[3] == 0x456 && (s.valid & 0x0C) == 0x0C);
+
+	drv_shadow_set(&s, 0, 0);
+	check("Status not set as a control register", s.regs[0] == (1 << 10));
+
+	uint16_t part[1] = {0};
+	drv_shadow_update(&m_def_8323s, &s, 0, 1, part);
+	check("Status only compared when both are read", s.regs[0] == (1 << 10) && s.update_cnt == 7);
+
+	drv_shadow_init(&s);
+	uint16_t id[2] = {0, 0x001};
+	check("DRV8301 device ID is no change", drv_shadow_update_status(&m_def_8301, &s, id) == DRV_STATUS_SAME);
+}
+
+// One poll of the status thread
+static bool poll(drv_shadow *s, bool *pending, bool ok, uint16_t s0) {
+	uint16_t status[2] = {s0, 0};
+	drv_status_change change = DRV_STATUS_SAME;
+
+	if (ok) {
+		change = drv_shadow_update_status(&m_def_8323s, s, status);
+	}
+
+	return drv_regs_confirm_fault(&m_def_8323s, pending, ok, change, status);
+}
+
+static void test_confirm(void) {
+	drv_shadow s;
+	drv_shadow_init(&s);
+	bool pending = false;
+	const uint16_t fault = (1 << 10) | (1 << 5);
+
+	poll(&s, &pending, true, 0);
+	check("No fault", !poll(&s, &pending, true, 0));
+	check("Single corrupted read ignored", !poll(&s, &pending, true, fault) && !poll(&s, &pending, true, 0));
+	check("Failed read ignored", !poll(&s, &pending, false, 0));
+
+	check("New fault not stopped at once", !poll(&s, &pending, true, fault));
+	check("Stopped on the second read", poll(&s, &pending, true, fault));
+	check("Latched fault not stopped again", !poll(&s, &pending, true, fault) && !poll(&s, &pending, true, fault));
+
+	poll(&s, &pending, true, 0);
+	check("Failed read in between", !poll(&s, &pending, true, fault) && !poll(&s, &pending, false, 0) &&
+			poll(&s, &pending, true, fault));
+}
+
+int main(void) {
+	printf("Batched reads:\n");
+	test_batch(&m_def_8301, 4);
+	test_batch(&m_def_8320s, 4);
+	test_batch(&m_def_8323s, 4);
+
+	printf("\nResponse check:\n");
+	test_checked();
+
+	printf("\nFault word:\n");
+	test_faults();
+
+	printf("\nDiff:\n");
+	test_diff();
+
+	printf("\nShadow:\n");
+	test_shadow();
+
+	printf("\nFault confirmation:\n");
+	test_confirm();
+
+	return test_result();
+}
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "foc_dtc.h"
+#include "foc_svm.h"
+#include "../test_util.h"
+
+/*
+ * A virtual motor behind an inverter with dead time. The duty cycle that
+ * every phase loses goes smoothly to zero at low current, as when the current
+ * ripple crosses zero, and is slightly different between the phases. The
+ * motor is held at a low speed by a load machine and runs sensorless with the
+ * same observer as mcpwm_foc.c, with the commanded voltage as input.
+ *
+ * The compensation table is measured with the same sweep as during detection
+ * and compared with no compensation and with the foc_dt_us sign compensation.
+ */
+
+#define F_SW			20000.0
+#define V_BUS			24.0
+#define SUBSTEPS		4
+
+// Motor
+#define MOTOR_R			0.08
+#define MOTOR_L			40e-6
+#define MOTOR_LAMBDA	0.003
+
+// Inverter, duty cycle lost at high current and the current where half of it is lost
+static const double m_dt_loss[3] = {0.0110, 0.0125, 0.0095};
+#define DT_KNEE			0.8
+
+// Control
+#define CURR_BW			2000.0
+#define OBS_GAMMA		(0.5e3 / (MOTOR_LAMBDA * MOTOR_LAMBDA))
+#define IQ_LOAD			4.0
+#define SWEEP_CURRENT	10.0
+
+#define SIGN(x)			(((x) < 0.0) ? -1.0 : 1.0)
+
+typedef enum {
+	COMP_NONE = 0,
+	COMP_SIGN,
+	COMP_TABLE,
+	COMP_NUM
+} comp_mode;
+
+static const char *m_comp_names[COMP_NUM] = {"none", "foc_dt_us", "table"};
+
+typedef struct {
+	// Motor
+	double i_alpha;
+	double i_beta;
+	double theta;
+	double w;
+
+	// Controller
+	float x1;
+	float x2;
+	float phase_obs;
+	float vd_int;
+	float vq_int;
+	float mod_alpha;
+	float mod_beta;
+} sim_t;
+
+static foc_dtc_table m_dtc;
+static double norm_angle(double a) {
+	while (a > M_PI) {
+		a -= 2.0 * M_PI;
+	}
+	while (a < -M_PI) {
+		a += 2.0 * M_PI;
+	}
+	return a;
+}
+
+static double loss_true(int phase, double i) {
+	return m_dt_loss[phase] * tanh(i / DT_KNEE);
+}
+
+static void phase_currents(double alpha, double beta, double *i) {
+	i[0] = alpha;
+	i[1] = -0.5 * alpha + (sqrt(3.0) / 2.0) * beta;
+	i[2] = -0.5 * alpha - (sqrt(3.0) / 2.0) * beta;
+}
+
+// One PWM period of the motor and inverter with the modulation in s
+static void plant_step(sim_t *s) {
+	float duty[3];
+	foc_svm_duty(s->mod_alpha, s->mod_beta, FOC_SVM_MODE_CENTERED, false, duty);
+
+	const double dt = 1.0 / F_SW / SUBSTEPS;
+	for (int n = 0;n < SUBSTEPS;n++) {
+		double i[3];
+		phase_currents(s->i_alpha, s->i_beta, i);
+
+		double v[3];
+		for (int k = 0;k < 3;k++) {
+			v[k] = V_BUS * ((double)duty[k] - loss_true(k, i[k]));
+		}
+
+		const double v_alpha = (2.0 / 3.0) * (v[0] - 0.5 * v[1] - 0.5 * v[2]);
+		const double v_beta = (v[1] - v[2]) / sqrt(3.0);
+		const double e_alpha = -s->w * MOTOR_LAMBDA * sin(s->theta);
+		const double e_beta = s->w * MOTOR_LAMBDA * cos(s->theta);
+
+		s->i_alpha += (v_alpha - MOTOR_R * s->i_alpha - e_alpha) / MOTOR_L * dt;
+		s->i_beta += (v_beta - MOTOR_R * s->i_beta - e_beta) / MOTOR_L * dt;
+		s->theta = norm_angle(s->theta + s->w * dt);
+	}
+}
+
+// The current controller of control_current, at the angle phase
+static void current_control(sim_t *s, float phase, float id_set, float iq_set) {
+	const float dt = 1.0 / F_SW;
+	const float c = cosf(phase);
+	const float sn = sinf(phase);
+	const float id = c * (float)s->i_alpha + sn * (float)s->i_beta;
+	const float iq = c * (float)s->i_beta - sn * (float)s->i_alpha;
+
+	const float kp = MOTOR_L * CURR_BW;
+	const float ki = MOTOR_R * CURR_BW;
+
+	s->vd_int += (id_set - id) * ki * dt;
+	s->vq_int += (iq_set - iq) * ki * dt;
+	const float vd = s->vd_int + (id_set - id) * kp;
+	const float vq = s->vq_int + (iq_set - iq) * kp;
+
+	const float voltage_normalize = 1.5 / V_BUS;
+	s->mod_alpha = (c * vd - sn * vq) * voltage_normalize;
+	s->mod_beta = (c * vq + sn * vd) * voltage_normalize;
+}
+
+// The compensation and observer of update_valpha_vbeta and observer_update
+static void observer(sim_t *s, comp_mode comp, float i_filter[3]) {
+	const float dt = 1.0 / F_SW;
+	float mod_alpha = s->mod_alpha;
+	float mod_beta = s->mod_beta;
+
+	float comp_alpha = 0.0, comp_beta = 0.0;
+	if (comp == COMP_SIGN) {
+		// Tuned so that it is right at high current
+		const float mod_comp_fact = 1.5 * (m_dt_loss[0] + m_dt_loss[1] + m_dt_loss[2]) / 3.0;
+		comp_alpha = (1.0 / 3.0) * (2.0 * SIGN(i_filter[0]) - SIGN(i_filter[1]) - SIGN(i_filter[2])) * mod_comp_fact;
+		comp_beta = 0.57735026919 * (SIGN(i_filter[1]) - SIGN(i_filter[2])) * mod_comp_fact;
+	} else if (comp == COMP_TABLE) {
+		foc_dtc_mod_comp(&m_dtc, F_SW, i_filter[0], i_filter[1], i_filter[2], &comp_alpha, &comp_beta);
+	}
+
+	mod_alpha -= comp_alpha;
+	mod_beta -= comp_beta;
+
+	const float v_alpha = mod_alpha * (2.0 / 3.0) * V_BUS;
+	const float v_beta = mod_beta * (2.0 / 3.0) * V_BUS;
+	const float L_ia = MOTOR_L * (float)s->i_alpha;
+	const float L_ib = MOTOR_L * (float)s->i_beta;
+	const float lambda_2 = MOTOR_LAMBDA * MOTOR_LAMBDA;
+
+	float err = lambda_2 - ((s->x1 - L_ia) * (s->x1 - L_ia) + (s->x2 - L_ib) * (s->x2 - L_ib));
+	if (err > 0.0) {
+		err = 0.0;
+	}
+
+	s->x1 += (v_alpha - MOTOR_R * (float)s->i_alpha + OBS_GAMMA * 0.5 * (s->x1 - L_ia) * err) * dt;
+	s->x2 += (v_beta - MOTOR_R * (float)s->i_beta + OBS_GAMMA * 0.5 * (s->x2 - L_ib) * err) * dt;
+
+	const float mag = sqrtf(s->x1 * s->x1 + s->x2 * s->x2);
+	if (mag < (MOTOR_LAMBDA * 0.5)) {
+		s->x1 *= 1.1;
+		s->x2 *= 1.1;
+	}
+
+	s->phase_obs = atan2f(s->x2 - L_ib, s->x1 - L_ia);
+}
+
+/*
+ * The sweep of mcpwm_foc_measure_dead_time with the rotor locked, using the
+ * voltage magnitude that the current controller needs at every point.
+ */
+static void measure_table(void) {
+	float v_meas[3][FOC_DTC_POINTS];
+	sim_t s;
+	memset(&s, 0, sizeof(s));
+
+	for (int k = 0;k < 3;k++) {
+		const float phase = (float)(k - 1) * (2.0 * M_PI / 3.0);
+
+		for (int n = 1;n < FOC_DTC_POINTS;n++) {
+			const float i_goal = foc_dtc_point(SWEEP_CURRENT, n);
+
+			// 50 ms to settle and 100 samples
+			double v_sum = 0.0;
+			for (int j = 0;j < (int)(0.05 * F_SW) + 100;j++) {
+				current_control(&s, phase, 0.0, i_goal);
+				plant_step(&s);
+
+				if (j >= (int)(0.05 * F_SW)) {
+					v_sum += sqrt(s.mod_alpha * s.mod_alpha + s.mod_beta * s.mod_beta) * (2.0 / 3.0) * V_BUS;
+				}
+			}
+
+			v_meas[k][n] = v_sum / 100.0;
+		}
+	}
+
+	foc_dtc_reset(&m_dtc);
+	check("table calibrated", foc_dtc_calibrate(&m_dtc, SWEEP_CURRENT * sqrt(3.0) / 2.0, V_BUS, F_SW, v_meas));
+
+	printf("    R: %.1f mOhm (motor %.1f mOhm)\n", m_dtc.res * 1e3, MOTOR_R * 1e3);
+	printf("     I (A)   measured A B C (%%)     actual A B C (%%)\n");
+
+	double err_max = 0.0;
+	for (int n = 0;n < FOC_DTC_POINTS;n++) {
+		const double i = foc_dtc_point(m_dtc.i_max, n);
+		printf("    %6.2f  %5.2f %5.2f %5.2f      %5.2f %5.2f %5.2f\n", i,
+				m_dtc.tab[0][n] * 100.0, m_dtc.tab[1][n] * 100.0, m_dtc.tab[2][n] * 100.0,
+				loss_true(0, i) * 100.0, loss_true(1, i) * 100.0, loss_true(2, i) * 100.0);
+
+		for (int k = 0;k < 3;k++) {
+			double err = fabs(m_dtc.tab[k][n] - loss_true(k, i));
+			if (err > err_max) {
+				err_max = err;
+			}
+		}
+	}
+
+	check("resistance within 3 %", fabs(m_dtc.res - MOTOR_R) / MOTOR_R < 0.03);
+	check("loss within 0.15 % duty of the actual loss", err_max < 0.0015);
+}
+
+typedef struct {
+	double err_rms;
+	double err_max;
+	bool lost;
+} run_result_t;
+
+/*
+ * Run sensorless at a fixed speed and return the observer angle error in
+ * degrees after it has settled.
+ */
+static run_result_t run_speed(float erpm, comp_mode comp) {
+	run_result_t r = {0.0, 0.0, false};
+	sim_t s;
+	memset(&s, 0, sizeof(s));
+	s.w = erpm / 60.0 * 2.0 * M_PI;
+	s.x1 = MOTOR_LAMBDA;
+	s.x2 = 0.0;
+
+	float i_filter[3] = {0.0, 0.0, 0.0};
+	const int settle = (int)(0.3 * F_SW);
+	const int steps = settle + (int)(1.0 * F_SW);
+	double err_sq = 0.0;
+
+	for (int j = 0;j < steps;j++) {
+		double i[3];
+		phase_currents(s.i_alpha, s.i_beta, i);
+
+		// The compensation uses the filtered dq currents in mcpwm_foc.c
+		for (int k = 0;k < 3;k++) {
+			i_filter[k] += ((float)i[k] - i_filter[k]) * 0.1;
+		}
+
+		observer(&s, comp, i_filter);
+		current_control(&s, s.phase_obs, 0.0, IQ_LOAD);
+		plant_step(&s);
+
+		if (j >= settle) {
+			double err = fabs(norm_angle(s.phase_obs - s.theta)) * 180.0 / M_PI;
+			err_sq += err * err;
+			if (err > r.err_max) {
+				r.err_max = err;
+			}
+			if (err > 90.0) {
+				r.lost = true;
+			}
+		}
+	}
+
+	r.err_rms = sqrt(err_sq / (steps - settle));
+	return r;
+}
+
+static void test_speeds(void) {
+	const float speeds[] = {300.0, 500.0, 1000.0, 2000.0, 4000.0};
+	run_result_t res[sizeof(speeds) / sizeof(speeds[0])][COMP_NUM];
+
+	printf("    angle error in degrees, rms / max, at %.0f A\n", IQ_LOAD);
+	printf("     ERPM");
+	for (int c = 0;c < COMP_NUM;c++) {
+		printf("  %17s", m_comp_names[c]);
+	}
+	printf("\n");
+
+	for (unsigned int n = 0;n < sizeof(speeds) / sizeof(speeds[0]);n++) {
+		printf("    %5.0f", speeds[n]);
+		for (int c = 0;c < COMP_NUM;c++) {
+			res[n][c] = run_speed(speeds[n], c);
+			if (res[n][c].lost) {
+				printf("  %17s", "lost");
+			} else {
+				printf("  %7.2f / %7.2f", res[n][c].err_rms, res[n][c].err_max);
+			}
+		}
+		printf("\n");
+	}
+
+	bool table_best = true;
+	bool table_stable = true;
+	for (unsigned int n = 0;n < sizeof(speeds) / sizeof(speeds[0]);n++) {
+		if (res[n][COMP_TABLE].lost) {
+			table_stable = false;
+		}
+
+		if (res[n][COMP_TABLE].err_rms > res[n][COMP_SIGN].err_rms ||
+				res[n][COMP_TABLE].err_rms > res[n][COMP_NONE].err_rms) {
+			table_best = false;
+		}
+	}
+
+	check("table stays locked at all speeds", table_stable);
+	check("table has the lowest angle error at all speeds", table_best);
+	check("table halves the angle error at the lowest speed",
+			res[0][COMP_TABLE].err_rms < 0.5 * res[0][COMP_SIGN].err_rms);
+}
+
+int main(void) {
+	foc_svm_init();
+
+	printf("Sweep:\n");
+	measure_table();
+
+	printf("\nSensorless at low speed:\n");
+	test_speeds();
+
+	return test_result();
+}
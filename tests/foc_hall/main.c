@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "foc_hall.h"
+#include "../test_util.h"
+
+/*
+ * Synthetic hall sensors with uneven edges and a delay, sampled every
+ * control loop iteration. The hall table is what the detection would give,
+ * that is the center of every state, so the nominal edges in the middle
+ * between the centers are off by a few degrees.
+ *
+ * The learned model is compared with the interpolation from correct_hall in
+ * mcpwm_foc.c at constant speed, with acceleration, with speed ripple and
+ * through direction changes.
+ */
+
+#define F_LOOP			20000.0
+#define DT				(1.0 / F_LOOP)
+#define INTERP_ERPM		500.0
+#define HALL_DELAY		40e-6
+
+#define RPM2RADPS(x)	((x) * 2.0 * M_PI / 60.0)
+#define RAD2DEG(x)		((x) * 180.0 / M_PI)
+#define DEG2RAD(x)		((x) * M_PI / 180.0)
+#define SIGN(x)			(((x) < 0.0) ? -1.0 : 1.0)
+
+// Hall states in the forward direction and where each of them starts
+static const int m_order[6] = {1, 3, 2, 6, 4, 5};
+static const double m_edge_deg[6] = {36.0, 86.0, 158.0, 203.0, 273.0, 325.0};
+
+typedef enum {
+	PROF_CONST = 0,
+	PROF_RAMP,
+	PROF_RIPPLE,
+	PROF_REVERSE
+} profile_t;
+
+typedef struct {
+	profile_t type;
+	double erpm;
+	double erpm2;
+	double t_len;
+} profile;
+
+// State of the interpolation in correct_hall
+typedef struct {
+	int ang_hall_int_prev;
+	float ang_hall;
+	float hall_dt_diff_last;
+	float hall_dt_diff_now;
+} legacy_t;
+
+typedef struct {
+	double rms;
+	double max;
+} err_t;
+
+static uint8_t m_table[8];
+static double m_edge_mean = 0.0;
+static double time_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static double norm_angle(double a) {
+	a = fmod(a, 2.0 * M_PI);
+	if (a < 0.0) {
+		a += 2.0 * M_PI;
+	}
+	return a;
+}
+
+static double angle_diff(double a, double b) {
+	double d = norm_angle(a - b);
+	if (d > M_PI) {
+		d -= 2.0 * M_PI;
+	}
+	return d;
+}
+
+static void make_table(void) {
+	memset(m_table, 255, sizeof(m_table));
+
+	for (int k = 0;k < 6;k++) {
+		double lo = DEG2RAD(m_edge_deg[k]);
+		double hi = DEG2RAD(m_edge_deg[(k + 1) % 6]);
+		double center = norm_angle(lo + 0.5 * norm_angle(hi - lo));
+		m_table[m_order[k]] = (uint8_t)(center / (2.0 * M_PI) * 200.0 + 0.5) % 200;
+	}
+}
+
+static int hall_at(double angle) {
+	angle = RAD2DEG(norm_angle(angle));
+	int state = m_order[5];
+	for (int k = 0;k < 6;k++) {
+		if (angle >= m_edge_deg[k]) {
+			state = m_order[k];
+		}
+	}
+	return state;
+}
+
+static double profile_speed(const profile *p, double t) {
+	double erpm;
+
+	switch (p->type) {
+	case PROF_RAMP:
+		erpm = p->erpm + (p->erpm2 - p->erpm) * t / p->t_len;
+		break;
+
+	case PROF_RIPPLE:
+		erpm = p->erpm + p->erpm2 * sin(2.0 * M_PI * 5.0 * t);
+		break;
+
+	case PROF_REVERSE:
+		erpm = p->erpm * sin(2.0 * M_PI * t / p->t_len);
+		break;
+
+	default:
+		erpm = p->erpm;
+		break;
+	}
+
+	return RPM2RADPS(erpm);
+}
+
+/*
+ * The interpolation part of correct_hall, without the observer switching and
+ * the rate limit.
+ */
+static float legacy_update(legacy_t *l, int hall, float dt) {
+	l->hall_dt_diff_now += dt;
+	float rad_per_sec = (M_PI / 3.0) / l->hall_dt_diff_last;
+	int ang_hall_int = m_table[hall];
+	float ang_hall_now = ((float)ang_hall_int / 200.0) * 2 * M_PI;
+
+	if (l->ang_hall_int_prev < 0) {
+		l->ang_hall_int_prev = ang_hall_int;
+		l->ang_hall = ang_hall_now;
+	} else if (ang_hall_int != l->ang_hall_int_prev) {
+		int diff = ang_hall_int - l->ang_hall_int_prev;
+		if (diff > 100) {
+			diff -= 200;
+		} else if (diff < -100) {
+			diff += 200;
+		}
+
+		if (SIGN(diff) == SIGN(l->hall_dt_diff_last)) {
+			if (diff > 0) {
+				l->hall_dt_diff_last = l->hall_dt_diff_now;
+			} else {
+				l->hall_dt_diff_last = -l->hall_dt_diff_now;
+			}
+		} else {
+			l->hall_dt_diff_last = -l->hall_dt_diff_last;
+		}
+
+		l->hall_dt_diff_now = 0.0;
+
+		int ang_avg = l->ang_hall_int_prev + diff / 2;
+		ang_avg %= 200;
+		l->ang_hall = ((float)ang_avg / 200.0) * 2 * M_PI;
+	}
+
+	l->ang_hall_int_prev = ang_hall_int;
+
+	if ((60.0 * (M_PI / 3.0) / (2.0 * M_PI) /
+			fmaxf(fabsf(l->hall_dt_diff_now), fabsf(l->hall_dt_diff_last))) < INTERP_ERPM) {
+		l->ang_hall = ang_hall_now;
+	} else {
+		float diff = angle_diff(l->ang_hall, ang_hall_now);
+		if (fabsf(diff) < ((2.0 * M_PI) / 12.0)) {
+			l->ang_hall += rad_per_sec * dt;
+		} else {
+			l->ang_hall -= diff / 100.0;
+		}
+	}
+
+	l->ang_hall = norm_angle(l->ang_hall);
+	return l->ang_hall;
+}
+
+/*
+ * Run a speed profile. The observer angle is given to the model as the true
+ * angle when learn_delay is set. The error is only counted above the
+ * interpolation speed, as both snap to the center of the state below it.
+ */
+static void run(foc_hall_state *h, const profile *p, bool learn_delay, err_t *e_legacy, err_t *e_model) {
+	legacy_t l;
+	memset(&l, 0, sizeof(l));
+	l.ang_hall_int_prev = -1;
+	l.hall_dt_diff_last = 1.0;
+
+	double theta = 0.3;
+	double sq_l = 0.0, sq_m = 0.0;
+	double max_l = 0.0, max_m = 0.0;
+	int cnt = 0;
+
+	const int steps = (int)(p->t_len * F_LOOP);
+	for (int i = 0;i < steps;i++) {
+		double t = (double)i * DT;
+		double w = profile_speed(p, t);
+		theta = norm_angle(theta + w * DT);
+
+		int hall = hall_at(theta - w * HALL_DELAY);
+
+		float ang_l = legacy_update(&l, hall, DT);
+		foc_hall_update(h, m_table, hall, DT, theta, learn_delay,
+				RPM2RADPS(INTERP_ERPM));
+
+		// Only look at the second half, when the model has settled
+		if (i < steps / 2 || fabs(w) < RPM2RADPS(INTERP_ERPM * 1.2)) {
+			continue;
+		}
+
+		double el = fabs(RAD2DEG(angle_diff(ang_l, theta)));
+		double em = fabs(RAD2DEG(angle_diff(h->angle, theta)));
+		sq_l += el * el;
+		sq_m += em * em;
+		max_l = fmax(max_l, el);
+		max_m = fmax(max_m, em);
+		cnt++;
+	}
+
+	e_legacy->rms = sqrt(sq_l / (double)cnt);
+	e_legacy->max = max_l;
+	e_model->rms = sqrt(sq_m / (double)cnt);
+	e_model->max = max_m;
+}
+
+static void test_learning(foc_hall_state *h) {
+	err_t el, em;
+	profile p = {PROF_CONST, 1000.0, 0.0, 4.0};
+
+	run(h, &p, false, &el, &em);
+
+	// The learned edges can be off by a constant
+	double dev[6];
+	double mean = 0.0;
+	for (int k = 0;k < 6;k++) {
+		dev[k] = angle_diff(foc_hall_edge_angle(h, m_order[k], 1), DEG2RAD(m_edge_deg[k]));
+		mean += dev[k];
+	}
+	mean /= 6.0;
+	m_edge_mean = mean;
+
+	double err_max = 0.0;
+	printf("    Edge   True    Table   Learned\n");
+	for (int k = 0;k < 6;k++) {
+		printf("    %d      %5.1f   %5.1f   %5.1f\n", k, m_edge_deg[k],
+				RAD2DEG(h->nominal[m_order[k]]),
+				RAD2DEG(foc_hall_edge_angle(h, m_order[k], 1)));
+		err_max = fmax(err_max, fabs(RAD2DEG(dev[k] - mean)));
+	}
+	printf("    Max edge error: %.2f deg, %u updates\n", err_max, (unsigned int)h->cal_cnt[0]);
+
+	check("Edges learned to within 1 degree", err_max < 1.0);
+	check("Offsets have zero mean", fabs(RAD2DEG(mean)) < 1.0);
+}
+
+static void test_profiles(foc_hall_state *h) {
+	const struct {
+		const char *name;
+		profile p;
+		double gain_min;
+	} runs[] = {
+			{"1000 ERPM", {PROF_CONST, 1000.0, 0.0, 2.0}, 3.0},
+			{"3000 ERPM", {PROF_CONST, 3000.0, 0.0, 2.0}, 3.0},
+			{"1000 -> 8000 ERPM in 0.5 s", {PROF_RAMP, 1000.0, 8000.0, 1.0}, 2.0},
+			{"2000 ERPM +- 400 at 5 Hz", {PROF_RIPPLE, 2000.0, 400.0, 2.0}, 2.0},
+			{"+- 1500 ERPM at 0.5 Hz", {PROF_REVERSE, 1500.0, 0.0, 4.0}, 1.5},
+	};
+
+	printf("    %-28s %17s %17s\n", "", "correct_hall", "model");
+	printf("    %-28s %8s %8s %8s %8s\n", "Profile", "rms", "max", "rms", "max");
+
+	for (unsigned int r = 0;r < sizeof(runs) / sizeof(runs[0]);r++) {
+		err_t el, em;
+		run(h, &runs[r].p, false, &el, &em);
+		printf("    %-28s %8.2f %8.2f %8.2f %8.2f\n", runs[r].name, el.rms, el.max, em.rms, em.max);
+
+		char name[80];
+		snprintf(name, sizeof(name), "%s: rms error %.1fx lower", runs[r].name, runs[r].gain_min);
+		check(name, (em.rms * runs[r].gain_min) < el.rms);
+	}
+}
+
+static void test_delay(foc_hall_state *h) {
+	err_t el, em_before, em_after;
+	profile p = {PROF_CONST, 7700.0, 0.0, 2.0};
+
+	run(h, &p, false, &el, &em_before);
+	run(h, &p, true, &el, &em_after);
+
+	// The common error of the learned edges can't be told apart from a delay
+	// at one speed, so it ends up in the delay.
+	const double delay_exp = HALL_DELAY - m_edge_mean / RPM2RADPS(p.erpm);
+
+	printf("    Learned delay: %.1f us (sensor %.1f us, table error %.1f us), %u updates\n",
+			h->delay * 1e6, HALL_DELAY * 1e6, (delay_exp - HALL_DELAY) * 1e6,
+			(unsigned int)h->delay_cnt);
+	printf("    %.0f ERPM rms error: %.2f deg before, %.2f deg after, %.2f deg correct_hall\n",
+			p.erpm, em_before.rms, em_after.rms, el.rms);
+
+	// The edges are only seen every sample, so that is how far the rotor
+	// can be from the last edge.
+	const double ang_sample = RAD2DEG(RPM2RADPS(p.erpm) * DT);
+
+	check("Delay learned to within 3 us", fabs(h->delay - delay_exp) < 3e-6);
+	check("Error reduced by the delay", em_after.rms < em_before.rms);
+	check("Error below the rotation in one sample", em_after.rms < ang_sample);
+}
+
+static void test_invalid(void) {
+	foc_hall_state h;
+	foc_hall_reset(&h);
+
+	uint8_t table[8];
+	memcpy(table, m_table, sizeof(table));
+	table[m_order[2]] = 255;
+	check("Table with five states rejected", !foc_hall_update(&h, table, m_order[0], DT, 0.0, false, 0.0));
+
+	check("Invalid state rejected", !foc_hall_update(&h, m_table, 0, DT, 0.0, false, 0.0));
+	check("Valid state accepted", foc_hall_update(&h, m_table, m_order[0], DT, 0.0, false, 0.0));
+
+	// Skipping a state must not be taken as an edge
+	foc_hall_update(&h, m_table, m_order[2], DT, 0.0, false, 0.0);
+	check("Skipped state resyncs", h.edges == 0 && h.dir == 0);
+}
+
+static void test_speed(foc_hall_state *h) {
+	const int num = 2000000;
+	int hall[1024];
+	double theta = 0.0;
+	for (int i = 0;i < 1024;i++) {
+		hall[i] = hall_at(theta);
+		theta += RPM2RADPS(20000.0) * DT;
+	}
+
+	float sink = 0.0;
+	double t0 = time_now();
+	for (int i = 0;i < num;i++) {
+		foc_hall_update(h, m_table, hall[i & 1023], DT, 0.0, false, RPM2RADPS(INTERP_ERPM));
+		sink += h->angle;
+	}
+	printf("    foc_hall_update: %.1f ns\n", (time_now() - t0) / num * 1e9);
+
+	legacy_t l;
+	memset(&l, 0, sizeof(l));
+	l.ang_hall_int_prev = -1;
+	l.hall_dt_diff_last = 1.0;
+	t0 = time_now();
+	for (int i = 0;i < num;i++) {
+		sink += legacy_update(&l, hall[i & 1023], DT);
+	}
+	printf("    correct_hall:    %.1f ns\n", (time_now() - t0) / num * 1e9);
+
+	(void)sink;
+}
+
+int main(void) {
+	make_table();
+
+	foc_hall_state h;
+	foc_hall_reset(&h);
+
+	printf("Learning:\n");
+	test_learning(&h);
+
+	printf("\nAngle error (deg):\n");
+	test_profiles(&h);
+
+	printf("\nDelay:\n");
+	test_delay(&h);
+
+	printf("\nInvalid input:\n");
+	test_invalid();
+
+	printf("\nSpeed:\n");
+	test_speed(&h);
+
+	return test_result();
+}
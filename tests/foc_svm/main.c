@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#include "foc_svm.h"
+#include "../test_util.h"
+
+/*
+ * The zero sequence SVM is compared with the sector based svm that was used
+ * in mcpwm_foc.c before, and the fundamental of the output voltage and the
+ * number of switching events per electrical period are checked for all modes.
+ */
+
+#define ONE_BY_SQRT3			(0.57735026919)
+#define TWO_BY_SQRT3			(2.0f * 0.57735026919)
+#define TOP						8400
+#define PERIOD_STEPS			720
+
+static double time_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// The svm from mcpwm_foc.c before foc_svm.c
+__attribute__((noinline)) static void svm_legacy(float alpha, float beta, uint32_t PWMFullDutyCycle,
+				uint32_t* tAout, uint32_t* tBout, uint32_t* tCout, uint32_t *svm_sector) {
+	uint32_t sector;
+
+	if (beta >= 0.0f) {
+		if (alpha >= 0.0f) {
+			//quadrant I
+			if (ONE_BY_SQRT3 * beta > alpha) {
+				sector = 2;
+			} else {
+				sector = 1;
+			}
+		} else {
+			//quadrant II
+			if (-ONE_BY_SQRT3 * beta > alpha) {
+				sector = 3;
+			} else {
+				sector = 2;
+			}
+		}
+	} else {
+		if (alpha >= 0.0f) {
+			//quadrant IV5
+			if (-ONE_BY_SQRT3 * beta > alpha) {
+				sector = 5;
+			} else {
+				sector = 6;
+			}
+		} else {
+			//quadrant III
+			if (ONE_BY_SQRT3 * beta > alpha) {
+				sector = 4;
+			} else {
+				sector = 5;
+			}
+		}
+	}
+
+	// PWM timings
+	uint32_t tA, tB, tC;
+
+	switch (sector) {
+
+	// sector 1-2
+	case 1: {
+		// Vector on-times
+		uint32_t t1 = (alpha - ONE_BY_SQRT3 * beta) * PWMFullDutyCycle;
+		uint32_t t2 = (TWO_BY_SQRT3 * beta) * PWMFullDutyCycle;
+
+		// PWM timings
+		tA = (PWMFullDutyCycle + t1 + t2) / 2;
+		tB = tA - t1;
+		tC = tB - t2;
+
+		break;
+	}
+
+	// sector 2-3
+	case 2: {
+		// Vector on-times
+		uint32_t t2 = (alpha + ONE_BY_SQRT3 * beta) * PWMFullDutyCycle;
+		uint32_t t3 = (-alpha + ONE_BY_SQRT3 * beta) * PWMFullDutyCycle;
+
+		// PWM timings
+		tB = (PWMFullDutyCycle + t2 + t3) / 2;
+		tA = tB - t3;
+		tC = tA - t2;
+
+		break;
+	}
+
+	// sector 3-4
+	case 3: {
+		// Vector on-times
+		uint32_t t3 = (TWO_BY_SQRT3 * beta) * PWMFullDutyCycle;
+		uint32_t t4 = (-alpha - ONE_BY_SQRT3 * beta) * PWMFullDutyCycle;
+
+		// PWM timings
+		tB = (PWMFullDutyCycle + t3 + t4) / 2;
+		tC = tB - t3;
+		tA = tC - t4;
+
+		break;
+	}
+
+	// sector 4-5
+	case 4: {
+		// Vector on-times
+		uint32_t t4 = (-alpha + ONE_BY_SQRT3 * beta) * PWMFullDutyCycle;
+		uint32_t t5 = (-TWO_BY_SQRT3 * beta) * PWMFullDutyCycle;
+
+		// PWM timings
+		tC = (PWMFullDutyCycle + t4 + t5) / 2;
+		tB = tC - t5;
+		tA = tB - t4;
+
+		break;
+	}
+
+	// sector 5-6
+	case 5: {
+		// Vector on-times
+		uint32_t t5 = (-alpha - ONE_BY_SQRT3 * beta) * PWMFullDutyCycle;
+		uint32_t t6 = (alpha - ONE_BY_SQRT3 * beta) * PWMFullDutyCycle;
+
+		// PWM timings
+		tC = (PWMFullDutyCycle + t5 + t6) / 2;
+		tA = tC - t5;
+		tB = tA - t6;
+
+		break;
+	}
+
+	// sector 6-1
+	case 6: {
+		// Vector on-times
+		uint32_t t6 = (-TWO_BY_SQRT3 * beta) * PWMFullDutyCycle;
+		uint32_t t1 = (alpha + ONE_BY_SQRT3 * beta) * PWMFullDutyCycle;
+
+		// PWM timings
+		tA = (PWMFullDutyCycle + t6 + t1) / 2;
+		tC = tA - t1;
+		tB = tC - t6;
+
+		break;
+	}
+	}
+
+	*tAout = tA;
+	*tBout = tB;
+	*tCout = tC;
+	*svm_sector = sector;
+}
+
+// Fundamental of the output over one electrical period, in the normalization of the input
+static double fundamental(float mod, foc_svm_mode mode, bool overmod) {
+	double sum = 0.0;
+
+	for (int i = 0;i < PERIOD_STEPS;i++) {
+		double ang = 2.0 * M_PI * ((double)i + 0.5) / (double)PERIOD_STEPS;
+		uint32_t t[3], sector;
+		foc_svm(mod * cos(ang), mod * sin(ang), TOP, mode, overmod, &t[0], &t[1], &t[2], &sector);
+
+		double da = (double)t[0] / TOP;
+		double db = (double)t[1] / TOP;
+		double dc = (double)t[2] / TOP;
+		double alpha = 0.5 * (2.0 * da - db - dc);
+		double beta = FOC_SVM_MOD_LINEAR * (db - dc);
+		sum += alpha * cos(ang) + beta * sin(ang);
+	}
+
+	return sum / (double)PERIOD_STEPS;
+}
+
+// Switching events of all phases over one electrical period with PERIOD_STEPS PWM cycles
+static int switch_events(float mod, foc_svm_mode mode, bool overmod) {
+	int events = 0;
+	uint32_t last[3] = {0, 0, 0};
+
+	for (int i = 0;i <= PERIOD_STEPS;i++) {
+		double ang = 2.0 * M_PI * (double)i / (double)PERIOD_STEPS;
+		uint32_t t[3], sector;
+		foc_svm(mod * cos(ang), mod * sin(ang), TOP, mode, overmod, &t[0], &t[1], &t[2], &sector);
+
+		for (int j = 0;j < 3;j++) {
+			if (i == 0) {
+				last[j] = t[j];
+				continue;
+			}
+
+			// A pulse switches twice, and going between the rails once
+			if (t[j] > 0 && t[j] < TOP) {
+				events += 2;
+			} else if (t[j] != last[j] && (last[j] == 0 || last[j] == TOP)) {
+				events += 1;
+			}
+			last[j] = t[j];
+		}
+	}
+
+	return events;
+}
+
+static void test_legacy(void) {
+	int diff_max = 0;
+	int sector_diff = 0;
+
+	for (int m = 0;m <= 20;m++) {
+		float mod = FOC_SVM_MOD_LINEAR * (float)m / 20.0;
+
+		for (int i = 0;i < 3600;i++) {
+			float ang = 2.0 * M_PI * ((float)i + 0.3) / 3600.0;
+			float alpha = mod * cosf(ang);
+			float beta = mod * sinf(ang);
+
+			uint32_t a1, b1, c1, s1, a2, b2, c2, s2;
+			svm_legacy(alpha, beta, TOP, &a1, &b1, &c1, &s1);
+			foc_svm(alpha, beta, TOP, FOC_SVM_MODE_CENTERED, false, &a2, &b2, &c2, &s2);
+
+			int d[3] = {abs((int)a1 - (int)a2), abs((int)b1 - (int)b2), abs((int)c1 - (int)c2)};
+			for (int j = 0;j < 3;j++) {
+				if (d[j] > diff_max) {
+					diff_max = d[j];
+				}
+			}
+
+			if (mod > 0.01 && s1 != s2) {
+				sector_diff++;
+			}
+		}
+	}
+
+	printf("    largest difference: %d counts of %d\n", diff_max, TOP);
+	check("centered mode matches the legacy svm", diff_max <= 2);
+	check("same sector as the legacy svm", sector_diff == 0);
+}
+
+static void test_linearity(void) {
+	for (int mode = 0;mode < FOC_SVM_MODE_NUM;mode++) {
+		double err_max = 0.0;
+		for (int m = 1;m <= 20;m++) {
+			float mod = FOC_SVM_MOD_LINEAR * (float)m / 20.0;
+			double err = fabs(fundamental(mod, mode, false) - mod) / mod;
+			if (err > err_max) {
+				err_max = err;
+			}
+		}
+
+		char buf[100];
+		sprintf(buf, "%s linear up to %.3f (error %.3f %%)",
+				foc_svm_mode_name(mode), FOC_SVM_MOD_LINEAR, err_max * 100.0);
+		check(buf, err_max < 0.002);
+	}
+
+	printf("    request  clamped  overmod\n");
+	double err_max = 0.0;
+	double last = 0.0;
+	bool monotonic = true;
+	for (int m = 0;m <= 10;m++) {
+		float mod = FOC_SVM_MOD_LINEAR + (FOC_SVM_MOD_SIX_STEP - FOC_SVM_MOD_LINEAR) * (float)m / 10.0;
+		double clamped = fundamental(mod, FOC_SVM_MODE_CENTERED, false);
+		double over = fundamental(mod, FOC_SVM_MODE_CENTERED, true);
+		printf("    %.4f   %.4f   %.4f\n", mod, clamped, over);
+
+		double err = fabs(over - mod) / mod;
+		if (err > err_max) {
+			err_max = err;
+		}
+		if (over < last) {
+			monotonic = false;
+		}
+		last = over;
+	}
+
+	check("overmodulation follows the request up to six-step", err_max < 0.005);
+	check("overmodulation is monotonic", monotonic);
+	check("without overmodulation the hexagon is the limit",
+			fundamental(FOC_SVM_MOD_SIX_STEP, FOC_SVM_MODE_CENTERED, false) < 0.91);
+	check("below the linear limit overmodulation changes nothing",
+			fabs(fundamental(0.8, FOC_SVM_MODE_CENTERED, true) - 0.8) < 0.002);
+}
+
+static void test_switching(void) {
+	int centered = switch_events(0.7, FOC_SVM_MODE_CENTERED, false);
+
+	printf("    %-10s events per period (%d PWM cycles)\n", "mode", PERIOD_STEPS);
+	for (int mode = 0;mode < FOC_SVM_MODE_NUM;mode++) {
+		int events = switch_events(0.7, mode, false);
+		printf("    %-10s %d (%.1f %%)\n", foc_svm_mode_name(mode), events, 100.0 * events / centered);
+
+		if (mode != FOC_SVM_MODE_CENTERED) {
+			char buf[100];
+			sprintf(buf, "%s saves a third of the switching", foc_svm_mode_name(mode));
+			double ratio = (double)events / centered;
+			check(buf, ratio > 0.64 && ratio < 0.7);
+		}
+	}
+
+	int six_step = switch_events(FOC_SVM_MOD_SIX_STEP, FOC_SVM_MODE_CENTERED, true);
+	printf("    %-10s %d\n", "six-step", six_step);
+	check("six-step switches each phase twice per period", six_step == 6);
+}
+
+static void test_speed(void) {
+	const int num = 10000000;
+	static float alpha[1024], beta[1024], alpha_high[1024], beta_high[1024];
+	volatile uint32_t sink = 0;
+	uint32_t a, b, c, s;
+
+	for (int i = 0;i < 1024;i++) {
+		float ang = (float)i * (2.0 * M_PI / 1024.0);
+		alpha[i] = 0.7 * cosf(ang);
+		beta[i] = 0.7 * sinf(ang);
+		alpha_high[i] = 0.93 * cosf(ang);
+		beta_high[i] = 0.93 * sinf(ang);
+	}
+
+	printf("    %-24s ns/call\n", "");
+
+	double t0 = time_now();
+	for (int i = 0;i < num;i++) {
+		svm_legacy(alpha[i & 1023], beta[i & 1023], TOP, &a, &b, &c, &s);
+		sink += a + b + c + s;
+	}
+	printf("    %-24s %.1f\n", "legacy", (time_now() - t0) / num * 1e9);
+
+	const struct {
+		const char *name;
+		foc_svm_mode mode;
+		bool overmod;
+		float *alpha;
+		float *beta;
+	} runs[] = {
+			{"centered", FOC_SVM_MODE_CENTERED, false, alpha, beta},
+			{"DPWM1", FOC_SVM_MODE_DPWM1, false, alpha, beta},
+			{"overmod, linear", FOC_SVM_MODE_CENTERED, true, alpha, beta},
+			{"overmod, mode II", FOC_SVM_MODE_CENTERED, true, alpha_high, beta_high},
+	};
+
+	for (unsigned int r = 0;r < sizeof(runs) / sizeof(runs[0]);r++) {
+		t0 = time_now();
+		for (int i = 0;i < num;i++) {
+			foc_svm(runs[r].alpha[i & 1023], runs[r].beta[i & 1023], TOP,
+					runs[r].mode, runs[r].overmod, &a, &b, &c, &s);
+			sink += a + b + c + s;
+		}
+		printf("    %-24s %.1f\n", runs[r].name, (time_now() - t0) / num * 1e9);
+	}
+
+	(void)sink;
+}
+
+int main(void) {
+	double t0 = time_now();
+	foc_svm_init();
+	printf("Overmodulation table built in %.2f ms\n", (time_now() - t0) * 1e3);
+
+	printf("\nLegacy svm:\n");
+	test_legacy();
+
+	printf("\nLinearity:\n");
+	test_linearity();
+
+	printf("\nSwitching:\n");
+	test_switching();
+
+	printf("\nSpeed:\n");
+	test_speed();
+
+	return test_result();
+}
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lispbm.h"
+#include "buffer_extensions.h"
+#include "../test_util.h"
+
+/*
+ * Byte buffer extensions, evaluated from lisp code in the same runtime
+ * as on the VESC. The extensions are also called directly to check that
+ * writing and reading small values does not use any heap cells.
+ *
+ * The lisp memory is mapped below 4 GB and the binary is not position
+ * independent, as the runtime stores addresses in 32 bit values.
+ */
+
+#define NUM_CELLS		4096
+#define MEM_SIZE		MEMORY_SIZE_16K
+#define BITMAP_SIZE		MEMORY_BITMAP_SIZE_16K
+
+static cons_t m_heap[NUM_CELLS] __attribute__((aligned(8)));
+static uint32_t *m_mem = NULL;
+static bool init_runtime(void) {
+	if (!m_mem) {
+		m_mem = mmap(NULL, (MEM_SIZE + BITMAP_SIZE) * 4, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	}
+
+	return lispbm_init(m_heap, NUM_CELLS, m_mem, MEM_SIZE, m_mem + MEM_SIZE, BITMAP_SIZE) == 1 &&
+			eval_cps_init_nc(256, false) &&
+			buffer_extensions_init();
+}
+
+// Evaluates src after creating the 8 byte buffer b and compares the
+// printed result of the last expression
+static void eval_test(const char *src, const char *expected) {
+	char code[512];
+	char res[128];
+
+	init_runtime();
+	snprintf(code, sizeof(code), "(define b (bufcreate 8)) %s", src);
+
+	VALUE prg = tokpar_parse(code);
+	VALUE r = eval_cps_program_nc(prg);
+	print_value(res, sizeof(res), r);
+
+	check(src, strcmp(res, expected) == 0);
+	if (strcmp(res, expected) != 0) {
+		printf("    got %s, expected %s\n", res, expected);
+	}
+}
+
+static VALUE call(const char *name, VALUE *args, UINT argn) {
+	UINT sym;
+	if (!symrepr_lookup((char*)name, &sym)) {
+		return enc_sym(SYM_EERROR);
+	}
+	return extensions_lookup(sym)(args, argn);
+}
+
+static void test_no_allocation(void) {
+	init_runtime();
+
+	VALUE buf;
+	heap_allocate_array(&buf, 64, VAL_TYPE_CHAR);
+	VALUE little = enc_sym(SYM_NIL);
+	UINT sym;
+	if (symrepr_lookup("little-endian", &sym)) {
+		little = enc_sym(sym);
+	}
+
+	unsigned int free_before = heap_num_free();
+	bool ok = true;
+
+	for (int i = 0;i < 1000;i++) {
+		VALUE set_args[] = {buf, enc_i(i % 32), enc_i(i), enc_i(-i), little};
+		ok &= call("bufset-i16", set_args, 5) == enc_sym(SYM_TRUE);
+
+		VALUE get_args[] = {buf, enc_i(i % 32 + 2), little};
+		ok &= dec_i(call("bufget-i16", get_args, 3)) == -i;
+
+		VALUE clear_args[] = {buf, enc_i(0)};
+		ok &= call("bufclear", clear_args, 2) == enc_sym(SYM_TRUE);
+	}
+
+	check("1000 writes and reads without heap cells", ok && heap_num_free() == free_before);
+}
+
+int main(void) {
+	printf("Buffers:\n");
+	eval_test("(bufset-u16 b 0 0x1234) (bufget-u8 b 0)", "18");
+	eval_test("(bufset-u16 b 0 0x1234 'little-endian) (bufget-u8 b 0)", "52");
+	eval_test("(bufset-u16 b 0 0x1234 'big-endian) (bufget-u16 b 0 'big-endian)", "4660");
+	eval_test("(bufset-i8 b 7 (- 0 5)) (bufget-i8 b 7)", "-5");
+	eval_test("(bufset-i16 b 3 (- 0 300) 'little-endian) (bufget-i16 b 3 'little-endian)", "-300");
+	eval_test("(bufset-i32 b 2 (- 0 100000)) (bufget-i32 b 2)", "{-100000}");
+	eval_test("(bufset-u32 b 4 0xAABBCCDD) (bufget-u32 b 4)", "{2864434397}");
+	eval_test("(bufset-f32 b 4 3.5 'little-endian) (bufget-f32 b 4 'little-endian)", "{3.500000}");
+	eval_test("(bufset-u8 b 0 1 2 3 4) (bufget-u32 b 0 'little-endian)", "{67305985}");
+	eval_test("(bufclear b 255) (bufget-i8 b 7)", "-1");
+	eval_test("(buflen b)", "8");
+	eval_test("(buflen \"abc\")", "4");
+
+	printf("\nViews:\n");
+	eval_test("(define v (bufview b 4 4)) (bufset-u8 v 1 9) (bufget-u8 b 5)", "9");
+	eval_test("(define v (bufview b 4 4)) (buflen v)", "4");
+	eval_test("(define v (bufview (bufview b 2 6) 2 2)) (bufset-u8 v 0 7) (bufget-u8 b 4)", "7");
+	eval_test("(bufset-u8 b 0 1 2 3 4) (bufcpy b 1 b 0 3) (bufget-u32 b 0)", "{16843267}");
+	eval_test("(bufset-u8 b 4 42) (bufcpy b 0 (bufview b 4 4) 0 4) (bufget-u8 b 0)", "42");
+
+	printf("\nErrors:\n");
+	eval_test("(bufset-u32 b 6 1)", "eval_error");
+	eval_test("(bufget-u16 b 7)", "eval_error");
+	eval_test("(bufset-u16 (bufview b 4 4) 3 1)", "eval_error");
+	eval_test("(bufview b 6 4)", "eval_error");
+	eval_test("(bufcpy b 0 b 4 5)", "eval_error");
+	eval_test("(bufset-u8 b 0 1 'middle-endian)", "eval_error");
+	eval_test("(bufset-u8 b 0 'a)", "eval_error");
+	eval_test("(bufget-u8 '(1 2 3) 0)", "eval_error");
+
+	printf("\nAllocation:\n");
+	test_no_allocation();
+
+	return test_result();
+}
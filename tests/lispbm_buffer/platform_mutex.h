@@ -0,0 +1,23 @@
+#ifndef PLATFORM_MUTEX_H_
+#define PLATFORM_MUTEX_H_
+
+// Host version of lispBM/platform/chibios/include/platform_mutex.h
+
+#include <pthread.h>
+#include <stdbool.h>
+
+typedef pthread_mutex_t mutex_t;
+
+static inline bool mutex_init(mutex_t *m) {
+	return pthread_mutex_init(m, NULL) == 0;
+}
+
+static inline void mutex_lock(mutex_t *m) {
+	pthread_mutex_lock(m);
+}
+
+static inline void mutex_unlock(mutex_t *m) {
+	pthread_mutex_unlock(m);
+}
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "image_writer.h"
+#include "compression.h"
+#include "heap.h"
+#include "tokpar.h"
+#include "print.h"
+#include "../test_util.h"
+
+/*
+ * Compression of lisp code with the original code table and with the
+ * trained dictionary. Both must decompress to the same text and parse to
+ * the same program. The compression ratio and decode speed of both are
+ * printed for each file.
+ *
+ * The dictionary is trained on these files, so the last test case is a
+ * script that is not part of the training set.
+ */
+
+#define PARSE_CELLS			65536
+#define BENCH_BYTES			(4 * 1024 * 1024)
+
+static char *read_file(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return NULL;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char *buf = malloc((size_t)size + 1);
+	size_t n = fread(buf, 1, (size_t)size, f);
+	buf[n] = 0;
+	fclose(f);
+	return buf;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static char *compress(const char *src, uint32_t *size, bool legacy) {
+	char *tmp = strdup(src);
+	char *res = legacy ? compression_compress_legacy(tmp, size) : compression_compress(tmp, size);
+	free(tmp);
+	return res;
+}
+
+static char *print_program(VALUE prg) {
+	size_t cap = 1 << 16;
+	size_t len = 0;
+	char *res = malloc(cap);
+	char buf[1024];
+
+	res[0] = 0;
+	while (type_of(prg) == PTR_TYPE_CONS) {
+		print_value(buf, sizeof(buf), car(prg));
+		size_t n = strlen(buf);
+		if (len + n + 2 > cap) {
+			cap *= 2;
+			res = realloc(res, cap);
+		}
+		memcpy(res + len, buf, n);
+		len += n;
+		res[len++] = '\n';
+		res[len] = 0;
+		prg = cdr(prg);
+	}
+
+	return res;
+}
+
+static char *parse_compressed(char *compressed) {
+	image_writer_init(PARSE_CELLS);
+	VALUE prg = compression_parse(compressed);
+	if (type_of(prg) == VAL_TYPE_SYMBOL && dec_sym(prg) != SYM_NIL) {
+		return NULL;
+	}
+	return print_program(prg);
+}
+
+// Decompressed bytes per second
+static double decode_speed(char *compressed, char *dest, uint32_t dest_n, uint32_t text_len) {
+	int iterations = BENCH_BYTES / (int)text_len + 1;
+
+	double t0 = now();
+	for (int i = 0;i < iterations;i++) {
+		compression_decompress(dest, dest_n, compressed);
+	}
+	return (double)text_len * (double)iterations / (now() - t0);
+}
+
+static void test_file(const char *name, const char *src) {
+	uint32_t size_legacy, size_dict;
+	char *c_legacy = compress(src, &size_legacy, true);
+	char *c_dict = compress(src, &size_dict, false);
+
+	if (!c_legacy || !c_dict) {
+		check(name, false);
+		free(c_legacy);
+		free(c_dict);
+		return;
+	}
+
+	uint32_t dest_n = (uint32_t)strlen(src) + 64;
+	char *d_legacy = malloc(dest_n);
+	char *d_dict = malloc(dest_n);
+
+	bool ok = compression_decompress(d_legacy, dest_n, c_legacy) &&
+			compression_decompress(d_dict, dest_n, c_dict) &&
+			strcmp(d_legacy, d_dict) == 0;
+
+	char *p_legacy = parse_compressed(c_legacy);
+	char *p_dict = parse_compressed(c_dict);
+	ok = ok && p_legacy && p_dict && strcmp(p_legacy, p_dict) == 0;
+
+	check(name, ok);
+
+	uint32_t text_len = (uint32_t)strlen(d_dict);
+	double s_legacy = decode_speed(c_legacy, d_legacy, dest_n, text_len);
+	double s_dict = decode_speed(c_dict, d_dict, dest_n, text_len);
+
+	printf("    %6u B -> legacy %5u B (%4.1f%%) %6.1f MB/s, dict %5u B (%4.1f%%) %6.1f MB/s\n",
+			(unsigned int)strlen(src),
+			size_legacy, 100.0 * size_legacy / strlen(src), s_legacy * 1e-6,
+			size_dict, 100.0 * size_dict / strlen(src), s_dict * 1e-6);
+
+	free(p_legacy);
+	free(p_dict);
+	free(d_legacy);
+	free(d_dict);
+	free(c_legacy);
+	free(c_dict);
+}
+
+static void test_errors(void) {
+	const char *src = "(define s \"a string\") (define l '(1 2 3))";
+	uint32_t size;
+	char *c = compress(src, &size, false);
+	char dest[256];
+
+	// Header claiming more bits than there are codes must not read past the end
+	uint32_t hdr;
+	memcpy(&hdr, c, 4);
+	bool ok = true;
+	for (uint32_t bits = 1;bits < 8;bits++) {
+		uint32_t h = (hdr & ~COMPRESSION_DICT_FLAG) - bits;
+		h |= COMPRESSION_DICT_FLAG;
+		memcpy(c, &h, 4);
+		compression_decompress(dest, sizeof(dest), c);
+		ok &= strlen(dest) < strlen(src);
+	}
+	check("truncated stream stops early", ok);
+
+	free(c);
+}
+
+// Prelude style code that is not part of the training set
+static char *make_script(void) {
+	char *src = malloc(64 * 1024);
+	int len = 0;
+	for (int i = 0;i < 40;i++) {
+		len += sprintf(src + len,
+				"; Filter %d\n(define filter-%d (lambda (x y) (+ (* %d.5 x) (* (- 1.0 %d.5) y))))\n"
+				"(define str-%d \"Channel %d \\\"ok\\\"\")\n",
+				i, i, i, i, i, i);
+	}
+	return src;
+}
+
+int main(void) {
+	const char *files[] = {
+			"../../lispBM/src/prelude.lisp",
+			"../../lispBM/tests/example_can_pos_follow.lisp",
+			"../../lispBM/tests/example_control_servo_from_duty.lisp",
+			"../../lispBM/tests/example_control_servo_from_encoder.lisp",
+			"../../lispBM/tests/example_duty.lisp",
+			"../../lispBM/tests/example_ppm_read.lisp",
+			"../../lispBM/tests/example_print_bms_data.lisp",
+			"../../lispBM/tests/test_math.lisp",
+	};
+
+	printf("Legacy and dictionary formats decode to the same program:\n");
+
+	for (unsigned int i = 0;i < sizeof(files) / sizeof(files[0]);i++) {
+		char *src = read_file(files[i]);
+		if (!src) {
+			check(files[i], false);
+			continue;
+		}
+		test_file(strrchr(files[i], '/') + 1, src);
+		free(src);
+	}
+
+	char *script = make_script();
+	test_file("untrained script", script);
+	free(script);
+
+	printf("\nErrors:\n");
+	test_errors();
+
+	return test_result();
+}
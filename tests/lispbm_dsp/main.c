@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "lispbm.h"
+#include "dsp_extensions.h"
+#include "../test_util.h"
+
+/*
+ * Math and DSP extensions. The filters and the PID controller are called
+ * directly and compared against reference implementations in double
+ * precision, and the speed of the extensions is compared to the same
+ * operations written in lisp.
+ *
+ * The lisp memory is mapped below 4 GB and the binary is not position
+ * independent, as the runtime stores addresses in 32 bit values.
+ */
+
+#define NUM_CELLS		8192
+#define MEM_SIZE		MEMORY_SIZE_16K
+#define BITMAP_SIZE		MEMORY_BITMAP_SIZE_16K
+#define SIGNAL_LEN		1000
+#define BLOCK_LEN		100
+
+static cons_t m_heap[NUM_CELLS] __attribute__((aligned(8)));
+static uint32_t *m_mem = NULL;
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool init_runtime(void) {
+	if (!m_mem) {
+		m_mem = mmap(NULL, (MEM_SIZE + BITMAP_SIZE) * 4, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	}
+
+	return lispbm_init(m_heap, NUM_CELLS, m_mem, MEM_SIZE, m_mem + MEM_SIZE, BITMAP_SIZE) == 1 &&
+			eval_cps_init_nc(256, false) &&
+			dsp_extensions_init();
+}
+
+static VALUE eval(const char *src) {
+	char *code = strdup(src);
+	VALUE r = eval_cps_program_nc(tokpar_parse(code));
+	free(code);
+	return r;
+}
+
+// Evaluates src and compares the printed result of the last expression
+static void eval_test(const char *src, const char *expected) {
+	char res[128];
+
+	init_runtime();
+	print_value(res, sizeof(res), eval(src));
+
+	check(src, strcmp(res, expected) == 0);
+	if (strcmp(res, expected) != 0) {
+		printf("    got %s, expected %s\n", res, expected);
+	}
+}
+
+static VALUE call(const char *name, VALUE *args, UINT argn) {
+	UINT sym;
+	if (!symrepr_lookup((char*)name, &sym)) {
+		return enc_sym(SYM_EERROR);
+	}
+	return extensions_lookup(sym)(args, argn);
+}
+
+static VALUE farray(const float *data, unsigned int len) {
+	VALUE res;
+	if (!heap_allocate_array(&res, len, PTR_TYPE_BOXED_F)) {
+		return enc_sym(SYM_MERROR);
+	}
+	if (data) {
+		memcpy((uint32_t*)car(res) + 2, data, len * sizeof(float));
+	} else {
+		memset((uint32_t*)car(res) + 2, 0, len * sizeof(float));
+	}
+	return res;
+}
+
+static float *fdata(VALUE arr) {
+	return (float*)((uint32_t*)car(arr) + 2);
+}
+
+static void make_signal(float *x, int len) {
+	srand(1234);
+	for (int i = 0;i < len;i++) {
+		x[i] = sinf((float)i * 0.05f) + 0.5f * sinf((float)i * 1.3f) +
+				0.1f * ((float)rand() / (float)RAND_MAX - 0.5f);
+	}
+}
+
+static double max_diff(const float *a, const double *b, int len) {
+	double res = 0.0;
+	for (int i = 0;i < len;i++) {
+		double d = fabs((double)a[i] - b[i]);
+		if (d > res) {
+			res = d;
+		}
+	}
+	return res;
+}
+
+static void test_biquad(void) {
+	init_runtime();
+
+	// Two stage low pass, direct form I in double precision as reference
+	const float c[10] = {
+			0.0675f, 0.1349f, 0.0675f, -1.1430f, 0.4128f,
+			0.2929f, 0.5858f, 0.2929f, 0.0f, 0.1716f
+	};
+
+	float x[SIGNAL_LEN];
+	double ref[SIGNAL_LEN];
+	make_signal(x, SIGNAL_LEN);
+
+	double stage_in[SIGNAL_LEN];
+	for (int i = 0;i < SIGNAL_LEN;i++) {
+		stage_in[i] = x[i];
+	}
+
+	for (int s = 0;s < 2;s++) {
+		const float *k = c + 5 * s;
+		double x1 = 0.0, x2 = 0.0, y1 = 0.0, y2 = 0.0;
+		for (int i = 0;i < SIGNAL_LEN;i++) {
+			double y = k[0] * stage_in[i] + k[1] * x1 + k[2] * x2 - k[3] * y1 - k[4] * y2;
+			x2 = x1; x1 = stage_in[i];
+			y2 = y1; y1 = y;
+			ref[i] = y;
+		}
+		memcpy(stage_in, ref, sizeof(ref));
+	}
+
+	// Filter in blocks, in place, carrying the state between them
+	VALUE coeffs = farray(c, 10);
+	VALUE state = farray(NULL, 4);
+	VALUE block = farray(NULL, BLOCK_LEN);
+	float out[SIGNAL_LEN];
+	bool ok = true;
+
+	for (int b = 0;b < SIGNAL_LEN / BLOCK_LEN;b++) {
+		memcpy(fdata(block), x + b * BLOCK_LEN, BLOCK_LEN * sizeof(float));
+		VALUE args[] = {coeffs, state, block};
+		ok &= call("dsp-biquad", args, 3) == enc_sym(SYM_TRUE);
+		memcpy(out + b * BLOCK_LEN, fdata(block), BLOCK_LEN * sizeof(float));
+	}
+
+	double diff = max_diff(out, ref, SIGNAL_LEN);
+	printf("    biquad max error: %.2e\n", diff);
+	check("biquad cascade in blocks matches reference", ok && diff < 1e-4);
+
+	VALUE bad_state = farray(NULL, 3);
+	VALUE args[] = {coeffs, bad_state, block};
+	check("biquad rejects state of wrong size", call("dsp-biquad", args, 3) == enc_sym(SYM_EERROR));
+}
+
+static void test_fir(void) {
+	init_runtime();
+
+	const int taps_len = 15;
+	float taps[15];
+	for (int i = 0;i < taps_len;i++) {
+		taps[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * (float)(i + 1) / (float)(taps_len + 1));
+	}
+
+	float x[SIGNAL_LEN];
+	double ref[SIGNAL_LEN];
+	make_signal(x, SIGNAL_LEN);
+	for (int i = 0;i < SIGNAL_LEN;i++) {
+		ref[i] = 0.0;
+		for (int j = 0;j < taps_len && j <= i;j++) {
+			ref[i] += (double)taps[j] * (double)x[i - j];
+		}
+	}
+
+	VALUE t = farray(taps, taps_len);
+	VALUE state = farray(NULL, taps_len);
+	VALUE in = farray(NULL, BLOCK_LEN);
+	VALUE block_out = farray(NULL, BLOCK_LEN);
+	float out[SIGNAL_LEN];
+	bool ok = true;
+
+	for (int b = 0;b < SIGNAL_LEN / BLOCK_LEN;b++) {
+		memcpy(fdata(in), x + b * BLOCK_LEN, BLOCK_LEN * sizeof(float));
+		VALUE args[] = {t, state, in, block_out};
+		ok &= call("dsp-fir", args, 4) == enc_sym(SYM_TRUE);
+		memcpy(out + b * BLOCK_LEN, fdata(block_out), BLOCK_LEN * sizeof(float));
+	}
+
+	double diff = max_diff(out, ref, SIGNAL_LEN);
+	printf("    fir max error: %.2e\n", diff);
+	check("fir in blocks matches reference", ok && diff < 1e-4);
+}
+
+static void test_pid(void) {
+	init_runtime();
+
+	// First order plant with a time constant of 0.1 s and a gain of 2
+	VALUE args[] = {enc_F(2.0f), enc_F(20.0f), enc_F(0.01f), enc_F(-1.0f), enc_F(1.0f)};
+	VALUE pid = call("pid-create", args, 5);
+	double y = 0.0;
+	const double dt = 0.001;
+	double out_min = 0.0, out_max = 0.0;
+	bool ok = true;
+
+	for (int i = 0;i < 2000;i++) {
+		double setpoint = i < 1000 ? 1.0 : 5.0;
+		VALUE u_args[] = {pid, enc_F((float)setpoint), enc_F((float)y), enc_F((float)dt)};
+		VALUE u = call("pid-update", u_args, 4);
+		ok &= type_of(u) == PTR_TYPE_BOXED_F;
+		double out = dec_as_f(u);
+		out_min = fmin(out_min, out);
+		out_max = fmax(out_max, out);
+		y += (2.0 * out - y) * dt / 0.1;
+
+		if (i == 999) {
+			check("pid settles on the setpoint", fabs(y - 1.0) < 1e-3);
+		}
+
+		// Collect the boxed floats now and then, as the evaluator would
+		if (i % 200 == 0) {
+			heap_perform_gc_aux(enc_sym(SYM_NIL), enc_sym(SYM_NIL), pid,
+					enc_sym(SYM_NIL), enc_sym(SYM_NIL), NULL, 0);
+		}
+	}
+
+	check("pid output stays within limits", ok && out_min >= -1.0 && out_max <= 1.0);
+
+	// The setpoint of 5 needs an output of 2.5, so the output saturates.
+	// Without anti windup the integrator would keep growing.
+	VALUE u_args[] = {pid, enc_F(1.0f), enc_F((float)y), enc_F((float)dt)};
+	int steps = 0;
+	while (dec_as_f(call("pid-update", u_args, 4)) >= 0.999f && steps < 1000) {
+		steps++;
+	}
+	check("pid leaves saturation at once when the setpoint drops", steps < 5);
+
+	VALUE r_args[] = {pid};
+	check("pid-reset", call("pid-reset", r_args, 1) == enc_sym(SYM_TRUE) &&
+			fdata(pid)[5] == 0.0f);
+}
+
+static double time_eval(const char *setup, const char *src, int runs) {
+	init_runtime();
+	eval(setup);
+
+	double t = now();
+	for (int i = 0;i < runs;i++) {
+		eval(src);
+	}
+	return (now() - t) / (double)runs;
+}
+
+static void test_speed(void) {
+	const char *setup =
+			"(define a (farray 256 1.5))"
+			"(define coeffs (farray-from-list (list 0.0675 0.1349 0.0675 (- 0 1.1430) 0.4128)))"
+			"(define state (farray 2))"
+			"(define sum (lambda (i acc) (if (= i 256) acc (sum (+ i 1) (+ acc (array-read a i))))))"
+			"(define lp (lambda (i z1 z2)"
+			"  (if (= i 256) (progn (array-write state 0 z1) (array-write state 1 z2))"
+			"    (let ((x (array-read a i))"
+			"          (y (+ (* 0.0675 x) z1)))"
+			"      (progn"
+			"        (array-write a i y)"
+			"        (lp (+ i 1) (- (+ (* 0.1349 x) z2) (* (- 0 1.1430) y)) (- (* 0.0675 x) (* 0.4128 y))))))))";
+
+	double t_sum_lisp = time_eval(setup, "(sum 0 0.0)", 20);
+	double t_sum_native = time_eval(setup, "(dsp-sum a)", 20);
+	double t_lp_lisp = time_eval(setup, "(lp 0 0.0 0.0)", 20);
+	double t_lp_native = time_eval(setup, "(dsp-biquad coeffs state a)", 20);
+
+	printf("    sum of 256 floats:    lisp %7.1f us, native %5.1f us (%.0fx)\n",
+			t_sum_lisp * 1e6, t_sum_native * 1e6, t_sum_lisp / t_sum_native);
+	printf("    biquad on 256 floats: lisp %7.1f us, native %5.1f us (%.0fx)\n",
+			t_lp_lisp * 1e6, t_lp_native * 1e6, t_lp_lisp / t_lp_native);
+	check("native sum at least 10x faster", t_sum_lisp > 10.0 * t_sum_native);
+	check("native biquad at least 10x faster", t_lp_lisp > 10.0 * t_lp_native);
+}
+
+int main(void) {
+	printf("Arrays:\n");
+	eval_test("(dsp-mean (farray-from-list '(1 2 3 4)))", "{2.500000}");
+	eval_test("(dsp-sum (farray 10 0.5))", "{5.000000}");
+	eval_test("(dsp-min (farray-from-list (list 3 (- 0 2) 7 1)))", "{-2.000000}");
+	eval_test("(dsp-max (farray-from-list (list 3 (- 0 2) 7 1)))", "{7.000000}");
+	eval_test("(dsp-dot (farray-from-list '(1 2 3)) (farray-from-list '(4 5 6)))", "{32.000000}");
+	eval_test("(define a (farray-from-list '(1 2))) (dsp-scale a 3 1) (farray-to-list a)",
+			"({4.000000} {7.000000})");
+	eval_test("(array-read (farray 3 2.5) 2)", "{2.500000}");
+	eval_test("(define xs (farray-from-list '(0 1 3))) (define ys (farray-from-list '(0 10 30)))"
+			" (dsp-interp xs ys 2.5)", "{25.000000}");
+	eval_test("(define xs (farray-from-list '(0 1 3))) (define ys (farray-from-list '(0 10 30)))"
+			" (dsp-interp xs ys 7)", "{30.000000}");
+	eval_test("(define xs (farray-from-list '(0 1 3))) (define ys (farray-from-list '(0 10 30)))"
+			" (define a (farray-from-list (list (- 0 1) 0.5 2)))"
+			" (dsp-interp xs ys a a) (farray-to-list a)", "({0.000000} {5.000000} {20.000000})");
+
+	printf("\nErrors:\n");
+	eval_test("(dsp-mean (farray 0))", "eval_error");
+	eval_test("(dsp-dot (farray 2) (farray 3))", "eval_error");
+	eval_test("(dsp-sum \"abc\")", "eval_error");
+	eval_test("(farray-from-list '(1 a))", "eval_error");
+	eval_test("(dsp-fir (farray 3) (farray 2) (farray 8))", "eval_error");
+	eval_test("(dsp-interp (farray 2) (farray 3) 1)", "eval_error");
+
+	printf("\nFilters:\n");
+	test_biquad();
+	test_fir();
+
+	printf("\nPID:\n");
+	test_pid();
+
+	printf("\nSpeed:\n");
+	test_speed();
+
+	return test_result();
+}
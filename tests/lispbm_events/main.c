@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "lispbm.h"
+#include "buffer_extensions.h"
+#include "lispif_events.h"
+#include "../test_util.h"
+
+/*
+ * Event delivery to LispBM mailboxes with the evaluator running in its
+ * own thread, like on the VESC. Events are posted from the main thread,
+ * and the script acknowledges them through the ack extension.
+ *
+ * Also compares how often the evaluator wakes up when a script waits for
+ * events in recv, against a script that polls with yield.
+ *
+ * The lisp memory is mapped below 4 GB and the binary is not position
+ * independent, as the runtime stores addresses in 32 bit values.
+ */
+
+#define NUM_CELLS		2048
+#define MEM_SIZE		MEMORY_SIZE_16K
+#define BITMAP_SIZE		MEMORY_BITMAP_SIZE_16K
+#define IDLE_SLEEP_US	10000
+
+static cons_t m_heap[NUM_CELLS] __attribute__((aligned(8)));
+static uint32_t *m_mem = NULL;
+static pthread_t m_eval_thread;
+static pthread_mutex_t m_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_wake_cond = PTHREAD_COND_INITIALIZER;
+static bool m_wake = false;
+static volatile int m_sleeps = 0;
+
+static volatile int m_acks = 0;
+static volatile int m_ack_a = 0;
+static volatile int m_ack_b = 0;
+static volatile double m_ack_time = 0.0;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint32_t timestamp_callback(void) {
+	return (uint32_t)(now() * 1e6);
+}
+
+// Same as sleep_callback in lispif.c, with a condition variable instead of a semaphore
+static void sleep_callback(uint32_t us) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += (long)us * 1000;
+	ts.tv_sec += ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+
+	pthread_mutex_lock(&m_wake_mutex);
+	while (!m_wake && pthread_cond_timedwait(&m_wake_cond, &m_wake_mutex, &ts) == 0) {
+	}
+	m_wake = false;
+	pthread_mutex_unlock(&m_wake_mutex);
+
+	m_sleeps++;
+}
+
+static void wake_eval(void) {
+	pthread_mutex_lock(&m_wake_mutex);
+	m_wake = true;
+	pthread_cond_signal(&m_wake_cond);
+	pthread_mutex_unlock(&m_wake_mutex);
+}
+
+static VALUE ext_ack(VALUE *args, UINT argn) {
+	if (argn != 2) {
+		return enc_sym(SYM_EERROR);
+	}
+	m_ack_a = dec_as_i(args[0]);
+	m_ack_b = dec_as_i(args[1]);
+	m_ack_time = now();
+	__sync_synchronize();
+	m_acks++;
+	return enc_sym(SYM_TRUE);
+}
+
+static void *eval_thread(void *arg) {
+	(void)arg;
+	eval_cps_run_eval();
+	return NULL;
+}
+
+static void start(const char *src) {
+	if (!m_mem) {
+		m_mem = mmap(NULL, (MEM_SIZE + BITMAP_SIZE) * 4, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	}
+
+	lispbm_init(m_heap, NUM_CELLS, m_mem, MEM_SIZE, m_mem + MEM_SIZE, BITMAP_SIZE);
+	lispif_events_init(wake_eval, NULL);
+	buffer_extensions_init();
+	lispif_events_load_extensions();
+	extensions_add("ack", ext_ack);
+
+	eval_cps_set_timestamp_us_callback(timestamp_callback);
+	eval_cps_set_usleep_callback(sleep_callback);
+	eval_cps_set_idle_sleep_us(IDLE_SLEEP_US);
+
+	char *code = strdup(src);
+	eval_cps_program(tokpar_parse(code));
+	free(code);
+
+	m_acks = 0;
+	eval_cps_continue_eval();
+	pthread_create(&m_eval_thread, NULL, eval_thread, NULL);
+}
+
+static void stop(void) {
+	eval_cps_kill_eval();
+	wake_eval();
+	pthread_join(m_eval_thread, NULL);
+}
+
+// Waits for the next acknowledgement and returns the latency in us, or -1
+static double wait_ack(int acks_before, double t_post) {
+	double t0 = now();
+	while (m_acks == acks_before) {
+		if (now() - t0 > 1.0) {
+			return -1.0;
+		}
+		struct timespec ts = {0, 20000};
+		nanosleep(&ts, NULL);
+	}
+	__sync_synchronize();
+	return (m_ack_time - t_post) * 1e6;
+}
+
+static void sleep_ms(int ms) {
+	struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+	nanosleep(&ts, NULL);
+}
+
+static const char *m_receiver =
+		"(define loop (lambda ()"
+		"  (progn"
+		"    (recv ((can-sid (? id) (? data)) (ack id (bufget-u16 data 0)))"
+		"          ((can-eid (? id) (? data)) (ack 5000 (buflen data)))"
+		"          ((adc-above (? ch) (? v)) (ack 2000 ch))"
+		"          ((adc-below (? ch) (? v)) (ack 3000 ch))"
+		"          ((fault (? f)) (ack 4000 f))"
+		"          ((timer (? t)) (ack 1000 t)))"
+		"    (loop))))"
+		"(event-can-sid 0x120 0x7F0)"
+		"(event-can-eid 0x10000 0x1FFF0000)"
+		"(event-adc 1 1.5 0.2)"
+		"(event-fault)"
+		"(loop)";
+
+static void test_delivery(void) {
+	start(m_receiver);
+	sleep_ms(20);
+
+	uint8_t data[8] = {0x12, 0x34, 0, 0, 0, 0, 0, 0};
+	double latency_max = 0.0;
+	bool ok = true;
+
+	// Matching frames are delivered with their data, others are not
+	for (int i = 0;i < 20;i++) {
+		int acks = m_acks;
+		double t = now();
+		lispif_events_can_frame(0x125, false, data, 8);
+		double l = wait_ack(acks, t);
+		ok &= l >= 0.0 && m_ack_a == 0x125 && m_ack_b == 0x1234;
+		if (l > latency_max) {
+			latency_max = l;
+		}
+	}
+	check("standard frames delivered", ok);
+
+	int acks = m_acks;
+	lispif_events_can_frame(0x220, false, data, 8);
+	lispif_events_can_frame(0x125, true, data, 8);
+	sleep_ms(20);
+	check("non-matching frames filtered", m_acks == acks);
+
+	double t = now();
+	lispif_events_can_frame(0x12345, true, data, 3);
+	check("extended frame delivered", wait_ack(acks, t) >= 0.0 && m_ack_a == 5000 && m_ack_b == 3);
+
+	// ADC crossings with hysteresis
+	acks = m_acks;
+	lispif_events_adc(1, 1.0);
+	lispif_events_adc(0, 3.0);
+	lispif_events_adc(1, 1.4);
+	sleep_ms(20);
+	ok = m_acks == acks;
+	t = now();
+	lispif_events_adc(1, 1.6);
+	ok &= wait_ack(acks, t) >= 0.0 && m_ack_a == 2000 && m_ack_b == 1;
+	acks = m_acks;
+	lispif_events_adc(1, 1.4);
+	sleep_ms(20);
+	ok &= m_acks == acks;
+	t = now();
+	lispif_events_adc(1, 1.2);
+	ok &= wait_ack(acks, t) >= 0.0 && m_ack_a == 3000;
+	check("adc threshold crossings", ok);
+
+	// Fault changes
+	acks = m_acks;
+	lispif_events_fault(0);
+	lispif_events_fault(0);
+	sleep_ms(20);
+	ok = m_acks == acks;
+	t = now();
+	lispif_events_fault(3);
+	ok &= wait_ack(acks, t) >= 0.0 && m_ack_a == 4000 && m_ack_b == 3;
+	check("fault changes", ok);
+
+	check("nothing dropped", lispif_events_dropped() == 0);
+
+	printf("    worst latency from posting to ack: %.0f us (idle sleep %d us)\n",
+			latency_max, IDLE_SLEEP_US);
+	check("latency below idle sleep", latency_max < IDLE_SLEEP_US);
+
+	stop();
+}
+
+static void test_timer(void) {
+	start("(event-timer 10)"
+			"(define loop (lambda () (progn (recv ((timer (? t)) (ack 1000 t))) (loop))))"
+			"(loop)");
+	sleep_ms(20);
+
+	uint32_t ms = 0;
+	for (int i = 0;i < 100;i++) {
+		lispif_events_tick(ms++);
+	}
+	sleep_ms(20);
+
+	// First tick starts the timer, so 9 periods have passed after 100 ms
+	check("timer fires once per period", m_acks == 9 && m_ack_a == 1000);
+	stop();
+}
+
+static void test_gone(void) {
+	// A context that subscribes and then finishes
+	start("(event-can-sid 0x300)");
+	sleep_ms(20);
+
+	uint8_t data[8] = {0};
+	lispif_events_can_frame(0x300, false, data, 8);
+	sleep_ms(20);
+	check("finished context unsubscribed", !lispif_events_wants(LISPIF_EVENT_CAN_SID));
+	stop();
+}
+
+static double wakeups_per_second(const char *src) {
+	start(src);
+	sleep_ms(50);
+	int sleeps = m_sleeps;
+	double t = now();
+	sleep_ms(500);
+	double res = (double)(m_sleeps - sleeps) / (now() - t);
+	stop();
+	return res;
+}
+
+int main(void) {
+	printf("Delivery:\n");
+	test_delivery();
+	test_timer();
+	test_gone();
+
+	printf("\nEvaluator wakeups while waiting:\n");
+	double w_recv = wakeups_per_second(m_receiver);
+	double w_poll = wakeups_per_second(
+			"(define loop (lambda () (progn (yield 10000) (loop)))) (loop)");
+	printf("    recv: %.0f/s, polling with (yield 10000): %.0f/s\n", w_recv, w_poll);
+	check("recv wakes up less than polling", w_recv * 4 < w_poll);
+
+	return test_result();
+}
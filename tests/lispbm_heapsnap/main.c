@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "lispbm.h"
+#include "buffer_extensions.h"
+#include "heap_snapshot.h"
+#include "heap_decode.h"
+#include "../test_util.h"
+
+/*
+ * Heap snapshots, as read in chunks over COMM_LISP_HEAP_SNAPSHOT, and
+ * the decoder of lbm_heapvis. Chunked reads must give the same bytes as
+ * one large read, and the decoded occupancy, memory use and retention
+ * must agree with the runtime.
+ *
+ * The lisp memory is mapped below 4 GB and the binary is not position
+ * independent, as the runtime stores addresses in 32 bit values.
+ */
+
+#define NUM_CELLS		2048
+#define MEM_SIZE		MEMORY_SIZE_4K
+#define BITMAP_SIZE		MEMORY_BITMAP_SIZE_4K
+#define CHUNK_SIZE		500
+
+static cons_t m_heap[NUM_CELLS] __attribute__((aligned(8)));
+static uint32_t *m_mem = NULL;
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void init_runtime(void) {
+	if (!m_mem) {
+		m_mem = mmap(NULL, (MEM_SIZE + BITMAP_SIZE) * 4, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	}
+
+	lispbm_init(m_heap, NUM_CELLS, m_mem, MEM_SIZE, m_mem + MEM_SIZE, BITMAP_SIZE);
+	eval_cps_init_nc(256, false);
+	buffer_extensions_init();
+}
+
+static void run(const char *src) {
+	char *code = strdup(src);
+	eval_cps_program_nc(tokpar_parse(code));
+	free(code);
+}
+
+// Reads the snapshot the way the COMM command does
+static uint8_t *read_chunked(uint32_t chunk, uint32_t *size) {
+	uint32_t total = heap_snapshot_begin();
+	uint8_t *data = malloc(total);
+	uint32_t offset = 0;
+
+	while (offset < total) {
+		uint32_t len = heap_snapshot_read(offset, data + offset, chunk);
+		if (len == 0) {
+			break;
+		}
+		offset += len;
+	}
+
+	*size = offset;
+	return data;
+}
+
+static uint32_t retained(heap_decode_t *h, const char *name, uint32_t *words) {
+	for (uint32_t i = 0; i < h->hdr.num_roots; i++) {
+		if (h->roots[i].kind != HEAP_SNAPSHOT_ROOT_GLOBAL) {
+			continue;
+		}
+		const char *n = heap_decode_sym_name(h, h->roots[i].id);
+		if (n && strcmp(n, name) == 0) {
+			return heap_decode_retained(h, h->roots[i].val, words);
+		}
+	}
+	return 0;
+}
+
+static const char *m_program =
+		"(define make (lambda (n acc) (if (= n 0) acc (make (- n 1) (cons n acc)))))"
+		"(define big (make 300 nil))"
+		"(define small (list 1 2 3))"
+		"(define buf (bufcreate 400))"
+		"(define holder (list 1 (list 2 (bufcreate 100))))";
+
+static void test_chunks(void) {
+	init_runtime();
+	run(m_program);
+
+	uint32_t total = heap_snapshot_begin();
+	uint8_t *one = malloc(total + 16);
+	check("one read gives the whole snapshot", heap_snapshot_read(0, one, total + 16) == total);
+	check("nothing to read past the end", heap_snapshot_read(total, one, 16) == 0);
+
+	const uint32_t chunks[] = {1, 7, 100, CHUNK_SIZE};
+	bool same = true;
+	for (unsigned int i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+		uint32_t size;
+		uint8_t *data = read_chunked(chunks[i], &size);
+		same &= size == total && memcmp(data, one, total) == 0;
+		free(data);
+	}
+	check("chunked reads give the same bytes", same);
+
+	const int reps = 20;
+	double t0 = now();
+	for (int i = 0; i < reps; i++) {
+		uint32_t size;
+		free(read_chunked(CHUNK_SIZE, &size));
+	}
+	double t = (now() - t0) / reps;
+
+	printf("    %u bytes for %u cells and %u words of memory, %u chunks read in %.0f us\n",
+			total, NUM_CELLS, MEM_SIZE, (total + CHUNK_SIZE - 1) / CHUNK_SIZE, t * 1e6);
+	free(one);
+}
+
+static void test_decode(void) {
+	init_runtime();
+	run(m_program);
+
+	// Garbage that is left until the next collection
+	run("(make 200 nil)");
+
+	uint32_t size;
+	uint8_t *data = read_chunked(CHUNK_SIZE, &size);
+	heap_decode_t h;
+	check("snapshot decodes", heap_decode_load(&h, data, size));
+
+	heap_decode_stats_t s;
+	heap_decode_stats(&h, &s);
+	uint32_t used = s.cells - s.free;
+
+	check("free cells match the heap", s.free == heap_num_free());
+	check("free words match the array memory", s.mem_free == memory_num_free());
+	check("both arrays found", s.kinds[CELL_ARRAY] == 2 && s.array_blocks == 2);
+	check("array words include headers", s.mem_arrays == (2 + 100) + (2 + 25));
+	check("symbol names in the other blocks", s.other_blocks > 0 && s.mem_other > 0);
+	check("unbound list is garbage", used - s.reachable >= 200);
+
+	uint32_t words = 0;
+	check("big retains its list", retained(&h, "big", &words) == 300 && words == 0);
+	check("small retains its list", retained(&h, "small", &words) == 3);
+	retained(&h, "holder", &words);
+	check("holder retains its array", words == 2 + 25);
+
+	char path[256] = "";
+	for (uint32_t i = 0; i < h.hdr.num_arrays; i++) {
+		if (h.arrays[i].size == 100) {
+			heap_decode_path(&h, h.arrays[i].cell, path, sizeof(path));
+		}
+	}
+	printf("    path to the small array: %s\n", path);
+	check("path to the small array", strcmp(path, "holder cdr car cdr car") == 0);
+
+	printf("    used %u, reachable %u, free %u, memory free %u in %u runs\n",
+			used, s.reachable, s.free, s.mem_free, s.free_runs);
+
+	heap_decode_free(&h);
+	free(data);
+
+	// After collecting, all that is left is reachable from the roots
+	eval_cps_gc(enc_sym(SYM_NIL));
+	data = read_chunked(CHUNK_SIZE, &size);
+	heap_decode_load(&h, data, size);
+	heap_decode_stats(&h, &s);
+	check("no garbage after gc", s.reachable == s.cells - s.free && s.free == heap_num_free());
+	heap_decode_free(&h);
+	free(data);
+}
+
+static void test_contexts(void) {
+	init_runtime();
+	run(m_program);
+
+	// A queued program that nothing but its context refers to
+	char *code = strdup("(define later (make 50 nil)) (+ 1 2 3 4 5 6 7 8 9)");
+	eval_cps_program(tokpar_parse(code));
+	free(code);
+	eval_cps_gc(enc_sym(SYM_NIL));
+
+	uint32_t size;
+	uint8_t *data = read_chunked(CHUNK_SIZE, &size);
+	heap_decode_t h;
+	heap_decode_load(&h, data, size);
+	heap_decode_stats_t s;
+	heap_decode_stats(&h, &s);
+
+	uint32_t ctx_cells = 0;
+	for (uint32_t i = 0; i < h.hdr.heap_cells; i++) {
+		if (h.root[i] >= 0 && h.roots[h.root[i]].kind == HEAP_SNAPSHOT_ROOT_CTX) {
+			ctx_cells++;
+		}
+	}
+
+	// 6 cells for the define, 10 for the sum and the rest of the program list
+	check("queued program held by its context", ctx_cells == 17);
+	check("no garbage with a queued context", s.reachable == s.cells - s.free);
+
+	heap_decode_free(&h);
+	free(data);
+}
+
+int main(void) {
+	printf("Reading:\n");
+	test_chunks();
+
+	printf("\nDecoding:\n");
+	test_decode();
+	test_contexts();
+
+	return test_result();
+}
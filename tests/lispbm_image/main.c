@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "image_writer.h"
+#include "heap_image.h"
+#include "heap.h"
+#include "symrepr.h"
+#include "tokpar.h"
+#include "print.h"
+#include "../test_util.h"
+
+/*
+ * Round trip of lisp programs through the heap image serializer. Each
+ * program is parsed, written to an image and loaded into a fresh runtime
+ * with the same heap size as the firmware, where some symbols have been
+ * registered before loading in the same way as the VESC extensions. The
+ * printed expressions must match those of the parsed program.
+ */
+
+#define PARSE_CELLS			65536
+#define TARGET_CELLS		1024
+#define BENCH_ITERATIONS	2000
+
+static char *read_file(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return NULL;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char *buf = malloc((size_t)size + 1);
+	size_t n = fread(buf, 1, (size_t)size, f);
+	buf[n] = 0;
+	fclose(f);
+	return buf;
+}
+
+static char *print_program(VALUE prg) {
+	size_t cap = 1 << 16;
+	size_t len = 0;
+	char *res = malloc(cap);
+	char buf[1024];
+
+	res[0] = 0;
+	while (type_of(prg) == PTR_TYPE_CONS) {
+		print_value(buf, sizeof(buf), car(prg));
+		size_t n = strlen(buf);
+		if (len + n + 2 > cap) {
+			cap *= 2;
+			res = realloc(res, cap);
+		}
+		memcpy(res + len, buf, n);
+		len += n;
+		res[len++] = '\n';
+		res[len] = 0;
+		prg = cdr(prg);
+	}
+
+	return res;
+}
+
+static void init_target(void) {
+	image_writer_init(TARGET_CELLS);
+
+	const char *ext[] = {"print", "get-duty", "set-duty", "can-cmd", "timeout-reset"};
+	for (unsigned int i = 0;i < sizeof(ext) / sizeof(ext[0]);i++) {
+		UINT id;
+		symrepr_addsym((char*)ext[i], &id);
+	}
+}
+
+static uint8_t *make_image(const char *src, unsigned int *size, char **printed) {
+	image_writer_init(PARSE_CELLS);
+
+	char *code = strdup(src);
+	VALUE prg = tokpar_parse(code);
+	free(code);
+
+	if (type_of(prg) == VAL_TYPE_SYMBOL && dec_sym(prg) != SYM_NIL) {
+		return NULL;
+	}
+
+	uint8_t *image = NULL;
+	if (!image_writer_write(prg, &image, size)) {
+		return NULL;
+	}
+
+	if (printed) {
+		*printed = print_program(prg);
+	}
+
+	return image;
+}
+
+static void round_trip(const char *name, const char *src) {
+	unsigned int size;
+	char *expected = NULL;
+	uint8_t *image = make_image(src, &size, &expected);
+
+	if (!image) {
+		check(name, false);
+		return;
+	}
+
+	init_target();
+	VALUE prg = heap_image_load(image, size);
+	char *loaded = print_program(prg);
+
+	bool ok = is_ptr(prg) && strcmp(expected, loaded) == 0 &&
+			heap_num_allocated() == ((heap_image_header_t*)image)->num_cells;
+
+	char label[128];
+	snprintf(label, sizeof(label), "%s (%u cells, %u B)", name,
+			((heap_image_header_t*)image)->num_cells, size);
+	check(label, ok);
+
+	if (!ok) {
+		printf("--- parsed ---\n%s--- loaded ---\n%s", expected, loaded);
+	}
+
+	free(expected);
+	free(loaded);
+	free(image);
+}
+
+static void test_errors(void) {
+	unsigned int size;
+	uint8_t *image = make_image("(define s \"abc\") (define l '(1 2 3))", &size, NULL);
+
+	// Any flipped bit must be rejected by the checksum or the header checks
+	bool ok = true;
+	for (unsigned int i = 0;i < size * 8;i += 7) {
+		image[i / 8] ^= (uint8_t)(1 << (i % 8));
+		init_target();
+		VALUE r = heap_image_load(image, size);
+		ok &= type_of(r) == VAL_TYPE_SYMBOL && dec_sym(r) == SYM_RERROR;
+		ok &= heap_num_allocated() == 0;
+		image[i / 8] ^= (uint8_t)(1 << (i % 8));
+	}
+	check("corrupt image rejected", ok);
+
+	init_target();
+	VALUE r = heap_image_load(image, size - 4);
+	check("truncated image rejected",
+			type_of(r) == VAL_TYPE_SYMBOL && dec_sym(r) == SYM_RERROR);
+
+	// Out of order free list, as after a garbage collection
+	init_target();
+	VALUE a = cons(enc_sym(SYM_NIL), enc_sym(SYM_NIL));
+	cons(enc_sym(SYM_NIL), enc_sym(SYM_NIL));
+	(void)a;
+	heap_perform_gc(enc_sym(SYM_NIL));
+	r = heap_image_load(image, size);
+	check("fragmented free list refused",
+			type_of(r) == VAL_TYPE_SYMBOL && dec_sym(r) == SYM_MERROR);
+
+	// Too large for the target heap
+	char *big = malloc(64 * 1024);
+	strcpy(big, "(define l '(");
+	for (int i = 0;i < 2000;i++) {
+		strcat(big, "1 ");
+	}
+	strcat(big, "))");
+	uint8_t *big_image = make_image(big, &size, NULL);
+	init_target();
+	r = heap_image_load(big_image, size);
+	check("image larger than heap refused",
+			type_of(r) == VAL_TYPE_SYMBOL && dec_sym(r) == SYM_MERROR &&
+			heap_num_allocated() == 0);
+	free(big_image);
+	free(big);
+
+	free(image);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void bench(const char *src) {
+	unsigned int size;
+	uint8_t *image = make_image(src, &size, NULL);
+	char *code = strdup(src);
+
+	// Runtime initialization is the same for both, so it is subtracted
+	double t0 = now();
+	for (int i = 0;i < BENCH_ITERATIONS;i++) {
+		init_target();
+		strcpy(code, src);
+	}
+	double t_init = (now() - t0) / BENCH_ITERATIONS;
+
+	t0 = now();
+	for (int i = 0;i < BENCH_ITERATIONS;i++) {
+		init_target();
+		strcpy(code, src);
+		tokpar_parse(code);
+	}
+	double t_parse = (now() - t0) / BENCH_ITERATIONS - t_init;
+
+	t0 = now();
+	for (int i = 0;i < BENCH_ITERATIONS;i++) {
+		init_target();
+		strcpy(code, src);
+		heap_image_load(image, size);
+	}
+	double t_load = (now() - t0) / BENCH_ITERATIONS - t_init;
+
+	printf("\nStartup of prelude + example_print_bms_data.lisp on the host:\n");
+	printf("  parse source: %8.1f us\n", t_parse * 1e6);
+	printf("  load image:   %8.1f us (%.1fx)\n", t_load * 1e6, t_parse / t_load);
+
+	free(code);
+	free(image);
+}
+
+int main(void) {
+	const char *files[] = {
+			"../../lispBM/src/prelude.lisp",
+			"../../lispBM/tests/example_can_pos_follow.lisp",
+			"../../lispBM/tests/example_control_servo_from_duty.lisp",
+			"../../lispBM/tests/example_control_servo_from_encoder.lisp",
+			"../../lispBM/tests/example_duty.lisp",
+			"../../lispBM/tests/example_ppm_read.lisp",
+			"../../lispBM/tests/example_print_bms_data.lisp",
+			"../../lispBM/tests/test_math.lisp",
+	};
+
+	printf("Round trip:\n");
+
+	round_trip("numbers",
+			"(define a 1) (define b -12) (define c 3.25) (define d 0xDEADBEEF)"
+			"(define e 70000u32) (define f -5i32) (define g 7u28)");
+	round_trip("strings and chars",
+			"(define s \"hello world\") (define t \"\") (define c \\#a) (print s \"x\" c)");
+	round_trip("quote and backquote",
+			"(define x '(a b . c)) (define y `(1 ,x ,@x 2)) (define z '(quote q))");
+	round_trip("shared and special symbols",
+			"(define set-duty 1) (let ((q 1) (lambda-x 2)) (if q lambda-x nil))");
+
+	for (unsigned int i = 0;i < sizeof(files) / sizeof(files[0]);i++) {
+		char *src = read_file(files[i]);
+		if (!src) {
+			check(files[i], false);
+			continue;
+		}
+		round_trip(strrchr(files[i], '/') + 1, src);
+		free(src);
+	}
+
+	printf("\nErrors:\n");
+	test_errors();
+
+	char *prelude = read_file("../../lispBM/src/prelude.lisp");
+	char *prg = read_file("../../lispBM/tests/example_print_bms_data.lisp");
+	if (prelude && prg) {
+		char *both = malloc(strlen(prelude) + strlen(prg) + 2);
+		sprintf(both, "%s\n%s", prelude, prg);
+		bench(both);
+		free(both);
+	}
+	free(prelude);
+	free(prg);
+
+	return test_result();
+}
@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "lispbm.h"
+#include "rt_eval.h"
+#include "../test_util.h"
+
+/*
+ * Real-time evaluator. Programs are compiled from lisp code parsed by the
+ * normal runtime, and then run without it. A PI speed controller for a
+ * simulated motor is compared against the same controller in C, and the
+ * time per run is compared against the main evaluator.
+ *
+ * The lisp memory is mapped below 4 GB and the binary is not position
+ * independent, as the runtime stores addresses in 32 bit values.
+ */
+
+#define NUM_CELLS		4096
+#define MEM_SIZE		MEMORY_SIZE_16K
+#define BITMAP_SIZE		MEMORY_BITMAP_SIZE_16K
+#define DT				0.001f
+
+static cons_t m_heap[NUM_CELLS] __attribute__((aligned(8)));
+static uint32_t *m_mem = NULL;
+static rt_program_t m_prog;
+static float m_rpm = 0.0f;
+static float m_current = 0.0f;
+static int m_post_id = 0;
+static float m_post_value = 0.0f;
+static int m_posts = 0;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool init_runtime(void) {
+	if (!m_mem) {
+		m_mem = mmap(NULL, (MEM_SIZE + BITMAP_SIZE) * 4, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	}
+
+	return lispbm_init(m_heap, NUM_CELLS, m_mem, MEM_SIZE, m_mem + MEM_SIZE, BITMAP_SIZE) == 1 &&
+			eval_cps_init_nc(256, false);
+}
+
+static float get_rpm(const float *args) {
+	(void)args;
+	return m_rpm;
+}
+
+static float set_current(const float *args) {
+	m_current = args[0];
+	return args[0];
+}
+
+static float add3(const float *args) {
+	return args[0] + args[1] + args[2];
+}
+
+static void post(int id, float value) {
+	m_post_id = id;
+	m_post_value = value;
+	m_posts++;
+}
+
+static rt_eval_res compile(const char *src) {
+	init_runtime();
+	char *code = strdup(src);
+	rt_eval_res res = rt_eval_compile(&m_prog, car(tokpar_parse(code)));
+	free(code);
+	return res;
+}
+
+static void set_var(const char *name, float value) {
+	UINT sym;
+	if (symrepr_lookup((char*)name, &sym)) {
+		int ind = rt_eval_var_index(&m_prog, sym);
+		if (ind >= 0) {
+			m_prog.vars[ind] = value;
+		}
+	}
+}
+
+// Compiles src, runs it the given number of times and compares the last result
+static void run_test(const char *src, int runs, float expected) {
+	bool ok = compile(src) == RT_EVAL_OK;
+	float res = 0.0f;
+	for (int i = 0;i < runs;i++) {
+		res = rt_eval_run(&m_prog, DT);
+	}
+
+	ok &= fabsf(res - expected) < 1e-4f;
+	check(src, ok);
+	if (!ok) {
+		printf("    got %f, expected %f\n", (double)res, (double)expected);
+	}
+}
+
+static void compile_error_test(const char *src, rt_eval_res expected) {
+	rt_eval_res res = compile(src);
+	check(src, res == expected);
+	if (res != expected) {
+		printf("    got %s, expected %s\n", rt_eval_error_str(res), rt_eval_error_str(expected));
+	}
+}
+
+static const char *m_pi_code =
+		"(progn"
+		"  (setq err (- target (get-rpm)))"
+		"  (setq integ (max (- lim) (min lim (+ integ (* ki err dt)))))"
+		"  (set-current (max (- lim) (min lim (+ (* kp err) integ)))))";
+
+static void pi_setup(void) {
+	compile(m_pi_code);
+	set_var("target", 3000.0f);
+	set_var("kp", 0.01f);
+	set_var("ki", 0.5f);
+	set_var("lim", 20.0f);
+	m_rpm = 0.0f;
+}
+
+static void motor_step(void) {
+	m_rpm += (m_current * 500.0f - m_rpm * 2.0f) * DT;
+}
+
+static void test_pi(void) {
+	pi_setup();
+
+	// The same controller in C
+	float rpm = 0.0f;
+	float integ = 0.0f;
+	float max_diff = 0.0f;
+	bool saturated = false;
+
+	// Clear the heap between compiling and running
+	init_runtime();
+
+	for (int i = 0;i < 5000;i++) {
+		rt_eval_run(&m_prog, DT);
+		motor_step();
+
+		float err = 3000.0f - rpm;
+		integ = fmaxf(-20.0f, fminf(20.0f, integ + 0.5f * err * DT));
+		float current = fmaxf(-20.0f, fminf(20.0f, 0.01f * err + integ));
+		rpm += (current * 500.0f - rpm * 2.0f) * DT;
+
+		max_diff = fmaxf(max_diff, fabsf(current - m_current));
+		saturated |= current >= 20.0f;
+	}
+
+	printf("    speed after 5 s: %.1f rpm, max difference from C: %g A\n",
+			(double)m_rpm, (double)max_diff);
+	check("pi controller matches the one in C", max_diff < 1e-4f && saturated);
+	check("pi controller reaches the setpoint", fabsf(m_rpm - 3000.0f) < 1.0f);
+}
+
+static void test_speed(void) {
+	const int runs = 100000;
+
+	pi_setup();
+	double t_start = now();
+	for (int i = 0;i < runs;i++) {
+		rt_eval_run(&m_prog, DT);
+		motor_step();
+	}
+	double t_rt = (now() - t_start) / (double)runs;
+
+	pi_setup();
+	double t_max = 0.0;
+	for (int i = 0;i < runs;i++) {
+		double t0 = now();
+		rt_eval_run(&m_prog, DT);
+		double t = now() - t0;
+		if (t > t_max) {
+			t_max = t;
+		}
+		motor_step();
+	}
+
+	// The same controller in the main evaluator, with a lisp loop around it
+	init_runtime();
+	char *code = strdup(
+			"(define target 3000.0) (define kp 0.01) (define ki 0.5) (define lim 20.0)"
+			"(define dt 0.001) (define integ 0.0) (define rpm 0.0)"
+			"(define clamp (lambda (x) (if (> x lim) lim (if (< x (- 0 lim)) (- 0 lim) x))))"
+			"(define step (lambda ()"
+			"  (let ((err (- target rpm)))"
+			"    (progn"
+			"      (define integ (clamp (+ integ (* ki err dt))))"
+			"      (clamp (+ (* kp err) integ))))))"
+			"(define loop (lambda (n) (if (= n 0) 0 (progn (step) (loop (- n 1))))))");
+	eval_cps_program_nc(tokpar_parse(code));
+	free(code);
+
+	code = strdup("(loop 2000)");
+	double t0 = now();
+	eval_cps_program_nc(tokpar_parse(code));
+	double t_lisp = (now() - t0) / 2000.0;
+	free(code);
+
+	printf("    per run: rt %.0f ns (max %.1f us), main evaluator %.0f ns\n",
+			t_rt * 1e9, t_max * 1e6, t_lisp * 1e9);
+	check("rt evaluator at least 10x faster than the main evaluator", t_lisp > 10.0 * t_rt);
+}
+
+int main(void) {
+	rt_eval_add_native("get-rpm", 0, get_rpm);
+	rt_eval_add_native("set-current", 1, set_current);
+	rt_eval_add_native("add3", 3, add3);
+	rt_eval_set_post_callback(post);
+
+	printf("Evaluation:\n");
+	run_test("(+ 1 2 3.5)", 1, 6.5f);
+	run_test("(- 10 2 3)", 1, 5.0f);
+	run_test("(- 4)", 1, -4.0f);
+	run_test("(* 2 3 4)", 1, 24.0f);
+	run_test("(/ 7 2)", 1, 3.5f);
+	run_test("(/ 7 0)", 1, 0.0f);
+	run_test("(if (< 1 2) 10 20)", 1, 10.0f);
+	run_test("(if (>= 1 2) 10)", 1, 0.0f);
+	run_test("(and 1 0 (/ 1 0))", 1, 0.0f);
+	run_test("(or nil 0 3)", 1, 3.0f);
+	run_test("(not t)", 1, 0.0f);
+	run_test("(min 4 (- 2) 7)", 1, -2.0f);
+	run_test("(max (abs (- 9)) 4)", 1, 9.0f);
+	run_test("(add3 1 2 3)", 1, 6.0f);
+	run_test("(setq x (+ x 1))", 10, 10.0f);
+	run_test("(setq t-sum (+ t-sum dt))", 500, 0.5f);
+	run_test("(progn (setq a 2) (setq b (* a 3)) (+ a b))", 1, 8.0f);
+
+	m_posts = 0;
+	run_test("(post 7 (* 2 21))", 3, 42.0f);
+	check("post calls back with id and value", m_posts == 3 && m_post_id == 7 && m_post_value == 42.0f);
+
+	printf("\nCompile errors:\n");
+	compile_error_test("(lambda (x) x)", RT_EVAL_ERR_FORM);
+	compile_error_test("(define x 1)", RT_EVAL_ERR_FORM);
+	compile_error_test("(cons 1 2)", RT_EVAL_ERR_FORM);
+	compile_error_test("(no-such-function 1)", RT_EVAL_ERR_FORM);
+	compile_error_test("\"string\"", RT_EVAL_ERR_FORM);
+	compile_error_test("(if 1)", RT_EVAL_ERR_ARGS);
+	compile_error_test("(add3 1 2)", RT_EVAL_ERR_ARGS);
+	compile_error_test("(setq 1 2)", RT_EVAL_ERR_ARGS);
+	compile_error_test("(setq t 2)", RT_EVAL_ERR_FORM);
+	compile_error_test("(+ a b c d e f g h i j k l m n o p)", RT_EVAL_ERR_VARS);
+	compile_error_test("(- (- (- (- (- (- (- (- (- (- (- (- (- (- (- (- 1))))))))))))))))",
+			RT_EVAL_ERR_DEPTH);
+
+	char big[4096] = "(progn";
+	for (int i = 0;i < 2;i++) {
+		strcat(big, " (+");
+		for (int j = 0;j < 150;j++) {
+			strcat(big, " 1");
+		}
+		strcat(big, ")");
+	}
+	strcat(big, ")");
+	check("program with too many nodes", compile(big) == RT_EVAL_ERR_NODES);
+
+	UINT sym;
+	compile("(no-such-function 1)");
+	check("error symbol is reported", symrepr_lookup("no-such-function", &sym) &&
+			m_prog.err_sym == sym);
+
+	printf("\nControl:\n");
+	test_pi();
+
+	printf("\nSpeed:\n");
+	test_speed();
+
+	return test_result();
+}
@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lispbm.h"
+#include "compression.h"
+#include "../test_util.h"
+
+/*
+ * Streaming read-eval of compressed code, the way lispif loads it from
+ * flash: one top level form is decompressed, parsed and evaluated at a
+ * time with a garbage collection in between. This is compared against
+ * parsing the whole program first by searching for the smallest heap
+ * that each method can run a program in.
+ *
+ * The lisp memory is mapped below 4 GB and the binary is not position
+ * independent, as the runtime stores addresses in 32 bit values.
+ */
+
+#define MAX_CELLS		16384
+#define MEM_SIZE		MEMORY_SIZE_16K
+#define BITMAP_SIZE		MEMORY_BITMAP_SIZE_16K
+
+static cons_t m_heap[MAX_CELLS] __attribute__((aligned(8)));
+static uint32_t *m_mem = NULL;
+static bool init_runtime(unsigned int cells) {
+	if (!m_mem) {
+		m_mem = mmap(NULL, (MEM_SIZE + BITMAP_SIZE) * 4, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	}
+
+	return lispbm_init(m_heap, cells, m_mem, MEM_SIZE, m_mem + MEM_SIZE, BITMAP_SIZE) == 1 &&
+			eval_cps_init_nc(256, false);
+}
+
+static bool is_error(VALUE v) {
+	return type_of(v) == VAL_TYPE_SYMBOL && symrepr_is_error(dec_sym(v));
+}
+
+static char *read_file(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return NULL;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char *buf = malloc((size_t)size + 1);
+	size_t n = fread(buf, 1, (size_t)size, f);
+	buf[n] = 0;
+	fclose(f);
+	return buf;
+}
+
+static char *compress(const char *src, uint32_t *size) {
+	char *tmp = strdup(src);
+	char *res = compression_compress(tmp, size);
+	free(tmp);
+	return res;
+}
+
+// Parse everything, then evaluate
+static bool run_full(const char *src, unsigned int cells, VALUE *res) {
+	if (!init_runtime(cells)) {
+		return false;
+	}
+
+	char *code = strdup(src);
+	VALUE prg = tokpar_parse(code);
+	free(code);
+
+	if (is_error(prg) || heap_num_free() == 0) {
+		return false;
+	}
+
+	*res = eval_cps_program_nc(prg);
+	return !is_error(*res);
+}
+
+// Same steps as load_thread in lispif.c
+static bool run_stream(char *compressed, unsigned int cells, VALUE *res) {
+	if (!init_runtime(cells)) {
+		return false;
+	}
+
+	tokenizer_compressed_state ts;
+	tokenizer_char_stream str;
+	compression_create_char_stream(&ts, &str, compressed);
+
+	for (;;) {
+		eval_cps_gc(enc_sym(SYM_NIL));
+
+		VALUE form;
+		if (!tokpar_parse_next(str, &form)) {
+			return true;
+		}
+
+		if (is_error(form) || heap_num_free() == 0) {
+			return false;
+		}
+
+		*res = eval_cps_program_nc(cons(form, enc_sym(SYM_NIL)));
+		if (is_error(*res)) {
+			return false;
+		}
+	}
+}
+
+static unsigned int min_cells(const char *src, char *compressed, bool stream, INT expected) {
+	unsigned int lo = 16, hi = MAX_CELLS;
+	VALUE r;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		bool ok = stream ? run_stream(compressed, mid, &r) : run_full(src, mid, &r);
+		if (ok && dec_as_i(r) == expected) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return lo;
+}
+
+static bool same_forms(const char *src) {
+	uint32_t size;
+	char *compressed = compress(src, &size);
+	if (!compressed) {
+		return false;
+	}
+
+	init_runtime(MAX_CELLS);
+	char *code = strdup(src);
+	VALUE prg = tokpar_parse(code);
+	free(code);
+
+	tokenizer_compressed_state ts;
+	tokenizer_char_stream str;
+	compression_create_char_stream(&ts, &str, compressed);
+
+	bool ok = !is_error(prg);
+	char a[1024], b[1024];
+	VALUE form;
+
+	while (ok && tokpar_parse_next(str, &form)) {
+		print_value(a, sizeof(a), car(prg));
+		print_value(b, sizeof(b), form);
+		ok = type_of(prg) == PTR_TYPE_CONS && strcmp(a, b) == 0;
+		prg = cdr(prg);
+	}
+
+	free(compressed);
+	return ok && prg == enc_sym(SYM_NIL);
+}
+
+// Prelude followed by a long script of top level statements, the
+// typical shape of a configuration or test script.
+static char *make_script(int statements, INT *expected) {
+	char *prelude = read_file("../../lispBM/src/prelude.lisp");
+	size_t cap = strlen(prelude) + (size_t)statements * 256 + 1024;
+	char *src = malloc(cap);
+	int len = sprintf(src, "%s\n(define acc 0)\n", prelude);
+	free(prelude);
+
+	*expected = 0;
+	for (int i = 0;i < statements;i++) {
+		len += sprintf(src + len, "; Statement %d\n(define acc (+ acc (foldl + 0 (list", i);
+		for (int j = 0;j < 16;j++) {
+			len += sprintf(src + len, " %d", i + j);
+			*expected += i + j;
+		}
+		len += sprintf(src + len, "))))\n");
+	}
+	len += sprintf(src + len, "acc\n");
+
+	return src;
+}
+
+int main(void) {
+	const char *files[] = {
+			"../../lispBM/src/prelude.lisp",
+			"../../lispBM/tests/example_can_pos_follow.lisp",
+			"../../lispBM/tests/example_control_servo_from_duty.lisp",
+			"../../lispBM/tests/example_duty.lisp",
+			"../../lispBM/tests/example_print_bms_data.lisp",
+			"../../lispBM/tests/test_math.lisp",
+	};
+
+	printf("Compressed forms equal to parsed source:\n");
+	for (unsigned int i = 0;i < sizeof(files) / sizeof(files[0]);i++) {
+		char *src = read_file(files[i]);
+		check(strrchr(files[i], '/') + 1, src && same_forms(src));
+		free(src);
+	}
+
+	printf("\nRead-eval:\n");
+	INT expected;
+	char *src = make_script(20, &expected);
+	uint32_t size;
+	char *compressed = compress(src, &size);
+	VALUE r = enc_sym(SYM_NIL);
+
+	check("full parse result", run_full(src, MAX_CELLS, &r) && dec_as_i(r) == expected);
+	check("streaming result", run_stream(compressed, MAX_CELLS, &r) && dec_as_i(r) == expected);
+
+	// A broken form stops the load
+	char *bad = strdup(src);
+	strcpy(strstr(bad, "; Statement 10"), "(define acc (+ acc 1)\n");
+	char *bad_compressed = compress(bad, &size);
+	check("unbalanced form rejected", !run_stream(bad_compressed, MAX_CELLS, &r));
+	free(bad_compressed);
+	free(bad);
+
+	free(compressed);
+	free(src);
+
+	printf("\nSmallest heap that runs the script, in cells:\n");
+	printf("  %10s %10s %10s %10s\n", "statements", "bytes", "full", "streaming");
+
+	unsigned int last_stream = 0;
+	bool stream_flat = true;
+	int counts[] = {10, 40, 160};
+	for (unsigned int i = 0;i < sizeof(counts) / sizeof(counts[0]);i++) {
+		src = make_script(counts[i], &expected);
+		compressed = compress(src, &size);
+
+		unsigned int full = min_cells(src, compressed, false, expected);
+		unsigned int stream = min_cells(src, compressed, true, expected);
+		printf("  %10d %10u %10u %10u\n", counts[i], size, full, stream);
+
+		if (last_stream && stream != last_stream) {
+			stream_flat = false;
+		}
+		last_stream = stream;
+
+		free(compressed);
+		free(src);
+	}
+	check("streaming heap independent of length", stream_flat);
+
+	return test_result();
+}
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rf_transport.h"
+#include "../test_util.h"
+
+/*
+ * Two transports connected by a simulated radio that loses packets. Every
+ * radio packet takes PKT_TIME_US of air time, including the automatic ack
+ * of the NRF, and the transports run once per millisecond in between.
+ *
+ * The old scheme in nrf_driver_send_buffer is modeled for comparison: all
+ * chunks and the CRC frame are sent, and if one of them is lost the
+ * application sends the whole request again after LEGACY_RETRY_MS.
+ */
+
+#define PKT_TIME_US			400
+#define LEGACY_RETRY_MS		50
+#define MSG_LEN				512
+#define MSG_NUM				200
+#define LINK_SIZE			256
+
+#define DATA_ID				8
+#define ACK_ID				9
+
+typedef struct {
+	uint8_t data[RF_TRANSPORT_RADIO_PL_LEN];
+	unsigned int len;
+} radio_pkt_t;
+
+static RF_TRANSPORT_STATE_t m_side[2];
+static radio_pkt_t m_link[2][LINK_SIZE];
+static int m_link_num[2];
+static int m_from = 0;
+static double m_loss = 0.0;
+static unsigned long m_time_us = 0;
+static int m_corrupt = -1;
+static int radio_send(unsigned char *data, unsigned int len) {
+	int to = 1 - m_from;
+	m_time_us += PKT_TIME_US;
+
+	if ((double)rand() / RAND_MAX < m_loss) {
+		return -1;
+	}
+
+	if (m_link_num[to] < LINK_SIZE && len <= RF_TRANSPORT_RADIO_PL_LEN) {
+		radio_pkt_t *p = &m_link[to][m_link_num[to]++];
+		memcpy(p->data, data, len);
+		p->len = len;
+	}
+
+	return 0;
+}
+
+static void fill_msg(uint8_t *msg, unsigned int len, int num) {
+	for (unsigned int i = 0;i < len;i++) {
+		msg[i] = (uint8_t)(i * 7 + num * 13);
+	}
+}
+
+static void sim_init(double loss, unsigned int seed) {
+	m_loss = loss;
+	m_time_us = 0;
+	m_link_num[0] = 0;
+	m_link_num[1] = 0;
+	m_corrupt = -1;
+	srand(seed);
+
+	rf_transport_init(radio_send, DATA_ID, ACK_ID, &m_side[0]);
+	rf_transport_init(radio_send, DATA_ID, ACK_ID, &m_side[1]);
+}
+
+/*
+ * Delivers what is on the air and runs both transports. Returns the
+ * length of a message completed on side 1.
+ */
+static int sim_step(void) {
+	int res = 0;
+
+	for (int side = 0;side < 2;side++) {
+		radio_pkt_t pkts[LINK_SIZE];
+		int num = m_link_num[side];
+		memcpy(pkts, m_link[side], num * sizeof(radio_pkt_t));
+		m_link_num[side] = 0;
+
+		m_from = side;
+		for (int i = 0;i < num;i++) {
+			if (side == 1 && m_corrupt >= 0 && pkts[i].data[0] == DATA_ID &&
+					(pkts[i].data[1] & 0x1F) == m_corrupt) {
+				pkts[i].data[5] ^= 0x55;
+				m_corrupt = -1;
+			}
+
+			int len = rf_transport_process_packet(pkts[i].data, pkts[i].len, &m_side[side]);
+			if (side == 1 && len > 0) {
+				res = len;
+			}
+		}
+	}
+
+	unsigned long t0 = m_time_us;
+	for (int side = 0;side < 2;side++) {
+		m_from = side;
+		rf_transport_timer(1, &m_side[side]);
+	}
+
+	// The transports run every millisecond, or after the radio is done
+	m_time_us = t0 + 1000 > m_time_us ? t0 + 1000 : m_time_us;
+
+	return res;
+}
+
+typedef struct {
+	int received;
+	int corrupt;
+	double goodput;
+} run_result_t;
+
+static run_result_t run_messages(double loss, int num, unsigned int seed) {
+	run_result_t r = {0, 0, 0.0};
+	uint8_t msg[MSG_LEN];
+	int next = 0;
+
+	sim_init(loss, seed);
+
+	while (r.received + (int)m_side[0].stats.msgs_failed < num) {
+		if (next < num && m_side[0].tx_queue_num < RF_TRANSPORT_TX_QUEUE) {
+			fill_msg(msg, MSG_LEN, next++);
+			rf_transport_send(msg, MSG_LEN, &m_side[0]);
+		}
+
+		if (sim_step() > 0) {
+			uint8_t expected[MSG_LEN];
+			fill_msg(expected, MSG_LEN, r.received + m_side[0].stats.msgs_failed);
+			if (m_side[1].rx_msg.len != MSG_LEN + 2 ||
+					memcmp(m_side[1].rx_msg.data, expected, MSG_LEN) != 0) {
+				r.corrupt++;
+			}
+			r.received++;
+		}
+
+		if (m_time_us > 600e6) {
+			break;
+		}
+	}
+
+	// Let the last acks through
+	for (int i = 0;i < 50;i++) {
+		sim_step();
+	}
+
+	r.goodput = (double)r.received * MSG_LEN / ((double)m_time_us * 1e-6);
+	return r;
+}
+
+// Radio packets that nrf_driver_send_buffer uses for a message
+static int legacy_packets(unsigned int len) {
+	const unsigned int pl = RF_TRANSPORT_RADIO_PL_LEN;
+	unsigned int len2 = len - (pl - 5);
+	unsigned int end_a = 0;
+	int pkts = 0;
+
+	for (unsigned int i = 0;i < len2 && i <= 255;i += (pl - 2)) {
+		end_a = i + (pl - 2);
+		pkts++;
+	}
+
+	for (unsigned int i = end_a;i < len2;i += (pl - 3)) {
+		pkts++;
+	}
+
+	return pkts + 1;
+}
+
+static double run_legacy(double loss, int num, unsigned int seed) {
+	int pkts = legacy_packets(MSG_LEN);
+	double time_us = 0;
+	srand(seed);
+
+	for (int m = 0;m < num;m++) {
+		for (int attempt = 0;attempt < 100;attempt++) {
+			bool lost = false;
+			for (int i = 0;i < pkts;i++) {
+				time_us += PKT_TIME_US;
+				if ((double)rand() / RAND_MAX < loss) {
+					lost = true;
+				}
+			}
+
+			if (!lost) {
+				break;
+			}
+
+			time_us += LEGACY_RETRY_MS * 1000;
+		}
+	}
+
+	return (double)num * MSG_LEN / (time_us * 1e-6);
+}
+
+static void test_delivery(void) {
+	run_result_t r = run_messages(0.0, 20, 1);
+	check("all messages delivered without loss", r.received == 20 && r.corrupt == 0);
+	check("no chunks resent without loss", m_side[0].stats.chunks_resent == 0);
+	check("one ack per message without loss", m_side[1].stats.acks_sent == 20);
+
+	r = run_messages(0.2, 50, 2);
+	check("all messages delivered at 20 % loss", r.received == 50 && r.corrupt == 0);
+	check("no message failed", m_side[0].stats.msgs_failed == 0);
+	check("messages not delivered twice", m_side[1].stats.msgs_received == 50);
+
+	// Short messages are a single chunk
+	uint8_t msg[10];
+	fill_msg(msg, sizeof(msg), 3);
+	sim_init(0.0, 3);
+	rf_transport_send(msg, sizeof(msg), &m_side[0]);
+	int len = 0;
+	for (int i = 0;i < 5 && len == 0;i++) {
+		len = sim_step();
+	}
+	check("short message in one chunk", len == 10 && m_side[0].stats.chunks_sent == 1 &&
+			memcmp(m_side[1].rx_msg.data, msg, sizeof(msg)) == 0);
+
+	// A chunk that passes the radio CRC with wrong data
+	uint8_t big[MSG_LEN];
+	fill_msg(big, MSG_LEN, 0);
+	sim_init(0.0, 4);
+	m_corrupt = 4;
+	rf_transport_send(big, MSG_LEN, &m_side[0]);
+	int received = 0;
+	for (int i = 0;i < 200;i++) {
+		if (sim_step() > 0) {
+			received++;
+		}
+	}
+	check("bad message CRC makes the sender start over", m_side[1].stats.crc_errors == 1 &&
+			received == 1 && memcmp(m_side[1].rx_msg.data, big, MSG_LEN) == 0);
+
+	// Nobody listening
+	sim_init(1.0, 5);
+	rf_transport_send(big, MSG_LEN, &m_side[0]);
+	rf_transport_send(big, MSG_LEN, &m_side[0]);
+	check("queue full", !rf_transport_send(big, MSG_LEN, &m_side[0]));
+	for (int i = 0;i < 1000;i++) {
+		sim_step();
+	}
+	check("sender gives up", m_side[0].stats.msgs_failed == 2 && !rf_transport_busy(&m_side[0]));
+}
+
+static void test_goodput(void) {
+	const double losses[] = {0.0, 0.05, 0.1, 0.2, 0.3};
+
+	printf("    loss   windowed      resent   legacy\n");
+	for (unsigned int i = 0;i < sizeof(losses) / sizeof(losses[0]);i++) {
+		run_result_t r = run_messages(losses[i], MSG_NUM, 10 + i);
+		double legacy = run_legacy(losses[i], MSG_NUM, 10 + i);
+
+		printf("    %3.0f %%  %5.1f kB/s  %5.1f %%  %5.1f kB/s\n",
+				losses[i] * 100.0, r.goodput / 1e3,
+				100.0 * m_side[0].stats.chunks_resent / m_side[0].stats.chunks_sent,
+				legacy / 1e3);
+
+		if (losses[i] <= 0.2) {
+			check("all delivered", r.received == MSG_NUM && r.corrupt == 0);
+		}
+	}
+}
+
+int main(void) {
+	printf("Delivery:\n");
+	test_delivery();
+
+	printf("\nGoodput, %d messages of %d bytes, %d us per radio packet:\n",
+			MSG_NUM, MSG_LEN, PKT_TIME_US);
+	test_goodput();
+
+	return test_result();
+}
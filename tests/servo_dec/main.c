@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "servo_filter.h"
+#include "rc_serial.h"
+#include "../test_util.h"
+
+/*
+ * Filtering of servo pulses with timestamps, and decoding of SBUS and CRSF
+ * frames.
+ */
+
+#define TICK_FREQ		1e6
+
+static void pack_channels(const uint16_t *ch, uint8_t *data) {
+	memset(data, 0, 22);
+	for (int i = 0;i < RC_SERIAL_CHANNELS;i++) {
+		for (int bit = 0;bit < 11;bit++) {
+			if (ch[i] & (1 << bit)) {
+				int pos = i * 11 + bit;
+				data[pos / 8] |= 1 << (pos % 8);
+			}
+		}
+	}
+}
+
+static int make_sbus(const uint16_t *ch, uint8_t flags, uint8_t end, uint8_t *frame) {
+	frame[0] = 0x0F;
+	pack_channels(ch, frame + 1);
+	frame[23] = flags;
+	frame[24] = end;
+	return 25;
+}
+
+static int make_crsf(uint8_t type, const uint8_t *payload, int len, uint8_t *frame) {
+	frame[0] = 0xC8;
+	frame[1] = len + 2;
+	frame[2] = type;
+	memcpy(frame + 3, payload, len);
+	frame[len + 3] = rc_serial_crc8(frame + 2, len + 1);
+	return len + 4;
+}
+
+static int feed(rc_serial_state *s, const uint8_t *data, int len) {
+	int frames = 0;
+	for (int i = 0;i < len;i++) {
+		if (rc_serial_process_byte(s, data[i])) {
+			frames++;
+		}
+	}
+	return frames;
+}
+
+static void test_filter(void) {
+	servo_filter f;
+	float out = 0.0;
+	uint32_t time = 0;
+
+	servo_filter_init(&f, TICK_FREQ, 1);
+	servo_filter_add(&f, 0.5, time, &out);
+	time += 20000;
+	servo_filter_add(&f, 0.9, time, &out);
+	check("No median passes every pulse", out == 0.9);
+
+	servo_filter_init(&f, TICK_FREQ, 3);
+	f.jitter_band = 0.002;
+	bool ok = true;
+	for (int i = 0;i < 10;i++) {
+		time += 20000;
+		servo_filter_add(&f, 0.5, time, &out);
+	}
+
+	time += 20000;
+	servo_filter_add(&f, 0.95, time, &out);
+	ok = out == 0.5;
+	time += 20000;
+	servo_filter_add(&f, 0.5, time, &out);
+	check("Single bad pulse removed", ok && out == 0.5);
+	check("Outlier counted", f.outlier_cnt == 1);
+	time += 20000;
+	servo_filter_add(&f, 0.5, time, &out);
+
+	time += 20000;
+	servo_filter_add(&f, 0.8, time, &out);
+	ok = out == 0.5;
+	time += 20000;
+	servo_filter_add(&f, 0.8, time, &out);
+	check("Step passes after one pulse", ok && out == 0.8);
+	check("Period from timestamps", fabsf(f.period - 0.02) < 1e-6);
+
+	// An extra edge 1 ms after a pulse
+	uint32_t rej = f.reject_cnt;
+	bool accepted = servo_filter_add(&f, 0.1, time + 1000, &out);
+	check("Glitch dropped", !accepted && f.reject_cnt == rej + 1 && out == 0.8);
+	time += 20000;
+	servo_filter_add(&f, 0.8, time, &out);
+	check("Period kept after glitch", fabsf(f.period - 0.02) < 1e-6);
+
+	time += 20000;
+	servo_filter_add(&f, 0.801, time, &out);
+	check("Jitter held", out == 0.8);
+	time += 20000;
+	servo_filter_add(&f, 0.801, time, &out);
+	time += 20000;
+	servo_filter_add(&f, 0.805, time, &out);
+	time += 20000;
+	servo_filter_add(&f, 0.805, time, &out);
+	check("Larger change passes", fabsf(out - 0.805) < 1e-6);
+
+	// Signal gone for a while, the old pulses should not be in the median
+	time += 500000;
+	servo_filter_add(&f, 0.2, time, &out);
+	check("History dropped after dropout", out == 0.2);
+
+	// The timestamps wrap around
+	servo_filter_init(&f, TICK_FREQ, 3);
+	time = 0xFFFFFFFF - 5000;
+	servo_filter_add(&f, 0.5, time, &out);
+	time += 20000;
+	accepted = servo_filter_add(&f, 0.5, time, &out);
+	check("Timer wrap", accepted && fabsf(f.period - 0.02) < 1e-6);
+
+	// 400 Hz receiver with 20 us of jitter on the timestamps
+	servo_filter_init(&f, TICK_FREQ, 3);
+	time = 0;
+	unsigned int accepted_cnt = 0;
+	for (int i = 0;i < 400;i++) {
+		time += 2500 + (i % 2 ? 20 : -20);
+		accepted_cnt += servo_filter_add(&f, 0.5, time, &out);
+	}
+	check("Fast receiver keeps every pulse", accepted_cnt == 400 && f.reject_cnt == 0);
+	check("Jitter band off by default", f.jitter_band == 0.0);
+
+	accepted = servo_filter_add(&f, 0.1, time + 300, &out);
+	time += 2500;
+	servo_filter_add(&f, 0.5, time, &out);
+	check("Glitch dropped at 400 Hz", !accepted && f.reject_cnt == 1 && fabsf(f.period - 0.0025) < 1e-4);
+
+	// The receiver switches from 50 Hz to 400 Hz
+	servo_filter_init(&f, TICK_FREQ, 3);
+	time = 0;
+	for (int i = 0;i < 10;i++) {
+		time += 20000;
+		servo_filter_add(&f, 0.5, time, &out);
+	}
+
+	accepted_cnt = 0;
+	for (int i = 0;i < 20;i++) {
+		time += 2500;
+		accepted_cnt += servo_filter_add(&f, 0.5, time, &out);
+	}
+	check("Frame rate change learned", accepted_cnt == 16 && fabsf(f.period - 0.0025) < 1e-6);
+}
+
+static void test_sbus(void) {
+	rc_serial_state s;
+	uint16_t ch[RC_SERIAL_CHANNELS];
+	uint8_t frame[64];
+
+	for (int i = 0;i < RC_SERIAL_CHANNELS;i++) {
+		ch[i] = (uint16_t)(172 + i * 100);
+	}
+	ch[2] = 0x7FF;
+
+	rc_serial_init(&s, RC_SERIAL_SBUS);
+	int len = make_sbus(ch, 0, 0x00, frame);
+	check("SBUS frame", feed(&s, frame, len) == 1 && memcmp(s.ch, ch, sizeof(ch)) == 0);
+
+	len = make_sbus(ch, 0, 0x14, frame);
+	check("SBUS2 end byte", feed(&s, frame, len) == 1);
+
+	len = make_sbus(ch, (1 << 3) | (1 << 2), 0x00, frame);
+	check("SBUS failsafe", feed(&s, frame, len) == 1 && s.failsafe && s.lost_cnt == 1);
+
+	// Start in the middle of a frame, the gap between the frames syncs up
+	rc_serial_init(&s, RC_SERIAL_SBUS);
+	len = make_sbus(ch, 0, 0x00, frame);
+	feed(&s, frame + 10, len - 10);
+	rc_serial_gap(&s);
+	check("SBUS sync after gap", feed(&s, frame, len) == 1 && !s.failsafe);
+
+	frame[24] = 0x55;
+	check("SBUS bad end byte", feed(&s, frame, len) == 0 && s.error_cnt == 1);
+}
+
+static void test_crsf(void) {
+	rc_serial_state s;
+	uint16_t ch[RC_SERIAL_CHANNELS];
+	uint8_t payload[22];
+	uint8_t frame[64];
+	uint8_t stream[256];
+
+	for (int i = 0;i < RC_SERIAL_CHANNELS;i++) {
+		ch[i] = (uint16_t)(1811 - i * 90);
+	}
+	pack_channels(ch, payload);
+
+	rc_serial_init(&s, RC_SERIAL_CRSF);
+	int len = make_crsf(0x16, payload, 22, frame);
+	check("CRSF frame", feed(&s, frame, len) == 1 && memcmp(s.ch, ch, sizeof(ch)) == 0);
+
+	uint8_t stats[10] = {50, 60, 87, 10, 0, 4, 2, 90, 100, 12};
+	len = make_crsf(0x14, stats, 10, frame);
+	check("CRSF link statistics", feed(&s, frame, len) == 0 && s.link_quality == 87);
+
+	len = make_crsf(0x16, payload, 22, frame);
+	frame[10] ^= 0x01;
+	check("CRSF bad CRC", feed(&s, frame, len) == 0 && s.error_cnt == 1);
+
+	// Noise, then frames back to back without gaps
+	int ind = 0;
+	stream[ind++] = 0x12;
+	stream[ind++] = 0xC8;
+	stream[ind++] = 0xFF;
+	for (int i = 0;i < 3;i++) {
+		ind += make_crsf(0x16, payload, 22, stream + ind);
+		ind += make_crsf(0x14, stats, 10, stream + ind);
+	}
+	check("CRSF stream", feed(&s, stream, ind) == 3);
+
+	// CRC of "123456789" with polynomial 0xD5
+	check("CRC8", rc_serial_crc8((const uint8_t*)"123456789", 9) == 0xBC);
+}
+
+static void test_scale(void) {
+	check("Channel 172 is 988 us", fabsf(rc_serial_ch_to_ms(172) - 0.9875) < 1e-4);
+	check("Channel 992 is 1500 us", fabsf(rc_serial_ch_to_ms(992) - 1.5) < 1e-6);
+	check("Channel 1811 is 2012 us", fabsf(rc_serial_ch_to_ms(1811) - 2.0119) < 1e-4);
+}
+
+int main(void) {
+	printf("Pulse filter:\n");
+	test_filter();
+
+	printf("\nSBUS:\n");
+	test_sbus();
+
+	printf("\nCRSF:\n");
+	test_crsf();
+
+	printf("\nScale:\n");
+	test_scale();
+
+	return test_result();
+}
@@ -0,0 +1,26 @@
+#ifndef TEST_UTIL_H_
+#define TEST_UTIL_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/*
+ * Shared by the host tests. check prints one line per check and counts the
+ * failures, and test_result prints the summary and gives the exit code.
+ */
+
+static int m_fails = 0;
+
+static inline void check(const char *name, bool ok) {
+	printf("  %-60s %s\n", name, ok ? "OK" : "FAIL");
+	if (!ok) {
+		m_fails++;
+	}
+}
+
+static inline int test_result(void) {
+	printf("\n%s\n", m_fails ? "FAILED" : "All tests passed");
+	return m_fails ? 1 : 0;
+}
+
+#endif /* TEST_UTIL_H_ */
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "torque_vectoring.h"
+
+/*
+ * Simulation of a vehicle with four hub motors, each driven by its own ESC.
+ * The ESCs are virtual nodes with a current limit, their own temperature
+ * derating and a thermal model. The wheels have a tire model with slip. The
+ * master runs the app loop at APP_RATE and sees the status of the other nodes
+ * one cycle late, like over CAN. Three strategies are compared:
+ *
+ * - Equal: the same relative current is sent to all nodes (multi-ESC).
+ * - TC: the traction control of the apps, which maps the ERPM difference to
+ *   the slowest wheel to less current.
+ * - Coordinator: tv_distribute.
+ */
+
+#define NODES			4
+#define SIM_RATE		10000.0
+#define APP_RATE		100.0
+
+// Vehicle
+#define MASS			200.0
+#define G				9.81
+#define WHEEL_R			0.15
+#define WHEEL_J			0.05
+#define POLE_PAIRS		10.0
+#define KT				1.0
+#define DRAG			2.0
+#define I_MAX			50.0
+
+// Tire, simplified magic formula
+#define TIRE_B			10.0
+#define TIRE_C			1.9
+
+// ESC temperature derating and thermal model
+#define TEMP_FET_START	85.0
+#define TEMP_FET_END	100.0
+#define TEMP_AMB		30.0
+#define TEMP_RISE		(60.0 / (I_MAX * I_MAX))
+#define TEMP_TAU		30.0
+
+// Traction control of the apps
+#define TC_MAX_DIFF		3000.0
+
+typedef enum {
+	STRATEGY_EQUAL = 0,
+	STRATEGY_TC,
+	STRATEGY_COORDINATOR
+} strategy_t;
+
+typedef struct {
+	float w;
+	float current;
+	float current_rel_set;
+	float temp;
+	float cooling;
+	float mu;
+	float rpm_reported;
+	float temp_reported;
+} node_t;
+
+typedef struct {
+	node_t nodes[NODES];
+	float v;
+	float x;
+	float grade;
+} vehicle_t;
+
+typedef struct {
+	float throttle;
+	float grade;
+	float time;
+	float mu[NODES];
+	float temp_start[NODES];
+	float cooling[NODES];
+} scenario_t;
+
+static const char *strategy_names[] = {"Equal", "TC", "Coordinator"};
+
+static float map_clamp(float x, float in_min, float in_max, float out_min, float out_max) {
+	if (x <= in_min) {
+		return out_min;
+	} else if (x >= in_max) {
+		return out_max;
+	}
+	return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+static float erpm(float w) {
+	return w * 60.0 / (2.0 * M_PI) * POLE_PAIRS;
+}
+
+static void app_cycle(vehicle_t *veh, tv_state *tv, strategy_t strategy, float throttle) {
+	switch (strategy) {
+	case STRATEGY_EQUAL:
+		for (int i = 0;i < NODES;i++) {
+			veh->nodes[i].current_rel_set = throttle;
+		}
+		break;
+
+	case STRATEGY_TC: {
+		float rpm_lowest = veh->nodes[0].rpm_reported;
+		for (int i = 1;i < NODES;i++) {
+			if (veh->nodes[i].rpm_reported < rpm_lowest) {
+				rpm_lowest = veh->nodes[i].rpm_reported;
+			}
+		}
+
+		for (int i = 0;i < NODES;i++) {
+			float diff = veh->nodes[i].rpm_reported - rpm_lowest;
+			veh->nodes[i].current_rel_set = map_clamp(diff, 0.0, TC_MAX_DIFF, throttle, 0.0);
+		}
+	} break;
+
+	case STRATEGY_COORDINATOR:
+		tv_begin(tv);
+		for (int i = 0;i < NODES;i++) {
+			tv_add_node(tv, i, veh->nodes[i].rpm_reported, veh->nodes[i].temp_reported, 0.0);
+		}
+		tv_distribute(tv, throttle, 1.0 / APP_RATE);
+		for (int i = 0;i < NODES;i++) {
+			veh->nodes[i].current_rel_set = tv->nodes[i].current_rel;
+		}
+		break;
+	}
+
+	// Status for the next cycle
+	for (int i = 0;i < NODES;i++) {
+		veh->nodes[i].rpm_reported = erpm(veh->nodes[i].w);
+		veh->nodes[i].temp_reported = veh->nodes[i].temp;
+	}
+}
+
+static void sim_step(vehicle_t *veh, float dt) {
+	const float fz = MASS * G / (float)NODES;
+	float force = 0.0;
+
+	for (int i = 0;i < NODES;i++) {
+		node_t *n = &veh->nodes[i];
+
+		// ESC with its own temperature derating and a fast current loop
+		float i_max = I_MAX * map_clamp(n->temp, TEMP_FET_START, TEMP_FET_END, 1.0, 0.0);
+		float i_set = n->current_rel_set * I_MAX;
+		if (i_set > i_max) {
+			i_set = i_max;
+		}
+		n->current += (i_set - n->current) * dt / 0.002;
+		n->temp += (TEMP_AMB + TEMP_RISE * n->current * n->current / n->cooling - n->temp) * dt / TEMP_TAU;
+
+		// Tire
+		float v_wheel = n->w * WHEEL_R;
+		float slip = (v_wheel - veh->v) / fmaxf(fabsf(veh->v), 0.5);
+		float f = fz * n->mu * sinf(TIRE_C * atanf(TIRE_B * slip));
+
+		n->w += (KT * n->current - f * WHEEL_R) * dt / WHEEL_J;
+		force += f;
+	}
+
+	force -= MASS * G * veh->grade + DRAG * veh->v * fabsf(veh->v);
+	veh->v += force * dt / MASS;
+	veh->x += veh->v * dt;
+}
+
+static void run(const char *name, const scenario_t *sc, strategy_t strategy) {
+	vehicle_t veh;
+	tv_state tv;
+	memset(&veh, 0, sizeof(veh));
+	tv_init(&tv);
+	tv.conf.temp_fet_start = TEMP_FET_START - 15.0;
+	tv.conf.temp_fet_end = TEMP_FET_START;
+
+	veh.grade = sc->grade;
+	for (int i = 0;i < NODES;i++) {
+		veh.nodes[i].mu = sc->mu[i];
+		veh.nodes[i].temp = sc->temp_start[i];
+		veh.nodes[i].cooling = sc->cooling[i];
+	}
+
+	const int steps = sc->time * SIM_RATE;
+	const int app_div = SIM_RATE / APP_RATE;
+	float slip_max = 0.0;
+	float temp_max = 0.0;
+	float v_min = 1e9;
+
+	for (int i = 0;i < steps;i++) {
+		if ((i % app_div) == 0) {
+			app_cycle(&veh, &tv, strategy, sc->throttle);
+		}
+
+		sim_step(&veh, 1.0 / SIM_RATE);
+
+		for (int j = 0;j < NODES;j++) {
+			float slip = (veh.nodes[j].w * WHEEL_R - veh.v) / fmaxf(fabsf(veh.v), 0.5);
+			if (slip > slip_max) {
+				slip_max = slip;
+			}
+			if (veh.nodes[j].temp > temp_max) {
+				temp_max = veh.nodes[j].temp;
+			}
+		}
+
+		if (i > steps / 2 && veh.v < v_min) {
+			v_min = veh.v;
+		}
+	}
+
+	printf("%-12s %-12s distance: %7.2f m  speed: %5.2f m/s (min %5.2f)  max slip: %6.2f  max FET temp: %5.1f C\n",
+			name, strategy_names[strategy], veh.x, veh.v, v_min, slip_max, temp_max);
+}
+
+int main(void) {
+	scenario_t ice = {
+			.throttle = 0.6,
+			.grade = 0.0,
+			.time = 4.0,
+			.mu = {0.15, 1.0, 1.0, 1.0},
+			.temp_start = {TEMP_AMB, TEMP_AMB, TEMP_AMB, TEMP_AMB},
+			.cooling = {1.0, 1.0, 1.0, 1.0},
+	};
+
+	scenario_t hill = {
+			.throttle = 0.8,
+			.grade = 0.3,
+			.time = 180.0,
+			.mu = {1.0, 1.0, 1.0, 1.0},
+			.temp_start = {TEMP_AMB, TEMP_AMB, TEMP_AMB, TEMP_AMB},
+			.cooling = {0.4, 1.0, 1.0, 1.0},
+	};
+
+	printf("Four hub motors, app loop at %.0f Hz\n\n", APP_RATE);
+
+	for (int s = STRATEGY_EQUAL;s <= STRATEGY_COORDINATOR;s++) {
+		run("Ice patch", &ice, s);
+	}
+
+	printf("\n");
+
+	for (int s = STRATEGY_EQUAL;s <= STRATEGY_COORDINATOR;s++) {
+		run("Poor cooling", &hill, s);
+	}
+
+	return 0;
+}
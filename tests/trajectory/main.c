@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "trajectory.h"
+
+/*
+ * Simulation of a position servo to compare step inputs to the PID with
+ * trajectory following, with and without velocity and acceleration
+ * feedforward. The motor is modeled in output degrees with an inertia,
+ * viscous friction, coulomb friction and a first order current loop.
+ */
+
+#define PID_RATE		10000.0
+#define SIM_RATE		100000.0
+#define I_MAX			20.0
+
+// Plant: acc = (iq * K_ACC - B * vel - coulomb) in deg/s^2
+#define K_ACC			20000.0
+#define B_VISC			5.0
+#define COULOMB			4000.0
+#define TAU_CURRENT		0.0003
+
+// Position PID, same structure as the one in mcpwm_foc.c
+#define KP				0.03
+#define KI				2.0
+#define KD				0.0003
+#define KD_FILTER		0.2
+
+typedef struct {
+	float pos;
+	float vel;
+	float iq;
+} plant_t;
+
+typedef struct {
+	float i_term;
+	float prev_error;
+	float d_filter;
+} pid_t_;
+
+typedef struct {
+	double err_sq_sum;
+	float err_max;
+	int samples;
+	float i_max;
+} stats_t;
+
+static void plant_step(plant_t *p, float iq_set, float dt_pid) {
+	const int steps = SIM_RATE / PID_RATE;
+	const float dt = dt_pid / (float)steps;
+
+	for (int i = 0;i < steps;i++) {
+		p->iq += (iq_set - p->iq) * (dt / TAU_CURRENT);
+		float acc = p->iq * K_ACC - B_VISC * p->vel;
+		if (fabsf(p->vel) > 1e-3) {
+			acc -= p->vel > 0.0 ? COULOMB : -COULOMB;
+		} else if (fabsf(acc) < COULOMB) {
+			acc = 0.0;
+		} else {
+			acc -= acc > 0.0 ? COULOMB : -COULOMB;
+		}
+		p->vel += acc * dt;
+		p->pos += p->vel * dt;
+	}
+}
+
+static float pid_run(pid_t_ *pid, float set, float now, float dt) {
+	float error = set - now;
+	float p_term = error * KP;
+	pid->i_term += error * KI * dt;
+	float d_term = (error - pid->prev_error) * (KD / dt);
+	pid->d_filter -= KD_FILTER * (pid->d_filter - d_term);
+	pid->prev_error = error;
+
+	// I-term wind-up protection
+	float p_tmp = p_term;
+	if (p_tmp > 1.0) {
+		p_tmp = 1.0;
+	} else if (p_tmp < -1.0) {
+		p_tmp = -1.0;
+	}
+	float i_max = 1.0 - fabsf(p_tmp);
+	if (pid->i_term > i_max) {
+		pid->i_term = i_max;
+	} else if (pid->i_term < -i_max) {
+		pid->i_term = -i_max;
+	}
+
+	float output = p_term + pid->i_term + pid->d_filter;
+	if (output > 1.0) {
+		output = 1.0;
+	} else if (output < -1.0) {
+		output = -1.0;
+	}
+
+	return output * I_MAX;
+}
+
+static float clamp_current(float iq) {
+	if (iq > I_MAX) {
+		return I_MAX;
+	} else if (iq < -I_MAX) {
+		return -I_MAX;
+	}
+	return iq;
+}
+
+static void stats_add(stats_t *s, float err, float iq) {
+	s->err_sq_sum += (double)(err * err);
+	if (fabsf(err) > s->err_max) {
+		s->err_max = fabsf(err);
+	}
+	if (fabsf(iq) > s->i_max) {
+		s->i_max = fabsf(iq);
+	}
+	s->samples++;
+}
+
+static void stats_print(const char *name, stats_t *s) {
+	printf("%-28s RMS err: %8.4f deg  max err: %8.4f deg  max current: %5.1f A\r\n",
+			name, sqrt(s->err_sq_sum / (double)s->samples), (double)s->err_max, (double)s->i_max);
+}
+
+static void run_move(const char *name, float dist, bool use_traj, bool use_ff) {
+	const float dt = 1.0 / PID_RATE;
+	plant_t p;
+	pid_t_ pid;
+	traj_state t;
+	stats_t s;
+	memset(&p, 0, sizeof(p));
+	memset(&pid, 0, sizeof(pid));
+	memset(&t, 0, sizeof(t));
+	memset(&s, 0, sizeof(s));
+
+	traj_set_limits(&t, 3000.0, 60000.0, 3.0e6);
+	traj_init(&t, 0.0);
+	traj_set_target(&t, dist);
+
+	float settle_time = -1.0;
+	float overshoot = 0.0;
+
+	for (int i = 0;i < (int)(0.5 * PID_RATE);i++) {
+		float set = dist;
+		float iq_ff = 0.0;
+
+		if (use_traj) {
+			traj_update(&t, dt);
+			set = t.pos;
+			if (use_ff) {
+				iq_ff = (t.acc + B_VISC * t.vel) / K_ACC;
+				if (fabsf(t.vel) > 1e-3) {
+					iq_ff += (t.vel > 0.0 ? COULOMB : -COULOMB) / K_ACC;
+				}
+			}
+		}
+
+		float iq = clamp_current(pid_run(&pid, set, p.pos, dt) + iq_ff);
+		plant_step(&p, iq, dt);
+
+		if (use_traj) {
+			stats_add(&s, set - p.pos, iq);
+		} else {
+			stats_add(&s, 0.0, iq);
+		}
+
+		if ((p.pos - dist) > overshoot) {
+			overshoot = p.pos - dist;
+		}
+
+		if (fabsf(p.pos - dist) > 0.1) {
+			settle_time = -1.0;
+		} else if (settle_time < 0.0) {
+			settle_time = (float)i * dt;
+		}
+	}
+
+	if (use_traj) {
+		stats_print(name, &s);
+	} else {
+		printf("%-28s max current: %5.1f A\r\n", name, (double)s.i_max);
+	}
+	printf("%-28s overshoot: %7.3f deg  settled (0.1 deg) after: %6.1f ms\r\n",
+			"", (double)overshoot, (double)(settle_time * 1e3));
+}
+
+static void run_stream(const char *name, bool use_ff) {
+	const float dt = 1.0 / PID_RATE;
+	const float wp_rate = 100.0;
+	const float amp = 90.0;
+	const float freq = 2.0;
+
+	plant_t p;
+	pid_t_ pid;
+	traj_state t;
+	stats_t s;
+	memset(&p, 0, sizeof(p));
+	memset(&pid, 0, sizeof(pid));
+	memset(&t, 0, sizeof(t));
+	memset(&s, 0, sizeof(s));
+
+	traj_set_limits(&t, 5000.0, 60000.0, 3.0e6);
+	traj_init(&t, 0.0);
+
+	int wp_div = PID_RATE / wp_rate;
+	int wp_cnt = 0;
+	int wp_ind = 1;
+
+	// Keep a few waypoints queued, like a host would
+	for (int i = 0;i < 3;i++) {
+		float tw = (float)wp_ind / wp_rate;
+		traj_push_waypoint(&t, amp * sinf(2.0 * M_PI * freq * tw),
+				amp * 2.0 * M_PI * freq * cosf(2.0 * M_PI * freq * tw));
+		wp_ind++;
+	}
+
+	for (int i = 0;i < (int)(2.0 * PID_RATE);i++) {
+		if (++wp_cnt >= wp_div) {
+			wp_cnt = 0;
+			float tw = (float)wp_ind / wp_rate;
+			traj_push_waypoint(&t, amp * sinf(2.0 * M_PI * freq * tw),
+					amp * 2.0 * M_PI * freq * cosf(2.0 * M_PI * freq * tw));
+			wp_ind++;
+		}
+
+		traj_update(&t, dt);
+
+		float iq_ff = 0.0;
+		if (use_ff) {
+			iq_ff = (t.acc + B_VISC * t.vel) / K_ACC;
+			if (fabsf(t.vel) > 1e-3) {
+				iq_ff += (t.vel > 0.0 ? COULOMB : -COULOMB) / K_ACC;
+			}
+		}
+
+		float iq = clamp_current(pid_run(&pid, t.pos, p.pos, dt) + iq_ff);
+		plant_step(&p, iq, dt);
+
+		// Skip the start-up transient
+		if (i > (int)(0.2 * PID_RATE)) {
+			stats_add(&s, t.pos - p.pos, iq);
+		}
+	}
+
+	stats_print(name, &s);
+}
+
+static void check_limits(void) {
+	const float dt = 1.0 / PID_RATE;
+	traj_state t;
+	memset(&t, 0, sizeof(t));
+	traj_set_limits(&t, 1000.0, 20000.0, 1.0e6);
+	traj_init(&t, 0.0);
+	traj_set_target(&t, 360.0);
+
+	float vel_max = 0.0, acc_max = 0.0, jerk_max = 0.0;
+	float acc_last = 0.0;
+	float pos_max = 0.0;
+	int iterations = 0;
+
+	while (!traj_is_done(&t) && iterations < 100000) {
+		traj_update(&t, dt);
+		vel_max = fmaxf(vel_max, fabsf(t.vel));
+		acc_max = fmaxf(acc_max, fabsf(t.acc));
+		jerk_max = fmaxf(jerk_max, fabsf(t.acc - acc_last) / dt);
+		pos_max = fmaxf(pos_max, t.pos);
+		acc_last = t.acc;
+		iterations++;
+	}
+
+	printf("Limits 1000 deg/s, 20000 deg/s^2, 1e6 deg/s^3, move 360 deg\r\n");
+	printf("  Peak vel: %.1f  peak acc: %.1f  peak jerk: %.3g  overshoot: %.4f  time: %.1f ms  %s\r\n",
+			(double)vel_max, (double)acc_max, (double)jerk_max, (double)(pos_max - 360.0),
+			(double)((float)iterations * dt * 1e3),
+			traj_is_done(&t) ? "done" : "NOT DONE");
+}
+
+// Targets where the last step does not land exactly on the target in float
+static void check_done(void) {
+	const float dt = 1.0 / PID_RATE;
+	const float starts[] = {0.0, 0.1, 1000.3, -359.7};
+	const float targets[] = {123.456789, 0.10001, 1000.30005, 17.3};
+	int done = 0;
+	int num = (int)(sizeof(starts) / sizeof(starts[0]));
+
+	for (int i = 0;i < num;i++) {
+		traj_state t;
+		memset(&t, 0, sizeof(t));
+		traj_set_limits(&t, 1000.0, 20000.0, 1.0e6);
+		traj_init(&t, starts[i]);
+		traj_set_target(&t, targets[i]);
+
+		int iterations = 0;
+		while (!traj_is_done(&t) && iterations < 100000) {
+			traj_update(&t, dt);
+			iterations++;
+		}
+
+		if (traj_is_done(&t) && t.pos == targets[i]) {
+			done++;
+		}
+	}
+
+	printf("Moves that end exactly on the target: %d of %d  %s\r\n",
+			done, num, done == num ? "done" : "NOT DONE");
+}
+
+static void benchmark(void) {
+	traj_state t;
+	memset(&t, 0, sizeof(t));
+	traj_set_limits(&t, 1000.0, 20000.0, 1.0e6);
+	traj_init(&t, 0.0);
+
+	const int iterations = 10000000;
+	clock_t start = clock();
+	for (int i = 0;i < iterations;i++) {
+		if (traj_is_done(&t)) {
+			traj_set_target(&t, t.pos > 100.0 ? 0.0 : 200.0);
+		}
+		traj_update(&t, 1.0 / PID_RATE);
+	}
+	double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	printf("traj_update: %.1f ns per call\r\n", secs * 1e9 / iterations);
+}
+
+int main(void) {
+	check_limits();
+	check_done();
+	printf("\r\n");
+
+	printf("90 degree move at %.0f Hz\r\n", PID_RATE);
+	run_move("Step to PID", 90.0, false, false);
+	run_move("S-curve, no feedforward", 90.0, true, false);
+	run_move("S-curve with feedforward", 90.0, true, true);
+	printf("\r\n");
+
+	printf("Streamed waypoints at 100 Hz, 90 degree 2 Hz sine\r\n");
+	run_stream("Waypoints, no feedforward", false);
+	run_stream("Waypoints with feedforward", true);
+	printf("\r\n");
+
+	benchmark();
+
+	return 0;
+}
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "packet.h"
+#include "../test_util.h"
+
+/*
+ * Loopback of the USB receive path in comm_usb.c with a simulated CDC
+ * stream. USB packets of up to 64 bytes are read into a ring buffer with
+ * the same rules as the read thread, and the ring buffer is decoded either
+ * byte by byte, as before, or span by span with packet_process_data. Both
+ * must give the same packets, also when packets are split over the end of
+ * the ring buffer and when there is garbage between them.
+ */
+
+#define RING_SIZE		2048
+#define USB_PACKET		64
+#define STREAM_PACKETS	20000
+
+typedef struct {
+	unsigned int packets;
+	unsigned int payload;
+	unsigned int hash;
+	unsigned int in_place;
+	double latency_sum;
+	double latency_max;
+} result_t;
+
+static uint8_t *m_stream = NULL;
+static unsigned int m_stream_len = 0;
+static unsigned int *m_packet_end = NULL;
+static unsigned int m_packets = 0;
+
+static uint8_t m_ring[RING_SIZE];
+static int m_read_pos = 0;
+static int m_write_pos = 0;
+
+static double *m_chunk_time = NULL;
+static unsigned int *m_chunk_end = NULL;
+static unsigned int m_chunks = 0;
+
+static PACKET_STATE_t m_state;
+static result_t m_res;
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void send_packet(unsigned char *data, unsigned int len) {
+	memcpy(m_stream + m_stream_len, data, len);
+	m_stream_len += len;
+}
+
+// Time when the USB packet with the given stream offset was read
+static double chunk_time(unsigned int offset) {
+	unsigned int lo = 0;
+	unsigned int hi = m_chunks;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (m_chunk_end[mid] <= offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return m_chunk_time[lo];
+}
+
+static void process_packet(unsigned char *data, unsigned int len) {
+	double t = now();
+
+	m_res.packets++;
+	m_res.payload += len;
+	for (unsigned int i = 0;i < len;i++) {
+		m_res.hash = (m_res.hash ^ data[i]) * 16777619;
+	}
+
+	if (data >= m_ring && data < m_ring + RING_SIZE) {
+		m_res.in_place++;
+	}
+
+	unsigned int seq = 0;
+	if (len >= 4) {
+		memcpy(&seq, data, 4);
+	}
+
+	if (seq < m_packets) {
+		double lat = t - chunk_time(m_packet_end[seq] - 1);
+		m_res.latency_sum += lat;
+		if (lat > m_res.latency_max) {
+			m_res.latency_max = lat;
+		}
+	}
+}
+
+static void make_stream(void) {
+	m_stream = malloc(STREAM_PACKETS * (PACKET_BUFFER_LEN + 20));
+	m_packet_end = malloc(STREAM_PACKETS * sizeof(unsigned int));
+	packet_init(send_packet, process_packet, &m_state);
+
+	srand(91);
+	unsigned char pl[PACKET_MAX_PL_LEN];
+	for (unsigned int i = 0;i < STREAM_PACKETS;i++) {
+		// Some garbage now and then, which can look like a start byte
+		if (rand() % 10 == 0) {
+			int n = rand() % 20;
+			for (int j = 0;j < n;j++) {
+				m_stream[m_stream_len++] = rand() % 2 ? 2 : rand();
+			}
+		}
+
+		// Mostly short packets, like most commands
+		unsigned int len = rand() % 4 == 0 ? 4 + rand() % (PACKET_MAX_PL_LEN - 3) : 4 + rand() % 60;
+		memcpy(pl, &i, 4);
+		for (unsigned int j = 4;j < len;j++) {
+			pl[j] = rand();
+		}
+
+		packet_send_packet(pl, len, &m_state);
+		m_packet_end[i] = m_stream_len;
+	}
+
+	m_packets = STREAM_PACKETS;
+	m_chunk_time = malloc((m_stream_len + 1) * sizeof(double));
+	m_chunk_end = malloc((m_stream_len + 1) * sizeof(unsigned int));
+}
+
+// Free space that can be written in one go, as in the read thread
+static int ring_free_span(void) {
+	if (m_write_pos >= m_read_pos) {
+		return RING_SIZE - m_write_pos - (m_read_pos == 0 ? 1 : 0);
+	} else {
+		return m_read_pos - m_write_pos - 1;
+	}
+}
+
+static void process_ring(bool bulk) {
+	while (m_read_pos != m_write_pos) {
+		int end = m_write_pos > m_read_pos ? m_write_pos : RING_SIZE;
+
+		if (bulk) {
+			packet_process_data(m_ring + m_read_pos, end - m_read_pos, &m_state);
+		} else {
+			for (int i = m_read_pos;i < end;i++) {
+				packet_process_byte(m_ring[i], &m_state);
+			}
+		}
+
+		m_read_pos = end == RING_SIZE ? 0 : end;
+	}
+}
+
+/*
+ * Runs the stream through the ring buffer. The host sends USB packets of
+ * random size and the process thread gets to run after a random number of
+ * them, or when the ring buffer is full.
+ */
+static double run(bool bulk, bool random_usb, unsigned int seed, unsigned int *wraps) {
+	memset(&m_res, 0, sizeof(m_res));
+	packet_init(NULL, process_packet, &m_state);
+	m_read_pos = 0;
+	m_write_pos = 0;
+	m_chunks = 0;
+	srand(seed);
+
+	unsigned int pos = 0;
+	unsigned int usb_left = 0;
+	int batch = 0;
+	*wraps = 0;
+
+	double t0 = now();
+	while (pos < m_stream_len) {
+		if (usb_left == 0) {
+			usb_left = random_usb ? 1 + rand() % USB_PACKET : USB_PACKET;
+			if (usb_left > m_stream_len - pos) {
+				usb_left = m_stream_len - pos;
+			}
+		}
+
+		int len = ring_free_span();
+		if (len == 0) {
+			process_ring(bulk);
+			continue;
+		}
+
+		unsigned int n = usb_left < (unsigned int)len ? usb_left : (unsigned int)len;
+		memcpy(m_ring + m_write_pos, m_stream + pos, n);
+		pos += n;
+		usb_left -= n;
+		m_write_pos += n;
+		if (m_write_pos == RING_SIZE) {
+			m_write_pos = 0;
+			(*wraps)++;
+		}
+
+		m_chunk_end[m_chunks] = pos;
+		m_chunk_time[m_chunks++] = now();
+
+		if (--batch <= 0) {
+			process_ring(bulk);
+			batch = random_usb ? 1 + rand() % 8 : 1;
+		}
+	}
+
+	process_ring(bulk);
+	return now() - t0;
+}
+
+static void test_same_packets(void) {
+	unsigned int wraps;
+
+	run(false, true, 1, &wraps);
+	result_t ref = m_res;
+	check("byte by byte gets all packets", ref.packets == m_packets);
+
+	bool same = true;
+	unsigned int in_place = 0;
+	for (unsigned int seed = 1;seed < 20;seed++) {
+		run(true, true, seed, &wraps);
+		same &= m_res.packets == ref.packets && m_res.payload == ref.payload && m_res.hash == ref.hash;
+		in_place += m_res.in_place;
+	}
+
+	check("spans give the same packets as bytes", same);
+	check("ring buffer wrapped", wraps > 0);
+	check("packets within a span decoded in place", in_place > 0);
+
+	// A start byte and a length right before the next packet, which has
+	// to be found again when the long packet turns out to be invalid
+	uint8_t tail[2] = {2, 200};
+	uint8_t *buf = malloc(m_packet_end[10] + sizeof(tail));
+	memcpy(buf, m_stream, m_packet_end[0]);
+	memcpy(buf + m_packet_end[0], tail, sizeof(tail));
+	memcpy(buf + m_packet_end[0] + sizeof(tail), m_stream + m_packet_end[0], m_packet_end[10] - m_packet_end[0]);
+	unsigned int len = m_packet_end[10] + sizeof(tail);
+
+	packet_init(NULL, process_packet, &m_state);
+	memset(&m_res, 0, sizeof(m_res));
+	for (unsigned int i = 0;i < len;i++) {
+		packet_process_byte(buf[i], &m_state);
+	}
+	ref = m_res;
+
+	packet_init(NULL, process_packet, &m_state);
+	memset(&m_res, 0, sizeof(m_res));
+	for (unsigned int i = 0;i < len;i += 7) {
+		packet_process_data(buf + i, len - i < 7 ? len - i : 7, &m_state);
+	}
+
+	check("recovers from a truncated packet", m_res.packets == 11 &&
+			ref.packets == 11 && m_res.hash == ref.hash);
+	free(buf);
+}
+
+static void test_performance(void) {
+	unsigned int wraps;
+	const char *names[] = {"bytes", "spans"};
+
+	for (int bulk = 0;bulk < 2;bulk++) {
+		double best = 1e9;
+		result_t res;
+		memset(&res, 0, sizeof(res));
+		for (int i = 0;i < 5;i++) {
+			double t = run(bulk, false, 1, &wraps);
+			if (t < best) {
+				best = t;
+				res = m_res;
+			}
+		}
+
+		printf("    %s: %6.1f MB/s, latency %5.2f us avg, %5.2f us max, %u of %u in place\n",
+				names[bulk], (double)m_stream_len / best / 1e6,
+				res.latency_sum / res.packets * 1e6, res.latency_max * 1e6,
+				res.in_place, res.packets);
+	}
+}
+
+int main(void) {
+	make_stream();
+	printf("Stream of %u packets, %u bytes\n", m_packets, m_stream_len);
+
+	printf("\nDecoding:\n");
+	test_same_packets();
+
+	printf("\nThroughput with %d byte USB packets:\n", USB_PACKET);
+	test_performance();
+
+	return test_result();
+}
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet_queue.h"
+#include "../test_util.h"
+
+/*
+ * Tests of the packet queue that the USB write thread in comm_usb.c takes
+ * its data from. Packets of random length are pushed and popped so that
+ * both the length bytes and the data wrap around the end of the buffer, and
+ * everything that comes out must match what went in, in order. Packets that
+ * do not fit must be dropped whole and counted.
+ */
+
+#define QUEUE_SIZE		300
+#define MAX_LEN			100
+#define ROUNDS			20000
+
+static uint8_t m_buffer[QUEUE_SIZE];
+
+// Reference of the packets in the queue, as a FIFO of lengths and seeds
+static unsigned int m_ref_len[QUEUE_SIZE];
+static uint8_t m_ref_seed[QUEUE_SIZE];
+static unsigned int m_ref_head = 0;
+static unsigned int m_ref_tail = 0;
+
+static void fill(uint8_t *data, unsigned int len, uint8_t seed) {
+	for (unsigned int i = 0;i < len;i++) {
+		data[i] = (uint8_t)(seed + i * 7);
+	}
+}
+
+int main(void) {
+	packet_queue q;
+	uint8_t data[MAX_LEN];
+	uint8_t out[QUEUE_SIZE];
+
+	srand(1234);
+
+	// Empty queue
+	packet_queue_init(&q, m_buffer, QUEUE_SIZE);
+	check("Empty queue pops nothing", packet_queue_pop(&q, out, sizeof(out)) == 0 && q.sent == 0);
+
+	// Full and drop accounting
+	fill(data, 98, 1);
+	bool ok = packet_queue_push(&q, data, 98);
+	ok = ok && packet_queue_push(&q, data, 98);
+	ok = ok && packet_queue_push(&q, data, 98);
+	check("Three packets fill the queue", ok && q.used == 300 && q.peak == 300);
+	check("Full queue refuses zero length packet", !packet_queue_fits(&q, 0) &&
+			!packet_queue_push(&q, data, 0) && q.dropped == 1 && q.used == 300);
+
+	unsigned int len = packet_queue_pop(&q, out, 150);
+	check("Pop returns whole packets that fit", len == 98 && q.sent == 1 && q.used == 200);
+	check("Packet larger than the space is dropped", !packet_queue_push(&q, data, 99) &&
+			q.dropped == 2 && q.used == 200);
+	check("Packet that fits exactly is taken", packet_queue_push(&q, data, 98) && q.used == 300);
+
+	len = packet_queue_pop(&q, out, 0);
+	check("Pop into no space keeps packets", len == 0 && q.used == 300 && q.sent == 1);
+	len = packet_queue_pop(&q, out, sizeof(out));
+	check("Pop returns everything", len == 3 * 98 && q.used == 0 && q.sent == 4);
+
+	// Random push and pop with wraparound
+	packet_queue_init(&q, m_buffer, QUEUE_SIZE);
+	unsigned int pushed = 0;
+	unsigned int dropped = 0;
+	unsigned int popped = 0;
+	unsigned int wraps = 0;
+	unsigned int bad = 0;
+	uint8_t seed = 0;
+
+	for (int i = 0;i < ROUNDS;i++) {
+		unsigned int write_before = q.write;
+		unsigned int plen = (unsigned int)(rand() % (MAX_LEN + 1));
+		fill(data, plen, seed);
+
+		bool fits = packet_queue_fits(&q, plen);
+		bool pushed_now = packet_queue_push(&q, data, plen);
+		if (fits != pushed_now || q.dropped != dropped + (pushed_now ? 0 : 1)) {
+			bad++;
+		}
+
+		if (pushed_now) {
+			m_ref_len[m_ref_head] = plen;
+			m_ref_seed[m_ref_head] = seed;
+			m_ref_head = (m_ref_head + 1) % QUEUE_SIZE;
+			pushed++;
+			if (q.write < write_before || q.write == 0) {
+				wraps++;
+			}
+		} else {
+			dropped++;
+		}
+
+		seed++;
+
+		if (rand() % 3 == 0) {
+			unsigned int max = (unsigned int)(rand() % QUEUE_SIZE);
+			unsigned int sent_before = q.sent;
+			len = packet_queue_pop(&q, out, max);
+
+			// Packets of length zero are popped too, so count by sent
+			unsigned int pos = 0;
+			for (unsigned int j = sent_before;j < q.sent;j++) {
+				uint8_t ref[MAX_LEN];
+				unsigned int rlen = m_ref_len[m_ref_tail];
+				fill(ref, rlen, m_ref_seed[m_ref_tail]);
+				if (pos + rlen > len || memcmp(out + pos, ref, rlen) != 0) {
+					bad++;
+					break;
+				}
+				pos += rlen;
+				m_ref_tail = (m_ref_tail + 1) % QUEUE_SIZE;
+				popped++;
+			}
+
+			if (pos != len) {
+				bad++;
+			}
+
+			// The next packet must not have fit
+			if (m_ref_head != m_ref_tail && len + m_ref_len[m_ref_tail] <= max) {
+				bad++;
+			}
+		}
+
+		unsigned int used = 0;
+		for (unsigned int j = m_ref_tail;j != m_ref_head;j = (j + 1) % QUEUE_SIZE) {
+			used += m_ref_len[j] + PACKET_QUEUE_OVERHEAD;
+		}
+
+		if (used != q.used || q.used > q.size) {
+			bad++;
+		}
+	}
+
+	len = packet_queue_pop(&q, out, sizeof(out));
+	popped += (m_ref_head + QUEUE_SIZE - m_ref_tail) % QUEUE_SIZE;
+
+	printf("Pushed %u, dropped %u, popped %u, write wraps %u\n", pushed, dropped, popped, wraps);
+	check("Random packets come out in order", bad == 0);
+	check("Write position wrapped", wraps > 100);
+	check("Some packets dropped", dropped > 0 && q.dropped == dropped);
+	check("Sent and popped match pushed", q.sent == pushed && popped == pushed && q.used == 0);
+
+	return test_result();
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "virtual_motor_load.h"
+
+/*
+ * Host build of the virtual motor load models. A PMSM with the same dq model as
+ * virtual_motor.c is driven by current controllers and a speed controller at
+ * the FOC rate, so that control changes can be compared under the same load
+ * scenarios as on the bench with the virtual motor connected.
+ */
+
+#define F_SW			20000.0
+#define V_BUS			48.0
+#define I_MAX			60.0
+
+// Motor
+#define MOTOR_R			0.05
+#define MOTOR_L			30e-6
+#define MOTOR_LAMBDA	0.005
+#define POLE_PAIRS		7
+#define MOTOR_J			1e-4
+#define KT				(1.5 * POLE_PAIRS * MOTOR_LAMBDA)
+
+// Current controller bandwidth in rad/s
+#define CURR_BW			6000.0
+// Speed controller bandwidth in rad/s
+#define SPEED_BW		150.0
+
+typedef struct {
+	float id;
+	float iq;
+	float w;
+	float id_int;
+	float iq_int;
+	float speed_int;
+	float speed_kp;
+	float speed_ki;
+} sim_t;
+
+typedef struct {
+	double err_sq_sum;
+	float err_max;
+	float i_max;
+	int samples;
+} stats_t;
+
+typedef float(*setpoint_func)(float t);
+
+static void sim_init(sim_t *s, float inertia) {
+	memset(s, 0, sizeof(sim_t));
+	s->speed_kp = inertia * SPEED_BW / KT;
+	s->speed_ki = s->speed_kp * SPEED_BW / 4.0;
+}
+
+static void sim_step(sim_t *s, vm_load_state *l, float w_set) {
+	const float dt = 1.0 / F_SW;
+	const float we = s->w * POLE_PAIRS;
+
+	// Speed PI
+	float err = w_set - s->w;
+	float iq_set = s->speed_kp * err + s->speed_int;
+	s->speed_int += s->speed_ki * err * dt;
+	if (fabsf(iq_set) > I_MAX) {
+		iq_set = iq_set > 0.0 ? I_MAX : -I_MAX;
+		s->speed_int -= s->speed_ki * err * dt;
+	}
+
+	// Current PI
+	const float kp = MOTOR_L * CURR_BW;
+	const float ki = MOTOR_R * CURR_BW;
+	float vd = kp * (0.0 - s->id) + s->id_int;
+	float vq = kp * (iq_set - s->iq) + s->iq_int;
+	const float v_max = V_BUS / sqrtf(3.0);
+	float v_mag = sqrtf(vd * vd + vq * vq);
+	if (v_mag > v_max) {
+		vd *= v_max / v_mag;
+		vq *= v_max / v_mag;
+	} else {
+		s->id_int += ki * (0.0 - s->id) * dt;
+		s->iq_int += ki * (iq_set - s->iq) * dt;
+	}
+
+	// Electrical
+	s->id += (vd - MOTOR_R * s->id + we * MOTOR_L * s->iq) * dt / MOTOR_L;
+	s->iq += (vq - MOTOR_R * s->iq - we * (MOTOR_L * s->id + MOTOR_LAMBDA)) * dt / MOTOR_L;
+
+	// Mechanical
+	float t_load = vm_load_update(l, s->w, dt);
+	s->w += (KT * s->iq - t_load) * dt / (MOTOR_J + vm_load_get_inertia(l));
+}
+
+static void run(const char *name, vm_load_state *l, setpoint_func sp, float time) {
+	sim_t s;
+	stats_t st;
+	memset(&st, 0, sizeof(st));
+	sim_init(&s, MOTOR_J + vm_load_get_inertia(l));
+	s.w = sp(0.0);
+
+	int steps = time * F_SW;
+	for (int i = 0;i < steps;i++) {
+		float t = (float)i / F_SW;
+		float w_set = sp(t);
+		sim_step(&s, l, w_set);
+
+		float err = fabsf(w_set - s.w);
+		st.err_sq_sum += err * err;
+		st.samples++;
+		if (err > st.err_max) {
+			st.err_max = err;
+		}
+		if (fabsf(s.iq) > st.i_max) {
+			st.i_max = fabsf(s.iq);
+		}
+	}
+
+	printf("%-28s RMS err: %7.3f rad/s  max err: %7.3f rad/s  max current: %5.1f A\n",
+			name, sqrt(st.err_sq_sum / st.samples), st.err_max, st.i_max);
+}
+
+static float sp_const(float t) {
+	(void)t;
+	return 100.0;
+}
+
+static float sp_ramp(float t) {
+	return t < 0.5 ? 0.0 : (t < 1.5 ? (t - 0.5) * 400.0 : 400.0);
+}
+
+static float sp_slow(float t) {
+	(void)t;
+	return 5.0;
+}
+
+static float sp_reverse(float t) {
+	return 20.0 * sinf(2.0 * M_PI * 2.5 * t);
+}
+
+static float sp_vehicle(float t) {
+	return t < 3.0 ? t * 50.0 : 150.0;
+}
+
+int main(void) {
+	vm_load_state l;
+
+	printf("Speed control at %.0f Hz with virtual motor load models\n", F_SW);
+
+	vm_load_init(&l);
+	vm_load_push_keyframe(&l, 0.2, 0.0, 0.0);
+	vm_load_push_keyframe(&l, 0.001, 0.3, 0.0);
+	vm_load_push_keyframe(&l, 0.3, 0.3, 0.0);
+	vm_load_push_keyframe(&l, 0.001, 0.0, 0.0);
+	run("Load torque steps", &l, sp_const, 1.0);
+
+	vm_load_init(&l);
+	vm_load_set_drag(&l, 1e-4, 1e-5);
+	run("Viscous and aero drag", &l, sp_ramp, 2.0);
+
+	vm_load_init(&l);
+	vm_load_set_cogging(&l, 0.05, 42.0);
+	run("Cogging at low speed", &l, sp_slow, 1.0);
+
+	vm_load_init(&l);
+	vm_load_set_backlash(&l, 0.0, 0.0, 0.0, 1e-3);
+	run("Rigid load, speed reversals", &l, sp_reverse, 1.2);
+
+	vm_load_init(&l);
+	vm_load_set_backlash(&l, 2.0 * M_PI / 180.0, 50.0, 0.01, 1e-3);
+	run("Backlash, speed reversals", &l, sp_reverse, 1.2);
+
+	vm_load_init(&l);
+	vm_load_set_vehicle(&l, 80.0, 0.1, 5.0, 0.01);
+	vm_load_set_drag(&l, 0.0, 2e-6);
+	vm_load_push_keyframe(&l, 3.0, 0.0, 0.0);
+	vm_load_push_keyframe(&l, 1.0, 0.0, 8.0);
+	vm_load_push_keyframe(&l, 1.0, 0.0, 8.0);
+	vm_load_push_keyframe(&l, 1.0, 0.0, -8.0);
+	run("Vehicle, slope script", &l, sp_vehicle, 7.0);
+
+	vm_load_init(&l);
+	vm_load_set_vehicle(&l, 80.0, 0.1, 5.0, 0.01);
+	vm_load_set_backlash(&l, 1.0 * M_PI / 180.0, 200.0, 0.05, 0.0);
+	vm_load_push_keyframe(&l, 3.0, 0.0, 0.0);
+	vm_load_push_keyframe(&l, 1.0, 0.0, 8.0);
+	vm_load_push_keyframe(&l, 1.0, 0.0, 8.0);
+	vm_load_push_keyframe(&l, 1.0, 0.0, -8.0);
+	run("Vehicle through gearbox", &l, sp_vehicle, 7.0);
+
+	// Benchmark with all models enabled
+	vm_load_init(&l);
+	vm_load_set_drag(&l, 1e-4, 1e-5);
+	vm_load_set_cogging(&l, 0.05, 42.0);
+	vm_load_set_vehicle(&l, 80.0, 0.1, 5.0, 0.01);
+	vm_load_set_backlash(&l, 1.0 * M_PI / 180.0, 200.0, 0.05, 0.0);
+
+	const int iterations = 10000000;
+	volatile float sum = 0.0;
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0;i < iterations;i++) {
+		if (vm_load_keyframes_queued(&l) == 0) {
+			vm_load_push_keyframe(&l, 0.5, 0.1, (i & 1) ? 5.0 : -5.0);
+		}
+		sum += vm_load_update(&l, 100.0, 1.0 / F_SW);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	double ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+	printf("\nvm_load_update: %.1f ns per call\n", ns / iterations);
+
+	return 0;
+}
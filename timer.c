@@ -22,9 +22,6 @@
 #include "hal.h"
 #include "stm32f4xx_conf.h"
 
-// Settings
-#define TIMER_HZ					1.4e7
-
 void timer_init(void) {
 	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM5, ENABLE);
 	uint16_t PrescalerValue = (uint16_t) ((SYSTEM_CORE_CLOCK / 2) / TIMER_HZ) - 1;
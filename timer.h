@@ -22,6 +22,9 @@
 
 #include <stdint.h>
 
+// Settings
+#define TIMER_HZ					1.4e7
+
 void timer_init(void);
 uint32_t timer_time_now(void);
 float timer_seconds_elapsed_since(uint32_t time);
@@ -0,0 +1,396 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "torque_vectoring.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Coordinator that distributes a total current request over several motor
+ * controllers. The nodes are assumed to drive similar motors, so currents are
+ * relative to the current limits of each node. Every node has a capacity
+ * between 0 and 1 that is reduced when its wheel slips compared to the
+ * slowest wheel, or when its MOSFETs or motor get hot. The request is then
+ * shared equally, and the part that nodes at their capacity cannot take is
+ * moved to the others. With equal motors this minimizes the total copper
+ * losses for the requested torque.
+ *
+ * Slip derating is applied immediately and recovers at slip_recovery per
+ * second, so that a slipping wheel does not oscillate between grip and slip.
+ */
+
+// Private functions
+static float derate(float x, float start, float end);
+
+void tv_init(tv_state *s) {
+	memset(s, 0, sizeof(tv_state));
+	s->conf.slip_start = 0.05;
+	s->conf.slip_end = 0.25;
+	s->conf.slip_recovery = 2.0;
+	s->conf.rpm_min = 1000.0;
+	s->conf.temp_fet_start = 70.0;
+	s->conf.temp_fet_end = 85.0;
+	s->conf.temp_motor_start = 70.0;
+	s->conf.temp_motor_end = 85.0;
+}
+
+/**
+ * Start a new cycle. Nodes that were not added in the previous cycle are
+ * removed.
+ */
+void tv_begin(tv_state *s) {
+	int ind = 0;
+	for (int i = 0;i < s->node_num;i++) {
+		if (s->nodes[i].seen) {
+			s->nodes[ind] = s->nodes[i];
+			s->nodes[ind].seen = false;
+			ind++;
+		}
+	}
+	s->node_num = ind;
+}
+
+/**
+ * Add or update a node for this cycle.
+ *
+ * @param id
+ * Unique ID of the node, e.g. the CAN ID.
+ *
+ * @param rpm
+ * Speed of the node in ERPM.
+ *
+ * @param temp_fet
+ * MOSFET temperature in degrees C.
+ *
+ * @param temp_motor
+ * Motor temperature in degrees C.
+ *
+ * @return
+ * Index of the node in nodes, or -1 if there are too many nodes.
+ */
+int tv_add_node(tv_state *s, int id, float rpm, float temp_fet, float temp_motor) {
+	int ind = -1;
+	for (int i = 0;i < s->node_num;i++) {
+		if (s->nodes[i].id == id) {
+			ind = i;
+			break;
+		}
+	}
+
+	if (ind < 0) {
+		if (s->node_num >= TV_MAX_NODES) {
+			return -1;
+		}
+
+		ind = s->node_num++;
+		memset(&s->nodes[ind], 0, sizeof(tv_node));
+		s->nodes[ind].id = id;
+		s->nodes[ind].derate_slip = 1.0;
+	}
+
+	tv_node *n = &s->nodes[ind];
+	n->seen = true;
+	n->rpm = rpm;
+	n->temp_fet = temp_fet;
+	n->temp_motor = temp_motor;
+
+	return ind;
+}
+
+/**
+ * Distribute a current request over the nodes added in this cycle. The result
+ * is in current_rel of each node.
+ *
+ * @param current_rel
+ * Requested current of each node, relative to its limit. Negative for reverse.
+ *
+ * @param dt
+ * Time since the previous cycle in seconds.
+ */
+void tv_distribute(tv_state *s, float current_rel, float dt) {
+	const tv_config *c = &s->conf;
+	const float sign = current_rel < 0.0 ? -1.0 : 1.0;
+	float request = fabsf(current_rel);
+	if (request > 1.0) {
+		request = 1.0;
+	}
+
+	int num = 0;
+	float rpm_ref = 0.0;
+	for (int i = 0;i < s->node_num;i++) {
+		tv_node *n = &s->nodes[i];
+		if (!n->seen) {
+			continue;
+		}
+
+		float rpm = n->rpm * sign;
+		if (num == 0 || rpm < rpm_ref) {
+			rpm_ref = rpm;
+		}
+		num++;
+	}
+
+	s->demand = request * (float)num;
+	s->delivered = 0.0;
+
+	if (num == 0) {
+		return;
+	}
+
+	const float rpm_norm = fmaxf(fabsf(rpm_ref), c->rpm_min);
+	float cap[TV_MAX_NODES];
+	bool assigned[TV_MAX_NODES];
+
+	for (int i = 0;i < s->node_num;i++) {
+		tv_node *n = &s->nodes[i];
+		assigned[i] = !n->seen;
+		n->current_rel = 0.0;
+
+		if (!n->seen) {
+			continue;
+		}
+
+		n->slip = (n->rpm * sign - rpm_ref) / rpm_norm;
+		float target = derate(n->slip, c->slip_start, c->slip_end);
+		if (target < n->derate_slip) {
+			n->derate_slip = target;
+		} else {
+			n->derate_slip = fminf(target, n->derate_slip + c->slip_recovery * dt);
+		}
+
+		n->derate_temp = fminf(derate(n->temp_fet, c->temp_fet_start, c->temp_fet_end),
+				derate(n->temp_motor, c->temp_motor_start, c->temp_motor_end));
+
+		cap[i] = n->derate_slip * n->derate_temp;
+	}
+
+	// Share equally and move what the nodes at their capacity cannot take to the rest
+	float remaining = s->demand;
+	int unassigned = num;
+	bool changed = true;
+	while (changed && unassigned > 0) {
+		changed = false;
+		float share = remaining / (float)unassigned;
+
+		for (int i = 0;i < s->node_num;i++) {
+			if (!assigned[i] && cap[i] < share) {
+				s->nodes[i].current_rel = cap[i];
+				assigned[i] = true;
+				remaining -= cap[i];
+				unassigned--;
+				changed = true;
+			}
+		}
+	}
+
+	float share = unassigned > 0 ? remaining / (float)unassigned : 0.0;
+	for (int i = 0;i < s->node_num;i++) {
+		tv_node *n = &s->nodes[i];
+		if (!n->seen) {
+			continue;
+		}
+
+		if (!assigned[i]) {
+			n->current_rel = share;
+		}
+
+		s->delivered += n->current_rel;
+		n->current_rel *= sign;
+	}
+}
+
+static float derate(float x, float start, float end) {
+	if (x <= start) {
+		return 1.0;
+	} else if (x >= end) {
+		return 0.0;
+	} else {
+		return (end - x) / (end - start);
+	}
+}
+
+#ifndef NO_STM32
+#include "ch.h"
+#include "mc_interface.h"
+#include "comm_can.h"
+#include "terminal.h"
+#include "commands.h"
+#include "timer.h"
+#include "utils.h"
+#include "conf_general.h"
+
+#include <stdio.h>
+
+#define MAX_CAN_AGE					0.1
+
+// Private variables
+static tv_state m_tv;
+static volatile bool m_enabled;
+static uint32_t m_last_time;
+
+// Private functions
+static void terminal_enable(int argc, const char **argv);
+static void terminal_slip(int argc, const char **argv);
+static void terminal_status(int argc, const char **argv);
+
+void torque_vectoring_init(void) {
+	tv_init(&m_tv);
+	m_tv.conf.slip_start = TV_SLIP_START;
+	m_tv.conf.slip_end = TV_SLIP_END;
+	m_tv.conf.slip_recovery = TV_SLIP_RECOVERY;
+	m_tv.conf.rpm_min = TV_RPM_MIN;
+	m_enabled = TV_ENABLE;
+	m_last_time = timer_time_now();
+
+	terminal_register_command_callback(
+			"tv_enable",
+			"Enable the torque vectoring coordinator for multiple ESCs in current mode",
+			"[0/1]",
+			terminal_enable);
+
+	terminal_register_command_callback(
+			"tv_slip",
+			"Set the relative slip where torque vectoring starts and ends derating a wheel",
+			"[start] [end]",
+			terminal_slip);
+
+	terminal_register_command_callback(
+			"tv_status",
+			"Print the state of the torque vectoring coordinator",
+			0,
+			terminal_status);
+}
+
+bool torque_vectoring_is_enabled(void) {
+	return m_enabled;
+}
+
+/**
+ * Distribute a current request over this ESC and all ESCs seen on the CAN-bus,
+ * and send their currents to them. The temperature derating starts
+ * TV_TEMP_MARGIN before the local temperature limits, so that load is moved
+ * away before a node limits itself. Temperatures of other nodes are only used
+ * when they send CAN status message 4.
+ *
+ * @param current_rel
+ * Requested current relative to the current limits, 0 to 1.
+ *
+ * @param is_reverse
+ * Drive in reverse.
+ *
+ * @return
+ * The relative current for the local motor, 0 to 1.
+ */
+float torque_vectoring_apply(float current_rel, bool is_reverse) {
+	float dt = timer_seconds_elapsed_since(m_last_time);
+	m_last_time = timer_time_now();
+	utils_truncate_number(&dt, 0.0, 0.1);
+
+	const volatile mc_configuration *mcconf = mc_interface_get_configuration();
+	m_tv.conf.temp_fet_start = mcconf->l_temp_fet_start - TV_TEMP_MARGIN;
+	m_tv.conf.temp_fet_end = mcconf->l_temp_fet_start;
+	m_tv.conf.temp_motor_start = mcconf->l_temp_motor_start - TV_TEMP_MARGIN;
+	m_tv.conf.temp_motor_end = mcconf->l_temp_motor_start;
+
+	tv_begin(&m_tv);
+
+	int local = tv_add_node(&m_tv, -1, mc_interface_get_rpm(),
+			mc_interface_temp_fet_filtered(), mc_interface_temp_motor_filtered());
+
+	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
+		can_status_msg *msg = comm_can_get_status_msg_index(i);
+
+		if (msg->id >= 0 && UTILS_AGE_S(msg->rx_time) < MAX_CAN_AGE) {
+			float temp_fet = 0.0;
+			float temp_motor = 0.0;
+
+			can_status_msg_4 *msg4 = comm_can_get_status_msg_4_id(msg->id);
+			if (msg4 && UTILS_AGE_S(msg4->rx_time) < MAX_CAN_AGE) {
+				temp_fet = msg4->temp_fet;
+				temp_motor = msg4->temp_motor;
+			}
+
+			tv_add_node(&m_tv, msg->id, msg->rpm, temp_fet, temp_motor);
+		}
+	}
+
+	tv_distribute(&m_tv, is_reverse ? -current_rel : current_rel, dt);
+
+	for (int i = 0;i < m_tv.node_num;i++) {
+		if (i != local) {
+			comm_can_set_current_rel(m_tv.nodes[i].id, m_tv.nodes[i].current_rel);
+		}
+	}
+
+	return local >= 0 ? fabsf(m_tv.nodes[local].current_rel) : 0.0;
+}
+
+static void terminal_enable(int argc, const char **argv) {
+	if (argc == 2) {
+		int en = -1;
+		sscanf(argv[1], "%d", &en);
+
+		if (en == 0 || en == 1) {
+			m_enabled = en;
+			commands_printf("Torque vectoring %s\n", en ? "enabled" : "disabled");
+		} else {
+			commands_printf("Invalid argument. Use 0 or 1.\n");
+		}
+	} else {
+		commands_printf("This command requires one argument.\n");
+	}
+}
+
+static void terminal_slip(int argc, const char **argv) {
+	if (argc == 3) {
+		float start = -1.0;
+		float end = -1.0;
+		sscanf(argv[1], "%f", &start);
+		sscanf(argv[2], "%f", &end);
+
+		if (start >= 0.0 && end > start) {
+			m_tv.conf.slip_start = start;
+			m_tv.conf.slip_end = end;
+			commands_printf("Slip derating set\n");
+		} else {
+			commands_printf("Invalid argument. 0 <= start < end.\n");
+		}
+	} else {
+		commands_printf("This command requires two arguments.\n");
+	}
+}
+
+static void terminal_status(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	commands_printf("Enabled: %d, demand: %.2f, delivered: %.2f",
+			m_enabled, (double)m_tv.demand, (double)m_tv.delivered);
+
+	for (int i = 0;i < m_tv.node_num;i++) {
+		tv_node *n = &m_tv.nodes[i];
+		commands_printf("ID %3d  ERPM: %8.0f  slip: %5.2f  derate slip: %4.2f  temp: %4.2f  current: %5.2f",
+				n->id, (double)n->rpm, (double)n->slip, (double)n->derate_slip,
+				(double)n->derate_temp, (double)n->current_rel);
+	}
+
+	commands_printf(" ");
+}
+#endif
@@ -0,0 +1,72 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef TORQUE_VECTORING_H_
+#define TORQUE_VECTORING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Maximum number of nodes, including the local motor
+#define TV_MAX_NODES				16
+
+typedef struct {
+	float slip_start;		// Relative slip where derating starts
+	float slip_end;			// Relative slip where the node gets no current
+	float slip_recovery;	// Rate at which slip derating recovers, 1/s
+	float rpm_min;			// Reference ERPM used for slip at low speed
+	float temp_fet_start;	// MOSFET temperature where derating starts
+	float temp_fet_end;		// MOSFET temperature where the node gets no current
+	float temp_motor_start;	// Motor temperature where derating starts
+	float temp_motor_end;	// Motor temperature where the node gets no current
+} tv_config;
+
+typedef struct {
+	int id;
+	bool seen;
+	float rpm;
+	float temp_fet;
+	float temp_motor;
+	float slip;
+	float derate_slip;
+	float derate_temp;
+	float current_rel;
+} tv_node;
+
+typedef struct {
+	tv_config conf;
+	tv_node nodes[TV_MAX_NODES];
+	int node_num;
+	float demand;			// Requested total current, relative to one node
+	float delivered;		// Distributed total current, relative to one node
+} tv_state;
+
+// Functions
+void tv_init(tv_state *s);
+void tv_begin(tv_state *s);
+int tv_add_node(tv_state *s, int id, float rpm, float temp_fet, float temp_motor);
+void tv_distribute(tv_state *s, float current_rel, float dt);
+
+#ifndef NO_STM32
+void torque_vectoring_init(void);
+bool torque_vectoring_is_enabled(void);
+float torque_vectoring_apply(float current_rel, bool is_reverse);
+#endif
+
+#endif /* TORQUE_VECTORING_H_ */
@@ -0,0 +1,272 @@
+/*
+	Copyright 2021 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "trajectory.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Online jerk-limited trajectory generator. A trapezoidal profile that is
+ * recomputed in every iteration drives towards the current waypoint, so the
+ * target can be moved and new waypoints can be streamed at any time. Its
+ * velocity is then smoothed with a moving average over acc_max / jerk_max
+ * seconds, which turns the trapezoid into an S-curve with the jerk limit and
+ * the same end position. When the acceleration changes sign directly, which
+ * happens for moves that are too short to reach vel_max, the jerk during
+ * that transition can be up to twice jerk_max.
+ *
+ * Positions can be in any unit, e.g. degrees. Velocity, acceleration and jerk
+ * are then in degrees/s, degrees/s^2 and degrees/s^3.
+ */
+
+// Private functions
+static bool next_waypoint(traj_state *t);
+static void fir_reset(traj_state *t, float dt);
+
+void traj_init(traj_state *t, float pos) {
+	float vel_max = t->vel_max;
+	float acc_max = t->acc_max;
+	float jerk_max = t->jerk_max;
+
+	memset(t, 0, sizeof(traj_state));
+
+	t->vel_max = vel_max;
+	t->acc_max = acc_max;
+	t->jerk_max = jerk_max;
+	t->pos = pos;
+	t->trap_pos = pos;
+	t->target = pos;
+	t->fir_update = true;
+}
+
+void traj_set_limits(traj_state *t, float vel_max, float acc_max, float jerk_max) {
+	t->vel_max = fabsf(vel_max);
+	t->acc_max = fabsf(acc_max);
+	t->jerk_max = jerk_max > 0.0 ? jerk_max : 0.0;
+	t->fir_update = true;
+}
+
+/**
+ * Move to pos and stop there. Queued waypoints are dropped.
+ */
+void traj_set_target(traj_state *t, float pos) {
+	t->wp_read = t->wp_write;
+	t->target = pos;
+	t->target_vel = 0.0;
+	t->active = true;
+}
+
+/**
+ * Queue a waypoint that should be passed with velocity vel. The last waypoint
+ * in a stream should have zero velocity, otherwise the trajectory will
+ * overshoot and come back to it when the queue runs empty.
+ *
+ * @return
+ * false if the queue is full.
+ */
+bool traj_push_waypoint(traj_state *t, float pos, float vel) {
+	int next = (t->wp_write + 1) % TRAJ_WAYPOINTS;
+	if (next == t->wp_read) {
+		return false;
+	}
+
+	t->wp[t->wp_write].pos = pos;
+	t->wp[t->wp_write].vel = vel;
+	t->wp_write = next;
+
+	if (!t->active) {
+		next_waypoint(t);
+		t->active = true;
+	}
+
+	return true;
+}
+
+/**
+ * Shift all positions by ofs, e.g. to keep them in a bounded range when the
+ * position wraps around.
+ */
+void traj_offset(traj_state *t, float ofs) {
+	t->pos += ofs;
+	t->trap_pos += ofs;
+	t->target += ofs;
+
+	for (int i = 0;i < TRAJ_WAYPOINTS;i++) {
+		t->wp[i].pos += ofs;
+	}
+}
+
+int traj_waypoints_queued(traj_state *t) {
+	int res = t->wp_write - t->wp_read;
+	if (res < 0) {
+		res += TRAJ_WAYPOINTS;
+	}
+	return res;
+}
+
+void traj_update(traj_state *t, float dt) {
+	if (dt <= 0.0 || t->acc_max <= 0.0 || t->vel_max <= 0.0) {
+		return;
+	}
+
+	if (t->fir_update) {
+		fir_reset(t, dt);
+	}
+
+	if (!t->active) {
+		return;
+	}
+
+	const float acc_step = t->acc_max * dt;
+	float vel_new = 0.0;
+	bool arrived = false;
+
+	for (;;) {
+		float error = t->target - t->trap_pos;
+		float dir = error >= 0.0 ? 1.0 : -1.0;
+
+		float vel_end = t->target_vel * dir;
+		if (vel_end < 0.0) {
+			vel_end = 0.0;
+		}
+
+		// Highest velocity from which vel_end can be reached at the waypoint when
+		// the velocity is decreased by acc_step per iteration. With n = v / acc_step
+		// the distance until reaching n_end is (n * (n + 1) - n_end * (n_end + 1)) / 2
+		// steps of acc_step * dt.
+		float n_end = vel_end / acc_step;
+		float n = -0.5 + sqrtf(0.25 + n_end * (n_end + 1.0) + 2.0 * fabsf(error) / (acc_step * dt));
+		float vel_reach = n * acc_step;
+		if (vel_reach > t->vel_max) {
+			vel_reach = t->vel_max;
+		}
+
+		vel_new = dir * vel_reach;
+		if (vel_new > (t->trap_vel + acc_step)) {
+			vel_new = t->trap_vel + acc_step;
+		} else if (vel_new < (t->trap_vel - acc_step)) {
+			vel_new = t->trap_vel - acc_step;
+		}
+
+		// Reaching the waypoint in this iteration
+		if (fabsf(vel_new * dt) >= fabsf(error) && (vel_new * error) >= 0.0) {
+			if (fabsf(t->target_vel) > 0.0 && next_waypoint(t)) {
+				continue;
+			}
+
+			if (t->target_vel == 0.0) {
+				vel_new = error / dt;
+				arrived = true;
+			}
+
+			t->target_vel = 0.0;
+		}
+
+		break;
+	}
+
+	t->trap_vel = vel_new;
+	t->trap_pos += vel_new * dt;
+
+	// The last step is error / dt * dt, which does not always land exactly
+	// on the target in float.
+	if (arrived) {
+		t->trap_pos = t->target;
+	}
+
+	// Moving average of the velocity
+	float vel_old = t->fir_buf[t->fir_ind];
+	t->fir_buf[t->fir_ind] = vel_new;
+	t->fir_sum += vel_new - vel_old;
+	t->fir_ind++;
+	if (t->fir_ind >= t->fir_len) {
+		t->fir_ind = 0;
+	}
+
+	float n_inv = 1.0 / (float)t->fir_len;
+	float vel_last = t->vel;
+	t->vel = t->fir_sum * n_inv;
+	t->acc = (t->vel - vel_last) / dt;
+	t->pos += t->vel * dt;
+
+	// Stop once the trapezoid is at rest on the last waypoint and the moving
+	// average has caught up. Closer than the smallest step counts as there.
+	if (fabsf(t->target - t->trap_pos) <= (acc_step * dt) &&
+			fabsf(vel_new) <= acc_step && t->target_vel == 0.0) {
+		t->trap_pos = t->target;
+		t->fir_idle++;
+		if (t->fir_idle > t->fir_len && !next_waypoint(t)) {
+			memset(t->fir_buf, 0, sizeof(t->fir_buf));
+			t->fir_sum = 0.0;
+			t->fir_idle = 0;
+			t->pos = t->target;
+			t->vel = 0.0;
+			t->acc = 0.0;
+			t->trap_vel = 0.0;
+			t->active = false;
+		}
+	} else {
+		t->fir_idle = 0;
+	}
+}
+
+bool traj_is_done(traj_state *t) {
+	return !t->active;
+}
+
+static bool next_waypoint(traj_state *t) {
+	if (t->wp_read == t->wp_write) {
+		return false;
+	}
+
+	t->target = t->wp[t->wp_read].pos;
+	t->target_vel = t->wp[t->wp_read].vel;
+	t->wp_read = (t->wp_read + 1) % TRAJ_WAYPOINTS;
+
+	return true;
+}
+
+/**
+ * Set the length of the moving average from the limits. The window is
+ * filled with the current output velocity, so that changing the limits
+ * during a move keeps the velocity continuous.
+ */
+static void fir_reset(traj_state *t, float dt) {
+	int len = 1;
+	if (t->jerk_max > 0.0) {
+		len = (int)roundf(t->acc_max / (t->jerk_max * dt));
+	}
+
+	if (len < 1) {
+		len = 1;
+	} else if (len > TRAJ_FIR_LEN) {
+		len = TRAJ_FIR_LEN;
+	}
+
+	for (int i = 0;i < len;i++) {
+		t->fir_buf[i] = t->vel;
+	}
+
+	t->fir_len = len;
+	t->fir_sum = t->vel * (float)len;
+	t->fir_ind = 0;
+	t->fir_idle = 0;
+	t->fir_update = false;
+}
@@ -0,0 +1,80 @@
+/*
+	Copyright 2021 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef TRAJECTORY_H_
+#define TRAJECTORY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of waypoints that can be queued when streaming
+#define TRAJ_WAYPOINTS			16
+// Maximum length of the jerk limiting window in iterations
+#define TRAJ_FIR_LEN			256
+
+typedef struct {
+	float pos;
+	float vel;
+} traj_waypoint;
+
+typedef struct {
+	// Limits. jerk_max <= 0 gives a trapezoidal profile.
+	float vel_max;
+	float acc_max;
+	float jerk_max;
+
+	// Generated reference
+	float pos;
+	float vel;
+	float acc;
+
+	// Trapezoidal profile before jerk limiting
+	float trap_pos;
+	float trap_vel;
+
+	// Waypoint that is being approached
+	float target;
+	float target_vel;
+	bool active;
+
+	// Moving average of the trapezoidal velocity
+	float fir_buf[TRAJ_FIR_LEN];
+	float fir_sum;
+	int fir_len;
+	int fir_ind;
+	int fir_idle;
+	bool fir_update;
+
+	// Streamed waypoints
+	traj_waypoint wp[TRAJ_WAYPOINTS];
+	volatile int wp_read;
+	volatile int wp_write;
+} traj_state;
+
+// Functions
+void traj_init(traj_state *t, float pos);
+void traj_set_limits(traj_state *t, float vel_max, float acc_max, float jerk_max);
+void traj_set_target(traj_state *t, float pos);
+bool traj_push_waypoint(traj_state *t, float pos, float vel);
+void traj_offset(traj_state *t, float ofs);
+int traj_waypoints_queued(traj_state *t);
+void traj_update(traj_state *t, float dt);
+bool traj_is_done(traj_state *t);
+
+#endif /* TRAJECTORY_H_ */
@@ -25,6 +25,7 @@
 #include "stdio.h"
 #include "commands.h"
 #include "encoder.h"
+#include "virtual_motor_load.h"
 
 typedef struct{
 	//constant variables
@@ -47,7 +48,7 @@ typedef struct{
 	float cos_phi;
 	bool connected;				//true => connected; false => disconnected;
 	float tsj;					// Ts / J;
-	float ml;					//load torque
+	float ml;					//load torque, updated by the load model
 	float v_alpha;				//alpha axis voltage in Volts
 	float v_beta; 				//beta axis voltage in Volts
 	float va;					//phase a voltage in Volts
@@ -67,6 +68,7 @@ static volatile float m_curr0_offset_backup;
 static volatile float m_curr1_offset_backup;
 static volatile float m_curr2_offset_backup;
 static volatile mc_configuration *m_conf;
+static vm_load_state m_load;
 
 //private functions
 static void connect_virtual_motor(float ml, float J, float Vbus);
@@ -75,8 +77,15 @@ static inline void run_virtual_motor_electrical(float v_alpha, float v_beta);
 static inline void run_virtual_motor_mechanics(float ml);
 static inline void run_virtual_motor(float v_alpha, float v_beta, float ml);
 static inline void run_virtual_motor_park_clark_inverse( void );
+static void update_inertia(void);
 static void terminal_cmd_connect_virtual_motor(int argc, const char **argv);
 static void terminal_cmd_disconnect_virtual_motor(int argc, const char **argv);
+static void terminal_cmd_virtual_motor_drag(int argc, const char **argv);
+static void terminal_cmd_virtual_motor_cogging(int argc, const char **argv);
+static void terminal_cmd_virtual_motor_backlash(int argc, const char **argv);
+static void terminal_cmd_virtual_motor_vehicle(int argc, const char **argv);
+static void terminal_cmd_virtual_motor_keyframe(int argc, const char **argv);
+static void terminal_cmd_virtual_motor_load(int argc, const char **argv);
 
 //Public Functions
 
@@ -105,6 +114,8 @@ void virtual_motor_init(volatile mc_configuration *conf){
 	virtual_motor.id_int = 0.0;
 	virtual_motor.iq = 0.0;
 
+	vm_load_init(&m_load);
+
 	// Register terminal callbacks used for virtual motor setup
 	terminal_register_command_callback(
 				"connect_virtual_motor",
@@ -117,6 +128,42 @@ void virtual_motor_init(volatile mc_configuration *conf){
 				"disconnect virtual motor",
 				0,
 				terminal_cmd_disconnect_virtual_motor);
+
+	terminal_register_command_callback(
+				"virtual_motor_drag",
+				"sets viscous friction [Nm/(rad/s)] and quadratic drag [Nm/(rad/s)^2] of the virtual motor load",
+				"[viscous][drag]",
+				terminal_cmd_virtual_motor_drag);
+
+	terminal_register_command_callback(
+				"virtual_motor_cogging",
+				"sets sinusoidal cogging torque [Nm] and cogging periods per revolution, 0 disables",
+				"[amplitude][periods]",
+				terminal_cmd_virtual_motor_cogging);
+
+	terminal_register_command_callback(
+				"virtual_motor_backlash",
+				"couples a load inertia [Nm*s^2] through backlash [deg], stiffness [Nm/rad] and damping [Nm/(rad/s)]",
+				"[backlash][stiffness][damping][J_load]",
+				terminal_cmd_virtual_motor_backlash);
+
+	terminal_register_command_callback(
+				"virtual_motor_vehicle",
+				"drives a vehicle with mass [kg], wheel radius [m], gear ratio and rolling resistance, 0 mass disables",
+				"[mass][radius][ratio][crr]",
+				terminal_cmd_virtual_motor_vehicle);
+
+	terminal_register_command_callback(
+				"virtual_motor_keyframe",
+				"queues a ramp of the load torque [Nm] and slope [deg] over duration [s]",
+				"[duration][ml][slope]",
+				terminal_cmd_virtual_motor_keyframe);
+
+	terminal_register_command_callback(
+				"virtual_motor_load",
+				"prints the virtual motor load state",
+				0,
+				terminal_cmd_virtual_motor_load);
 }
 
 void virtual_motor_set_configuration(volatile mc_configuration *conf){
@@ -142,6 +189,10 @@ void virtual_motor_set_configuration(volatile mc_configuration *conf){
 		virtual_motor.lq = m_conf->foc_motor_l ;
 		virtual_motor.ld = m_conf->foc_motor_l ;
 	}
+
+	if(virtual_motor.connected){
+		update_inertia();
+	}
 }
 
 /**
@@ -149,6 +200,7 @@ void virtual_motor_set_configuration(volatile mc_configuration *conf){
  */
 void virtual_motor_int_handler(float v_alpha, float v_beta){
 	if(virtual_motor.connected){
+		virtual_motor.ml = vm_load_update(&m_load, virtual_motor.we, virtual_motor.Ts);
 		run_virtual_motor(v_alpha, v_beta, virtual_motor.ml );
 		mcpwm_foc_adc_int_handler( NULL, 0);
 	}
@@ -162,6 +214,22 @@ float virtual_motor_get_angle_deg(void){
 	return RAD2DEG_f(virtual_motor.phi);
 }
 
+/**
+ * Queue a load keyframe, e.g. to stream a load profile while running
+ *
+ * @param duration: time to ramp to the keyframe in s
+ * @param ml: constant load torque at the keyframe in Nm
+ * @param slope: road slope at the keyframe in degrees
+ * @return false if the keyframe queue is full
+ */
+bool virtual_motor_push_load_keyframe(float duration, float ml, float slope){
+	return vm_load_push_keyframe(&m_load, duration, ml, slope);
+}
+
+void virtual_motor_clear_load_keyframes(void){
+	vm_load_clear_keyframes(&m_load);
+}
+
 //Private Functions
 
 /**
@@ -234,8 +302,9 @@ static void connect_virtual_motor(float ml , float J, float Vbus){
 	//initialize constants
 	virtual_motor.v_max_adc = Vbus;
 	virtual_motor.J = J;
-	virtual_motor.tsj = virtual_motor.Ts / virtual_motor.J;
 	virtual_motor.ml = ml;
+	vm_load_set_torque(&m_load, ml);
+	update_inertia();
 
 	virtual_motor.connected = true;
 }
@@ -410,6 +479,13 @@ static inline void run_virtual_motor_park_clark_inverse( void ){
 	ADC_Value[ ADC_IND_SENS3 ] = virtual_motor.vc * VOLTAGE_TO_ADC_FACTOR + 2048;
 }
 
+/**
+ * Add the inertia that is rigidly coupled by the load model to the rotor inertia
+ */
+static void update_inertia(void){
+	virtual_motor.tsj = virtual_motor.Ts / (virtual_motor.J + vm_load_get_inertia(&m_load));
+}
+
 /**
  * connect_virtual_motor command
  */
@@ -442,3 +518,131 @@ static void terminal_cmd_disconnect_virtual_motor(int argc, const char **argv) {
 	commands_printf("virtual motor disconnected");
 	commands_printf(" ");
 }
+
+/**
+ * virtual_motor_drag command
+ */
+static void terminal_cmd_virtual_motor_drag(int argc, const char **argv) {
+	if( argc == 3 ){
+		float viscous = 0.0;
+		float drag = 0.0;
+
+		sscanf(argv[1], "%f", &viscous);
+		sscanf(argv[2], "%f", &drag);
+
+		vm_load_set_drag(&m_load, viscous, drag);
+		commands_printf("virtual motor drag set");
+	}
+	else{
+		commands_printf("arguments should be 2" );
+	}
+}
+
+/**
+ * virtual_motor_cogging command
+ */
+static void terminal_cmd_virtual_motor_cogging(int argc, const char **argv) {
+	if( argc == 3 ){
+		float amplitude = 0.0;
+		float periods = 0.0;
+
+		sscanf(argv[1], "%f", &amplitude);
+		sscanf(argv[2], "%f", &periods);
+
+		vm_load_set_cogging(&m_load, amplitude, periods);
+		commands_printf("virtual motor cogging set");
+	}
+	else{
+		commands_printf("arguments should be 2" );
+	}
+}
+
+/**
+ * virtual_motor_backlash command
+ */
+static void terminal_cmd_virtual_motor_backlash(int argc, const char **argv) {
+	if( argc == 5 ){
+		float backlash = 0.0;
+		float stiffness = 0.0;
+		float damping = 0.0;
+		float J_load = 0.0;
+
+		sscanf(argv[1], "%f", &backlash);
+		sscanf(argv[2], "%f", &stiffness);
+		sscanf(argv[3], "%f", &damping);
+		sscanf(argv[4], "%f", &J_load);
+
+		vm_load_set_backlash(&m_load, DEG2RAD_f(backlash), stiffness, damping, J_load);
+		update_inertia();
+		commands_printf("virtual motor backlash set");
+	}
+	else{
+		commands_printf("arguments should be 4" );
+	}
+}
+
+/**
+ * virtual_motor_vehicle command
+ */
+static void terminal_cmd_virtual_motor_vehicle(int argc, const char **argv) {
+	if( argc == 5 ){
+		float mass = 0.0;
+		float radius = 0.0;
+		float ratio = 1.0;
+		float crr = 0.0;
+
+		sscanf(argv[1], "%f", &mass);
+		sscanf(argv[2], "%f", &radius);
+		sscanf(argv[3], "%f", &ratio);
+		sscanf(argv[4], "%f", &crr);
+
+		vm_load_set_vehicle(&m_load, mass, radius, ratio, crr);
+		update_inertia();
+		commands_printf("virtual motor vehicle set");
+	}
+	else{
+		commands_printf("arguments should be 4" );
+	}
+}
+
+/**
+ * virtual_motor_keyframe command
+ */
+static void terminal_cmd_virtual_motor_keyframe(int argc, const char **argv) {
+	if( argc == 4 ){
+		float duration = 0.0;
+		float ml = 0.0;
+		float slope = 0.0;
+
+		sscanf(argv[1], "%f", &duration);
+		sscanf(argv[2], "%f", &ml);
+		sscanf(argv[3], "%f", &slope);
+
+		if(vm_load_push_keyframe(&m_load, duration, ml, slope)){
+			commands_printf("keyframe queued, %d in queue", vm_load_keyframes_queued(&m_load));
+		}else{
+			commands_printf("keyframe queue full");
+		}
+	}
+	else{
+		commands_printf("arguments should be 3" );
+	}
+}
+
+/**
+ * virtual_motor_load command
+ */
+static void terminal_cmd_virtual_motor_load(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	commands_printf("load torque    : %.4f Nm", (double)virtual_motor.ml);
+	commands_printf("constant torque: %.4f Nm", (double)m_load.torque);
+	commands_printf("shaft torque   : %.4f Nm", (double)m_load.torque_shaft);
+	commands_printf("slope          : %.2f deg", (double)m_load.slope);
+	commands_printf("motor speed    : %.2f rad/s", (double)virtual_motor.we);
+	commands_printf("load speed     : %.2f rad/s", (double)m_load.w_load);
+	commands_printf("inertia        : %.6f Nm*s^2", (double)(virtual_motor.J + vm_load_get_inertia(&m_load)));
+	commands_printf("keyframes      : %d", vm_load_keyframes_queued(&m_load));
+	commands_printf(" ");
+}
@@ -28,4 +28,6 @@ void virtual_motor_set_configuration(volatile mc_configuration *conf);
 void virtual_motor_int_handler(float v_alpha, float v_beta);
 bool virtual_motor_is_connected(void);
 float virtual_motor_get_angle_deg(void);
+bool virtual_motor_push_load_keyframe(float duration, float ml, float slope);
+void virtual_motor_clear_load_keyframes(void);
 #endif /* VIRTUAL_MOTOR_H_ */
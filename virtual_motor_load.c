@@ -0,0 +1,333 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "virtual_motor_load.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Load models for the virtual motor. Everything is expressed at the motor
+ * shaft: angles in rad, speeds in rad/s and torques in Nm. The load torque
+ * returned by vm_load_update is the sum of
+ *
+ * - A constant torque.
+ * - Viscous friction and quadratic (aerodynamic) drag.
+ * - Cogging from a table over one cogging period.
+ * - A vehicle with rolling resistance on a slope, reflected through the wheel
+ *   radius and the gear ratio.
+ *
+ * With a rigid coupling the load inertia and the reflected vehicle mass are
+ * added to the rotor inertia, see vm_load_get_inertia. With backlash, the load
+ * side is simulated separately and connected to the motor with a spring and
+ * damper that only transfer torque outside of the backlash. The spring must be
+ * soft enough for the sample time: dt * sqrt(stiffness / inertia) well below 1.
+ *
+ * The constant torque and the slope can be scripted with keyframes that are
+ * ramped to one by one, and new keyframes can be streamed while the script runs.
+ */
+
+// Speed below which coulomb friction is ramped down, to avoid chatter at standstill
+#define COULOMB_RAMP_SPEED			0.5
+
+// Private functions
+static void script_update(vm_load_state *l, float dt);
+static float external_torque(vm_load_state *l, float w);
+static float cogging_torque(vm_load_state *l);
+
+void vm_load_init(vm_load_state *l) {
+	memset(l, 0, sizeof(vm_load_state));
+	l->r_eff = 1.0;
+	l->slope_cos = 1.0;
+}
+
+void vm_load_set_torque(vm_load_state *l, float torque) {
+	l->torque = torque;
+}
+
+void vm_load_set_drag(vm_load_state *l, float viscous, float drag) {
+	l->viscous = viscous;
+	l->drag = drag;
+}
+
+/**
+ * Use a sinusoidal cogging torque.
+ *
+ * @param amplitude
+ * Peak cogging torque in Nm.
+ *
+ * @param periods
+ * Cogging periods per revolution, e.g. the least common multiple of the slot
+ * and pole count. 0 disables cogging.
+ */
+void vm_load_set_cogging(vm_load_state *l, float amplitude, float periods) {
+	for (int i = 0;i < VM_LOAD_COGGING_TABLE;i++) {
+		l->cogging[i] = amplitude * sinf(2.0 * M_PI * (float)i / (float)VM_LOAD_COGGING_TABLE);
+	}
+	l->cogging_periods = periods;
+}
+
+/**
+ * Use a measured cogging torque table. The table is resampled to
+ * VM_LOAD_COGGING_TABLE points.
+ *
+ * @param table
+ * Cogging torque in Nm over one cogging period.
+ *
+ * @param len
+ * Number of points in the table.
+ *
+ * @param periods
+ * Cogging periods per revolution. 0 disables cogging.
+ */
+void vm_load_set_cogging_table(vm_load_state *l, const float *table, int len, float periods) {
+	if (len <= 0) {
+		l->cogging_periods = 0.0;
+		return;
+	}
+
+	for (int i = 0;i < VM_LOAD_COGGING_TABLE;i++) {
+		float pos = (float)i * (float)len / (float)VM_LOAD_COGGING_TABLE;
+		int ind = (int)pos;
+		float frac = pos - (float)ind;
+		l->cogging[i] = table[ind] + (table[(ind + 1) % len] - table[ind]) * frac;
+	}
+	l->cogging_periods = periods;
+}
+
+/**
+ * Couple the load to the motor through a spring and damper with backlash.
+ *
+ * @param backlash
+ * Total backlash in rad at the motor shaft.
+ *
+ * @param stiffness
+ * Coupling stiffness in Nm/rad. 0 gives a rigid coupling without backlash.
+ *
+ * @param damping
+ * Coupling damping in Nm/(rad/s).
+ *
+ * @param inertia
+ * Load inertia at the motor shaft in Nm*s^2.
+ */
+void vm_load_set_backlash(vm_load_state *l, float backlash, float stiffness, float damping, float inertia) {
+	l->backlash = fabsf(backlash);
+	l->stiffness = stiffness;
+	l->damping = damping;
+	l->inertia_load = inertia;
+
+	// The load side needs inertia to be simulated separately
+	const float inertia_side = l->inertia_load + l->mass * l->r_eff * l->r_eff;
+	bool compliant = stiffness > 0.0 && inertia_side > 0.0;
+
+	if (compliant && !l->compliant) {
+		l->delta = 0.0;
+	}
+
+	l->compliant = compliant;
+}
+
+/**
+ * Drive a vehicle. Its mass is reflected to the motor shaft as inertia.
+ *
+ * @param mass
+ * Vehicle mass in kg. 0 disables the vehicle.
+ *
+ * @param wheel_radius
+ * Wheel radius in m.
+ *
+ * @param gear_ratio
+ * Motor revolutions per wheel revolution.
+ *
+ * @param crr
+ * Rolling resistance coefficient.
+ */
+void vm_load_set_vehicle(vm_load_state *l, float mass, float wheel_radius, float gear_ratio, float crr) {
+	l->mass = mass;
+	l->r_eff = gear_ratio > 0.0 ? wheel_radius / gear_ratio : wheel_radius;
+	l->crr = crr;
+	vm_load_set_backlash(l, l->backlash, l->stiffness, l->damping, l->inertia_load);
+}
+
+void vm_load_set_slope(vm_load_state *l, float slope) {
+	l->slope = slope;
+	l->slope_sin = sinf(slope * (float)M_PI / 180.0);
+	l->slope_cos = cosf(slope * (float)M_PI / 180.0);
+}
+
+/**
+ * Queue a keyframe. The constant torque and the slope are ramped from their
+ * values at the previous keyframe to the values of this keyframe over its
+ * duration.
+ *
+ * @return
+ * false if the queue is full.
+ */
+bool vm_load_push_keyframe(vm_load_state *l, float duration, float torque, float slope) {
+	int next = (l->kf_write + 1) % VM_LOAD_KEYFRAMES;
+	if (next == l->kf_read) {
+		return false;
+	}
+
+	l->kf[l->kf_write].duration = duration;
+	l->kf[l->kf_write].torque = torque;
+	l->kf[l->kf_write].slope = slope;
+	l->kf_write = next;
+
+	return true;
+}
+
+void vm_load_clear_keyframes(vm_load_state *l) {
+	l->kf_read = l->kf_write;
+}
+
+int vm_load_keyframes_queued(vm_load_state *l) {
+	int res = l->kf_write - l->kf_read;
+	if (res < 0) {
+		res += VM_LOAD_KEYFRAMES;
+	}
+	return res;
+}
+
+/**
+ * Inertia that is rigidly connected to the motor shaft, to be added to the
+ * rotor inertia.
+ */
+float vm_load_get_inertia(vm_load_state *l) {
+	if (l->compliant) {
+		return 0.0;
+	}
+
+	return l->inertia_load + l->mass * l->r_eff * l->r_eff;
+}
+
+/**
+ * Run one step of the load model.
+ *
+ * @param w
+ * Motor shaft speed in rad/s.
+ *
+ * @param dt
+ * Time step in s.
+ *
+ * @return
+ * Load torque at the motor shaft in Nm.
+ */
+float vm_load_update(vm_load_state *l, float w, float dt) {
+	script_update(l, dt);
+	l->time += dt;
+
+	l->theta += w * dt;
+	if (l->theta > (2.0 * M_PI)) {
+		l->theta -= 2.0 * M_PI;
+	} else if (l->theta < 0.0) {
+		l->theta += 2.0 * M_PI;
+	}
+
+	float res = cogging_torque(l);
+
+	if (l->compliant) {
+		l->delta += (w - l->w_load) * dt;
+
+		const float half = 0.5 * l->backlash;
+		float tc = 0.0;
+		if (l->delta > half) {
+			tc = l->stiffness * (l->delta - half) + l->damping * (w - l->w_load);
+			if (tc < 0.0) {
+				tc = 0.0;
+			}
+		} else if (l->delta < -half) {
+			tc = l->stiffness * (l->delta + half) + l->damping * (w - l->w_load);
+			if (tc > 0.0) {
+				tc = 0.0;
+			}
+		}
+
+		const float inertia = l->inertia_load + l->mass * l->r_eff * l->r_eff;
+		l->w_load += (tc - external_torque(l, l->w_load)) * dt / inertia;
+		l->torque_shaft = tc;
+		res += tc;
+	} else {
+		l->w_load = w;
+		l->torque_shaft = external_torque(l, w);
+		res += l->torque_shaft;
+	}
+
+	return res;
+}
+
+static void script_update(vm_load_state *l, float dt) {
+	if (l->kf_read == l->kf_write) {
+		l->seg_time = 0.0;
+		l->seg_torque = l->torque;
+		l->seg_slope = l->slope;
+		return;
+	}
+
+	const vm_load_keyframe *kf = &l->kf[l->kf_read];
+	l->seg_time += dt;
+
+	if (l->seg_time >= kf->duration) {
+		l->torque = kf->torque;
+		vm_load_set_slope(l, kf->slope);
+		l->seg_time = 0.0;
+		l->seg_torque = l->torque;
+		l->seg_slope = l->slope;
+		l->kf_read = (l->kf_read + 1) % VM_LOAD_KEYFRAMES;
+	} else {
+		float ratio = l->seg_time / kf->duration;
+		l->torque = l->seg_torque + (kf->torque - l->seg_torque) * ratio;
+		vm_load_set_slope(l, l->seg_slope + (kf->slope - l->seg_slope) * ratio);
+	}
+}
+
+static float external_torque(vm_load_state *l, float w) {
+	float res = l->torque + l->viscous * w + l->drag * w * fabsf(w);
+
+	if (l->mass > 0.0) {
+		float coulomb = w / COULOMB_RAMP_SPEED;
+		if (coulomb > 1.0) {
+			coulomb = 1.0;
+		} else if (coulomb < -1.0) {
+			coulomb = -1.0;
+		}
+
+		const float weight = l->mass * 9.81;
+		res += weight * (l->slope_sin + l->crr * l->slope_cos * coulomb) * l->r_eff;
+	}
+
+	return res;
+}
+
+static float cogging_torque(vm_load_state *l) {
+	if (l->cogging_periods <= 0.0) {
+		return 0.0;
+	}
+
+	float pos = l->theta * l->cogging_periods * (float)VM_LOAD_COGGING_TABLE / (2.0 * M_PI);
+	pos = fmodf(pos, (float)VM_LOAD_COGGING_TABLE);
+	int ind = (int)pos;
+	float frac = pos - (float)ind;
+
+	if (ind >= VM_LOAD_COGGING_TABLE) {
+		ind = 0;
+	}
+
+	return l->cogging[ind] + (l->cogging[(ind + 1) % VM_LOAD_COGGING_TABLE] - l->cogging[ind]) * frac;
+}
@@ -0,0 +1,93 @@
+/*
+	Copyright 2022 Benjamin Vedder	benjamin@vedder.se
+
+	This file is part of the VESC firmware.
+
+	The VESC firmware is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    The VESC firmware is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef VIRTUAL_MOTOR_LOAD_H_
+#define VIRTUAL_MOTOR_LOAD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of points in one period of the cogging torque table
+#define VM_LOAD_COGGING_TABLE		64
+// Number of keyframes that can be queued when scripting the load
+#define VM_LOAD_KEYFRAMES			32
+
+typedef struct {
+	float duration;			// Time to ramp to this keyframe in s
+	float torque;			// Constant load torque in Nm
+	float slope;			// Road slope in degrees
+} vm_load_keyframe;
+
+typedef struct {
+	// Constant and speed-dependent load
+	float torque;			// Constant load torque in Nm
+	float viscous;			// Viscous friction in Nm/(rad/s)
+	float drag;				// Quadratic (aerodynamic) drag in Nm/(rad/s)^2
+
+	// Cogging
+	float cogging[VM_LOAD_COGGING_TABLE];
+	float cogging_periods;	// Cogging periods per revolution, 0 to disable
+
+	// Vehicle on a slope
+	float mass;				// Vehicle mass in kg, 0 to disable
+	float r_eff;			// Wheel radius divided by gear ratio in m
+	float crr;				// Rolling resistance coefficient
+	float slope;			// Road slope in degrees
+	float slope_sin;
+	float slope_cos;
+
+	// Compliant coupling with backlash between motor and load
+	float backlash;			// Total backlash in rad at the motor shaft, 0 for a rigid coupling
+	float stiffness;		// Coupling stiffness in Nm/rad
+	float damping;			// Coupling damping in Nm/(rad/s)
+	float inertia_load;		// Load inertia at the motor shaft in Nm*s^2, excluding the vehicle
+	bool compliant;
+
+	// State
+	float time;				// Time since init in s
+	float theta;			// Motor shaft angle in rad
+	float delta;			// Motor angle minus load angle in rad
+	float w_load;			// Load speed at the motor shaft in rad/s
+	float torque_shaft;		// Torque transmitted through the coupling in Nm
+
+	// Script
+	vm_load_keyframe kf[VM_LOAD_KEYFRAMES];
+	volatile int kf_read;
+	volatile int kf_write;
+	float seg_time;
+	float seg_torque;
+	float seg_slope;
+} vm_load_state;
+
+// Functions
+void vm_load_init(vm_load_state *l);
+void vm_load_set_torque(vm_load_state *l, float torque);
+void vm_load_set_drag(vm_load_state *l, float viscous, float drag);
+void vm_load_set_cogging(vm_load_state *l, float amplitude, float periods);
+void vm_load_set_cogging_table(vm_load_state *l, const float *table, int len, float periods);
+void vm_load_set_backlash(vm_load_state *l, float backlash, float stiffness, float damping, float inertia);
+void vm_load_set_vehicle(vm_load_state *l, float mass, float wheel_radius, float gear_ratio, float crr);
+void vm_load_set_slope(vm_load_state *l, float slope);
+bool vm_load_push_keyframe(vm_load_state *l, float duration, float torque, float slope);
+void vm_load_clear_keyframes(vm_load_state *l);
+int vm_load_keyframes_queued(vm_load_state *l);
+float vm_load_get_inertia(vm_load_state *l);
+float vm_load_update(vm_load_state *l, float w, float dt);
+
+#endif /* VIRTUAL_MOTOR_LOAD_H_ */